@@ -0,0 +1,97 @@
+// Commit throughput of LayeredStorage::MergeTempStorage for transactions of 1, 100 and 10k
+// records. BM_CommitRocksDBPerKey replays the same transaction with one Put per record (the
+// pre-WriteBatch merge path) as a baseline for BM_CommitRocksDB.
+
+#include <benchmark/benchmark.h>
+
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <random>
+#include <string>
+
+#include "gendb/arena_storage.h"
+#include "gendb/layered_storage.h"
+#include "gendb/storage.h"
+
+namespace gendb {
+namespace {
+
+constexpr size_t kValueSize = 80;  // Roughly one Account record.
+
+class ScopedRocksDB {
+ public:
+  ScopedRocksDB()
+      : _path(std::filesystem::temp_directory_path() /
+              ("gendb_commit_bench_" + std::to_string(std::random_device{}()))),
+        _storage(std::make_unique<RocksDBStorage>(_path.string())) {}
+  ~ScopedRocksDB() {
+    _storage.reset();
+    std::filesystem::remove_all(_path);
+  }
+
+  RocksDBStorage& storage() { return *_storage; }
+
+ private:
+  std::filesystem::path _path;
+  std::unique_ptr<RocksDBStorage> _storage;
+};
+
+Bytes MakeKey(uint64_t i) {
+  Bytes key(sizeof(i));
+  std::memcpy(key.data(), &i, sizeof(i));
+  return key;
+}
+
+// Stages `records` puts in `temp`, continuing the key sequence across transactions.
+void StageTransaction(MemoryStorage& temp, int64_t records, uint64_t& next_key) {
+  for (int64_t i = 0; i < records; ++i) {
+    temp.Put(0, MakeKey(next_key++), Bytes(kValueSize, 0xAB));
+  }
+}
+
+void RunCommitBenchmark(benchmark::State& state, Storage& storage) {
+  const int64_t records = state.range(0);
+  MemoryStorage temp;
+  LayeredStorage layered(storage, &temp);
+  uint64_t next_key = 0;
+  for (auto _ : state) {
+    StageTransaction(temp, records, next_key);
+    layered.MergeTempStorage();
+  }
+  state.SetItemsProcessed(state.iterations() * records);
+}
+
+void BM_CommitRocksDB(benchmark::State& state) {
+  ScopedRocksDB db;
+  RunCommitBenchmark(state, db.storage());
+}
+
+void BM_CommitRocksDBPerKey(benchmark::State& state) {
+  ScopedRocksDB db;
+  const int64_t records = state.range(0);
+  MemoryStorage temp;
+  uint64_t next_key = 0;
+  for (auto _ : state) {
+    StageTransaction(temp, records, next_key);
+    for (auto& [key, value] : temp.collections[0]) {
+      db.storage().Put(0, key, std::move(value));
+    }
+    temp.collections[0].clear();
+  }
+  state.SetItemsProcessed(state.iterations() * records);
+}
+
+void BM_CommitArena(benchmark::State& state) {
+  ArenaStorage storage;
+  RunCommitBenchmark(state, storage);
+}
+
+BENCHMARK(BM_CommitRocksDB)->Arg(1)->Arg(100)->Arg(10'000);
+BENCHMARK(BM_CommitRocksDBPerKey)->Arg(1)->Arg(100)->Arg(10'000);
+BENCHMARK(BM_CommitArena)->Arg(1)->Arg(100)->Arg(10'000);
+
+}  // namespace
+}  // namespace gendb
+
+BENCHMARK_MAIN();
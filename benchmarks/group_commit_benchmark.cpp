@@ -0,0 +1,46 @@
+// Commit throughput with 1 to 8 writer threads, each committing one new account per transaction,
+// for the test schema's Db (writers hold the writer mutex for the whole transaction) and for the
+// same collection with commit_mode group (writers run concurrently and their commits are applied
+// in batches). Items are commits, summed over the threads.
+
+#include <benchmark/benchmark.h>
+
+#include <cstdint>
+
+#include "account.fbs.h"
+#include "database.h"
+#include "group_database.h"
+
+namespace gendb::tests {
+namespace {
+
+template <typename DbT>
+void RunCommits(benchmark::State& state) {
+  static DbT* db = nullptr;
+  if (state.thread_index() == 0) {
+    db = new DbT();
+  }
+  uint64_t id = static_cast<uint64_t>(state.thread_index()) << 32;
+  for (auto _ : state) {
+    auto writer = db->CreateWriter();
+    (void)writer.PutAccount(id, AccountBuilder().set_account_id(id).set_balance(1).Build());
+    writer.Commit();
+    ++id;
+  }
+  state.SetItemsProcessed(state.iterations());
+  if (state.thread_index() == 0) {
+    delete db;
+  }
+}
+
+void BM_LockedCommits(benchmark::State& state) { RunCommits<Db>(state); }
+
+void BM_GroupCommits(benchmark::State& state) { RunCommits<group::Db>(state); }
+
+BENCHMARK(BM_LockedCommits)->ThreadRange(1, 8)->UseRealTime();
+BENCHMARK(BM_GroupCommits)->ThreadRange(1, 8)->UseRealTime();
+
+}  // namespace
+}  // namespace gendb::tests
+
+BENCHMARK_MAIN();
@@ -0,0 +1,124 @@
+// Read-modify-write transactions with 1 to 8 writer threads and a varying overlap ratio, for the
+// test schema's Db (writers hold the writer mutex for the whole transaction) and for the same
+// collection with commit_mode optimistic (writers run concurrently and retry aborted commits).
+// Each transaction reads kReadsPerTransaction accounts and increments the balance of the last one.
+// With probability overlap_pct% it picks them among kHotAccounts shared by every thread, otherwise
+// among accounts of its own thread. Items are committed transactions, summed over the threads;
+// the aborts counter is the number of aborted commits per committed transaction.
+
+#include <benchmark/benchmark.h>
+
+#include <array>
+#include <cstdint>
+#include <random>
+#include <span>
+
+#include "account.fbs.h"
+#include "database.h"
+#include "optimistic_database.h"
+
+namespace gendb::tests {
+namespace {
+
+constexpr uint64_t kHotAccounts = 16;
+constexpr uint64_t kAccountsPerThread = 1024;
+constexpr size_t kReadsPerTransaction = 4;
+
+uint64_t OwnAccountId(int thread, uint64_t i) {
+  return (static_cast<uint64_t>(thread + 1) << 32) + i;
+}
+
+bool TryCommit(ScopedWrite& writer) {
+  writer.Commit();
+  return true;
+}
+
+bool TryCommit(optimistic::ScopedWrite& writer) { return writer.Commit().ok(); }
+
+template <typename DbT>
+void Populate(DbT& db, int threads) {
+  auto writer = db.CreateWriter();
+  auto put = [&](uint64_t id) {
+    (void)writer.PutAccount(id, AccountBuilder().set_account_id(id).set_balance(0).Build());
+  };
+  for (uint64_t id = 0; id < kHotAccounts; ++id) {
+    put(id);
+  }
+  for (int thread = 0; thread < threads; ++thread) {
+    for (uint64_t i = 0; i < kAccountsPerThread; ++i) {
+      put(OwnAccountId(thread, i));
+    }
+  }
+  (void)TryCommit(writer);
+}
+
+// False if the commit was aborted.
+template <typename DbT>
+bool RunTransaction(DbT& db, std::span<const uint64_t> ids) {
+  auto writer = db.CreateWriter();
+  Account account;
+  for (uint64_t id : ids) {
+    (void)writer.GetAccount(id, account);
+  }
+  (void)writer.UpdateAccount(ids.back(),
+                             AccountPatchBuilder().set_balance(account.balance() + 1).Build());
+  return TryCommit(writer);
+}
+
+template <typename DbT>
+void RunTransactions(benchmark::State& state) {
+  static DbT* db = nullptr;
+  if (state.thread_index() == 0) {
+    db = new DbT();
+    Populate(*db, state.threads());
+  }
+  std::mt19937_64 rng(state.thread_index());
+  std::uniform_int_distribution<int64_t> percent(0, 99);
+  std::uniform_int_distribution<uint64_t> hot(0, kHotAccounts - 1);
+  std::uniform_int_distribution<uint64_t> own(0, kAccountsPerThread - 1);
+  std::array<uint64_t, kReadsPerTransaction> ids;
+  int64_t aborts = 0;
+  for (auto _ : state) {
+    const bool shared = percent(rng) < state.range(0);
+    for (uint64_t& id : ids) {
+      id = shared ? hot(rng) : OwnAccountId(state.thread_index(), own(rng));
+    }
+    while (!RunTransaction(*db, ids)) {
+      ++aborts;
+    }
+  }
+  state.SetItemsProcessed(state.iterations());
+  state.counters["aborts"] =
+      benchmark::Counter(static_cast<double>(aborts), benchmark::Counter::kAvgIterations);
+  if (state.thread_index() == 0) {
+    delete db;
+  }
+}
+
+void BM_LockedTransactions(benchmark::State& state) { RunTransactions<Db>(state); }
+
+void BM_OptimisticTransactions(benchmark::State& state) {
+  RunTransactions<optimistic::Db>(state);
+}
+
+BENCHMARK(BM_LockedTransactions)
+    ->ArgName("overlap_pct")
+    ->Arg(0)
+    ->Arg(10)
+    ->Arg(50)
+    ->Arg(100)
+    ->ThreadRange(1, 8)
+    ->UseRealTime();
+BENCHMARK(BM_OptimisticTransactions)
+    ->ArgName("overlap_pct")
+    ->Arg(0)
+    ->Arg(10)
+    ->Arg(50)
+    ->Arg(100)
+    ->ThreadRange(1, 8)
+    ->UseRealTime();
+
+}  // namespace
+}  // namespace gendb::tests
+
+BENCHMARK_MAIN();
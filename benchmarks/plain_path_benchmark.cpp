@@ -0,0 +1,84 @@
+// Read and commit path of the test schema's Db opened without a WAL, checkpoint, snapshot,
+// change subscriber or async commit: what a schema and caller that use none of these pay for
+// them. The benchmarks only use the API of the original Db, so this file also builds against
+// it, to compare both.
+//
+// BM_GuardPointRead is one Db::SharedLock() plus GetAccount; BM_GuardPointReads reads `range`
+// accounts under one guard. BM_Commit puts `range` accounts in one ScopedWrite and commits it,
+// over a Db of kAccounts accounts.
+
+#include <benchmark/benchmark.h>
+
+#include <cstdint>
+#include <vector>
+
+#include "account.fbs.h"
+#include "database.h"
+
+namespace gendb::tests {
+namespace {
+
+constexpr uint64_t kAccounts = 10'000;
+
+void FillAccounts(Db& db) {
+  auto writer = db.CreateWriter();
+  for (uint64_t id = 0; id < kAccounts; ++id) {
+    (void)writer.PutAccount(id, AccountBuilder().set_account_id(id).set_balance(0).Build());
+  }
+  writer.Commit();
+}
+
+void BM_GuardPointRead(benchmark::State& state) {
+  Db db;
+  FillAccounts(db);
+  uint64_t id = 0;
+  for (auto _ : state) {
+    auto guard = db.SharedLock();
+    Account account;
+    benchmark::DoNotOptimize(guard.GetAccount(id, account));
+    benchmark::DoNotOptimize(account);
+    id = (id + 7919) % kAccounts;
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+void BM_GuardPointReads(benchmark::State& state) {
+  Db db;
+  FillAccounts(db);
+  uint64_t id = 0;
+  for (auto _ : state) {
+    auto guard = db.SharedLock();
+    for (int64_t i = 0; i < state.range(0); ++i) {
+      Account account;
+      benchmark::DoNotOptimize(guard.GetAccount(id, account));
+      benchmark::DoNotOptimize(account);
+      id = (id + 7919) % kAccounts;
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+void BM_Commit(benchmark::State& state) {
+  Db db;
+  FillAccounts(db);
+  const std::vector<uint8_t> account = AccountBuilder().set_balance(1).Build();
+  uint64_t id = 0;
+  for (auto _ : state) {
+    auto writer = db.CreateWriter();
+    for (int64_t i = 0; i < state.range(0); ++i) {
+      (void)writer.PutAccount(id, account);
+      id = (id + 7919) % kAccounts;
+    }
+    writer.Commit();
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+BENCHMARK(BM_GuardPointRead);
+BENCHMARK(BM_GuardPointReads)->Arg(100);
+BENCHMARK(BM_Commit)->Arg(1)->Arg(100);
+
+}  // namespace
+}  // namespace gendb::tests
+
+BENCHMARK_MAIN();
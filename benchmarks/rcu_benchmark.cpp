@@ -0,0 +1,98 @@
+// Guard::GetAccount latency while a background writer keeps committing transactions of range(0)
+// account updates, for the test schema's Db (commits hold the reader lock exclusively) and for
+// the same collection with commit_mode rcu (commits publish a new state with one atomic swap).
+// Each iteration is one SharedLock() plus GetAccount; `p50_ns` and `p99_ns` are percentiles of
+// those reads and `commits` the writer's commit rate. With the locked mode the p99 grows with the
+// transaction size; with rcu it should not.
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "account.fbs.h"
+#include "database.h"
+#include "rcu_database.h"
+
+namespace gendb::tests {
+namespace {
+
+constexpr uint64_t kAccounts = 10'000;
+
+template <typename DbT>
+void FillDb(DbT& db) {
+  auto writer = db.CreateWriter();
+  for (uint64_t id = 0; id < kAccounts; ++id) {
+    (void)writer.PutAccount(id, AccountBuilder().set_account_id(id).set_balance(0).Build());
+  }
+  writer.Commit();
+}
+
+template <typename DbT>
+void RunReadsDuringCommits(benchmark::State& state) {
+  DbT db;
+  FillDb(db);
+  const uint64_t commit_size = static_cast<uint64_t>(state.range(0));
+  std::atomic<bool> stop = false;
+  std::atomic<int64_t> commits = 0;
+  std::thread writer_thread([&] {
+    uint64_t next_id = 0;
+    while (!stop.load(std::memory_order_relaxed)) {
+      auto writer = db.CreateWriter();
+      for (uint64_t i = 0; i < commit_size; ++i) {
+        const uint64_t id = next_id++ % kAccounts;
+        (void)writer.UpdateAccount(
+            id, AccountPatchBuilder().set_balance(static_cast<float>(next_id)).Build());
+      }
+      writer.Commit();
+      commits.fetch_add(1, std::memory_order_relaxed);
+    }
+  });
+
+  std::vector<int64_t> latencies;
+  latencies.reserve(1 << 20);
+  uint64_t id = 0;
+  for (auto _ : state) {
+    const auto start = std::chrono::steady_clock::now();
+    {
+      auto guard = db.SharedLock();
+      Account account;
+      benchmark::DoNotOptimize(guard.GetAccount(id, account));
+      benchmark::DoNotOptimize(account);
+    }
+    latencies.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                            std::chrono::steady_clock::now() - start)
+                            .count());
+    id = (id + 7919) % kAccounts;
+  }
+
+  stop = true;
+  writer_thread.join();
+  std::sort(latencies.begin(), latencies.end());
+  auto percentile = [&](double p) {
+    return static_cast<double>(latencies[static_cast<size_t>(p * (latencies.size() - 1))]);
+  };
+  state.counters["p50_ns"] = percentile(0.5);
+  state.counters["p99_ns"] = percentile(0.99);
+  state.counters["commits"] =
+      benchmark::Counter(static_cast<double>(commits.load()), benchmark::Counter::kIsRate);
+}
+
+void BM_GetAccountDuringLockedCommits(benchmark::State& state) {
+  RunReadsDuringCommits<Db>(state);
+}
+
+void BM_GetAccountDuringRcuCommits(benchmark::State& state) {
+  RunReadsDuringCommits<rcu::Db>(state);
+}
+
+BENCHMARK(BM_GetAccountDuringLockedCommits)->Arg(1)->Arg(100)->Arg(10'000)->UseRealTime();
+BENCHMARK(BM_GetAccountDuringRcuCommits)->Arg(1)->Arg(100)->Arg(10'000)->UseRealTime();
+
+}  // namespace
+}  // namespace gendb::tests
+
+BENCHMARK_MAIN();
@@ -0,0 +1,118 @@
+// Point-read throughput from 1 thread to one per hardware thread, with no writer. The lock-only
+// benchmarks take a shared lock and read one value, through a std::shared_mutex, whose reader
+// count every reader writes, and through a gendb::ReaderBiasedMutex, whose readers write their
+// own visible readers slot. BM_DbPointReads is one Db::SharedLock() plus GetAccount on the test
+// schema's Db, which uses the latter. Items are reads summed over the threads: they should grow
+// with the thread count for the ReaderBiasedMutex and flatten out for the std::shared_mutex.
+//
+// The mixed benchmarks make one operation in kWritePeriod a write, on every thread. Each write
+// revokes the ReaderBiasedMutex's bias, so its readers mostly take the underlying rwlock; they
+// measure that fallback against a std::shared_mutex, and writers must not starve under either.
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+
+#include "account.fbs.h"
+#include "database.h"
+#include "gendb/reader_biased_mutex.h"
+
+namespace gendb::tests {
+namespace {
+
+constexpr uint64_t kAccounts = 10'000;
+
+int MaxThreads() { return static_cast<int>(std::max(1u, std::thread::hardware_concurrency())); }
+
+void BM_SharedMutexReads(benchmark::State& state) {
+  static std::shared_mutex mutex;
+  static int64_t value = 0;
+  for (auto _ : state) {
+    std::shared_lock lock(mutex);
+    benchmark::DoNotOptimize(value);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+void BM_ReaderBiasedMutexReads(benchmark::State& state) {
+  static ReaderBiasedMutex mutex;
+  static int64_t value = 0;
+  for (auto _ : state) {
+    ReaderBiasedMutex::ReadLock lock = mutex.LockShared();
+    benchmark::DoNotOptimize(value);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+constexpr int kWritePeriod = 1000;
+
+void BM_SharedMutexMixed(benchmark::State& state) {
+  static std::shared_mutex mutex;
+  static int64_t value = 0;
+  int i = state.thread_index();
+  for (auto _ : state) {
+    if (++i % kWritePeriod == 0) {
+      std::unique_lock lock(mutex);
+      ++value;
+    } else {
+      std::shared_lock lock(mutex);
+      benchmark::DoNotOptimize(value);
+    }
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+void BM_ReaderBiasedMutexMixed(benchmark::State& state) {
+  static ReaderBiasedMutex mutex;
+  static int64_t value = 0;
+  int i = state.thread_index();
+  for (auto _ : state) {
+    if (++i % kWritePeriod == 0) {
+      std::unique_lock lock(mutex);
+      ++value;
+    } else {
+      ReaderBiasedMutex::ReadLock lock = mutex.LockShared();
+      benchmark::DoNotOptimize(value);
+    }
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+void BM_DbPointReads(benchmark::State& state) {
+  static Db* db = nullptr;
+  if (state.thread_index() == 0) {
+    db = new Db();
+    auto writer = db->CreateWriter();
+    for (uint64_t id = 0; id < kAccounts; ++id) {
+      (void)writer.PutAccount(id, AccountBuilder().set_account_id(id).set_balance(0).Build());
+    }
+    writer.Commit();
+  }
+  uint64_t id = static_cast<uint64_t>(state.thread_index());
+  for (auto _ : state) {
+    auto guard = db->SharedLock();
+    Account account;
+    benchmark::DoNotOptimize(guard.GetAccount(id, account));
+    benchmark::DoNotOptimize(account);
+    id = (id + 7919) % kAccounts;
+  }
+  state.SetItemsProcessed(state.iterations());
+  if (state.thread_index() == 0) {
+    delete db;
+  }
+}
+
+BENCHMARK(BM_SharedMutexReads)->ThreadRange(1, MaxThreads())->UseRealTime();
+BENCHMARK(BM_ReaderBiasedMutexReads)->ThreadRange(1, MaxThreads())->UseRealTime();
+BENCHMARK(BM_SharedMutexMixed)->ThreadRange(1, MaxThreads())->UseRealTime();
+BENCHMARK(BM_ReaderBiasedMutexMixed)->ThreadRange(1, MaxThreads())->UseRealTime();
+BENCHMARK(BM_DbPointReads)->ThreadRange(1, MaxThreads())->UseRealTime();
+
+}  // namespace
+}  // namespace gendb::tests
+
+BENCHMARK_MAIN();
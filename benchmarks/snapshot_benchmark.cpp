@@ -0,0 +1,95 @@
+// Reader and writer throughput of the test schema's Db while both run at once. Every iteration
+// commits one account update, while range(0) background readers repeatedly scan a tenth of the
+// account_by_age index, each scan under its own Guard (BM_CommitWithGuardReaders) or Snapshot
+// (BM_CommitWithSnapshotReaders). items_per_second is the writer's commit rate and `scans` the
+// readers' combined scan rate. A commit waits for every in-flight Guard scan, but at most for one
+// index batch of a Snapshot scan.
+
+#include <benchmark/benchmark.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "account.fbs.h"
+#include "database.h"
+
+namespace gendb::tests {
+namespace {
+
+constexpr uint64_t kAccounts = 10'000;
+constexpr int32_t kAges = 100;
+constexpr int32_t kScannedAges = 10;
+// Pause between a reader's scans. Back-to-back Guard scans can starve the writer indefinitely.
+constexpr auto kThinkTime = std::chrono::microseconds(100);
+
+void FillDb(Db& db) {
+  auto writer = db.CreateWriter();
+  for (uint64_t id = 0; id < kAccounts; ++id) {
+    const int32_t age = static_cast<int32_t>(id % kAges);
+    (void)writer.PutAccount(id, AccountBuilder().set_account_id(id).set_age(age).Build());
+  }
+  writer.Commit();
+}
+
+template <typename Reader>
+int64_t ScanAges(const Reader& reader) {
+  int64_t balance = 0;
+  for (auto it = reader.GetAccountByAgeRange(0, kScannedAges); it.Valid(); it.Next()) {
+    balance += static_cast<int64_t>(it.Value().balance());
+  }
+  return balance;
+}
+
+template <typename ScanFn>
+void RunContendedCommits(benchmark::State& state, ScanFn scan) {
+  Db db;
+  FillDb(db);
+  std::atomic<bool> stop = false;
+  std::atomic<int64_t> scans = 0;
+  std::vector<std::thread> readers;
+  for (int64_t i = 0; i < state.range(0); ++i) {
+    readers.emplace_back([&] {
+      while (!stop.load(std::memory_order_relaxed)) {
+        benchmark::DoNotOptimize(scan(db));
+        scans.fetch_add(1, std::memory_order_relaxed);
+        std::this_thread::sleep_for(kThinkTime);
+      }
+    });
+  }
+
+  uint64_t next_id = 0;
+  for (auto _ : state) {
+    auto writer = db.CreateWriter();
+    // Updates inside the scanned range, so snapshots keep old versions around.
+    const uint64_t id = (next_id++ * kAges) % kAccounts;
+    (void)writer.UpdateAccount(
+        id, AccountPatchBuilder().set_balance(static_cast<float>(next_id)).Build());
+    writer.Commit();
+  }
+
+  stop = true;
+  for (std::thread& reader : readers) {
+    reader.join();
+  }
+  state.SetItemsProcessed(state.iterations());
+  state.counters["scans"] =
+      benchmark::Counter(static_cast<double>(scans.load()), benchmark::Counter::kIsRate);
+}
+
+void BM_CommitWithGuardReaders(benchmark::State& state) {
+  RunContendedCommits(state, [](const Db& db) { return ScanAges(db.SharedLock()); });
+}
+
+void BM_CommitWithSnapshotReaders(benchmark::State& state) {
+  RunContendedCommits(state, [](const Db& db) { return ScanAges(db.Snapshot()); });
+}
+
+BENCHMARK(BM_CommitWithGuardReaders)->Arg(0)->Arg(1)->Arg(2)->Arg(4)->UseRealTime();
+BENCHMARK(BM_CommitWithSnapshotReaders)->Arg(0)->Arg(1)->Arg(2)->Arg(4)->UseRealTime();
+
+}  // namespace
+}  // namespace gendb::tests
+
+BENCHMARK_MAIN();
@@ -0,0 +1,82 @@
+// Opening the test schema's Db on a WAL of kCommits commits, each putting kAccountsPerCommit
+// accounts and patching as many written by an earlier commit. The argument is
+// WalOptions::replay_threads, from 1 to one per hardware thread. Bytes are the log's segment
+// bytes and items its records, so the rates read as MB/s and records/s of replay, index rebuild
+// included.
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <random>
+#include <string>
+#include <thread>
+
+#include "account.fbs.h"
+#include "database.h"
+#include "gendb/wal.h"
+
+namespace gendb::tests {
+namespace {
+
+constexpr uint64_t kCommits = 2'000;
+constexpr uint64_t kAccountsPerCommit = 50;
+
+int MaxThreads() { return static_cast<int>(std::max(1u, std::thread::hardware_concurrency())); }
+
+// Writes the log once, for every run of the benchmark.
+const WalOptions& LoggedOptions() {
+  static const WalOptions* options = [] {
+    auto* options = new WalOptions();
+    options->dir = (std::filesystem::temp_directory_path() /
+                    ("wal_replay_benchmark_" + std::to_string(std::random_device{}())))
+                       .string();
+    options->sync = WalSyncPolicy::kNone;
+    std::filesystem::remove_all(options->dir);
+    Db db(*options);
+    uint64_t id = 0;
+    for (uint64_t commit = 0; commit < kCommits; ++commit) {
+      auto writer = db.CreateWriter();
+      for (uint64_t i = 0; i < kAccountsPerCommit; ++i, ++id) {
+        (void)writer.PutAccount(id, AccountBuilder()
+                                        .set_account_id(id)
+                                        .set_name("account" + std::to_string(id))
+                                        .set_age(static_cast<int32_t>(id % 100))
+                                        .set_balance(0)
+                                        .Build());
+        if (id >= kAccountsPerCommit) {
+          (void)writer.UpdateAccount(id / 2, AccountPatchBuilder()
+                                                 .set_balance(static_cast<float>(id))
+                                                 .Build());
+        }
+      }
+      writer.Commit();
+    }
+    return options;
+  }();
+  return *options;
+}
+
+void BM_OpenDb(benchmark::State& state) {
+  WalOptions options = LoggedOptions();
+  options.replay_threads = static_cast<size_t>(state.range(0));
+  size_t log_bytes = 0;
+  for (const auto& entry : std::filesystem::directory_iterator(options.dir)) {
+    log_bytes += entry.file_size();
+  }
+  for (auto _ : state) {
+    Db db(options);
+    benchmark::DoNotOptimize(&db);
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * log_bytes));
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * kCommits));
+}
+
+BENCHMARK(BM_OpenDb)->RangeMultiplier(2)->Range(1, MaxThreads())->UseRealTime()->Unit(
+    benchmark::kMillisecond);
+
+}  // namespace
+}  // namespace gendb::tests
+
+BENCHMARK_MAIN();
@@ -61,6 +61,7 @@ class Collection:
     type: str                  # link to Message.name
     primary_key: List[str]     # link to Message.fields[i].name(s)
     private: bool = False      # whether write methods should be private
+    storage: Optional[dict] = None  # RocksDB tuning, see storage_tuning.py
 
 @dataclass
 class Database:
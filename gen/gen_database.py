@@ -7,6 +7,26 @@ from clang_format import clang_format
 import base_types
 import flatc_to_store
 import schema_validator
+import storage_tuning
+
+# How ScopedWrite::Commit publishes its changes (options.commit_mode in db.yaml).
+#   locked: applies them in place while holding the reader lock exclusively. Writers may also hand
+#           them to a background apply thread with ScopedWrite::CommitAsync.
+#   rcu: copies the state with copy-on-write trees, applies them to the copy and publishes it with
+#        one atomic pointer swap; readers never block.
+#   group: like locked, but writers run concurrently, each reading from a snapshot, and queue their
+#          commits; one of them applies each batch of queued commits with a single storage write.
+#   optimistic: like locked, but writers run concurrently, each reading from a snapshot; a commit
+#               fails with an AbortedError if an earlier one changed what its writer read.
+COMMIT_MODES = ("locked", "rcu", "group", "optimistic")
+
+# Where the secondary indices live (options.index_storage in db.yaml).
+#   memory: in-memory trees, saved in checkpoints and rebuilt from the values on WAL replay.
+#   collection: gendb::StorageIndex records in collections of the storage after those of the
+#               schema, written in the same atomic batch as the values and logged with them, so
+#               they are neither saved apart nor rebuilt; the change stream carries them too. Only
+#               with the locked commit mode, and without the Guard's ...RangeAsync index reads.
+INDEX_STORAGES = ("memory", "collection")
 
 
 def load_yaml_db(yaml_path):
@@ -31,7 +51,9 @@ def build_store_from_yaml(db_cfg):
         name="metadata",
         type="gendb.MetadataValue",
         primary_key=["type", "id"],
-        private=True
+        private=True,
+        # Lookups are grouped by metadata type.
+        storage={"prefix_fields": 1}
     )
     store.add_collection(metadata_collection)
     for col in db_cfg.get("collections", []):
@@ -39,7 +61,8 @@ def build_store_from_yaml(db_cfg):
             name=col["name"],
             type=col["type"],
             primary_key=col["primary_key"] if isinstance(col["primary_key"], list) else [col["primary_key"]],
-            private=col.get("private", False)
+            private=col.get("private", False),
+            storage=col.get("storage")
         )
         store.add_collection(collection)
     # Load indices
@@ -107,6 +130,19 @@ def main():
     # Use namespace from first message, or fallback
     namespace = db_cfg.get("options", {}).get("cpp_namespace", "")
     generated_source_base_name = db_cfg.get("options", {}).get("generated_source_base_name", "database")
+    commit_mode = db_cfg.get("options", {}).get("commit_mode", "locked")
+    if commit_mode not in COMMIT_MODES:
+        raise ValueError(f"Unknown commit_mode '{commit_mode}', expected one of {COMMIT_MODES}")
+    locked = commit_mode == "locked"
+    rcu = commit_mode == "rcu"
+    group = commit_mode == "group"
+    optimistic = commit_mode == "optimistic"
+    index_storage = db_cfg.get("options", {}).get("index_storage", "memory")
+    if index_storage not in INDEX_STORAGES:
+        raise ValueError(f"Unknown index_storage '{index_storage}', expected one of {INDEX_STORAGES}")
+    storage_indices = index_storage == "collection"
+    if storage_indices and not locked:
+        raise ValueError("index_storage 'collection' requires the locked commit_mode")
 
     # Collect includes
     includes = []
@@ -120,14 +156,18 @@ def main():
     for col in store.collections.values():
         type = naming.split_namespace_class(col.type)[1]
         pk_fields = []
+        pk_field_sizes = []  # None for variable-size fields
         pk_fixed_size = 0
         for pk_name in col.primary_key:
             pk_field = store.get_field(col.type, pk_name)
+            if not pk_field.is_fixed_size:
+                pk_field_sizes.append(None)
+            elif pk_field.field_kind == FieldKind.SCALAR:
+                pk_field_sizes.append(base_types.type_size(pk_field.type))
+            else:
+                pk_field_sizes.append(base_types.cpp_type_size(pk_field.underlying_type))
             if pk_field.is_fixed_size and pk_fixed_size >= 0:
-                if pk_field.field_kind == FieldKind.SCALAR:
-                    pk_fixed_size += base_types.type_size(pk_field.type)
-                else:
-                    pk_fixed_size += base_types.cpp_type_size(pk_field.underlying_type)
+                pk_fixed_size += pk_field_sizes[-1]
             elif not pk_field.is_fixed_size:
                 pk_fixed_size = -1
             pk_fields.append(pk_field)
@@ -140,6 +180,7 @@ def main():
             "pk_fields": pk_fields,
             "pk_fixed_size": pk_fixed_size, # -1 in case the size is not fixed
             "private": col.private,
+            "tuning": storage_tuning.cpp_initializer(col.storage, pk_field_sizes),
         })
 
     # Compose indices info
@@ -161,7 +202,8 @@ def main():
             "key_type": key_type,
             "key_cpp_type": base_types.cpp_type(key_type),
             "value_cpp_type": base_types.cpp_type(value_type),
-            "index_class": f"gendb::Index</*{idx.field}*/ {base_types.cpp_type(key_type)}, std::array<uint8_t, sizeof({base_types.cpp_type(value_type)})>>",
+            "index_class": (f"gendb::StorageIndex</*{idx.field}*/ {base_types.cpp_type(key_type)}>" if storage_indices else
+                            f"gendb::{'PersistentIndex' if rcu else 'Index'}</*{idx.field}*/ {base_types.cpp_type(key_type)}, std::array<uint8_t, sizeof({base_types.cpp_type(value_type)})>>"),
             "primary_key": collection.primary_key[0],
         })
 
@@ -176,8 +218,16 @@ def main():
         "includes": includes,
         "collections": collections,
         "indices": indices,
+        # The indices kept in memory; those in collections follow the schema's collections.
+        "memory_indices": [] if storage_indices else indices,
+        "storage_indices": storage_indices,
+        "storage_collection_count": len(collections) + (len(indices) if storage_indices else 0),
         "sequences": sequences,
-        "generated_source_base_name": generated_source_base_name
+        "generated_source_base_name": generated_source_base_name,
+        "locked": locked,
+        "rcu": rcu,
+        "group": group,
+        "optimistic": optimistic,
     }
 
     # Output dir
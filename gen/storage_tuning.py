@@ -0,0 +1,58 @@
+# Per-collection RocksDB tuning declared under a collection's `storage:` block in db.yaml:
+#
+#   storage:
+#     bloom_bits_per_key: 10        # block-based bloom filter
+#     block_size: 16384             # data block size in bytes
+#     compression: zstd             # default | none | snappy | lz4 | zstd
+#     prefix_fields: 1              # prefix extractor over the leading primary key fields
+#     optimize_point_lookup: true   # data block hash index and memtable bloom filter
+#
+# Rendered as a gendb::CollectionTuning initializer.
+
+COMPRESSION = {
+    "default": "kDefault",
+    "none": "kNone",
+    "snappy": "kSnappy",
+    "lz4": "kLZ4",
+    "zstd": "kZstd",
+}
+
+KEYS = ["bloom_bits_per_key", "block_size", "compression", "prefix_fields", "optimize_point_lookup"]
+
+
+def prefix_length(prefix_fields, pk_field_sizes):
+    """Encoded width of the first `prefix_fields` primary key fields.
+
+    key_codec writes fixed-size fields at their native width, so the prefix has a fixed length
+    only if every field in it is fixed-size. `pk_field_sizes` holds None for variable-size fields.
+    """
+    if not 0 < prefix_fields <= len(pk_field_sizes):
+        raise ValueError(f"prefix_fields must be between 1 and {len(pk_field_sizes)}, got {prefix_fields}")
+    sizes = pk_field_sizes[:prefix_fields]
+    if any(size is None for size in sizes):
+        raise ValueError("prefix_fields must only cover fixed-size primary key fields")
+    return sum(sizes)
+
+
+def cpp_initializer(storage_cfg, pk_field_sizes):
+    """Returns the C++ designated initializer of a gendb::CollectionTuning."""
+    storage_cfg = storage_cfg or {}
+    unknown = sorted(set(storage_cfg) - set(KEYS))
+    if unknown:
+        raise ValueError(f"Unknown storage options: {', '.join(unknown)}")
+
+    fields = []
+    if "bloom_bits_per_key" in storage_cfg:
+        fields.append(f".bloom_bits_per_key = {float(storage_cfg['bloom_bits_per_key'])}")
+    if "block_size" in storage_cfg:
+        fields.append(f".block_size = {int(storage_cfg['block_size'])}")
+    if "compression" in storage_cfg:
+        compression = storage_cfg["compression"]
+        if compression not in COMPRESSION:
+            raise ValueError(f"Unknown compression '{compression}'. Supported: {list(COMPRESSION)}")
+        fields.append(f".compression = gendb::CollectionTuning::Compression::{COMPRESSION[compression]}")
+    if "prefix_fields" in storage_cfg:
+        fields.append(f".prefix_length = {prefix_length(storage_cfg['prefix_fields'], pk_field_sizes)}")
+    if storage_cfg.get("optimize_point_lookup", False):
+        fields.append(".optimize_point_lookup = true")
+    return "{" + ", ".join(fields) + "}"
@@ -0,0 +1,40 @@
+import pytest
+import storage_tuning
+
+
+def test_empty_config_keeps_defaults():
+    assert storage_tuning.cpp_initializer(None, [4]) == "{}"
+    assert storage_tuning.cpp_initializer({}, [4]) == "{}"
+
+
+def test_fields_follow_declaration_order():
+    cfg = {
+        "optimize_point_lookup": True,
+        "compression": "zstd",
+        "block_size": 16384,
+        "bloom_bits_per_key": 10,
+    }
+    assert storage_tuning.cpp_initializer(cfg, [4]) == (
+        "{.bloom_bits_per_key = 10.0, .block_size = 16384, "
+        ".compression = gendb::CollectionTuning::Compression::kZstd, .optimize_point_lookup = true}"
+    )
+
+
+def test_prefix_length_matches_key_codec_layout():
+    assert storage_tuning.prefix_length(1, [4, 8, None]) == 4
+    assert storage_tuning.prefix_length(2, [4, 8, None]) == 12
+    assert storage_tuning.cpp_initializer({"prefix_fields": 1}, [4, 4]) == "{.prefix_length = 4}"
+
+
+def test_prefix_over_variable_size_field_is_rejected():
+    with pytest.raises(ValueError):
+        storage_tuning.prefix_length(1, [None, 4])
+    with pytest.raises(ValueError):
+        storage_tuning.prefix_length(3, [4, 4])
+
+
+def test_invalid_options_are_rejected():
+    with pytest.raises(ValueError):
+        storage_tuning.cpp_initializer({"compression": "brotli"}, [4])
+    with pytest.raises(ValueError):
+        storage_tuning.cpp_initializer({"bloom_bits": 10}, [4])
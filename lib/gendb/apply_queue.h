@@ -0,0 +1,96 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+namespace gendb {
+
+// Applies submitted items one at a time, in submission order, on a thread of its own, started by
+// the first Submit(). Submitters do not wait: each gets a future that becomes ready once its item
+// is applied, or holds the exception `apply` threw for it. Items submitted before the queue is
+// destroyed are all applied.
+template <typename T>
+class ApplyQueue {
+ public:
+  explicit ApplyQueue(std::function<void(T&)> apply) : _apply(std::move(apply)) {}
+  ~ApplyQueue() {
+    {
+      std::lock_guard lock(_mutex);
+      _stopping = true;
+    }
+    _cv.notify_all();
+    if (_thread.joinable()) {
+      _thread.join();
+    }
+  }
+
+  ApplyQueue(const ApplyQueue&) = delete;
+  ApplyQueue& operator=(const ApplyQueue&) = delete;
+
+  std::future<void> Submit(T item) {
+    std::promise<void> applied;
+    std::future<void> future = applied.get_future();
+    {
+      std::lock_guard lock(_mutex);
+      _queue.push_back({std::move(item), std::move(applied)});
+      if (!_thread.joinable()) {
+        _thread = std::thread([this] { Run(); });
+      }
+    }
+    _cv.notify_all();
+    return future;
+  }
+
+  // Returns once every item submitted so far has been applied.
+  void WaitIdle() {
+    std::unique_lock lock(_mutex);
+    _cv.wait(lock, [&] { return _queue.empty() && !_applying; });
+  }
+
+ private:
+  struct Pending {
+    T item;
+    std::promise<void> applied;
+  };
+
+  void Run() {
+    std::unique_lock lock(_mutex);
+    while (true) {
+      _cv.wait(lock, [&] { return !_queue.empty() || _stopping; });
+      if (_queue.empty()) {
+        return;
+      }
+      Pending pending = std::move(_queue.front());
+      _queue.pop_front();
+      _applying = true;
+      lock.unlock();
+
+      try {
+        _apply(pending.item);
+        pending.applied.set_value();
+      } catch (...) {
+        pending.applied.set_exception(std::current_exception());
+      }
+
+      lock.lock();
+      _applying = false;
+      _cv.notify_all();
+    }
+  }
+
+  const std::function<void(T&)> _apply;
+  std::mutex _mutex;
+  std::condition_variable _cv;
+  std::deque<Pending> _queue;
+  bool _applying = false;
+  bool _stopping = false;
+  std::thread _thread;
+};
+
+}  // namespace gendb
@@ -0,0 +1,72 @@
+#include "gendb/apply_queue.h"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <future>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+namespace gendb {
+namespace {
+
+TEST(ApplyQueueTest, AppliesInSubmissionOrderOnItsOwnThread) {
+  std::vector<int> applied;
+  std::thread::id apply_thread;
+  std::vector<std::future<void>> futures;
+  {
+    ApplyQueue<int> queue([&](int& item) {
+      applied.push_back(item);
+      apply_thread = std::this_thread::get_id();
+    });
+    for (int i = 0; i < 100; ++i) {
+      futures.push_back(queue.Submit(i));
+    }
+    futures.back().wait();
+    EXPECT_EQ(applied.size(), 100);
+  }
+  for (int i = 0; i < 100; ++i) {
+    EXPECT_EQ(applied[i], i);
+    EXPECT_EQ(futures[i].wait_for(std::chrono::seconds(0)), std::future_status::ready);
+  }
+  EXPECT_NE(apply_thread, std::this_thread::get_id());
+}
+
+TEST(ApplyQueueTest, SubmitDoesNotWaitForTheApply) {
+  std::promise<void> release;
+  std::shared_future<void> released = release.get_future().share();
+  ApplyQueue<int> queue([&](int&) { released.wait(); });
+  std::future<void> first = queue.Submit(1);
+  std::future<void> second = queue.Submit(2);
+  EXPECT_EQ(first.wait_for(std::chrono::milliseconds(10)), std::future_status::timeout);
+  release.set_value();
+  second.get();
+  queue.WaitIdle();
+}
+
+TEST(ApplyQueueTest, ErrorIsDeliveredThroughItsFuture) {
+  ApplyQueue<int> queue([](int& item) {
+    if (item == 1) {
+      throw std::runtime_error("x");
+    }
+  });
+  std::future<void> failed = queue.Submit(1);
+  std::future<void> next = queue.Submit(2);
+  EXPECT_THROW(failed.get(), std::runtime_error);
+  EXPECT_NO_THROW(next.get());
+}
+
+TEST(ApplyQueueTest, DestructionAppliesQueuedItems) {
+  int applied = 0;
+  {
+    ApplyQueue<int> queue([&](int& item) { applied += item; });
+    for (int i = 1; i <= 10; ++i) {
+      (void)queue.Submit(i);
+    }
+  }
+  EXPECT_EQ(applied, 55);
+}
+
+}  // namespace
+}  // namespace gendb
@@ -0,0 +1,385 @@
+#include "gendb/arena_storage.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace gendb {
+
+namespace {
+
+struct RecordHeader {
+  uint32_t value_size;
+  uint32_t key_size;  // kDeadBit is set once the record is freed.
+};
+
+constexpr uint32_t kDeadBit = 1u << 31;
+constexpr size_t kRecordAlignment = 8;
+
+uint32_t RecordLength(size_t key_size, size_t value_size) {
+  size_t length = sizeof(RecordHeader) + value_size + key_size;
+  return static_cast<uint32_t>((length + kRecordAlignment - 1) & ~(kRecordAlignment - 1));
+}
+
+RecordHeader ReadHeader(const uint8_t* record) {
+  RecordHeader header;
+  std::memcpy(&header, record, sizeof(header));
+  return header;
+}
+
+BytesConstView RecordValue(const uint8_t* record, const RecordHeader& header) {
+  return {record + sizeof(RecordHeader), header.value_size};
+}
+
+BytesConstView RecordKey(const uint8_t* record, const RecordHeader& header) {
+  return {record + sizeof(RecordHeader) + header.value_size, header.key_size & ~kDeadBit};
+}
+
+}  // namespace
+
+void ArenaStorage::Put(const size_t collection_id, BytesConstView key, Bytes&& value) {
+  ArenaCollection& coll = GetOrCreateCollection(collection_id);
+  if (_epochs == nullptr && OverwriteRecord(coll, key, value)) {
+    return;
+  }
+  RecordRef ref = WriteRecord(coll, key, value);
+  auto [it, inserted] = coll.index.try_emplace(key, ref);
+  if (inserted) {
+    coll.ordered_keys.insert(key);
+  } else {
+    FreeRecord(coll, it->value);
+    it->value = ref;
+  }
+  Evacuate(coll, kCompactionBytesPerWrite);
+}
+
+absl::Status ArenaStorage::Delete(const size_t collection_id, BytesConstView key) {
+  if (collection_id >= _collections.size()) {
+    return absl::NotFoundError("Collection not found");
+  }
+  ArenaCollection& coll = _collections[collection_id];
+  auto it = coll.index.find(key);
+  if (it == coll.index.end()) {
+    return absl::NotFoundError("Key not found");
+  }
+  FreeRecord(coll, it->value);
+  coll.index.erase(it);
+  coll.ordered_keys.erase(key);
+  Evacuate(coll, kCompactionBytesPerWrite);
+  return absl::OkStatus();
+}
+
+absl::Status ArenaStorage::DeleteRange(const size_t collection_id, BytesConstView begin,
+                                       BytesConstView end) {
+  if (collection_id >= _collections.size()) {
+    return absl::OkStatus();
+  }
+  ArenaCollection& coll = _collections[collection_id];
+  // Erasing invalidates BTreeSet iterators, so the range is collected first.
+  std::vector<SmallKey> keys;
+  for (auto it = coll.ordered_keys.lower_bound(begin);
+       it != coll.ordered_keys.end() && KeyInRange(*it, begin, end); ++it) {
+    keys.emplace_back(*it);
+  }
+  for (const SmallKey& key : keys) {
+    auto it = coll.index.find(key);
+    FreeRecord(coll, it->value);
+    coll.index.erase(it);
+    coll.ordered_keys.erase(key);
+  }
+  Evacuate(coll, kCompactionBytesPerWrite);
+  return absl::OkStatus();
+}
+
+absl::Status ArenaStorage::Truncate(const size_t collection_id) {
+  if (collection_id < _collections.size()) {
+    RetireSlabs(_collections[collection_id]);
+    _collections[collection_id] = ArenaCollection();
+  }
+  return absl::OkStatus();
+}
+
+void ArenaStorage::Clear() {
+  for (ArenaCollection& coll : _collections) {
+    RetireSlabs(coll);
+  }
+  _collections.clear();
+}
+
+class ArenaStorage::Cursor : public StorageCursor {
+ public:
+  // `coll` is null for a collection that does not exist yet.
+  explicit Cursor(const ArenaCollection* coll) : _coll(coll) {}
+
+  void Seek(BytesConstView key) override {
+    if (_coll != nullptr) {
+      _it = _coll->ordered_keys.lower_bound(key);
+      Load();
+    }
+  }
+  void Next() override {
+    ++_it;
+    Load();
+  }
+  bool Valid() const override { return _coll != nullptr && _it != _coll->ordered_keys.end(); }
+  BytesConstView Key() const override { return *_it; }
+  BytesConstView Value() const override { return _value; }
+
+ private:
+  void Load() {
+    if (Valid()) {
+      _value = ValueOf(*_coll, _coll->index.find(*_it)->value);
+    }
+  }
+
+  const ArenaCollection* _coll;
+  BTreeSet::const_iterator _it;
+  BytesConstView _value;
+};
+
+std::unique_ptr<StorageCursor> ArenaStorage::NewCursor(const size_t collection_id) const {
+  return std::make_unique<Cursor>(
+      collection_id < _collections.size() ? &_collections[collection_id] : nullptr);
+}
+
+absl::Status ArenaStorage::Get(const size_t collection_id, BytesConstView key,
+                               BytesConstView& value) const {
+  if (collection_id >= _collections.size()) {
+    return absl::NotFoundError("Collection not found");
+  }
+  if (!Find(collection_id, key, value)) {
+    return absl::NotFoundError("Key not found");
+  }
+  return absl::OkStatus();
+}
+
+bool ArenaStorage::Find(const size_t collection_id, BytesConstView key,
+                        BytesConstView& value) const {
+  if (collection_id >= _collections.size()) {
+    return false;
+  }
+  const ArenaCollection& coll = _collections[collection_id];
+  auto it = coll.index.find(key);
+  if (it == coll.index.end()) {
+    return false;
+  }
+  value = ValueOf(coll, it->value);
+  return true;
+}
+
+void ArenaStorage::MultiGet(const size_t collection_id, std::span<const BytesConstView> keys,
+                            std::span<BytesConstView> values, std::span<absl::Status> statuses,
+                            ValuePins& /*pins*/) const {
+  if (collection_id >= _collections.size()) {
+    std::fill(statuses.begin(), statuses.end(), absl::NotFoundError("Collection not found"));
+    return;
+  }
+  const ArenaCollection& coll = _collections[collection_id];
+  coll.index.FindBatch(keys, [&](size_t i, FlatHashMap<RecordRef>::const_iterator it) {
+    if (it == coll.index.end()) {
+      statuses[i] = absl::NotFoundError("Key not found");
+      return;
+    }
+    values[i] = ValueOf(coll, it->value);
+    statuses[i] = absl::OkStatus();
+  });
+}
+
+bool ArenaStorage::Exists(const size_t collection_id, BytesConstView key) const {
+  if (collection_id >= _collections.size()) {
+    return false;
+  }
+  return _collections[collection_id].index.contains(key);
+}
+
+size_t ArenaStorage::GetCollectionSize(const size_t collection_id) const {
+  if (collection_id >= _collections.size()) {
+    return 0;
+  }
+  return _collections[collection_id].index.size();
+}
+
+ArenaStats ArenaStorage::GetCollectionStats(size_t collection_id) const {
+  if (collection_id >= _collections.size()) {
+    return {};
+  }
+  const ArenaCollection& coll = _collections[collection_id];
+  return {.live_bytes = coll.live_bytes,
+          .reserved_bytes = coll.reserved_bytes,
+          .slab_count = coll.slabs.size() - coll.free_slab_ids.size()};
+}
+
+void ArenaStorage::Compact() {
+  for (ArenaCollection& coll : _collections) {
+    Evacuate(coll, SIZE_MAX);
+  }
+}
+
+BytesConstView ArenaStorage::ValueOf(const ArenaCollection& coll, RecordRef ref) {
+  const uint8_t* record = coll.slabs[ref.slab].data.get() + ref.offset;
+  return RecordValue(record, ReadHeader(record));
+}
+
+ArenaStorage::ArenaCollection& ArenaStorage::GetOrCreateCollection(size_t collection_id) {
+  if (collection_id >= _collections.size()) {
+    _collections.resize(collection_id + 1);
+  }
+  return _collections[collection_id];
+}
+
+ArenaStorage::RecordRef ArenaStorage::WriteRecord(ArenaCollection& coll, BytesConstView key,
+                                                  BytesConstView value) {
+  RecordRef ref = Allocate(coll, RecordLength(key.size(), value.size()));
+  uint8_t* record = coll.slabs[ref.slab].data.get() + ref.offset;
+  RecordHeader header{static_cast<uint32_t>(value.size()), static_cast<uint32_t>(key.size())};
+  std::memcpy(record, &header, sizeof(header));
+  if (!value.empty()) {
+    std::memcpy(record + sizeof(header), value.data(), value.size());
+  }
+  if (!key.empty()) {
+    std::memcpy(record + sizeof(header) + value.size(), key.data(), key.size());
+  }
+  return ref;
+}
+
+bool ArenaStorage::OverwriteRecord(ArenaCollection& coll, BytesConstView key,
+                                   BytesConstView value) {
+  auto it = coll.index.find(key);
+  if (it == coll.index.end()) {
+    return false;
+  }
+  uint8_t* record = coll.slabs[it->value.slab].data.get() + it->value.offset;
+  const RecordHeader old_header = ReadHeader(record);
+  if (RecordLength(key.size(), value.size()) !=
+      RecordLength(old_header.key_size, old_header.value_size)) {
+    return false;
+  }
+  RecordHeader header{static_cast<uint32_t>(value.size()), static_cast<uint32_t>(key.size())};
+  std::memcpy(record, &header, sizeof(header));
+  if (!value.empty()) {
+    std::memcpy(record + sizeof(header), value.data(), value.size());
+  }
+  if (!key.empty()) {
+    std::memmove(record + sizeof(header) + value.size(), key.data(), key.size());
+  }
+  return true;
+}
+
+ArenaStorage::RecordRef ArenaStorage::Allocate(ArenaCollection& coll, uint32_t length) {
+  if (length > _slab_size) {
+    // Oversized records get a dedicated slab and leave the active slab alone.
+    uint32_t slab_id = OpenSlab(coll, length);
+    coll.slabs[slab_id].used = length;
+    coll.slabs[slab_id].live = length;
+    coll.live_bytes += length;
+    return {slab_id, 0};
+  }
+  if (coll.active == kNoSlab || coll.slabs[coll.active].used + length > _slab_size) {
+    // Seal the current slab; it may already be sparse.
+    uint32_t sealed = coll.active;
+    coll.active = OpenSlab(coll, static_cast<uint32_t>(_slab_size));
+    if (sealed != kNoSlab) {
+      Slab& slab = coll.slabs[sealed];
+      if (slab.live == 0) {
+        ReleaseSlab(coll, sealed);
+      } else if (slab.live * 2 < slab.used && !slab.queued) {
+        slab.queued = true;
+        coll.sparse_slabs.push_back(sealed);
+      }
+    }
+  }
+  Slab& slab = coll.slabs[coll.active];
+  RecordRef ref{coll.active, slab.used};
+  slab.used += length;
+  slab.live += length;
+  coll.live_bytes += length;
+  return ref;
+}
+
+uint32_t ArenaStorage::OpenSlab(ArenaCollection& coll, uint32_t capacity) {
+  uint32_t slab_id;
+  if (!coll.free_slab_ids.empty()) {
+    slab_id = coll.free_slab_ids.back();
+    coll.free_slab_ids.pop_back();
+  } else {
+    slab_id = static_cast<uint32_t>(coll.slabs.size());
+    coll.slabs.emplace_back();
+  }
+  Slab& slab = coll.slabs[slab_id];
+  slab.data = std::make_unique_for_overwrite<uint8_t[]>(capacity);
+  slab.capacity = capacity;
+  coll.reserved_bytes += capacity;
+  return slab_id;
+}
+
+void ArenaStorage::FreeRecord(ArenaCollection& coll, RecordRef ref) {
+  Slab& slab = coll.slabs[ref.slab];
+  uint8_t* record = slab.data.get() + ref.offset;
+  RecordHeader header = ReadHeader(record);
+  const uint32_t length = RecordLength(header.key_size, header.value_size);
+  header.key_size |= kDeadBit;
+  std::memcpy(record, &header, sizeof(header));
+
+  slab.live -= length;
+  coll.live_bytes -= length;
+  if (ref.slab == coll.active) {
+    return;
+  }
+  if (slab.live == 0) {
+    ReleaseSlab(coll, ref.slab);
+  } else if (slab.live * 2 < slab.used && !slab.queued) {
+    slab.queued = true;
+    coll.sparse_slabs.push_back(ref.slab);
+  }
+}
+
+void ArenaStorage::ReleaseSlab(ArenaCollection& coll, uint32_t slab_id) {
+  // Queue entries for released slabs are skipped because `queued` is reset.
+  Slab& slab = coll.slabs[slab_id];
+  coll.reserved_bytes -= slab.capacity;
+  if (_epochs != nullptr) {
+    _epochs->Retire(std::move(slab.data));
+  }
+  slab = Slab{};
+  coll.free_slab_ids.push_back(slab_id);
+}
+
+void ArenaStorage::RetireSlabs(ArenaCollection& coll) {
+  if (_epochs != nullptr && !coll.slabs.empty()) {
+    _epochs->Retire(std::move(coll.slabs));
+  }
+}
+
+void ArenaStorage::Evacuate(ArenaCollection& coll, size_t budget) {
+  while (budget > 0 && !coll.sparse_slabs.empty()) {
+    const uint32_t slab_id = coll.sparse_slabs.front();
+    if (!coll.slabs[slab_id].queued) {
+      coll.sparse_slabs.pop_front();
+      continue;
+    }
+    // Allocate() may grow `coll.slabs`, so the slab is re-fetched by id after each move.
+    while (budget > 0 && coll.slabs[slab_id].live > 0) {
+      Slab& slab = coll.slabs[slab_id];
+      const uint32_t offset = slab.evacuate_offset;
+      const uint8_t* record = slab.data.get() + offset;
+      const RecordHeader header = ReadHeader(record);
+      const uint32_t length = RecordLength(header.key_size & ~kDeadBit, header.value_size);
+      slab.evacuate_offset += length;
+      if (header.key_size & kDeadBit) {
+        continue;
+      }
+
+      BytesConstView key = RecordKey(record, header);
+      RecordRef moved = WriteRecord(coll, key, RecordValue(record, header));
+      auto it = coll.index.find(key);
+      it->value = moved;
+      // Frees the old copy; releases the slab once its last live record is gone.
+      FreeRecord(coll, {slab_id, offset});
+      budget -= std::min<size_t>(budget, length);
+    }
+    if (!coll.slabs[slab_id].queued) {
+      coll.sparse_slabs.pop_front();
+    }
+  }
+}
+
+}  // namespace gendb
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <span>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "gendb/btree_set.h"
+#include "gendb/bytes.h"
+#include "gendb/epoch.h"
+#include "gendb/flat_hash_map.h"
+#include "gendb/storage.h"
+
+namespace gendb {
+
+// Memory usage of a single ArenaStorage collection.
+struct ArenaStats {
+  size_t live_bytes = 0;      // Bytes held by live records, including record headers.
+  size_t reserved_bytes = 0;  // Bytes reserved by slabs.
+  size_t slab_count = 0;
+};
+
+// In-memory storage that packs values into large slabs instead of one heap block per value.
+// Records are bump-allocated into the collection's active slab; deleting or overwriting a record
+// only marks it dead. Sealed slabs whose live bytes drop below half of their used bytes are
+// queued for evacuation, and every write moves a bounded number of live bytes out of them, so
+// compaction is incremental and never stalls a single commit. Empty slabs are released at once.
+//
+// Point reads go through a per-collection hash index. Each collection also keeps its keys in a
+// BTreeSet, which orders them for cursors and range deletes.
+//
+// Views returned by Get stay valid until the next write to the same collection. Without an
+// EpochManager, a Put that does not change the length of a record rewrites it in place, so that
+// updates neither allocate nor leave work for compaction. Given one, writes never touch the bytes
+// of existing records, only free whole slabs, and freed slabs are retired through it instead: a
+// view also stays readable while the read section it was taken in is open.
+class ArenaStorage : public Storage {
+ public:
+  static constexpr size_t kDefaultSlabSize = 256 * 1024;
+  // Live bytes evacuated from sparse slabs per Put/Delete.
+  static constexpr size_t kCompactionBytesPerWrite = 4 * 1024;
+
+  explicit ArenaStorage(size_t slab_size = kDefaultSlabSize, EpochManager* epochs = nullptr)
+      : _slab_size(slab_size), _epochs(epochs) {}
+
+  void Put(const size_t collection_id, BytesConstView key, Bytes&& value) override;
+
+  absl::Status Delete(const size_t collection_id, BytesConstView key) override;
+
+  // Slabs emptied by the range are released.
+  absl::Status DeleteRange(const size_t collection_id, BytesConstView begin,
+                           BytesConstView end) override;
+
+  absl::Status Truncate(const size_t collection_id) override;
+
+  absl::Status Get(const size_t collection_id, BytesConstView key,
+                   BytesConstView& value) const override;
+
+  // Like Get, but a miss does not build an error status.
+  bool Find(const size_t collection_id, BytesConstView key, BytesConstView& value) const;
+
+  // Interleaved, prefetched index probes (see FlatHashMap::FindBatch).
+  void MultiGet(const size_t collection_id, std::span<const BytesConstView> keys,
+                std::span<BytesConstView> values, std::span<absl::Status> statuses,
+                ValuePins& pins) const override;
+
+  bool Exists(const size_t collection_id, BytesConstView key) const override;
+
+  std::unique_ptr<StorageCursor> NewCursor(const size_t collection_id) const override;
+
+  size_t GetCollectionCount() const override { return _collections.size(); }
+
+  size_t GetCollectionSize(const size_t collection_id) const override;
+
+  void Clear() override;
+
+  // Live versus reserved bytes of a collection.
+  ArenaStats GetCollectionStats(size_t collection_id) const;
+
+  // Evacuate every queued sparse slab of every collection.
+  void Compact();
+
+ private:
+  static constexpr uint32_t kNoSlab = UINT32_MAX;
+
+  // Location of a record: [RecordHeader][value][key], 8-byte aligned inside its slab.
+  struct RecordRef {
+    uint32_t slab;
+    uint32_t offset;
+  };
+
+  struct Slab {
+    std::unique_ptr<uint8_t[]> data;
+    uint32_t capacity = 0;
+    uint32_t used = 0;
+    uint32_t live = 0;
+    uint32_t evacuate_offset = 0;
+    bool queued = false;
+  };
+
+  struct ArenaCollection {
+    ArenaCollection() = default;
+    // std::deque's move constructor is not noexcept; without this std::vector would copy.
+    ArenaCollection(ArenaCollection&&) noexcept = default;
+    ArenaCollection& operator=(ArenaCollection&&) noexcept = default;
+
+    FlatHashMap<RecordRef> index;
+    BTreeSet ordered_keys;
+    std::vector<Slab> slabs;
+    std::vector<uint32_t> free_slab_ids;
+    std::deque<uint32_t> sparse_slabs;
+    uint32_t active = kNoSlab;
+    size_t live_bytes = 0;
+    size_t reserved_bytes = 0;
+  };
+
+  class Cursor;
+
+  ArenaCollection& GetOrCreateCollection(size_t collection_id);
+  static BytesConstView ValueOf(const ArenaCollection& coll, RecordRef ref);
+  RecordRef WriteRecord(ArenaCollection& coll, BytesConstView key, BytesConstView value);
+  // Rewrites the record of `key` with `value` if it exists and keeps its length.
+  bool OverwriteRecord(ArenaCollection& coll, BytesConstView key, BytesConstView value);
+  RecordRef Allocate(ArenaCollection& coll, uint32_t length);
+  uint32_t OpenSlab(ArenaCollection& coll, uint32_t capacity);
+  void FreeRecord(ArenaCollection& coll, RecordRef ref);
+  void ReleaseSlab(ArenaCollection& coll, uint32_t slab_id);
+  // Drops every slab of the collection.
+  void RetireSlabs(ArenaCollection& coll);
+  void Evacuate(ArenaCollection& coll, size_t budget);
+
+  size_t _slab_size;
+  EpochManager* _epochs;
+  std::vector<ArenaCollection> _collections;
+};
+
+}  // namespace gendb
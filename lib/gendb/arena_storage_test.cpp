@@ -0,0 +1,195 @@
+#include "gendb/arena_storage.h"
+
+#include <gtest/gtest.h>
+
+#include <map>
+#include <random>
+#include <string>
+
+#include "status_matchers.h"
+
+namespace gendb {
+namespace {
+
+constexpr size_t kSlabSize = 1024;
+
+Bytes MakeKey(int i) {
+  std::string key = "key" + std::to_string(i);
+  return {key.begin(), key.end()};
+}
+
+Bytes MakeValue(int i, size_t size = 40) { return Bytes(size, static_cast<uint8_t>(i)); }
+
+void ExpectValue(const ArenaStorage& storage, int i, size_t size = 40) {
+  BytesConstView value;
+  ASSERT_OK(storage.Get(0, MakeKey(i), value));
+  EXPECT_EQ(Bytes(value.begin(), value.end()), MakeValue(i, size)) << i;
+}
+
+TEST(ArenaStorageTest, StatsTrackLiveAndReservedBytes) {
+  ArenaStorage storage(kSlabSize);
+  EXPECT_EQ(storage.GetCollectionStats(0).reserved_bytes, 0);
+
+  for (int i = 0; i < 100; ++i) {
+    storage.Put(0, MakeKey(i), MakeValue(i));
+  }
+  ArenaStats stats = storage.GetCollectionStats(0);
+  EXPECT_GE(stats.live_bytes, 100 * 40);
+  EXPECT_GE(stats.reserved_bytes, stats.live_bytes);
+  EXPECT_EQ(stats.reserved_bytes, stats.slab_count * kSlabSize);
+
+  for (int i = 0; i < 100; ++i) {
+    ASSERT_OK(storage.Delete(0, MakeKey(i)));
+  }
+  stats = storage.GetCollectionStats(0);
+  EXPECT_EQ(stats.live_bytes, 0);
+  // Only the active slab is kept around.
+  EXPECT_EQ(stats.slab_count, 1);
+  EXPECT_EQ(stats.reserved_bytes, kSlabSize);
+}
+
+TEST(ArenaStorageTest, OverwriteFreesPreviousRecord) {
+  ArenaStorage storage(kSlabSize);
+  storage.Put(0, MakeKey(1), MakeValue(1));
+  const size_t live_bytes = storage.GetCollectionStats(0).live_bytes;
+  for (int i = 0; i < 1000; ++i) {
+    storage.Put(0, MakeKey(1), MakeValue(1));
+  }
+  EXPECT_EQ(storage.GetCollectionStats(0).live_bytes, live_bytes);
+  EXPECT_LE(storage.GetCollectionStats(0).slab_count, 2);
+  ExpectValue(storage, 1);
+}
+
+TEST(ArenaStorageTest, SameLengthOverwriteRewritesInPlace) {
+  ArenaStorage storage(kSlabSize);
+  storage.Put(0, MakeKey(1), MakeValue(1));
+  BytesConstView before;
+  ASSERT_OK(storage.Get(0, MakeKey(1), before));
+  const size_t reserved_bytes = storage.GetCollectionStats(0).reserved_bytes;
+  for (int i = 0; i < 1000; ++i) {
+    storage.Put(0, MakeKey(1), MakeValue(i % 256));
+  }
+  BytesConstView after;
+  ASSERT_OK(storage.Get(0, MakeKey(1), after));
+  EXPECT_EQ(after.data(), before.data());
+  EXPECT_EQ(storage.GetCollectionStats(0).reserved_bytes, reserved_bytes);
+  EXPECT_EQ(Bytes(after.begin(), after.end()), MakeValue(999 % 256));
+
+  // A longer value takes a new record.
+  storage.Put(0, MakeKey(1), MakeValue(1, 80));
+  ASSERT_OK(storage.Get(0, MakeKey(1), after));
+  EXPECT_NE(after.data(), before.data());
+  EXPECT_EQ(Bytes(after.begin(), after.end()), MakeValue(1, 80));
+}
+
+TEST(ArenaStorageTest, OversizedValueGetsDedicatedSlab) {
+  ArenaStorage storage(kSlabSize);
+  storage.Put(0, MakeKey(1), MakeValue(1));
+  storage.Put(0, MakeKey(2), MakeValue(2, 4 * kSlabSize));
+  ExpectValue(storage, 1);
+  ExpectValue(storage, 2, 4 * kSlabSize);
+
+  ASSERT_OK(storage.Delete(0, MakeKey(2)));
+  EXPECT_EQ(storage.GetCollectionStats(0).reserved_bytes, kSlabSize);
+}
+
+TEST(ArenaStorageTest, CompactReclaimsSparseSlabs) {
+  ArenaStorage storage(kSlabSize);
+  for (int i = 0; i < 1000; ++i) {
+    storage.Put(0, MakeKey(i), MakeValue(i));
+  }
+  const size_t reserved_before = storage.GetCollectionStats(0).reserved_bytes;
+  // Leave every slab three quarters empty.
+  for (int i = 0; i < 1000; ++i) {
+    if (i % 4 != 0) {
+      ASSERT_OK(storage.Delete(0, MakeKey(i)));
+    }
+  }
+  storage.Compact();
+
+  ArenaStats stats = storage.GetCollectionStats(0);
+  EXPECT_LT(stats.reserved_bytes, reserved_before / 2);
+  EXPECT_LE(stats.reserved_bytes, 2 * stats.live_bytes + kSlabSize);
+  EXPECT_EQ(storage.GetCollectionSize(0), 250);
+  for (int i = 0; i < 1000; i += 4) {
+    ExpectValue(storage, i);
+  }
+}
+
+TEST(ArenaStorageTest, WritesCompactIncrementally) {
+  ArenaStorage storage(kSlabSize);
+  for (int i = 0; i < 1000; ++i) {
+    storage.Put(0, MakeKey(i), MakeValue(i));
+  }
+  for (int i = 0; i < 1000; ++i) {
+    if (i % 4 != 0) {
+      ASSERT_OK(storage.Delete(0, MakeKey(i)));
+    }
+  }
+  // Deletes alone already evacuate sparse slabs without an explicit Compact().
+  ArenaStats stats = storage.GetCollectionStats(0);
+  EXPECT_LE(stats.reserved_bytes, 2 * stats.live_bytes + 2 * kSlabSize);
+  for (int i = 0; i < 1000; i += 4) {
+    ExpectValue(storage, i);
+  }
+}
+
+TEST(ArenaStorageTest, RetiredSlabsOutliveOpenReadSections) {
+  EpochManager epochs;
+  ArenaStorage storage(kSlabSize, &epochs);
+  storage.Put(0, MakeKey(1), MakeValue(1));
+  BytesConstView value;
+  {
+    EpochManager::ReadSection section = epochs.Enter();
+    ASSERT_OK(storage.Get(0, MakeKey(1), value));
+    // Overwrites fill and release slabs, including the one holding `value`.
+    for (int i = 0; i < 1000; ++i) {
+      storage.Put(0, MakeKey(1), MakeValue(2));
+    }
+    ASSERT_OK(storage.Truncate(0));
+    EXPECT_EQ(Bytes(value.begin(), value.end()), MakeValue(1));
+    epochs.Reclaim();
+    EXPECT_GT(epochs.RetiredCount(), 0);
+  }
+  epochs.Reclaim();
+  EXPECT_EQ(epochs.RetiredCount(), 0);
+}
+
+TEST(ArenaStorageTest, CollectionsAreIndependent) {
+  ArenaStorage storage(kSlabSize);
+  storage.Put(0, MakeKey(1), MakeValue(1));
+  storage.Put(2, MakeKey(1), MakeValue(2));
+  EXPECT_EQ(storage.GetCollectionCount(), 3);
+  EXPECT_EQ(storage.GetCollectionStats(1).reserved_bytes, 0);
+  BytesConstView value;
+  ASSERT_OK(storage.Get(2, MakeKey(1), value));
+  EXPECT_EQ(Bytes(value.begin(), value.end()), MakeValue(2));
+  EXPECT_NOT_FOUND(storage.Get(1, MakeKey(1), value));
+}
+
+TEST(ArenaStorageTest, MatchesReferenceMapUnderRandomOps) {
+  ArenaStorage storage(kSlabSize);
+  std::map<int, size_t> reference;  // key -> value size
+  std::mt19937 rng(7);
+  std::uniform_int_distribution<int> key_dist(0, 500);
+  std::uniform_int_distribution<size_t> size_dist(0, 300);
+  for (int i = 0; i < 20000; ++i) {
+    const int k = key_dist(rng);
+    if (rng() % 3 == 0) {
+      EXPECT_EQ(storage.Delete(0, MakeKey(k)).ok(), reference.erase(k) == 1);
+    } else {
+      const size_t size = size_dist(rng);
+      storage.Put(0, MakeKey(k), MakeValue(k, size));
+      reference[k] = size;
+    }
+  }
+  EXPECT_EQ(storage.GetCollectionSize(0), reference.size());
+  for (const auto& [k, size] : reference) {
+    ExpectValue(storage, k, size);
+  }
+  ArenaStats stats = storage.GetCollectionStats(0);
+  EXPECT_LE(stats.reserved_bytes, 2 * stats.live_bytes + 2 * kSlabSize);
+}
+
+}  // namespace
+}  // namespace gendb
@@ -0,0 +1,81 @@
+#include "gendb/async_read.h"
+
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <utility>
+
+namespace gendb {
+
+namespace {
+
+// Pins of one MultiGet, shared by the reads it served that keep their values past the flush.
+struct SharedPins : ValuePins::Pin {
+  explicit SharedPins(std::shared_ptr<ValuePins> pins) : pins(std::move(pins)) {}
+  std::shared_ptr<ValuePins> pins;
+};
+
+}  // namespace
+
+size_t AsyncReadQueue::Flush() {
+  std::vector<AsyncRead*> reads;
+  reads.swap(_pending);
+  _pins.Clear();
+
+  // One MultiGet per storage and collection, over the keys of every read of the group.
+  std::vector<AsyncRead*> sorted = reads;
+  std::ranges::stable_sort(sorted, [](const AsyncRead* a, const AsyncRead* b) {
+    if (a->storage != b->storage) {
+      return std::less<>()(a->storage, b->storage);
+    }
+    return a->collection_id < b->collection_id;
+  });
+  std::vector<BytesConstView> keys;
+  std::vector<BytesConstView> values;
+  std::vector<absl::Status> statuses;
+  ValuePins group_pins;
+  for (size_t begin = 0; begin < sorted.size();) {
+    size_t end = begin + 1;
+    while (end < sorted.size() && sorted[end]->storage == sorted[begin]->storage &&
+           sorted[end]->collection_id == sorted[begin]->collection_id) {
+      ++end;
+    }
+    keys.clear();
+    for (size_t i = begin; i < end; ++i) {
+      keys.insert(keys.end(), sorted[i]->keys.begin(), sorted[i]->keys.end());
+    }
+    values.assign(keys.size(), BytesConstView{});
+    statuses.assign(keys.size(), absl::OkStatus());
+    sorted[begin]->storage->MultiGet(sorted[begin]->collection_id, keys, values, statuses,
+                                     group_pins);
+    const bool own_pins = std::any_of(sorted.begin() + begin, sorted.begin() + end,
+                                      [](const AsyncRead* read) { return read->pins != nullptr; });
+    if (own_pins && group_pins.size() > 0) {
+      auto shared = std::make_shared<ValuePins>(std::move(group_pins));
+      group_pins = ValuePins();
+      for (size_t i = begin; i < end; ++i) {
+        ValuePins& pins = sorted[i]->pins != nullptr ? *sorted[i]->pins : _pins;
+        pins.Add(std::make_unique<SharedPins>(shared));
+      }
+    } else {
+      _pins.Append(std::move(group_pins));
+    }
+
+    size_t offset = 0;
+    for (size_t i = begin; i < end; ++i) {
+      AsyncRead& read = *sorted[i];
+      for (size_t k = 0; k < read.keys.size(); ++k, ++offset) {
+        read.values[k] = values[offset];
+        read.statuses[k] = std::move(statuses[offset]);
+      }
+    }
+    begin = end;
+  }
+
+  for (AsyncRead* read : reads) {
+    read->continuation.resume();
+  }
+  return reads.size();
+}
+
+}  // namespace gendb
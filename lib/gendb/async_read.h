@@ -0,0 +1,248 @@
+#pragma once
+
+#include <array>
+#include <coroutine>
+#include <cstddef>
+#include <optional>
+#include <span>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "gendb/bytes.h"
+#include "gendb/index.h"
+#include "gendb/layered_storage.h"
+
+namespace gendb {
+
+// Lookups of a suspended coroutine, performed by AsyncReadQueue::Flush().
+struct AsyncRead {
+  const LayeredStorage* storage;
+  size_t collection_id;
+  std::span<const BytesConstView> keys;
+  std::span<BytesConstView> values;
+  std::span<absl::Status> statuses;
+  // Keeps the values alive past the queue's next Flush(), until cleared, or nullptr.
+  ValuePins* pins;
+  std::coroutine_handle<> continuation;
+};
+
+// Lookups that coroutines wait for, owned by the thread running them. Reads of a storage that
+// blocks (see Storage::ReadsBlock) are queued here instead of being performed inline; Flush()
+// then issues all of them with one MultiGet per storage and collection, so that a single thread
+// keeps as many lookups in flight as it has suspended coroutines. Not thread-safe.
+class AsyncReadQueue {
+ public:
+  void Push(AsyncRead& read) { _pending.push_back(&read); }
+
+  // Performs the queued lookups and resumes their coroutines, in queue order. Lookups queued by
+  // the resumed coroutines wait for the next call. Returns the number of coroutines resumed.
+  // Values pinned by the storages stay valid until the next call, or for reads given their own
+  // pins, until those are cleared.
+  size_t Flush();
+
+  size_t pending() const { return _pending.size(); }
+
+ private:
+  std::vector<AsyncRead*> _pending;
+  ValuePins _pins;
+};
+
+// Awaitable of a batch of lookups through a LayeredStorage; the views and statuses are set when
+// `co_await` returns, valid until `pins` is cleared if given, until the queue's next Flush() for
+// queued reads otherwise, and with the lifetime rules of LayeredStorage::Get for inline ones.
+// Unless the storage blocks and a queue is given, the lookups are performed by await_ready(),
+// with one MultiGet given `pins` and one Get each otherwise: the coroutine does not suspend and,
+// in memory, nothing is allocated.
+class ReadAwaitable {
+ public:
+  // No lookups: ready at once.
+  ReadAwaitable() = default;
+  ReadAwaitable(const LayeredStorage& storage, size_t collection_id,
+                std::span<const BytesConstView> keys, std::span<BytesConstView> values,
+                std::span<absl::Status> statuses, AsyncReadQueue* queue,
+                ValuePins* pins = nullptr)
+      : _read{&storage, collection_id, keys, values, statuses, pins, {}},
+        _queue(queue),
+        _pins(pins) {}
+
+  bool await_ready() {
+    if (_read.keys.empty()) {
+      return true;
+    }
+    if (_queue != nullptr && _read.storage->ReadsBlock()) {
+      return false;
+    }
+    if (_pins != nullptr) {
+      _read.storage->MultiGet(_read.collection_id, _read.keys, _read.values, _read.statuses,
+                              *_pins);
+      return true;
+    }
+    for (size_t i = 0; i < _read.keys.size(); ++i) {
+      _read.statuses[i] = _read.storage->Get(_read.collection_id, _read.keys[i], _read.values[i]);
+    }
+    return true;
+  }
+
+  void await_suspend(std::coroutine_handle<> continuation) {
+    _read.continuation = continuation;
+    _queue->Push(_read);
+  }
+
+  void await_resume() {}
+
+  // For awaitables that bind the spans to their own members once those stop moving.
+  void Bind(std::span<const BytesConstView> keys, std::span<BytesConstView> values,
+            std::span<absl::Status> statuses) {
+    _read.keys = keys;
+    _read.values = values;
+    _read.statuses = statuses;
+  }
+
+ private:
+  AsyncRead _read{};
+  AsyncReadQueue* _queue = nullptr;
+  ValuePins* _pins = nullptr;
+};
+
+// Awaitable of a point read: `co_await` returns the status and, when OK, sets the message.
+// `KeyT` is the encoded primary key, held by the awaitable.
+template <typename MessageT, typename KeyT>
+class GetMessageAwaitable {
+ public:
+  GetMessageAwaitable(const LayeredStorage& storage, size_t collection_id, KeyT key,
+                      MessageT& message, AsyncReadQueue* queue)
+      : _read(storage, collection_id, {}, {}, {}, queue),
+        _key(std::move(key)),
+        _message(message) {}
+
+  bool await_ready() {
+    // The awaitable no longer moves once awaited.
+    _key_view = BytesConstView(_key);
+    _read.Bind(std::span(&_key_view, 1), std::span(&_value, 1), std::span(&_status, 1));
+    return _read.await_ready();
+  }
+
+  void await_suspend(std::coroutine_handle<> continuation) { _read.await_suspend(continuation); }
+
+  absl::Status await_resume() {
+    if (_status.ok()) {
+      _message = MessageT{_value};
+    }
+    return std::move(_status);
+  }
+
+ private:
+  ReadAwaitable _read;
+  KeyT _key;
+  MessageT& _message;
+  BytesConstView _key_view;
+  BytesConstView _value;
+  absl::Status _status;
+};
+
+// Secondary index scan whose message reads are awaited: each `co_await it.Next()` moves to the
+// message of the next record, reading them kBatchSize at a time with one ReadAwaitable. It
+// returns false at the end or on a failed read, which Status() then reports. Keep the result in a
+// local rather than awaiting inside a loop condition, which GCC 12 miscompiles.
+template <typename T, typename IteratorT>
+class AsyncSecondaryIndexIterator {
+ public:
+  static constexpr size_t kBatchSize = 64;
+
+  using PrimKey =
+      std::remove_cvref_t<decltype(std::declval<const IteratorT&>().Value().prim_key)>;
+
+  class NextAwaitable {
+   public:
+    bool await_ready() { return _read.await_ready(); }
+    void await_suspend(std::coroutine_handle<> continuation) { _read.await_suspend(continuation); }
+    bool await_resume() { return _it.LoadCurrent(); }
+
+   private:
+    friend class AsyncSecondaryIndexIterator;
+    NextAwaitable(AsyncSecondaryIndexIterator& it, ReadAwaitable read)
+        : _it(it), _read(std::move(read)) {}
+
+    AsyncSecondaryIndexIterator& _it;
+    ReadAwaitable _read;
+  };
+
+  AsyncSecondaryIndexIterator(const LayeredStorage& storage, size_t collection_id,
+                              IteratorT merge_it, AsyncReadQueue* queue)
+      : _storage(storage),
+        _collection_id(collection_id),
+        _merge_it(std::move(merge_it)),
+        _queue(queue) {}
+
+  // The iterator must outlive the awaitable.
+  NextAwaitable Next() {
+    if (_position + 1 < _count) {
+      ++_position;
+      return {*this, ReadAwaitable()};
+    }
+    FillBatch();
+    return {*this, ReadAwaitable(_storage, _collection_id, std::span(_keys.data(), _count),
+                                 std::span(_values.data(), _count),
+                                 std::span(_statuses.data(), _count), _queue, &_pins)};
+  }
+
+  // The message Next() moved to.
+  const T& Value() const { return _current_value.value(); }
+
+  absl::Status Status() const { return _status; }
+
+ private:
+  // Copies the primary keys of the next records, skipping the deleted ones like
+  // SecondaryIndexIterator does.
+  void FillBatch() {
+    _position = 0;
+    _count = 0;
+    _pins.Clear();
+    for (; _merge_it.Valid() && _count < kBatchSize; _merge_it.Next()) {
+      if (_merge_it.Value().is_deleted) {
+        continue;
+      }
+      _prim_keys[_count] = _merge_it.Value().prim_key;
+      _keys[_count] = BytesConstView{_prim_keys[_count]};
+      ++_count;
+    }
+  }
+
+  bool LoadCurrent() {
+    _current_value.reset();
+    if (_position >= _count) {
+      _status = absl::OutOfRangeError("End of iterator");
+      return false;
+    }
+    if (!_statuses[_position].ok()) {
+      _status = _statuses[_position];
+      return false;
+    }
+    _current_value = T{_values[_position]};
+    return true;
+  }
+
+  const LayeredStorage& _storage;
+  const size_t _collection_id;
+  IteratorT _merge_it;
+  AsyncReadQueue* const _queue;
+  std::array<PrimKey, kBatchSize> _prim_keys;
+  std::array<BytesConstView, kBatchSize> _keys;
+  std::array<BytesConstView, kBatchSize> _values;
+  std::array<absl::Status, kBatchSize> _statuses;
+  // Keeps the values of the batch alive until the next one, whether read inline or queued: the
+  // coroutine may await other reads, and so flush the queue, between two Next() calls.
+  ValuePins _pins;
+  size_t _position = 0;
+  size_t _count = 0;
+  std::optional<T> _current_value;
+  absl::Status _status = absl::OkStatus();
+};
+
+// AsyncSecondaryIndexIterator over a range of one index.
+template <typename T, typename IndexT>
+using AsyncIndexIterator = AsyncSecondaryIndexIterator<T, SingleSetIterator<IndexT>>;
+
+}  // namespace gendb
@@ -0,0 +1,251 @@
+#include "gendb/async_read.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <array>
+#include <coroutine>
+#include <exception>
+#include <filesystem>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "gendb/index.h"
+#include "gendb/storage.h"
+
+namespace gendb {
+namespace {
+
+// Coroutine that starts at once and is not awaited; `done` is set when it returns.
+struct Detached {
+  struct promise_type {
+    Detached get_return_object() { return {}; }
+    std::suspend_never initial_suspend() { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_void() {}
+    void unhandled_exception() { std::terminate(); }
+  };
+};
+
+// Message type that keeps the value as a string.
+struct Text {
+  Text() = default;
+  explicit Text(BytesConstView value)
+      : text(reinterpret_cast<const char*>(value.data()), value.size()) {}
+  std::string text;
+};
+
+std::array<uint8_t, 4> Key(uint32_t i) {
+  return {static_cast<uint8_t>(i >> 24), static_cast<uint8_t>(i >> 16),
+          static_cast<uint8_t>(i >> 8), static_cast<uint8_t>(i)};
+}
+
+Bytes Value(uint32_t i) {
+  const std::string value = "value" + std::to_string(i);
+  return {value.begin(), value.end()};
+}
+
+Detached GetText(const LayeredStorage& storage, uint32_t i, AsyncReadQueue* queue, Text& text,
+                 absl::Status& status, bool& done) {
+  status = co_await GetMessageAwaitable<Text, std::array<uint8_t, 4>>(storage, 0, Key(i), text,
+                                                                      queue);
+  done = true;
+}
+
+class AsyncReadTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    _path = std::filesystem::temp_directory_path() /
+            ("async_read_test_" + std::to_string(std::random_device{}()));
+    std::filesystem::remove_all(_path);
+  }
+
+  void TearDown() override { std::filesystem::remove_all(_path); }
+
+  std::filesystem::path _path;
+};
+
+TEST_F(AsyncReadTest, InMemoryReadsCompleteWithoutSuspending) {
+  MemoryStorage storage;
+  storage.Put(0, BytesConstView(Key(1)), Value(1));
+  LayeredStorage layered(storage, /*temp_storage_ptr=*/nullptr);
+  AsyncReadQueue queue;
+  Text text;
+  absl::Status status;
+  bool done = false;
+  GetText(layered, 1, &queue, text, status, done);
+  EXPECT_TRUE(done);
+  EXPECT_EQ(queue.pending(), 0);
+  EXPECT_TRUE(status.ok());
+  EXPECT_EQ(text.text, "value1");
+}
+
+TEST_F(AsyncReadTest, BlockingReadsAreBatchedByFlush) {
+  constexpr uint32_t kReads = 200;
+  RocksDBStorage storage(_path.string());
+  for (uint32_t i = 0; i < kReads; i += 2) {
+    storage.Put(0, BytesConstView(Key(i)), Value(i));
+  }
+  LayeredStorage layered(storage, /*temp_storage_ptr=*/nullptr);
+  AsyncReadQueue queue;
+  std::vector<Text> texts(kReads);
+  std::vector<absl::Status> statuses(kReads);
+  std::array<bool, kReads> done{};
+  for (uint32_t i = 0; i < kReads; ++i) {
+    GetText(layered, i, &queue, texts[i], statuses[i], done[i]);
+  }
+  // Every lookup is in flight at once on this thread.
+  EXPECT_EQ(queue.pending(), kReads);
+  EXPECT_EQ(std::ranges::count(done, true), 0);
+
+  EXPECT_EQ(queue.Flush(), kReads);
+  EXPECT_EQ(queue.pending(), 0);
+  for (uint32_t i = 0; i < kReads; ++i) {
+    EXPECT_TRUE(done[i]);
+    if (i % 2 == 0) {
+      EXPECT_TRUE(statuses[i].ok());
+      EXPECT_EQ(texts[i].text, "value" + std::to_string(i));
+    } else {
+      EXPECT_TRUE(absl::IsNotFound(statuses[i]));
+    }
+  }
+}
+
+TEST_F(AsyncReadTest, WithoutQueueBlockingReadsCompleteInline) {
+  RocksDBStorage storage(_path.string());
+  storage.Put(0, BytesConstView(Key(1)), Value(1));
+  LayeredStorage layered(storage, /*temp_storage_ptr=*/nullptr);
+  Text text;
+  absl::Status status;
+  bool done = false;
+  GetText(layered, 1, /*queue=*/nullptr, text, status, done);
+  EXPECT_TRUE(done);
+  EXPECT_EQ(text.text, "value1");
+}
+
+using TestIndex = Index<int32_t, std::array<uint8_t, 4>>;
+
+Detached ScanTexts(AsyncIndexIterator<Text, TestIndex> it, std::vector<std::string>& texts,
+                   absl::Status& status, bool& done) {
+  while (true) {
+    const bool more = co_await it.Next();
+    if (!more) {
+      break;
+    }
+    texts.push_back(it.Value().text);
+  }
+  status = it.Status();
+  done = true;
+}
+
+TEST_F(AsyncReadTest, IndexScanReadsBatchesPerFlush) {
+  constexpr uint32_t kRecords = 150;
+  RocksDBStorage storage(_path.string());
+  TestIndex index;
+  for (uint32_t i = 0; i < kRecords; ++i) {
+    storage.Put(0, BytesConstView(Key(i)), Value(i));
+    index.Insert(static_cast<int32_t>(i), Key(i));
+  }
+  // Removed records are skipped.
+  index.Insert(5, Key(1000), /*is_deleted=*/true);
+  LayeredStorage layered(storage, /*temp_storage_ptr=*/nullptr);
+  AsyncReadQueue queue;
+  std::vector<std::string> texts;
+  absl::Status status;
+  bool done = false;
+  ScanTexts({layered, 0, SingleSetIterator<TestIndex>(index.begin(), index.end()), &queue}, texts,
+            status, done);
+
+  // One read per batch of kBatchSize records; the empty batch at the end needs none.
+  int flushes = 0;
+  while (!done) {
+    ASSERT_EQ(queue.pending(), 1);
+    queue.Flush();
+    ++flushes;
+  }
+  EXPECT_EQ(flushes, 3);
+  EXPECT_TRUE(absl::IsOutOfRange(status));
+  ASSERT_EQ(texts.size(), kRecords);
+  for (uint32_t i = 0; i < kRecords; ++i) {
+    EXPECT_EQ(texts[i], "value" + std::to_string(i));
+  }
+}
+
+TEST_F(AsyncReadTest, WithoutQueueIndexScanKeepsTheBatchReadInline) {
+  constexpr uint32_t kRecords = 150;
+  RocksDBStorage storage(_path.string());
+  TestIndex index;
+  for (uint32_t i = 0; i < kRecords; ++i) {
+    storage.Put(0, BytesConstView(Key(i)), Value(i));
+    index.Insert(static_cast<int32_t>(i), Key(i));
+  }
+  LayeredStorage layered(storage, /*temp_storage_ptr=*/nullptr);
+  std::vector<std::string> texts;
+  absl::Status status;
+  bool done = false;
+  // Each message is read after the whole batch of kBatchSize values it belongs to.
+  ScanTexts({layered, 0, SingleSetIterator<TestIndex>(index.begin(), index.end()), nullptr},
+            texts, status, done);
+
+  EXPECT_TRUE(done);
+  EXPECT_TRUE(absl::IsOutOfRange(status));
+  ASSERT_EQ(texts.size(), kRecords);
+  for (uint32_t i = 0; i < kRecords; ++i) {
+    EXPECT_EQ(texts[i], "value" + std::to_string(i));
+  }
+}
+
+Detached ScanTextsWithGets(AsyncIndexIterator<Text, TestIndex> it, const LayeredStorage& storage,
+                           AsyncReadQueue* queue, std::vector<std::string>& texts,
+                           absl::Status& status, bool& done) {
+  while (true) {
+    const bool more = co_await it.Next();
+    if (!more) {
+      break;
+    }
+    // Flushes the queue between two messages of the same batch.
+    Text other;
+    absl::Status other_status = co_await GetMessageAwaitable<Text, std::array<uint8_t, 4>>(
+        storage, 0, Key(0), other, queue);
+    if (!other_status.ok() || other.text != "value0") {
+      status = other_status.ok() ? absl::InternalError(other.text) : other_status;
+      break;
+    }
+    texts.push_back(it.Value().text);
+  }
+  if (status.ok()) {
+    status = it.Status();
+  }
+  done = true;
+}
+
+TEST_F(AsyncReadTest, IndexScanValuesOutliveFlushesOfOtherReads) {
+  constexpr uint32_t kRecords = 100;
+  RocksDBStorage storage(_path.string());
+  TestIndex index;
+  for (uint32_t i = 0; i < kRecords; ++i) {
+    storage.Put(0, BytesConstView(Key(i)), Value(i));
+    index.Insert(static_cast<int32_t>(i), Key(i));
+  }
+  LayeredStorage layered(storage, /*temp_storage_ptr=*/nullptr);
+  AsyncReadQueue queue;
+  std::vector<std::string> texts;
+  absl::Status status;
+  bool done = false;
+  ScanTextsWithGets({layered, 0, SingleSetIterator<TestIndex>(index.begin(), index.end()), &queue},
+                    layered, &queue, texts, status, done);
+  while (!done) {
+    ASSERT_EQ(queue.pending(), 1);
+    queue.Flush();
+  }
+
+  EXPECT_TRUE(absl::IsOutOfRange(status));
+  ASSERT_EQ(texts.size(), kRecords);
+  for (uint32_t i = 0; i < kRecords; ++i) {
+    EXPECT_EQ(texts[i], "value" + std::to_string(i));
+  }
+}
+
+}  // namespace
+}  // namespace gendb
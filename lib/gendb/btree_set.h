@@ -0,0 +1,378 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+
+#include "gendb/bytes.h"
+#include "gendb/small_key.h"
+
+namespace gendb {
+
+namespace internal::btree {
+
+// Bytewise order: memcmp over the common prefix, then the shorter key first. key_codec encodes
+// primary keys so that this is the order of the key tuples.
+inline int CompareKeys(BytesConstView a, BytesConstView b) {
+  const size_t common = std::min(a.size(), b.size());
+  if (common > 0) {
+    if (int c = std::memcmp(a.data(), b.data(), common); c != 0) {
+      return c;
+    }
+  }
+  return a.size() < b.size() ? -1 : (a.size() > b.size() ? 1 : 0);
+}
+
+struct KeyLess {
+  bool operator()(const SmallKey& a, BytesConstView b) const { return CompareKeys(a, b) < 0; }
+  bool operator()(BytesConstView a, const SmallKey& b) const { return CompareKeys(a, b) < 0; }
+};
+
+}  // namespace internal::btree
+
+// Ordered set of byte-string keys stored as a B+tree. Keys sit inline in fixed-size nodes (a
+// SmallKey keeps keys up to 16 bytes inside the node), so a lookup touches one contiguous key
+// array per level, and leaves are chained for in-order scans. Nodes are rebalanced on erase, so
+// every node except the root stays at least half full.
+//
+// Iterators are invalidated by any insert or erase.
+class BTreeSet {
+ public:
+  // Keys per node. Nodes hold one extra slot so an insert can overflow before splitting.
+  static constexpr uint32_t kNodeSize = 32;
+  static constexpr uint32_t kMinKeys = kNodeSize / 2;
+
+ private:
+  struct Node {
+    explicit Node(bool is_leaf) : leaf(is_leaf) {}
+    const bool leaf;
+    uint32_t count = 0;
+    SmallKey keys[kNodeSize + 1];
+  };
+  struct Leaf : Node {
+    Leaf() : Node(true) {}
+    Leaf* next = nullptr;
+  };
+  // children[i] holds the keys in [keys[i - 1], keys[i]).
+  struct Inner : Node {
+    Inner() : Node(false) {}
+    Node* children[kNodeSize + 2] = {};
+  };
+
+ public:
+  class const_iterator {
+   public:
+    const_iterator() = default;
+
+    BytesConstView operator*() const { return _leaf->keys[_pos]; }
+    const_iterator& operator++() {
+      if (++_pos == _leaf->count) {
+        _leaf = _leaf->next;
+        _pos = 0;
+      }
+      return *this;
+    }
+    bool operator==(const const_iterator& other) const = default;
+
+   private:
+    friend class BTreeSet;
+    const_iterator(const Leaf* leaf, uint32_t pos) : _leaf(leaf), _pos(pos) {}
+
+    const Leaf* _leaf = nullptr;
+    uint32_t _pos = 0;
+  };
+
+  BTreeSet() = default;
+  BTreeSet(const BTreeSet&) = delete;
+  BTreeSet& operator=(const BTreeSet&) = delete;
+  BTreeSet(BTreeSet&& other) noexcept
+      : _root(std::exchange(other._root, nullptr)), _size(std::exchange(other._size, 0)) {}
+  BTreeSet& operator=(BTreeSet&& other) noexcept {
+    std::swap(_root, other._root);
+    std::swap(_size, other._size);
+    return *this;
+  }
+  ~BTreeSet() { Free(_root); }
+
+  size_t size() const { return _size; }
+  bool empty() const { return _size == 0; }
+
+  const_iterator begin() const {
+    if (_root == nullptr || _size == 0) {
+      return end();
+    }
+    const Node* node = _root;
+    while (!node->leaf) {
+      node = static_cast<const Inner*>(node)->children[0];
+    }
+    return {static_cast<const Leaf*>(node), 0};
+  }
+  const_iterator end() const { return {}; }
+
+  // First key not less than `key`.
+  const_iterator lower_bound(BytesConstView key) const {
+    if (_root == nullptr) {
+      return end();
+    }
+    const Leaf* leaf = FindLeaf(key);
+    const uint32_t pos = LowerBound(*leaf, key);
+    if (pos < leaf->count) {
+      return {leaf, pos};
+    }
+    // Non-root leaves are never empty, so the next leaf starts with the successor.
+    return leaf->next == nullptr ? end() : const_iterator(leaf->next, 0);
+  }
+
+  bool contains(BytesConstView key) const {
+    if (_root == nullptr) {
+      return false;
+    }
+    const Leaf* leaf = FindLeaf(key);
+    const uint32_t pos = LowerBound(*leaf, key);
+    return pos < leaf->count && leaf->keys[pos] == key;
+  }
+
+  // Returns false if the key was already present.
+  bool insert(BytesConstView key) {
+    if (_root == nullptr) {
+      _root = new Leaf();
+    }
+    SmallKey separator;
+    Node* right = nullptr;
+    if (!Insert(_root, key, separator, right)) {
+      return false;
+    }
+    ++_size;
+    if (right != nullptr) {
+      auto* root = new Inner();
+      root->keys[0] = std::move(separator);
+      root->children[0] = _root;
+      root->children[1] = right;
+      root->count = 1;
+      _root = root;
+    }
+    return true;
+  }
+
+  // Returns the number of erased keys (0 or 1).
+  size_t erase(BytesConstView key) {
+    if (_root == nullptr || !Erase(_root, key)) {
+      return 0;
+    }
+    --_size;
+    if (!_root->leaf && _root->count == 0) {
+      auto* old_root = static_cast<Inner*>(_root);
+      _root = old_root->children[0];
+      delete old_root;
+    }
+    return 1;
+  }
+
+  void clear() {
+    Free(_root);
+    _root = nullptr;
+    _size = 0;
+  }
+
+ private:
+  static uint32_t LowerBound(const Node& node, BytesConstView key) {
+    return static_cast<uint32_t>(
+        std::lower_bound(node.keys, node.keys + node.count, key, internal::btree::KeyLess()) -
+        node.keys);
+  }
+  // Child of an inner node whose range holds `key`.
+  static uint32_t ChildIndex(const Node& node, BytesConstView key) {
+    return static_cast<uint32_t>(
+        std::upper_bound(node.keys, node.keys + node.count, key, internal::btree::KeyLess()) -
+        node.keys);
+  }
+
+  const Leaf* FindLeaf(BytesConstView key) const {
+    const Node* node = _root;
+    while (!node->leaf) {
+      const auto* inner = static_cast<const Inner*>(node);
+      node = inner->children[ChildIndex(*inner, key)];
+    }
+    return static_cast<const Leaf*>(node);
+  }
+
+  // Inserts into the subtree at `node`. On overflow the node is split and the new right sibling
+  // and its separator are returned through `right` and `separator`.
+  static bool Insert(Node* node, BytesConstView key, SmallKey& separator, Node*& right) {
+    if (node->leaf) {
+      auto* leaf = static_cast<Leaf*>(node);
+      const uint32_t pos = LowerBound(*leaf, key);
+      if (pos < leaf->count && leaf->keys[pos] == key) {
+        return false;
+      }
+      std::move_backward(leaf->keys + pos, leaf->keys + leaf->count,
+                         leaf->keys + leaf->count + 1);
+      leaf->keys[pos] = SmallKey(key);
+      if (++leaf->count > kNodeSize) {
+        auto* sibling = new Leaf();
+        const uint32_t mid = leaf->count / 2;
+        std::move(leaf->keys + mid, leaf->keys + leaf->count, sibling->keys);
+        sibling->count = leaf->count - mid;
+        leaf->count = mid;
+        sibling->next = leaf->next;
+        leaf->next = sibling;
+        separator = sibling->keys[0];
+        right = sibling;
+      }
+      return true;
+    }
+
+    auto* inner = static_cast<Inner*>(node);
+    const uint32_t index = ChildIndex(*inner, key);
+    SmallKey child_separator;
+    Node* child_right = nullptr;
+    if (!Insert(inner->children[index], key, child_separator, child_right)) {
+      return false;
+    }
+    if (child_right == nullptr) {
+      return true;
+    }
+    std::move_backward(inner->keys + index, inner->keys + inner->count,
+                       inner->keys + inner->count + 1);
+    std::move_backward(inner->children + index + 1, inner->children + inner->count + 1,
+                       inner->children + inner->count + 2);
+    inner->keys[index] = std::move(child_separator);
+    inner->children[index + 1] = child_right;
+    if (++inner->count > kNodeSize) {
+      // The middle key moves up; it separates the two halves and stays in neither.
+      auto* sibling = new Inner();
+      const uint32_t mid = inner->count / 2;
+      std::move(inner->keys + mid + 1, inner->keys + inner->count, sibling->keys);
+      std::copy(inner->children + mid + 1, inner->children + inner->count + 1,
+                sibling->children);
+      sibling->count = inner->count - mid - 1;
+      separator = std::move(inner->keys[mid]);
+      inner->count = mid;
+      right = sibling;
+    }
+    return true;
+  }
+
+  // Erases from the subtree at `node`; the caller fixes an underflow of `node`.
+  static bool Erase(Node* node, BytesConstView key) {
+    if (node->leaf) {
+      const uint32_t pos = LowerBound(*node, key);
+      if (pos == node->count || !(node->keys[pos] == key)) {
+        return false;
+      }
+      std::move(node->keys + pos + 1, node->keys + node->count, node->keys + pos);
+      node->keys[--node->count] = SmallKey();
+      return true;
+    }
+    // Separators may outlive the keys they were copied from; they still partition correctly.
+    auto* inner = static_cast<Inner*>(node);
+    const uint32_t index = ChildIndex(*inner, key);
+    if (!Erase(inner->children[index], key)) {
+      return false;
+    }
+    if (inner->children[index]->count < kMinKeys) {
+      Rebalance(*inner, index);
+    }
+    return true;
+  }
+
+  // Refills the underfull child `index` from a sibling, or merges it with one.
+  static void Rebalance(Inner& parent, uint32_t index) {
+    Node* child = parent.children[index];
+    Node* left = index > 0 ? parent.children[index - 1] : nullptr;
+    Node* right = index < parent.count ? parent.children[index + 1] : nullptr;
+
+    if (left != nullptr && left->count > kMinKeys) {
+      std::move_backward(child->keys, child->keys + child->count,
+                         child->keys + child->count + 1);
+      if (child->leaf) {
+        child->keys[0] = std::move(left->keys[left->count - 1]);
+        parent.keys[index - 1] = child->keys[0];
+      } else {
+        auto* inner = static_cast<Inner*>(child);
+        auto* left_inner = static_cast<Inner*>(left);
+        std::move_backward(inner->children, inner->children + inner->count + 1,
+                           inner->children + inner->count + 2);
+        inner->keys[0] = std::move(parent.keys[index - 1]);
+        inner->children[0] = left_inner->children[left->count];
+        parent.keys[index - 1] = std::move(left->keys[left->count - 1]);
+      }
+      left->keys[--left->count] = SmallKey();
+      ++child->count;
+      return;
+    }
+
+    if (right != nullptr && right->count > kMinKeys) {
+      if (child->leaf) {
+        child->keys[child->count] = std::move(right->keys[0]);
+        std::move(right->keys + 1, right->keys + right->count, right->keys);
+        parent.keys[index] = right->keys[0];
+      } else {
+        auto* inner = static_cast<Inner*>(child);
+        auto* right_inner = static_cast<Inner*>(right);
+        inner->keys[child->count] = std::move(parent.keys[index]);
+        inner->children[child->count + 1] = right_inner->children[0];
+        parent.keys[index] = std::move(right->keys[0]);
+        std::move(right->keys + 1, right->keys + right->count, right->keys);
+        std::copy(right_inner->children + 1, right_inner->children + right->count + 1,
+                  right_inner->children);
+      }
+      right->keys[--right->count] = SmallKey();
+      ++child->count;
+      return;
+    }
+
+    // Neither sibling can spare a key: merge the child with one of them.
+    if (left != nullptr) {
+      Merge(parent, index - 1);
+    } else if (right != nullptr) {
+      Merge(parent, index);
+    }
+  }
+
+  // Merges children[index + 1] into children[index] and drops it from the parent.
+  static void Merge(Inner& parent, uint32_t index) {
+    Node* left = parent.children[index];
+    Node* right = parent.children[index + 1];
+    if (left->leaf) {
+      std::move(right->keys, right->keys + right->count, left->keys + left->count);
+      left->count += right->count;
+      static_cast<Leaf*>(left)->next = static_cast<Leaf*>(right)->next;
+      delete static_cast<Leaf*>(right);
+    } else {
+      auto* left_inner = static_cast<Inner*>(left);
+      auto* right_inner = static_cast<Inner*>(right);
+      left->keys[left->count] = std::move(parent.keys[index]);
+      std::move(right->keys, right->keys + right->count, left->keys + left->count + 1);
+      std::copy(right_inner->children, right_inner->children + right->count + 1,
+                left_inner->children + left->count + 1);
+      left->count += right->count + 1;
+      delete right_inner;
+    }
+    std::move(parent.keys + index + 1, parent.keys + parent.count, parent.keys + index);
+    std::copy(parent.children + index + 2, parent.children + parent.count + 1,
+              parent.children + index + 1);
+    parent.keys[--parent.count] = SmallKey();
+  }
+
+  static void Free(Node* node) {
+    if (node == nullptr) {
+      return;
+    }
+    if (node->leaf) {
+      delete static_cast<Leaf*>(node);
+      return;
+    }
+    auto* inner = static_cast<Inner*>(node);
+    for (uint32_t i = 0; i <= inner->count; ++i) {
+      Free(inner->children[i]);
+    }
+    delete inner;
+  }
+
+  Node* _root = nullptr;
+  size_t _size = 0;
+};
+
+}  // namespace gendb
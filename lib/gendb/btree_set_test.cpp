@@ -0,0 +1,104 @@
+#include "gendb/btree_set.h"
+
+#include <gtest/gtest.h>
+
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace gendb {
+namespace {
+
+BytesConstView StringToBytesView(const std::string& str) {
+  return {reinterpret_cast<const uint8_t*>(str.data()), str.size()};
+}
+
+std::string BytesViewToString(BytesConstView bytes) {
+  return {reinterpret_cast<const char*>(bytes.data()), bytes.size()};
+}
+
+std::vector<std::string> Keys(const BTreeSet& set) {
+  std::vector<std::string> keys;
+  for (BytesConstView key : set) {
+    keys.push_back(BytesViewToString(key));
+  }
+  return keys;
+}
+
+TEST(BTreeSetTest, EmptySet) {
+  BTreeSet set;
+  EXPECT_TRUE(set.empty());
+  EXPECT_EQ(set.begin(), set.end());
+  EXPECT_EQ(set.lower_bound(StringToBytesView("a")), set.end());
+  EXPECT_FALSE(set.contains(StringToBytesView("a")));
+  EXPECT_EQ(set.erase(StringToBytesView("a")), 0);
+}
+
+TEST(BTreeSetTest, BytewiseOrder) {
+  BTreeSet set;
+  for (const std::string& key :
+       std::vector<std::string>{"b", "a\xff", "", "ab", "a", std::string("a\0", 2)}) {
+    EXPECT_TRUE(set.insert(StringToBytesView(key)));
+  }
+  EXPECT_FALSE(set.insert(StringToBytesView("ab")));
+  // Unsigned bytes: 0xff sorts after 'b'.
+  EXPECT_EQ(Keys(set),
+            (std::vector<std::string>{"", "a", std::string("a\0", 2), "ab", "a\xff", "b"}));
+}
+
+TEST(BTreeSetTest, LowerBoundCrossesLeaves) {
+  BTreeSet set;
+  for (int i = 0; i < 1000; i += 2) {
+    set.insert(StringToBytesView(std::to_string(10000 + i)));
+  }
+  for (int i = 0; i < 998; ++i) {
+    auto it = set.lower_bound(StringToBytesView(std::to_string(10000 + i)));
+    ASSERT_NE(it, set.end());
+    EXPECT_EQ(BytesViewToString(*it), std::to_string(10000 + i + i % 2));
+  }
+  EXPECT_EQ(set.lower_bound(StringToBytesView("10999")), set.end());
+}
+
+TEST(BTreeSetTest, MatchesStdSetUnderRandomOps) {
+  BTreeSet set;
+  std::set<std::string> reference;
+  std::mt19937 rng(11);
+  std::uniform_int_distribution<int> key_dist(0, 3000);
+  for (int i = 0; i < 100000; ++i) {
+    // Mix inline and heap-allocated SmallKeys.
+    const int k = key_dist(rng);
+    const std::string key = std::to_string(k) + (k % 3 == 0 ? std::string(20, 'x') : "");
+    if (rng() % 5 < 2) {
+      EXPECT_EQ(set.erase(StringToBytesView(key)), reference.erase(key));
+    } else {
+      EXPECT_EQ(set.insert(StringToBytesView(key)), reference.insert(key).second);
+    }
+  }
+  EXPECT_EQ(set.size(), reference.size());
+  EXPECT_EQ(Keys(set), std::vector<std::string>(reference.begin(), reference.end()));
+
+  // Drain completely; the tree collapses back to an empty root.
+  for (const std::string& key : reference) {
+    ASSERT_EQ(set.erase(StringToBytesView(key)), 1);
+    ASSERT_FALSE(set.contains(StringToBytesView(key)));
+  }
+  EXPECT_TRUE(set.empty());
+  EXPECT_EQ(set.begin(), set.end());
+  EXPECT_TRUE(set.insert(StringToBytesView("again")));
+  EXPECT_EQ(Keys(set), std::vector<std::string>{"again"});
+}
+
+TEST(BTreeSetTest, MoveLeavesSourceEmpty) {
+  BTreeSet set;
+  for (int i = 0; i < 100; ++i) {
+    set.insert(StringToBytesView(std::to_string(i)));
+  }
+  BTreeSet moved(std::move(set));
+  EXPECT_EQ(moved.size(), 100);
+  EXPECT_TRUE(set.empty());
+  EXPECT_EQ(set.begin(), set.end());
+}
+
+}  // namespace
+}  // namespace gendb
@@ -0,0 +1,84 @@
+#include "gendb/change_stream.h"
+
+#include <algorithm>
+#include <bit>
+#include <memory>
+
+#include "absl/strings/str_cat.h"
+
+namespace gendb {
+
+absl::Status ChangeStream::Subscriber::Next(ChangeBatch& batch) {
+  if (!_status.ok()) {
+    return _status;
+  }
+  // Keeps the batch from being freed while it is copied, should it be overwritten meanwhile.
+  EpochManager::ReadSection section = _stream->_epochs.Enter();
+  const Node* node = _stream->_slots[_position & _stream->_mask].load(std::memory_order_acquire);
+  if (node == nullptr || node->position < _position) {
+    return absl::OutOfRangeError("No new changes");
+  }
+  if (node->position > _position) {
+    _status = absl::DataLossError(
+        absl::StrCat("The changes after sequence ", _last_sequence, " were overwritten"));
+    return _status;
+  }
+  batch.sequence = node->batch.sequence;
+  batch.changes = node->batch.changes;
+  ++_position;
+  _last_sequence = batch.sequence;
+  return absl::OkStatus();
+}
+
+ChangeStream::ChangeStream(size_t capacity)
+    : _slots(std::bit_ceil(std::max<size_t>(capacity, 1))), _mask(_slots.size() - 1) {}
+
+ChangeStream::~ChangeStream() {
+  for (std::atomic<const Node*>& slot : _slots) {
+    delete slot.load(std::memory_order_relaxed);
+  }
+}
+
+ChangeStream::Subscriber ChangeStream::Subscribe() {
+  _active.store(true, std::memory_order_release);
+  return Subscriber(*this, _published.load(std::memory_order_acquire), /*last_sequence=*/0,
+                    absl::OkStatus());
+}
+
+ChangeStream::Subscriber ChangeStream::Resume(uint64_t sequence) {
+  _active.store(true, std::memory_order_release);
+  EpochManager::ReadSection section = _epochs.Enter();
+  const uint64_t published = _published.load(std::memory_order_acquire);
+  // The oldest batch still in the ring after `sequence`. Sequence numbers grow with positions.
+  uint64_t position = published > _slots.size() ? published - _slots.size() : 0;
+  for (; position < published; ++position) {
+    const Node* node = _slots[position & _mask].load(std::memory_order_acquire);
+    if (node->position == position && node->batch.sequence > sequence) {
+      break;
+    }
+  }
+  absl::Status status = absl::OkStatus();
+  if (_evicted_sequence.load(std::memory_order_acquire) > sequence) {
+    status = absl::DataLossError(
+        absl::StrCat("The changes after sequence ", sequence, " were overwritten"));
+  }
+  return Subscriber(*this, position, sequence, std::move(status));
+}
+
+void ChangeStream::Publish(uint64_t sequence, WalBatch&& changes) {
+  const uint64_t position = _published.load(std::memory_order_relaxed);
+  std::atomic<const Node*>& slot = _slots[position & _mask];
+  const Node* replaced = slot.load(std::memory_order_relaxed);
+  if (replaced != nullptr) {
+    // Before the slot changes, so that a Resume() that missed the batch learns it was lost.
+    _evicted_sequence.store(replaced->batch.sequence, std::memory_order_release);
+  }
+  slot.store(new Node{position, {sequence, std::move(changes)}}, std::memory_order_release);
+  _last_sequence.store(sequence, std::memory_order_release);
+  _published.store(position + 1, std::memory_order_release);
+  if (replaced != nullptr) {
+    _epochs.Retire(std::unique_ptr<const Node>(replaced));
+  }
+}
+
+}  // namespace gendb
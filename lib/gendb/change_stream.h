@@ -0,0 +1,103 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "gendb/epoch.h"
+#include "gendb/wal.h"
+
+namespace gendb {
+
+// The changes of one commit, with its sequence number. Decode them with ForEachWalOp: puts,
+// deletes and the MessagePatch of each update, by collection id, in the order the commit made
+// them.
+struct ChangeBatch {
+  uint64_t sequence = 0;
+  WalBatch changes;
+};
+
+// Change data capture: publishes committed batches to any number of subscribers through a
+// bounded ring. Publishing never waits for subscribers: each reads at its own pace, and one that
+// falls more than capacity() batches behind loses the overwritten ones, which it is told about.
+// Slots hold pointers swapped atomically, and the batches they replace are freed once no
+// subscriber can still be copying them (see EpochManager), so neither side takes a lock.
+class ChangeStream {
+ public:
+  static constexpr size_t kDefaultCapacity = 1024;
+
+  class Subscriber {
+   public:
+    // Copies the next batch into `batch`. OutOfRangeError if none was published since the last
+    // one read: poll again later. DataLossError, for good, if the next batch was overwritten
+    // before it was read.
+    absl::Status Next(ChangeBatch& batch);
+
+    // Sequence number of the last batch read, or the one given to Resume(); 0 if neither.
+    uint64_t last_sequence() const { return _last_sequence; }
+
+   private:
+    friend class ChangeStream;
+    Subscriber(ChangeStream& stream, uint64_t position, uint64_t last_sequence,
+               absl::Status status)
+        : _stream(&stream),
+          _position(position),
+          _last_sequence(last_sequence),
+          _status(std::move(status)) {}
+
+    ChangeStream* _stream;
+    // Publish count of the next batch to read.
+    uint64_t _position;
+    uint64_t _last_sequence;
+    absl::Status _status;
+  };
+
+  // Holds the last `capacity` batches, rounded up to a power of two.
+  explicit ChangeStream(size_t capacity = kDefaultCapacity);
+  // Subscribers must be gone.
+  ~ChangeStream();
+
+  ChangeStream(const ChangeStream&) = delete;
+  ChangeStream& operator=(const ChangeStream&) = delete;
+
+  // Reads the batches published from now on. The first subscription activates the stream.
+  Subscriber Subscribe();
+
+  // Reads the batches published after `sequence`, those still in the ring first. If some of them
+  // were already overwritten, the subscriber's first Next() fails with a DataLossError.
+  Subscriber Resume(uint64_t sequence);
+
+  // Whether anything subscribed, so that publishers can skip recording changes until then.
+  bool active() const { return _active.load(std::memory_order_acquire); }
+
+  // Adds the batch of the commit numbered `sequence`, which is greater than any published
+  // before. Publishers must not run concurrently: commits are serialized anyway.
+  void Publish(uint64_t sequence, WalBatch&& changes);
+
+  // Sequence number of the last batch published, 0 if none.
+  uint64_t LastSequence() const { return _last_sequence.load(std::memory_order_acquire); }
+
+  size_t capacity() const { return _slots.size(); }
+
+ private:
+  struct Node {
+    // Publish count of the batch, which selects its slot.
+    uint64_t position;
+    ChangeBatch batch;
+  };
+
+  std::vector<std::atomic<const Node*>> _slots;
+  const size_t _mask;
+  // Batches published so far.
+  std::atomic<uint64_t> _published = 0;
+  std::atomic<uint64_t> _last_sequence = 0;
+  // Sequence number of the last batch overwritten, 0 if none.
+  std::atomic<uint64_t> _evicted_sequence = 0;
+  std::atomic<bool> _active = false;
+  EpochManager _epochs;
+};
+
+}  // namespace gendb
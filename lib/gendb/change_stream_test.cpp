@@ -0,0 +1,140 @@
+#include "gendb/change_stream.h"
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "status_matchers.h"
+
+namespace gendb {
+namespace {
+
+Bytes ToBytes(const std::string& str) { return {str.begin(), str.end()}; }
+
+std::string ToString(BytesConstView bytes) {
+  return {reinterpret_cast<const char*>(bytes.data()), bytes.size()};
+}
+
+// A batch putting `value` at key "k" of collection 0.
+WalBatch MakeChanges(const std::string& value) {
+  WalBatch changes;
+  changes.Put(0, ToBytes("k"), ToBytes(value));
+  return changes;
+}
+
+std::string PutValue(const ChangeBatch& batch) {
+  std::string value;
+  EXPECT_OK(ForEachWalOp(batch.changes.data(), [&](const WalOp& op) {
+    EXPECT_EQ(op.type, WalOp::Type::kPut);
+    value = ToString(op.value);
+    return absl::OkStatus();
+  }));
+  return value;
+}
+
+TEST(ChangeStreamTest, SubscribersReadTheBatchesPublishedAfterThem) {
+  ChangeStream stream(/*capacity=*/4);
+  EXPECT_FALSE(stream.active());
+  stream.Publish(1, MakeChanges("a"));
+  ChangeStream::Subscriber first = stream.Subscribe();
+  EXPECT_TRUE(stream.active());
+  stream.Publish(3, MakeChanges("b"));
+  ChangeStream::Subscriber second = stream.Subscribe();
+  stream.Publish(4, MakeChanges("c"));
+  EXPECT_EQ(stream.LastSequence(), 4);
+
+  ChangeBatch batch;
+  ASSERT_OK(first.Next(batch));
+  EXPECT_EQ(batch.sequence, 3);
+  EXPECT_EQ(PutValue(batch), "b");
+  ASSERT_OK(first.Next(batch));
+  EXPECT_EQ(PutValue(batch), "c");
+  EXPECT_STATUS_EQ(absl::StatusCode::kOutOfRange, first.Next(batch));
+  EXPECT_EQ(first.last_sequence(), 4);
+
+  ASSERT_OK(second.Next(batch));
+  EXPECT_EQ(batch.sequence, 4);
+  EXPECT_STATUS_EQ(absl::StatusCode::kOutOfRange, second.Next(batch));
+  stream.Publish(5, MakeChanges("d"));
+  ASSERT_OK(second.Next(batch));
+  EXPECT_EQ(PutValue(batch), "d");
+}
+
+TEST(ChangeStreamTest, SlowSubscribersLearnOfOverwrittenBatches) {
+  ChangeStream stream(/*capacity=*/3);
+  EXPECT_EQ(stream.capacity(), 4);
+  ChangeStream::Subscriber subscriber = stream.Subscribe();
+  for (uint64_t sequence = 1; sequence <= 5; ++sequence) {
+    stream.Publish(sequence, MakeChanges(std::to_string(sequence)));
+  }
+  ChangeBatch batch;
+  EXPECT_STATUS_EQ(absl::StatusCode::kDataLoss, subscriber.Next(batch));
+  // For good, even once the ring moved on.
+  stream.Publish(6, MakeChanges("6"));
+  EXPECT_STATUS_EQ(absl::StatusCode::kDataLoss, subscriber.Next(batch));
+}
+
+TEST(ChangeStreamTest, ResumeStartsAfterASequence) {
+  ChangeStream stream(/*capacity=*/4);
+  for (uint64_t sequence = 10; sequence <= 60; sequence += 10) {
+    stream.Publish(sequence, MakeChanges(std::to_string(sequence)));
+  }
+  // 10 and 20 were overwritten.
+  ChangeBatch batch;
+  ChangeStream::Subscriber subscriber = stream.Resume(35);
+  EXPECT_EQ(subscriber.last_sequence(), 35);
+  ASSERT_OK(subscriber.Next(batch));
+  EXPECT_EQ(batch.sequence, 40);
+  ASSERT_OK(subscriber.Next(batch));
+  ASSERT_OK(subscriber.Next(batch));
+  EXPECT_EQ(batch.sequence, 60);
+  EXPECT_STATUS_EQ(absl::StatusCode::kOutOfRange, subscriber.Next(batch));
+
+  ChangeStream::Subscriber oldest = stream.Resume(20);
+  ASSERT_OK(oldest.Next(batch));
+  EXPECT_EQ(batch.sequence, 30);
+  EXPECT_STATUS_EQ(absl::StatusCode::kDataLoss, stream.Resume(15).Next(batch));
+
+  ChangeStream::Subscriber latest = stream.Resume(60);
+  EXPECT_STATUS_EQ(absl::StatusCode::kOutOfRange, latest.Next(batch));
+  stream.Publish(70, MakeChanges("70"));
+  ASSERT_OK(latest.Next(batch));
+  EXPECT_EQ(PutValue(batch), "70");
+}
+
+TEST(ChangeStreamTest, ConcurrentSubscribersSeeEveryBatchInOrder) {
+  constexpr uint64_t kBatches = 20000;
+  ChangeStream stream(/*capacity=*/kBatches);
+  std::vector<ChangeStream::Subscriber> subscribers;
+  for (int i = 0; i < 3; ++i) {
+    subscribers.push_back(stream.Subscribe());
+  }
+  std::vector<std::thread> threads;
+  for (ChangeStream::Subscriber& subscriber : subscribers) {
+    threads.emplace_back([&subscriber] {
+      ChangeBatch batch;
+      for (uint64_t expected = 1; expected <= kBatches;) {
+        absl::Status status = subscriber.Next(batch);
+        if (absl::IsOutOfRange(status)) {
+          std::this_thread::yield();
+          continue;
+        }
+        ASSERT_OK(status);
+        ASSERT_EQ(batch.sequence, expected);
+        ASSERT_EQ(PutValue(batch), std::to_string(expected));
+        ++expected;
+      }
+    });
+  }
+  for (uint64_t sequence = 1; sequence <= kBatches; ++sequence) {
+    stream.Publish(sequence, MakeChanges(std::to_string(sequence)));
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+}
+
+}  // namespace
+}  // namespace gendb
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include "gendb/bytes.h"
+#include "gendb/flat_hash_map.h"
+
+namespace gendb {
+
+// Keys written or deleted since some point, such as the last checkpoint, by collection id. Each
+// key is kept once however often it changes, so the set grows with the number of keys written,
+// not with the number of writes.
+class ChangedKeys {
+ public:
+  // Keys of one collection, in no particular order. Values are unused.
+  using Collection = FlatHashMap<bool>;
+
+  void Add(size_t collection_id, BytesConstView key) {
+    if (collection_id >= _collections.size()) {
+      _collections.resize(collection_id + 1);
+    }
+    if (_collections[collection_id].try_emplace(key, true).second) {
+      ++_size;
+    }
+  }
+
+  // Adds every key of `other`.
+  void Add(const ChangedKeys& other) {
+    for (size_t collection_id = 0; collection_id < other._collections.size(); ++collection_id) {
+      for (const auto& slot : other._collections[collection_id]) {
+        Add(collection_id, slot.key.view());
+      }
+    }
+  }
+
+  // Empty for a collection without changes.
+  const Collection& collection(size_t collection_id) const {
+    static const Collection kEmpty;
+    return collection_id < _collections.size() ? _collections[collection_id] : kEmpty;
+  }
+
+  // Number of keys, across collections.
+  size_t size() const { return _size; }
+
+  void Clear() {
+    _collections.clear();
+    _size = 0;
+  }
+
+ private:
+  std::vector<Collection> _collections;
+  size_t _size = 0;
+};
+
+}  // namespace gendb
@@ -0,0 +1,477 @@
+#include "gendb/checkpoint.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdio>
+#include <filesystem>
+#include <stdexcept>
+#include <utility>
+
+#include "absl/strings/str_cat.h"
+#include "gendb/versioned_storage.h"
+#include "gendb/wal.h"
+
+namespace gendb {
+
+namespace {
+
+constexpr uint64_t kMagic = 0x54504b4342444e47;  // "GNDBCKPT"
+constexpr uint32_t kVersion = 2;
+constexpr size_t kFlushBytes = 1 << 20;
+constexpr size_t kRecordHeaderSize = 8;
+constexpr uint64_t kOffsetMask = (uint64_t{1} << 48) - 1;
+// Value size of a deleted key's record.
+constexpr uint32_t kDeleted = 0xFFFFFFFF;
+
+enum Kind : uint32_t { kBase = 0, kDelta = 1 };
+
+struct Header {
+  uint64_t magic;
+  uint32_t version;
+  uint32_t collection_count;
+  uint32_t index_count;
+  uint32_t directory_crc;
+  uint64_t wal_sequence;
+  uint64_t directory_offset;
+  uint64_t file_size;
+  uint64_t generation;
+  uint32_t kind;
+  // Of the bytes before it.
+  uint32_t header_crc;
+};
+static_assert(sizeof(Header) == 64);
+
+struct DirectoryCollection {
+  uint64_t count;
+  uint64_t records_offset;
+  uint64_t order_offset;
+  uint64_t table_offset;
+  uint64_t table_capacity;
+  uint32_t crc;
+  uint32_t reserved;
+};
+
+struct DirectoryIndex {
+  uint64_t record_size;
+  uint64_t count;
+  uint64_t records_offset;
+  uint32_t crc;
+  uint32_t reserved;
+};
+
+// FNV-1a, then the murmur3 finalizer. Unlike absl::Hash it is the same in every process, which the
+// tables need: one process builds them and another probes them.
+uint64_t KeyHash(BytesConstView key) {
+  uint64_t hash = 0xcbf29ce484222325;
+  for (uint8_t byte : key) {
+    hash = (hash ^ byte) * 0x100000001b3;
+  }
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccd;
+  hash ^= hash >> 33;
+  hash *= 0xc4ceb9fe1a85ec53;
+  hash ^= hash >> 33;
+  return hash;
+}
+
+uint32_t HeaderCrc(const Header& header) {
+  return Crc32c(BytesConstView(reinterpret_cast<const uint8_t*>(&header),
+                               offsetof(Header, header_crc)));
+}
+
+template <typename T>
+BytesConstView AsBytes(const std::vector<T>& values) {
+  return {reinterpret_cast<const uint8_t*>(values.data()), values.size() * sizeof(T)};
+}
+
+}  // namespace
+
+CheckpointWriter::CheckpointWriter(std::string path, uint64_t generation, bool delta)
+    : _path(std::move(path)), _temp_path(_path + ".tmp"), _generation(generation), _delta(delta) {
+  _fd = ::open(_temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (_fd < 0) {
+    _status = ErrnoStatus(absl::StrCat("Failed to create ", _temp_path));
+    return;
+  }
+  // The header is written last, once the directory is known.
+  _buffer.resize(sizeof(Header));
+}
+
+CheckpointWriter::~CheckpointWriter() {
+  if (_fd >= 0) {
+    ::close(_fd);
+  }
+  if (!_finished) {
+    ::unlink(_temp_path.c_str());
+  }
+}
+
+absl::Status CheckpointWriter::AddCollection(StorageCursor& cursor) {
+  RETURN_IF_ERROR(_status);
+  _collection = {.records_offset = size()};
+  StartRegion();
+  for (cursor.Seek({}); cursor.Valid(); cursor.Next()) {
+    const BytesConstView value = cursor.Value();
+    RETURN_IF_ERROR(AddRecord(cursor.Key(), &value));
+  }
+  return FinishCollection();
+}
+
+absl::Status CheckpointWriter::AddChangedKeys(const Storage& storage, size_t collection_id,
+                                              const ChangedKeys::Collection& keys) {
+  return AddChangedKeysFrom(storage, collection_id, keys);
+}
+
+absl::Status CheckpointWriter::AddChangedKeys(const StorageSnapshot& snapshot,
+                                              size_t collection_id,
+                                              const ChangedKeys::Collection& keys) {
+  return AddChangedKeysFrom(snapshot, collection_id, keys);
+}
+
+template <typename StorageT>
+absl::Status CheckpointWriter::AddChangedKeysFrom(const StorageT& storage, size_t collection_id,
+                                                  const ChangedKeys::Collection& keys) {
+  RETURN_IF_ERROR(_status);
+  _collection = {.records_offset = size()};
+  StartRegion();
+  std::vector<BytesConstView> sorted;
+  sorted.reserve(keys.size());
+  for (const auto& slot : keys) {
+    sorted.push_back(slot.key.view());
+  }
+  std::ranges::sort(sorted, std::ranges::lexicographical_compare);
+  for (BytesConstView key : sorted) {
+    BytesConstView value;
+    absl::Status status = storage.Get(collection_id, key, value);
+    if (absl::IsNotFound(status)) {
+      RETURN_IF_ERROR(AddRecord(key, nullptr));
+    } else if (status.ok()) {
+      RETURN_IF_ERROR(AddRecord(key, &value));
+    } else {
+      return _status = status;
+    }
+  }
+  return FinishCollection();
+}
+
+absl::Status CheckpointWriter::AddRecord(BytesConstView key, const BytesConstView* value) {
+  if (size() > kOffsetMask) {
+    return _status = absl::OutOfRangeError("Checkpoint larger than 256 TiB");
+  }
+  _order.push_back(size());
+  _hashes.push_back(KeyHash(key));
+  const uint32_t sizes[] = {static_cast<uint32_t>(key.size()),
+                            value != nullptr ? static_cast<uint32_t>(value->size()) : kDeleted};
+  RETURN_IF_ERROR(Append(BytesConstView(reinterpret_cast<const uint8_t*>(sizes), sizeof(sizes))));
+  if (value != nullptr) {
+    RETURN_IF_ERROR(Append(*value));
+  }
+  RETURN_IF_ERROR(Append(key));
+  Pad();
+  return absl::OkStatus();
+}
+
+absl::Status CheckpointWriter::FinishCollection() {
+  CollectionEntry& entry = _collection;
+  entry.count = _order.size();
+
+  entry.order_offset = size();
+  RETURN_IF_ERROR(Append(AsBytes(_order)));
+
+  entry.table_capacity = _order.empty() ? 0 : std::bit_ceil(2 * _order.size());
+  std::vector<uint64_t> table(entry.table_capacity);
+  for (size_t i = 0; i < _order.size(); ++i) {
+    size_t slot = _hashes[i] & (table.size() - 1);
+    while (table[slot] != 0) {
+      slot = (slot + 1) & (table.size() - 1);
+    }
+    table[slot] = (_hashes[i] & ~kOffsetMask) | _order[i];
+  }
+  entry.table_offset = size();
+  RETURN_IF_ERROR(Append(AsBytes(table)));
+  entry.crc = _region_crc;
+  _collections.push_back(entry);
+  _order.clear();
+  _hashes.clear();
+  return absl::OkStatus();
+}
+
+absl::Status CheckpointWriter::Finish(uint64_t wal_sequence) {
+  RETURN_IF_ERROR(_status);
+  std::vector<DirectoryCollection> collections;
+  for (const CollectionEntry& entry : _collections) {
+    collections.push_back({entry.count, entry.records_offset, entry.order_offset,
+                           entry.table_offset, entry.table_capacity, entry.crc, 0});
+  }
+  std::vector<DirectoryIndex> indices;
+  for (const IndexEntry& entry : _indices) {
+    indices.push_back({entry.record_size, entry.count, entry.records_offset, entry.crc, 0});
+  }
+  Header header{};
+  header.magic = kMagic;
+  header.version = kVersion;
+  header.collection_count = static_cast<uint32_t>(collections.size());
+  header.index_count = static_cast<uint32_t>(indices.size());
+  header.directory_crc = Crc32c(AsBytes(indices), Crc32c(AsBytes(collections)));
+  header.wal_sequence = wal_sequence;
+  header.directory_offset = size();
+  header.generation = _generation;
+  header.kind = _delta ? kDelta : kBase;
+  RETURN_IF_ERROR(Append(AsBytes(collections)));
+  RETURN_IF_ERROR(Append(AsBytes(indices)));
+  header.file_size = size();
+  header.header_crc = HeaderCrc(header);
+  RETURN_IF_ERROR(Flush());
+
+  const BytesConstView header_bytes(reinterpret_cast<const uint8_t*>(&header), sizeof(header));
+  if (absl::Status status = WriteAt(_fd, header_bytes, 0); !status.ok()) {
+    return _status = status;
+  }
+  if (::fsync(_fd) != 0) {
+    return _status = ErrnoStatus(absl::StrCat("Failed to sync ", _temp_path));
+  }
+  ::close(_fd);
+  _fd = -1;
+  if (std::rename(_temp_path.c_str(), _path.c_str()) != 0) {
+    return _status = ErrnoStatus(absl::StrCat("Failed to rename ", _temp_path));
+  }
+  _finished = true;
+  const std::filesystem::path parent = std::filesystem::path(_path).parent_path();
+  return SyncDirectory(parent.empty() ? "." : parent.string());
+}
+
+absl::Status CheckpointWriter::Append(BytesConstView data) {
+  _region_crc = Crc32c(data, _region_crc);
+  _buffer.insert(_buffer.end(), data.begin(), data.end());
+  if (_buffer.size() >= kFlushBytes) {
+    return Flush();
+  }
+  return absl::OkStatus();
+}
+
+void CheckpointWriter::Pad() {
+  static constexpr uint8_t kZeros[8] = {};
+  const size_t padding = -size() & 7;
+  _region_crc = Crc32c(BytesConstView(kZeros, padding), _region_crc);
+  _buffer.resize(_buffer.size() + padding);
+}
+
+absl::Status CheckpointWriter::Flush() {
+  RETURN_IF_ERROR(_status);
+  if (absl::Status status = WriteAt(_fd, _buffer, _offset); !status.ok()) {
+    return _status = status;
+  }
+  _offset += _buffer.size();
+  _buffer.clear();
+  return absl::OkStatus();
+}
+
+Checkpoint::Checkpoint(const std::string& path) : _file(path, MADV_RANDOM) {
+  const BytesConstView contents = _file.contents();
+  auto fail = [&](const std::string& what) {
+    return std::runtime_error(absl::StrCat("Invalid checkpoint ", path, ": ", what));
+  };
+  Header header;
+  if (contents.size() < sizeof(header)) {
+    throw fail("truncated header");
+  }
+  std::memcpy(&header, contents.data(), sizeof(header));
+  if (header.magic != kMagic) {
+    throw fail("not a checkpoint");
+  }
+  if (header.version != kVersion) {
+    throw fail(absl::StrCat("unsupported version ", header.version));
+  }
+  if (header.header_crc != HeaderCrc(header)) {
+    throw fail("header checksum mismatch");
+  }
+  if (header.kind != kBase && header.kind != kDelta) {
+    throw fail(absl::StrCat("unknown kind ", header.kind));
+  }
+  if (header.file_size != contents.size()) {
+    throw fail(absl::StrCat("size ", contents.size(), " instead of ", header.file_size));
+  }
+  const size_t directory_size = header.collection_count * sizeof(DirectoryCollection) +
+                                header.index_count * sizeof(DirectoryIndex);
+  if (header.directory_offset % 8 != 0 ||
+      header.directory_offset + directory_size != contents.size() ||
+      Crc32c(contents.subspan(header.directory_offset)) != header.directory_crc) {
+    throw fail("directory checksum mismatch");
+  }
+
+  // Every region the reads use lies before the directory.
+  auto in_file = [&](uint64_t offset, uint64_t count, uint64_t item_size) {
+    return offset % 8 == 0 && offset <= header.directory_offset &&
+           count <= (header.directory_offset - offset) / item_size;
+  };
+  const uint8_t* directory = contents.data() + header.directory_offset;
+  for (uint32_t i = 0; i < header.collection_count; ++i) {
+    DirectoryCollection entry;
+    std::memcpy(&entry, directory + i * sizeof(entry), sizeof(entry));
+    // The records, order and table follow each other, as the checksum covers them together.
+    if (!in_file(entry.order_offset, entry.count, sizeof(uint64_t)) ||
+        !in_file(entry.table_offset, entry.table_capacity, sizeof(uint64_t)) ||
+        entry.records_offset % 8 != 0 || entry.records_offset < sizeof(Header) ||
+        entry.records_offset > entry.order_offset ||
+        entry.table_offset != entry.order_offset + entry.count * sizeof(uint64_t) ||
+        (entry.table_capacity != 0 && !std::has_single_bit(entry.table_capacity)) ||
+        entry.table_capacity < 2 * entry.count) {
+      throw fail(absl::StrCat("collection ", i, " out of bounds"));
+    }
+    const uint64_t end = entry.table_offset + entry.table_capacity * sizeof(uint64_t);
+    _collections.push_back(
+        {entry.count, contents.subspan(entry.records_offset, end - entry.records_offset),
+         entry.records_offset, entry.order_offset,
+         reinterpret_cast<const uint64_t*>(contents.data() + entry.order_offset),
+         reinterpret_cast<const uint64_t*>(contents.data() + entry.table_offset),
+         entry.table_capacity, entry.crc});
+  }
+  directory += header.collection_count * sizeof(DirectoryCollection);
+  for (uint32_t i = 0; i < header.index_count; ++i) {
+    DirectoryIndex entry;
+    std::memcpy(&entry, directory + i * sizeof(entry), sizeof(entry));
+    if (entry.record_size == 0 || !in_file(entry.records_offset, entry.count, entry.record_size)) {
+      throw fail(absl::StrCat("index ", i, " out of bounds"));
+    }
+    _indices.push_back({entry.record_size,
+                        contents.subspan(entry.records_offset, entry.count * entry.record_size),
+                        entry.crc});
+  }
+  _wal_sequence = header.wal_sequence;
+  _generation = header.generation;
+  _delta = header.kind == kDelta;
+}
+
+absl::Status Checkpoint::Find(size_t collection_id, BytesConstView key,
+                              BytesConstView& value) const {
+  if (collection_id >= _collections.size() || _collections[collection_id].count == 0) {
+    return absl::NotFoundError("Key not found");
+  }
+  const CollectionEntry& coll = _collections[collection_id];
+  const uint64_t hash = KeyHash(key);
+  const uint64_t mask = coll.table_capacity - 1;
+  // The writer leaves half of the slots free, so only a corrupt table has none on the way.
+  uint64_t slot = hash & mask;
+  for (uint64_t probes = 0; probes < coll.table_capacity; ++probes, slot = (slot + 1) & mask) {
+    const uint64_t entry = coll.table[slot];
+    if (entry == 0) {
+      return absl::NotFoundError("Key not found");
+    }
+    if ((entry & ~kOffsetMask) != (hash & ~kOffsetMask)) {
+      continue;
+    }
+    Record record;
+    RETURN_IF_ERROR(ReadRecord(collection_id, entry & kOffsetMask, record));
+    if (std::ranges::equal(record.key, key)) {
+      if (record.deleted) {
+        return absl::NotFoundError("Key not found");
+      }
+      value = record.value;
+      return absl::OkStatus();
+    }
+  }
+  return absl::DataLossError(
+      absl::StrCat("Corrupt checkpoint: no free slot in the table of collection ", collection_id));
+}
+
+absl::Status Checkpoint::Read(size_t collection_id, size_t i, Record& record) const {
+  return ReadRecord(collection_id, _collections[collection_id].order[i], record);
+}
+
+absl::Status Checkpoint::LowerBound(size_t collection_id, BytesConstView key,
+                                    size_t& position) const {
+  if (collection_id >= _collections.size()) {
+    position = 0;
+    return absl::OkStatus();
+  }
+  const CollectionEntry& coll = _collections[collection_id];
+  // The first corrupt record ends the search: every later probe is taken as not less.
+  absl::Status status;
+  const uint64_t* it =
+      std::partition_point(coll.order, coll.order + coll.count, [&](uint64_t offset) {
+        Record record;
+        if (status.ok()) {
+          status = ReadRecord(collection_id, offset, record);
+        }
+        return status.ok() && std::ranges::lexicographical_compare(record.key, key);
+      });
+  RETURN_IF_ERROR(status);
+  position = it - coll.order;
+  return absl::OkStatus();
+}
+
+absl::Status Checkpoint::Verify(size_t collection_id) const {
+  if (collection_id >= _collections.size()) {
+    return absl::NotFoundError(absl::StrCat("Checkpoint has no collection ", collection_id));
+  }
+  const CollectionEntry& coll = _collections[collection_id];
+  if (Crc32c(coll.region) != coll.crc) {
+    return absl::DataLossError(
+        absl::StrCat("Corrupt checkpoint: checksum mismatch in collection ", collection_id));
+  }
+  for (uint64_t i = 0; i < coll.count; ++i) {
+    Record record;
+    RETURN_IF_ERROR(ReadRecord(collection_id, coll.order[i], record));
+  }
+  return absl::OkStatus();
+}
+
+absl::Status Checkpoint::Verify() const {
+  for (size_t collection_id = 0; collection_id < _collections.size(); ++collection_id) {
+    RETURN_IF_ERROR(Verify(collection_id));
+  }
+  for (size_t i = 0; i < _indices.size(); ++i) {
+    BytesConstView records;
+    RETURN_IF_ERROR(IndexRecords(i, _indices[i].record_size, records));
+  }
+  return absl::OkStatus();
+}
+
+absl::Status Checkpoint::ReadRecord(size_t collection_id, uint64_t offset, Record& record) const {
+  const CollectionEntry& coll = _collections[collection_id];
+  auto corrupt = [&] {
+    return absl::DataLossError(absl::StrCat("Corrupt checkpoint: record at ", offset,
+                                            " outside of the records of collection ",
+                                            collection_id));
+  };
+  // The records of the collection end where its order starts.
+  if (offset % 8 != 0 || offset < coll.records_offset || offset > coll.order_offset ||
+      coll.order_offset - offset < kRecordHeaderSize) {
+    return corrupt();
+  }
+  const BytesConstView contents = _file.contents();
+  uint32_t sizes[2];
+  std::memcpy(sizes, contents.data() + offset, sizeof(sizes));
+  const uint64_t value_size = sizes[1] == kDeleted ? 0 : sizes[1];
+  if (sizes[0] + value_size > coll.order_offset - offset - kRecordHeaderSize) {
+    return corrupt();
+  }
+  record.value = contents.subspan(offset + kRecordHeaderSize, value_size);
+  record.key = contents.subspan(offset + kRecordHeaderSize + value_size, sizes[0]);
+  record.deleted = sizes[1] == kDeleted;
+  return absl::OkStatus();
+}
+
+absl::Status Checkpoint::IndexRecords(size_t i, size_t record_size,
+                                      BytesConstView& records) const {
+  if (i >= _indices.size()) {
+    return absl::NotFoundError(absl::StrCat("Checkpoint has no index ", i));
+  }
+  if (_indices[i].record_size != record_size) {
+    return absl::FailedPreconditionError(absl::StrCat(
+        "Checkpoint index ", i, " has records of ", _indices[i].record_size, " bytes, not ",
+        record_size));
+  }
+  if (Crc32c(_indices[i].records) != _indices[i].crc) {
+    return absl::DataLossError(absl::StrCat("Corrupt checkpoint: checksum mismatch in index ", i));
+  }
+  records = _indices[i].records;
+  return absl::OkStatus();
+}
+
+}  // namespace gendb
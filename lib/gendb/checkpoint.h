@@ -0,0 +1,270 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "gendb/bytes.h"
+#include "gendb/changed_keys.h"
+#include "gendb/file.h"
+#include "gendb/status.h"
+#include "gendb/storage.h"
+
+namespace gendb {
+
+class StorageSnapshot;
+
+// A checkpoint is one file holding every collection and secondary index of a database, laid out
+// to be served from a read-only mapping without being loaded:
+//
+//   header     magic, format version, collection and index counts, the sequence number of the
+//              last WAL record it holds, generation and kind (base or delta), directory offset
+//              and the CRC32Cs of header and directory
+//   per collection, in CollectionId order:
+//     records  [key size u32][value size u32][value][key], sorted by key, each 8-byte aligned;
+//              a value size of 0xFFFFFFFF marks a deleted key, which has no value
+//     order    offset u64 of each record, in key order, for binary searches and cursors
+//     table    open-addressing hash table of (16-bit key hash tag << 48 | record offset) u64
+//              slots, 0 when empty, at most half full, for point reads
+//   per index, in the order they were added:
+//     records  packed (sec_key, prim_key) pairs in index order
+//   directory  (record count, records, order and table offsets, table capacity, CRC32C of its
+//              records, order and table) per collection, (record size, record count, records
+//              offset, CRC32C of its records) per index
+//
+// Integers are in native byte order. Only the header and directory are checked when the file is
+// opened, so that opening costs the same whatever the size of the file. Every read of a record
+// checks that it lies within the records of its collection, and fails with DataLoss otherwise: a
+// corrupt offset or size never reads outside of the file. The checksums of the collections are
+// only checked by Verify, since point reads and cursors would have to read a whole collection to
+// check one; the reads that take in a whole checkpoint anyway call it (a delta replay, a merge).
+// An index is always read whole, so LoadIndex checks its checksum.
+//
+// A base checkpoint holds the whole database. A delta holds only the keys changed since the
+// checkpoint of the previous generation, deleted keys included, and no indices: a base followed
+// by the deltas of the next generations adds up to the database as of the last one (see
+// checkpoint_chain.h).
+
+// Writes a checkpoint to a temporary file next to `path`, which Finish syncs and renames over
+// `path`: a crash leaves either the old file or the new one. Collections are added in
+// CollectionId order, then the indices. Errors are sticky: the first one is returned by every
+// later call.
+class CheckpointWriter {
+ public:
+  // `generation` numbers the checkpoints of a chain; a delta must follow the checkpoint of
+  // generation `generation - 1`.
+  explicit CheckpointWriter(std::string path, uint64_t generation = 0, bool delta = false);
+  // Removes the temporary file unless Finish succeeded.
+  ~CheckpointWriter();
+
+  CheckpointWriter(const CheckpointWriter&) = delete;
+  CheckpointWriter& operator=(const CheckpointWriter&) = delete;
+
+  // Adds the next collection: every key of `cursor` in order, from the start of the collection.
+  absl::Status AddCollection(StorageCursor& cursor);
+
+  // Adds the next collection of a delta: the value in `storage` of each of `keys`, or a deletion
+  // if `storage` no longer has it. Reads as many keys as changed, whatever the collection's size.
+  absl::Status AddChangedKeys(const Storage& storage, size_t collection_id,
+                              const ChangedKeys::Collection& keys);
+  // Same, with the values as of `snapshot`.
+  absl::Status AddChangedKeys(const StorageSnapshot& snapshot, size_t collection_id,
+                              const ChangedKeys::Collection& keys);
+
+  // Adds the next index: its records in order, skipping those only kept for snapshots.
+  template <typename IndexT>
+  absl::Status AddIndex(const IndexT& index);
+
+  // Writes the directory and header, recording `wal_sequence` as the last WAL record the
+  // checkpoint holds, and replaces `path` durably.
+  absl::Status Finish(uint64_t wal_sequence);
+
+  // Bytes written so far.
+  uint64_t size() const { return _offset + _buffer.size(); }
+
+ private:
+  struct CollectionEntry {
+    uint64_t count = 0;
+    uint64_t records_offset = 0;
+    uint64_t order_offset = 0;
+    uint64_t table_offset = 0;
+    uint64_t table_capacity = 0;
+    uint32_t crc = 0;
+  };
+  struct IndexEntry {
+    uint64_t record_size = 0;
+    uint64_t count = 0;
+    uint64_t records_offset = 0;
+    uint32_t crc = 0;
+  };
+
+  // Buffers `data` for the file, flushing the buffer when it is full.
+  absl::Status Append(BytesConstView data);
+  // Zeros up to the next 8-byte boundary.
+  void Pad();
+  // Starts the checksum of a collection or index at the next byte.
+  void StartRegion() { _region_crc = 0; }
+  absl::Status Flush();
+  // Appends a record to the collection being added, a deletion if `value` is null. Keys come in
+  // order.
+  absl::Status AddRecord(BytesConstView key, const BytesConstView* value);
+  // Writes the order and table of the collection being added.
+  absl::Status FinishCollection();
+  // AddChangedKeys from anything with the Get of a Storage.
+  template <typename StorageT>
+  absl::Status AddChangedKeysFrom(const StorageT& storage, size_t collection_id,
+                                  const ChangedKeys::Collection& keys);
+
+  const std::string _path;
+  const std::string _temp_path;
+  const uint64_t _generation;
+  const bool _delta;
+  int _fd = -1;
+  absl::Status _status;
+  // File offset of the first buffered byte.
+  uint64_t _offset = 0;
+  Bytes _buffer;
+  // CRC32C of the bytes appended since StartRegion.
+  uint32_t _region_crc = 0;
+  std::vector<CollectionEntry> _collections;
+  std::vector<IndexEntry> _indices;
+  // Of the collection being added: its entry, and the offsets and key hashes of its records.
+  CollectionEntry _collection;
+  std::vector<uint64_t> _order;
+  std::vector<uint64_t> _hashes;
+  bool _finished = false;
+};
+
+// Read-only view of a checkpoint file through a shared mapping. The file is paged in by the reads
+// that touch it, so opening it costs the same whatever its size. Thread-safe.
+class Checkpoint {
+ public:
+  // Throws std::runtime_error if the file cannot be mapped or its header or directory is invalid.
+  explicit Checkpoint(const std::string& path);
+
+  Checkpoint(const Checkpoint&) = delete;
+  Checkpoint& operator=(const Checkpoint&) = delete;
+
+  // Sequence number of the last WAL record the checkpoint holds, 0 if none.
+  uint64_t wal_sequence() const { return _wal_sequence; }
+  uint64_t generation() const { return _generation; }
+  bool is_delta() const { return _delta; }
+  size_t collection_count() const { return _collections.size(); }
+  size_t index_count() const { return _indices.size(); }
+
+  // Number of keys of the collection, 0 for a collection it does not have.
+  size_t size(size_t collection_id) const {
+    return collection_id < _collections.size() ? _collections[collection_id].count : 0;
+  }
+
+  struct Record {
+    BytesConstView key;
+    // Empty for a deletion.
+    BytesConstView value;
+    // Whether the record is a deletion, which only deltas have.
+    bool deleted = false;
+  };
+
+  // Point read through the collection's hash table: one probe of the table, usually one record.
+  // NotFound for a key the delta deletes, DataLoss if the table or the record is corrupt.
+  absl::Status Find(size_t collection_id, BytesConstView key, BytesConstView& value) const;
+
+  // The collection's `i`-th record in key order, i < size(collection_id). DataLoss if it does not
+  // lie within the collection's records.
+  absl::Status Read(size_t collection_id, size_t i, Record& record) const;
+
+  // Position in key order of the first key not less than `key`. DataLoss if a record on the way
+  // is corrupt.
+  absl::Status LowerBound(size_t collection_id, BytesConstView key, size_t& position) const;
+
+  // Checks the checksum of the collection's records, order and table, then that every record lies
+  // within its records. Reads the whole collection.
+  absl::Status Verify(size_t collection_id) const;
+  // Same for every collection, then checks the checksum of every index.
+  absl::Status Verify() const;
+
+  // Inserts the records of the checkpoint's `i`-th index into `index`, which must be empty. The
+  // records are already in order, so each insert takes amortized constant time. Fails if the
+  // index's records have another size than `index`'s, or with DataLoss if their checksum does not
+  // match.
+  template <typename IndexT>
+  absl::Status LoadIndex(size_t i, IndexT& index) const;
+
+ private:
+  struct CollectionEntry {
+    uint64_t count;
+    // From the first record to the end of the table, which the checksum covers.
+    BytesConstView region;
+    // Records end where the order starts.
+    uint64_t records_offset;
+    uint64_t order_offset;
+    const uint64_t* order;
+    const uint64_t* table;
+    uint64_t table_capacity;
+    uint32_t crc;
+  };
+  struct IndexEntry {
+    size_t record_size;
+    BytesConstView records;
+    uint32_t crc;
+  };
+
+  // Record at `offset` of the collection: [key size u32][value size u32][value][key], 8-byte
+  // aligned. DataLoss if it does not lie within the collection's records.
+  absl::Status ReadRecord(size_t collection_id, uint64_t offset, Record& record) const;
+  absl::Status IndexRecords(size_t i, size_t record_size, BytesConstView& records) const;
+
+  const MappedFile _file;
+  uint64_t _wal_sequence = 0;
+  uint64_t _generation = 0;
+  bool _delta = false;
+  std::vector<CollectionEntry> _collections;
+  std::vector<IndexEntry> _indices;
+};
+
+template <typename IndexT>
+absl::Status CheckpointWriter::AddIndex(const IndexT& index) {
+  using Record = typename IndexT::Container::value_type;
+  using SecKey = decltype(Record::sec_key);
+  using PrimKey = decltype(Record::prim_key);
+  static_assert(std::is_trivially_copyable_v<SecKey> && std::is_trivially_copyable_v<PrimKey>);
+  RETURN_IF_ERROR(_status);
+  IndexEntry entry{.record_size = sizeof(SecKey) + sizeof(PrimKey), .records_offset = size()};
+  StartRegion();
+  uint8_t bytes[sizeof(SecKey) + sizeof(PrimKey)];
+  for (const Record& record : index) {
+    if (record.is_deleted) {
+      continue;
+    }
+    std::memcpy(bytes, &record.sec_key, sizeof(SecKey));
+    std::memcpy(bytes + sizeof(SecKey), &record.prim_key, sizeof(PrimKey));
+    RETURN_IF_ERROR(Append(BytesConstView(bytes, sizeof(bytes))));
+    ++entry.count;
+  }
+  entry.crc = _region_crc;
+  Pad();
+  _indices.push_back(entry);
+  return absl::OkStatus();
+}
+
+template <typename IndexT>
+absl::Status Checkpoint::LoadIndex(size_t i, IndexT& index) const {
+  using Record = typename IndexT::Container::value_type;
+  using SecKey = decltype(Record::sec_key);
+  using PrimKey = decltype(Record::prim_key);
+  BytesConstView records;
+  RETURN_IF_ERROR(IndexRecords(i, sizeof(SecKey) + sizeof(PrimKey), records));
+  for (size_t offset = 0; offset < records.size(); offset += sizeof(SecKey) + sizeof(PrimKey)) {
+    SecKey sec_key;
+    PrimKey prim_key;
+    std::memcpy(&sec_key, records.data() + offset, sizeof(SecKey));
+    std::memcpy(&prim_key, records.data() + offset + sizeof(SecKey), sizeof(PrimKey));
+    index.InsertLast(sec_key, prim_key);
+  }
+  return absl::OkStatus();
+}
+
+}  // namespace gendb
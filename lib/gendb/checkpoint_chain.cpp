@@ -0,0 +1,195 @@
+#include "gendb/checkpoint_chain.h"
+
+#include <filesystem>
+#include <stdexcept>
+#include <string_view>
+#include <system_error>
+#include <utility>
+
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+
+namespace gendb {
+
+namespace {
+
+constexpr std::string_view kBaseExtension = ".base";
+constexpr std::string_view kDeltaExtension = ".delta";
+
+}  // namespace
+
+std::vector<std::unique_ptr<const Checkpoint>> OpenCheckpointChain(
+    std::span<const std::string> paths) {
+  std::vector<std::unique_ptr<const Checkpoint>> checkpoints;
+  for (const std::string& path : paths) {
+    auto checkpoint = std::make_unique<const Checkpoint>(path);
+    if (checkpoints.empty() ? checkpoint->is_delta() : !checkpoint->is_delta()) {
+      throw std::runtime_error(absl::StrCat("Checkpoint ", path, " is ",
+                                            checkpoints.empty() ? "a delta, not a base"
+                                                                : "a base, not a delta"));
+    }
+    if (!checkpoints.empty() &&
+        checkpoint->generation() != checkpoints.back()->generation() + 1) {
+      throw std::runtime_error(absl::StrCat("Checkpoint ", path, " of generation ",
+                                            checkpoint->generation(), " does not follow ",
+                                            checkpoints.back()->generation()));
+    }
+    checkpoints.push_back(std::move(checkpoint));
+  }
+  return checkpoints;
+}
+
+CheckpointChain::CheckpointChain(CheckpointChainOptions options, MergeFn merge)
+    : _options(std::move(options)), _merge(std::move(merge)) {
+  std::filesystem::create_directories(_options.dir);
+  for (const auto& entry : std::filesystem::directory_iterator(_options.dir)) {
+    const std::filesystem::path& path = entry.path();
+    uint64_t generation = 0;
+    if (!absl::SimpleAtoi(path.stem().string(), &generation)) {
+      continue;
+    }
+    if (path.extension() == kBaseExtension) {
+      _bases.insert(generation);
+    } else if (path.extension() == kDeltaExtension) {
+      _deltas.insert(generation);
+    }
+  }
+  std::lock_guard lock(_mutex);
+  if (absl::Status status = RemoveObsoleteLocked(); !status.ok()) {
+    throw std::runtime_error(status.ToString());
+  }
+}
+
+CheckpointChain::~CheckpointChain() {
+  if (_merge_thread.joinable()) {
+    _merge_thread.join();
+  }
+}
+
+std::vector<std::string> CheckpointChain::Paths() const {
+  std::lock_guard lock(_mutex);
+  return PathsLocked();
+}
+
+uint64_t CheckpointChain::LastGeneration() const {
+  std::lock_guard lock(_mutex);
+  return LastGenerationLocked();
+}
+
+std::string CheckpointChain::Path(uint64_t generation, bool delta) const {
+  const std::string digits = std::to_string(generation);
+  const std::string name = std::string(20 - digits.size(), '0') + digits +
+                           std::string(delta ? kDeltaExtension : kBaseExtension);
+  return (std::filesystem::path(_options.dir) / name).string();
+}
+
+absl::Status CheckpointChain::Add(uint64_t generation, bool delta) {
+  std::lock_guard lock(_mutex);
+  if (!delta) {
+    _bases.insert(generation);
+    return RemoveObsoleteLocked();
+  }
+  if (_bases.empty() || generation != LastGenerationLocked() + 1) {
+    return absl::FailedPreconditionError(
+        absl::StrCat("Checkpoint delta ", generation, " does not follow generation ",
+                     LastGenerationLocked()));
+  }
+  _deltas.insert(generation);
+  if (_merging || PathsLocked().size() <= _options.max_deltas + 1) {
+    return absl::OkStatus();
+  }
+  // Finished: its result was recorded before `_merging` was cleared.
+  if (_merge_thread.joinable()) {
+    _merge_thread.join();
+  }
+  _merge_thread = std::thread([this, job = StartMergeLocked()] {
+    absl::Status status = _merge(job.paths, Path(job.generation, /*delta=*/false));
+    std::lock_guard lock(_mutex);
+    FinishMergeLocked(job, std::move(status)).IgnoreError();
+  });
+  return absl::OkStatus();
+}
+
+absl::Status CheckpointChain::Merge() {
+  std::unique_lock lock(_mutex);
+  _cv.wait(lock, [&] { return !_merging; });
+  if (PathsLocked().size() < 2) {
+    return absl::OkStatus();
+  }
+  const MergeJob job = StartMergeLocked();
+  lock.unlock();
+  absl::Status status = _merge(job.paths, Path(job.generation, /*delta=*/false));
+  lock.lock();
+  return FinishMergeLocked(job, std::move(status));
+}
+
+absl::Status CheckpointChain::merge_status() const {
+  std::lock_guard lock(_mutex);
+  return _merge_status;
+}
+
+std::vector<std::string> CheckpointChain::PathsLocked() const {
+  std::vector<std::string> paths;
+  if (_bases.empty()) {
+    return paths;
+  }
+  uint64_t generation = *_bases.rbegin();
+  paths.push_back(Path(generation, /*delta=*/false));
+  while (_deltas.contains(generation + 1)) {
+    paths.push_back(Path(++generation, /*delta=*/true));
+  }
+  return paths;
+}
+
+uint64_t CheckpointChain::LastGenerationLocked() const {
+  if (_bases.empty()) {
+    return 0;
+  }
+  uint64_t generation = *_bases.rbegin();
+  while (_deltas.contains(generation + 1)) {
+    ++generation;
+  }
+  return generation;
+}
+
+CheckpointChain::MergeJob CheckpointChain::StartMergeLocked() {
+  _merging = true;
+  return {PathsLocked(), LastGenerationLocked()};
+}
+
+absl::Status CheckpointChain::FinishMergeLocked(const MergeJob& job, absl::Status status) {
+  _merging = false;
+  if (status.ok()) {
+    _bases.insert(job.generation);
+    status = RemoveObsoleteLocked();
+  }
+  _merge_status = status;
+  _cv.notify_all();
+  return status;
+}
+
+absl::Status CheckpointChain::RemoveObsoleteLocked() {
+  if (_merging || _bases.empty()) {
+    return absl::OkStatus();
+  }
+  const uint64_t newest = *_bases.rbegin();
+  std::vector<std::string> obsolete;
+  while (*_bases.begin() != newest) {
+    obsolete.push_back(Path(*_bases.begin(), /*delta=*/false));
+    _bases.erase(_bases.begin());
+  }
+  while (!_deltas.empty() && *_deltas.begin() <= newest) {
+    obsolete.push_back(Path(*_deltas.begin(), /*delta=*/true));
+    _deltas.erase(_deltas.begin());
+  }
+  for (const std::string& path : obsolete) {
+    std::error_code error;
+    std::filesystem::remove(path, error);
+    if (error) {
+      return absl::InternalError("Failed to remove checkpoint " + path + ": " + error.message());
+    }
+  }
+  return absl::OkStatus();
+}
+
+}  // namespace gendb
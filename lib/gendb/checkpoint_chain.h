@@ -0,0 +1,100 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <span>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "gendb/checkpoint.h"
+
+namespace gendb {
+
+// Opens the checkpoints of a chain: a base, then the deltas of the generations following it, in
+// order. Throws std::runtime_error if a file is invalid, or if they do not form a chain.
+std::vector<std::unique_ptr<const Checkpoint>> OpenCheckpointChain(
+    std::span<const std::string> paths);
+
+struct CheckpointChainOptions {
+  // Directory of the checkpoint files, created if missing.
+  std::string dir;
+  // Once the newest base has more deltas than this, they are merged into a new base in the
+  // background, which bounds the files a Db opens and the changes it replays.
+  size_t max_deltas = 8;
+};
+
+// The checkpoints of a Db in a directory, each file named after its generation: the newest base
+// and the deltas written after it. Writing a delta costs as much as the keys changed since the
+// previous checkpoint, so periodic checkpoints of a large database that changes slowly stay
+// cheap; merges fold the deltas back into a base, off the commit path, with files no newer
+// checkpoint needs removed. Thread-safe.
+class CheckpointChain {
+ public:
+  // Writes the checkpoint of the chain at `paths`, a base followed by deltas, to a base at `path`.
+  using MergeFn =
+      std::function<absl::Status(std::span<const std::string> paths, const std::string& path)>;
+
+  // Lists the checkpoints already in `options.dir`. `merge` runs on the background thread. Throws
+  // std::runtime_error if the directory cannot be created or read.
+  CheckpointChain(CheckpointChainOptions options, MergeFn merge);
+  // Waits for a background merge.
+  ~CheckpointChain();
+
+  CheckpointChain(const CheckpointChain&) = delete;
+  CheckpointChain& operator=(const CheckpointChain&) = delete;
+
+  // Paths of the newest base and of the deltas after it, in generation order, to open a Db from.
+  // Empty if the chain has no base.
+  std::vector<std::string> Paths() const;
+
+  // Generation of the last checkpoint of Paths(), 0 if none: the next one is one more.
+  uint64_t LastGeneration() const;
+
+  // Where the checkpoint of `generation` is written.
+  std::string Path(uint64_t generation, bool delta) const;
+
+  // Adds the checkpoint just written at Path(generation, delta), of generation LastGeneration() + 1
+  // if it is a delta. A base makes every older file obsolete; too many deltas start a merge.
+  absl::Status Add(uint64_t generation, bool delta);
+
+  // Merges the deltas into a new base on the calling thread, after waiting for a background merge.
+  absl::Status Merge();
+
+  // Result of the last merge, OkStatus if none failed.
+  absl::Status merge_status() const;
+
+ private:
+  // The merge in progress: it writes `generation` from `paths`.
+  struct MergeJob {
+    std::vector<std::string> paths;
+    uint64_t generation = 0;
+  };
+
+  std::vector<std::string> PathsLocked() const;
+  uint64_t LastGenerationLocked() const;
+  // Marks a merge of the current chain as running.
+  MergeJob StartMergeLocked();
+  absl::Status FinishMergeLocked(const MergeJob& job, absl::Status status);
+  // Removes the bases older than the newest one and the deltas it holds, unless a merge still
+  // reads them.
+  absl::Status RemoveObsoleteLocked();
+
+  const CheckpointChainOptions _options;
+  const MergeFn _merge;
+  mutable std::mutex _mutex;
+  std::condition_variable _cv;
+  // Generations of the files in the directory.
+  std::set<uint64_t> _bases;
+  std::set<uint64_t> _deltas;
+  bool _merging = false;
+  absl::Status _merge_status;
+  std::thread _merge_thread;
+};
+
+}  // namespace gendb
@@ -0,0 +1,141 @@
+#include "gendb/checkpoint_chain.h"
+
+#include <gtest/gtest.h>
+
+#include <filesystem>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "gendb/arena_storage.h"
+#include "status_matchers.h"
+
+namespace gendb {
+namespace {
+
+Bytes ToBytes(const std::string& str) { return {str.begin(), str.end()}; }
+
+class CheckpointChainTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    _options.dir = (std::filesystem::temp_directory_path() /
+                    ("checkpoint_chain_test_" + std::to_string(std::random_device{}())))
+                       .string();
+    _options.max_deltas = 2;
+  }
+
+  void TearDown() override { std::filesystem::remove_all(_options.dir); }
+
+  // Writes a checkpoint with one key, named after its generation, at `path`.
+  static void Write(const std::string& path, uint64_t generation, bool delta) {
+    ArenaStorage storage;
+    storage.Put(0, ToBytes("key"), ToBytes(std::to_string(generation)));
+    ChangedKeys changed_keys;
+    changed_keys.Add(0, ToBytes("key"));
+    CheckpointWriter writer(path, generation, delta);
+    if (delta) {
+      ASSERT_OK(writer.AddChangedKeys(storage, 0, changed_keys.collection(0)));
+    } else {
+      ASSERT_OK(writer.AddCollection(*storage.NewCursor(0)));
+    }
+    ASSERT_OK(writer.Finish(generation));
+  }
+
+  // Merges by writing a base of the last generation, after checking the chain.
+  static absl::Status Merge(std::span<const std::string> paths, const std::string& path) {
+    const auto checkpoints = OpenCheckpointChain(paths);
+    Write(path, checkpoints.back()->generation(), /*delta=*/false);
+    return absl::OkStatus();
+  }
+
+  size_t FileCount() const {
+    return std::distance(std::filesystem::directory_iterator(_options.dir),
+                         std::filesystem::directory_iterator());
+  }
+
+  CheckpointChainOptions _options;
+};
+
+TEST_F(CheckpointChainTest, OpenCheckpointChainChecksTheOrder) {
+  CheckpointChain chain(_options, Merge);
+  Write(chain.Path(1, false), 1, /*delta=*/false);
+  Write(chain.Path(2, true), 2, /*delta=*/true);
+  Write(chain.Path(3, true), 3, /*delta=*/true);
+  const std::vector<std::string> paths = {chain.Path(1, false), chain.Path(2, true),
+                                          chain.Path(3, true)};
+  EXPECT_EQ(OpenCheckpointChain(paths).size(), 3);
+  // A delta first, a gap and a second base.
+  EXPECT_THROW(OpenCheckpointChain(std::span(paths).subspan(1)), std::runtime_error);
+  const std::vector<std::string> gap = {paths[0], paths[2]};
+  EXPECT_THROW(OpenCheckpointChain(gap), std::runtime_error);
+  const std::vector<std::string> bases = {paths[0], paths[0]};
+  EXPECT_THROW(OpenCheckpointChain(bases), std::runtime_error);
+}
+
+TEST_F(CheckpointChainTest, BasesMakeOlderFilesObsolete) {
+  {
+    CheckpointChain chain(_options, Merge);
+    EXPECT_TRUE(chain.Paths().empty());
+    EXPECT_EQ(chain.LastGeneration(), 0);
+    // A delta needs a base to follow.
+    Write(chain.Path(1, true), 1, /*delta=*/true);
+    EXPECT_FALSE(chain.Add(1, /*delta=*/true).ok());
+    std::filesystem::remove(chain.Path(1, true));
+
+    Write(chain.Path(1, false), 1, /*delta=*/false);
+    ASSERT_OK(chain.Add(1, /*delta=*/false));
+    Write(chain.Path(2, true), 2, /*delta=*/true);
+    ASSERT_OK(chain.Add(2, /*delta=*/true));
+    EXPECT_EQ(chain.LastGeneration(), 2);
+    EXPECT_EQ(chain.Paths(), (std::vector<std::string>{chain.Path(1, false), chain.Path(2, true)}));
+
+    Write(chain.Path(3, false), 3, /*delta=*/false);
+    ASSERT_OK(chain.Add(3, /*delta=*/false));
+    EXPECT_EQ(chain.Paths(), std::vector<std::string>{chain.Path(3, false)});
+    EXPECT_EQ(FileCount(), 1);
+    Write(chain.Path(4, true), 4, /*delta=*/true);
+    ASSERT_OK(chain.Add(4, /*delta=*/true));
+  }
+  // Listed again on reopen.
+  CheckpointChain chain(_options, Merge);
+  EXPECT_EQ(chain.LastGeneration(), 4);
+  EXPECT_EQ(chain.Paths().size(), 2);
+}
+
+TEST_F(CheckpointChainTest, TooManyDeltasAreMergedInTheBackground) {
+  CheckpointChain chain(_options, Merge);
+  Write(chain.Path(1, false), 1, /*delta=*/false);
+  ASSERT_OK(chain.Add(1, /*delta=*/false));
+  for (uint64_t generation = 2; generation <= 4; ++generation) {
+    Write(chain.Path(generation, true), generation, /*delta=*/true);
+    ASSERT_OK(chain.Add(generation, /*delta=*/true));
+  }
+  // Waits for the background merge of generation 4, which has nothing left to merge after it.
+  ASSERT_OK(chain.Merge());
+  ASSERT_OK(chain.merge_status());
+  EXPECT_EQ(chain.Paths(), std::vector<std::string>{chain.Path(4, false)});
+  EXPECT_EQ(chain.LastGeneration(), 4);
+  EXPECT_EQ(FileCount(), 1);
+
+  Write(chain.Path(5, true), 5, /*delta=*/true);
+  ASSERT_OK(chain.Add(5, /*delta=*/true));
+  ASSERT_OK(chain.Merge());
+  EXPECT_EQ(chain.Paths(), std::vector<std::string>{chain.Path(5, false)});
+}
+
+TEST_F(CheckpointChainTest, FailedMergeKeepsTheChain) {
+  CheckpointChain chain(_options, [](std::span<const std::string>, const std::string&) {
+    return absl::DataLossError("merge failed");
+  });
+  Write(chain.Path(1, false), 1, /*delta=*/false);
+  ASSERT_OK(chain.Add(1, /*delta=*/false));
+  Write(chain.Path(2, true), 2, /*delta=*/true);
+  ASSERT_OK(chain.Add(2, /*delta=*/true));
+  EXPECT_STATUS_EQ(absl::StatusCode::kDataLoss, chain.Merge());
+  EXPECT_STATUS_EQ(absl::StatusCode::kDataLoss, chain.merge_status());
+  EXPECT_EQ(chain.Paths().size(), 2);
+}
+
+}  // namespace
+}  // namespace gendb
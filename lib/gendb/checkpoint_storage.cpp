@@ -0,0 +1,202 @@
+#include "gendb/checkpoint_storage.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <utility>
+
+#include "gendb/status.h"
+
+namespace gendb {
+
+namespace {
+
+// A cursor has no status to return: like a failed RocksDB write, a corrupt checkpoint record is
+// fatal to it.
+void ThrowIfCorrupt(const absl::Status& status) {
+  if (!status.ok()) {
+    throw std::runtime_error("Failed to read checkpoint: " + status.ToString());
+  }
+}
+
+}  // namespace
+
+// Merges the arena's cursor with a walk of the checkpoint's key order. A key is never in both:
+// writing a checkpoint key hides it.
+class CheckpointStorage::Cursor : public StorageCursor {
+ public:
+  Cursor(const CheckpointStorage& storage, size_t collection_id)
+      : _storage(storage),
+        _collection_id(collection_id),
+        _arena(storage._arena.NewCursor(collection_id)) {
+    if (storage.HasBase(collection_id)) {
+      _base = &storage._bases[collection_id];
+      _base_end = storage._checkpoint->size(collection_id);
+    }
+    _position = _base_end;
+  }
+
+  void Seek(BytesConstView key) override {
+    _arena->Seek(key);
+    if (_base_end > 0) {
+      ThrowIfCorrupt(_storage._checkpoint->LowerBound(_collection_id, key, _position));
+    }
+    SkipHidden();
+  }
+  void Next() override {
+    if (_in_arena) {
+      _arena->Next();
+    } else {
+      ++_position;
+    }
+    SkipHidden();
+  }
+  bool Valid() const override { return _in_arena || _position < _base_end; }
+  BytesConstView Key() const override { return _in_arena ? _arena->Key() : _record.key; }
+  BytesConstView Value() const override { return _in_arena ? _arena->Value() : _record.value; }
+
+ private:
+  // Moves past hidden checkpoint keys, reading the record at the position, then picks the smaller
+  // of the two keys.
+  void SkipHidden() {
+    // Only read with a checkpoint, when _base_end is not 0.
+    for (; _position < _base_end; ++_position) {
+      ThrowIfCorrupt(_storage._checkpoint->Read(_collection_id, _position, _record));
+      if (!_base->hidden.contains(_record.key)) {
+        break;
+      }
+    }
+    _in_arena =
+        _arena->Valid() && (_position == _base_end ||
+                            std::ranges::lexicographical_compare(_arena->Key(), _record.key));
+  }
+
+  const CheckpointStorage& _storage;
+  const size_t _collection_id;
+  std::unique_ptr<StorageCursor> _arena;
+  // Null if none of the checkpoint's keys are visible.
+  const Base* _base = nullptr;
+  // Position in the checkpoint's key order, and its end: 0 if none of its keys are visible.
+  size_t _position = 0;
+  size_t _base_end = 0;
+  // The checkpoint's record at _position, if before _base_end.
+  Checkpoint::Record _record;
+  bool _in_arena = false;
+};
+
+void CheckpointStorage::SetCheckpoint(std::unique_ptr<const Checkpoint> checkpoint) {
+  _checkpoint = std::move(checkpoint);
+  _bases = std::vector<Base>(_checkpoint->collection_count());
+}
+
+void CheckpointStorage::Put(const size_t collection_id, BytesConstView key, Bytes&& value) {
+  Hide(collection_id, key);
+  _arena.Put(collection_id, key, std::move(value));
+}
+
+absl::Status CheckpointStorage::Delete(const size_t collection_id, BytesConstView key) {
+  absl::Status status = _arena.Delete(collection_id, key);
+  if (!HasBase(collection_id)) {
+    return status;
+  }
+  BytesConstView value;
+  absl::Status base_status = FindBase(collection_id, key, value);
+  if (base_status.ok()) {
+    _bases[collection_id].hidden.try_emplace(key, true);
+    return absl::OkStatus();
+  }
+  return absl::IsNotFound(base_status) ? status : base_status;
+}
+
+absl::Status CheckpointStorage::DeleteRange(const size_t collection_id, BytesConstView begin,
+                                            BytesConstView end) {
+  RETURN_IF_ERROR(_arena.DeleteRange(collection_id, begin, end));
+  if (HasBase(collection_id)) {
+    size_t i = 0;
+    RETURN_IF_ERROR(_checkpoint->LowerBound(collection_id, begin, i));
+    for (; i < _checkpoint->size(collection_id); ++i) {
+      Checkpoint::Record record;
+      RETURN_IF_ERROR(_checkpoint->Read(collection_id, i, record));
+      if (!std::ranges::lexicographical_compare(record.key, end)) {
+        break;
+      }
+      _bases[collection_id].hidden.try_emplace(record.key, true);
+    }
+  }
+  return absl::OkStatus();
+}
+
+absl::Status CheckpointStorage::Truncate(const size_t collection_id) {
+  RETURN_IF_ERROR(_arena.Truncate(collection_id));
+  if (collection_id < _bases.size()) {
+    _bases[collection_id] = {.hidden = {}, .dropped = true};
+  }
+  return absl::OkStatus();
+}
+
+absl::Status CheckpointStorage::Get(const size_t collection_id, BytesConstView key,
+                                    BytesConstView& value) const {
+  if (_arena.Find(collection_id, key, value)) {
+    return absl::OkStatus();
+  }
+  return FindBase(collection_id, key, value);
+}
+
+void CheckpointStorage::MultiGet(const size_t collection_id, std::span<const BytesConstView> keys,
+                                 std::span<BytesConstView> values,
+                                 std::span<absl::Status> statuses, ValuePins& pins) const {
+  _arena.MultiGet(collection_id, keys, values, statuses, pins);
+  for (size_t i = 0; i < keys.size(); ++i) {
+    if (!statuses[i].ok()) {
+      statuses[i] = FindBase(collection_id, keys[i], values[i]);
+    }
+  }
+}
+
+bool CheckpointStorage::Exists(const size_t collection_id, BytesConstView key) const {
+  BytesConstView value;
+  return _arena.Exists(collection_id, key) || FindBase(collection_id, key, value).ok();
+}
+
+std::unique_ptr<StorageCursor> CheckpointStorage::NewCursor(const size_t collection_id) const {
+  return std::make_unique<Cursor>(*this, collection_id);
+}
+
+size_t CheckpointStorage::GetCollectionCount() const {
+  return std::max(_arena.GetCollectionCount(), _bases.size());
+}
+
+size_t CheckpointStorage::GetCollectionSize(const size_t collection_id) const {
+  size_t size = _arena.GetCollectionSize(collection_id);
+  if (HasBase(collection_id)) {
+    size += _checkpoint->size(collection_id) - _bases[collection_id].hidden.size();
+  }
+  return size;
+}
+
+void CheckpointStorage::Clear() {
+  _arena.Clear();
+  for (Base& base : _bases) {
+    base = {.hidden = {}, .dropped = true};
+  }
+}
+
+absl::Status CheckpointStorage::FindBase(size_t collection_id, BytesConstView key,
+                                         BytesConstView& value) const {
+  if (!HasBase(collection_id)) {
+    return absl::NotFoundError("Key not found");
+  }
+  const Base& base = _bases[collection_id];
+  if (!base.hidden.empty() && base.hidden.contains(key)) {
+    return absl::NotFoundError("Key not found");
+  }
+  return _checkpoint->Find(collection_id, key, value);
+}
+
+void CheckpointStorage::Hide(size_t collection_id, BytesConstView key) {
+  BytesConstView value;
+  if (HasBase(collection_id) && FindBase(collection_id, key, value).ok()) {
+    _bases[collection_id].hidden.try_emplace(key, true);
+  }
+}
+
+}  // namespace gendb
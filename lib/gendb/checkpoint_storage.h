@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "gendb/arena_storage.h"
+#include "gendb/bytes.h"
+#include "gendb/checkpoint.h"
+#include "gendb/epoch.h"
+#include "gendb/flat_hash_map.h"
+#include "gendb/storage.h"
+
+namespace gendb {
+
+// ArenaStorage over a read-only Checkpoint. Keys not written since the checkpoint are read from
+// its mapping, so a database serves reads as soon as the file is mapped, and pages values in as
+// they are first read instead of loading them all. Writes go to the arena; a checkpoint key that
+// is overwritten or deleted is hidden, which costs a hash map entry per such key.
+//
+// Views of checkpoint values stay valid for the lifetime of the storage; views of arena values
+// follow ArenaStorage's rules. Reads of a corrupt checkpoint record fail with DataLoss, except in
+// cursors, which have no status to return and throw std::runtime_error.
+class CheckpointStorage : public Storage {
+ public:
+  explicit CheckpointStorage(size_t slab_size = ArenaStorage::kDefaultSlabSize,
+                             EpochManager* epochs = nullptr)
+      : _arena(slab_size, epochs) {}
+
+  // Reads fall through to `checkpoint` from now on. Only before the first write.
+  void SetCheckpoint(std::unique_ptr<const Checkpoint> checkpoint);
+  // nullptr until SetCheckpoint.
+  const Checkpoint* checkpoint() const { return _checkpoint.get(); }
+
+  void Put(const size_t collection_id, BytesConstView key, Bytes&& value) override;
+
+  absl::Status Delete(const size_t collection_id, BytesConstView key) override;
+
+  // Every checkpoint key in the range is hidden one by one.
+  absl::Status DeleteRange(const size_t collection_id, BytesConstView begin,
+                           BytesConstView end) override;
+
+  // Hides the checkpoint's collection as a whole.
+  absl::Status Truncate(const size_t collection_id) override;
+
+  absl::Status Get(const size_t collection_id, BytesConstView key,
+                   BytesConstView& value) const override;
+
+  // The arena's batched probes first, then the checkpoint for the keys they missed.
+  void MultiGet(const size_t collection_id, std::span<const BytesConstView> keys,
+                std::span<BytesConstView> values, std::span<absl::Status> statuses,
+                ValuePins& pins) const override;
+
+  bool Exists(const size_t collection_id, BytesConstView key) const override;
+
+  // Merges the arena's keys with the checkpoint's, in key order.
+  std::unique_ptr<StorageCursor> NewCursor(const size_t collection_id) const override;
+
+  size_t GetCollectionCount() const override;
+
+  size_t GetCollectionSize(const size_t collection_id) const override;
+
+  void Clear() override;
+
+ private:
+  // What is left of the checkpoint's collection.
+  struct Base {
+    // Checkpoint keys that were overwritten or deleted. Values are unused.
+    FlatHashMap<bool> hidden;
+    // Truncated or cleared: no checkpoint key is visible.
+    bool dropped = false;
+  };
+
+  class Cursor;
+
+  // Whether some of the checkpoint's keys of the collection may be visible. Writes check it
+  // first, so that a Db opened without a checkpoint does not build FindBase's error status.
+  bool HasBase(size_t collection_id) const {
+    return collection_id < _bases.size() && !_bases[collection_id].dropped;
+  }
+  // NotFound unless the checkpoint has `key` and it is not hidden; sets `value` if so. DataLoss if
+  // the checkpoint's table is corrupt.
+  absl::Status FindBase(size_t collection_id, BytesConstView key, BytesConstView& value) const;
+  // Hides `key` if the checkpoint has it.
+  void Hide(size_t collection_id, BytesConstView key);
+
+  ArenaStorage _arena;
+  std::unique_ptr<const Checkpoint> _checkpoint;
+  // One per checkpoint collection.
+  std::vector<Base> _bases;
+};
+
+}  // namespace gendb
@@ -0,0 +1,194 @@
+#include "gendb/checkpoint_storage.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "status_matchers.h"
+
+namespace gendb {
+namespace {
+
+Bytes ToBytes(const std::string& str) { return {str.begin(), str.end()}; }
+
+std::string ToString(BytesConstView bytes) {
+  return {reinterpret_cast<const char*>(bytes.data()), bytes.size()};
+}
+
+Bytes MakeKey(int i) {
+  char key[8];
+  std::snprintf(key, sizeof(key), "key%03d", i);
+  return ToBytes(key);
+}
+
+class CheckpointStorageTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    _path = (std::filesystem::temp_directory_path() /
+             ("checkpoint_storage_test_" + std::to_string(std::random_device{}())))
+                .string();
+    // Even keys in collection 0, "b" alone in collection 1.
+    ArenaStorage source;
+    for (int i = 0; i < 100; i += 2) {
+      source.Put(0, MakeKey(i), ToBytes("base" + std::to_string(i)));
+    }
+    source.Put(1, ToBytes("b"), ToBytes("base"));
+    CheckpointWriter writer(_path);
+    ASSERT_OK(writer.AddCollection(*source.NewCursor(0)));
+    ASSERT_OK(writer.AddCollection(*source.NewCursor(1)));
+    ASSERT_OK(writer.Finish(0));
+    _storage.SetCheckpoint(std::make_unique<Checkpoint>(_path));
+  }
+
+  void TearDown() override { std::filesystem::remove(_path); }
+
+  std::vector<std::string> Keys(size_t collection_id, BytesConstView from = {}) const {
+    std::vector<std::string> keys;
+    auto cursor = _storage.NewCursor(collection_id);
+    for (cursor->Seek(from); cursor->Valid(); cursor->Next()) {
+      keys.push_back(ToString(cursor->Key()));
+    }
+    return keys;
+  }
+
+  std::string _path;
+  CheckpointStorage _storage;
+};
+
+TEST_F(CheckpointStorageTest, ReadsFallThroughToTheCheckpoint) {
+  EXPECT_EQ(_storage.GetCollectionCount(), 2);
+  EXPECT_EQ(_storage.GetCollectionSize(0), 50);
+  BytesConstView value;
+  ASSERT_OK(_storage.Get(0, MakeKey(42), value));
+  EXPECT_EQ(ToString(value), "base42");
+  EXPECT_NOT_FOUND(_storage.Get(0, MakeKey(43), value));
+  EXPECT_TRUE(_storage.Exists(1, ToBytes("b")));
+  EXPECT_FALSE(_storage.Exists(2, ToBytes("b")));
+  EXPECT_EQ(Keys(1), std::vector<std::string>{"b"});
+}
+
+TEST_F(CheckpointStorageTest, WritesHideCheckpointKeys) {
+  _storage.Put(0, MakeKey(2), ToBytes("new2"));
+  _storage.Put(0, MakeKey(3), ToBytes("new3"));
+  ASSERT_OK(_storage.Delete(0, MakeKey(4)));
+  EXPECT_NOT_FOUND(_storage.Delete(0, MakeKey(4)));
+  EXPECT_NOT_FOUND(_storage.Delete(0, MakeKey(5)));
+  EXPECT_EQ(_storage.GetCollectionSize(0), 50);
+
+  BytesConstView value;
+  ASSERT_OK(_storage.Get(0, MakeKey(2), value));
+  EXPECT_EQ(ToString(value), "new2");
+  EXPECT_NOT_FOUND(_storage.Get(0, MakeKey(4), value));
+
+  // Deleting an overwritten checkpoint key deletes it for good.
+  ASSERT_OK(_storage.Delete(0, MakeKey(2)));
+  EXPECT_NOT_FOUND(_storage.Get(0, MakeKey(2), value));
+  EXPECT_EQ(_storage.GetCollectionSize(0), 49);
+
+  const std::vector<Bytes> key_bytes = {MakeKey(2), MakeKey(3), MakeKey(6)};
+  const std::vector<BytesConstView> keys(key_bytes.begin(), key_bytes.end());
+  std::vector<BytesConstView> values(keys.size());
+  std::vector<absl::Status> statuses(keys.size());
+  ValuePins pins;
+  _storage.MultiGet(0, keys, values, statuses, pins);
+  EXPECT_NOT_FOUND(statuses[0]);
+  ASSERT_OK(statuses[1]);
+  EXPECT_EQ(ToString(values[1]), "new3");
+  ASSERT_OK(statuses[2]);
+  EXPECT_EQ(ToString(values[2]), "base6");
+}
+
+TEST_F(CheckpointStorageTest, CursorMergesArenaAndCheckpoint) {
+  _storage.Put(0, MakeKey(1), ToBytes("new1"));
+  _storage.Put(0, MakeKey(2), ToBytes("new2"));
+  ASSERT_OK(_storage.Delete(0, MakeKey(4)));
+  ASSERT_OK(_storage.DeleteRange(0, MakeKey(10), MakeKey(96)));
+  _storage.Put(0, MakeKey(97), ToBytes("new97"));
+  EXPECT_EQ(Keys(0), (std::vector<std::string>{"key000", "key001", "key002", "key006", "key008",
+                                               "key096", "key097", "key098"}));
+  EXPECT_EQ(Keys(0, MakeKey(7)),
+            (std::vector<std::string>{"key008", "key096", "key097", "key098"}));
+  EXPECT_EQ(_storage.GetCollectionSize(0), 8);
+
+  auto cursor = _storage.NewCursor(0);
+  cursor->Seek(MakeKey(2));
+  ASSERT_TRUE(cursor->Valid());
+  EXPECT_EQ(ToString(cursor->Value()), "new2");
+  cursor->Next();
+  EXPECT_EQ(ToString(cursor->Value()), "base6");
+}
+
+TEST_F(CheckpointStorageTest, TruncateAndClearDropTheCheckpoint) {
+  _storage.Put(0, MakeKey(1), ToBytes("new1"));
+  ASSERT_OK(_storage.Truncate(0));
+  EXPECT_EQ(_storage.GetCollectionSize(0), 0);
+  EXPECT_TRUE(Keys(0).empty());
+  _storage.Put(0, MakeKey(2), ToBytes("new2"));
+  EXPECT_EQ(Keys(0), std::vector<std::string>{"key002"});
+  EXPECT_EQ(Keys(1), std::vector<std::string>{"b"});
+
+  _storage.Clear();
+  EXPECT_EQ(_storage.GetCollectionSize(0), 0);
+  EXPECT_FALSE(_storage.Exists(1, ToBytes("b")));
+}
+
+TEST_F(CheckpointStorageTest, MatchesReferenceMapUnderRandomOps) {
+  std::map<std::string, std::string> reference;
+  for (int i = 0; i < 100; i += 2) {
+    reference[ToString(MakeKey(i))] = "base" + std::to_string(i);
+  }
+  std::mt19937 rng(7);
+  for (int i = 0; i < 5000; ++i) {
+    const int k = static_cast<int>(rng() % 120);
+    const std::string key = ToString(MakeKey(k));
+    if (rng() % 3 == 0) {
+      EXPECT_EQ(_storage.Delete(0, ToBytes(key)).ok(), reference.erase(key) == 1);
+    } else {
+      const std::string value = std::to_string(i);
+      _storage.Put(0, ToBytes(key), ToBytes(value));
+      reference[key] = value;
+    }
+  }
+  EXPECT_EQ(_storage.GetCollectionSize(0), reference.size());
+  std::vector<std::string> keys;
+  for (const auto& [key, value] : reference) {
+    keys.push_back(key);
+    BytesConstView found;
+    ASSERT_OK(_storage.Get(0, ToBytes(key), found));
+    EXPECT_EQ(ToString(found), value);
+  }
+  EXPECT_EQ(Keys(0), keys);
+}
+
+TEST_F(CheckpointStorageTest, CorruptRecordsFailReads) {
+  // The first record of collection 0 follows the 64-byte header; its key size now runs past the
+  // collection's records.
+  {
+    std::fstream file(_path, std::ios::in | std::ios::out | std::ios::binary);
+    const uint32_t key_size = 0x7fffffff;
+    file.seekp(64);
+    file.write(reinterpret_cast<const char*>(&key_size), sizeof(key_size));
+  }
+  CheckpointStorage storage;
+  storage.SetCheckpoint(std::make_unique<Checkpoint>(_path));
+  BytesConstView value;
+  EXPECT_STATUS_EQ(absl::StatusCode::kDataLoss, storage.Get(0, MakeKey(0), value));
+  ASSERT_OK(storage.Get(0, MakeKey(2), value));
+  EXPECT_STATUS_EQ(absl::StatusCode::kDataLoss, storage.DeleteRange(0, {}, MakeKey(2)));
+  EXPECT_THROW(storage.NewCursor(0)->Seek({}), std::runtime_error);
+  // Other collections still read.
+  auto cursor = storage.NewCursor(1);
+  cursor->Seek({});
+  ASSERT_TRUE(cursor->Valid());
+  EXPECT_EQ(ToString(cursor->Key()), "b");
+}
+
+}  // namespace
+}  // namespace gendb
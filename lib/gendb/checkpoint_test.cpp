@@ -0,0 +1,374 @@
+#include "gendb/checkpoint.h"
+
+#include <gtest/gtest.h>
+
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <random>
+#include <stdexcept>
+#include <string>
+
+#include "gendb/arena_storage.h"
+#include "gendb/index.h"
+#include "status_matchers.h"
+
+namespace gendb {
+namespace {
+
+Bytes ToBytes(const std::string& str) { return {str.begin(), str.end()}; }
+
+std::string ToString(BytesConstView bytes) {
+  return {reinterpret_cast<const char*>(bytes.data()), bytes.size()};
+}
+
+Checkpoint::Record Read(const Checkpoint& checkpoint, size_t collection_id, size_t i) {
+  Checkpoint::Record record;
+  EXPECT_OK(checkpoint.Read(collection_id, i, record));
+  return record;
+}
+
+size_t LowerBound(const Checkpoint& checkpoint, size_t collection_id, BytesConstView key) {
+  size_t position = 0;
+  EXPECT_OK(checkpoint.LowerBound(collection_id, key, position));
+  return position;
+}
+
+// Reads and writes the u64s of a checkpoint file in place.
+class FilePatcher {
+ public:
+  explicit FilePatcher(const std::string& path)
+      : _file(path, std::ios::in | std::ios::out | std::ios::binary) {}
+
+  uint64_t Get(std::streamoff offset) {
+    uint64_t value = 0;
+    _file.seekg(offset);
+    _file.read(reinterpret_cast<char*>(&value), sizeof(value));
+    return value;
+  }
+  void Set(std::streamoff offset, uint64_t value) {
+    _file.seekp(offset);
+    _file.write(reinterpret_cast<const char*>(&value), sizeof(value));
+  }
+
+  // The header holds the directory's offset at byte 32. A collection's directory entry holds its
+  // record count and records, order and table offsets, 8 bytes each, then the table's capacity.
+  std::streamoff directory() { return static_cast<std::streamoff>(Get(32)); }
+
+ private:
+  std::fstream _file;
+};
+
+class CheckpointTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    _path = (std::filesystem::temp_directory_path() /
+             ("checkpoint_test_" + std::to_string(std::random_device{}())))
+                .string();
+  }
+
+  void TearDown() override { std::filesystem::remove(_path); }
+
+  // Writes every collection of `storage`, then `index`.
+  void Write(const Storage& storage, const Index<int32_t, int64_t>& index,
+             uint64_t wal_sequence = 0) {
+    CheckpointWriter writer(_path);
+    for (size_t id = 0; id < storage.GetCollectionCount(); ++id) {
+      ASSERT_OK(writer.AddCollection(*storage.NewCursor(id)));
+    }
+    ASSERT_OK(writer.AddIndex(index));
+    ASSERT_OK(writer.Finish(wal_sequence));
+  }
+
+  std::string _path;
+};
+
+TEST_F(CheckpointTest, RoundTripsCollectionsAndIndices) {
+  ArenaStorage storage;
+  std::map<std::string, std::string> reference;
+  for (int i = 0; i < 1000; ++i) {
+    const std::string key = "key" + std::to_string(i);
+    // Odd sizes, so records need padding.
+    const std::string value(static_cast<size_t>(i % 37), static_cast<char>('a' + i % 26));
+    storage.Put(1, ToBytes(key), ToBytes(value));
+    reference[key] = value;
+  }
+  // Collection 0 stays empty; collection 2 has an empty key.
+  storage.Put(2, Bytes(), ToBytes("empty key"));
+  Index<int32_t, int64_t> index;
+  index.Insert(3, 30);
+  index.Insert(1, 10);
+  index.Insert(1, 11);
+  // Only kept for snapshots: not written.
+  index.Insert(2, 20, /*is_deleted=*/true);
+  Write(storage, index, /*wal_sequence=*/42);
+
+  const Checkpoint checkpoint(_path);
+  EXPECT_EQ(checkpoint.wal_sequence(), 42);
+  ASSERT_EQ(checkpoint.collection_count(), 3);
+  EXPECT_EQ(checkpoint.index_count(), 1);
+  EXPECT_EQ(checkpoint.size(0), 0);
+  EXPECT_EQ(checkpoint.size(7), 0);
+  ASSERT_EQ(checkpoint.size(1), reference.size());
+
+  size_t i = 0;
+  for (const auto& [key, value] : reference) {
+    const Checkpoint::Record record = Read(checkpoint, 1, i);
+    EXPECT_EQ(ToString(record.key), key);
+    EXPECT_EQ(ToString(record.value), value);
+    EXPECT_FALSE(record.deleted);
+    BytesConstView found;
+    ASSERT_TRUE(checkpoint.Find(1, ToBytes(key), found).ok()) << key;
+    EXPECT_EQ(ToString(found), value);
+    ++i;
+  }
+  BytesConstView found;
+  EXPECT_STATUS_EQ(absl::StatusCode::kNotFound, checkpoint.Find(1, ToBytes("key1000"), found));
+  EXPECT_STATUS_EQ(absl::StatusCode::kNotFound, checkpoint.Find(0, ToBytes("key1"), found));
+  ASSERT_OK(checkpoint.Find(2, Bytes(), found));
+  EXPECT_EQ(ToString(found), "empty key");
+
+  EXPECT_EQ(LowerBound(checkpoint, 1, Bytes()), 0);
+  EXPECT_EQ(ToString(Read(checkpoint, 1, LowerBound(checkpoint, 1, ToBytes("key10"))).key),
+            "key10");
+  EXPECT_EQ(ToString(Read(checkpoint, 1, LowerBound(checkpoint, 1, ToBytes("key100a"))).key),
+            "key101");
+  EXPECT_EQ(LowerBound(checkpoint, 1, ToBytes("z")), reference.size());
+  EXPECT_OK(checkpoint.Verify());
+
+  Index<int32_t, int64_t> loaded;
+  ASSERT_OK(checkpoint.LoadIndex(0, loaded));
+  ASSERT_EQ(loaded._index.size(), 3);
+  auto it = loaded.begin();
+  EXPECT_EQ(std::make_pair(it->sec_key, it->prim_key), std::make_pair(1, int64_t{10}));
+  ++it;
+  EXPECT_EQ(std::make_pair(it->sec_key, it->prim_key), std::make_pair(1, int64_t{11}));
+  ++it;
+  EXPECT_EQ(std::make_pair(it->sec_key, it->prim_key), std::make_pair(3, int64_t{30}));
+
+  // Another record size than the index's.
+  Index<int64_t, int64_t> wider;
+  EXPECT_FALSE(checkpoint.LoadIndex(0, wider).ok());
+  EXPECT_FALSE(checkpoint.LoadIndex(1, loaded).ok());
+}
+
+TEST_F(CheckpointTest, DeltaHoldsChangedKeysAndDeletions) {
+  ArenaStorage storage;
+  for (int i = 0; i < 100; ++i) {
+    storage.Put(0, ToBytes("key" + std::to_string(i)), ToBytes("value" + std::to_string(i)));
+  }
+  ChangedKeys changed_keys;
+  // Written twice, but recorded once.
+  changed_keys.Add(0, ToBytes("key7"));
+  changed_keys.Add(0, ToBytes("key7"));
+  changed_keys.Add(0, ToBytes("key50"));
+  changed_keys.Add(0, ToBytes("gone"));
+  changed_keys.Add(2, ToBytes("gone"));
+  EXPECT_EQ(changed_keys.size(), 4);
+  {
+    CheckpointWriter writer(_path, /*generation=*/3, /*delta=*/true);
+    for (size_t id = 0; id < 3; ++id) {
+      ASSERT_OK(writer.AddChangedKeys(storage, id, changed_keys.collection(id)));
+    }
+    ASSERT_OK(writer.Finish(/*wal_sequence=*/9));
+  }
+
+  const Checkpoint delta(_path);
+  EXPECT_TRUE(delta.is_delta());
+  EXPECT_EQ(delta.generation(), 3);
+  EXPECT_EQ(delta.wal_sequence(), 9);
+  EXPECT_EQ(delta.index_count(), 0);
+  ASSERT_EQ(delta.size(0), 3);
+  EXPECT_EQ(delta.size(1), 0);
+  // In key order, deletions included.
+  EXPECT_EQ(ToString(Read(delta, 0, 0).key), "gone");
+  EXPECT_TRUE(Read(delta, 0, 0).deleted);
+  EXPECT_TRUE(Read(delta, 0, 0).value.empty());
+  EXPECT_EQ(ToString(Read(delta, 0, 1).key), "key50");
+  EXPECT_FALSE(Read(delta, 0, 1).deleted);
+  EXPECT_EQ(ToString(Read(delta, 0, 1).value), "value50");
+  EXPECT_EQ(ToString(Read(delta, 0, 2).key), "key7");
+  ASSERT_EQ(delta.size(2), 1);
+  EXPECT_TRUE(Read(delta, 2, 0).deleted);
+  EXPECT_OK(delta.Verify());
+
+  BytesConstView value;
+  ASSERT_OK(delta.Find(0, ToBytes("key7"), value));
+  EXPECT_EQ(ToString(value), "value7");
+  EXPECT_STATUS_EQ(absl::StatusCode::kNotFound, delta.Find(0, ToBytes("gone"), value));
+  EXPECT_STATUS_EQ(absl::StatusCode::kNotFound, delta.Find(0, ToBytes("key8"), value));
+
+  // A base records its generation too.
+  Write(storage, {});
+  const Checkpoint base(_path);
+  EXPECT_FALSE(base.is_delta());
+  EXPECT_EQ(base.generation(), 0);
+}
+
+TEST_F(CheckpointTest, FinishReplacesTheFileAtomically) {
+  ArenaStorage storage;
+  storage.Put(0, ToBytes("key"), ToBytes("old"));
+  Write(storage, {});
+  storage.Put(0, ToBytes("key"), ToBytes("new"));
+  {
+    // Not finished: the old file stays.
+    CheckpointWriter writer(_path);
+    ASSERT_OK(writer.AddCollection(*storage.NewCursor(0)));
+  }
+  EXPECT_FALSE(std::filesystem::exists(_path + ".tmp"));
+  BytesConstView value;
+  {
+    const Checkpoint checkpoint(_path);
+    ASSERT_OK(checkpoint.Find(0, ToBytes("key"), value));
+    EXPECT_EQ(ToString(value), "old");
+  }
+  Write(storage, {});
+  const Checkpoint checkpoint(_path);
+  ASSERT_OK(checkpoint.Find(0, ToBytes("key"), value));
+  EXPECT_EQ(ToString(value), "new");
+}
+
+TEST_F(CheckpointTest, InvalidFilesThrow) {
+  EXPECT_THROW(Checkpoint("/nonexistent/checkpoint"), std::runtime_error);
+
+  ArenaStorage storage;
+  storage.Put(0, ToBytes("key"), ToBytes("value"));
+  Write(storage, {});
+  const auto size = std::filesystem::file_size(_path);
+
+  // A flipped bit in the header.
+  {
+    std::fstream file(_path, std::ios::in | std::ios::out | std::ios::binary);
+    file.seekp(20);
+    file.put('\x01');
+  }
+  EXPECT_THROW(Checkpoint{_path}, std::runtime_error);
+
+  // A truncated file.
+  Write(storage, {});
+  std::filesystem::resize_file(_path, size - 8);
+  EXPECT_THROW(Checkpoint{_path}, std::runtime_error);
+
+  // A flipped bit in the directory, at the end of the file.
+  Write(storage, {});
+  {
+    std::fstream file(_path, std::ios::in | std::ios::out | std::ios::binary);
+    file.seekp(static_cast<std::streamoff>(size - 1));
+    file.put('\x7f');
+  }
+  EXPECT_THROW(Checkpoint{_path}, std::runtime_error);
+}
+
+TEST_F(CheckpointTest, FullTableIsCorruption) {
+  ArenaStorage storage;
+  storage.Put(0, ToBytes("key"), ToBytes("value"));
+  Write(storage, {});
+
+  // Fills the free slot of the collection's table with a copy of the key's entry.
+  {
+    FilePatcher file(_path);
+    const std::streamoff directory = file.directory();
+    const auto table_offset = static_cast<std::streamoff>(file.Get(directory + 24));
+    ASSERT_EQ(file.Get(directory + 32), 2);
+    const uint64_t entry = file.Get(table_offset) | file.Get(table_offset + 8);
+    file.Set(table_offset, entry);
+    file.Set(table_offset + 8, entry);
+  }
+
+  const Checkpoint checkpoint(_path);
+  BytesConstView value;
+  ASSERT_OK(checkpoint.Find(0, ToBytes("key"), value));
+  EXPECT_EQ(ToString(value), "value");
+  EXPECT_STATUS_EQ(absl::StatusCode::kDataLoss, checkpoint.Find(0, ToBytes("other"), value));
+  EXPECT_STATUS_EQ(absl::StatusCode::kDataLoss, checkpoint.Verify());
+}
+
+TEST_F(CheckpointTest, RecordsOutsideOfTheirCollectionAreCorruption) {
+  ArenaStorage storage;
+  storage.Put(0, ToBytes("key"), ToBytes("value"));
+  storage.Put(1, ToBytes("other"), ToBytes("value"));
+  Write(storage, {});
+
+  auto expect_data_loss = [&] {
+    const Checkpoint checkpoint(_path);
+    Checkpoint::Record record;
+    EXPECT_STATUS_EQ(absl::StatusCode::kDataLoss, checkpoint.Read(0, 0, record));
+    size_t position = 0;
+    EXPECT_STATUS_EQ(absl::StatusCode::kDataLoss,
+                     checkpoint.LowerBound(0, ToBytes("key"), position));
+    EXPECT_STATUS_EQ(absl::StatusCode::kDataLoss, checkpoint.Verify(0));
+    // Collection 1 is intact.
+    EXPECT_OK(checkpoint.Verify(1));
+    EXPECT_OK(checkpoint.Read(1, 0, record));
+  };
+
+  // A key size running past the records, into the order.
+  {
+    FilePatcher file(_path);
+    const auto records_offset = static_cast<std::streamoff>(file.Get(file.directory() + 8));
+    file.Set(records_offset, uint64_t{5} << 32 | 0x7fffffff);
+  }
+  expect_data_loss();
+
+  // An offset in the order pointing at the next collection's record.
+  Write(storage, {});
+  {
+    FilePatcher file(_path);
+    const std::streamoff directory = file.directory();
+    const auto order_offset = static_cast<std::streamoff>(file.Get(directory + 16));
+    file.Set(order_offset, file.Get(directory + 48 + 8));
+  }
+  expect_data_loss();
+
+  // An offset past the end of the file.
+  Write(storage, {});
+  {
+    FilePatcher file(_path);
+    const auto order_offset = static_cast<std::streamoff>(file.Get(file.directory() + 16));
+    file.Set(order_offset, uint64_t{1} << 40);
+  }
+  expect_data_loss();
+}
+
+TEST_F(CheckpointTest, VerifyChecksCollectionsAndLoadIndexChecksIndices) {
+  ArenaStorage storage;
+  storage.Put(0, ToBytes("key"), ToBytes("value"));
+  Index<int32_t, int64_t> index;
+  index.Insert(1, 10);
+  Write(storage, index);
+
+  // A changed value still reads, but fails the collection's checksum.
+  {
+    FilePatcher file(_path);
+    const auto records_offset = static_cast<std::streamoff>(file.Get(file.directory() + 8));
+    file.Set(records_offset + 8, file.Get(records_offset + 8) ^ 1);
+  }
+  {
+    const Checkpoint checkpoint(_path);
+    BytesConstView value;
+    ASSERT_OK(checkpoint.Find(0, ToBytes("key"), value));
+    EXPECT_EQ(ToString(value), "walue");
+    EXPECT_STATUS_EQ(absl::StatusCode::kDataLoss, checkpoint.Verify(0));
+    EXPECT_STATUS_EQ(absl::StatusCode::kDataLoss, checkpoint.Verify());
+    EXPECT_STATUS_EQ(absl::StatusCode::kNotFound, checkpoint.Verify(1));
+    Index<int32_t, int64_t> loaded;
+    EXPECT_OK(checkpoint.LoadIndex(0, loaded));
+  }
+
+  // A changed index record. The index's directory entry, after the collection's 48 bytes, holds
+  // its records offset at byte 16.
+  Write(storage, index);
+  {
+    FilePatcher file(_path);
+    const auto records_offset = static_cast<std::streamoff>(file.Get(file.directory() + 48 + 16));
+    file.Set(records_offset, file.Get(records_offset) ^ 1);
+  }
+  const Checkpoint checkpoint(_path);
+  Index<int32_t, int64_t> loaded;
+  EXPECT_STATUS_EQ(absl::StatusCode::kDataLoss, checkpoint.LoadIndex(0, loaded));
+  EXPECT_STATUS_EQ(absl::StatusCode::kDataLoss, checkpoint.Verify());
+  EXPECT_OK(checkpoint.Verify(0));
+}
+
+}  // namespace
+}  // namespace gendb
@@ -0,0 +1,118 @@
+#include "gendb/epoch.h"
+
+#include <algorithm>
+
+namespace gendb {
+
+namespace {
+
+std::atomic<uint64_t> next_manager_id = 0;
+
+}  // namespace
+
+// Slots of the current thread, one per manager it has entered. Releases them on thread exit.
+struct EpochManager::ThreadSlots {
+  ~ThreadSlots() {
+    for (auto& [manager_id, slot] : entries) {
+      slot->owned.store(false, std::memory_order_release);
+    }
+  }
+
+  std::vector<std::pair<uint64_t, std::shared_ptr<Slot>>> entries;
+};
+
+EpochManager::EpochManager() : _id(next_manager_id.fetch_add(1, std::memory_order_relaxed)) {}
+
+EpochManager::~EpochManager() {
+  for (const std::shared_ptr<Slot>& slot : _slots) {
+    slot->manager_alive.store(false, std::memory_order_release);
+  }
+  for (const Retired& retired : _retired) {
+    retired.deleter(retired.ptr);
+  }
+}
+
+EpochManager::ReadSection EpochManager::Enter() {
+  Slot* slot = LocalSlot();
+  if (slot->depth++ == 0) {
+    slot->epoch.store(_epoch.load(std::memory_order_acquire), std::memory_order_relaxed);
+    // Orders the store before the section's reads; pairs with the fence in Reclaim().
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+  }
+  return ReadSection(slot);
+}
+
+void EpochManager::Reclaim() {
+  std::vector<Retired> candidates;
+  {
+    std::lock_guard lock(_retired_mutex);
+    candidates.swap(_retired);
+  }
+
+  // The candidates are already unlinked, so sections entering at the new epoch cannot reach them.
+  const uint64_t next = _epoch.fetch_add(1, std::memory_order_seq_cst) + 1;
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  uint64_t oldest = next;
+  {
+    std::lock_guard lock(_slots_mutex);
+    for (const std::shared_ptr<Slot>& slot : _slots) {
+      oldest = std::min(oldest, slot->epoch.load(std::memory_order_acquire));
+    }
+  }
+
+  std::vector<Retired> kept;
+  for (const Retired& retired : candidates) {
+    if (retired.epoch < oldest) {
+      retired.deleter(retired.ptr);
+    } else {
+      kept.push_back(retired);
+    }
+  }
+  std::lock_guard lock(_retired_mutex);
+  _retired.insert(_retired.end(), kept.begin(), kept.end());
+  _reclaim_at = _retired.size() + kReclaimBatchSize;
+}
+
+size_t EpochManager::RetiredCount() const {
+  std::lock_guard lock(_retired_mutex);
+  return _retired.size();
+}
+
+EpochManager::Slot* EpochManager::LocalSlot() {
+  thread_local ThreadSlots local;
+  for (const auto& [manager_id, slot] : local.entries) {
+    if (manager_id == _id) {
+      return slot.get();
+    }
+  }
+  // First section of this thread in this manager; forget the slots of destroyed managers.
+  std::erase_if(local.entries, [](const auto& entry) {
+    return !entry.second->manager_alive.load(std::memory_order_acquire);
+  });
+  return local.entries.emplace_back(_id, RegisterThread()).second.get();
+}
+
+std::shared_ptr<EpochManager::Slot> EpochManager::RegisterThread() {
+  std::lock_guard lock(_slots_mutex);
+  for (const std::shared_ptr<Slot>& slot : _slots) {
+    bool owned = false;
+    if (slot->owned.compare_exchange_strong(owned, true, std::memory_order_acquire)) {
+      return slot;
+    }
+  }
+  return _slots.emplace_back(std::make_shared<Slot>());
+}
+
+void EpochManager::RetireErased(void* ptr, void (*deleter)(void*)) {
+  bool reclaim;
+  {
+    std::lock_guard lock(_retired_mutex);
+    _retired.push_back({_epoch.load(std::memory_order_relaxed), ptr, deleter});
+    reclaim = _retired.size() >= _reclaim_at;
+  }
+  if (reclaim) {
+    Reclaim();
+  }
+}
+
+}  // namespace gendb
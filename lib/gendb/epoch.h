@@ -0,0 +1,119 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace gendb {
+
+// Epoch-based reclamation. Readers wrap their accesses to shared data in a ReadSection; writers
+// unlink data and Retire() it instead of freeing it. Retired data is freed once every section
+// that was open when it was retired has closed.
+//
+// Each thread gets its own slot per manager, on its own cache line. Entering and leaving a
+// section only writes that slot; it reads the global epoch but never writes shared state. Retired
+// objects are freed in batches: every kReclaimBatchSize retirements the global epoch is advanced
+// and the slots are scanned for the oldest open section.
+class EpochManager {
+ public:
+  static constexpr size_t kReclaimBatchSize = 64;
+
+ private:
+  struct Slot;
+
+ public:
+  // Open read section. Sections nest; the outermost one pins the epoch. A section must be closed
+  // on the thread that opened it.
+  class ReadSection {
+   public:
+    ReadSection(ReadSection&& other) noexcept : _slot(std::exchange(other._slot, nullptr)) {}
+    ReadSection& operator=(ReadSection&& other) noexcept {
+      if (this != &other) {
+        Leave();
+        _slot = std::exchange(other._slot, nullptr);
+      }
+      return *this;
+    }
+    ~ReadSection() { Leave(); }
+
+   private:
+    friend class EpochManager;
+    explicit ReadSection(Slot* slot) : _slot(slot) {}
+    void Leave();
+
+    Slot* _slot;
+  };
+
+  EpochManager();
+  // Frees everything still retired. No section may be open.
+  ~EpochManager();
+
+  EpochManager(const EpochManager&) = delete;
+  EpochManager& operator=(const EpochManager&) = delete;
+
+  ReadSection Enter();
+
+  // Takes ownership of `object` and destroys it once no open section can still reach it.
+  template <typename T>
+  void Retire(T object) {
+    RetireErased(new T(std::move(object)), [](void* ptr) { delete static_cast<T*>(ptr); });
+  }
+
+  // Frees the retired objects that no open section can reach. Retire() calls it in batches.
+  void Reclaim();
+
+  // Number of retired objects not freed yet.
+  size_t RetiredCount() const;
+
+  uint64_t CurrentEpoch() const { return _epoch.load(std::memory_order_relaxed); }
+
+ private:
+  static constexpr uint64_t kIdle = UINT64_MAX;
+
+  struct alignas(64) Slot {
+    // Epoch the outermost open section entered at, or kIdle.
+    std::atomic<uint64_t> epoch = kIdle;
+    // Section nesting depth; only touched by the owning thread.
+    uint32_t depth = 0;
+    // Cleared when the owning thread exits, so another thread can take the slot.
+    std::atomic<bool> owned = true;
+    // Cleared when the manager is destroyed, so threads drop their cached pointer.
+    std::atomic<bool> manager_alive = true;
+  };
+
+  struct Retired {
+    uint64_t epoch;
+    void* ptr;
+    void (*deleter)(void*);
+  };
+
+  struct ThreadSlots;
+
+  Slot* LocalSlot();
+  std::shared_ptr<Slot> RegisterThread();
+  void RetireErased(void* ptr, void (*deleter)(void*));
+
+  // Distinguishes managers in the threads' slot caches, as addresses may be reused.
+  const uint64_t _id;
+  std::atomic<uint64_t> _epoch = 0;
+
+  mutable std::mutex _slots_mutex;
+  std::vector<std::shared_ptr<Slot>> _slots;
+
+  mutable std::mutex _retired_mutex;
+  std::vector<Retired> _retired;
+  // Retired count at which Retire() next reclaims.
+  size_t _reclaim_at = kReclaimBatchSize;
+};
+
+inline void EpochManager::ReadSection::Leave() {
+  if (_slot != nullptr && --_slot->depth == 0) {
+    _slot->epoch.store(kIdle, std::memory_order_release);
+  }
+  _slot = nullptr;
+}
+
+}  // namespace gendb
@@ -0,0 +1,135 @@
+#include "gendb/epoch.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <memory>
+#include <optional>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace gendb {
+namespace {
+
+// Counts its live instances.
+struct Tracked {
+  explicit Tracked(std::atomic<int>& live) : live(&live) { ++live; }
+  Tracked(Tracked&& other) noexcept : live(std::exchange(other.live, nullptr)) {}
+  ~Tracked() {
+    if (live != nullptr) {
+      --*live;
+    }
+  }
+  std::atomic<int>* live;
+};
+
+TEST(EpochManagerTest, ReclaimsWithoutOpenSections) {
+  std::atomic<int> live = 0;
+  EpochManager epochs;
+  epochs.Retire(Tracked(live));
+  EXPECT_EQ(live, 1);
+  epochs.Reclaim();
+  EXPECT_EQ(live, 0);
+  EXPECT_EQ(epochs.RetiredCount(), 0);
+}
+
+TEST(EpochManagerTest, OpenSectionDefersReclamation) {
+  std::atomic<int> live = 0;
+  EpochManager epochs;
+  std::optional<EpochManager::ReadSection> section = epochs.Enter();
+  epochs.Retire(Tracked(live));
+  epochs.Reclaim();
+  EXPECT_EQ(live, 1);
+
+  // Sections opened after the retirement do not hold it back.
+  section.reset();
+  std::thread([&] {
+    EpochManager::ReadSection later = epochs.Enter();
+    epochs.Reclaim();
+    EXPECT_EQ(live, 0);
+  }).join();
+}
+
+TEST(EpochManagerTest, NestedSectionsLeaveAtTheOutermost) {
+  std::atomic<int> live = 0;
+  EpochManager epochs;
+  {
+    EpochManager::ReadSection outer = epochs.Enter();
+    {
+      EpochManager::ReadSection inner = epochs.Enter();
+      epochs.Retire(Tracked(live));
+    }
+    epochs.Reclaim();
+    EXPECT_EQ(live, 1);
+  }
+  epochs.Reclaim();
+  EXPECT_EQ(live, 0);
+}
+
+TEST(EpochManagerTest, RetireReclaimsInBatches) {
+  std::atomic<int> live = 0;
+  EpochManager epochs;
+  for (size_t i = 0; i + 1 < EpochManager::kReclaimBatchSize; ++i) {
+    epochs.Retire(Tracked(live));
+  }
+  EXPECT_EQ(live, EpochManager::kReclaimBatchSize - 1);
+  epochs.Retire(Tracked(live));
+  EXPECT_EQ(live, 0);
+}
+
+TEST(EpochManagerTest, DestructorFreesPendingObjects) {
+  std::atomic<int> live = 0;
+  {
+    EpochManager epochs;
+    epochs.Retire(Tracked(live));
+    epochs.Retire(std::make_unique<int>(1));
+  }
+  EXPECT_EQ(live, 0);
+}
+
+TEST(EpochManagerTest, ReadersNeverSeeFreedNodes) {
+  // Readers dereference the published node; the writer swaps in new ones and retires the old.
+  struct Node {
+    explicit Node(uint64_t value) : value(value), check(~value) {}
+    ~Node() { check = value; }
+    uint64_t value;
+    uint64_t check;
+  };
+  EpochManager epochs;
+  std::atomic<Node*> current = new Node(0);
+  std::atomic<bool> done = false;
+  std::vector<std::thread> readers;
+  for (int r = 0; r < 4; ++r) {
+    readers.emplace_back([&] {
+      while (!done) {
+        EpochManager::ReadSection section = epochs.Enter();
+        const Node* node = current.load(std::memory_order_acquire);
+        EXPECT_EQ(node->check, ~node->value);
+      }
+    });
+  }
+  for (uint64_t i = 1; i <= 20000; ++i) {
+    Node* old = current.exchange(new Node(i), std::memory_order_acq_rel);
+    epochs.Retire(std::unique_ptr<Node>(old));
+  }
+  done = true;
+  for (std::thread& reader : readers) {
+    reader.join();
+  }
+  delete current.load();
+}
+
+TEST(EpochManagerTest, ExitedThreadsReleaseTheirSlots) {
+  std::atomic<int> live = 0;
+  EpochManager epochs;
+  for (int i = 0; i < 8; ++i) {
+    std::thread([&] { EpochManager::ReadSection section = epochs.Enter(); }).join();
+  }
+  epochs.Retire(Tracked(live));
+  epochs.Reclaim();
+  EXPECT_EQ(live, 0);
+}
+
+}  // namespace
+}  // namespace gendb
@@ -0,0 +1,74 @@
+#include "gendb/file.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <stdexcept>
+
+#include "absl/strings/str_cat.h"
+
+namespace gendb {
+
+absl::Status ErrnoStatus(const std::string& what) { return absl::ErrnoToStatus(errno, what); }
+
+absl::Status SyncDirectory(const std::string& dir) {
+  const int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd < 0) {
+    return ErrnoStatus(absl::StrCat("Failed to open ", dir));
+  }
+  absl::Status status = absl::OkStatus();
+  if (::fsync(fd) != 0) {
+    status = ErrnoStatus(absl::StrCat("Failed to sync ", dir));
+  }
+  ::close(fd);
+  return status;
+}
+
+absl::Status WriteAt(int fd, BytesConstView data, size_t offset) {
+  for (size_t written = 0; written < data.size();) {
+    const ssize_t n = ::pwrite(fd, data.data() + written, data.size() - written,
+                               static_cast<off_t>(offset + written));
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return ErrnoStatus("Failed to write");
+    }
+    written += static_cast<size_t>(n);
+  }
+  return absl::OkStatus();
+}
+
+MappedFile::MappedFile(const std::string& path, int advice) {
+  const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  struct stat st {};
+  if (fd < 0 || ::fstat(fd, &st) != 0) {
+    if (fd >= 0) {
+      ::close(fd);
+    }
+    throw std::runtime_error("Failed to open " + path);
+  }
+  _size = static_cast<size_t>(st.st_size);
+  if (_size > 0) {
+    // Shared rather than private: pages already in the page cache are reused, not copied.
+    _data = ::mmap(nullptr, _size, PROT_READ, MAP_SHARED, fd, 0);
+  }
+  ::close(fd);
+  if (_data == MAP_FAILED) {
+    throw std::runtime_error("Failed to map " + path);
+  }
+  if (_data != nullptr) {
+    ::madvise(_data, _size, advice);
+  }
+}
+
+MappedFile::~MappedFile() {
+  if (_data != nullptr) {
+    ::munmap(_data, _size);
+  }
+}
+
+}  // namespace gendb
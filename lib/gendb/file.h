@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+#include "absl/status/status.h"
+#include "gendb/bytes.h"
+
+namespace gendb {
+
+// Status of the current errno, with `what` as its message.
+absl::Status ErrnoStatus(const std::string& what);
+
+// Makes the entries of `dir`, such as the files just created or renamed in it, durable.
+absl::Status SyncDirectory(const std::string& dir);
+
+// Writes all of `data` to `fd` at `offset`, retrying short and interrupted writes.
+absl::Status WriteAt(int fd, BytesConstView data, size_t offset);
+
+// Read-only shared mapping of a whole file. Pages are read in as they are first touched.
+class MappedFile {
+ public:
+  // `advice` is passed to madvise for the whole mapping. Throws std::runtime_error if the file
+  // cannot be opened or mapped. An empty file maps to empty contents.
+  MappedFile(const std::string& path, int advice);
+  ~MappedFile();
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  BytesConstView contents() const { return {static_cast<const uint8_t*>(_data), _size}; }
+
+ private:
+  void* _data = nullptr;
+  size_t _size = 0;
+};
+
+}  // namespace gendb
@@ -0,0 +1,461 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <span>
+#include <utility>
+
+#include "gendb/bytes.h"
+#include "gendb/small_key.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define GENDB_FLAT_HASH_SSE2 1
+#endif
+
+namespace gendb {
+
+namespace internal::flat_hash {
+
+// Control byte states. Full slots store the 7 low bits of the key hash (H2), so every full slot
+// has the high bit cleared, while all special states have it set.
+using ctrl_t = int8_t;
+inline constexpr ctrl_t kEmpty = -128;  // 0b10000000
+inline constexpr ctrl_t kDeleted = -2;  // 0b11111110
+inline constexpr ctrl_t kSentinel = -1;  // 0b11111111
+
+inline bool IsFull(ctrl_t c) { return c >= 0; }
+
+inline size_t H1(size_t hash) { return hash >> 7; }
+inline ctrl_t H2(size_t hash) { return static_cast<ctrl_t>(hash & 0x7F); }
+
+// Bitmask over the slots of a group. Each set bit stands for a matching slot; `kShift` converts a
+// bit position into a slot offset (0 for SSE2 masks, 3 for the byte-per-slot portable masks).
+template <typename T, int kShift>
+class BitMask {
+ public:
+  explicit BitMask(T mask) : _mask(mask) {}
+
+  explicit operator bool() const { return _mask != 0; }
+  uint32_t LowestBitSet() const { return static_cast<uint32_t>(std::countr_zero(_mask)) >> kShift; }
+
+  // Iterates the set bits: `for (uint32_t i : mask)`.
+  BitMask& operator++() {
+    _mask &= (_mask - 1);
+    return *this;
+  }
+  uint32_t operator*() const { return LowestBitSet(); }
+  BitMask begin() const { return *this; }
+  BitMask end() const { return BitMask(0); }
+  bool operator!=(const BitMask& other) const { return _mask != other._mask; }
+
+ private:
+  T _mask;
+};
+
+#ifdef GENDB_FLAT_HASH_SSE2
+// 16 control bytes probed at once with SSE2 compares.
+struct Group {
+  static constexpr size_t kWidth = 16;
+
+  explicit Group(const ctrl_t* pos)
+      : _ctrl(_mm_loadu_si128(reinterpret_cast<const __m128i*>(pos))) {}
+
+  BitMask<uint32_t, 0> Match(ctrl_t h2) const {
+    auto match = _mm_set1_epi8(h2);
+    return BitMask<uint32_t, 0>(
+        static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(match, _ctrl))));
+  }
+
+  BitMask<uint32_t, 0> MatchEmpty() const { return Match(kEmpty); }
+
+  // kEmpty and kDeleted are the only control values below kSentinel.
+  BitMask<uint32_t, 0> MatchEmptyOrDeleted() const {
+    auto special = _mm_set1_epi8(kSentinel);
+    return BitMask<uint32_t, 0>(
+        static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpgt_epi8(special, _ctrl))));
+  }
+
+  __m128i _ctrl;
+};
+#else
+// Portable fallback: 8 control bytes packed into a word, SWAR matching. `Match` may report false
+// positives, which are harmless because every candidate is confirmed by a key comparison.
+struct Group {
+  static constexpr size_t kWidth = 8;
+  static constexpr uint64_t kLsbs = 0x0101010101010101ULL;
+  static constexpr uint64_t kMsbs = 0x8080808080808080ULL;
+
+  explicit Group(const ctrl_t* pos) { std::memcpy(&_ctrl, pos, sizeof(_ctrl)); }
+
+  BitMask<uint64_t, 3> Match(ctrl_t h2) const {
+    uint64_t x = _ctrl ^ (kLsbs * static_cast<uint8_t>(h2));
+    return BitMask<uint64_t, 3>((x - kLsbs) & ~x & kMsbs);
+  }
+
+  BitMask<uint64_t, 3> MatchEmpty() const {
+    return BitMask<uint64_t, 3>((_ctrl & ~(_ctrl << 6)) & kMsbs);
+  }
+
+  BitMask<uint64_t, 3> MatchEmptyOrDeleted() const {
+    return BitMask<uint64_t, 3>((_ctrl & ~(_ctrl << 7)) & kMsbs);
+  }
+
+  uint64_t _ctrl;
+};
+#endif
+
+}  // namespace internal::flat_hash
+
+// Open-addressing hash map from byte-string keys to `ValueT` in the Swiss-table layout: a flat
+// array of slots plus a parallel array of one-byte control words holding 7 bits of each key's
+// hash. Lookups scan a whole group of control bytes per probe step (SSE2 when available), so a
+// miss or hit usually costs one control-byte load and one slot access, with no node allocations.
+//
+// Lookups are heterogeneous (`BytesConstView`), so no temporary key is built. Pointers and
+// iterators are invalidated by inserts that grow the table; erase only invalidates the erased
+// element.
+template <typename ValueT>
+class FlatHashMap {
+  using Group = internal::flat_hash::Group;
+  using ctrl_t = internal::flat_hash::ctrl_t;
+
+ public:
+  using Key = SmallKey;
+
+  struct Slot {
+    Key key;
+    ValueT value;
+  };
+
+  template <bool kConst>
+  class IteratorBase {
+   public:
+    using SlotT = std::conditional_t<kConst, const Slot, Slot>;
+
+    IteratorBase() = default;
+    // Allow iterator -> const_iterator.
+    operator IteratorBase<true>() const
+      requires(!kConst)
+    {
+      return IteratorBase<true>(_ctrl, _slot);
+    }
+
+    SlotT& operator*() const { return *_slot; }
+    SlotT* operator->() const { return _slot; }
+    IteratorBase& operator++() {
+      ++_ctrl;
+      ++_slot;
+      SkipEmpty();
+      return *this;
+    }
+    bool operator==(const IteratorBase& other) const { return _slot == other._slot; }
+    bool operator!=(const IteratorBase& other) const { return _slot != other._slot; }
+
+   private:
+    friend class FlatHashMap;
+    template <bool>
+    friend class IteratorBase;
+    IteratorBase(const ctrl_t* ctrl, SlotT* slot) : _ctrl(ctrl), _slot(slot) {}
+
+    // The control array ends with kSentinel, which stops the scan at end().
+    void SkipEmpty() {
+      while (!internal::flat_hash::IsFull(*_ctrl) && *_ctrl != internal::flat_hash::kSentinel) {
+        ++_ctrl;
+        ++_slot;
+      }
+    }
+
+    const ctrl_t* _ctrl = nullptr;
+    SlotT* _slot = nullptr;
+  };
+  using iterator = IteratorBase<false>;
+  using const_iterator = IteratorBase<true>;
+
+  FlatHashMap() = default;
+  FlatHashMap(const FlatHashMap& other) : FlatHashMap() {
+    reserve(other.size());
+    for (const auto& slot : other) {
+      InsertUnique(Hash(slot.key), slot.key, slot.value);
+    }
+  }
+  FlatHashMap(FlatHashMap&& other) noexcept { Swap(other); }
+  FlatHashMap& operator=(FlatHashMap other) noexcept {
+    Swap(other);
+    return *this;
+  }
+  ~FlatHashMap() { Destroy(); }
+
+  iterator begin() {
+    iterator it(_ctrl, _slots);
+    if (_capacity != 0) {
+      it.SkipEmpty();
+    }
+    return it;
+  }
+  iterator end() { return iterator(_ctrl + _capacity, _slots + _capacity); }
+  const_iterator begin() const { return const_cast<FlatHashMap*>(this)->begin(); }
+  const_iterator end() const { return const_cast<FlatHashMap*>(this)->end(); }
+
+  size_t size() const { return _size; }
+  bool empty() const { return _size == 0; }
+  size_t capacity() const { return _capacity; }
+
+  iterator find(BytesConstView key) {
+    size_t index = FindIndex(key, Hash(key));
+    return index == kNotFound ? end() : IteratorAt(index);
+  }
+  const_iterator find(BytesConstView key) const {
+    size_t index = FindIndex(key, Hash(key));
+    return index == kNotFound ? end() : const_iterator(_ctrl + index, _slots + index);
+  }
+  bool contains(BytesConstView key) const { return FindIndex(key, Hash(key)) != kNotFound; }
+
+  // Batched lookup that calls `fn(i, it)` with the result of find(keys[i]). Keys are hashed and
+  // their first probe group prefetched a window ahead of the probes, so the cache misses of
+  // independent lookups overlap instead of being paid one after another.
+  template <typename Fn>
+  void FindBatch(std::span<const BytesConstView> keys, Fn&& fn) const {
+    constexpr size_t kWindow = 16;
+    size_t hashes[kWindow];
+    for (size_t begin = 0; begin < keys.size(); begin += kWindow) {
+      const size_t n = std::min(kWindow, keys.size() - begin);
+      for (size_t i = 0; i < n; ++i) {
+        hashes[i] = Hash(keys[begin + i]);
+        Prefetch(hashes[i]);
+      }
+      for (size_t i = 0; i < n; ++i) {
+        const size_t index = FindIndex(keys[begin + i], hashes[i]);
+        fn(begin + i, index == kNotFound ? end() : const_iterator(_ctrl + index, _slots + index));
+      }
+    }
+  }
+
+  // Returns the value for `key`, default-constructing it if absent.
+  ValueT& operator[](BytesConstView key) { return try_emplace(key).first->value; }
+
+  template <typename... Args>
+  std::pair<iterator, bool> try_emplace(BytesConstView key, Args&&... args) {
+    const size_t hash = Hash(key);
+    size_t index = FindIndex(key, hash);
+    if (index != kNotFound) {
+      return {IteratorAt(index), false};
+    }
+    index = InsertUnique(hash, key, std::forward<Args>(args)...);
+    return {IteratorAt(index), true};
+  }
+
+  template <typename V>
+  std::pair<iterator, bool> insert_or_assign(BytesConstView key, V&& value) {
+    auto [it, inserted] = try_emplace(key, std::forward<V>(value));
+    if (!inserted) {
+      it->value = std::forward<V>(value);
+    }
+    return {it, inserted};
+  }
+
+  void erase(const_iterator it) {
+    const size_t index = static_cast<size_t>(it._slot - _slots);
+    std::destroy_at(_slots + index);
+    SetCtrl(index, internal::flat_hash::kDeleted);
+    --_size;
+    ++_deleted;
+  }
+
+  size_t erase(BytesConstView key) {
+    size_t index = FindIndex(key, Hash(key));
+    if (index == kNotFound) {
+      return 0;
+    }
+    erase(const_iterator(_ctrl + index, _slots + index));
+    return 1;
+  }
+
+  void clear() {
+    Destroy();
+    _ctrl = nullptr;
+    _slots = nullptr;
+    _capacity = _size = _deleted = 0;
+  }
+
+  // Makes room for `count` elements without further rehashing.
+  void reserve(size_t count) {
+    if (count > MaxLoad(_capacity)) {
+      Resize(CapacityFor(count));
+    }
+  }
+
+  // Heap bytes held by the table itself (control bytes and slots), excluding out-of-line keys
+  // and whatever the values own.
+  size_t AllocatedBytes() const {
+    return _capacity == 0 ? 0 : _capacity * (sizeof(Slot) + 1) + 1 + kClonedBytes;
+  }
+
+ private:
+  static constexpr size_t kNotFound = ~size_t{0};
+
+  static size_t Hash(BytesConstView key) { return BytesHash{}(key); }
+
+  void Prefetch(size_t hash) const {
+#if defined(__GNUC__)
+    if (_capacity != 0) {
+      const size_t offset = internal::flat_hash::H1(hash) & _capacity;
+      __builtin_prefetch(_ctrl + offset);
+      __builtin_prefetch(_slots + offset);
+    }
+#endif
+  }
+
+  // Capacities are 2^k - 1, so `capacity` doubles as the probe mask. Max load factor is 7/8,
+  // which leaves at least one empty slot to terminate every probe.
+  static constexpr size_t kMinCapacity = 15;
+  static_assert(kMinCapacity >= Group::kWidth - 1);
+  static size_t MaxLoad(size_t capacity) { return capacity - capacity / 8; }
+  static size_t CapacityFor(size_t count) {
+    size_t capacity = kMinCapacity;
+    while (MaxLoad(capacity) < count) {
+      capacity = capacity * 2 + 1;
+    }
+    return capacity;
+  }
+
+  iterator IteratorAt(size_t index) { return iterator(_ctrl + index, _slots + index); }
+
+  // Triangular probing over groups: offsets H1, H1 + W, H1 + 3W, ... (mod capacity + 1) visit
+  // every group exactly once for power-of-two table sizes.
+  class ProbeSeq {
+   public:
+    ProbeSeq(size_t hash, size_t mask)
+        : _mask(mask), _offset(internal::flat_hash::H1(hash) & mask) {}
+    size_t offset() const { return _offset; }
+    size_t offset(uint32_t i) const { return (_offset + i) & _mask; }
+    void Next() {
+      _step += Group::kWidth;
+      _offset = (_offset + _step) & _mask;
+    }
+
+   private:
+    size_t _mask;
+    size_t _offset;
+    size_t _step = 0;
+  };
+
+  size_t FindIndex(BytesConstView key, size_t hash) const {
+    if (_size == 0) {
+      return kNotFound;
+    }
+    const ctrl_t h2 = internal::flat_hash::H2(hash);
+    for (ProbeSeq seq(hash, _capacity);; seq.Next()) {
+      Group group(_ctrl + seq.offset());
+      for (uint32_t i : group.Match(h2)) {
+        const size_t index = seq.offset(i);
+        if (_slots[index].key == key) {
+          return index;
+        }
+      }
+      // The load factor guarantees an empty slot somewhere, which terminates every probe.
+      if (group.MatchEmpty()) {
+        return kNotFound;
+      }
+    }
+  }
+
+  size_t FindFirstNonFull(size_t hash) const {
+    for (ProbeSeq seq(hash, _capacity);; seq.Next()) {
+      auto free_slots = Group(_ctrl + seq.offset()).MatchEmptyOrDeleted();
+      if (free_slots) {
+        return seq.offset(free_slots.LowestBitSet());
+      }
+    }
+  }
+
+  template <typename... Args>
+  size_t InsertUnique(size_t hash, BytesConstView key, Args&&... args) {
+    if (_size + _deleted + 1 > MaxLoad(_capacity)) {
+      // Rehash at the same capacity when tombstones make up most of the load, grow otherwise.
+      Resize(_capacity != 0 && (_size + 1) * 2 <= MaxLoad(_capacity) ? _capacity
+                                                                      : CapacityFor(_size + 1));
+    }
+    const size_t index = FindFirstNonFull(hash);
+    if (_ctrl[index] == internal::flat_hash::kDeleted) {
+      --_deleted;
+    }
+    std::construct_at(_slots + index, Slot{Key(key), ValueT(std::forward<Args>(args)...)});
+    SetCtrl(index, internal::flat_hash::H2(hash));
+    ++_size;
+    return index;
+  }
+
+  // Control layout: `capacity` bytes, a kSentinel that stops iteration, then copies of the first
+  // kWidth - 1 bytes. A group load starting near the end of the table reads the copies, so probing
+  // wraps around without bounds checks.
+  static constexpr size_t kClonedBytes = Group::kWidth - 1;
+
+  void SetCtrl(size_t index, ctrl_t value) {
+    _ctrl[index] = value;
+    if (index < kClonedBytes) {
+      _ctrl[_capacity + 1 + index] = value;
+    }
+  }
+
+  void Resize(size_t new_capacity) {
+    ctrl_t* old_ctrl = _ctrl;
+    Slot* old_slots = _slots;
+    const size_t old_capacity = _capacity;
+
+    _capacity = new_capacity;
+    _ctrl = new ctrl_t[_capacity + 1 + kClonedBytes];
+    std::memset(_ctrl, internal::flat_hash::kEmpty, _capacity + 1 + kClonedBytes);
+    _ctrl[_capacity] = internal::flat_hash::kSentinel;
+    _slots = std::allocator<Slot>{}.allocate(_capacity);
+    _deleted = 0;
+
+    for (size_t i = 0; i < old_capacity; ++i) {
+      if (internal::flat_hash::IsFull(old_ctrl[i])) {
+        Slot& slot = old_slots[i];
+        const size_t hash = Hash(slot.key);
+        const size_t index = FindFirstNonFull(hash);
+        std::construct_at(_slots + index, std::move(slot));
+        SetCtrl(index, internal::flat_hash::H2(hash));
+        std::destroy_at(&slot);
+      }
+    }
+    if (old_capacity != 0) {
+      delete[] old_ctrl;
+      std::allocator<Slot>{}.deallocate(old_slots, old_capacity);
+    }
+  }
+
+  void Destroy() {
+    if (_capacity == 0) {
+      return;
+    }
+    for (size_t i = 0; i < _capacity; ++i) {
+      if (internal::flat_hash::IsFull(_ctrl[i])) {
+        std::destroy_at(_slots + i);
+      }
+    }
+    delete[] _ctrl;
+    std::allocator<Slot>{}.deallocate(_slots, _capacity);
+  }
+
+  void Swap(FlatHashMap& other) noexcept {
+    std::swap(_ctrl, other._ctrl);
+    std::swap(_slots, other._slots);
+    std::swap(_capacity, other._capacity);
+    std::swap(_size, other._size);
+    std::swap(_deleted, other._deleted);
+  }
+
+  ctrl_t* _ctrl = nullptr;
+  Slot* _slots = nullptr;
+  size_t _capacity = 0;
+  size_t _size = 0;
+  size_t _deleted = 0;
+};
+
+}  // namespace gendb
@@ -0,0 +1,167 @@
+#include "gendb/flat_hash_map.h"
+
+#include <gtest/gtest.h>
+
+#include <map>
+#include <random>
+#include <string>
+
+namespace gendb {
+namespace {
+
+BytesConstView StringToBytesView(const std::string& str) {
+  return {reinterpret_cast<const uint8_t*>(str.data()), str.size()};
+}
+
+std::string BytesViewToString(BytesConstView bytes) {
+  return {reinterpret_cast<const char*>(bytes.data()), bytes.size()};
+}
+
+TEST(FlatHashMapTest, EmptyMap) {
+  FlatHashMap<int> map;
+  EXPECT_TRUE(map.empty());
+  EXPECT_EQ(map.size(), 0);
+  EXPECT_EQ(map.begin(), map.end());
+  EXPECT_EQ(map.find(StringToBytesView("missing")), map.end());
+  EXPECT_FALSE(map.contains(StringToBytesView("missing")));
+  EXPECT_EQ(map.erase(StringToBytesView("missing")), 0);
+}
+
+TEST(FlatHashMapTest, InsertFindAndOverwrite) {
+  FlatHashMap<int> map;
+  auto [it, inserted] = map.try_emplace(StringToBytesView("a"), 1);
+  EXPECT_TRUE(inserted);
+  EXPECT_EQ(it->value, 1);
+
+  auto [it2, inserted2] = map.try_emplace(StringToBytesView("a"), 2);
+  EXPECT_FALSE(inserted2);
+  EXPECT_EQ(it2->value, 1);
+
+  map.insert_or_assign(StringToBytesView("a"), 3);
+  EXPECT_EQ(map.find(StringToBytesView("a"))->value, 3);
+  map[StringToBytesView("b")] = 4;
+  EXPECT_EQ(map.size(), 2);
+  EXPECT_EQ(map.find(StringToBytesView("b"))->value, 4);
+}
+
+TEST(FlatHashMapTest, EmptyKeyIsValid) {
+  FlatHashMap<int> map;
+  map[BytesConstView{}] = 7;
+  ASSERT_NE(map.find(BytesConstView{}), map.end());
+  EXPECT_EQ(map.find(BytesConstView{})->value, 7);
+}
+
+TEST(FlatHashMapTest, InlineAndOutOfLineKeys) {
+  FlatHashMap<int> map;
+  const std::string short_key(FlatHashMap<int>::Key::kInlineSize, 's');
+  const std::string long_key(FlatHashMap<int>::Key::kInlineSize + 1, 'l');
+  map[StringToBytesView(short_key)] = 1;
+  map[StringToBytesView(long_key)] = 2;
+
+  auto it = map.find(StringToBytesView(long_key));
+  ASSERT_NE(it, map.end());
+  EXPECT_EQ(BytesViewToString(it->key), long_key);
+  EXPECT_EQ(it->value, 2);
+  EXPECT_EQ(BytesViewToString(map.find(StringToBytesView(short_key))->key), short_key);
+
+  // Keys differing only past the inline prefix must stay distinct.
+  std::string long_key2 = long_key;
+  long_key2.back() = 'x';
+  EXPECT_EQ(map.find(StringToBytesView(long_key2)), map.end());
+}
+
+TEST(FlatHashMapTest, EraseLeavesOtherKeysReachable) {
+  FlatHashMap<int> map;
+  for (int i = 0; i < 1000; ++i) {
+    map[StringToBytesView(std::to_string(i))] = i;
+  }
+  for (int i = 0; i < 1000; i += 2) {
+    EXPECT_EQ(map.erase(StringToBytesView(std::to_string(i))), 1);
+  }
+  EXPECT_EQ(map.size(), 500);
+  for (int i = 0; i < 1000; ++i) {
+    auto it = map.find(StringToBytesView(std::to_string(i)));
+    if (i % 2 == 0) {
+      EXPECT_EQ(it, map.end()) << i;
+    } else {
+      ASSERT_NE(it, map.end()) << i;
+      EXPECT_EQ(it->value, i);
+    }
+  }
+}
+
+TEST(FlatHashMapTest, IterationVisitsEveryElementOnce) {
+  FlatHashMap<int> map;
+  for (int i = 0; i < 300; ++i) {
+    map[StringToBytesView("key" + std::to_string(i))] = i;
+  }
+  std::map<std::string, int> seen;
+  for (const auto& [key, value] : map) {
+    EXPECT_TRUE(seen.emplace(BytesViewToString(key), value).second);
+  }
+  EXPECT_EQ(seen.size(), 300);
+  EXPECT_EQ(seen["key42"], 42);
+}
+
+TEST(FlatHashMapTest, ChurnDoesNotGrowUnbounded) {
+  // Insert/erase cycles leave tombstones that must be reclaimed instead of forcing growth.
+  FlatHashMap<int> map;
+  for (int i = 0; i < 100000; ++i) {
+    map[StringToBytesView(std::to_string(i))] = i;
+    map.erase(StringToBytesView(std::to_string(i - 10)));
+  }
+  EXPECT_LE(map.size(), 11);
+  EXPECT_LT(map.capacity(), 64);
+}
+
+TEST(FlatHashMapTest, CopyAndMove) {
+  FlatHashMap<Bytes> map;
+  map[StringToBytesView("k")] = Bytes{1, 2, 3};
+
+  FlatHashMap<Bytes> copy = map;
+  EXPECT_EQ(copy.find(StringToBytesView("k"))->value, (Bytes{1, 2, 3}));
+
+  FlatHashMap<Bytes> moved = std::move(map);
+  EXPECT_EQ(moved.size(), 1);
+  EXPECT_EQ(moved.find(StringToBytesView("k"))->value, (Bytes{1, 2, 3}));
+
+  moved.clear();
+  EXPECT_TRUE(moved.empty());
+  EXPECT_EQ(copy.size(), 1);
+}
+
+TEST(FlatHashMapTest, MatchesReferenceMapUnderRandomOps) {
+  FlatHashMap<int> map;
+  std::map<std::string, int> reference;
+  std::mt19937 rng(42);
+  std::uniform_int_distribution<int> key_dist(0, 2000);
+  std::uniform_int_distribution<int> op_dist(0, 2);
+  for (int i = 0; i < 50000; ++i) {
+    // Mix of inline (short) and out-of-line (long) keys.
+    const int k = key_dist(rng);
+    const std::string key =
+        k % 3 == 0 ? std::string(20, 'p') + std::to_string(k) : std::to_string(k);
+    switch (op_dist(rng)) {
+      case 0:
+        map.insert_or_assign(StringToBytesView(key), i);
+        reference[key] = i;
+        break;
+      case 1:
+        EXPECT_EQ(map.erase(StringToBytesView(key)), reference.erase(key));
+        break;
+      case 2: {
+        auto it = map.find(StringToBytesView(key));
+        auto ref_it = reference.find(key);
+        ASSERT_EQ(it == map.end(), ref_it == reference.end());
+        if (ref_it != reference.end()) {
+          EXPECT_EQ(it->value, ref_it->second);
+        }
+        break;
+      }
+    }
+  }
+  EXPECT_EQ(map.size(), reference.size());
+}
+
+}  // namespace
+}  // namespace gendb
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <mutex>
+#include <span>
+#include <vector>
+
+namespace gendb {
+
+// Leader/follower group commit. Threads that commit concurrently queue their items; the first one
+// to find no batch in progress becomes the leader, takes everything queued so far and applies it
+// with a single call while the others wait. Items queued meanwhile form the next batch, led by one
+// of their own submitters once the current leader is done.
+template <typename T>
+class GroupCommit {
+ public:
+  // Queues `item` and returns once a leader, possibly this thread, has applied it.
+  // `apply(std::span<T* const>)` receives a batch in submission order; calls never overlap. If it
+  // throws, every Submit of that batch rethrows the exception.
+  template <typename ApplyFn>
+  void Submit(T& item, ApplyFn&& apply) {
+    Waiter waiter{.item = &item};
+    std::unique_lock lock(_mutex);
+    _queue.push_back(&waiter);
+    _cv.wait(lock, [&] { return waiter.done || !_leading; });
+    if (!waiter.done) {
+      _leading = true;
+      std::vector<Waiter*> batch;
+      batch.swap(_queue);
+      lock.unlock();
+
+      _items.clear();
+      for (Waiter* queued : batch) {
+        _items.push_back(queued->item);
+      }
+      std::exception_ptr error;
+      try {
+        apply(std::span<T* const>(_items));
+      } catch (...) {
+        error = std::current_exception();
+      }
+
+      lock.lock();
+      for (Waiter* queued : batch) {
+        queued->done = true;
+        queued->error = error;
+      }
+      _leading = false;
+      ++_batch_count;
+      _cv.notify_all();
+    }
+    if (waiter.error) {
+      std::rethrow_exception(waiter.error);
+    }
+  }
+
+  // Runs `fn()` while no batch is applied: it waits for the batch in progress, and batches queued
+  // meanwhile wait for it.
+  template <typename Fn>
+  void RunExclusive(Fn&& fn) {
+    std::unique_lock lock(_mutex);
+    _cv.wait(lock, [&] { return !_leading; });
+    _leading = true;
+    lock.unlock();
+    std::exception_ptr error;
+    try {
+      fn();
+    } catch (...) {
+      error = std::current_exception();
+    }
+    lock.lock();
+    _leading = false;
+    _cv.notify_all();
+    if (error) {
+      std::rethrow_exception(error);
+    }
+  }
+
+  // Number of batches applied so far.
+  uint64_t BatchCount() const {
+    std::lock_guard lock(_mutex);
+    return _batch_count;
+  }
+
+ private:
+  struct Waiter {
+    T* item;
+    bool done = false;
+    std::exception_ptr error = nullptr;
+  };
+
+  mutable std::mutex _mutex;
+  std::condition_variable _cv;
+  std::vector<Waiter*> _queue;
+  bool _leading = false;
+  uint64_t _batch_count = 0;
+  // Items of the batch being applied; only touched by its leader.
+  std::vector<T*> _items;
+};
+
+}  // namespace gendb
@@ -0,0 +1,117 @@
+#include "gendb/group_commit.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+namespace gendb {
+namespace {
+
+struct Item {
+  int thread;
+  int index;
+};
+
+TEST(GroupCommitTest, SingleSubmitIsItsOwnBatch) {
+  GroupCommit<Item> commit;
+  Item item{0, 0};
+  std::vector<Item*> applied;
+  commit.Submit(item, [&](std::span<Item* const> batch) {
+    applied.assign(batch.begin(), batch.end());
+  });
+  EXPECT_EQ(applied, std::vector<Item*>{&item});
+  EXPECT_EQ(commit.BatchCount(), 1);
+}
+
+TEST(GroupCommitTest, ErrorIsRethrownBySubmitter) {
+  GroupCommit<Item> commit;
+  Item item{0, 0};
+  EXPECT_THROW(commit.Submit(item, [](std::span<Item* const>) { throw std::runtime_error("x"); }),
+               std::runtime_error);
+  // The next batch is unaffected.
+  int applied = 0;
+  commit.Submit(item, [&](std::span<Item* const> batch) { applied += batch.size(); });
+  EXPECT_EQ(applied, 1);
+}
+
+TEST(GroupCommitTest, ConcurrentSubmitsAreBatched) {
+  constexpr int kThreads = 8;
+  constexpr int kItemsPerThread = 200;
+  GroupCommit<Item> commit;
+  std::atomic<int> started = 0;
+  std::atomic<bool> applying = false;
+  std::vector<std::vector<int>> applied(kThreads);
+  bool first_batch = true;
+  auto apply = [&](std::span<Item* const> batch) {
+    EXPECT_FALSE(applying.exchange(true));
+    if (first_batch) {
+      // Hold the first batch until every other thread has queued behind it.
+      first_batch = false;
+      while (started < kThreads) {
+        std::this_thread::yield();
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+    for (Item* item : batch) {
+      applied[item->thread].push_back(item->index);
+    }
+    applying = false;
+  };
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreads; ++t) {
+    threads.emplace_back([&, t] {
+      for (int i = 0; i < kItemsPerThread; ++i) {
+        Item item{t, i};
+        if (i == 0) {
+          ++started;
+        }
+        commit.Submit(item, apply);
+      }
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+
+  for (int t = 0; t < kThreads; ++t) {
+    ASSERT_EQ(applied[t].size(), kItemsPerThread);
+    for (int i = 0; i < kItemsPerThread; ++i) {
+      EXPECT_EQ(applied[t][i], i);
+    }
+  }
+  EXPECT_LT(commit.BatchCount(), kThreads * kItemsPerThread);
+}
+
+TEST(GroupCommitTest, RunExclusiveHoldsBatchesBack) {
+  GroupCommit<Item> commit;
+  std::atomic<bool> exclusive = false;
+  std::atomic<bool> applied = false;
+  std::thread submitter;
+  commit.RunExclusive([&] {
+    exclusive = true;
+    submitter = std::thread([&] {
+      Item item{0, 0};
+      commit.Submit(item, [&](std::span<Item* const>) {
+        EXPECT_FALSE(exclusive);
+        applied = true;
+      });
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    EXPECT_FALSE(applied);
+    exclusive = false;
+  });
+  submitter.join();
+  EXPECT_TRUE(applied);
+  EXPECT_THROW(commit.RunExclusive([] { throw std::runtime_error("x"); }), std::runtime_error);
+  Item item{0, 0};
+  commit.Submit(item, [](std::span<Item* const>) {});
+  EXPECT_EQ(commit.BatchCount(), 2);
+}
+
+}  // namespace
+}  // namespace gendb
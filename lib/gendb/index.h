@@ -1,8 +1,14 @@
 #pragma once
 
+#include <cstdint>
+#include <deque>
 #include <map>
 #include <set>
 #include <type_traits>
+#include <vector>
+
+#include "gendb/epoch.h"
+#include "gendb/persistent_btree.h"
 
 namespace gendb {
 
@@ -10,7 +16,9 @@ template <typename SecKey, typename PrimKey>
 struct IndexRecord {
   SecKey sec_key;
   PrimKey prim_key;
-  bool is_deleted;
+  bool is_deleted = false;
+  // Sequence of the commit that removed a record kept for snapshots (see Index::MergeTempIndex).
+  uint64_t removed_at = 0;
 
   // Lexicographical comparison: SecKey, then PrimKey
   auto operator<=>(const IndexRecord& other) const {
@@ -28,10 +36,11 @@ struct IndexRecord {
 // TODO(design): Can I make it type-erased?
 //     This way I will be able to use different key types without templating the index
 //     implementation.
-template <typename SecKey, typename PrimKey>
+template <typename SecKey, typename PrimKey,
+          typename ContainerT = std::set<IndexRecord<SecKey, PrimKey>>>
 class Index {
  public:
-  using Container = std::set<IndexRecord<SecKey, PrimKey>>;
+  using Container = ContainerT;
 
   auto lower_bound(const SecKey& key) const {
     auto it = _index.lower_bound({key, PrimKey{}});
@@ -48,30 +57,80 @@ class Index {
     _index.insert({sec_key, prim_key, is_deleted});
   }
 
+  // Insert of a record that sorts after every record of the index: amortized constant time.
+  void InsertLast(const SecKey& sec_key, const PrimKey& prim_key) {
+    _index.insert(_index.end(), {sec_key, prim_key, /*is_deleted=*/false});
+  }
+
   void Erase(const SecKey& sec_key, const PrimKey& prim_key) { _index.erase({sec_key, prim_key}); }
 
-  void MergeTempIndex(Index&& temp_index) {
+  // Applies the records of a writer's index, committed with sequence number `sequence`. A record
+  // removed while a snapshot older than the commit is open (`oldest_snapshot` < `sequence`) stays
+  // in the index, marked deleted, until a later merge sees no such snapshot; readers skip it.
+  // Given `epochs`, erased records are retired through it rather than freed.
+  void MergeTempIndex(Index&& temp_index, uint64_t sequence = 0, uint64_t oldest_snapshot = 0,
+                      EpochManager* epochs = nullptr) {
+    const bool keep_removed = oldest_snapshot < sequence;
+    std::vector<typename Container::node_type> erased;
+    auto erase = [&](typename Container::const_iterator it) {
+      if (epochs != nullptr) {
+        erased.push_back(_index.extract(it));
+      } else {
+        _index.erase(it);
+      }
+    };
     for (auto& rec : temp_index._index) {
       if (rec.is_deleted) {
-        _index.erase(rec);
+        auto it = _index.find(rec);
+        if (it == _index.end()) {
+          continue;
+        }
+        if (keep_removed) {
+          auto& record = const_cast<IndexRecord<SecKey, PrimKey>&>(*it);
+          record.is_deleted = true;
+          record.removed_at = sequence;
+          _removed.push_back(record);
+        } else {
+          erase(it);
+        }
       } else {
         // TODO(perf): Optimize insertion (now it's find + insert).
         auto it = _index.find(rec);
-        if (it != _index.end()) {
+        if (it == _index.end()) {
+          _index.emplace(std::move(rec));
+        } else if (it->is_deleted) {
           // TODO(correctness): the field is_deleted doesn't participate as a key. So it's safe to
-          // modify it without re-inserting the record.
+          // modify it without re-inserting the record. Only records kept for snapshots are
+          // written; a PersistentIndex never keeps any, so its shared records stay untouched.
           const_cast<IndexRecord<SecKey, PrimKey>&>(*it).is_deleted = false;
-        } else {
-          _index.emplace(std::move(rec));
         }
       }
     }
     temp_index._index.clear();
+
+    while (!_removed.empty() && _removed.front().removed_at <= oldest_snapshot) {
+      // Skip records that were added back, or removed again by a later commit.
+      auto it = _index.find(_removed.front());
+      if (it != _index.end() && it->is_deleted && it->removed_at <= oldest_snapshot) {
+        erase(it);
+      }
+      _removed.pop_front();
+    }
+    if (!erased.empty()) {
+      epochs->Retire(std::move(erased));
+    }
   }
 
   Container _index;
+  // Records kept for snapshots, in removal order.
+  std::deque<IndexRecord<SecKey, PrimKey>> _removed;
 };
 
+// Index over a PersistentSet: copies share their records (see PersistentBTree), for databases
+// that publish immutable versions of their indices.
+template <typename SecKey, typename PrimKey>
+using PersistentIndex = Index<SecKey, PrimKey, PersistentSet<IndexRecord<SecKey, PrimKey>>>;
+
 template <typename SecKey, typename PrimKey, typename Functor>
 void ForEachInRange(const Index<SecKey, PrimKey>& index, const SecKey& start, const SecKey& end,
                     Functor&& func) {
@@ -1,11 +1,19 @@
 #pragma once
 
+#include <algorithm>
 #include <concepts>
+#include <memory>
+#include <optional>
+#include <vector>
 
 #include "absl/status/status.h"
 #include "gendb/bytes.h"
 #include "gendb/index.h"
 #include "gendb/layered_storage.h"
+#include "gendb/reader_biased_mutex.h"
+#include "gendb/small_key.h"
+#include "gendb/storage.h"
+#include "gendb/versioned_storage.h"
 
 namespace gendb {
 
@@ -77,25 +85,26 @@ class SecondaryIndexIterator : public IteratorImpl<T> {
   const LayeredStorage& _storage;
   const size_t _collection_id;
   IteratorT _merge_it;
+  // Keeps the current value alive on backends that pin read buffers, until Next().
+  ValuePins _pins;
   std::optional<T> _current_value = std::nullopt;
   absl::Status _status = absl::OkStatus();
 
   void LoadCurrent() {
     _current_value.reset();
     _status = absl::OkStatus();
+    // Skip deleted records: a writer's pending removals and the removals kept for snapshots.
+    while (_merge_it.Valid() && _merge_it.Value().is_deleted) {
+      _merge_it.Next();
+    }
     if (!_merge_it.Valid()) {
       _status = absl::OutOfRangeError("End of iterator");
       return;
     }
     const auto& rec = _merge_it.Value();
-    if (rec.is_deleted) {
-      // Skip deleted records
-      // TODO (correctness): Do not use recursion here.
-      Next();
-      return;
-    }
     BytesConstView value;
-    absl::Status s = _storage.Get(_collection_id, BytesConstView{rec.prim_key}, value);
+    _pins.Clear();
+    absl::Status s = _storage.Get(_collection_id, BytesConstView{rec.prim_key}, value, _pins);
     if (!s.ok()) {
       _status = s;
       return;
@@ -104,6 +113,201 @@ class SecondaryIndexIterator : public IteratorImpl<T> {
   }
 };
 
+// Walks a collection in primary key order over the encoded keys in [begin, end).
+template <typename T>
+class PrimaryKeyIterator : public IteratorImpl<T> {
+ public:
+  PrimaryKeyIterator(std::unique_ptr<StorageCursor> cursor, BytesConstView begin,
+                     BytesConstView end)
+      : _cursor(std::move(cursor)), _end(end) {
+    if (_cursor == nullptr) {
+      _status = absl::FailedPreconditionError("Storage does not keep keys ordered");
+      return;
+    }
+    _cursor->Seek(begin);
+    UpdateStatus();
+  }
+
+  T Value() override { return T{_cursor->Value()}; }
+
+  void Next() override {
+    _cursor->Next();
+    UpdateStatus();
+  }
+
+  bool Valid() const override { return _status.ok(); }
+
+  absl::Status Status() const override { return _status; }
+
+ private:
+  void UpdateStatus() {
+    if (!_cursor->Valid() ||
+        !std::ranges::lexicographical_compare(_cursor->Key(), BytesConstView(_end))) {
+      _status = absl::OutOfRangeError("End of iterator");
+    }
+  }
+
+  std::unique_ptr<StorageCursor> _cursor;
+  const SmallKey _end;
+  absl::Status _status = absl::OkStatus();
+};
+
+// Secondary index scan at a snapshot over the records with min <= sec_key < max, or
+// sec_key <= max with `include_max`. Commits modify the index concurrently, so it is only read
+// under a shared lock on `mutex`, a batch of records at a time: a commit waits at most for the
+// copy of kBatchSize records, and the scan for one commit per batch. Each record is checked
+// against its message at the snapshot, `field` extracting the indexed value: this drops records
+// added after the snapshot, and keeps the ones removed after it, which the index retains for open
+// snapshots (see Index::MergeTempIndex).
+template <typename T, typename IndexT, typename FieldFn>
+class SnapshotIndexIterator : public IteratorImpl<T> {
+ public:
+  using Record = typename IndexT::Container::value_type;
+  using SecKey = decltype(Record::sec_key);
+
+  static constexpr size_t kBatchSize = 64;
+
+  SnapshotIndexIterator(ReaderBiasedMutex& mutex, const IndexT& index, SecKey min, SecKey max,
+                        bool include_max, const StorageSnapshot& snapshot, size_t collection_id,
+                        FieldFn field)
+      : _mutex(mutex),
+        _index(index),
+        _min(std::move(min)),
+        _max(std::move(max)),
+        _include_max(include_max),
+        _snapshot(snapshot),
+        _collection_id(collection_id),
+        _field(std::move(field)) {
+    LoadCurrent();
+  }
+
+  T Value() override { return _current_value.value(); }
+
+  void Next() override { LoadCurrent(); }
+
+  bool Valid() const override { return _current_value.has_value(); }
+
+  absl::Status Status() const override { return _status; }
+
+ private:
+  void LoadCurrent() {
+    _current_value.reset();
+    while (true) {
+      if (_position == _records.size()) {
+        if (_exhausted) {
+          _status = absl::OutOfRangeError("End of iterator");
+          return;
+        }
+        FillRecords();
+        continue;
+      }
+      const size_t i = _position++;
+      if (absl::IsNotFound(_statuses[i])) {
+        continue;
+      }
+      if (!_statuses[i].ok()) {
+        _status = _statuses[i];
+        return;
+      }
+      T message{_values[i]};
+      if (_field(message) == std::optional<SecKey>(_records[i].sec_key)) {
+        _current_value = message;
+        return;
+      }
+    }
+  }
+
+  // Copies the next batch of index records under the reader lock, then reads their messages from
+  // the snapshot in one batched lookup.
+  void FillRecords() {
+    _records.clear();
+    _position = 0;
+    {
+      ReaderBiasedMutex::ReadLock lock = _mutex.LockShared();
+      auto it = _last.has_value() ? _index._index.upper_bound(*_last) : _index.lower_bound(_min);
+      for (; it != _index.end() && _records.size() < kBatchSize; ++it) {
+        if (_include_max ? _max < it->sec_key : !(it->sec_key < _max)) {
+          break;
+        }
+        _records.push_back(*it);
+      }
+    }
+    _exhausted = _records.size() < kBatchSize;
+    if (_records.empty()) {
+      return;
+    }
+    _last = _records.back();
+    _keys.clear();
+    for (const Record& rec : _records) {
+      _keys.push_back(BytesConstView{rec.prim_key});
+    }
+    _values.assign(_keys.size(), BytesConstView{});
+    _statuses.assign(_keys.size(), absl::OkStatus());
+    _copies.clear();
+    _snapshot.MultiGet(_collection_id, _keys, _values, _statuses, _copies);
+  }
+
+  ReaderBiasedMutex& _mutex;
+  const IndexT& _index;
+  const SecKey _min;
+  const SecKey _max;
+  const bool _include_max;
+  const StorageSnapshot& _snapshot;
+  const size_t _collection_id;
+  FieldFn _field;
+  std::vector<Record> _records;
+  std::vector<BytesConstView> _keys;
+  std::vector<BytesConstView> _values;
+  std::vector<absl::Status> _statuses;
+  // The latest values of the batch, which the snapshot does not keep: scans would otherwise
+  // leave it holding a copy of every message they read.
+  std::vector<Bytes> _copies;
+  size_t _position = 0;
+  bool _exhausted = false;
+  std::optional<Record> _last;
+  std::optional<T> _current_value;
+  absl::Status _status = absl::OkStatus();
+};
+
+// Secondary index scan of a writer that reads from a StorageSnapshot (see LayeredStorage): the
+// records of the committed index visible at the snapshot, merged with the writer's own records.
+// Messages are read through the writer's LayeredStorage, so they include its changes.
+template <typename T, typename IndexT>
+class SnapshotWriterIndexIterator : public IteratorImpl<T> {
+ public:
+  using Record = typename IndexT::Container::value_type;
+  using SecKey = decltype(Record::sec_key);
+  using Iter = typename IndexT::Container::const_iterator;
+
+  SnapshotWriterIndexIterator(IndexT visible, const LayeredStorage& storage, size_t collection_id,
+                              Iter temp_begin, Iter temp_end)
+      : _visible(std::move(visible)),
+        _merged(storage, collection_id,
+                MergedSetIterator<IndexT>(_visible.begin(), _visible.end(), temp_begin,
+                                          temp_end)) {}
+
+  T Value() override { return _merged.Value(); }
+
+  void Next() override { _merged.Next(); }
+
+  bool Valid() const override { return _merged.Valid(); }
+
+  absl::Status Status() const override { return _merged.Status(); }
+
+ private:
+  // The committed records in range that are visible at the snapshot.
+  IndexT _visible;
+  SecondaryIndexIterator<T, MergedSetIterator<IndexT>> _merged;
+};
+
+// `reader` is a Storage or a StorageSnapshot.
+template <typename MessageT, typename ReaderT>
+gendb::Iterator<MessageT> MakePrimaryKeyIterator(const ReaderT& reader, size_t collection_id,
+                                                 BytesConstView begin, BytesConstView end) {
+  return gendb::Iterator<MessageT>(std::make_unique<PrimaryKeyIterator<MessageT>>(
+      reader.NewCursor(collection_id), begin, end));
+}
+
 template <typename MessageT, typename IndexT>
 gendb::Iterator<MessageT> MakeSecondaryIndexIterator(
     const LayeredStorage& storage, size_t collection_id,
@@ -126,4 +330,60 @@ gendb::Iterator<MessageT> MakeSecondaryIndexIterator(
       storage, collection_id, IteratorT{begin, end, m2_begin, m2_end}));
 }
 
+template <typename MessageT, typename IndexT, typename FieldFn>
+gendb::Iterator<MessageT> MakeSnapshotIndexIterator(
+    ReaderBiasedMutex& mutex, const IndexT& index,
+    typename SnapshotIndexIterator<MessageT, IndexT, FieldFn>::SecKey min,
+    typename SnapshotIndexIterator<MessageT, IndexT, FieldFn>::SecKey max, bool include_max,
+    const StorageSnapshot& snapshot, size_t collection_id, FieldFn field) {
+  return gendb::Iterator<MessageT>(
+      std::make_unique<SnapshotIndexIterator<MessageT, IndexT, FieldFn>>(
+          mutex, index, std::move(min), std::move(max), include_max, snapshot, collection_id,
+          std::move(field)));
+}
+
+// Scan over the records with min <= sec_key < max, or sec_key <= max with `include_max`, for a
+// writer reading from `snapshot`; `temp_begin` and `temp_end` delimit the range in its own index.
+// The committed records in range are copied up front, under a shared lock on `mutex`, and checked
+// against their messages at the snapshot like SnapshotIndexIterator does.
+template <typename MessageT, typename IndexT, typename FieldFn>
+gendb::Iterator<MessageT> MakeSnapshotWriterIndexIterator(
+    ReaderBiasedMutex& mutex, const IndexT& index,
+    typename SnapshotWriterIndexIterator<MessageT, IndexT>::SecKey min,
+    typename SnapshotWriterIndexIterator<MessageT, IndexT>::SecKey max, bool include_max,
+    const StorageSnapshot& snapshot, FieldFn field, const LayeredStorage& storage,
+    size_t collection_id, typename IndexT::Container::const_iterator temp_begin,
+    typename IndexT::Container::const_iterator temp_end) {
+  using Record = typename SnapshotWriterIndexIterator<MessageT, IndexT>::Record;
+  using SecKey = typename SnapshotWriterIndexIterator<MessageT, IndexT>::SecKey;
+  std::vector<Record> records;
+  {
+    ReaderBiasedMutex::ReadLock lock = mutex.LockShared();
+    for (auto it = index.lower_bound(min); it != index.end(); ++it) {
+      if (include_max ? max < it->sec_key : !(it->sec_key < max)) {
+        break;
+      }
+      records.push_back(*it);
+    }
+  }
+  std::vector<BytesConstView> keys;
+  keys.reserve(records.size());
+  for (const Record& rec : records) {
+    keys.push_back(BytesConstView{rec.prim_key});
+  }
+  std::vector<BytesConstView> values(keys.size());
+  std::vector<absl::Status> statuses(keys.size());
+  snapshot.MultiGet(collection_id, keys, values, statuses);
+
+  IndexT visible;
+  for (size_t i = 0; i < records.size(); ++i) {
+    if (statuses[i].ok() &&
+        field(MessageT{values[i]}) == std::optional<SecKey>(records[i].sec_key)) {
+      visible.Insert(records[i].sec_key, records[i].prim_key);
+    }
+  }
+  return gendb::Iterator<MessageT>(std::make_unique<SnapshotWriterIndexIterator<MessageT, IndexT>>(
+      std::move(visible), storage, collection_id, temp_begin, temp_end));
+}
+
 }  // namespace gendb
\ No newline at end of file
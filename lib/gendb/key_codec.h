@@ -9,6 +9,7 @@
 #include <type_traits>
 
 #include "gendb/bytes.h"
+#include "gendb/small_key.h"
 
 namespace gendb::internal::key_codec {
 
@@ -186,6 +187,23 @@ Bytes EncodeTuple(const Tuple& t) {
   return EncodeTupleImpl(t, std::make_index_sequence<std::tuple_size_v<Tuple>>{});
 }
 
+// Encodes into a SmallKey, which stays allocation-free for keys up to SmallKey::kInlineSize bytes.
+template <typename Tuple, size_t... I>
+SmallKey EncodeTupleToSmallKeyImpl(const Tuple& t, std::index_sequence<I...>) {
+  size_t total = (FieldSize(std::get<I>(t)) + ...);
+  SmallKey out(total);
+  BytesView view(out.data(), out.size());
+
+  (EncodeField(std::get<I>(t), view), ...);
+
+  return out;
+}
+
+template <typename Tuple>
+SmallKey EncodeTupleToSmallKey(const Tuple& t) {
+  return EncodeTupleToSmallKeyImpl(t, std::make_index_sequence<std::tuple_size_v<Tuple>>{});
+}
+
 template <typename Tuple, size_t... I>
 Tuple DecodeTupleImpl(BytesConstView& in, std::index_sequence<I...>) {
   return Tuple{DecodeField<std::tuple_element_t<I, Tuple>>(in)...};
@@ -2,12 +2,19 @@
 
 #include <gtest/gtest.h>
 
+#include <string>
+#include <tuple>
+#include <vector>
+
 using namespace gendb::internal::key_codec;
 
+using gendb::Bytes;
+using gendb::BytesConstView;
+
 TEST(KeyCodecTest, IntegerEncodeDecode) {
   Bytes out;
   int32_t value = -123456;
-  WriteInteger(value, out);
+  out = EncodeTuple(std::tuple(value));
   BytesConstView in(out.data(), out.size());
   auto decoded = ReadInteger<int32_t>(in);
   EXPECT_EQ(decoded, value);
@@ -31,11 +38,23 @@ TEST(KeyCodecTest, TupleEncodeDecode) {
   EXPECT_EQ(std::get<1>(decoded), "abc");
 }
 
+TEST(KeyCodecTest, SmallKeyMatchesEncodeTuple) {
+  std::tuple<int32_t, std::string> short_tup{-42, "abc"};
+  gendb::SmallKey short_key = EncodeTupleToSmallKey(short_tup);
+  EXPECT_TRUE(short_key.is_inline());
+  EXPECT_TRUE(short_key == BytesConstView(EncodeTuple(short_tup)));
+
+  std::tuple<int32_t, std::string> long_tup{7, "a string longer than the inline buffer"};
+  gendb::SmallKey long_key = EncodeTupleToSmallKey(long_tup);
+  EXPECT_FALSE(long_key.is_inline());
+  EXPECT_TRUE(long_key == BytesConstView(EncodeTuple(long_tup)));
+}
+
 TEST(KeyCodecTest, EnumEncodeDecode) {
   enum class MyEnum : int8_t { A = 1, B = 2 };
   Bytes out;
   MyEnum e = MyEnum::B;
-  EncodeField(e, out);
+  out = EncodeTuple(std::tuple(e));
   BytesConstView in(out.data(), out.size());
   auto decoded = DecodeField<MyEnum>(in);
   EXPECT_EQ(decoded, MyEnum::B);
@@ -56,7 +75,7 @@ TEST(KeyCodecOrderTest, IntegerOrderPreserved) {
   std::vector<Bytes> encoded;
   for (auto v : values) {
     Bytes out;
-    WriteInteger(v, out);
+    out = EncodeTuple(std::tuple(v));
     encoded.push_back(out);
   }
   for (size_t i = 1; i < encoded.size(); ++i) {
@@ -84,7 +103,7 @@ TEST(KeyCodecOrderTest, EnumOrderPreserved) {
   std::vector<Bytes> encoded;
   for (auto e : values) {
     Bytes out;
-    EncodeField(e, out);
+    out = EncodeTuple(std::tuple(e));
     encoded.push_back(out);
   }
   for (size_t i = 1; i < encoded.size(); ++i) {
@@ -110,7 +129,7 @@ TEST(KeyCodecOrderTest, NegativeIntegerOrderPreserved) {
   std::vector<Bytes> encoded;
   for (auto v : values) {
     Bytes out;
-    WriteInteger(v, out);
+    out = EncodeTuple(std::tuple(v));
     encoded.push_back(out);
   }
   for (size_t i = 1; i < encoded.size(); ++i) {
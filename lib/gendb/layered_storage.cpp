@@ -1,25 +1,108 @@
 #include "gendb/layered_storage.h"
 
+#include <stdexcept>
+
+#include "gendb/versioned_storage.h"
+
 namespace gendb {
 
+LayeredStorage& LayeredStorage::operator=(LayeredStorage&& other) noexcept {
+  if (this == &other) {
+    return *this;
+  }
+  _storage = other._storage;
+  _snapshot = other._snapshot;
+  _pending = other._pending;
+  _temp_storage_ptr = other._temp_storage_ptr;
+  std::scoped_lock lock(_pins_mutex, other._pins_mutex);
+  _pins.Clear();
+  _pins.Append(std::move(other._pins));
+  return *this;
+}
+
 absl::Status LayeredStorage::Get(const size_t collection_id, BytesConstView key,
                                  BytesConstView& value) const {
-  // First check temp storage if available
-  if (_temp_storage_ptr != nullptr) {
-    if (_temp_storage_ptr->Exists(collection_id, key)) {
-      absl::Status status = _temp_storage_ptr->Get(collection_id, key, value);
-      if (status.ok()) {
-        // Check if it's a deletion marker (empty value)
-        if (value.empty()) {
-          return absl::NotFoundError("Key not found");
-        }
-        return absl::OkStatus();
+  ValuePins pins;
+  absl::Status status = Get(collection_id, key, value, pins);
+  KeepPins(std::move(pins));
+  return status;
+}
+
+absl::Status LayeredStorage::Get(const size_t collection_id, BytesConstView key,
+                                 BytesConstView& value, ValuePins& pins) const {
+  // First check temp storage and pending changes
+  if (const Bytes* staged = FindStaged(collection_id, key)) {
+    // Check if it's a deletion marker (empty value)
+    if (staged->empty()) {
+      return absl::NotFoundError("Key not found");
+    }
+    value = BytesConstView{*staged};
+    return absl::OkStatus();
+  }
+
+  // Check main storage. Snapshots pin the values they return themselves.
+  if (_snapshot != nullptr) {
+    return _snapshot->Get(collection_id, key, value);
+  }
+  return _storage->GetPinned(collection_id, key, value, pins);
+}
+
+void LayeredStorage::MultiGet(const size_t collection_id, std::span<const BytesConstView> keys,
+                              std::span<BytesConstView> values,
+                              std::span<absl::Status> statuses) const {
+  ValuePins pins;
+  MultiGet(collection_id, keys, values, statuses, pins);
+  KeepPins(std::move(pins));
+}
+
+void LayeredStorage::KeepPins(ValuePins&& pins) const {
+  if (pins.size() == 0) {
+    return;
+  }
+  std::lock_guard lock(_pins_mutex);
+  _pins.Append(std::move(pins));
+}
+
+void LayeredStorage::ReleasePins() const {
+  std::lock_guard lock(_pins_mutex);
+  _pins.Clear();
+}
+
+void LayeredStorage::MultiGet(const size_t collection_id, std::span<const BytesConstView> keys,
+                              std::span<BytesConstView> values, std::span<absl::Status> statuses,
+                              ValuePins& pins) const {
+  if (_temp_storage_ptr == nullptr && _pending.empty()) {
+    MainMultiGet(collection_id, keys, values, statuses, pins);
+    return;
+  }
+
+  // Resolve staged keys and batch the rest against the main storage.
+  std::vector<size_t> misses;
+  std::vector<BytesConstView> miss_keys;
+  for (size_t i = 0; i < keys.size(); ++i) {
+    if (const Bytes* staged = FindStaged(collection_id, keys[i])) {
+      if (staged->empty()) {
+        statuses[i] = absl::NotFoundError("Key not found");
+      } else {
+        values[i] = BytesConstView{*staged};
+        statuses[i] = absl::OkStatus();
       }
+    } else {
+      misses.push_back(i);
+      miss_keys.push_back(keys[i]);
     }
   }
+  if (misses.empty()) {
+    return;
+  }
 
-  // Check main storage
-  return _storage.Get(collection_id, key, value);
+  std::vector<BytesConstView> miss_values(misses.size());
+  std::vector<absl::Status> miss_statuses(misses.size());
+  MainMultiGet(collection_id, miss_keys, miss_values, miss_statuses, pins);
+  for (size_t j = 0; j < misses.size(); ++j) {
+    values[misses[j]] = miss_values[j];
+    statuses[misses[j]] = std::move(miss_statuses[j]);
+  }
 }
 
 absl::Status LayeredStorage::Delete(const size_t collection_id, BytesConstView key) {
@@ -27,9 +110,11 @@ absl::Status LayeredStorage::Delete(const size_t collection_id, BytesConstView k
     // Mark deletion in temp storage with empty value
     _temp_storage_ptr->Put(collection_id, key, Bytes{});
     return absl::OkStatus();
+  } else if (_snapshot != nullptr) {
+    return absl::FailedPreconditionError("Snapshots are read-only");
   } else {
     // Delete directly from main storage
-    return _storage.Delete(collection_id, key);
+    return _storage->Delete(collection_id, key);
   }
 }
 
@@ -40,75 +125,143 @@ absl::Status LayeredStorage::EnsureInTempStorage(const size_t collection_id, Byt
   }
 
   // Check if key already exists in temp storage
-  if (_temp_storage_ptr->Exists(collection_id, key)) {
-    // We need to get the actual storage implementation to access collections directly
-    // This is a limitation of the current design - we need direct access to modify values
-    auto* memory_storage = dynamic_cast<MemoryStorage*>(_temp_storage_ptr);
-    if (memory_storage == nullptr) {
-      return absl::InternalError("Temp storage must be MemoryStorage for EnsureInTempStorage");
-    }
+  if (Bytes* temp_value = _temp_storage_ptr->Find(collection_id, key)) {
+    *value = temp_value;
+    return absl::OkStatus();
+  }
 
-    if (collection_id >= memory_storage->collections.size()) {
-      memory_storage->collections.resize(collection_id + 1);
+  // Key doesn't exist in temp storage, try to copy from pending changes or main storage
+  BytesConstView main_value;
+  if (const Bytes* staged = FindStaged(collection_id, key)) {
+    if (staged->empty()) {
+      return absl::NotFoundError("Key not found");
     }
-    auto& temp_coll = memory_storage->collections[collection_id];
-    auto it = temp_coll.find(Bytes{key.begin(), key.end()});
-    if (it != temp_coll.end()) {
-      *value = &it->second;
-      return absl::OkStatus();
+    main_value = BytesConstView{*staged};
+  } else {
+    absl::Status status = _snapshot != nullptr ? _snapshot->Get(collection_id, key, main_value)
+                                                : _storage->Get(collection_id, key, main_value);
+    if (!status.ok()) {
+      return status;
     }
   }
 
-  // Key doesn't exist in temp storage, try to copy from main storage
-  BytesConstView main_value;
-  absl::Status status = _storage.Get(collection_id, key, main_value);
-  if (!status.ok()) {
-    return status;
+  // Copy to temp storage and hand out the stored value
+  auto& collections = _temp_storage_ptr->collections;
+  if (collection_id >= collections.size()) {
+    collections.resize(collection_id + 1);
   }
+  auto [it, inserted] =
+      collections[collection_id].try_emplace(key, main_value.begin(), main_value.end());
+  *value = &it->value;
+  return absl::OkStatus();
+}
 
-  // Copy to temp storage
-  Bytes copied_value{main_value.begin(), main_value.end()};
-  _temp_storage_ptr->Put(collection_id, key, std::move(copied_value));
-
-  // Get reference to the stored value
-  auto* memory_storage = dynamic_cast<MemoryStorage*>(_temp_storage_ptr);
-  if (memory_storage == nullptr) {
-    return absl::InternalError("Temp storage must be MemoryStorage for EnsureInTempStorage");
+const Bytes* LayeredStorage::FindStaged(const size_t collection_id, BytesConstView key) const {
+  if (_temp_storage_ptr != nullptr) {
+    if (const Bytes* value = _temp_storage_ptr->Find(collection_id, key)) {
+      return value;
+    }
   }
-
-  auto& temp_coll = memory_storage->collections[collection_id];
-  auto it = temp_coll.find(Bytes{key.begin(), key.end()});
-  if (it == temp_coll.end()) {
-    return absl::InternalError("Failed to store value in temp storage");
+  for (auto it = _pending.rbegin(); it != _pending.rend(); ++it) {
+    if (const Bytes* value = (*it)->Find(collection_id, key)) {
+      return value;
+    }
   }
+  return nullptr;
+}
 
-  *value = &it->second;
-  return absl::OkStatus();
+void LayeredStorage::MainMultiGet(const size_t collection_id,
+                                  std::span<const BytesConstView> keys,
+                                  std::span<BytesConstView> values,
+                                  std::span<absl::Status> statuses, ValuePins& pins) const {
+  if (_snapshot != nullptr) {
+    _snapshot->MultiGet(collection_id, keys, values, statuses);
+  } else {
+    _storage->MultiGet(collection_id, keys, values, statuses, pins);
+  }
 }
 
-void LayeredStorage::MergeTempStorage() {
+void LayeredStorage::MergeTempStorage(ChangedKeys* changed_keys) {
   if (_temp_storage_ptr == nullptr) {
     return;
   }
+  assert(_storage != nullptr);
+
+  size_t total = 0;
+  for (const auto& temp_coll : _temp_storage_ptr->collections) {
+    total += temp_coll.size();
+  }
+
+  // Keys in the batch point into the temp storage, so it is cleared only after the write. Values
+  // are moved into the batch and back if it is rejected: an empty value in the temp storage
+  // means a deletion, so a retried merge would otherwise delete every key the batch put.
+  WriteBatch batch;
+  batch.Reserve(total);
+  std::vector<Bytes*> moved_from;
+  moved_from.reserve(total);
+  for (size_t i = 0; i < _temp_storage_ptr->collections.size(); ++i) {
+    for (auto& [key, value] : _temp_storage_ptr->collections[i]) {
+      if (value.empty()) {
+        // Empty value means deletion
+        batch.Delete(i, key);
+        moved_from.push_back(nullptr);
+      } else {
+        batch.Put(i, key, std::move(value));
+        moved_from.push_back(&value);
+      }
+    }
+  }
+
+  absl::Status status = _storage->Write(std::move(batch));
+  if (!status.ok()) {
+    for (size_t i = 0; i < moved_from.size(); ++i) {
+      if (moved_from[i] != nullptr) {
+        *moved_from[i] = std::move(batch.ops()[i].value);
+      }
+    }
+    throw std::runtime_error("Failed to merge temp storage: " + status.ToString());
+  }
+  for (size_t i = 0; i < _temp_storage_ptr->collections.size(); ++i) {
+    if (changed_keys != nullptr) {
+      for (const auto& [key, value] : _temp_storage_ptr->collections[i]) {
+        changed_keys->Add(i, key);
+      }
+    }
+    _temp_storage_ptr->collections[i].clear();
+  }
+}
+
+void LayeredStorage::MergeChanges(const MemoryStorage& changes, ChangedKeys* changed_keys) {
+  assert(_storage != nullptr);
 
-  // We need direct access to iterate over collections
-  auto* memory_storage = dynamic_cast<MemoryStorage*>(_temp_storage_ptr);
-  if (memory_storage == nullptr) {
-    return;  // Can't merge if not MemoryStorage
+  size_t total = 0;
+  for (const auto& coll : changes.collections) {
+    total += coll.size();
   }
 
-  for (size_t i = 0; i < memory_storage->collections.size(); ++i) {
-    auto& temp_coll = memory_storage->collections[i];
-    for (auto& [key, value] : temp_coll) {
+  WriteBatch batch;
+  batch.Reserve(total);
+  for (size_t i = 0; i < changes.collections.size(); ++i) {
+    for (const auto& [key, value] : changes.collections[i]) {
       if (value.empty()) {
-        // Empty value means deletion - ignore result as this is best effort
-        (void)_storage.Delete(i, key);
+        batch.Delete(i, key);
       } else {
-        _storage.Put(i, key, std::move(value));
+        batch.Put(i, key, Bytes(value));
+      }
+    }
+  }
+
+  absl::Status status = _storage->Write(std::move(batch));
+  if (!status.ok()) {
+    throw std::runtime_error("Failed to merge changes: " + status.ToString());
+  }
+  if (changed_keys != nullptr) {
+    for (size_t i = 0; i < changes.collections.size(); ++i) {
+      for (const auto& [key, value] : changes.collections[i]) {
+        changed_keys->Add(i, key);
       }
     }
-    temp_coll.clear();
   }
 }
 
-}  // namespace gendb
\ No newline at end of file
+}  // namespace gendb
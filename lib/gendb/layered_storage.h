@@ -1,26 +1,86 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <type_traits>
+
 #include "absl/status/status.h"
+#include "gendb/changed_keys.h"
 #include "gendb/storage.h"
 
 namespace gendb {
+
+class StorageSnapshot;
+
 // Non owning view of the storages and operations for moving data between the layers.
 class LayeredStorage {
  public:
-  LayeredStorage(Storage& storage, Storage* temp_storage_ptr)
-      : _storage(storage), _temp_storage_ptr(temp_storage_ptr) {}
+  LayeredStorage(Storage& storage, MemoryStorage* temp_storage_ptr)
+      : _storage(&storage), _temp_storage_ptr(temp_storage_ptr) {}
+
+  // Reads the main layer from `snapshot`, which outlives this LayeredStorage. It cannot delete
+  // from the main layer nor merge into it.
+  LayeredStorage(const StorageSnapshot& snapshot, MemoryStorage* temp_storage_ptr)
+      : _snapshot(&snapshot), _temp_storage_ptr(temp_storage_ptr) {}
+
+  // Same as above, with the changes of commits that are not in the snapshot yet read between the
+  // temporary storage and the snapshot, the last one first. `pending` outlives this
+  // LayeredStorage and is not modified meanwhile.
+  LayeredStorage(const StorageSnapshot& snapshot,
+                 std::span<const std::shared_ptr<const MemoryStorage>> pending,
+                 MemoryStorage* temp_storage_ptr)
+      : _snapshot(&snapshot), _pending(pending), _temp_storage_ptr(temp_storage_ptr) {}
+
+  // The pins move along; the mutex guarding them does not.
+  LayeredStorage(LayeredStorage&& other) noexcept { *this = std::move(other); }
+  LayeredStorage& operator=(LayeredStorage&& other) noexcept;
 
   // Set `value` to the value associated with the given `key` in the specified `collection_id`.
-  // The key is looked up in both the temporary and main storage.
+  // The key is looked up in both the temporary and main storage. Does not allocate for in-memory
+  // main storage. Buffers pinned by the main storage are kept by this LayeredStorage until
+  // ReleasePins() or its destruction, so the views of every read stay valid until then.
   absl::Status Get(size_t collection_id, BytesConstView key, BytesConstView& value) const;
 
+  // Same as above, but buffers pinned by the main storage are owned by `pins`.
+  absl::Status Get(size_t collection_id, BytesConstView key, BytesConstView& value,
+                   ValuePins& pins) const;
+
+  // Batched Get: looks up `keys[i]` into `values[i]` and `statuses[i]`, with the same layering
+  // and lifetime rules as Get. Keys missing from the temporary storage go to the main storage in
+  // a single Storage::MultiGet.
+  void MultiGet(size_t collection_id, std::span<const BytesConstView> keys,
+                std::span<BytesConstView> values, std::span<absl::Status> statuses) const;
+
+  void MultiGet(size_t collection_id, std::span<const BytesConstView> keys,
+                std::span<BytesConstView> values, std::span<absl::Status> statuses,
+                ValuePins& pins) const;
+
+  // Releases the buffers pinned by the reads without `pins`, whose views are invalid afterwards.
+  // For readers that keep a LayeredStorage across many reads of a storage that pins.
+  void ReleasePins() const;
+
+  // Whether reads of the main storage may wait for I/O (see Storage::ReadsBlock). Snapshots are
+  // in memory.
+  bool ReadsBlock() const { return _storage != nullptr && _storage->ReadsBlock(); }
+
   // Delete a key from the specified collection
   // The deletion is marked in temporary storage if available, otherwise deleted from main storage
   absl::Status Delete(size_t collection_id, BytesConstView key);
 
-  // Merge the temporary storage into the main storage.
-  // The temporary storage is cleared after the merge.
-  void MergeTempStorage();
+  // Merge the temporary storage into the main storage as a single atomic Storage::Write.
+  // The temporary storage is cleared after the merge. Throws std::runtime_error if the main
+  // storage rejects the batch, in which case nothing was applied and the temporary storage holds
+  // the same changes as before, ready for another merge. Given `changed_keys`, every merged key
+  // is added to it once the batch is applied.
+  void MergeTempStorage(ChangedKeys* changed_keys = nullptr);
+
+  // Same as MergeTempStorage, for changes that other readers may still layer over the main
+  // storage: `changes` is copied and left as it is.
+  void MergeChanges(const MemoryStorage& changes, ChangedKeys* changed_keys = nullptr);
 
   // Ensure that the specified key is present in the temporary storage.
   // If the value is not already present, it is copied from the main storage.
@@ -28,7 +88,54 @@ class LayeredStorage {
   absl::Status EnsureInTempStorage(size_t collection_id, BytesConstView key, Bytes** value);
 
  private:
-  Storage& _storage;
-  Storage* _temp_storage_ptr = nullptr;
+  // The value staged for `key` in the temporary storage or, failing that, in the pending changes;
+  // empty for a deletion. Null if none is.
+  const Bytes* FindStaged(size_t collection_id, BytesConstView key) const;
+
+  void MainMultiGet(size_t collection_id, std::span<const BytesConstView> keys,
+                    std::span<BytesConstView> values, std::span<absl::Status> statuses,
+                    ValuePins& pins) const;
+
+  // Keeps the pins of a read without `pins` until ReleasePins(). Only locks when there are some,
+  // so reads of in-memory storages neither lock nor allocate.
+  void KeepPins(ValuePins&& pins) const;
+
+  // Exactly one of the two is set.
+  Storage* _storage = nullptr;
+  const StorageSnapshot* _snapshot = nullptr;
+  std::span<const std::shared_ptr<const MemoryStorage>> _pending;
+  MemoryStorage* _temp_storage_ptr = nullptr;
+  // Pins of the reads without `pins`, which may run concurrently.
+  mutable std::mutex _pins_mutex;
+  mutable ValuePins _pins;
 };
+
+// Reads one message per id through the MultiGet of a LayeredStorage or a StorageSnapshot, in
+// stack-allocated chunks. `to_key` encodes an id into its primary key; `messages[i]` is only
+// assigned when `statuses[i]` is OK. The reader keeps the values of every chunk alive: a
+// LayeredStorage holds their pins until ReleasePins(), a snapshot its versions.
+template <typename MessageT, typename ReaderT, typename IdT, typename ToKeyFn>
+void MultiGetMessages(const ReaderT& storage, size_t collection_id, std::span<const IdT> ids,
+                      ToKeyFn to_key, std::span<MessageT> messages,
+                      std::span<absl::Status> statuses) {
+  assert(messages.size() == ids.size() && statuses.size() == ids.size());
+  constexpr size_t kChunkSize = 64;
+  std::array<std::invoke_result_t<ToKeyFn, const IdT&>, kChunkSize> raw_keys;
+  std::array<BytesConstView, kChunkSize> keys;
+  std::array<BytesConstView, kChunkSize> values;
+  for (size_t begin = 0; begin < ids.size(); begin += kChunkSize) {
+    const size_t n = std::min(kChunkSize, ids.size() - begin);
+    for (size_t i = 0; i < n; ++i) {
+      raw_keys[i] = to_key(ids[begin + i]);
+      keys[i] = BytesConstView(raw_keys[i]);
+    }
+    storage.MultiGet(collection_id, std::span(keys.data(), n), std::span(values.data(), n),
+                     statuses.subspan(begin, n));
+    for (size_t i = 0; i < n; ++i) {
+      if (statuses[begin + i].ok()) {
+        messages[begin + i] = MessageT{values[i]};
+      }
+    }
+  }
+}
 }  // namespace gendb
\ No newline at end of file
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+namespace gendb {
+
+// std::mutex that knows which thread holds it, so that code which would take it can tell that
+// its thread already does and fail instead of deadlocking. Works with std::unique_lock.
+class OwnedMutex {
+ public:
+  void lock() {
+    _mutex.lock();
+    _owner.store(std::this_thread::get_id(), std::memory_order_relaxed);
+  }
+
+  bool try_lock() {
+    if (!_mutex.try_lock()) {
+      return false;
+    }
+    _owner.store(std::this_thread::get_id(), std::memory_order_relaxed);
+    return true;
+  }
+
+  void unlock() {
+    _owner.store(std::thread::id(), std::memory_order_relaxed);
+    _mutex.unlock();
+  }
+
+  // Exact for the calling thread: only it stores its own id, and clears it before unlocking.
+  bool HeldByThisThread() const {
+    return _owner.load(std::memory_order_relaxed) == std::this_thread::get_id();
+  }
+
+ private:
+  std::mutex _mutex;
+  std::atomic<std::thread::id> _owner;
+};
+
+}  // namespace gendb
@@ -0,0 +1,522 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <functional>
+#include <utility>
+
+namespace gendb {
+
+// Ordered map stored as a copy-on-write B+tree with reference-counted nodes. Copying a tree takes
+// O(1): the copies share every node. A mutation copies the nodes on the path to the changed entry
+// that are still shared with another tree and modifies the rest in place, so a tree never changes
+// a node that another tree can reach.
+//
+// That makes published copies safe to read while the original keeps being written, without locks
+// on either side: lookups and iteration never touch reference counts. Dropping the last tree that
+// references a node frees it, so a published copy must only be destroyed once no reader can still
+// be using it (see EpochManager).
+//
+// Erase merges an underfull node into a sibling when the two fit in one node, but never borrows,
+// so nodes may stay sparse after heavy deletes.
+template <typename Key, typename Value, typename Compare = std::less<>>
+class PersistentBTree {
+ public:
+  // Entries per leaf and children per inner node. Nodes hold one extra slot so an insert can
+  // overflow before splitting.
+  static constexpr uint32_t kNodeSize = 32;
+  // Splits leave nodes at least half full, so this bounds trees of up to 16^15 entries.
+  static constexpr int kMaxHeight = 16;
+
+ private:
+  struct Node {
+    explicit Node(bool is_leaf) : leaf(is_leaf) {}
+    std::atomic<uint32_t> refs = 1;
+    const bool leaf;
+    uint32_t count = 0;
+  };
+  struct Leaf : Node {
+    Leaf() : Node(true) {}
+    Key keys[kNodeSize + 1];
+    Value values[kNodeSize + 1];
+  };
+  // `count` children; keys[i] separates children[i] (smaller keys) from children[i + 1].
+  struct Inner : Node {
+    Inner() : Node(false) {}
+    Key keys[kNodeSize];
+    Node* children[kNodeSize + 1] = {};
+  };
+
+ public:
+  class const_iterator {
+   public:
+    const_iterator() = default;
+
+    const Key& operator*() const { return leaf()->keys[_pos[_depth - 1]]; }
+    const Key* operator->() const { return &**this; }
+    const Value& value() const { return leaf()->values[_pos[_depth - 1]]; }
+
+    const_iterator& operator++() {
+      ++_pos[_depth - 1];
+      Normalize();
+      return *this;
+    }
+
+    bool operator==(const const_iterator& other) const {
+      if (_depth == 0 || other._depth == 0) {
+        return _depth == other._depth;
+      }
+      return leaf() == other.leaf() && _pos[_depth - 1] == other._pos[other._depth - 1];
+    }
+
+   private:
+    friend class PersistentBTree;
+
+    const Leaf* leaf() const { return static_cast<const Leaf*>(_nodes[_depth - 1]); }
+
+    void Push(const Node* node, uint32_t pos) {
+      assert(_depth < kMaxHeight);
+      _nodes[_depth] = node;
+      _pos[_depth] = pos;
+      ++_depth;
+    }
+
+    // Descends to the first entry of the subtree at `node`.
+    void DescendFirst(const Node* node) {
+      while (!node->leaf) {
+        Push(node, 0);
+        node = static_cast<const Inner*>(node)->children[0];
+      }
+      Push(node, 0);
+    }
+
+    // Moves past the end of exhausted nodes to the next entry, or to end(). Leaves below the
+    // root are never empty.
+    void Normalize() {
+      while (_depth > 0 && _pos[_depth - 1] >= _nodes[_depth - 1]->count) {
+        --_depth;
+        if (_depth == 0) {
+          return;
+        }
+        const auto* inner = static_cast<const Inner*>(_nodes[_depth - 1]);
+        if (++_pos[_depth - 1] < inner->count) {
+          DescendFirst(inner->children[_pos[_depth - 1]]);
+          return;
+        }
+      }
+    }
+
+    const Node* _nodes[kMaxHeight];
+    uint32_t _pos[kMaxHeight];
+    int _depth = 0;
+  };
+
+  PersistentBTree() = default;
+  PersistentBTree(const PersistentBTree& other) : _root(other._root), _size(other._size) {
+    if (_root != nullptr) {
+      _root->refs.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+  PersistentBTree(PersistentBTree&& other) noexcept
+      : _root(std::exchange(other._root, nullptr)), _size(std::exchange(other._size, 0)) {}
+  PersistentBTree& operator=(PersistentBTree other) noexcept {
+    std::swap(_root, other._root);
+    std::swap(_size, other._size);
+    return *this;
+  }
+  ~PersistentBTree() { Unref(_root); }
+
+  size_t size() const { return _size; }
+  bool empty() const { return _size == 0; }
+
+  const_iterator begin() const {
+    const_iterator it;
+    if (_root != nullptr) {
+      it.DescendFirst(_root);
+      it.Normalize();
+    }
+    return it;
+  }
+  const_iterator end() const { return {}; }
+
+  // First entry whose key is not less than `key`.
+  template <typename K>
+  const_iterator lower_bound(const K& key) const {
+    return Bound(key, /*upper=*/false);
+  }
+  const_iterator lower_bound(const Key& key) const { return Bound(key, /*upper=*/false); }
+
+  // First entry whose key is greater than `key`.
+  template <typename K>
+  const_iterator upper_bound(const K& key) const {
+    return Bound(key, /*upper=*/true);
+  }
+  const_iterator upper_bound(const Key& key) const { return Bound(key, /*upper=*/true); }
+
+  template <typename K>
+  const_iterator find(const K& key) const {
+    const_iterator it = lower_bound(key);
+    return it != end() && !_less(key, *it) ? it : end();
+  }
+  const_iterator find(const Key& key) const { return find<Key>(key); }
+
+  // Pointer to the value stored under `key`, or nullptr.
+  template <typename K>
+  const Value* Find(const K& key) const {
+    const Node* node = _root;
+    if (node == nullptr) {
+      return nullptr;
+    }
+    while (!node->leaf) {
+      const auto* inner = static_cast<const Inner*>(node);
+      node = inner->children[ChildIndex(*inner, key)];
+    }
+    const auto* leaf = static_cast<const Leaf*>(node);
+    const uint32_t pos = LowerBound(*leaf, key);
+    return pos < leaf->count && !_less(key, leaf->keys[pos]) ? &leaf->values[pos] : nullptr;
+  }
+
+  template <typename K>
+  bool contains(const K& key) const {
+    return Find(key) != nullptr;
+  }
+
+  // Inserts the entry, or overwrites the value of an existing key if `overwrite`. Returns true if
+  // the key was new.
+  bool Put(Key key, Value value, bool overwrite = true) {
+    if (!overwrite && contains(key)) {
+      return false;
+    }
+    if (_root == nullptr) {
+      _root = new Leaf();
+    }
+    Node* root = MakeMutable(_root);
+    Key separator;
+    Node* right = nullptr;
+    const bool inserted = Insert(root, std::move(key), std::move(value), separator, right);
+    if (right != nullptr) {
+      auto* new_root = new Inner();
+      new_root->keys[0] = std::move(separator);
+      new_root->children[0] = root;
+      new_root->children[1] = right;
+      new_root->count = 2;
+      _root = new_root;
+    }
+    _size += inserted ? 1 : 0;
+    return inserted;
+  }
+
+  // Returns the number of erased entries (0 or 1).
+  template <typename K>
+  size_t Erase(const K& key) {
+    if (!contains(key)) {
+      return 0;
+    }
+    Node* root = MakeMutable(_root);
+    Erase(root, key);
+    --_size;
+    if (root->count == 0) {
+      Unref(root);
+      _root = nullptr;
+    } else if (!root->leaf && root->count == 1) {
+      // The only child takes over the root's reference.
+      auto* old_root = static_cast<Inner*>(root);
+      _root = old_root->children[0];
+      old_root->count = 0;
+      delete old_root;
+    }
+    return 1;
+  }
+
+  void clear() {
+    Unref(_root);
+    _root = nullptr;
+    _size = 0;
+  }
+
+ private:
+  template <typename K>
+  uint32_t LowerBound(const Leaf& leaf, const K& key) const {
+    return static_cast<uint32_t>(
+        std::lower_bound(leaf.keys, leaf.keys + leaf.count, key,
+                         [this](const Key& a, const K& b) { return _less(a, b); }) -
+        leaf.keys);
+  }
+  template <typename K>
+  uint32_t UpperBound(const Leaf& leaf, const K& key) const {
+    return static_cast<uint32_t>(
+        std::upper_bound(leaf.keys, leaf.keys + leaf.count, key,
+                         [this](const K& a, const Key& b) { return _less(a, b); }) -
+        leaf.keys);
+  }
+  // Child of an inner node whose range holds `key`.
+  template <typename K>
+  uint32_t ChildIndex(const Inner& inner, const K& key) const {
+    return static_cast<uint32_t>(
+        std::upper_bound(inner.keys, inner.keys + inner.count - 1, key,
+                         [this](const K& a, const Key& b) { return _less(a, b); }) -
+        inner.keys);
+  }
+
+  template <typename K>
+  const_iterator Bound(const K& key, bool upper) const {
+    const_iterator it;
+    const Node* node = _root;
+    if (node == nullptr) {
+      return it;
+    }
+    while (!node->leaf) {
+      const auto* inner = static_cast<const Inner*>(node);
+      const uint32_t index = ChildIndex(*inner, key);
+      it.Push(node, index);
+      node = inner->children[index];
+    }
+    const auto* leaf = static_cast<const Leaf*>(node);
+    it.Push(leaf, upper ? UpperBound(*leaf, key) : LowerBound(*leaf, key));
+    it.Normalize();
+    return it;
+  }
+
+  // Makes `slot` point to a node owned by this tree alone, copying the node if it is shared.
+  static Node* MakeMutable(Node*& slot) {
+    if (slot->refs.load(std::memory_order_acquire) == 1) {
+      return slot;
+    }
+    Node* copy;
+    if (slot->leaf) {
+      const auto* leaf = static_cast<const Leaf*>(slot);
+      auto* leaf_copy = new Leaf();
+      std::copy(leaf->keys, leaf->keys + leaf->count, leaf_copy->keys);
+      std::copy(leaf->values, leaf->values + leaf->count, leaf_copy->values);
+      copy = leaf_copy;
+    } else {
+      const auto* inner = static_cast<const Inner*>(slot);
+      auto* inner_copy = new Inner();
+      std::copy(inner->keys, inner->keys + inner->count - 1, inner_copy->keys);
+      std::copy(inner->children, inner->children + inner->count, inner_copy->children);
+      for (uint32_t i = 0; i < inner->count; ++i) {
+        inner->children[i]->refs.fetch_add(1, std::memory_order_relaxed);
+      }
+      copy = inner_copy;
+    }
+    copy->count = slot->count;
+    Unref(slot);
+    slot = copy;
+    return copy;
+  }
+
+  static void Unref(Node* node) {
+    if (node == nullptr || node->refs.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+      return;
+    }
+    if (node->leaf) {
+      delete static_cast<Leaf*>(node);
+      return;
+    }
+    auto* inner = static_cast<Inner*>(node);
+    for (uint32_t i = 0; i < inner->count; ++i) {
+      Unref(inner->children[i]);
+    }
+    delete inner;
+  }
+
+  // Inserts into the subtree at the mutable `node`. On overflow the node is split and the new
+  // right sibling and its separator are returned through `right` and `separator`.
+  bool Insert(Node* node, Key&& key, Value&& value, Key& separator, Node*& right) {
+    if (node->leaf) {
+      auto* leaf = static_cast<Leaf*>(node);
+      const uint32_t pos = LowerBound(*leaf, key);
+      if (pos < leaf->count && !_less(key, leaf->keys[pos])) {
+        leaf->values[pos] = std::move(value);
+        return false;
+      }
+      std::move_backward(leaf->keys + pos, leaf->keys + leaf->count,
+                         leaf->keys + leaf->count + 1);
+      std::move_backward(leaf->values + pos, leaf->values + leaf->count,
+                         leaf->values + leaf->count + 1);
+      leaf->keys[pos] = std::move(key);
+      leaf->values[pos] = std::move(value);
+      if (++leaf->count > kNodeSize) {
+        auto* sibling = new Leaf();
+        const uint32_t mid = leaf->count / 2;
+        MoveEntries(*leaf, mid, leaf->count, *sibling, 0);
+        sibling->count = leaf->count - mid;
+        leaf->count = mid;
+        separator = sibling->keys[0];
+        right = sibling;
+      }
+      return true;
+    }
+
+    auto* inner = static_cast<Inner*>(node);
+    const uint32_t index = ChildIndex(*inner, key);
+    Node* child = MakeMutable(inner->children[index]);
+    Key child_separator;
+    Node* child_right = nullptr;
+    const bool inserted = Insert(child, std::move(key), std::move(value), child_separator,
+                                 child_right);
+    if (child_right == nullptr) {
+      return inserted;
+    }
+    std::move_backward(inner->keys + index, inner->keys + inner->count - 1,
+                       inner->keys + inner->count);
+    std::move_backward(inner->children + index + 1, inner->children + inner->count,
+                       inner->children + inner->count + 1);
+    inner->keys[index] = std::move(child_separator);
+    inner->children[index + 1] = child_right;
+    if (++inner->count > kNodeSize) {
+      // The separator between the halves moves up and stays in neither.
+      auto* sibling = new Inner();
+      const uint32_t mid = inner->count / 2;
+      std::move(inner->keys + mid, inner->keys + inner->count - 1, sibling->keys);
+      std::copy(inner->children + mid, inner->children + inner->count, sibling->children);
+      sibling->count = inner->count - mid;
+      separator = std::move(inner->keys[mid - 1]);
+      ResetSlots(*inner, mid, inner->count);
+      inner->count = mid;
+      right = sibling;
+    }
+    return inserted;
+  }
+
+  // Erases an existing key from the subtree at the mutable `node`. Empty children are dropped
+  // and an underfull child is merged into a sibling if both fit in one node.
+  template <typename K>
+  void Erase(Node* node, const K& key) {
+    if (node->leaf) {
+      auto* leaf = static_cast<Leaf*>(node);
+      const uint32_t pos = LowerBound(*leaf, key);
+      assert(pos < leaf->count);
+      std::move(leaf->keys + pos + 1, leaf->keys + leaf->count, leaf->keys + pos);
+      std::move(leaf->values + pos + 1, leaf->values + leaf->count, leaf->values + pos);
+      --leaf->count;
+      leaf->keys[leaf->count] = Key();
+      leaf->values[leaf->count] = Value();
+      return;
+    }
+    auto* inner = static_cast<Inner*>(node);
+    const uint32_t index = ChildIndex(*inner, key);
+    Node* child = MakeMutable(inner->children[index]);
+    Erase(child, key);
+    if (child->count == 0) {
+      Unref(child);
+      RemoveChild(*inner, index);
+    } else if (child->count < kNodeSize / 4) {
+      if (index > 0 && inner->children[index - 1]->count + child->count <= kNodeSize) {
+        Merge(*inner, index - 1);
+      } else if (index + 1 < inner->count &&
+                 inner->children[index + 1]->count + child->count <= kNodeSize) {
+        Merge(*inner, index);
+      }
+    }
+  }
+
+  // Merges children[index + 1] into children[index] and drops it from the parent.
+  void Merge(Inner& parent, uint32_t index) {
+    Node* left = MakeMutable(parent.children[index]);
+    Node* right = parent.children[index + 1];
+    if (left->leaf) {
+      auto* left_leaf = static_cast<Leaf*>(left);
+      const auto* right_leaf = static_cast<const Leaf*>(right);
+      std::copy(right_leaf->keys, right_leaf->keys + right->count,
+                left_leaf->keys + left->count);
+      std::copy(right_leaf->values, right_leaf->values + right->count,
+                left_leaf->values + left->count);
+    } else {
+      auto* left_inner = static_cast<Inner*>(left);
+      const auto* right_inner = static_cast<const Inner*>(right);
+      left_inner->keys[left->count - 1] = parent.keys[index];
+      std::copy(right_inner->keys, right_inner->keys + right->count - 1,
+                left_inner->keys + left->count);
+      std::copy(right_inner->children, right_inner->children + right->count,
+                left_inner->children + left->count);
+      for (uint32_t i = 0; i < right->count; ++i) {
+        right_inner->children[i]->refs.fetch_add(1, std::memory_order_relaxed);
+      }
+    }
+    left->count += right->count;
+    Unref(right);
+    RemoveChild(parent, index + 1);
+  }
+
+  // Drops children[index] and the separator next to it, without releasing the child.
+  static void RemoveChild(Inner& inner, uint32_t index) {
+    const uint32_t separator = index == 0 ? 0 : index - 1;
+    std::move(inner.keys + separator + 1, inner.keys + inner.count - 1, inner.keys + separator);
+    std::copy(inner.children + index + 1, inner.children + inner.count, inner.children + index);
+    --inner.count;
+    ResetSlots(inner, inner.count, inner.count + 1);
+  }
+
+  // Clears the separators and children of the unused slots [from, to).
+  static void ResetSlots(Inner& inner, uint32_t from, uint32_t to) {
+    for (uint32_t i = from; i < to; ++i) {
+      if (i > 0) {
+        inner.keys[i - 1] = Key();
+      }
+      inner.children[i] = nullptr;
+    }
+  }
+
+  static void MoveEntries(Leaf& from, uint32_t begin, uint32_t end, Leaf& to, uint32_t at) {
+    std::move(from.keys + begin, from.keys + end, to.keys + at);
+    std::move(from.values + begin, from.values + end, to.values + at);
+    for (uint32_t i = begin; i < end; ++i) {
+      from.keys[i] = Key();
+      from.values[i] = Value();
+    }
+  }
+
+  Node* _root = nullptr;
+  size_t _size = 0;
+  [[no_unique_address]] Compare _less;
+};
+
+// Ordered set on a PersistentBTree, with the subset of the std::set interface that Index uses.
+// Copies share their nodes; mutations invalidate the iterators of the mutated set only.
+template <typename T, typename Compare = std::less<>>
+class PersistentSet {
+  struct Empty {};
+  using Tree = PersistentBTree<T, Empty, Compare>;
+
+ public:
+  using value_type = T;
+  // What extract() returns.
+  using node_type = T;
+  using const_iterator = typename Tree::const_iterator;
+  using iterator = const_iterator;
+
+  size_t size() const { return _tree.size(); }
+  bool empty() const { return _tree.empty(); }
+  const_iterator begin() const { return _tree.begin(); }
+  const_iterator end() const { return _tree.end(); }
+  const_iterator find(const T& value) const { return _tree.find(value); }
+  const_iterator lower_bound(const T& value) const { return _tree.lower_bound(value); }
+  const_iterator upper_bound(const T& value) const { return _tree.upper_bound(value); }
+  bool contains(const T& value) const { return _tree.contains(value); }
+
+  // Returns false if an equal value was already present.
+  bool insert(T value) { return _tree.Put(std::move(value), Empty{}, /*overwrite=*/false); }
+  template <typename... Args>
+  bool emplace(Args&&... args) {
+    return insert(T(std::forward<Args>(args)...));
+  }
+
+  size_t erase(const T& value) { return _tree.Erase(value); }
+  // Copies the value first: erasing may free the node `it` points into.
+  void erase(const_iterator it) { erase(T(*it)); }
+  node_type extract(const_iterator it) {
+    T value = *it;
+    erase(value);
+    return value;
+  }
+
+  void clear() { _tree.clear(); }
+
+ private:
+  Tree _tree;
+};
+
+}  // namespace gendb
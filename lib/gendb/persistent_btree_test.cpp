@@ -0,0 +1,157 @@
+#include "gendb/persistent_btree.h"
+
+#include <gtest/gtest.h>
+
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace gendb {
+namespace {
+
+using Tree = PersistentBTree<int, std::string>;
+
+std::vector<std::pair<int, std::string>> Entries(const Tree& tree) {
+  std::vector<std::pair<int, std::string>> entries;
+  for (auto it = tree.begin(); it != tree.end(); ++it) {
+    entries.emplace_back(*it, it.value());
+  }
+  return entries;
+}
+
+std::vector<std::pair<int, std::string>> Entries(const std::map<int, std::string>& map) {
+  return {map.begin(), map.end()};
+}
+
+TEST(PersistentBTreeTest, EmptyTree) {
+  Tree tree;
+  EXPECT_TRUE(tree.empty());
+  EXPECT_EQ(tree.begin(), tree.end());
+  EXPECT_EQ(tree.lower_bound(1), tree.end());
+  EXPECT_EQ(tree.Find(1), nullptr);
+  EXPECT_EQ(tree.Erase(1), 0);
+}
+
+TEST(PersistentBTreeTest, BoundsCrossLeaves) {
+  Tree tree;
+  for (int i = 0; i < 1000; i += 2) {
+    EXPECT_TRUE(tree.Put(i, std::to_string(i)));
+  }
+  for (int i = 0; i < 998; ++i) {
+    auto lower = tree.lower_bound(i);
+    ASSERT_NE(lower, tree.end());
+    EXPECT_EQ(*lower, i + i % 2);
+    auto upper = tree.upper_bound(i);
+    ASSERT_NE(upper, tree.end());
+    EXPECT_EQ(*upper, i + 2 - i % 2);
+  }
+  EXPECT_EQ(tree.lower_bound(999), tree.end());
+  EXPECT_EQ(tree.upper_bound(998), tree.end());
+  EXPECT_EQ(tree.find(3), tree.end());
+  EXPECT_EQ(tree.find(4).value(), "4");
+}
+
+TEST(PersistentBTreeTest, PutOverwritesUnlessAsked) {
+  Tree tree;
+  EXPECT_TRUE(tree.Put(1, "a"));
+  EXPECT_FALSE(tree.Put(1, "b", /*overwrite=*/false));
+  EXPECT_EQ(*tree.Find(1), "a");
+  EXPECT_FALSE(tree.Put(1, "c"));
+  EXPECT_EQ(*tree.Find(1), "c");
+  EXPECT_EQ(tree.size(), 1);
+}
+
+TEST(PersistentBTreeTest, MatchesStdMapUnderRandomOps) {
+  Tree tree;
+  std::map<int, std::string> reference;
+  std::mt19937 rng(11);
+  std::uniform_int_distribution<int> key_dist(0, 3000);
+  for (int i = 0; i < 100000; ++i) {
+    const int key = key_dist(rng);
+    if (rng() % 5 < 2) {
+      EXPECT_EQ(tree.Erase(key), reference.erase(key));
+    } else {
+      const std::string value = std::to_string(i);
+      EXPECT_EQ(tree.Put(key, value), !reference.contains(key));
+      reference[key] = value;
+    }
+  }
+  EXPECT_EQ(tree.size(), reference.size());
+  EXPECT_EQ(Entries(tree), Entries(reference));
+
+  // Drain completely; the tree collapses back to an empty root.
+  for (const auto& [key, value] : reference) {
+    ASSERT_EQ(tree.Erase(key), 1);
+    ASSERT_EQ(tree.Find(key), nullptr);
+  }
+  EXPECT_TRUE(tree.empty());
+  EXPECT_EQ(tree.begin(), tree.end());
+}
+
+TEST(PersistentBTreeTest, CopiesAreUnaffectedByLaterWrites) {
+  // Each round copies the tree, then mutates the original; every copy must keep its contents.
+  Tree tree;
+  std::map<int, std::string> reference;
+  std::vector<std::pair<Tree, std::map<int, std::string>>> versions;
+  std::mt19937 rng(7);
+  std::uniform_int_distribution<int> key_dist(0, 2000);
+  for (int round = 0; round < 50; ++round) {
+    versions.emplace_back(tree, reference);
+    for (int i = 0; i < 500; ++i) {
+      const int key = key_dist(rng);
+      if (rng() % 3 == 0) {
+        tree.Erase(key);
+        reference.erase(key);
+      } else {
+        tree.Put(key, std::to_string(round));
+        reference[key] = std::to_string(round);
+      }
+    }
+  }
+  EXPECT_EQ(Entries(tree), Entries(reference));
+  for (const auto& [copy, expected] : versions) {
+    ASSERT_EQ(Entries(copy), Entries(expected));
+  }
+
+  // Dropping the original leaves the copies intact.
+  tree.clear();
+  EXPECT_EQ(Entries(versions.back().first), Entries(versions.back().second));
+}
+
+TEST(PersistentBTreeTest, ValuesAreReleasedWithTheLastCopy) {
+  auto value = std::make_shared<int>(1);
+  auto copy = std::make_unique<PersistentBTree<int, std::shared_ptr<int>>>();
+  {
+    PersistentBTree<int, std::shared_ptr<int>> tree;
+    tree.Put(1, value);
+    *copy = tree;
+    tree.Erase(1);
+    EXPECT_EQ(value.use_count(), 2);
+  }
+  copy.reset();
+  EXPECT_EQ(value.use_count(), 1);
+}
+
+TEST(PersistentSetTest, SetInterface) {
+  PersistentSet<std::pair<int, int>> set;
+  EXPECT_TRUE(set.insert({1, 1}));
+  EXPECT_TRUE(set.emplace(1, 2));
+  EXPECT_TRUE(set.emplace(2, 1));
+  EXPECT_FALSE(set.insert({1, 2}));
+  EXPECT_EQ(*set.lower_bound({1, 0}), std::make_pair(1, 1));
+  EXPECT_EQ(*set.upper_bound({1, 2}), std::make_pair(2, 1));
+
+  const PersistentSet<std::pair<int, int>> copy = set;
+  EXPECT_EQ(set.extract(set.find({1, 1})), std::make_pair(1, 1));
+  set.erase(set.begin());
+  EXPECT_EQ(set.size(), 1);
+  EXPECT_EQ(*set.begin(), std::make_pair(2, 1));
+  EXPECT_EQ(copy.size(), 3);
+  EXPECT_TRUE(copy.contains({1, 1}));
+}
+
+}  // namespace
+}  // namespace gendb
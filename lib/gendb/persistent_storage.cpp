@@ -0,0 +1,101 @@
+#include "gendb/persistent_storage.h"
+
+#include <utility>
+
+#include "gendb/btree_set.h"
+
+namespace gendb {
+
+bool PersistentStorage::KeyLess::operator()(BytesConstView a, BytesConstView b) const {
+  return internal::btree::CompareKeys(a, b) < 0;
+}
+
+void PersistentStorage::Put(const size_t collection_id, BytesConstView key, Bytes&& value) {
+  if (collection_id >= _collections.size()) {
+    _collections.resize(collection_id + 1);
+  }
+  _collections[collection_id].Put(SmallKey(key),
+                                  std::make_shared<const Bytes>(std::move(value)));
+}
+
+absl::Status PersistentStorage::Delete(const size_t collection_id, BytesConstView key) {
+  if (collection_id >= _collections.size()) {
+    return absl::NotFoundError("Collection not found");
+  }
+  if (_collections[collection_id].Erase(key) == 0) {
+    return absl::NotFoundError("Key not found");
+  }
+  return absl::OkStatus();
+}
+
+absl::Status PersistentStorage::DeleteRange(const size_t collection_id, BytesConstView begin,
+                                            BytesConstView end) {
+  if (collection_id >= _collections.size()) {
+    return absl::OkStatus();
+  }
+  Collection& coll = _collections[collection_id];
+  // Erasing invalidates iterators, so the range is collected first.
+  std::vector<SmallKey> keys;
+  for (auto it = coll.lower_bound(begin); it != coll.end() && KeyInRange(*it, begin, end); ++it) {
+    keys.push_back(*it);
+  }
+  for (const SmallKey& key : keys) {
+    coll.Erase(BytesConstView(key));
+  }
+  return absl::OkStatus();
+}
+
+absl::Status PersistentStorage::Truncate(const size_t collection_id) {
+  if (collection_id < _collections.size()) {
+    _collections[collection_id].clear();
+  }
+  return absl::OkStatus();
+}
+
+absl::Status PersistentStorage::Get(const size_t collection_id, BytesConstView key,
+                                    BytesConstView& value) const {
+  if (collection_id >= _collections.size()) {
+    return absl::NotFoundError("Collection not found");
+  }
+  const std::shared_ptr<const Bytes>* found = _collections[collection_id].Find(key);
+  if (found == nullptr) {
+    return absl::NotFoundError("Key not found");
+  }
+  value = BytesConstView{**found};
+  return absl::OkStatus();
+}
+
+bool PersistentStorage::Exists(const size_t collection_id, BytesConstView key) const {
+  return collection_id < _collections.size() && _collections[collection_id].contains(key);
+}
+
+size_t PersistentStorage::GetCollectionSize(const size_t collection_id) const {
+  return collection_id < _collections.size() ? _collections[collection_id].size() : 0;
+}
+
+class PersistentStorage::Cursor : public StorageCursor {
+ public:
+  // `coll` is null for a collection that does not exist yet.
+  explicit Cursor(const Collection* coll) : _coll(coll) {}
+
+  void Seek(BytesConstView key) override {
+    if (_coll != nullptr) {
+      _it = _coll->lower_bound(key);
+    }
+  }
+  void Next() override { ++_it; }
+  bool Valid() const override { return _coll != nullptr && _it != _coll->end(); }
+  BytesConstView Key() const override { return *_it; }
+  BytesConstView Value() const override { return BytesConstView{*_it.value()}; }
+
+ private:
+  const Collection* _coll;
+  Collection::const_iterator _it;
+};
+
+std::unique_ptr<StorageCursor> PersistentStorage::NewCursor(const size_t collection_id) const {
+  return std::make_unique<Cursor>(
+      collection_id < _collections.size() ? &_collections[collection_id] : nullptr);
+}
+
+}  // namespace gendb
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "gendb/bytes.h"
+#include "gendb/persistent_btree.h"
+#include "gendb/small_key.h"
+#include "gendb/storage.h"
+
+namespace gendb {
+
+// In-memory storage whose collections are PersistentBTrees, so copying the whole storage is O(1)
+// per collection and the copy is unaffected by later writes to the original. A writer can
+// therefore prepare the next state in a copy while readers keep using the published one.
+//
+// Values are shared between copies and never modified in place: a view returned by Get stays
+// valid for as long as any copy that holds the value is alive.
+class PersistentStorage : public Storage {
+ public:
+  void Put(const size_t collection_id, BytesConstView key, Bytes&& value) override;
+
+  absl::Status Delete(const size_t collection_id, BytesConstView key) override;
+
+  absl::Status DeleteRange(const size_t collection_id, BytesConstView begin,
+                           BytesConstView end) override;
+
+  absl::Status Truncate(const size_t collection_id) override;
+
+  absl::Status Get(const size_t collection_id, BytesConstView key,
+                   BytesConstView& value) const override;
+
+  bool Exists(const size_t collection_id, BytesConstView key) const override;
+
+  std::unique_ptr<StorageCursor> NewCursor(const size_t collection_id) const override;
+
+  size_t GetCollectionCount() const override { return _collections.size(); }
+
+  size_t GetCollectionSize(const size_t collection_id) const override;
+
+  void Clear() override { _collections.clear(); }
+
+ private:
+  // Bytewise order (see KeyInRange) over owned keys and lookup views alike.
+  struct KeyLess {
+    bool operator()(BytesConstView a, BytesConstView b) const;
+  };
+  using Collection = PersistentBTree<SmallKey, std::shared_ptr<const Bytes>, KeyLess>;
+
+  class Cursor;
+
+  std::vector<Collection> _collections;
+};
+
+}  // namespace gendb
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+#include "gendb/bytes.h"
+#include "gendb/small_key.h"
+#include "gendb/versioned_storage.h"
+
+namespace gendb {
+
+// Primary keys an optimistic writer read from its StorageSnapshot. Its commit conflicts with every
+// commit after the snapshot that wrote one of them.
+class ReadSet {
+ public:
+  void Add(size_t collection_id, BytesConstView key) {
+    _keys.emplace_back(collection_id, SmallKey(key));
+  }
+
+  // True if a commit after `snapshot` wrote or deleted one of the keys.
+  bool WrittenAfter(const StorageSnapshot& snapshot) const {
+    return std::ranges::any_of(_keys, [&](const auto& read) {
+      return snapshot.WrittenAfter(read.first, read.second);
+    });
+  }
+
+  size_t size() const { return _keys.size(); }
+
+  void Clear() { _keys.clear(); }
+
+ private:
+  std::vector<std::pair<size_t, SmallKey>> _keys;
+};
+
+// Secondary index range read by an optimistic writer: min <= sec_key < max, or sec_key <= max
+// with `include_max`.
+template <typename SecKey>
+struct IndexRange {
+  SecKey min;
+  SecKey max;
+  bool include_max;
+};
+
+// True if a commit after `snapshot` added or removed a record of `index` in `range`, or wrote a
+// message that one points to. Either takes a write of the message, so this checks the primary key
+// of every record now in range, including the removed records the index keeps for the snapshot
+// (see Index::MergeTempIndex). Callers keep commits from changing the index meanwhile.
+template <typename IndexT, typename SecKey>
+bool IndexRangeWrittenAfter(const IndexT& index, const IndexRange<SecKey>& range,
+                            const StorageSnapshot& snapshot, size_t collection_id) {
+  for (auto it = index.lower_bound(range.min); it != index.end(); ++it) {
+    if (range.include_max ? range.max < it->sec_key : !(it->sec_key < range.max)) {
+      break;
+    }
+    if (it->is_deleted && it->removed_at <= snapshot.sequence()) {
+      // Already removed at the snapshot.
+      continue;
+    }
+    if (snapshot.WrittenAfter(collection_id, BytesConstView{it->prim_key})) {
+      return true;
+    }
+  }
+  return false;
+}
+
+}  // namespace gendb
@@ -0,0 +1,157 @@
+#include "gendb/reader_biased_mutex.h"
+
+#include <array>
+#include <chrono>
+#include <mutex>
+#include <thread>
+
+namespace gendb {
+
+namespace {
+
+constexpr size_t kVisibleReaders = 1024;
+
+struct alignas(64) VisibleReader {
+  std::atomic<const ReaderBiasedMutex*> lock = nullptr;
+};
+
+// Shared by every lock, as in BRAVO: its size does not grow with the number of locks.
+std::array<VisibleReader, kVisibleReaders> visible_readers;
+
+std::atomic<size_t> next_thread_index = 0;
+
+int64_t NowNanos() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+}  // namespace
+
+#if GENDB_PTHREAD_RWLOCK
+ReaderBiasedMutex::ReaderBiasedMutex() {
+  // glibc's default, made explicit: a waiting writer does not block readers of the rwlock, so
+  // nested read locks always make progress. _writer_pending holds new readers back instead.
+  pthread_rwlockattr_t attr;
+  pthread_rwlockattr_init(&attr);
+  pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_READER_NP);
+  pthread_rwlock_init(&_rwlock, &attr);
+  pthread_rwlockattr_destroy(&attr);
+}
+
+ReaderBiasedMutex::~ReaderBiasedMutex() { pthread_rwlock_destroy(&_rwlock); }
+
+void ReaderBiasedMutex::LockUnderlyingShared() { pthread_rwlock_rdlock(&_rwlock); }
+
+void ReaderBiasedMutex::UnlockUnderlyingShared() { pthread_rwlock_unlock(&_rwlock); }
+
+void ReaderBiasedMutex::LockUnderlying() { pthread_rwlock_wrlock(&_rwlock); }
+
+void ReaderBiasedMutex::UnlockUnderlying() { pthread_rwlock_unlock(&_rwlock); }
+#else
+ReaderBiasedMutex::ReaderBiasedMutex() = default;
+
+ReaderBiasedMutex::~ReaderBiasedMutex() = default;
+
+void ReaderBiasedMutex::LockUnderlyingShared() {
+  _rwlock.lock_shared();
+  _readers.fetch_add(1, std::memory_order_relaxed);
+}
+
+void ReaderBiasedMutex::UnlockUnderlyingShared() {
+  _rwlock.unlock_shared();
+  if (_readers.fetch_sub(1, std::memory_order_release) == 1) {
+    _readers.notify_all();
+  }
+}
+
+void ReaderBiasedMutex::LockUnderlying() {
+  // A writer blocked in lock() may hold back the readers of the shared_mutex, nested ones
+  // included, so it only tries to lock it. Readers count themselves after locking it: a failed
+  // attempt with none counted is a reader about to be, or a spurious failure, and is retried.
+  while (!_rwlock.try_lock()) {
+    const uint32_t readers = _readers.load(std::memory_order_acquire);
+    if (readers != 0) {
+      _readers.wait(readers, std::memory_order_acquire);
+    } else {
+      std::this_thread::yield();
+    }
+  }
+}
+
+void ReaderBiasedMutex::UnlockUnderlying() { _rwlock.unlock(); }
+#endif
+
+ReaderBiasedMutex::Slot& ReaderBiasedMutex::LocalSlot() const {
+  // Consecutive threads get consecutive slots for a given lock, so up to kVisibleReaders threads
+  // reading the same lock never share one.
+  thread_local const size_t thread_index =
+      next_thread_index.fetch_add(1, std::memory_order_relaxed);
+  const size_t lock_hash = (reinterpret_cast<uintptr_t>(this) >> 6) * 0x9e3779b97f4a7c15;
+  return visible_readers[(thread_index + lock_hash) % kVisibleReaders].lock;
+}
+
+const std::shared_ptr<ReaderBiasedMutex::HeldCount>& ReaderBiasedMutex::LocalHeldCount() {
+  thread_local const std::shared_ptr<HeldCount> held = std::make_shared<HeldCount>(0);
+  return held;
+}
+
+ReaderBiasedMutex::ReadLock ReaderBiasedMutex::LockShared() {
+  if (_read_bias.load(std::memory_order_acquire)) {
+    Slot& slot = LocalSlot();
+    const ReaderBiasedMutex* expected = nullptr;
+    if (slot.compare_exchange_strong(expected, this, std::memory_order_seq_cst)) {
+      // Either the writer revoking the bias sees the slot, or the reader sees the revocation.
+      if (_read_bias.load(std::memory_order_seq_cst)) {
+        return ReadLock(this, &slot, nullptr);
+      }
+      slot.store(nullptr, std::memory_order_release);
+    }
+  }
+  const std::shared_ptr<HeldCount>& held = LocalHeldCount();
+  // A thread holding a read lock, in its slot or the rwlock, may be what the writer waits for.
+  if (held->load(std::memory_order_relaxed) == 0 &&
+      LocalSlot().load(std::memory_order_relaxed) != this) {
+    _writer_pending.wait(true, std::memory_order_acquire);
+  }
+  LockUnderlyingShared();
+  held->fetch_add(1, std::memory_order_relaxed);
+  // A writer revoking the bias holds _writer_mutex until it unlocks, so the bias is only
+  // restored when none is.
+  if (!_read_bias.load(std::memory_order_relaxed) &&
+      NowNanos() >= _inhibit_until.load(std::memory_order_relaxed) && _writer_mutex.try_lock()) {
+    _read_bias.store(true, std::memory_order_release);
+    _writer_mutex.unlock();
+  }
+  return ReadLock(this, nullptr, held);
+}
+
+void ReaderBiasedMutex::lock() {
+  _writer_mutex.lock();
+  _writer_pending.store(true, std::memory_order_relaxed);
+  if (_read_bias.load(std::memory_order_relaxed)) {
+    _read_bias.store(false, std::memory_order_seq_cst);
+    // Pairs with the slot exchange and bias load of LockShared(): without it the slot loads below
+    // may be ordered before the store, and miss a reader that then sees the bias still on.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    const int64_t start = NowNanos();
+    for (VisibleReader& reader : visible_readers) {
+      while (reader.lock.load(std::memory_order_acquire) == this) {
+        std::this_thread::yield();
+      }
+    }
+    const int64_t now = NowNanos();
+    _inhibit_until.store(now + (now - start) * kInhibitMultiplier, std::memory_order_relaxed);
+  }
+  LockUnderlying();
+  // Readers held back now wait on the rwlock.
+  _writer_pending.store(false, std::memory_order_release);
+  _writer_pending.notify_all();
+}
+
+void ReaderBiasedMutex::unlock() {
+  UnlockUnderlying();
+  _writer_mutex.unlock();
+}
+
+}  // namespace gendb
@@ -0,0 +1,148 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+// Only glibc's rwlock can be asked to prefer readers; elsewhere, or given GENDB_PORTABLE_RWLOCK,
+// the underlying lock is a std::shared_mutex that writers never queue in (see ReaderBiasedMutex).
+#if defined(__GLIBC__) && !defined(GENDB_PORTABLE_RWLOCK)
+#include <pthread.h>
+#define GENDB_PTHREAD_RWLOCK 1
+#else
+#include <shared_mutex>
+#endif
+
+namespace gendb {
+
+// Reader-writer lock for read-mostly data, after BRAVO (Dice and Kogan, "BRAVO: Biased Locking
+// for Reader-Writer Locks", USENIX ATC 2019). While the lock is read-biased, a reader announces
+// itself by publishing the lock's address in a slot of a process-wide table of visible readers,
+// picked by hashing its thread and the lock: readers on different threads write different cache
+// lines, where a std::shared_mutex makes them all write its reader count. A writer revokes the
+// bias, waits for the visible readers to leave and then takes the underlying reader-writer lock,
+// which readers take while the bias is off. They do so until the bias is restored, which happens
+// once a multiple of the revocation's duration has passed, so frequent writers do not pay for
+// revocations over and over.
+//
+// Readers whose slot is taken, by another lock or a nested read lock, take the underlying lock
+// too. It prefers readers, so that a thread already holding a read lock can take another one
+// while a writer waits; to keep writers from starving, a waiting writer holds back the readers
+// of threads that hold no read lock. A read lock handed to another thread does not count as held
+// there. std::unique_lock works for writers; readers use LockShared(). The preference for readers
+// is glibc's PTHREAD_RWLOCK_PREFER_READER_NP where available. Elsewhere the underlying lock is a
+// std::shared_mutex, which may queue readers behind a waiting writer: writers only try to lock it
+// and wait for its reader count to drop to zero in between, so readers only wait for a writer that
+// holds it.
+class ReaderBiasedMutex {
+ public:
+  class ReadLock;
+
+  // A revocation inhibits the bias for this many times its duration.
+  static constexpr int64_t kInhibitMultiplier = 9;
+
+  ReaderBiasedMutex();
+  ~ReaderBiasedMutex();
+  ReaderBiasedMutex(const ReaderBiasedMutex&) = delete;
+  ReaderBiasedMutex& operator=(const ReaderBiasedMutex&) = delete;
+
+  ReadLock LockShared();
+
+  void lock();
+  void unlock();
+
+  // Whether readers currently take the fast path; for tests.
+  bool read_biased() const { return _read_bias.load(std::memory_order_relaxed); }
+
+ private:
+  using Slot = std::atomic<const ReaderBiasedMutex*>;
+  // Read locks of the underlying lock taken by a thread, of any ReaderBiasedMutex, and not
+  // released yet. Shared with the locks, which may be released on another thread.
+  using HeldCount = std::atomic<uint32_t>;
+
+  Slot& LocalSlot() const;
+  static const std::shared_ptr<HeldCount>& LocalHeldCount();
+
+  // The underlying lock.
+  void LockUnderlyingShared();
+  void UnlockUnderlyingShared();
+  void LockUnderlying();
+  void UnlockUnderlying();
+
+  // Held by a writer from lock() to unlock(); only readers holding it may restore the bias.
+  std::mutex _writer_mutex;
+  // Taken by readers while the bias is off, and by writers. Prefers readers.
+#if GENDB_PTHREAD_RWLOCK
+  pthread_rwlock_t _rwlock;
+#else
+  std::shared_mutex _rwlock;
+  // Read locks held on `_rwlock`, which writers wait on between their attempts to lock it.
+  std::atomic<uint32_t> _readers = 0;
+#endif
+  // Set while a writer waits for the lock; readers of threads holding no read lock wait for it.
+  std::atomic<bool> _writer_pending = false;
+  std::atomic<bool> _read_bias = true;
+  // Steady clock time, in nanoseconds, before which readers do not restore the bias.
+  std::atomic<int64_t> _inhibit_until = 0;
+};
+
+// Shared ownership of a ReaderBiasedMutex, released on destruction. Like std::shared_lock it can
+// be released and taken again with unlock() and lock(). Unlike an EpochManager section it may be
+// released on another thread than the one that took it.
+class ReaderBiasedMutex::ReadLock {
+ public:
+  ReadLock(ReadLock&& other) noexcept
+      : _mutex(other._mutex),
+        _slot(other._slot),
+        _held(std::move(other._held)),
+        _owns(std::exchange(other._owns, false)) {}
+  ReadLock& operator=(ReadLock&& other) noexcept {
+    if (this != &other) {
+      if (_owns) {
+        unlock();
+      }
+      _mutex = other._mutex;
+      _slot = other._slot;
+      _held = std::move(other._held);
+      _owns = std::exchange(other._owns, false);
+    }
+    return *this;
+  }
+  ~ReadLock() {
+    if (_owns) {
+      unlock();
+    }
+  }
+
+  // The lock must not be held.
+  void lock() { *this = _mutex->LockShared(); }
+
+  // The lock must be held.
+  void unlock() {
+    if (_slot != nullptr) {
+      _slot->store(nullptr, std::memory_order_release);
+    } else {
+      _mutex->UnlockUnderlyingShared();
+      _held->fetch_sub(1, std::memory_order_relaxed);
+      _held.reset();
+    }
+    _owns = false;
+  }
+
+ private:
+  friend class ReaderBiasedMutex;
+  ReadLock(ReaderBiasedMutex* mutex, Slot* slot, std::shared_ptr<HeldCount> held)
+      : _mutex(mutex), _slot(slot), _held(std::move(held)), _owns(true) {}
+
+  ReaderBiasedMutex* _mutex;
+  // The visible readers slot holding the lock, or null if it holds the underlying lock.
+  Slot* _slot;
+  // Count of the thread that took the underlying lock, or null.
+  std::shared_ptr<HeldCount> _held;
+  bool _owns;
+};
+
+}  // namespace gendb
@@ -0,0 +1,151 @@
+#include "gendb/reader_biased_mutex.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+namespace gendb {
+namespace {
+
+TEST(ReaderBiasedMutexTest, WriterWaitsForVisibleReaders) {
+  ReaderBiasedMutex mutex;
+  std::optional<ReaderBiasedMutex::ReadLock> read = mutex.LockShared();
+  std::atomic<bool> locked = false;
+  std::thread writer([&] {
+    std::unique_lock lock(mutex);
+    locked = true;
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  EXPECT_FALSE(locked);
+  read.reset();
+  writer.join();
+  EXPECT_TRUE(locked);
+}
+
+TEST(ReaderBiasedMutexTest, ReadersWaitForWriter) {
+  ReaderBiasedMutex mutex;
+  std::optional<std::unique_lock<ReaderBiasedMutex>> write(mutex);
+  EXPECT_FALSE(mutex.read_biased());
+  std::atomic<bool> read = false;
+  std::thread reader([&] {
+    ReaderBiasedMutex::ReadLock lock = mutex.LockShared();
+    read = true;
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  EXPECT_FALSE(read);
+  write.reset();
+  reader.join();
+  EXPECT_TRUE(read);
+}
+
+TEST(ReaderBiasedMutexTest, NestedAndMovedReadLocks) {
+  ReaderBiasedMutex mutex;
+  std::optional<ReaderBiasedMutex::ReadLock> outer = mutex.LockShared();
+  // Takes the same visible readers slot, so falls back to the underlying lock.
+  std::optional<ReaderBiasedMutex::ReadLock> inner = mutex.LockShared();
+  // Released on another thread.
+  std::thread([lock = std::move(*outer)] {}).join();
+  outer.reset();
+  inner.reset();
+  std::unique_lock lock(mutex);
+}
+
+TEST(ReaderBiasedMutexTest, NestedReadLockWhileWriterWaits) {
+  ReaderBiasedMutex mutex;
+  for (bool biased : {true, false}) {
+    EXPECT_EQ(mutex.read_biased(), biased);
+    std::optional<ReaderBiasedMutex::ReadLock> outer = mutex.LockShared();
+    std::atomic<bool> locked = false;
+    std::thread writer([&] {
+      std::unique_lock lock(mutex);
+      locked = true;
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    EXPECT_FALSE(mutex.read_biased());
+    // The writer is waiting for the outer lock, so must not hold back the inner one.
+    std::optional<ReaderBiasedMutex::ReadLock> inner = mutex.LockShared();
+    EXPECT_FALSE(locked);
+    inner.reset();
+    outer.reset();
+    writer.join();
+    EXPECT_TRUE(locked);
+  }
+}
+
+TEST(ReaderBiasedMutexTest, WaitingWriterHoldsBackNewReaders) {
+  ReaderBiasedMutex mutex;
+  for (bool biased : {true, false}) {
+    EXPECT_EQ(mutex.read_biased(), biased);
+    std::optional<ReaderBiasedMutex::ReadLock> read = mutex.LockShared();
+    std::atomic<bool> locked = false;
+    std::thread writer([&] {
+      std::unique_lock lock(mutex);
+      locked = true;
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    // Holds no read lock, so goes after the writer instead of keeping it waiting.
+    std::atomic<bool> read_later = false;
+    std::thread reader([&] {
+      ReaderBiasedMutex::ReadLock lock = mutex.LockShared();
+      EXPECT_TRUE(locked);
+      read_later = true;
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    EXPECT_FALSE(read_later);
+    read.reset();
+    writer.join();
+    reader.join();
+    EXPECT_TRUE(read_later);
+  }
+}
+
+TEST(ReaderBiasedMutexTest, BiasIsRestoredAfterInhibition) {
+  ReaderBiasedMutex mutex;
+  { std::unique_lock lock(mutex); }
+  EXPECT_FALSE(mutex.read_biased());
+  for (int i = 0; i < 1000 && !mutex.read_biased(); ++i) {
+    std::this_thread::sleep_for(std::chrono::microseconds(100));
+    ReaderBiasedMutex::ReadLock lock = mutex.LockShared();
+  }
+  EXPECT_TRUE(mutex.read_biased());
+}
+
+TEST(ReaderBiasedMutexTest, ExcludesWritersFromReaders) {
+  constexpr int kThreads = 8;
+  constexpr int kIterations = 2000;
+  ReaderBiasedMutex mutex;
+  // Writers keep both equal; readers must never see them differ.
+  int a = 0;
+  int b = 0;
+  std::atomic<int> torn_reads = 0;
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreads; ++t) {
+    threads.emplace_back([&, t] {
+      for (int i = 0; i < kIterations; ++i) {
+        if ((i + t) % 16 == 0) {
+          std::unique_lock lock(mutex);
+          ++a;
+          ++b;
+        } else {
+          ReaderBiasedMutex::ReadLock lock = mutex.LockShared();
+          if (a != b) {
+            ++torn_reads;
+          }
+        }
+      }
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(torn_reads, 0);
+  EXPECT_EQ(a, kThreads * kIterations / 16);
+}
+
+}  // namespace
+}  // namespace gendb
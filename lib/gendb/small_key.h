@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <utility>
+
+#include "gendb/bytes.h"
+
+namespace gendb {
+
+// Owning byte-string key with inline storage. Keys up to kInlineSize bytes (every fixed-size
+// primary key produced by key_codec, and most short string keys) live inside the object, longer
+// ones spill to a separate heap block. Converts implicitly to BytesConstView, so it can be passed
+// anywhere a key view is expected.
+class SmallKey {
+ public:
+  static constexpr size_t kInlineSize = 16;
+
+  SmallKey() = default;
+  explicit SmallKey(BytesConstView key) : SmallKey(key.size()) {
+    if (_size > 0) {
+      std::memcpy(data(), key.data(), _size);
+    }
+  }
+  // Uninitialized key of `size` bytes, to be filled through data().
+  explicit SmallKey(size_t size) : _size(static_cast<uint32_t>(size)) {
+    if (_size > kInlineSize) {
+      _heap = new uint8_t[_size];
+    }
+  }
+  SmallKey(const SmallKey& other) : SmallKey(other.view()) {}
+  SmallKey(SmallKey&& other) noexcept : _size(other._size) {
+    std::memcpy(_inline, other._inline, kInlineSize);
+    other._size = 0;
+  }
+  SmallKey& operator=(SmallKey other) noexcept {
+    std::swap(_size, other._size);
+    uint8_t tmp[kInlineSize];
+    std::memcpy(tmp, _inline, kInlineSize);
+    std::memcpy(_inline, other._inline, kInlineSize);
+    std::memcpy(other._inline, tmp, kInlineSize);
+    return *this;
+  }
+  ~SmallKey() {
+    if (_size > kInlineSize) {
+      delete[] _heap;
+    }
+  }
+
+  uint8_t* data() { return _size <= kInlineSize ? _inline : _heap; }
+  const uint8_t* data() const { return _size <= kInlineSize ? _inline : _heap; }
+  size_t size() const { return _size; }
+  bool empty() const { return _size == 0; }
+  bool is_inline() const { return _size <= kInlineSize; }
+  BytesConstView view() const { return {data(), _size}; }
+  operator BytesConstView() const { return view(); }
+
+  friend bool operator==(const SmallKey& a, BytesConstView b) {
+    return a._size == b.size() && (b.empty() || std::memcmp(a.data(), b.data(), b.size()) == 0);
+  }
+
+ private:
+  union {
+    uint8_t _inline[kInlineSize];
+    uint8_t* _heap;
+  };
+  uint32_t _size = 0;
+};
+
+}  // namespace gendb
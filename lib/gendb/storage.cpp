@@ -1,15 +1,176 @@
 #include "gendb/storage.h"
 
 #include <rocksdb/db.h>
+#include <rocksdb/filter_policy.h>
 #include <rocksdb/iterator.h>
 #include <rocksdb/options.h>
 #include <rocksdb/slice.h>
+#include <rocksdb/slice_transform.h>
+#include <rocksdb/table.h>
+#include <rocksdb/write_batch.h>
 
+#include <atomic>
+#include <limits>
+#include <numeric>
+#include <optional>
+#include <shared_mutex>
+
+#include "absl/strings/numbers.h"
 #include "absl/strings/str_cat.h"
+#include "gendb/status.h"
 
 namespace gendb {
 
-RocksDBStorage::RocksDBStorage(const std::string& db_path) {
+namespace {
+
+struct PinnedSlice : ValuePins::Pin {
+  rocksdb::PinnableSlice slice;
+};
+
+struct PinnedSlices : ValuePins::Pin {
+  explicit PinnedSlices(size_t count) : slices(count) {}
+  std::vector<rocksdb::PinnableSlice> slices;
+};
+
+std::atomic<uint64_t> next_storage_id = 1;
+
+BytesConstView ToBytesView(const rocksdb::Slice& slice) {
+  return {reinterpret_cast<const uint8_t*>(slice.data()), slice.size()};
+}
+
+rocksdb::Slice ToSlice(BytesConstView bytes) {
+  return {reinterpret_cast<const char*>(bytes.data()), bytes.size()};
+}
+
+// Collection N lives in column family "collection_N", except collection 0 which uses the
+// default column family. Bookkeeping such as key counts lives in kMetadataColumnFamily.
+const std::string kCollectionPrefix = "collection_";
+const std::string kMetadataColumnFamily = "gendb_metadata";
+
+std::string CountKey(size_t collection_id) { return absl::StrCat("count/", collection_id); }
+
+// In-memory count of a collection whose keys must be counted again: for databases written before
+// counts were tracked, after a DeleteRange of part of the collection, and after a Truncate that
+// failed midway.
+constexpr uint64_t kUnknownCount = std::numeric_limits<uint64_t>::max();
+
+std::string EncodeCount(uint64_t count) {
+  std::string encoded(sizeof(count), '\0');
+  WriteScalarRaw(encoded.data(), count);
+  return encoded;
+}
+
+// Returns the collection stored in column family `name`, or nullopt for non-collection families.
+std::optional<size_t> CollectionIdFromName(const std::string& name) {
+  if (name == rocksdb::kDefaultColumnFamilyName) {
+    return 0;
+  }
+  size_t collection_id;
+  if (!name.starts_with(kCollectionPrefix) ||
+      !absl::SimpleAtoi(name.substr(kCollectionPrefix.size()), &collection_id)) {
+    return std::nullopt;
+  }
+  return collection_id;
+}
+
+rocksdb::CompressionType ToRocksDBCompression(CollectionTuning::Compression compression) {
+  switch (compression) {
+    case CollectionTuning::Compression::kNone:
+      return rocksdb::kNoCompression;
+    case CollectionTuning::Compression::kSnappy:
+      return rocksdb::kSnappyCompression;
+    case CollectionTuning::Compression::kLZ4:
+      return rocksdb::kLZ4Compression;
+    case CollectionTuning::Compression::kZstd:
+      return rocksdb::kZSTD;
+    case CollectionTuning::Compression::kDefault:
+      break;
+  }
+  return rocksdb::ColumnFamilyOptions().compression;
+}
+
+rocksdb::ColumnFamilyOptions MakeColumnFamilyOptions(const CollectionTuning& tuning) {
+  rocksdb::ColumnFamilyOptions options;
+  rocksdb::BlockBasedTableOptions table_options;
+  if (tuning.bloom_bits_per_key > 0) {
+    table_options.filter_policy.reset(rocksdb::NewBloomFilterPolicy(tuning.bloom_bits_per_key));
+  }
+  if (tuning.block_size > 0) {
+    table_options.block_size = tuning.block_size;
+  }
+  options.compression = ToRocksDBCompression(tuning.compression);
+  if (tuning.prefix_length > 0) {
+    options.prefix_extractor.reset(rocksdb::NewFixedPrefixTransform(tuning.prefix_length));
+    options.memtable_prefix_bloom_size_ratio = 0.1;
+  }
+  if (tuning.optimize_point_lookup) {
+    table_options.data_block_index_type =
+        rocksdb::BlockBasedTableOptions::kDataBlockBinaryAndHash;
+    options.memtable_whole_key_filtering = true;
+    options.memtable_prefix_bloom_size_ratio = 0.1;
+  }
+  options.table_factory.reset(rocksdb::NewBlockBasedTableFactory(table_options));
+  return options;
+}
+
+// Full scans must not be restricted to one prefix when the column family has a prefix extractor.
+rocksdb::ReadOptions TotalOrderReadOptions() {
+  rocksdb::ReadOptions options;
+  options.total_order_seek = true;
+  return options;
+}
+
+class RocksDBCursor : public StorageCursor {
+ public:
+  // Null stands for a collection that does not exist yet. The cursor holds on to the column
+  // family handle, which a concurrent Truncate may replace.
+  explicit RocksDBCursor(std::shared_ptr<rocksdb::ColumnFamilyHandle> cf,
+                         std::unique_ptr<rocksdb::Iterator> it = nullptr)
+      : _cf(std::move(cf)), _it(std::move(it)) {}
+
+  // Iterates [begin, end) of `cf`, or from `begin` on if `end` is empty. RocksDB reads the bounds
+  // through the ReadOptions for the lifetime of the iterator, so the cursor owns them.
+  RocksDBCursor(rocksdb::DB& db, std::shared_ptr<rocksdb::ColumnFamilyHandle> cf,
+                BytesConstView begin, BytesConstView end, size_t readahead_size)
+      : _cf(std::move(cf)),
+        _lower_bound(begin.begin(), begin.end()),
+        _upper_bound(end.begin(), end.end()),
+        _lower_slice(ToSlice(_lower_bound)),
+        _upper_slice(ToSlice(_upper_bound)) {
+    rocksdb::ReadOptions options = TotalOrderReadOptions();
+    options.iterate_lower_bound = &_lower_slice;
+    if (!_upper_bound.empty()) {
+      options.iterate_upper_bound = &_upper_slice;
+    }
+    options.readahead_size = readahead_size;
+    _it.reset(db.NewIterator(options, _cf.get()));
+  }
+
+  void Seek(BytesConstView key) override {
+    if (_it != nullptr) {
+      _it->Seek(ToSlice(key));
+    }
+  }
+  void Next() override { _it->Next(); }
+  bool Valid() const override { return _it != nullptr && _it->Valid(); }
+  BytesConstView Key() const override { return ToBytesView(_it->key()); }
+  BytesConstView Value() const override { return ToBytesView(_it->value()); }
+
+ private:
+  // Outlives the iterator.
+  const std::shared_ptr<rocksdb::ColumnFamilyHandle> _cf;
+  const Bytes _lower_bound;
+  const Bytes _upper_bound;
+  const rocksdb::Slice _lower_slice;
+  const rocksdb::Slice _upper_slice;
+  std::unique_ptr<rocksdb::Iterator> _it;
+};
+
+}  // namespace
+
+RocksDBStorage::RocksDBStorage(const std::string& db_path,
+                               std::span<const CollectionTuning> tuning)
+    : tuning_(tuning.begin(), tuning.end()), id_(next_storage_id++) {
   rocksdb::Options options;
   options.create_if_missing = true;
   options.create_missing_column_families = true;
@@ -23,10 +184,18 @@ RocksDBStorage::RocksDBStorage(const std::string& db_path) {
     column_family_names = {rocksdb::kDefaultColumnFamilyName};
   }
 
+  if (std::find(column_family_names.begin(), column_family_names.end(), kMetadataColumnFamily) ==
+      column_family_names.end()) {
+    column_family_names.push_back(kMetadataColumnFamily);
+  }
+
   // Create column family descriptors
   std::vector<rocksdb::ColumnFamilyDescriptor> column_families;
   for (const auto& name : column_family_names) {
-    column_families.emplace_back(name, rocksdb::ColumnFamilyOptions());
+    std::optional<size_t> collection_id = CollectionIdFromName(name);
+    column_families.emplace_back(name, collection_id.has_value()
+                                           ? MakeColumnFamilyOptions(GetTuning(*collection_id))
+                                           : rocksdb::ColumnFamilyOptions());
   }
 
   std::vector<rocksdb::ColumnFamilyHandle*> handles;
@@ -38,72 +207,237 @@ RocksDBStorage::RocksDBStorage(const std::string& db_path) {
   }
 
   db_.reset(db);
-  column_families_.reserve(handles.size());
-  for (auto* handle : handles) {
-    column_families_.emplace_back(handle);
+  for (size_t i = 0; i < handles.size(); ++i) {
+    std::unique_ptr<rocksdb::ColumnFamilyHandle> handle(handles[i]);
+    const std::string& name = column_family_names[i];
+    if (name == kMetadataColumnFamily) {
+      metadata_cf_ = std::move(handle);
+      continue;
+    }
+    std::optional<size_t> collection_id = CollectionIdFromName(name);
+    if (!collection_id.has_value()) {
+      throw std::runtime_error("Unexpected column family: " + name);
+    }
+    if (*collection_id >= column_families_.size()) {
+      column_families_.resize(*collection_id + 1);
+    }
+    column_families_[*collection_id] = std::move(handle);
+  }
+  LoadCollectionCounts();
+  // Families that a failed Truncate dropped and could not create again.
+  absl::Status created = CreateColumnFamilies(column_families_.size());
+  if (!created.ok()) {
+    throw std::runtime_error("Failed to recreate RocksDB column families: " +
+                             created.ToString());
   }
 }
 
-RocksDBStorage::~RocksDBStorage() = default;
+struct RocksDBStorage::ThreadSlices {
+  std::vector<rocksdb::PinnableSlice> slices;
+  // Cleared, with the slices, when the storage is destroyed.
+  std::atomic<bool> storage_alive = true;
+};
 
+// Pinned blocks must be released before the DB is closed.
+RocksDBStorage::~RocksDBStorage() { ReleaseThreadSlices(); }
+
+// The slices move with the id their threads know them by.
 RocksDBStorage::RocksDBStorage(RocksDBStorage&& other) noexcept
     : db_(std::move(other.db_)),
+      metadata_cf_(std::move(other.metadata_cf_)),
       column_families_(std::move(other.column_families_)),
-      get_buffer_(std::move(other.get_buffer_)) {}
+      collection_counts_(std::move(other.collection_counts_)),
+      tuning_(std::move(other.tuning_)),
+      id_(std::exchange(other.id_, next_storage_id++)),
+      thread_slices_(std::move(other.thread_slices_)) {}
 
 RocksDBStorage& RocksDBStorage::operator=(RocksDBStorage&& other) noexcept {
   if (this != &other) {
-    db_ = std::move(other.db_);
+    ReleaseThreadSlices();
+    id_ = std::exchange(other.id_, next_storage_id++);
+    thread_slices_ = std::move(other.thread_slices_);
+    // Handles must go before the DB they belong to.
     column_families_ = std::move(other.column_families_);
-    get_buffer_ = std::move(other.get_buffer_);
+    metadata_cf_ = std::move(other.metadata_cf_);
+    db_ = std::move(other.db_);
+    collection_counts_ = std::move(other.collection_counts_);
+    tuning_ = std::move(other.tuning_);
   }
   return *this;
 }
 
-void RocksDBStorage::Put(const size_t collection_id, BytesConstView key, Bytes&& value) {
-  rocksdb::ColumnFamilyHandle* cf = GetOrCreateColumnFamily(collection_id);
+void RocksDBStorage::LoadCollectionCounts() {
+  collection_counts_.clear();
+  for (size_t i = 0; i < column_families_.size(); ++i) {
+    collection_counts_.push_back(std::make_unique<CollectionCount>());
+    rocksdb::PinnableSlice value;
+    rocksdb::Status status =
+        db_->Get(rocksdb::ReadOptions(), metadata_cf_.get(), CountKey(i), &value);
+    // Missing for databases written before counts were tracked, and while a range deletion or a
+    // truncation left it to be counted again.
+    collection_counts_[i]->count = status.ok() && value.size() == sizeof(uint64_t)
+                                       ? ReadScalarRaw<uint64_t>(value.data())
+                                       : kUnknownCount;
+  }
+}
 
-  rocksdb::Slice key_slice(reinterpret_cast<const char*>(key.data()), key.size());
-  rocksdb::Slice value_slice(reinterpret_cast<const char*>(value.data()), value.size());
+size_t RocksDBStorage::CountKeys(size_t collection_id) const {
+  rocksdb::ColumnFamilyHandle* cf = column_families_[collection_id].get();
+  if (cf == nullptr) {
+    return 0;
+  }
+  std::unique_ptr<rocksdb::Iterator> it(db_->NewIterator(TotalOrderReadOptions(), cf));
+
+  size_t count = 0;
+  for (it->SeekToFirst(); it->Valid(); it->Next()) {
+    ++count;
+  }
 
-  rocksdb::Status status = db_->Put(rocksdb::WriteOptions(), cf, key_slice, value_slice);
+  return count;
+}
+
+void RocksDBStorage::Put(const size_t collection_id, BytesConstView key, Bytes&& value) {
+  WriteBatch batch;
+  batch.Put(collection_id, key, std::move(value));
+  absl::Status status = Write(std::move(batch));
   if (!status.ok()) {
     throw std::runtime_error("RocksDB Put failed: " + status.ToString());
   }
 }
 
 absl::Status RocksDBStorage::Delete(const size_t collection_id, BytesConstView key) {
-  if (collection_id >= column_families_.size()) {
+  if (ColumnFamily(collection_id) == nullptr) {
     return absl::NotFoundError("Collection not found");
   }
 
+  WriteBatch batch;
+  batch.Delete(collection_id, key);
+  return Write(std::move(batch));
+}
+
+absl::Status RocksDBStorage::DeleteRange(const size_t collection_id, BytesConstView begin,
+                                         BytesConstView end) {
+  std::shared_lock families(column_families_mutex_);
+  if (collection_id >= column_families_.size() ||
+      !std::ranges::lexicographical_compare(begin, end)) {
+    return absl::OkStatus();
+  }
   rocksdb::ColumnFamilyHandle* cf = column_families_[collection_id].get();
-  rocksdb::Slice key_slice(reinterpret_cast<const char*>(key.data()), key.size());
+  if (cf == nullptr) {
+    return absl::OkStatus();
+  }
+  CollectionCount& collection_count = *collection_counts_[collection_id];
+  // Held for the seeks and the write only, so that no writer's count update lands in between.
+  std::lock_guard counts(collection_count.mutex);
+  const rocksdb::Slice begin_slice = ToSlice(begin);
+  const rocksdb::Slice end_slice = ToSlice(end);
+
+  // Three seeks tell an empty range and one covering the whole collection apart from the rest,
+  // whose keys are left to be counted when the size is next asked for.
+  std::unique_ptr<rocksdb::Iterator> it(db_->NewIterator(TotalOrderReadOptions(), cf));
+  it->Seek(begin_slice);
+  if (!it->Valid() || it->key().compare(end_slice) >= 0) {
+    if (!it->status().ok()) {
+      return absl::InternalError("RocksDB DeleteRange seek failed: " + it->status().ToString());
+    }
+    return absl::OkStatus();
+  }
+  it->Prev();
+  bool covers_all = !it->Valid();
+  if (covers_all) {
+    it->SeekToLast();
+    covers_all = it->Valid() && it->key().compare(end_slice) < 0;
+  }
+  if (!it->status().ok()) {
+    return absl::InternalError("RocksDB DeleteRange seek failed: " + it->status().ToString());
+  }
 
-  rocksdb::Status status = db_->Delete(rocksdb::WriteOptions(), cf, key_slice);
+  rocksdb::WriteBatch batch;
+  batch.DeleteRange(cf, begin_slice, end_slice);
+  const uint64_t count = covers_all ? 0 : kUnknownCount;
+  if (covers_all) {
+    batch.Put(metadata_cf_.get(), CountKey(collection_id), EncodeCount(0));
+  } else {
+    batch.Delete(metadata_cf_.get(), CountKey(collection_id));
+  }
+  rocksdb::Status status = db_->Write(rocksdb::WriteOptions(), &batch);
   if (!status.ok()) {
-    return absl::InternalError("RocksDB Delete failed: " + status.ToString());
+    return absl::InternalError("RocksDB DeleteRange failed: " + status.ToString());
   }
-
+  collection_count.count = count;
   return absl::OkStatus();
 }
 
-absl::Status RocksDBStorage::Get(const size_t collection_id, BytesConstView key,
-                                 BytesConstView& value) const {
+absl::Status RocksDBStorage::Truncate(const size_t collection_id) {
+  // Exclusive: no writer or size query holds a count.
+  std::unique_lock families(column_families_mutex_);
   if (collection_id >= column_families_.size()) {
-    return absl::NotFoundError("Collection not found");
+    return absl::OkStatus();
   }
 
-  rocksdb::ColumnFamilyHandle* cf = column_families_[collection_id].get();
-  rocksdb::Slice key_slice(reinterpret_cast<const char*>(key.data()), key.size());
+  rocksdb::WriteBatch batch;
+  if (collection_id == 0) {
+    // DeleteRange's end is exclusive, so the last key gets its own tombstone.
+    std::unique_ptr<rocksdb::Iterator> it(
+        db_->NewIterator(TotalOrderReadOptions(), column_families_[0].get()));
+    it->SeekToFirst();
+    if (it->Valid()) {
+      const std::string first = it->key().ToString();
+      it->SeekToLast();
+      batch.DeleteRange(column_families_[0].get(), first, it->key());
+      batch.Delete(column_families_[0].get(), it->key());
+    }
+    if (!it->status().ok()) {
+      return absl::InternalError("RocksDB Truncate scan failed: " + it->status().ToString());
+    }
+  } else {
+    // A column family cannot be dropped in a write batch, so the count is forgotten first: a
+    // crash before the final write leaves it to be counted again instead of wrong.
+    rocksdb::Status status =
+        db_->Delete(rocksdb::WriteOptions(), metadata_cf_.get(), CountKey(collection_id));
+    if (!status.ok()) {
+      return absl::InternalError("Failed to reset collection count: " + status.ToString());
+    }
+    collection_counts_[collection_id]->count = kUnknownCount;
+    if (column_families_[collection_id] != nullptr) {
+      status = db_->DropColumnFamily(column_families_[collection_id].get());
+      if (!status.ok()) {
+        return absl::InternalError("Failed to drop column family: " + status.ToString());
+      }
+      // Dropped: the collection is empty even if it cannot be created again below. The next
+      // write to it, or the next open, retries.
+      column_families_[collection_id].reset();
+      collection_counts_[collection_id]->count = 0;
+    }
+    rocksdb::ColumnFamilyHandle* cf_handle;
+    status = db_->CreateColumnFamily(MakeColumnFamilyOptions(GetTuning(collection_id)),
+                                     absl::StrCat(kCollectionPrefix, collection_id), &cf_handle);
+    if (!status.ok()) {
+      return absl::InternalError("Failed to recreate column family: " + status.ToString());
+    }
+    column_families_[collection_id].reset(cf_handle);
+  }
+
+  batch.Put(metadata_cf_.get(), CountKey(collection_id), EncodeCount(0));
+  rocksdb::Status status = db_->Write(rocksdb::WriteOptions(), &batch);
+  if (!status.ok()) {
+    return absl::InternalError("RocksDB Truncate failed: " + status.ToString());
+  }
+  collection_counts_[collection_id]->count = 0;
+  return absl::OkStatus();
+}
 
-  // Resize the buffer for this thread if needed
-  if (get_buffer_.size() <= collection_id) {
-    get_buffer_.resize(collection_id + 1);
+absl::Status RocksDBStorage::GetInto(const size_t collection_id, BytesConstView key,
+                                     rocksdb::PinnableSlice* slice) const {
+  const std::shared_ptr<rocksdb::ColumnFamilyHandle> cf = ColumnFamily(collection_id);
+  if (cf == nullptr) {
+    return absl::NotFoundError("Collection not found");
   }
 
-  std::string result;
-  rocksdb::Status status = db_->Get(rocksdb::ReadOptions(), cf, key_slice, &result);
+  rocksdb::Slice key_slice(reinterpret_cast<const char*>(key.data()), key.size());
+
+  // Pins the block (or memtable entry) instead of copying the value out.
+  rocksdb::Status status = db_->Get(rocksdb::ReadOptions(), cf.get(), key_slice, slice);
 
   if (status.IsNotFound()) {
     return absl::NotFoundError("Key not found");
@@ -113,74 +447,343 @@ absl::Status RocksDBStorage::Get(const size_t collection_id, BytesConstView key,
     return absl::InternalError("RocksDB Get failed: " + status.ToString());
   }
 
-  // Copy result to our buffer and return a view
-  get_buffer_[collection_id].assign(
-      reinterpret_cast<const uint8_t*>(result.data()),
-      reinterpret_cast<const uint8_t*>(result.data()) + result.size());
+  return absl::OkStatus();
+}
+
+absl::Status RocksDBStorage::Get(const size_t collection_id, BytesConstView key,
+                                 BytesConstView& value) const {
+  // One slot per collection and thread, so concurrent readers never share a buffer.
+  std::vector<rocksdb::PinnableSlice>& slots = LocalSlices();
+  if (slots.size() <= collection_id) {
+    slots.resize(collection_id + 1);
+  }
+
+  rocksdb::PinnableSlice& slot = slots[collection_id];
+  slot.Reset();
+  RETURN_IF_ERROR(GetInto(collection_id, key, &slot));
+  value = ToBytesView(slot);
+  return absl::OkStatus();
+}
 
-  value = BytesConstView(get_buffer_[collection_id]);
+std::vector<rocksdb::PinnableSlice>& RocksDBStorage::LocalSlices() const {
+  thread_local std::vector<std::pair<uint64_t, std::shared_ptr<ThreadSlices>>> local;
+  for (const auto& [storage_id, slices] : local) {
+    if (storage_id == id_) {
+      return slices->slices;
+    }
+  }
+  // First Get of this thread in this storage; forget the slices of destroyed storages.
+  std::erase_if(local, [](const auto& entry) {
+    return !entry.second->storage_alive.load(std::memory_order_acquire);
+  });
+  auto slices = std::make_shared<ThreadSlices>();
+  {
+    std::lock_guard lock(thread_slices_mutex_);
+    thread_slices_.push_back(slices);
+  }
+  return local.emplace_back(id_, std::move(slices)).second->slices;
+}
+
+void RocksDBStorage::ReleaseThreadSlices() {
+  std::lock_guard lock(thread_slices_mutex_);
+  for (const std::shared_ptr<ThreadSlices>& slices : thread_slices_) {
+    slices->slices.clear();
+    slices->storage_alive.store(false, std::memory_order_release);
+  }
+  thread_slices_.clear();
+}
+
+absl::Status RocksDBStorage::GetPinned(const size_t collection_id, BytesConstView key,
+                                       BytesConstView& value, ValuePins& pins) const {
+  auto pin = std::make_unique<PinnedSlice>();
+  RETURN_IF_ERROR(GetInto(collection_id, key, &pin->slice));
+  value = ToBytesView(pin->slice);
+  pins.Add(std::move(pin));
   return absl::OkStatus();
 }
 
+void RocksDBStorage::MultiGet(const size_t collection_id, std::span<const BytesConstView> keys,
+                              std::span<BytesConstView> values, std::span<absl::Status> statuses,
+                              ValuePins& pins) const {
+  const std::shared_ptr<rocksdb::ColumnFamilyHandle> cf = ColumnFamily(collection_id);
+  if (cf == nullptr) {
+    std::fill(statuses.begin(), statuses.end(), absl::NotFoundError("Collection not found"));
+    return;
+  }
+
+  std::vector<rocksdb::Slice> key_slices;
+  key_slices.reserve(keys.size());
+  for (BytesConstView key : keys) {
+    key_slices.emplace_back(reinterpret_cast<const char*>(key.data()), key.size());
+  }
+  auto pinned = std::make_unique<PinnedSlices>(keys.size());
+  std::vector<rocksdb::Status> rocksdb_statuses(keys.size());
+
+  // Lets RocksDB read the blocks of different keys in parallel where it is built to (async_io),
+  // so batching the lookups of many callers into one call overlaps their I/O.
+  rocksdb::ReadOptions read_options;
+  read_options.async_io = true;
+  db_->MultiGet(read_options, cf.get(), keys.size(), key_slices.data(), pinned->slices.data(),
+                rocksdb_statuses.data());
+
+  for (size_t i = 0; i < keys.size(); ++i) {
+    if (rocksdb_statuses[i].ok()) {
+      values[i] = ToBytesView(pinned->slices[i]);
+      statuses[i] = absl::OkStatus();
+    } else if (rocksdb_statuses[i].IsNotFound()) {
+      statuses[i] = absl::NotFoundError("Key not found");
+    } else {
+      statuses[i] =
+          absl::InternalError("RocksDB MultiGet failed: " + rocksdb_statuses[i].ToString());
+    }
+  }
+  pins.Add(std::move(pinned));
+}
+
 bool RocksDBStorage::Exists(const size_t collection_id, BytesConstView key) const {
-  if (collection_id >= column_families_.size()) {
+  const std::shared_ptr<rocksdb::ColumnFamilyHandle> cf = ColumnFamily(collection_id);
+  if (cf == nullptr) {
     return false;
   }
 
-  rocksdb::ColumnFamilyHandle* cf = column_families_[collection_id].get();
   rocksdb::Slice key_slice(reinterpret_cast<const char*>(key.data()), key.size());
 
-  std::string result;
-  rocksdb::Status status = db_->Get(rocksdb::ReadOptions(), cf, key_slice, &result);
+  rocksdb::PinnableSlice result;
+  rocksdb::Status status = db_->Get(rocksdb::ReadOptions(), cf.get(), key_slice, &result);
 
   return status.ok();
 }
 
+absl::Status RocksDBStorage::Write(WriteBatch&& batch) {
+  std::span<const WriteBatch::Op> ops = batch.ops();
+  size_t collections = 0;
+  for (const WriteBatch::Op& op : ops) {
+    if (!op.is_delete) {
+      collections = std::max(collections, op.collection_id + 1);
+    }
+  }
+  // The families are created under the exclusive lock, so a Clear may drop them again before
+  // the shared lock is taken.
+  std::shared_lock families(column_families_mutex_, std::defer_lock);
+  while (true) {
+    RETURN_IF_ERROR(CreateColumnFamilies(collections));
+    families.lock();
+    if (HasColumnFamilies(collections)) {
+      break;
+    }
+    families.unlock();
+  }
+  // Ops sorted by key, so that each distinct key is looked up once, and all the keys of a
+  // collection in one MultiGet.
+  std::vector<size_t> order(ops.size());
+  std::iota(order.begin(), order.end(), 0);
+  auto key_less = [&](size_t a, size_t b) {
+    if (ops[a].collection_id != ops[b].collection_id) {
+      return ops[a].collection_id < ops[b].collection_id;
+    }
+    return std::ranges::lexicographical_compare(ops[a].key, ops[b].key);
+  };
+  std::ranges::sort(order, key_less);
+  // Distinct key of each op, and the first op of each distinct key.
+  std::vector<size_t> key_of_op(ops.size());
+  std::vector<size_t> first_ops;
+  for (size_t i = 0; i < order.size(); ++i) {
+    if (i == 0 || key_less(order[i - 1], order[i])) {
+      first_ops.push_back(order[i]);
+    }
+    key_of_op[order[i]] = first_ops.size() - 1;
+  }
+
+  // The counts of the written collections, locked in collection order and held from the lookups
+  // to the count update, so that concurrent batches never both count a key that neither of them
+  // found.
+  std::vector<std::unique_lock<std::mutex>> counts;
+  // Whether each distinct key is present, before the batch and then as its ops are applied.
+  std::vector<bool> present(first_ops.size(), false);
+  std::vector<size_t> lookups;
+  std::vector<rocksdb::Slice> key_slices;
+  std::vector<rocksdb::PinnableSlice> values;
+  std::vector<rocksdb::Status> statuses;
+  std::string unused_value;
+  for (size_t begin = 0, end; begin < first_ops.size(); begin = end) {
+    const size_t collection_id = ops[first_ops[begin]].collection_id;
+    end = begin + 1;
+    while (end < first_ops.size() && ops[first_ops[end]].collection_id == collection_id) {
+      ++end;
+    }
+    if (collection_id >= column_families_.size() || column_families_[collection_id] == nullptr) {
+      continue;  // Only deletes: every written collection has a column family.
+    }
+    counts.emplace_back(collection_counts_[collection_id]->mutex);
+    rocksdb::ColumnFamilyHandle* cf = column_families_[collection_id].get();
+    lookups.clear();
+    key_slices.clear();
+    for (size_t k = begin; k < end; ++k) {
+      const rocksdb::Slice key = ToSlice(ops[first_ops[k]].key);
+      // Settled without I/O when the memtables hold the key or the filters rule it out.
+      bool value_found = false;
+      if (!db_->KeyMayExist(rocksdb::ReadOptions(), cf, key, &unused_value, &value_found)) {
+        continue;
+      }
+      if (value_found) {
+        present[k] = true;
+        continue;
+      }
+      lookups.push_back(k);
+      key_slices.push_back(key);
+    }
+    if (lookups.empty()) {
+      continue;
+    }
+    values = std::vector<rocksdb::PinnableSlice>(key_slices.size());
+    statuses.assign(key_slices.size(), rocksdb::Status());
+    db_->MultiGet(rocksdb::ReadOptions(), cf, key_slices.size(), key_slices.data(), values.data(),
+                  statuses.data());
+    for (size_t j = 0; j < lookups.size(); ++j) {
+      if (!statuses[j].ok() && !statuses[j].IsNotFound()) {
+        return absl::InternalError("RocksDB Write lookup failed: " + statuses[j].ToString());
+      }
+      present[lookups[j]] = statuses[j].ok();
+    }
+  }
+
+  rocksdb::WriteBatch rocksdb_batch;
+  // Key count changes per collection; they are written in the same batch as the data.
+  std::vector<int64_t> count_deltas(column_families_.size(), 0);
+  for (size_t i = 0; i < ops.size(); ++i) {
+    const WriteBatch::Op& op = ops[i];
+    if (op.is_delete && (op.collection_id >= column_families_.size() ||
+                         column_families_[op.collection_id] == nullptr)) {
+      continue;  // Nothing to delete in a collection without a column family.
+    }
+    rocksdb::ColumnFamilyHandle* cf = column_families_[op.collection_id].get();
+    const bool existed = present[key_of_op[i]];
+    present[key_of_op[i]] = !op.is_delete;
+
+    rocksdb::Status status;
+    if (op.is_delete) {
+      status = rocksdb_batch.Delete(cf, ToSlice(op.key));
+      count_deltas[op.collection_id] -= existed ? 1 : 0;
+    } else {
+      status = rocksdb_batch.Put(cf, ToSlice(op.key), ToSlice(op.value));
+      count_deltas[op.collection_id] += existed ? 0 : 1;
+    }
+    if (!status.ok()) {
+      return absl::InternalError("RocksDB WriteBatch failed: " + status.ToString());
+    }
+  }
+
+  // Only the counts of the locked collections change.
+  for (size_t i = 0; i < count_deltas.size(); ++i) {
+    if (count_deltas[i] == 0) {
+      continue;
+    }
+    const uint64_t count = collection_counts_[i]->count;
+    if (count != kUnknownCount) {
+      rocksdb_batch.Put(metadata_cf_.get(), CountKey(i), EncodeCount(count + count_deltas[i]));
+    }
+  }
+
+  rocksdb::Status status = db_->Write(rocksdb::WriteOptions(), &rocksdb_batch);
+  if (!status.ok()) {
+    return absl::InternalError("RocksDB Write failed: " + status.ToString());
+  }
+  for (size_t i = 0; i < count_deltas.size(); ++i) {
+    if (count_deltas[i] == 0) {
+      continue;
+    }
+    uint64_t& count = collection_counts_[i]->count;
+    if (count != kUnknownCount) {
+      count += count_deltas[i];
+    }
+  }
+  return absl::OkStatus();
+}
+
 size_t RocksDBStorage::GetCollectionCount() const {
+  std::shared_lock lock(column_families_mutex_);
   return column_families_.size();
 }
 
 size_t RocksDBStorage::GetCollectionSize(const size_t collection_id) const {
-  if (collection_id >= column_families_.size()) {
+  std::shared_lock families(column_families_mutex_);
+  if (collection_id >= collection_counts_.size()) {
     return 0;
   }
-
-  rocksdb::ColumnFamilyHandle* cf = column_families_[collection_id].get();
-  std::unique_ptr<rocksdb::Iterator> it(db_->NewIterator(rocksdb::ReadOptions(), cf));
-
-  size_t count = 0;
-  for (it->SeekToFirst(); it->Valid(); it->Next()) {
-    ++count;
+  CollectionCount& collection_count = *collection_counts_[collection_id];
+  std::lock_guard counts(collection_count.mutex);
+  uint64_t& count = collection_count.count;
+  if (count == kUnknownCount) {
+    // Writes wait for the count, so none lands between the scan and the persisted count.
+    count = CountKeys(collection_id);
+    // If this fails the keys are only counted again after a restart.
+    db_->Put(rocksdb::WriteOptions(), metadata_cf_.get(), CountKey(collection_id),
+             EncodeCount(count));
   }
-
   return count;
 }
 
-void RocksDBStorage::Clear() {
-  // Delete all column families except the default one, then recreate them
-  for (size_t i = 1; i < column_families_.size(); ++i) {
-    rocksdb::Status status = db_->DropColumnFamily(column_families_[i].get());
-    if (!status.ok()) {
-      throw std::runtime_error("Failed to drop column family: " + status.ToString());
-    }
+std::unique_ptr<StorageCursor> RocksDBStorage::NewCursor(const size_t collection_id) const {
+  std::shared_ptr<rocksdb::ColumnFamilyHandle> cf = ColumnFamily(collection_id);
+  if (cf == nullptr) {
+    return std::make_unique<RocksDBCursor>(nullptr);
+  }
+  std::unique_ptr<rocksdb::Iterator> it(db_->NewIterator(TotalOrderReadOptions(), cf.get()));
+  return std::make_unique<RocksDBCursor>(std::move(cf), std::move(it));
+}
+
+std::unique_ptr<StorageCursor> RocksDBStorage::NewRangeCursor(const size_t collection_id,
+                                                              BytesConstView begin,
+                                                              BytesConstView end,
+                                                              size_t readahead_size) const {
+  std::shared_ptr<rocksdb::ColumnFamilyHandle> cf = ColumnFamily(collection_id);
+  if (cf == nullptr) {
+    return std::make_unique<RocksDBCursor>(nullptr);
   }
+  return std::make_unique<RocksDBCursor>(*db_, std::move(cf), begin, end, readahead_size);
+}
 
-  // Clear the default column family
-  if (!column_families_.empty()) {
-    rocksdb::ColumnFamilyHandle* default_cf = column_families_[0].get();
-    std::unique_ptr<rocksdb::Iterator> it(db_->NewIterator(rocksdb::ReadOptions(), default_cf));
+size_t RocksDBStorage::EstimateCollectionSize(const size_t collection_id) const {
+  const std::shared_ptr<rocksdb::ColumnFamilyHandle> cf = ColumnFamily(collection_id);
+  if (cf == nullptr) {
+    return 0;
+  }
+  uint64_t estimate = 0;
+  if (!db_->GetIntProperty(cf.get(), rocksdb::DB::Properties::kEstimateNumKeys, &estimate)) {
+    return GetCollectionSize(collection_id);
+  }
+  return estimate;
+}
 
-    for (it->SeekToFirst(); it->Valid(); it->Next()) {
-      rocksdb::Status status = db_->Delete(rocksdb::WriteOptions(), default_cf, it->key());
+void RocksDBStorage::Clear() {
+  // Drop all column families except the default one, which cannot be dropped
+  {
+    std::unique_lock families(column_families_mutex_);
+    rocksdb::WriteBatch counts;
+    for (size_t i = 1; i < column_families_.size(); ++i) {
+      if (column_families_[i] == nullptr) {
+        counts.Delete(metadata_cf_.get(), CountKey(i));
+        continue;
+      }
+      rocksdb::Status status = db_->DropColumnFamily(column_families_[i].get());
       if (!status.ok()) {
-        throw std::runtime_error("Failed to delete key during clear: " + status.ToString());
+        throw std::runtime_error("Failed to drop column family: " + status.ToString());
       }
+      counts.Delete(metadata_cf_.get(), CountKey(i));
     }
-  }
+    column_families_.resize(1);
+    collection_counts_.resize(1);
 
-  // Keep only the default column family
-  column_families_.resize(1);
-  get_buffer_.clear();
+    rocksdb::Status status = db_->Write(rocksdb::WriteOptions(), &counts);
+    if (!status.ok()) {
+      throw std::runtime_error("Failed to reset collection counts: " + status.ToString());
+    }
+  }
+  absl::Status truncate_status = Truncate(0);
+  if (!truncate_status.ok()) {
+    throw std::runtime_error("Failed to clear the default column family: " +
+                             truncate_status.ToString());
+  }
 }
 
 std::string RocksDBStorage::MakeCollectionKey(size_t collection_id, BytesConstView key) const {
@@ -188,22 +791,53 @@ std::string RocksDBStorage::MakeCollectionKey(size_t collection_id, BytesConstVi
                       std::string(reinterpret_cast<const char*>(key.data()), key.size()));
 }
 
-rocksdb::ColumnFamilyHandle* RocksDBStorage::GetOrCreateColumnFamily(size_t collection_id) {
-  // Ensure we have enough column families
-  while (collection_id >= column_families_.size()) {
-    std::string cf_name = "collection_" + std::to_string(column_families_.size());
-
+absl::Status RocksDBStorage::CreateColumnFamilies(size_t count) {
+  {
+    std::shared_lock lock(column_families_mutex_);
+    if (HasColumnFamilies(count)) {
+      return absl::OkStatus();
+    }
+  }
+  std::unique_lock lock(column_families_mutex_);
+  if (column_families_.size() < count) {
+    column_families_.resize(count);
+  }
+  while (collection_counts_.size() < column_families_.size()) {
+    collection_counts_.push_back(std::make_unique<CollectionCount>());
+  }
+  for (size_t i = 0; i < count; ++i) {
+    if (column_families_[i] != nullptr) {
+      continue;
+    }
     rocksdb::ColumnFamilyHandle* cf_handle;
-    rocksdb::Status status =
-        db_->CreateColumnFamily(rocksdb::ColumnFamilyOptions(), cf_name, &cf_handle);
+    rocksdb::Status status = db_->CreateColumnFamily(MakeColumnFamilyOptions(GetTuning(i)),
+                                                     absl::StrCat(kCollectionPrefix, i), &cf_handle);
     if (!status.ok()) {
-      throw std::runtime_error("Failed to create column family: " + status.ToString());
+      // The collections without a family stay empty until a later write creates it.
+      return absl::InternalError("Failed to create column family: " + status.ToString());
     }
+    column_families_[i].reset(cf_handle);
+  }
+  return absl::OkStatus();
+}
 
-    column_families_.emplace_back(cf_handle);
+bool RocksDBStorage::HasColumnFamilies(size_t count) const {
+  if (count > column_families_.size()) {
+    return false;
   }
+  return std::all_of(column_families_.begin(), column_families_.begin() + count,
+                     [](const auto& cf) { return cf != nullptr; });
+}
+
+std::shared_ptr<rocksdb::ColumnFamilyHandle> RocksDBStorage::ColumnFamily(
+    size_t collection_id) const {
+  std::shared_lock lock(column_families_mutex_);
+  return collection_id < column_families_.size() ? column_families_[collection_id] : nullptr;
+}
 
-  return column_families_[collection_id].get();
+const CollectionTuning& RocksDBStorage::GetTuning(size_t collection_id) const {
+  static const CollectionTuning kDefaultTuning;
+  return collection_id < tuning_.size() ? tuning_[collection_id] : kDefaultTuning;
 }
 
-}  // namespace gendb
\ No newline at end of file
+}  // namespace gendb
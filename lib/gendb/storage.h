@@ -1,26 +1,113 @@
 #pragma once
 
+#include <algorithm>
+#include <cstdint>
 #include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <span>
 #include <string>
-#include <unordered_map>
+#include <utility>
 #include <vector>
 
-#include "absl/hash/hash.h"
 #include "absl/status/status.h"
 #include "gendb/bytes.h"
+#include "gendb/flat_hash_map.h"
 
 // Forward declaration for RocksDB
 namespace rocksdb {
 class DB;
 class ColumnFamilyHandle;
+class PinnableSlice;
 }  // namespace rocksdb
 
 namespace gendb {
 
+// Keeps backend-owned read buffers (e.g. RocksDB pinned blocks) alive for as long as the views
+// handed out against them. Owned by one reader at a time, which releases them with Clear() once
+// it is done with the views, typically before its next read.
+class ValuePins {
+ public:
+  struct Pin {
+    virtual ~Pin() = default;
+  };
+
+  void Add(std::unique_ptr<Pin> pin) { _pins.push_back(std::move(pin)); }
+
+  // Does not write when empty, as with in-memory backends, so concurrent readers of those can
+  // share a holder.
+  void Clear() {
+    if (!_pins.empty()) {
+      _pins.clear();
+    }
+  }
+
+  // Takes over the pins of `other`.
+  void Append(ValuePins&& other) {
+    _pins.insert(_pins.end(), std::make_move_iterator(other._pins.begin()),
+                 std::make_move_iterator(other._pins.end()));
+    other._pins.clear();
+  }
+
+  size_t size() const { return _pins.size(); }
+
+ private:
+  std::vector<std::unique_ptr<Pin>> _pins;
+};
+
+// Writes that Storage::Write applies as one atomic unit, in insertion order. Keys are views and
+// must stay valid until the batch is written.
+class WriteBatch {
+ public:
+  struct Op {
+    size_t collection_id;
+    BytesConstView key;
+    Bytes value;
+    bool is_delete;
+  };
+
+  void Put(size_t collection_id, BytesConstView key, Bytes&& value) {
+    _ops.push_back({collection_id, key, std::move(value), /*is_delete=*/false});
+  }
+  void Delete(size_t collection_id, BytesConstView key) {
+    _ops.push_back({collection_id, key, Bytes{}, /*is_delete=*/true});
+  }
+
+  void Reserve(size_t count) { _ops.reserve(count); }
+  size_t size() const { return _ops.size(); }
+  bool empty() const { return _ops.empty(); }
+  std::vector<Op>& ops() { return _ops; }
+  const std::vector<Op>& ops() const { return _ops; }
+
+ private:
+  std::vector<Op> _ops;
+};
+
+// True if begin <= key < end, comparing unsigned bytes lexicographically like RocksDB's default
+// comparator.
+inline bool KeyInRange(BytesConstView key, BytesConstView begin, BytesConstView end) {
+  return !std::ranges::lexicographical_compare(key, begin) &&
+         std::ranges::lexicographical_compare(key, end);
+}
+
+// Forward cursor over one collection in key order (see KeyInRange). Key() and Value() stay valid
+// until the cursor moves or the storage is written.
+class StorageCursor {
+ public:
+  virtual ~StorageCursor() = default;
+
+  // Position at the first key not less than `key`.
+  virtual void Seek(BytesConstView key) = 0;
+  virtual void Next() = 0;
+  virtual bool Valid() const = 0;
+  virtual BytesConstView Key() const = 0;
+  virtual BytesConstView Value() const = 0;
+};
+
 // Abstract base class for storage backends
 class Storage {
  public:
-  using Collection = std::unordered_map<Bytes, Bytes, BytesHash, BytesEqual>;
+  using Collection = FlatHashMap<Bytes>;
 
   virtual ~Storage() = default;
 
@@ -30,24 +117,90 @@ class Storage {
   // Delete a key from the specified collection
   virtual absl::Status Delete(const size_t collection_id, BytesConstView key) = 0;
 
+  // Delete every key in [begin, end) of the collection. Keys are ordered bytewise (see
+  // KeyInRange), which for key_codec keys is the order of the encoded primary key tuples.
+  virtual absl::Status DeleteRange(const size_t collection_id, BytesConstView begin,
+                                   BytesConstView end) = 0;
+
+  // Delete every key of the collection.
+  virtual absl::Status Truncate(const size_t collection_id) = 0;
+
   // Get a value by key from the specified collection
   virtual absl::Status Get(const size_t collection_id, BytesConstView key,
                            BytesConstView& value) const = 0;
 
+  // Like Get, but `value` stays valid for as long as `pins` does. Backends that own their values
+  // (the in-memory ones) leave `pins` untouched.
+  virtual absl::Status GetPinned(const size_t collection_id, BytesConstView key,
+                                 BytesConstView& value, ValuePins& /*pins*/) const {
+    return Get(collection_id, key, value);
+  }
+
+  // Batched GetPinned: looks up `keys[i]` into `values[i]` and `statuses[i]`. All spans must have
+  // the same size.
+  virtual void MultiGet(const size_t collection_id, std::span<const BytesConstView> keys,
+                        std::span<BytesConstView> values, std::span<absl::Status> statuses,
+                        ValuePins& pins) const {
+    for (size_t i = 0; i < keys.size(); ++i) {
+      statuses[i] = GetPinned(collection_id, keys[i], values[i], pins);
+    }
+  }
+
+  // True if reads may wait for I/O, so that callers able to overlap them (see AsyncReadQueue)
+  // should batch them instead of reading inline.
+  virtual bool ReadsBlock() const { return false; }
+
   // Check if a key exists in the specified collection
   virtual bool Exists(const size_t collection_id, BytesConstView key) const = 0;
 
+  // Apply every write in `batch` atomically. Deleting a missing key is not an error. Values are
+  // only moved out of `batch` when it is applied: a rejected batch keeps them. The default
+  // applies the writes one by one, which is atomic for in-memory backends under the writer lock.
+  virtual absl::Status Write(WriteBatch&& batch) {
+    for (WriteBatch::Op& op : batch.ops()) {
+      if (op.is_delete) {
+        (void)Delete(op.collection_id, op.key);
+      } else {
+        Put(op.collection_id, op.key, std::move(op.value));
+      }
+    }
+    return absl::OkStatus();
+  }
+
   // Get the number of collections
   virtual size_t GetCollectionCount() const = 0;
 
   // Get the size of a specific collection
   virtual size_t GetCollectionSize(const size_t collection_id) const = 0;
 
+  // Cursor over the collection in key order, or nullptr if the backend does not keep keys
+  // ordered.
+  virtual std::unique_ptr<StorageCursor> NewCursor(const size_t /*collection_id*/) const {
+    return nullptr;
+  }
+
+  // Cursor for a scan of the keys in [begin, end) of the collection, an empty `end` meaning no
+  // upper bound, that may read up to `readahead_size` bytes ahead (0 for the backend's default).
+  // Callers still Seek to `begin` and stop at `end`: backends that cannot bound their cursors
+  // return NewCursor.
+  virtual std::unique_ptr<StorageCursor> NewRangeCursor(const size_t collection_id,
+                                                        BytesConstView /*begin*/,
+                                                        BytesConstView /*end*/,
+                                                        size_t /*readahead_size*/) const {
+    return NewCursor(collection_id);
+  }
+
+  // Cheap approximation of GetCollectionSize for storages that can only estimate quickly.
+  virtual size_t EstimateCollectionSize(const size_t collection_id) const {
+    return GetCollectionSize(collection_id);
+  }
+
   // Clear all data from all collections
   virtual void Clear() = 0;
 };
 
-// In-memory storage implementation
+// In-memory storage implementation. Each collection is an open-addressing FlatHashMap keyed by the
+// encoded primary key.
 class MemoryStorage : public Storage {
  public:
   std::vector<Collection> collections;
@@ -56,21 +209,40 @@ class MemoryStorage : public Storage {
     if (collection_id >= collections.size()) {
       collections.resize(collection_id + 1);
     }
-    auto& coll = collections[collection_id];
-    // TODO(perf): can we build the pair in-place?
-    coll[Bytes{key.begin(), key.end()}] = std::move(value);
+    collections[collection_id].insert_or_assign(key, std::move(value));
   }
 
   absl::Status Delete(const size_t collection_id, BytesConstView key) override {
     if (collection_id >= collections.size()) {
       return absl::NotFoundError("Collection not found");
     }
-    auto& coll = collections[collection_id];
-    auto it = coll.find(Bytes{key.begin(), key.end()});
-    if (it == coll.end()) {
+    if (collections[collection_id].erase(key) == 0) {
       return absl::NotFoundError("Key not found");
     }
-    coll.erase(it);
+    return absl::OkStatus();
+  }
+
+  absl::Status DeleteRange(const size_t collection_id, BytesConstView begin,
+                           BytesConstView end) override {
+    if (collection_id >= collections.size()) {
+      return absl::OkStatus();
+    }
+    // Unordered: every key is tested. Erasing only invalidates the erased iterator.
+    auto& coll = collections[collection_id];
+    for (auto it = coll.begin(); it != coll.end();) {
+      auto current = it;
+      ++it;
+      if (KeyInRange(current->key, begin, end)) {
+        coll.erase(current);
+      }
+    }
+    return absl::OkStatus();
+  }
+
+  absl::Status Truncate(const size_t collection_id) override {
+    if (collection_id < collections.size()) {
+      collections[collection_id].clear();
+    }
     return absl::OkStatus();
   }
 
@@ -80,20 +252,52 @@ class MemoryStorage : public Storage {
       return absl::NotFoundError("Collection not found");
     }
     const auto& coll = collections[collection_id];
-    auto it = coll.find(Bytes{key.begin(), key.end()});
+    auto it = coll.find(key);
     if (it == coll.end()) {
       return absl::NotFoundError("Key not found");
     }
-    value = BytesConstView{it->second};
+    value = BytesConstView{it->value};
     return absl::OkStatus();
   }
 
+  // Interleaved, prefetched hash probes (see FlatHashMap::FindBatch).
+  void MultiGet(const size_t collection_id, std::span<const BytesConstView> keys,
+                std::span<BytesConstView> values, std::span<absl::Status> statuses,
+                ValuePins& /*pins*/) const override {
+    if (collection_id >= collections.size()) {
+      std::fill(statuses.begin(), statuses.end(), absl::NotFoundError("Collection not found"));
+      return;
+    }
+    const auto& coll = collections[collection_id];
+    coll.FindBatch(keys, [&](size_t i, Collection::const_iterator it) {
+      if (it == coll.end()) {
+        statuses[i] = absl::NotFoundError("Key not found");
+      } else {
+        values[i] = BytesConstView{it->value};
+        statuses[i] = absl::OkStatus();
+      }
+    });
+  }
+
   bool Exists(const size_t collection_id, BytesConstView key) const override {
     if (collection_id >= collections.size()) {
       return false;
     }
+    return collections[collection_id].contains(key);
+  }
+
+  // Pointer to the stored value, or nullptr if the key is absent. Unlike Get, a miss does not
+  // build an error status.
+  const Bytes* Find(const size_t collection_id, BytesConstView key) const {
+    if (collection_id >= collections.size()) {
+      return nullptr;
+    }
     const auto& coll = collections[collection_id];
-    return coll.find(Bytes{key.begin(), key.end()}) != coll.end();
+    auto it = coll.find(key);
+    return it == coll.end() ? nullptr : &it->value;
+  }
+  Bytes* Find(const size_t collection_id, BytesConstView key) {
+    return const_cast<Bytes*>(std::as_const(*this).Find(collection_id, key));
   }
 
   size_t GetCollectionCount() const override { return collections.size(); }
@@ -108,11 +312,30 @@ class MemoryStorage : public Storage {
   void Clear() override { collections.clear(); }
 };
 
+// RocksDB column family tuning of one collection. Zero values keep RocksDB's defaults. Generated
+// databases emit one per collection from the `storage:` block of db.yaml.
+struct CollectionTuning {
+  enum class Compression : uint8_t { kDefault, kNone, kSnappy, kLZ4, kZstd };
+
+  // Bits per key of the block-based bloom filter; 0 disables the filter.
+  double bloom_bits_per_key = 0;
+  // Uncompressed data block size in bytes.
+  size_t block_size = 0;
+  Compression compression = Compression::kDefault;
+  // Length of the fixed key prefix used for prefix bloom filters, typically the encoded width of
+  // the leading primary key fields. Iterators ignore it and always scan in total order.
+  size_t prefix_length = 0;
+  // Hash index inside data blocks plus a whole-key memtable bloom filter.
+  bool optimize_point_lookup = false;
+};
+
 // RocksDB storage implementation
 class RocksDBStorage : public Storage {
  public:
-  // Constructor that takes a database path
-  explicit RocksDBStorage(const std::string& db_path);
+  // Constructor that takes a database path. `tuning[i]` configures the column family of
+  // collection i; collections beyond the span use RocksDB's defaults.
+  explicit RocksDBStorage(const std::string& db_path,
+                          std::span<const CollectionTuning> tuning = {});
 
   // Destructor
   ~RocksDBStorage() override;
@@ -129,25 +352,113 @@ class RocksDBStorage : public Storage {
 
   absl::Status Delete(const size_t collection_id, BytesConstView key) override;
 
+  // One range tombstone instead of a tombstone per key, written after a few seeks; the keys in the
+  // range are not visited. Unless the range is empty or covers the whole collection, its count is
+  // forgotten and GetCollectionSize counts the keys again.
+  absl::Status DeleteRange(const size_t collection_id, BytesConstView begin,
+                           BytesConstView end) override;
+
+  // Drops and recreates the collection's column family. Collection 0 lives in the default column
+  // family, which cannot be dropped, and is covered by a single range tombstone instead. If the
+  // family is dropped but cannot be created again, the collection reads as empty and its next
+  // write, or the next open, creates it.
+  absl::Status Truncate(const size_t collection_id) override;
+
+  // The value lives in a slot of the calling thread in this storage and stays valid until the
+  // thread's next Get on the same collection of this storage. Use GetPinned for views that must
+  // outlive that.
   absl::Status Get(const size_t collection_id, BytesConstView key,
                    BytesConstView& value) const override;
 
+  // Zero-copy: `value` points into a rocksdb::PinnableSlice owned by `pins`.
+  absl::Status GetPinned(const size_t collection_id, BytesConstView key, BytesConstView& value,
+                         ValuePins& pins) const override;
+
+  // One rocksdb::DB::MultiGet call; the pinned values are owned by `pins`.
+  void MultiGet(const size_t collection_id, std::span<const BytesConstView> keys,
+                std::span<BytesConstView> values, std::span<absl::Status> statuses,
+                ValuePins& pins) const override;
+
+  // Reads that miss the block cache go to disk.
+  bool ReadsBlock() const override { return true; }
+
   bool Exists(const size_t collection_id, BytesConstView key) const override;
 
+  // Applies the batch as a single rocksdb::WriteBatch: one WAL append, all or nothing. Column
+  // families of new collections are created first. The counts need the keys' previous presence,
+  // which costs a read per written key: KeyMayExist settles the keys the memtables and filters
+  // can, without I/O, and the rest are read with one MultiGet per collection, so overwrites cost
+  // a point read on top of the write. Batches writing a common collection are serialized from
+  // those reads to the write; batches on disjoint collections are not.
+  absl::Status Write(WriteBatch&& batch) override;
+
   size_t GetCollectionCount() const override;
 
+  // Iterates the column family in total order, ignoring any prefix extractor.
+  std::unique_ptr<StorageCursor> NewCursor(const size_t collection_id) const override;
+
+  // Sets the iterator's bounds, so that RocksDB skips the files and blocks outside of them, and
+  // its readahead for the sequential reads of the scan.
+  std::unique_ptr<StorageCursor> NewRangeCursor(const size_t collection_id, BytesConstView begin,
+                                                BytesConstView end,
+                                                size_t readahead_size) const override;
+
+  // Exact key count, kept in memory and persisted in a metadata column family in the same
+  // rocksdb::WriteBatch as the writes that change it. Counts the keys, once, for databases
+  // written before counts were tracked, after a DeleteRange of part of the collection and after
+  // a Truncate that failed midway.
   size_t GetCollectionSize(const size_t collection_id) const override;
 
+  // RocksDB's "rocksdb.estimate-num-keys"; may be off after overwrites and deletes.
+  size_t EstimateCollectionSize(const size_t collection_id) const override;
+
   void Clear() override;
 
  private:
+  struct ThreadSlices;
+
+  // Key count of a collection; counted again by GetCollectionSize when unknown. The mutex
+  // serializes the collection's writers from their presence reads to their count update.
+  struct CollectionCount {
+    std::mutex mutex;
+    uint64_t count = 0;
+  };
+
   std::unique_ptr<rocksdb::DB> db_;
-  std::vector<std::unique_ptr<rocksdb::ColumnFamilyHandle>> column_families_;
-  mutable std::vector<Bytes> get_buffer_;  // Thread-local buffer for Get operations
+  std::unique_ptr<rocksdb::ColumnFamilyHandle> metadata_cf_;
+  // Grown by Write, replaced by Truncate and Clear. Readers that do not hold the mutex across
+  // their RocksDB calls hold a handle instead: RocksDB keeps a dropped column family readable
+  // until its last handle is deleted. Null for a collection whose family a Truncate dropped but
+  // could not create again.
+  mutable std::shared_mutex column_families_mutex_;
+  std::vector<std::shared_ptr<rocksdb::ColumnFamilyHandle>> column_families_;
+  // One per column family, grown and replaced with them. The mutexes are taken after
+  // column_families_mutex_, in collection order when a batch writes several.
+  std::vector<std::unique_ptr<CollectionCount>> collection_counts_;
+  std::vector<CollectionTuning> tuning_;
 
   // Helper methods
+  void LoadCollectionCounts();
+  size_t CountKeys(size_t collection_id) const;
+  absl::Status GetInto(size_t collection_id, BytesConstView key,
+                       rocksdb::PinnableSlice* slice) const;
   std::string MakeCollectionKey(size_t collection_id, BytesConstView key) const;
-  rocksdb::ColumnFamilyHandle* GetOrCreateColumnFamily(size_t collection_id);
+  // Creates the column families of collections below `count` that have none yet.
+  absl::Status CreateColumnFamilies(size_t count);
+  // Whether every collection below `count` has a column family. Under column_families_mutex_.
+  bool HasColumnFamilies(size_t count) const;
+  // The collection's column family, or null if it has none.
+  std::shared_ptr<rocksdb::ColumnFamilyHandle> ColumnFamily(size_t collection_id) const;
+  const CollectionTuning& GetTuning(size_t collection_id) const;
+  // Get's slices of the calling thread, one per collection.
+  std::vector<rocksdb::PinnableSlice>& LocalSlices() const;
+  // Releases the slices of every thread, which must not be reading.
+  void ReleaseThreadSlices();
+
+  // Identifies the storage to the threads holding Get slices of it.
+  uint64_t id_;
+  mutable std::mutex thread_slices_mutex_;
+  mutable std::vector<std::shared_ptr<ThreadSlices>> thread_slices_;
 };
 
 }  // namespace gendb
\ No newline at end of file
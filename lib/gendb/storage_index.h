@@ -0,0 +1,310 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <compare>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "gendb/bytes.h"
+#include "gendb/iterator.h"
+#include "gendb/key_codec.h"
+#include "gendb/layered_storage.h"
+#include "gendb/storage.h"
+#include "gendb/versioned_storage.h"
+#include "gendb/wal.h"
+
+namespace gendb {
+
+// Primary key of a StorageIndex record: what follows the encoded secondary key.
+template <typename SecKey>
+BytesConstView StorageIndexPrimaryKey(BytesConstView record_key) {
+  if constexpr (std::is_convertible_v<const SecKey&, std::string_view>) {
+    internal::key_codec::ReadStringView(record_key);
+  } else {
+    internal::key_codec::DecodeField<SecKey>(record_key);
+  }
+  return record_key;
+}
+
+// Scan of the records of a StorageIndex in [begin, end), an empty `end` meaning no upper bound.
+// Records are read from a bounded cursor a batch at a time, with the records a writer staged in
+// the range merged over them, and their messages with one MultiGet per batch, so the scan holds
+// at most a batch of keys whatever the size of the range.
+template <typename T, typename SecKey>
+class StorageIndexIterator : public IteratorImpl<T> {
+ public:
+  static constexpr size_t kBatchSize = 64;
+
+  // Reads the messages at `keys`, like Storage::MultiGet on the indexed collection.
+  using MultiGetFn =
+      std::function<void(std::span<const BytesConstView> keys, std::span<BytesConstView> values,
+                         std::span<absl::Status> statuses, ValuePins& pins)>;
+  // Record keys staged by a writer in key order, each true for an insert and false for an erase.
+  using StagedRecords = std::vector<std::pair<Bytes, bool>>;
+
+  StorageIndexIterator(std::unique_ptr<StorageCursor> cursor, MultiGetFn multi_get,
+                       BytesConstView begin, Bytes end, StagedRecords staged = {})
+      : _cursor(std::move(cursor)),
+        _multi_get(std::move(multi_get)),
+        _end(std::move(end)),
+        _staged(std::move(staged)) {
+    if (_cursor == nullptr) {
+      _status = absl::FailedPreconditionError("Storage does not keep keys ordered");
+      return;
+    }
+    _cursor->Seek(begin);
+    LoadCurrent();
+  }
+
+  T Value() override { return _current_value.value(); }
+
+  void Next() override { LoadCurrent(); }
+
+  bool Valid() const override { return _current_value.has_value(); }
+
+  absl::Status Status() const override { return _status; }
+
+ private:
+  void LoadCurrent() {
+    _current_value.reset();
+    while (_status.ok()) {
+      if (_position == _keys.size()) {
+        if (!FillBatch()) {
+          _status = absl::OutOfRangeError("End of iterator");
+        }
+        continue;
+      }
+      const size_t i = _position++;
+      // Deleted since the cursor read its record.
+      if (absl::IsNotFound(_statuses[i])) {
+        continue;
+      }
+      if (!_statuses[i].ok()) {
+        _status = _statuses[i];
+        return;
+      }
+      _current_value = T{_values[i]};
+      return;
+    }
+  }
+
+  bool CursorInRange() const {
+    return _cursor->Valid() &&
+           (_end.empty() ||
+            std::ranges::lexicographical_compare(_cursor->Key(), BytesConstView(_end)));
+  }
+
+  void AddRecord(BytesConstView record_key) {
+    const BytesConstView prim_key = StorageIndexPrimaryKey<SecKey>(record_key);
+    _prim_keys.emplace_back(prim_key.begin(), prim_key.end());
+  }
+
+  // Copies the primary keys of the next records off the cursor and the staged records, then reads
+  // their messages in one batched lookup. False at the end of the range.
+  bool FillBatch() {
+    _prim_keys.clear();
+    _position = 0;
+    while (_prim_keys.size() < kBatchSize) {
+      const bool from_cursor = CursorInRange();
+      const bool from_staged = _staged_position < _staged.size();
+      if (!from_cursor && !from_staged) {
+        break;
+      }
+      const auto order = !from_staged ? std::strong_ordering::less
+                         : !from_cursor
+                             ? std::strong_ordering::greater
+                             : std::lexicographical_compare_three_way(
+                                   _cursor->Key().begin(), _cursor->Key().end(),
+                                   _staged[_staged_position].first.begin(),
+                                   _staged[_staged_position].first.end());
+      if (order < 0) {
+        AddRecord(_cursor->Key());
+        _cursor->Next();
+        continue;
+      }
+      // The writer's record replaces the committed one.
+      if (order == 0) {
+        _cursor->Next();
+      }
+      const auto& [record_key, inserted] = _staged[_staged_position++];
+      if (inserted) {
+        AddRecord(record_key);
+      }
+    }
+    _keys.assign(_prim_keys.begin(), _prim_keys.end());
+    _values.assign(_keys.size(), BytesConstView{});
+    _statuses.assign(_keys.size(), absl::OkStatus());
+    _pins.Clear();
+    _multi_get(_keys, _values, _statuses, _pins);
+    return !_keys.empty();
+  }
+
+  std::unique_ptr<StorageCursor> _cursor;
+  const MultiGetFn _multi_get;
+  const Bytes _end;
+  const StagedRecords _staged;
+  size_t _staged_position = 0;
+  std::vector<Bytes> _prim_keys;
+  std::vector<BytesConstView> _keys;
+  std::vector<BytesConstView> _values;
+  std::vector<absl::Status> _statuses;
+  // Keeps the messages of the current batch alive on backends that pin read buffers.
+  ValuePins _pins;
+  size_t _position = 0;
+  std::optional<T> _current_value;
+  absl::Status _status = absl::OkStatus();
+};
+
+// Secondary index kept in a collection of the storage, for databases whose data lives in a
+// persistent backend: in RocksDBStorage, the index is a column family next to the one of the
+// collection it indexes, and does not have to be rebuilt in memory on open. A record's key is the
+// key_codec encoding of the secondary key followed by the primary key, so records sort by
+// (sec_key, prim_key) and a range of secondary keys is a range of storage keys. Writers stage
+// records in their temp storage along with the messages, and LayeredStorage::MergeTempStorage
+// commits both in one atomic Storage::Write.
+template <typename SecKey>
+class StorageIndex {
+ public:
+  // How far a scan lets RocksDB read ahead of the records it returns.
+  static constexpr size_t kReadaheadSize = 256 * 1024;
+
+  // The records of the messages of `collection_id` are kept in `index_collection_id`.
+  StorageIndex(size_t index_collection_id, size_t collection_id)
+      : _index_collection_id(index_collection_id), _collection_id(collection_id) {}
+
+  size_t index_collection_id() const { return _index_collection_id; }
+  size_t collection_id() const { return _collection_id; }
+
+  static Bytes RecordKey(const SecKey& sec_key, BytesConstView prim_key) {
+    Bytes key = internal::key_codec::EncodeTuple(std::tuple<const SecKey&>(sec_key));
+    key.insert(key.end(), prim_key.begin(), prim_key.end());
+    return key;
+  }
+
+  // Stages the record of the message at `prim_key` in a writer's temp storage, and logs it to
+  // `wal_batch` if given.
+  void Insert(MemoryStorage& temp_storage, const SecKey& sec_key, BytesConstView prim_key,
+              WalBatch* wal_batch = nullptr) const {
+    Bytes key = RecordKey(sec_key, prim_key);
+    if (wal_batch != nullptr) {
+      wal_batch->Put(_index_collection_id, key, kRecordValue);
+    }
+    // Any non-empty value: an empty one marks a deletion in the temp storage.
+    temp_storage.Put(_index_collection_id, key, Bytes(kRecordValue.begin(), kRecordValue.end()));
+  }
+
+  // Stages the removal of the record of the message at `prim_key`.
+  void Erase(MemoryStorage& temp_storage, const SecKey& sec_key, BytesConstView prim_key,
+             WalBatch* wal_batch = nullptr) const {
+    Bytes key = RecordKey(sec_key, prim_key);
+    if (wal_batch != nullptr) {
+      wal_batch->Delete(_index_collection_id, key);
+    }
+    temp_storage.Put(_index_collection_id, key, Bytes{});
+  }
+
+  // Messages with min <= sec_key < max, or sec_key <= max with `include_max`, in (sec_key,
+  // prim_key) order. Reads the records committed to `storage`, not those staged by a writer.
+  template <typename MessageT>
+  Iterator<MessageT> Range(const Storage& storage, const SecKey& min, const SecKey& max,
+                           bool include_max, size_t readahead_size = kReadaheadSize) const {
+    auto [begin, end] = Bounds(min, max, include_max);
+    return Iterator<MessageT>(std::make_unique<StorageIndexIterator<MessageT, SecKey>>(
+        storage.NewRangeCursor(_index_collection_id, begin, end, readahead_size),
+        [&storage, collection_id = _collection_id](auto keys, auto values, auto statuses,
+                                                    ValuePins& pins) {
+          storage.MultiGet(collection_id, keys, values, statuses, pins);
+        },
+        begin, std::move(end)));
+  }
+
+  // Same, as of `snapshot`, which outlives the iterator.
+  template <typename MessageT>
+  Iterator<MessageT> Range(const StorageSnapshot& snapshot, const SecKey& min, const SecKey& max,
+                           bool include_max) const {
+    auto [begin, end] = Bounds(min, max, include_max);
+    return Iterator<MessageT>(std::make_unique<StorageIndexIterator<MessageT, SecKey>>(
+        snapshot.NewCursor(_index_collection_id),
+        [&snapshot, collection_id = _collection_id](auto keys, auto values, auto statuses,
+                                                     ValuePins& pins) {
+          // The batch's copies of latest values are freed with it rather than kept by the
+          // snapshot until it closes.
+          auto copies = std::make_unique<ReadCopiesPin>();
+          snapshot.MultiGet(collection_id, keys, values, statuses, copies->copies);
+          pins.Add(std::move(copies));
+        },
+        begin, std::move(end)));
+  }
+
+  // Same, for a writer: the records committed to `storage` with those it staged in
+  // `temp_storage` over them, and the messages read through `layered_storage`, which has its own.
+  template <typename MessageT>
+  Iterator<MessageT> Range(const Storage& storage, const MemoryStorage& temp_storage,
+                           const LayeredStorage& layered_storage, const SecKey& min,
+                           const SecKey& max, bool include_max,
+                           size_t readahead_size = kReadaheadSize) const {
+    auto [begin, end] = Bounds(min, max, include_max);
+    typename StorageIndexIterator<MessageT, SecKey>::StagedRecords staged;
+    if (_index_collection_id < temp_storage.collections.size()) {
+      for (const auto& [key, value] : temp_storage.collections[_index_collection_id]) {
+        if (!std::ranges::lexicographical_compare(key.view(), BytesConstView(begin)) &&
+            (end.empty() || std::ranges::lexicographical_compare(key.view(), BytesConstView(end)))) {
+          staged.emplace_back(Bytes(key.view().begin(), key.view().end()), !value.empty());
+        }
+      }
+    }
+    std::ranges::sort(staged, std::ranges::lexicographical_compare,
+                      [](const auto& record) -> const Bytes& { return record.first; });
+    return Iterator<MessageT>(std::make_unique<StorageIndexIterator<MessageT, SecKey>>(
+        storage.NewRangeCursor(_index_collection_id, begin, end, readahead_size),
+        [&layered_storage, collection_id = _collection_id](auto keys, auto values, auto statuses,
+                                                            ValuePins& pins) {
+          layered_storage.MultiGet(collection_id, keys, values, statuses, pins);
+        },
+        begin, std::move(end), std::move(staged)));
+  }
+
+ private:
+  // The first key greater than every key starting with `prefix`, or empty if there is none.
+  static constexpr std::array<uint8_t, 1> kRecordValue = {1};
+
+  struct ReadCopiesPin : ValuePins::Pin {
+    std::vector<Bytes> copies;
+  };
+
+  // Record keys of the range of secondary keys: [begin, end), an empty `end` meaning no bound.
+  static std::pair<Bytes, Bytes> Bounds(const SecKey& min, const SecKey& max, bool include_max) {
+    Bytes begin = internal::key_codec::EncodeTuple(std::tuple<const SecKey&>(min));
+    Bytes end = internal::key_codec::EncodeTuple(std::tuple<const SecKey&>(max));
+    if (include_max) {
+      end = PrefixSuccessor(std::move(end));
+    }
+    return {std::move(begin), std::move(end)};
+  }
+
+  static Bytes PrefixSuccessor(Bytes prefix) {
+    while (!prefix.empty() && prefix.back() == 0xFF) {
+      prefix.pop_back();
+    }
+    if (!prefix.empty()) {
+      ++prefix.back();
+    }
+    return prefix;
+  }
+
+  const size_t _index_collection_id;
+  const size_t _collection_id;
+};
+
+}  // namespace gendb
@@ -0,0 +1,173 @@
+#include "gendb/storage_index.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <filesystem>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "gendb/arena_storage.h"
+#include "gendb/layered_storage.h"
+#include "status_matchers.h"
+
+namespace gendb {
+namespace {
+
+Bytes ToBytes(const std::string& str) { return {str.begin(), str.end()}; }
+
+// Message holding a copy of its encoding.
+struct Row {
+  explicit Row(BytesConstView bytes) : value(bytes.begin(), bytes.end()) {}
+  std::string value;
+};
+
+template <typename SecKey>
+std::vector<std::string> Scan(const StorageIndex<SecKey>& index, const Storage& storage,
+                              const SecKey& min, const SecKey& max, bool include_max) {
+  std::vector<std::string> values;
+  auto it = index.template Range<Row>(storage, min, max, include_max);
+  for (; it.Valid(); it.Next()) {
+    values.push_back(it.Value().value);
+  }
+  EXPECT_TRUE(it.IsEnd()) << it.Status();
+  return values;
+}
+
+class StorageIndexTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    _path = (std::filesystem::temp_directory_path() /
+             ("storage_index_test_" + std::to_string(std::random_device{}())))
+                .string();
+  }
+
+  void TearDown() override { std::filesystem::remove_all(_path); }
+
+  // Commits the row `value` at primary key `prim_key` with its index record, as a writer does.
+  static void PutRow(Storage& storage, const StorageIndex<int32_t>& index, int32_t age,
+                     const std::string& prim_key, const std::string& value) {
+    MemoryStorage temp_storage;
+    LayeredStorage layered(storage, &temp_storage);
+    temp_storage.Put(index.collection_id(), ToBytes(prim_key), ToBytes(value));
+    index.Insert(temp_storage, age, ToBytes(prim_key));
+    layered.MergeTempStorage();
+  }
+
+  std::string _path;
+};
+
+TEST_F(StorageIndexTest, RangesFollowTheSecondaryKeyOrder) {
+  RocksDBStorage storage(_path);
+  const StorageIndex<int32_t> index(/*index_collection_id=*/1, /*collection_id=*/0);
+  PutRow(storage, index, 30, "k1", "a30");
+  PutRow(storage, index, -5, "k2", "b-5");
+  PutRow(storage, index, 20, "k3", "c20");
+  PutRow(storage, index, 30, "k0", "d30");
+  PutRow(storage, index, 31, "k4", "e31");
+  EXPECT_EQ(storage.GetCollectionSize(1), 5);
+
+  EXPECT_EQ(Scan(index, storage, -10, 30, false), (std::vector<std::string>{"b-5", "c20"}));
+  // Equal secondary keys follow the primary key order.
+  EXPECT_EQ(Scan(index, storage, 20, 30, true), (std::vector<std::string>{"c20", "d30", "a30"}));
+  EXPECT_EQ(Scan(index, storage, 31, INT32_MAX, true), std::vector<std::string>{"e31"});
+  EXPECT_TRUE(Scan(index, storage, 0, 0, true).empty());
+}
+
+TEST_F(StorageIndexTest, RecordsCommitWithTheirMessages) {
+  const StorageIndex<int32_t> index(/*index_collection_id=*/1, /*collection_id=*/0);
+  {
+    RocksDBStorage storage(_path);
+    PutRow(storage, index, 30, "k1", "a30");
+    PutRow(storage, index, 40, "k2", "b40");
+
+    // Moving a row to another key and deleting one, in a single batch.
+    MemoryStorage temp_storage;
+    LayeredStorage layered(storage, &temp_storage);
+    temp_storage.Put(0, ToBytes("k1"), ToBytes("a35"));
+    index.Erase(temp_storage, 30, ToBytes("k1"));
+    index.Insert(temp_storage, 35, ToBytes("k1"));
+    ASSERT_OK(layered.Delete(0, ToBytes("k2")));
+    index.Erase(temp_storage, 40, ToBytes("k2"));
+    // Staged records are not scanned before the merge.
+    EXPECT_EQ(Scan(index, storage, 0, 100, false), (std::vector<std::string>{"a30", "b40"}));
+    layered.MergeTempStorage();
+  }
+
+  // The index is persisted with the rows and needs no rebuild.
+  RocksDBStorage storage(_path);
+  EXPECT_EQ(storage.GetCollectionSize(1), 1);
+  EXPECT_EQ(Scan(index, storage, 0, 100, false), std::vector<std::string>{"a35"});
+}
+
+TEST_F(StorageIndexTest, WriterRangesMergeTheirStagedRecords) {
+  ArenaStorage storage;
+  const StorageIndex<int32_t> index(/*index_collection_id=*/1, /*collection_id=*/0);
+  PutRow(storage, index, 30, "k1", "a30");
+  PutRow(storage, index, 40, "k2", "b40");
+
+  MemoryStorage temp_storage;
+  LayeredStorage layered(storage, &temp_storage);
+  WalBatch wal_batch;
+  temp_storage.Put(0, ToBytes("k1"), ToBytes("a45"));
+  index.Erase(temp_storage, 30, ToBytes("k1"), &wal_batch);
+  index.Insert(temp_storage, 45, ToBytes("k1"), &wal_batch);
+  temp_storage.Put(0, ToBytes("k3"), ToBytes("c10"));
+  index.Insert(temp_storage, 10, ToBytes("k3"), &wal_batch);
+  EXPECT_FALSE(wal_batch.empty());
+
+  std::vector<std::string> values;
+  for (auto it = index.Range<Row>(storage, temp_storage, layered, 0, 100, false); it.Valid();
+       it.Next()) {
+    values.push_back(it.Value().value);
+  }
+  EXPECT_EQ(values, (std::vector<std::string>{"c10", "b40", "a45"}));
+  // The committed records alone.
+  EXPECT_EQ(Scan(index, storage, 0, 100, false), (std::vector<std::string>{"a30", "b40"}));
+}
+
+TEST_F(StorageIndexTest, StringKeysWithCommonPrefixes) {
+  ArenaStorage storage;
+  const StorageIndex<std::string> index(/*index_collection_id=*/1, /*collection_id=*/0);
+  MemoryStorage temp_storage;
+  LayeredStorage layered(storage, &temp_storage);
+  const std::vector<std::string> names = {"ab", "abc", "a", "b", ""};
+  for (size_t i = 0; i < names.size(); ++i) {
+    const Bytes prim_key = {static_cast<uint8_t>(i)};
+    temp_storage.Put(0, prim_key, ToBytes("row " + names[i]));
+    index.Insert(temp_storage, names[i], prim_key);
+  }
+  layered.MergeTempStorage();
+
+  // Bounds encoded from the keys alone: "ab" does not reach into "abc".
+  EXPECT_EQ(Scan(index, storage, std::string("a"), std::string("ab"), true),
+            (std::vector<std::string>{"row a", "row ab"}));
+  EXPECT_EQ(Scan(index, storage, std::string("ab"), std::string("b"), false),
+            (std::vector<std::string>{"row ab", "row abc"}));
+  EXPECT_EQ(Scan(index, storage, std::string(""), std::string("a"), false),
+            std::vector<std::string>{"row "});
+}
+
+TEST_F(StorageIndexTest, ScansLargeRangesInBatches) {
+  RocksDBStorage storage(_path);
+  const StorageIndex<int32_t> index(/*index_collection_id=*/1, /*collection_id=*/0);
+  MemoryStorage temp_storage;
+  LayeredStorage layered(storage, &temp_storage);
+  constexpr int kRows = 3 * StorageIndexIterator<Row, int32_t>::kBatchSize + 5;
+  for (int i = 0; i < kRows; ++i) {
+    const std::string prim_key = "k" + std::to_string(i);
+    temp_storage.Put(0, ToBytes(prim_key), ToBytes(std::to_string(i)));
+    index.Insert(temp_storage, kRows - i, ToBytes(prim_key));
+  }
+  layered.MergeTempStorage();
+
+  const std::vector<std::string> values = Scan(index, storage, 0, kRows, true);
+  ASSERT_EQ(values.size(), kRows);
+  for (int i = 0; i < kRows; ++i) {
+    EXPECT_EQ(values[i], std::to_string(kRows - 1 - i));
+  }
+}
+
+}  // namespace
+}  // namespace gendb
@@ -1,10 +1,21 @@
 #include "gendb/storage.h"
 
+#include <array>
+#include <atomic>
 #include <filesystem>
 #include <memory>
+#include <numeric>
 #include <random>
-
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "allocation_counter.h"
+#include "gendb/arena_storage.h"
 #include "gendb/layered_storage.h"
+#include "gendb/persistent_storage.h"
 #include "gtest/gtest.h"
 #include "status_matchers.h"
 
@@ -26,7 +37,7 @@ std::string BytesViewToString(BytesConstView bytes) {
 }
 
 // Storage type enum for parameterized tests
-enum class StorageType { Memory, RocksDB };
+enum class StorageType { Memory, Arena, Persistent, RocksDB };
 
 // Helper to create storage instances
 class StorageHelper {
@@ -35,6 +46,11 @@ class StorageHelper {
     switch (type) {
       case StorageType::Memory:
         return std::make_unique<MemoryStorage>();
+      case StorageType::Arena:
+        // Small slabs so the suite exercises slab rollover and compaction.
+        return std::make_unique<ArenaStorage>(/*slab_size=*/1024);
+      case StorageType::Persistent:
+        return std::make_unique<PersistentStorage>();
       case StorageType::RocksDB: {
         auto test_db_path = std::filesystem::temp_directory_path() /
                             ("rocksdb_test_" + std::to_string(std::random_device{}()));
@@ -50,6 +66,10 @@ class StorageHelper {
     switch (type) {
       case StorageType::Memory:
         return "MemoryStorage";
+      case StorageType::Arena:
+        return "ArenaStorage";
+      case StorageType::Persistent:
+        return "PersistentStorage";
       case StorageType::RocksDB:
         return "RocksDBStorage";
     }
@@ -289,13 +309,211 @@ TEST_P(StorageTest, EmptyStorageQueries) {
   EXPECT_NOT_FOUND(storage_->Get(0, StringToBytesView("any_key"), value));
 }
 
+TEST_P(StorageTest, WriteBatchAppliesPutsAndDeletes) {
+  storage_->Put(0, StringToBytesView("keep"), StringToBytes("old"));
+  storage_->Put(0, StringToBytesView("drop"), StringToBytes("value"));
+
+  // The batch only views its keys.
+  const std::string keep = "keep";
+  const std::string other = "other";
+  const std::string drop = "drop";
+  const std::string missing = "missing";
+  WriteBatch batch;
+  batch.Put(0, StringToBytesView(keep), StringToBytes("new"));
+  batch.Put(3, StringToBytesView(other), StringToBytes("value3"));
+  batch.Delete(0, StringToBytesView(drop));
+  batch.Delete(0, StringToBytesView(missing));
+  batch.Delete(7, StringToBytesView(missing));
+  ASSERT_OK(storage_->Write(std::move(batch)));
+
+  BytesConstView value;
+  ASSERT_OK(storage_->Get(0, StringToBytesView("keep"), value));
+  EXPECT_EQ(BytesViewToString(value), "new");
+  ASSERT_OK(storage_->Get(3, StringToBytesView("other"), value));
+  EXPECT_EQ(BytesViewToString(value), "value3");
+  EXPECT_FALSE(storage_->Exists(0, StringToBytesView("drop")));
+  EXPECT_EQ(storage_->GetCollectionSize(0), 1);
+}
+
+TEST_P(StorageTest, DeleteRange) {
+  for (const std::string key : {"a", "b1", "b2", "b\xff", "c", "c0"}) {
+    storage_->Put(1, StringToBytesView(key), StringToBytes(key));
+  }
+  storage_->Put(2, StringToBytesView("b1"), StringToBytes("other"));
+
+  ASSERT_OK(storage_->DeleteRange(1, StringToBytesView("b"), StringToBytesView("c")));
+  EXPECT_TRUE(storage_->Exists(1, StringToBytesView("a")));
+  EXPECT_FALSE(storage_->Exists(1, StringToBytesView("b1")));
+  EXPECT_FALSE(storage_->Exists(1, StringToBytesView("b2")));
+  EXPECT_FALSE(storage_->Exists(1, StringToBytesView("b\xff")));
+  EXPECT_TRUE(storage_->Exists(1, StringToBytesView("c")));
+  EXPECT_TRUE(storage_->Exists(1, StringToBytesView("c0")));
+  EXPECT_EQ(storage_->GetCollectionSize(1), 3);
+  EXPECT_TRUE(storage_->Exists(2, StringToBytesView("b1")));
+
+  // Empty and inverted ranges, and unknown collections, delete nothing.
+  ASSERT_OK(storage_->DeleteRange(1, StringToBytesView("c"), StringToBytesView("c")));
+  ASSERT_OK(storage_->DeleteRange(1, StringToBytesView("z"), StringToBytesView("a")));
+  ASSERT_OK(storage_->DeleteRange(9, StringToBytesView("a"), StringToBytesView("z")));
+  EXPECT_EQ(storage_->GetCollectionSize(1), 3);
+}
+
+TEST_P(StorageTest, Truncate) {
+  for (size_t collection_id : {0, 1, 2}) {
+    for (int i = 0; i < 10; ++i) {
+      storage_->Put(collection_id, StringToBytesView("key" + std::to_string(i)),
+                    StringToBytes("value"));
+    }
+  }
+
+  ASSERT_OK(storage_->Truncate(0));
+  ASSERT_OK(storage_->Truncate(2));
+  ASSERT_OK(storage_->Truncate(5));
+  EXPECT_EQ(storage_->GetCollectionSize(0), 0);
+  EXPECT_EQ(storage_->GetCollectionSize(1), 10);
+  EXPECT_EQ(storage_->GetCollectionSize(2), 0);
+  EXPECT_FALSE(storage_->Exists(0, StringToBytesView("key9")));
+  EXPECT_FALSE(storage_->Exists(2, StringToBytesView("key0")));
+
+  // Truncated collections stay usable.
+  storage_->Put(2, StringToBytesView("key0"), StringToBytes("new"));
+  BytesConstView value;
+  ASSERT_OK(storage_->Get(2, StringToBytesView("key0"), value));
+  EXPECT_EQ(BytesViewToString(value), "new");
+  EXPECT_EQ(storage_->GetCollectionSize(2), 1);
+}
+
+TEST_P(StorageTest, CursorWalksKeysInOrder) {
+  std::unique_ptr<StorageCursor> cursor = storage_->NewCursor(0);
+  if (cursor == nullptr) {
+    GTEST_SKIP() << "Backend does not keep keys ordered";
+  }
+  cursor->Seek({});
+  EXPECT_FALSE(cursor->Valid());
+
+  for (const std::string key : {"b", "a", "c\xff", "c", "ab"}) {
+    storage_->Put(0, StringToBytesView(key), StringToBytes("v" + key));
+  }
+  storage_->Put(1, StringToBytesView("bb"), StringToBytes("other"));
+
+  cursor = storage_->NewCursor(0);
+  std::vector<std::string> keys;
+  for (cursor->Seek(StringToBytesView("aa")); cursor->Valid(); cursor->Next()) {
+    keys.push_back(BytesViewToString(cursor->Key()));
+    EXPECT_EQ(BytesViewToString(cursor->Value()), "v" + keys.back());
+  }
+  EXPECT_EQ(keys, (std::vector<std::string>{"ab", "b", "c", "c\xff"}));
+
+  cursor = storage_->NewCursor(7);
+  cursor->Seek({});
+  EXPECT_FALSE(cursor->Valid());
+}
+
+TEST_P(StorageTest, MultiGetMatchesGet) {
+  for (int i = 0; i < 100; i += 2) {
+    storage_->Put(0, StringToBytesView("key" + std::to_string(i)),
+                  StringToBytes("value" + std::to_string(i)));
+  }
+
+  std::vector<std::string> key_strings;
+  for (int i = 0; i < 100; ++i) {
+    key_strings.push_back("key" + std::to_string(i));
+  }
+  std::vector<BytesConstView> keys;
+  for (const auto& key : key_strings) {
+    keys.push_back(StringToBytesView(key));
+  }
+  std::vector<BytesConstView> values(keys.size());
+  std::vector<absl::Status> statuses(keys.size());
+  ValuePins pins;
+  storage_->MultiGet(0, keys, values, statuses, pins);
+
+  for (int i = 0; i < 100; ++i) {
+    if (i % 2 == 0) {
+      ASSERT_OK(statuses[i]);
+      EXPECT_EQ(BytesViewToString(values[i]), "value" + std::to_string(i));
+    } else {
+      EXPECT_NOT_FOUND(statuses[i]);
+    }
+  }
+
+  storage_->MultiGet(42, keys, values, statuses, pins);
+  for (const auto& status : statuses) {
+    EXPECT_NOT_FOUND(status);
+  }
+}
+
+TEST_P(StorageTest, PinnedViewsSurviveLaterGets) {
+  storage_->Put(0, StringToBytesView("key1"), StringToBytes("value1"));
+  storage_->Put(0, StringToBytesView("key2"), StringToBytes("value2"));
+
+  ValuePins pins;
+  BytesConstView value1;
+  BytesConstView value2;
+  ASSERT_OK(storage_->GetPinned(0, StringToBytesView("key1"), value1, pins));
+  ASSERT_OK(storage_->GetPinned(0, StringToBytesView("key2"), value2, pins));
+  EXPECT_EQ(BytesViewToString(value1), "value1");
+  EXPECT_EQ(BytesViewToString(value2), "value2");
+}
+
+TEST_P(StorageTest, ConcurrentReadersSeeTheirOwnValues) {
+  constexpr int kThreads = 4;
+  for (int t = 0; t < kThreads; ++t) {
+    const std::string key = "key" + std::to_string(t);
+    storage_->Put(0, StringToBytesView(key), StringToBytes("value" + std::to_string(t)));
+  }
+
+  std::atomic<int> mismatches = 0;
+  std::vector<std::thread> readers;
+  for (int t = 0; t < kThreads; ++t) {
+    readers.emplace_back([&, t] {
+      const std::string key = "key" + std::to_string(t);
+      const std::string expected = "value" + std::to_string(t);
+      for (int i = 0; i < 1000; ++i) {
+        BytesConstView value;
+        if (!storage_->Get(0, StringToBytesView(key), value).ok() ||
+            BytesViewToString(value) != expected) {
+          ++mismatches;
+        }
+      }
+    });
+  }
+  for (auto& reader : readers) {
+    reader.join();
+  }
+  EXPECT_EQ(mismatches, 0);
+}
+
 // Instantiate tests for both storage types
 INSTANTIATE_TEST_SUITE_P(AllStorageTypes, StorageTest,
-                         ::testing::Values(StorageType::Memory, StorageType::RocksDB),
+                         ::testing::Values(StorageType::Memory, StorageType::Arena,
+                                           StorageType::Persistent, StorageType::RocksDB),
                          [](const ::testing::TestParamInfo<StorageType>& info) {
                            return StorageHelper::GetName(info.param);
                          });
 
+TEST(PersistentStorageTest, CopiesAreUnaffectedByLaterWrites) {
+  PersistentStorage storage;
+  for (int i = 0; i < 100; ++i) {
+    storage.Put(0, StringToBytesView("key" + std::to_string(i)), StringToBytes("v1"));
+  }
+  const PersistentStorage copy = storage;
+  BytesConstView value;
+  ASSERT_OK(copy.Get(0, StringToBytesView("key7"), value));
+
+  storage.Put(0, StringToBytesView("key7"), StringToBytes("v2"));
+  ASSERT_OK(storage.DeleteRange(0, StringToBytesView("key1"), StringToBytesView("key5")));
+  ASSERT_OK(storage.Truncate(0));
+  storage.Put(1, StringToBytesView("other"), StringToBytes("v2"));
+
+  // Views into the copy stay valid: the original never modifies shared values.
+  EXPECT_EQ(BytesViewToString(value), "v1");
+  EXPECT_EQ(copy.GetCollectionSize(0), 100);
+  EXPECT_EQ(copy.GetCollectionCount(), 1);
+  EXPECT_TRUE(copy.Exists(0, StringToBytesView("key42")));
+  EXPECT_EQ(storage.GetCollectionSize(0), 0);
+}
+
 // RocksDB-specific test for persistence (only makes sense for persistent storage)
 class RocksDBPersistenceTest : public ::testing::Test {
  protected:
@@ -331,6 +549,272 @@ TEST_F(RocksDBPersistenceTest, DataPersistsAcrossRestarts) {
   }
 }
 
+TEST_F(RocksDBPersistenceTest, GetSlotsBelongToTheirStorage) {
+  const std::filesystem::path other_path = test_db_path_.string() + "_other";
+  std::filesystem::remove_all(other_path);
+  {
+    RocksDBStorage storage(test_db_path_);
+    storage.Put(0, StringToBytesView("k"), StringToBytes("first"));
+    BytesConstView value;
+    ASSERT_OK(storage.Get(0, StringToBytesView("k"), value));
+    {
+      // Reads of another storage on the same thread leave the value alone, and the slots of a
+      // storage are released before its DB is closed.
+      RocksDBStorage other(other_path);
+      other.Put(0, StringToBytesView("k"), StringToBytes("second"));
+      BytesConstView other_value;
+      ASSERT_OK(other.Get(0, StringToBytesView("k"), other_value));
+      EXPECT_EQ(BytesViewToString(other_value), "second");
+    }
+    EXPECT_EQ(BytesViewToString(value), "first");
+  }
+  std::filesystem::remove_all(other_path);
+}
+
+TEST_F(RocksDBPersistenceTest, CollectionSizesPersistAcrossRestarts) {
+  {
+    RocksDBStorage storage(test_db_path_);
+    for (int i = 0; i < 10; ++i) {
+      storage.Put(0, StringToBytesView("key" + std::to_string(i)), StringToBytes("value"));
+    }
+    storage.Put(2, StringToBytesView("key"), StringToBytes("value"));
+    ASSERT_OK(storage.Delete(0, StringToBytesView("key3")));
+  }
+
+  RocksDBStorage storage(test_db_path_);
+  EXPECT_EQ(storage.GetCollectionCount(), 3);
+  EXPECT_EQ(storage.GetCollectionSize(0), 9);
+  EXPECT_EQ(storage.GetCollectionSize(1), 0);
+  EXPECT_EQ(storage.GetCollectionSize(2), 1);
+}
+
+TEST_F(RocksDBPersistenceTest, CollectionSizeCountsDistinctKeys) {
+  RocksDBStorage storage(test_db_path_);
+  storage.Put(0, StringToBytesView("a"), StringToBytes("1"));
+  storage.Put(0, StringToBytesView("a"), StringToBytes("2"));
+  ASSERT_OK(storage.Delete(0, StringToBytesView("missing")));
+  EXPECT_EQ(storage.GetCollectionSize(0), 1);
+
+  // Repeated keys within one batch are counted once.
+  const std::string a = "a";
+  const std::string b = "b";
+  const std::string c = "c";
+  WriteBatch batch;
+  batch.Put(0, StringToBytesView(b), StringToBytes("1"));
+  batch.Put(0, StringToBytesView(b), StringToBytes("2"));
+  batch.Delete(0, StringToBytesView(a));
+  batch.Delete(0, StringToBytesView(a));
+  batch.Put(0, StringToBytesView(c), StringToBytes("1"));
+  batch.Delete(0, StringToBytesView(c));
+  ASSERT_OK(storage.Write(std::move(batch)));
+  EXPECT_EQ(storage.GetCollectionSize(0), 1);
+
+  storage.Clear();
+  EXPECT_EQ(storage.GetCollectionSize(0), 0);
+  storage.Put(0, StringToBytesView("d"), StringToBytes("1"));
+  EXPECT_EQ(storage.GetCollectionSize(0), 1);
+}
+
+TEST_F(RocksDBPersistenceTest, ConcurrentWritersKeepExactSizes) {
+  constexpr int kThreads = 4;
+  constexpr int kKeys = 200;
+  RocksDBStorage storage(test_db_path_);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreads; ++t) {
+    // Every thread writes the same keys, into collections created as they go.
+    threads.emplace_back([&storage, t] {
+      for (int i = 0; i < kKeys; ++i) {
+        const std::string key = "key" + std::to_string(i);
+        WriteBatch batch;
+        batch.Put(i % 3, StringToBytesView(key), StringToBytes(std::to_string(t)));
+        batch.Put(t + 3, StringToBytesView(key), StringToBytes("value"));
+        ASSERT_OK(storage.Write(std::move(batch)));
+      }
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(storage.GetCollectionCount(), kThreads + 3);
+  EXPECT_EQ(storage.GetCollectionSize(0) + storage.GetCollectionSize(1) +
+                storage.GetCollectionSize(2),
+            kKeys);
+  for (int t = 0; t < kThreads; ++t) {
+    EXPECT_EQ(storage.GetCollectionSize(t + 3), kKeys);
+  }
+}
+
+TEST_F(RocksDBPersistenceTest, EstimateCollectionSize) {
+  RocksDBStorage storage(test_db_path_);
+  for (int i = 0; i < 100; ++i) {
+    storage.Put(1, StringToBytesView("key" + std::to_string(i)), StringToBytes("value"));
+  }
+  EXPECT_GT(storage.EstimateCollectionSize(1), 0);
+  EXPECT_LE(storage.EstimateCollectionSize(1), 200);
+  EXPECT_EQ(storage.EstimateCollectionSize(5), 0);
+}
+
+TEST_F(RocksDBPersistenceTest, TunedCollectionsScanAcrossPrefixes) {
+  const std::array<CollectionTuning, 2> tuning = {
+      CollectionTuning{.prefix_length = 2},
+      CollectionTuning{.bloom_bits_per_key = 10,
+                       .block_size = 16 * 1024,
+                       .compression = CollectionTuning::Compression::kNone,
+                       .optimize_point_lookup = true},
+  };
+  {
+    RocksDBStorage storage(test_db_path_, tuning);
+    for (const std::string key : {"aa1", "aa2", "bb1", "cc1"}) {
+      storage.Put(0, StringToBytesView(key), StringToBytes(key));
+      storage.Put(1, StringToBytesView(key), StringToBytes(key));
+    }
+  }
+
+  RocksDBStorage storage(test_db_path_, tuning);
+  for (size_t collection_id : {0, 1}) {
+    EXPECT_EQ(storage.GetCollectionSize(collection_id), 4);
+    BytesConstView value;
+    ASSERT_OK(storage.Get(collection_id, StringToBytesView("bb1"), value));
+    EXPECT_EQ(BytesViewToString(value), "bb1");
+    EXPECT_NOT_FOUND(storage.Get(collection_id, StringToBytesView("bb2"), value));
+  }
+
+  // Clear scans the default column family, which must not stop at the first prefix.
+  storage.Clear();
+  BytesConstView value;
+  EXPECT_NOT_FOUND(storage.Get(0, StringToBytesView("cc1"), value));
+}
+
+TEST_F(RocksDBPersistenceTest, RangeCursorStopsAtItsBounds) {
+  RocksDBStorage storage(test_db_path_);
+  for (const std::string key : {"a", "b", "c", "d"}) {
+    storage.Put(1, StringToBytesView(key), StringToBytes(key));
+  }
+  auto keys = [&](const std::string& begin, const std::string& end) {
+    std::vector<std::string> keys;
+    auto cursor = storage.NewRangeCursor(1, StringToBytesView(begin), StringToBytesView(end),
+                                         /*readahead_size=*/64 * 1024);
+    for (cursor->Seek(StringToBytesView(begin)); cursor->Valid(); cursor->Next()) {
+      keys.push_back(BytesViewToString(cursor->Key()));
+    }
+    return keys;
+  };
+  EXPECT_EQ(keys("b", "d"), (std::vector<std::string>{"b", "c"}));
+  EXPECT_EQ(keys("bb", ""), (std::vector<std::string>{"c", "d"}));
+  EXPECT_TRUE(keys("a", "a").empty());
+
+  auto cursor = storage.NewRangeCursor(5, {}, {}, 0);
+  cursor->Seek({});
+  EXPECT_FALSE(cursor->Valid());
+}
+
+TEST_F(RocksDBPersistenceTest, RangeDeletesPersistAcrossRestarts) {
+  {
+    RocksDBStorage storage(test_db_path_);
+    for (size_t collection_id : {0, 1}) {
+      for (int i = 0; i < 100; ++i) {
+        storage.Put(collection_id, StringToBytesView("key" + std::to_string(100 + i)),
+                    StringToBytes("value"));
+      }
+    }
+    ASSERT_OK(storage.DeleteRange(0, StringToBytesView("key110"), StringToBytesView("key190")));
+    ASSERT_OK(storage.Truncate(1));
+  }
+
+  RocksDBStorage storage(test_db_path_);
+  EXPECT_EQ(storage.GetCollectionSize(0), 20);
+  EXPECT_EQ(storage.GetCollectionSize(1), 0);
+  EXPECT_TRUE(storage.Exists(0, StringToBytesView("key109")));
+  EXPECT_FALSE(storage.Exists(0, StringToBytesView("key110")));
+  EXPECT_FALSE(storage.Exists(0, StringToBytesView("key189")));
+  EXPECT_TRUE(storage.Exists(0, StringToBytesView("key190")));
+  EXPECT_FALSE(storage.Exists(1, StringToBytesView("key100")));
+}
+
+TEST_F(RocksDBPersistenceTest, RangeDeletesKeepSizesExact) {
+  RocksDBStorage storage(test_db_path_);
+  for (int i = 0; i < 100; ++i) {
+    storage.Put(1, StringToBytesView("key" + std::to_string(100 + i)), StringToBytes("value"));
+  }
+  // Partial: the keys are counted again when the size is asked for, and later writes keep the
+  // count up to date.
+  ASSERT_OK(storage.DeleteRange(1, StringToBytesView("key150"), StringToBytesView("key160")));
+  storage.Put(1, StringToBytesView("key155"), StringToBytes("value"));
+  EXPECT_EQ(storage.GetCollectionSize(1), 91);
+  storage.Put(1, StringToBytesView("key156"), StringToBytes("value"));
+  EXPECT_EQ(storage.GetCollectionSize(1), 92);
+  // Empty, then covering every key.
+  ASSERT_OK(storage.DeleteRange(1, StringToBytesView("a"), StringToBytesView("b")));
+  EXPECT_EQ(storage.GetCollectionSize(1), 92);
+  ASSERT_OK(storage.DeleteRange(1, StringToBytesView("a"), StringToBytesView("z")));
+  EXPECT_EQ(storage.GetCollectionSize(1), 0);
+}
+
+TEST_F(RocksDBPersistenceTest, ConcurrentWritersKeepCountsExact) {
+  RocksDBStorage storage(test_db_path_);
+  storage.Put(2, StringToBytesView("key"), StringToBytes("value"));
+  // Two writers per collection, overlapping on every other key; the collections lock apart.
+  std::vector<std::thread> writers;
+  for (int w = 0; w < 4; ++w) {
+    writers.emplace_back([&storage, w] {
+      for (int i = 0; i < 100; ++i) {
+        WriteBatch batch;
+        const std::string key = "key" + std::to_string(w % 2 == 0 ? i : i / 2 * 2);
+        batch.Put(1 + w / 2, StringToBytesView(key), StringToBytes("value"));
+        ASSERT_OK(storage.Write(std::move(batch)));
+      }
+    });
+  }
+  for (std::thread& writer : writers) {
+    writer.join();
+  }
+  EXPECT_EQ(storage.GetCollectionSize(1), 100);
+  EXPECT_EQ(storage.GetCollectionSize(2), 101);
+}
+
+TEST_F(RocksDBPersistenceTest, ReadsRaceTruncate) {
+  RocksDBStorage storage(test_db_path_);
+  storage.Put(1, StringToBytesView("key"), StringToBytes("value"));
+  std::atomic<bool> done = false;
+  std::thread truncater([&] {
+    for (int i = 0; i < 200; ++i) {
+      ASSERT_OK(storage.Truncate(1));
+      storage.Put(1, StringToBytesView("key"), StringToBytes("value"));
+    }
+    done = true;
+  });
+  // Each read holds on to the column family handle that Truncate replaces.
+  while (!done) {
+    BytesConstView value;
+    absl::Status status = storage.Get(1, StringToBytesView("key"), value);
+    EXPECT_TRUE(status.ok() || absl::IsNotFound(status)) << status;
+    auto cursor = storage.NewCursor(1);
+    for (cursor->Seek({}); cursor->Valid(); cursor->Next()) {
+      EXPECT_EQ(BytesViewToString(cursor->Value()), "value");
+    }
+  }
+  truncater.join();
+  EXPECT_EQ(storage.GetCollectionSize(1), 1);
+}
+
+TEST_F(RocksDBPersistenceTest, WritesRaceClear) {
+  RocksDBStorage storage(test_db_path_);
+  std::atomic<bool> done = false;
+  std::thread clearer([&] {
+    for (int i = 0; i < 200; ++i) {
+      storage.Clear();
+    }
+    done = true;
+  });
+  // Each Put creates the column family that the next Clear drops.
+  while (!done) {
+    storage.Put(3, StringToBytesView("key"), StringToBytes("value"));
+  }
+  clearer.join();
+  storage.Put(3, StringToBytesView("key"), StringToBytes("value"));
+  EXPECT_EQ(storage.GetCollectionSize(3), 1);
+}
+
 // LayeredStorage tests (these work with any Storage implementation)
 class LayeredStorageTest : public ::testing::TestWithParam<StorageType> {
  protected:
@@ -406,12 +890,176 @@ TEST_P(LayeredStorageTest, CompleteWorkflow) {
   EXPECT_FALSE(main_storage_->Exists(0, StringToBytesView("main_key")));
 }
 
+TEST_P(LayeredStorageTest, MultiGetSeesTempStorage) {
+  main_storage_->Put(0, StringToBytesView("main"), StringToBytes("main_value"));
+  main_storage_->Put(0, StringToBytesView("shadowed"), StringToBytes("old_value"));
+  main_storage_->Put(0, StringToBytesView("deleted"), StringToBytes("deleted_value"));
+  temp_storage_->Put(0, StringToBytesView("shadowed"), StringToBytes("new_value"));
+  temp_storage_->Put(0, StringToBytesView("temp"), StringToBytes("temp_value"));
+  ASSERT_OK(layered_storage_->Delete(0, StringToBytesView("deleted")));
+
+  const std::vector<BytesConstView> keys = {
+      StringToBytesView("main"), StringToBytesView("shadowed"), StringToBytesView("deleted"),
+      StringToBytesView("temp"), StringToBytesView("missing")};
+  std::vector<BytesConstView> values(keys.size());
+  std::vector<absl::Status> statuses(keys.size());
+  layered_storage_->MultiGet(0, keys, values, statuses);
+
+  ASSERT_OK(statuses[0]);
+  EXPECT_EQ(BytesViewToString(values[0]), "main_value");
+  ASSERT_OK(statuses[1]);
+  EXPECT_EQ(BytesViewToString(values[1]), "new_value");
+  EXPECT_NOT_FOUND(statuses[2]);
+  ASSERT_OK(statuses[3]);
+  EXPECT_EQ(BytesViewToString(values[3]), "temp_value");
+  EXPECT_NOT_FOUND(statuses[4]);
+}
+
+TEST_P(LayeredStorageTest, CallerPinsOutliveLaterReads) {
+  main_storage_->Put(0, StringToBytesView("a"), StringToBytes("a_value"));
+  main_storage_->Put(0, StringToBytesView("b"), StringToBytes("b_value"));
+  ValuePins pins;
+  BytesConstView kept;
+  ASSERT_OK(layered_storage_->Get(0, StringToBytesView("a"), kept, pins));
+  for (int i = 0; i < 100; ++i) {
+    BytesConstView value;
+    ASSERT_OK(layered_storage_->Get(0, StringToBytesView("b"), value));
+    EXPECT_EQ(BytesViewToString(value), "b_value");
+  }
+  layered_storage_->ReleasePins();
+  EXPECT_EQ(BytesViewToString(kept), "a_value");
+  EXPECT_LE(pins.size(), 1);
+  pins.Clear();
+  EXPECT_EQ(pins.size(), 0);
+}
+
+// As a Guard reads: two messages of one collection, both used after the second read.
+TEST_P(LayeredStorageTest, ReadsWithoutPinsKeepEveryView) {
+  main_storage_->Put(0, StringToBytesView("a"), StringToBytes("a_value"));
+  main_storage_->Put(0, StringToBytesView("b"), StringToBytes("b_value"));
+  LayeredStorage guard_storage(*main_storage_, /*temp_storage_ptr=*/nullptr);
+  BytesConstView first;
+  BytesConstView second;
+  ASSERT_OK(guard_storage.Get(0, StringToBytesView("a"), first));
+  ASSERT_OK(guard_storage.Get(0, StringToBytesView("b"), second));
+  std::vector<BytesConstView> values(1);
+  std::vector<absl::Status> statuses(1);
+  const std::vector<BytesConstView> keys = {StringToBytesView("b")};
+  guard_storage.MultiGet(0, keys, values, statuses);
+  ASSERT_OK(statuses[0]);
+
+  EXPECT_EQ(BytesViewToString(first), "a_value");
+  EXPECT_EQ(BytesViewToString(second), "b_value");
+  EXPECT_EQ(BytesViewToString(values[0]), "b_value");
+  guard_storage.ReleasePins();
+}
+
+TEST_P(LayeredStorageTest, MultiGetMessagesKeepsEveryChunk) {
+  // Holds a view of its encoding, like the generated messages.
+  struct Message {
+    Message() = default;
+    explicit Message(BytesConstView bytes) : bytes(bytes) {}
+    BytesConstView bytes;
+  };
+  // More ids than a chunk, some of them missing.
+  constexpr uint32_t kIds = 150;
+  auto to_key = [](uint32_t id) { return StringToBytes("key" + std::to_string(id)); };
+  for (uint32_t id = 0; id < kIds; id += 3) {
+    main_storage_->Put(0, to_key(id), StringToBytes("value" + std::to_string(id)));
+  }
+  LayeredStorage guard_storage(*main_storage_, /*temp_storage_ptr=*/nullptr);
+  std::vector<uint32_t> ids(kIds);
+  std::iota(ids.begin(), ids.end(), 0);
+  std::vector<Message> messages(kIds);
+  std::vector<absl::Status> statuses(kIds);
+  MultiGetMessages<Message>(guard_storage, 0, std::span<const uint32_t>(ids), to_key,
+                            std::span(messages), std::span(statuses));
+
+  for (uint32_t id = 0; id < kIds; ++id) {
+    if (id % 3 == 0) {
+      ASSERT_OK(statuses[id]);
+      EXPECT_EQ(BytesViewToString(messages[id].bytes), "value" + std::to_string(id));
+    } else {
+      EXPECT_NOT_FOUND(statuses[id]);
+    }
+  }
+}
+
 // Instantiate LayeredStorage tests for both storage types
 INSTANTIATE_TEST_SUITE_P(AllStorageTypes, LayeredStorageTest,
-                         ::testing::Values(StorageType::Memory, StorageType::RocksDB),
+                         ::testing::Values(StorageType::Memory, StorageType::Arena,
+                                           StorageType::Persistent, StorageType::RocksDB),
                          [](const ::testing::TestParamInfo<StorageType>& info) {
                            return StorageHelper::GetName(info.param);
                          });
 
+TEST(MemoryStorageTest, ReadsDoNotAllocate) {
+  const std::array<uint8_t, 8> fixed_key{0, 0, 0, 0, 0, 0, 0, 1};
+  const SmallKey short_key(StringToBytesView("short"));
+  const SmallKey long_key(StringToBytesView("a key longer than the inline buffer"));
+  MemoryStorage main_storage;
+  MemoryStorage temp_storage;
+  main_storage.Put(0, fixed_key, StringToBytes("fixed"));
+  main_storage.Put(0, short_key, StringToBytes("short"));
+  main_storage.Put(0, long_key, StringToBytes("long"));
+  temp_storage.Put(0, short_key, StringToBytes("short_temp"));
+  const LayeredStorage reader(main_storage, /*temp_storage_ptr=*/nullptr);
+  const LayeredStorage writer(main_storage, &temp_storage);
+
+  size_t allocations = 0;
+  bool all_found = true;
+  BytesConstView value;
+  {
+    tests::ScopedAllocationCounter counter;
+    for (BytesConstView key : {BytesConstView(fixed_key), short_key.view(), long_key.view()}) {
+      all_found &= main_storage.Get(0, key, value).ok();
+      all_found &= main_storage.Exists(0, key);
+      all_found &= reader.Get(0, key, value).ok();
+      all_found &= writer.Get(0, key, value).ok();
+    }
+    all_found &= !main_storage.Exists(0, StringToBytesView("missing"));
+    all_found &= main_storage.Find(1, fixed_key) == nullptr;
+    allocations = counter.count();
+  }
+  EXPECT_TRUE(all_found);
+  EXPECT_EQ(allocations, 0);
+  ASSERT_OK(writer.Get(0, short_key, value));
+  EXPECT_EQ(BytesViewToString(value), "short_temp");
+}
+
+// Rejects the first batch written to it.
+class RejectingStorage : public MemoryStorage {
+ public:
+  absl::Status Write(WriteBatch&& batch) override {
+    if (!rejected_) {
+      rejected_ = true;
+      return absl::UnavailableError("rejected");
+    }
+    return MemoryStorage::Write(std::move(batch));
+  }
+
+ private:
+  bool rejected_ = false;
+};
+
+TEST(LayeredStorageMergeTest, RejectedMergeKeepsTheChanges) {
+  RejectingStorage main_storage;
+  MemoryStorage temp_storage;
+  main_storage.Put(0, StringToBytesView("deleted"), StringToBytes("old_value"));
+  LayeredStorage layered(main_storage, &temp_storage);
+  temp_storage.Put(0, StringToBytesView("put"), StringToBytes("new_value"));
+  ASSERT_OK(layered.Delete(0, StringToBytesView("deleted")));
+
+  EXPECT_THROW(layered.MergeTempStorage(), std::runtime_error);
+  BytesConstView value;
+  ASSERT_OK(layered.Get(0, StringToBytesView("put"), value));
+  EXPECT_EQ(BytesViewToString(value), "new_value");
+
+  layered.MergeTempStorage();
+  ASSERT_OK(main_storage.Get(0, StringToBytesView("put"), value));
+  EXPECT_EQ(BytesViewToString(value), "new_value");
+  EXPECT_FALSE(main_storage.Exists(0, StringToBytesView("deleted")));
+}
+
 }  // namespace
-}  // namespace gendb
\ No newline at end of file
+}  // namespace gendb
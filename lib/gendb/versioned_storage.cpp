@@ -0,0 +1,541 @@
+#include "gendb/versioned_storage.h"
+
+#include <compare>
+#include <stdexcept>
+#include <utility>
+
+#include "absl/cleanup/cleanup.h"
+#include "gendb/status.h"
+
+namespace gendb {
+
+namespace {
+
+std::shared_ptr<const Bytes> CopyBytes(BytesConstView bytes) {
+  return std::make_shared<const Bytes>(bytes.begin(), bytes.end());
+}
+
+}  // namespace
+
+// Merges the latest keys with the history keys, resolving each against the snapshot sequence.
+// The storage may be written between batches, so every batch seeks afresh from the last key.
+class VersionedStorage::SnapshotCursor : public StorageCursor {
+ public:
+  static constexpr size_t kBatchSize = 32;
+
+  SnapshotCursor(const VersionedStorage& storage, uint64_t sequence, size_t collection_id)
+      : _storage(storage), _sequence(sequence), _collection_id(collection_id) {}
+
+  void Seek(BytesConstView key) override { Fill(key, /*after=*/false); }
+
+  void Next() override {
+    if (_position + 1 < _entries.size() || _exhausted) {
+      ++_position;
+      return;
+    }
+    const SmallKey last = std::move(_entries.back().key);
+    Fill(last, /*after=*/true);
+  }
+
+  bool Valid() const override { return _position < _entries.size(); }
+
+  BytesConstView Key() const override { return _entries[_position].key; }
+
+  // Held by the current batch: valid until the cursor moves.
+  BytesConstView Value() const override { return *_entries[_position].value; }
+
+ private:
+  struct Entry {
+    SmallKey key;
+    std::shared_ptr<const Bytes> value;
+  };
+
+  void Fill(BytesConstView from, bool after) {
+    _entries.clear();
+    _position = 0;
+    _exhausted = false;
+
+    std::shared_lock lock(_storage.Stripe(_collection_id));
+    std::unique_ptr<StorageCursor> latest = _storage._storage.NewCursor(_collection_id);
+    const History* history =
+        _collection_id < _storage._history.size() ? &_storage._history[_collection_id] : nullptr;
+    latest->Seek(from);
+    History::const_iterator versions;
+    if (history != nullptr) {
+      versions = history->lower_bound(from);
+    }
+    if (after) {
+      if (latest->Valid() && std::ranges::equal(latest->Key(), from)) {
+        latest->Next();
+      }
+      if (history != nullptr && versions != history->end() &&
+          std::ranges::equal(BytesConstView(versions->first), from)) {
+        ++versions;
+      }
+    }
+
+    while (_entries.size() < kBatchSize) {
+      const bool has_latest = latest->Valid();
+      const bool has_versions = history != nullptr && versions != history->end();
+      if (!has_latest && !has_versions) {
+        _exhausted = true;
+        return;
+      }
+      std::strong_ordering order = std::strong_ordering::less;
+      if (!has_latest) {
+        order = std::strong_ordering::greater;
+      } else if (has_versions) {
+        const BytesConstView latest_key = latest->Key();
+        const BytesConstView versions_key = versions->first;
+        order = std::lexicographical_compare_three_way(latest_key.begin(), latest_key.end(),
+                                                       versions_key.begin(), versions_key.end());
+      }
+
+      // A key with a history version superseded after the snapshot reads that version, which is
+      // nullptr if the key did not exist yet. Keys without one read the latest value, if any.
+      const Version* version = order >= 0 ? VisibleVersion(versions->second, _sequence) : nullptr;
+      if (version != nullptr) {
+        if (version->value != nullptr) {
+          _entries.push_back({SmallKey(versions->first), version->value});
+        }
+      } else if (order <= 0) {
+        _entries.push_back({SmallKey(latest->Key()), CopyBytes(latest->Value())});
+      }
+
+      if (order <= 0) {
+        latest->Next();
+      }
+      if (order >= 0) {
+        ++versions;
+      }
+    }
+  }
+
+  const VersionedStorage& _storage;
+  const uint64_t _sequence;
+  const size_t _collection_id;
+  std::vector<Entry> _entries;
+  size_t _position = 0;
+  // The last Fill reached the end of the collection.
+  bool _exhausted = true;
+};
+
+// Latest values a snapshot read. A copy is made while no commit after the snapshot has written the
+// key, so it is the value at the snapshot's sequence for good.
+struct StorageSnapshot::ReadCopies {
+  using Copies = std::map<SmallKey, Bytes, VersionedStorage::KeyLess>;
+
+  // The key's copy, or nullptr if none was made.
+  const Bytes* Find(size_t collection_id, BytesConstView key) {
+    std::lock_guard lock(mutex);
+    if (collection_id >= by_collection.size()) {
+      return nullptr;
+    }
+    auto it = by_collection[collection_id].find(key);
+    return it == by_collection[collection_id].end() ? nullptr : &it->second;
+  }
+
+  // Readers racing on the same key keep the first copy.
+  const Bytes& Add(size_t collection_id, BytesConstView key, Bytes&& value) {
+    std::lock_guard lock(mutex);
+    if (collection_id >= by_collection.size()) {
+      by_collection.resize(collection_id + 1);
+    }
+    return by_collection[collection_id].try_emplace(SmallKey(key), std::move(value)).first->second;
+  }
+
+  std::mutex mutex;
+  std::vector<Copies> by_collection;
+};
+
+StorageSnapshot::StorageSnapshot(const VersionedStorage& storage, uint64_t sequence)
+    : _storage(&storage), _sequence(sequence), _read_copies(std::make_unique<ReadCopies>()) {}
+
+StorageSnapshot::StorageSnapshot(StorageSnapshot&& other) noexcept
+    : _storage(std::exchange(other._storage, nullptr)),
+      _sequence(other._sequence),
+      _read_copies(std::move(other._read_copies)) {}
+
+StorageSnapshot::~StorageSnapshot() {
+  if (_storage != nullptr) {
+    _storage->ReleaseSnapshot(_sequence);
+  }
+}
+
+absl::Status StorageSnapshot::Get(size_t collection_id, BytesConstView key,
+                                  BytesConstView& value) const {
+  if (const Bytes* copy = _read_copies->Find(collection_id, key)) {
+    value = *copy;
+    return absl::OkStatus();
+  }
+  std::shared_lock lock(_storage->Stripe(collection_id));
+  return _storage->ReadAt(_sequence, collection_id, key, value, *_read_copies);
+}
+
+void StorageSnapshot::MultiGet(size_t collection_id, std::span<const BytesConstView> keys,
+                               std::span<BytesConstView> values,
+                               std::span<absl::Status> statuses) const {
+  std::shared_lock lock(_storage->Stripe(collection_id));
+  for (size_t i = 0; i < keys.size(); ++i) {
+    statuses[i] = _storage->ReadAt(_sequence, collection_id, keys[i], values[i], *_read_copies);
+  }
+}
+
+void StorageSnapshot::MultiGet(size_t collection_id, std::span<const BytesConstView> keys,
+                               std::span<BytesConstView> values, std::span<absl::Status> statuses,
+                               std::vector<Bytes>& copies) const {
+  // Growing `copies` moves its Bytes, which keeps their buffers and so the views of them.
+  copies.reserve(copies.size() + keys.size());
+  std::shared_lock lock(_storage->Stripe(collection_id));
+  for (size_t i = 0; i < keys.size(); ++i) {
+    statuses[i] =
+        _storage->ReadAt(_sequence, collection_id, keys[i], values[i], *_read_copies, &copies);
+  }
+}
+
+std::unique_ptr<StorageCursor> StorageSnapshot::NewCursor(size_t collection_id) const {
+  {
+    std::shared_lock lock(_storage->Stripe(collection_id));
+    if (_storage->_storage.NewCursor(collection_id) == nullptr) {
+      return nullptr;
+    }
+  }
+  return std::make_unique<VersionedStorage::SnapshotCursor>(*_storage, _sequence, collection_id);
+}
+
+bool StorageSnapshot::WrittenAfter(size_t collection_id, BytesConstView key) const {
+  std::shared_lock lock(_storage->Stripe(collection_id));
+  return _storage->FindVersion(collection_id, key, _sequence) != nullptr;
+}
+
+size_t StorageSnapshot::ReadCopyCount() const {
+  std::lock_guard lock(_read_copies->mutex);
+  size_t count = 0;
+  for (const ReadCopies::Copies& copies : _read_copies->by_collection) {
+    count += copies.size();
+  }
+  return count;
+}
+
+void StorageSnapshot::ReleaseReadCopies() const {
+  std::lock_guard lock(_read_copies->mutex);
+  _read_copies->by_collection.clear();
+}
+
+StorageSnapshot VersionedStorage::GetSnapshot() const {
+  // A commit that saved no versions would change what a snapshot at the previous sequence reads.
+  std::unique_lock lock(_snapshots_mutex);
+  _unsaved_done.wait(lock, [&] { return _unsaved_sequence == 0; });
+  const uint64_t sequence = _sequence.load();
+  _snapshots.insert(sequence);
+  return StorageSnapshot(*this, sequence);
+}
+
+uint64_t VersionedStorage::LastSequence() const { return _sequence.load(); }
+
+uint64_t VersionedStorage::OldestSnapshot() const {
+  std::lock_guard lock(_snapshots_mutex);
+  return _snapshots.empty() ? _sequence.load() : *_snapshots.begin();
+}
+
+size_t VersionedStorage::RetainedVersionCount() const { return _retired_count.load(); }
+
+template <typename Save, typename Apply>
+absl::Status VersionedStorage::Commit(const Written& written, const Save& save,
+                                      const Apply& apply) {
+  std::lock_guard commit_lock(_commit_mutex);
+  const uint64_t sequence = _sequence.load() + 1;
+  bool saved = false;
+  {
+    std::lock_guard lock(_snapshots_mutex);
+    saved = !_snapshots.empty();
+    if (!saved) {
+      _unsaved_sequence = sequence;
+    }
+  }
+  absl::Cleanup unsaved_done = [&] {
+    if (!saved) {
+      {
+        std::lock_guard lock(_snapshots_mutex);
+        _unsaved_sequence = 0;
+      }
+      _unsaved_done.notify_all();
+    }
+  };
+
+  PendingVersions pending;
+  if (saved) {
+    RETURN_IF_ERROR(save(pending));
+  }
+  // Destroyed after the locks are released.
+  std::vector<std::shared_ptr<const Bytes>> freed;
+  Reclaim(freed);
+
+  // Without snapshots, none reads a stripe until the commit is over: GetSnapshot() waits for it.
+  std::vector<std::unique_lock<std::shared_mutex>> stripes = LockStripes(written, saved);
+  const size_t added = AddVersions(std::move(pending), sequence);
+  // A failed write leaves the latest values as they were: snapshots must not read the versions.
+  absl::Cleanup remove_versions = [&] { RemoveVersions(added); };
+  RETURN_IF_ERROR(apply());
+  std::move(remove_versions).Cancel();
+  _sequence = sequence;
+  return absl::OkStatus();
+}
+
+std::vector<std::unique_lock<std::shared_mutex>> VersionedStorage::LockStripes(
+    const Written& written, bool lock) {
+  std::vector<std::unique_lock<std::shared_mutex>> locks;
+  // Always in stripe order.
+  const bool all = written.all || written.end > _written_end;
+  for (size_t stripe = 0; lock && stripe < kStripeCount; ++stripe) {
+    if (all || written.stripes.test(stripe)) {
+      locks.emplace_back(_stripes[stripe]);
+    }
+  }
+  if (all) {
+    _written_end = std::max(_written_end, written.end);
+    if (_history.size() < _written_end) {
+      _history.resize(_written_end);
+    }
+  }
+  return locks;
+}
+
+void VersionedStorage::Put(const size_t collection_id, BytesConstView key, Bytes&& value) {
+  Written written;
+  written.Add(collection_id);
+  // Neither step can fail.
+  (void)Commit(
+      written,
+      [&](PendingVersions& pending) -> absl::Status {
+        SaveVersion(collection_id, key, pending);
+        return absl::OkStatus();
+      },
+      [&]() -> absl::Status {
+        _storage.Put(collection_id, key, std::move(value));
+        return absl::OkStatus();
+      });
+}
+
+absl::Status VersionedStorage::Delete(const size_t collection_id, BytesConstView key) {
+  Written written;
+  written.Add(collection_id);
+  return Commit(
+      written,
+      [&](PendingVersions& pending) -> absl::Status {
+        SaveVersion(collection_id, key, pending);
+        return absl::OkStatus();
+      },
+      [&] { return _storage.Delete(collection_id, key); });
+}
+
+absl::Status VersionedStorage::DeleteRange(const size_t collection_id, BytesConstView begin,
+                                           BytesConstView end) {
+  Written written;
+  written.Add(collection_id);
+  return Commit(
+      written,
+      [&](PendingVersions& pending) { return SaveRange(collection_id, begin, &end, pending); },
+      [&] { return _storage.DeleteRange(collection_id, begin, end); });
+}
+
+absl::Status VersionedStorage::Truncate(const size_t collection_id) {
+  Written written;
+  written.Add(collection_id);
+  return Commit(
+      written,
+      [&](PendingVersions& pending) {
+        return SaveRange(collection_id, BytesConstView{}, /*end=*/nullptr, pending);
+      },
+      [&] { return _storage.Truncate(collection_id); });
+}
+
+absl::Status VersionedStorage::Write(WriteBatch&& batch) {
+  Written written;
+  for (const WriteBatch::Op& op : batch.ops()) {
+    written.Add(op.collection_id);
+  }
+  return Commit(
+      written,
+      [&](PendingVersions& pending) -> absl::Status {
+        pending.reserve(batch.size());
+        for (const WriteBatch::Op& op : batch.ops()) {
+          SaveVersion(op.collection_id, op.key, pending);
+        }
+        return absl::OkStatus();
+      },
+      [&] { return _storage.Write(std::move(batch)); });
+}
+
+void VersionedStorage::Clear() {
+  Written written;
+  written.all = true;
+  absl::Status status = Commit(
+      written,
+      [&](PendingVersions& pending) -> absl::Status {
+        for (size_t i = 0; i < _storage.GetCollectionCount(); ++i) {
+          RETURN_IF_ERROR(SaveRange(i, BytesConstView{}, /*end=*/nullptr, pending));
+        }
+        return absl::OkStatus();
+      },
+      [&]() -> absl::Status {
+        _storage.Clear();
+        return absl::OkStatus();
+      });
+  if (!status.ok()) {
+    throw std::runtime_error("Failed to save versions before clearing: " + status.ToString());
+  }
+}
+
+const VersionedStorage::Version* VersionedStorage::VisibleVersion(const VersionChain& chain,
+                                                                  uint64_t sequence) {
+  auto it = std::ranges::upper_bound(chain, sequence, {}, &Version::superseded_at);
+  return it == chain.end() ? nullptr : &*it;
+}
+
+void VersionedStorage::SaveVersion(size_t collection_id, BytesConstView key,
+                                   PendingVersions& pending) const {
+  BytesConstView current;
+  std::shared_ptr<const Bytes> value;
+  if (_storage.Get(collection_id, key, current).ok()) {
+    value = CopyBytes(current);
+  }
+  pending.push_back({collection_id, SmallKey(key), std::move(value)});
+}
+
+absl::Status VersionedStorage::SaveRange(size_t collection_id, BytesConstView begin,
+                                         const BytesConstView* end,
+                                         PendingVersions& pending) const {
+  std::unique_ptr<StorageCursor> cursor = _storage.NewCursor(collection_id);
+  if (cursor == nullptr) {
+    return absl::FailedPreconditionError("Storage does not keep keys ordered");
+  }
+  for (cursor->Seek(begin); cursor->Valid(); cursor->Next()) {
+    if (end != nullptr && !std::ranges::lexicographical_compare(cursor->Key(), *end)) {
+      break;
+    }
+    pending.push_back({collection_id, SmallKey(cursor->Key()), CopyBytes(cursor->Value())});
+  }
+  return absl::OkStatus();
+}
+
+bool VersionedStorage::HasSnapshots() const {
+  std::lock_guard lock(_snapshots_mutex);
+  return !_snapshots.empty();
+}
+
+void VersionedStorage::Reclaim(std::vector<std::shared_ptr<const Bytes>>& freed) {
+  if (_retired.empty()) {
+    return;
+  }
+  // A version superseded at S is only read by snapshots older than S.
+  const uint64_t oldest = OldestSnapshot();
+  size_t count = 0;
+  std::bitset<kStripeCount> stripes;
+  while (count < _retired.size() && _retired[count].superseded_at <= oldest) {
+    stripes.set(_retired[count].collection_id % kStripeCount);
+    ++count;
+  }
+  for (size_t stripe = 0; stripe < kStripeCount; ++stripe) {
+    if (!stripes.test(stripe)) {
+      continue;
+    }
+    std::unique_lock lock(_stripes[stripe]);
+    // A key's versions are retired oldest first, so each is the front of its chain.
+    for (size_t i = 0; i < count; ++i) {
+      const RetiredVersion& retired = _retired[i];
+      if (retired.collection_id % kStripeCount != stripe) {
+        continue;
+      }
+      VersionChain& chain = retired.chain->second;
+      if (chain.front().value != nullptr) {
+        freed.push_back(std::move(chain.front().value));
+      }
+      chain.erase(chain.begin());
+      if (chain.empty()) {
+        _history[retired.collection_id].erase(retired.chain);
+      }
+    }
+  }
+  _retired.erase(_retired.begin(), _retired.begin() + count);
+  _retired_count = _retired.size();
+}
+
+size_t VersionedStorage::AddVersions(PendingVersions&& pending, uint64_t sequence) {
+  size_t added = 0;
+  for (PendingVersion& version : pending) {
+    History& history = _history[version.collection_id];
+    auto it = history.lower_bound(version.key);
+    if (it == history.end() ||
+        !std::ranges::equal(BytesConstView(it->first), version.key.view())) {
+      it = history.emplace_hint(it, std::move(version.key), VersionChain{});
+    }
+    VersionChain& chain = it->second;
+    if (!chain.empty() && chain.back().superseded_at == sequence) {
+      // Already saved for an earlier write of the same commit.
+      continue;
+    }
+    chain.push_back({sequence, std::move(version.value)});
+    _retired.push_back({sequence, version.collection_id, it});
+    ++added;
+  }
+  _retired_count = _retired.size();
+  return added;
+}
+
+void VersionedStorage::RemoveVersions(size_t count) {
+  for (; count > 0; --count) {
+    const RetiredVersion& retired = _retired.back();
+    VersionChain& chain = retired.chain->second;
+    chain.pop_back();
+    if (chain.empty()) {
+      _history[retired.collection_id].erase(retired.chain);
+    }
+    _retired.pop_back();
+  }
+  _retired_count = _retired.size();
+}
+
+const VersionedStorage::Version* VersionedStorage::FindVersion(size_t collection_id,
+                                                               BytesConstView key,
+                                                               uint64_t sequence) const {
+  if (collection_id >= _history.size()) {
+    return nullptr;
+  }
+  const History& history = _history[collection_id];
+  auto it = history.find(key);
+  return it == history.end() ? nullptr : VisibleVersion(it->second, sequence);
+}
+
+absl::Status VersionedStorage::ReadAt(uint64_t sequence, size_t collection_id, BytesConstView key,
+                                      BytesConstView& value,
+                                      StorageSnapshot::ReadCopies& read_copies,
+                                      std::vector<Bytes>* copies) const {
+  // Kept in the history at least as long as the snapshot reading it.
+  if (const Version* version = FindVersion(collection_id, key, sequence)) {
+    if (version->value == nullptr) {
+      return absl::NotFoundError("Key not found");
+    }
+    value = *version->value;
+    return absl::OkStatus();
+  }
+  if (const Bytes* copy = read_copies.Find(collection_id, key)) {
+    value = *copy;
+    return absl::OkStatus();
+  }
+  BytesConstView latest;
+  RETURN_IF_ERROR(_storage.Get(collection_id, key, latest));
+  if (copies != nullptr) {
+    value = copies->emplace_back(latest.begin(), latest.end());
+    return absl::OkStatus();
+  }
+  value = read_copies.Add(collection_id, key, Bytes(latest.begin(), latest.end()));
+  return absl::OkStatus();
+}
+
+void VersionedStorage::ReleaseSnapshot(uint64_t sequence) const {
+  std::lock_guard lock(_snapshots_mutex);
+  _snapshots.erase(_snapshots.find(sequence));
+}
+
+}  // namespace gendb
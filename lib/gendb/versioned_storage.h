@@ -0,0 +1,291 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bitset>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <shared_mutex>
+#include <span>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "gendb/bytes.h"
+#include "gendb/small_key.h"
+#include "gendb/storage.h"
+
+namespace gendb {
+
+class VersionedStorage;
+
+// Read-only view of a VersionedStorage as of one commit sequence number. It holds no lock between
+// calls, so writes proceed while it is alive; reads of a collection only wait while a commit
+// writing that collection applies its writes to the underlying storage (see VersionedStorage).
+// Such a commit waits in turn for the reads of the collection in progress, each of which holds
+// its stripe for one lookup, one MultiGet or one cursor batch. Values read with Get and MultiGet
+// stay valid for the lifetime of the snapshot, or until ReleaseReadCopies(); cursor values until
+// the cursor moves.
+class StorageSnapshot {
+ public:
+  StorageSnapshot(StorageSnapshot&& other) noexcept;
+  StorageSnapshot& operator=(StorageSnapshot&&) = delete;
+  ~StorageSnapshot();
+
+  // Sequence number of the last write visible to this snapshot.
+  uint64_t sequence() const { return _sequence; }
+
+  // Latest values are copied on the first read; repeated reads of a key take no lock.
+  absl::Status Get(size_t collection_id, BytesConstView key, BytesConstView& value) const;
+
+  // Batched Get under a single lock acquisition. All spans must have the same size.
+  void MultiGet(size_t collection_id, std::span<const BytesConstView> keys,
+                std::span<BytesConstView> values, std::span<absl::Status> statuses) const;
+
+  // Same as above, but latest values are copied into `copies` rather than into the snapshot,
+  // which keeps none of them: the views stay valid until `copies` is cleared. For scans, which
+  // would otherwise leave the snapshot holding a copy of every value they read.
+  void MultiGet(size_t collection_id, std::span<const BytesConstView> keys,
+                std::span<BytesConstView> values, std::span<absl::Status> statuses,
+                std::vector<Bytes>& copies) const;
+
+  // Cursor over the collection as of the snapshot, or nullptr if the underlying storage does not
+  // keep keys ordered. It reads ahead in small batches, one lock acquisition per batch.
+  std::unique_ptr<StorageCursor> NewCursor(size_t collection_id) const;
+
+  // True if a commit after the snapshot wrote or deleted `key`: the versions such commits
+  // supersede are kept for as long as the snapshot is open.
+  bool WrittenAfter(size_t collection_id, BytesConstView key) const;
+
+  // Number of latest values this snapshot copied on read. They are freed with the snapshot.
+  size_t ReadCopyCount() const;
+
+  // Frees the latest values copied by the reads so far, whose views are invalid afterwards. For
+  // snapshots kept across many reads.
+  void ReleaseReadCopies() const;
+
+ private:
+  friend class VersionedStorage;
+  struct ReadCopies;
+
+  StorageSnapshot(const VersionedStorage& storage, uint64_t sequence);
+
+  const VersionedStorage* _storage;
+  uint64_t _sequence;
+  std::unique_ptr<ReadCopies> _read_copies;
+};
+
+// Multi-version layer over another storage. Every write is a commit with the next sequence number.
+// While snapshots are open, a commit first copies the versions it is about to overwrite or delete
+// into a per-key history, tagged with the commit's sequence number; a snapshot at sequence S
+// reads a key's oldest history version superseded after S, or the latest value if none was. With
+// no open snapshot nothing is copied.
+//
+// Commits are serialized by their own mutex and copy the versions they supersede without
+// excluding snapshot reads: only commits write the underlying storage, and reading it is safe
+// alongside other reads. The underlying storage is not safe to read while it is written, so the
+// collections are striped over kStripeCount reader locks: a commit locks the stripes of the
+// collections it writes while it adds its versions and applies its writes, and snapshot reads of
+// the other collections do not wait for it. The first write to a collection this storage has not
+// written before, and Clear, lock every stripe, since the underlying storage may grow its
+// collections. A commit whose write fails takes its versions back.
+//
+// History versions are reclaimed by the first commit after every snapshot that could read them is
+// destroyed, one stripe at a time. Snapshots read them in place; a latest value they read is
+// copied into the snapshot, once per key, and freed with it. Reads and cursors through the
+// Storage interface see the latest values and, like the other storages, must not race with
+// writes.
+class VersionedStorage : public Storage {
+ public:
+  explicit VersionedStorage(Storage& storage) : _storage(storage) {}
+
+  static constexpr size_t kStripeCount = 16;
+
+  // Registers a snapshot at the last committed sequence. Waits for a commit that started while no
+  // snapshot was open, which saves no versions, to finish.
+  StorageSnapshot GetSnapshot() const;
+
+  // Sequence number of the last write; 0 before the first one.
+  uint64_t LastSequence() const;
+
+  // Sequence of the oldest open snapshot, or LastSequence() if there is none. Data removed by a
+  // commit with a higher sequence number may still be read by a snapshot.
+  uint64_t OldestSnapshot() const;
+
+  // Number of history versions held for open snapshots.
+  size_t RetainedVersionCount() const;
+
+  void Put(const size_t collection_id, BytesConstView key, Bytes&& value) override;
+
+  absl::Status Delete(const size_t collection_id, BytesConstView key) override;
+
+  // With open snapshots the range is walked to save its versions, which needs a storage that
+  // keeps keys ordered (see Storage::NewCursor).
+  absl::Status DeleteRange(const size_t collection_id, BytesConstView begin,
+                           BytesConstView end) override;
+
+  absl::Status Truncate(const size_t collection_id) override;
+
+  absl::Status Get(const size_t collection_id, BytesConstView key,
+                   BytesConstView& value) const override {
+    return _storage.Get(collection_id, key, value);
+  }
+
+  absl::Status GetPinned(const size_t collection_id, BytesConstView key, BytesConstView& value,
+                         ValuePins& pins) const override {
+    return _storage.GetPinned(collection_id, key, value, pins);
+  }
+
+  void MultiGet(const size_t collection_id, std::span<const BytesConstView> keys,
+                std::span<BytesConstView> values, std::span<absl::Status> statuses,
+                ValuePins& pins) const override {
+    _storage.MultiGet(collection_id, keys, values, statuses, pins);
+  }
+
+  bool ReadsBlock() const override { return _storage.ReadsBlock(); }
+
+  bool Exists(const size_t collection_id, BytesConstView key) const override {
+    return _storage.Exists(collection_id, key);
+  }
+
+  // One commit for the whole batch.
+  absl::Status Write(WriteBatch&& batch) override;
+
+  size_t GetCollectionCount() const override { return _storage.GetCollectionCount(); }
+
+  size_t GetCollectionSize(const size_t collection_id) const override {
+    return _storage.GetCollectionSize(collection_id);
+  }
+
+  std::unique_ptr<StorageCursor> NewCursor(const size_t collection_id) const override {
+    return _storage.NewCursor(collection_id);
+  }
+
+  size_t EstimateCollectionSize(const size_t collection_id) const override {
+    return _storage.EstimateCollectionSize(collection_id);
+  }
+
+  // Clears the latest values only; open snapshots keep reading their versions.
+  void Clear() override;
+
+ private:
+  friend class StorageSnapshot;
+
+  struct Version {
+    uint64_t superseded_at;  // Sequence of the commit that overwrote or deleted this version.
+    std::shared_ptr<const Bytes> value;  // nullptr if the key did not exist.
+  };
+
+  struct KeyLess {
+    using is_transparent = void;
+    bool operator()(BytesConstView a, BytesConstView b) const {
+      return std::ranges::lexicographical_compare(a, b);
+    }
+  };
+
+  // Oldest version first.
+  using VersionChain = std::vector<Version>;
+  using History = std::map<SmallKey, VersionChain, KeyLess>;
+
+  struct RetiredVersion {
+    uint64_t superseded_at;
+    size_t collection_id;
+    History::iterator chain;
+  };
+
+  // Collections a commit writes.
+  struct Written {
+    void Add(size_t collection_id) {
+      stripes.set(collection_id % kStripeCount);
+      end = std::max(end, collection_id + 1);
+    }
+
+    std::bitset<kStripeCount> stripes;
+    // One past the highest collection written.
+    size_t end = 0;
+    // Every collection, as Clear does.
+    bool all = false;
+  };
+
+  // A version the running commit supersedes: the key's value before the commit, or nullptr if
+  // the key did not exist.
+  struct PendingVersion {
+    size_t collection_id;
+    SmallKey key;
+    std::shared_ptr<const Bytes> value;
+  };
+  using PendingVersions = std::vector<PendingVersion>;
+
+  class SnapshotCursor;
+
+  // Version of the chain visible at `sequence`, or nullptr if the latest value is.
+  static const Version* VisibleVersion(const VersionChain& chain, uint64_t sequence);
+
+  // Runs one commit under `_commit_mutex`. While snapshots are open, `save` adds the versions the
+  // commit supersedes to its argument before any stripe is locked; `apply` then writes the
+  // underlying storage under the stripes of the `written` collections.
+  template <typename Save, typename Apply>
+  absl::Status Commit(const Written& written, const Save& save, const Apply& apply);
+
+  // Locks the stripes of the `written` collections, or all of them if the underlying storage may
+  // grow its collections. Without `lock`, only grows the history: no snapshot can read it.
+  std::vector<std::unique_lock<std::shared_mutex>> LockStripes(const Written& written, bool lock);
+  std::shared_mutex& Stripe(size_t collection_id) const {
+    return _stripes[collection_id % kStripeCount];
+  }
+
+  // Callers hold `_commit_mutex`.
+  void SaveVersion(size_t collection_id, BytesConstView key, PendingVersions& pending) const;
+  // Saves every key in [begin, end), or from `begin` on if `end` is nullptr.
+  absl::Status SaveRange(size_t collection_id, BytesConstView begin, const BytesConstView* end,
+                         PendingVersions& pending) const;
+  bool HasSnapshots() const;
+
+  // Callers hold `_commit_mutex`. Reclaim unlinks the versions no open snapshot can read, locking
+  // their stripes one at a time, and hands their values to `freed`, to be destroyed after the
+  // locks are released.
+  void Reclaim(std::vector<std::shared_ptr<const Bytes>>& freed);
+  // Callers also hold the stripes of the versions' collections. AddVersions returns the number
+  // of versions it added, which RemoveVersions takes back, the last one first.
+  size_t AddVersions(PendingVersions&& pending, uint64_t sequence);
+  void RemoveVersions(size_t count);
+
+  // Callers hold the stripe of `collection_id`.
+  const Version* FindVersion(size_t collection_id, BytesConstView key, uint64_t sequence) const;
+  // Reads the history version visible at `sequence`, or else the snapshot's copy of the latest
+  // value, made on its first read into `read_copies`, or into `copies` if given.
+  absl::Status ReadAt(uint64_t sequence, size_t collection_id, BytesConstView key,
+                      BytesConstView& value, StorageSnapshot::ReadCopies& read_copies,
+                      std::vector<Bytes>* copies = nullptr) const;
+
+  void ReleaseSnapshot(uint64_t sequence) const;
+
+  Storage& _storage;
+  // Serializes commits.
+  std::mutex _commit_mutex;
+  // Excludes snapshot reads of a collection from the part of a commit that writes its history and
+  // the underlying storage. Collection i belongs to stripe i % kStripeCount.
+  mutable std::array<std::shared_mutex, kStripeCount> _stripes;
+  std::atomic<uint64_t> _sequence = 0;
+  // One past the highest collection written through this storage. Under `_commit_mutex`.
+  size_t _written_end = 0;
+  // At least `_written_end` long; only resized under every stripe.
+  std::vector<History> _history;
+  // Every history version in commit order, for reclamation. Under `_commit_mutex`.
+  std::deque<RetiredVersion> _retired;
+  std::atomic<size_t> _retired_count = 0;
+
+  mutable std::mutex _snapshots_mutex;
+  mutable std::multiset<uint64_t> _snapshots;
+  // Sequence of the running commit if it found no snapshot to save versions for, else 0. New
+  // snapshots wait for it.
+  uint64_t _unsaved_sequence = 0;
+  mutable std::condition_variable _unsaved_done;
+};
+
+}  // namespace gendb
@@ -0,0 +1,433 @@
+#include "gendb/versioned_storage.h"
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gendb/arena_storage.h"
+#include "gendb/layered_storage.h"
+#include "gtest/gtest.h"
+#include "status_matchers.h"
+
+namespace gendb {
+namespace {
+
+BytesConstView StringToBytesView(const std::string& str) {
+  return {reinterpret_cast<const uint8_t*>(str.data()), str.size()};
+}
+
+Bytes StringToBytes(const std::string& str) {
+  return {reinterpret_cast<const uint8_t*>(str.data()),
+          reinterpret_cast<const uint8_t*>(str.data()) + str.size()};
+}
+
+std::string BytesViewToString(BytesConstView bytes) {
+  return {reinterpret_cast<const char*>(bytes.data()), bytes.size()};
+}
+
+std::string GetString(const StorageSnapshot& snapshot, const std::string& key) {
+  BytesConstView value;
+  absl::Status status = snapshot.Get(0, StringToBytesView(key), value);
+  return status.ok() ? BytesViewToString(value) : "<" + status.ToString() + ">";
+}
+
+std::vector<std::string> ScanAll(const StorageSnapshot& snapshot) {
+  std::vector<std::string> entries;
+  auto cursor = snapshot.NewCursor(0);
+  for (cursor->Seek(BytesConstView{}); cursor->Valid(); cursor->Next()) {
+    entries.push_back(BytesViewToString(cursor->Key()) + "=" +
+                      BytesViewToString(cursor->Value()));
+  }
+  return entries;
+}
+
+class VersionedStorageTest : public ::testing::Test {
+ protected:
+  ArenaStorage _latest;
+  VersionedStorage _storage{_latest};
+};
+
+TEST_F(VersionedStorageTest, EveryWriteIsACommit) {
+  EXPECT_EQ(_storage.LastSequence(), 0);
+  // Batches hold views of their keys.
+  const std::string a = "a";
+  const std::string b = "b";
+  _storage.Put(0, StringToBytesView(a), StringToBytes("1"));
+  WriteBatch batch;
+  batch.Put(0, StringToBytesView(b), StringToBytes("2"));
+  batch.Delete(0, StringToBytesView(a));
+  ASSERT_OK(_storage.Write(std::move(batch)));
+  EXPECT_EQ(_storage.LastSequence(), 2);
+  EXPECT_NOT_FOUND(_storage.Delete(0, StringToBytesView("a")));
+  EXPECT_EQ(_storage.LastSequence(), 2);
+}
+
+TEST_F(VersionedStorageTest, SnapshotReadsVersionsAtItsSequence) {
+  _storage.Put(0, StringToBytesView("a"), StringToBytes("a1"));
+  _storage.Put(0, StringToBytesView("b"), StringToBytes("b1"));
+  StorageSnapshot snapshot = _storage.GetSnapshot();
+  EXPECT_EQ(snapshot.sequence(), 2);
+
+  _storage.Put(0, StringToBytesView("a"), StringToBytes("a2"));
+  ASSERT_OK(_storage.Delete(0, StringToBytesView("b")));
+  _storage.Put(0, StringToBytesView("c"), StringToBytes("c2"));
+  StorageSnapshot later = _storage.GetSnapshot();
+  _storage.Put(0, StringToBytesView("a"), StringToBytes("a3"));
+
+  EXPECT_EQ(GetString(snapshot, "a"), "a1");
+  EXPECT_EQ(GetString(snapshot, "b"), "b1");
+  EXPECT_EQ(GetString(snapshot, "c"), "<NOT_FOUND: Key not found>");
+  EXPECT_EQ(GetString(later, "a"), "a2");
+  EXPECT_EQ(GetString(later, "b"), "<NOT_FOUND: Key not found>");
+  EXPECT_EQ(GetString(later, "c"), "c2");
+
+  EXPECT_EQ(ScanAll(snapshot), (std::vector<std::string>{"a=a1", "b=b1"}));
+  EXPECT_EQ(ScanAll(later), (std::vector<std::string>{"a=a2", "c=c2"}));
+  EXPECT_EQ(ScanAll(_storage.GetSnapshot()), (std::vector<std::string>{"a=a3", "c=c2"}));
+}
+
+TEST_F(VersionedStorageTest, MultiGetMixesVersionsAndLatestValues) {
+  _storage.Put(0, StringToBytesView("a"), StringToBytes("a1"));
+  _storage.Put(0, StringToBytesView("b"), StringToBytes("b1"));
+  _storage.Put(0, StringToBytesView("e"), Bytes{});
+  StorageSnapshot snapshot = _storage.GetSnapshot();
+  _storage.Put(0, StringToBytesView("a"), StringToBytes("a2"));
+  _storage.Put(0, StringToBytesView("c"), StringToBytes("c2"));
+
+  const std::vector<std::string> keys = {"a", "b", "c", "e"};
+  std::vector<BytesConstView> key_views;
+  for (const std::string& key : keys) {
+    key_views.push_back(StringToBytesView(key));
+  }
+  std::vector<BytesConstView> values(keys.size());
+  std::vector<absl::Status> statuses(keys.size());
+  snapshot.MultiGet(0, key_views, values, statuses);
+
+  EXPECT_OK(statuses[0]);
+  EXPECT_EQ(BytesViewToString(values[0]), "a1");
+  EXPECT_OK(statuses[1]);
+  EXPECT_EQ(BytesViewToString(values[1]), "b1");
+  EXPECT_NOT_FOUND(statuses[2]);
+  EXPECT_OK(statuses[3]);
+  EXPECT_TRUE(values[3].empty());
+}
+
+TEST_F(VersionedStorageTest, ValuesOutliveLaterWrites) {
+  _storage.Put(0, StringToBytesView("k"), StringToBytes("old"));
+  StorageSnapshot snapshot = _storage.GetSnapshot();
+  BytesConstView value;
+  ASSERT_OK(snapshot.Get(0, StringToBytesView("k"), value));
+  // Overwrites move records around in the arena; the snapshot's value is its own.
+  for (int i = 0; i < 1000; ++i) {
+    _storage.Put(0, StringToBytesView("k"), StringToBytes(std::string(100, 'x')));
+  }
+  EXPECT_EQ(BytesViewToString(value), "old");
+}
+
+TEST_F(VersionedStorageTest, ReadCopiesBelongToTheirSnapshot) {
+  _storage.Put(0, StringToBytesView("k"), StringToBytes("old"));
+  StorageSnapshot snapshot = _storage.GetSnapshot();
+  BytesConstView first;
+  ASSERT_OK(snapshot.Get(0, StringToBytesView("k"), first));
+  for (int i = 0; i < 100; ++i) {
+    BytesConstView value;
+    ASSERT_OK(snapshot.Get(0, StringToBytesView("k"), value));
+    EXPECT_EQ(value.data(), first.data());
+  }
+  EXPECT_EQ(snapshot.ReadCopyCount(), 1);
+
+  {
+    StorageSnapshot other = _storage.GetSnapshot();
+    for (int i = 0; i < 100; ++i) {
+      _storage.Put(0, StringToBytesView(std::to_string(i)), StringToBytes("v"));
+    }
+    StorageSnapshot later = _storage.GetSnapshot();
+    for (int i = 0; i < 100; ++i) {
+      BytesConstView value;
+      ASSERT_OK(later.Get(0, StringToBytesView(std::to_string(i)), value));
+    }
+    // Copies go with the snapshot that made them, while the others stay open.
+    EXPECT_EQ(later.ReadCopyCount(), 100);
+    EXPECT_EQ(other.ReadCopyCount(), 0);
+  }
+  EXPECT_EQ(snapshot.ReadCopyCount(), 1);
+
+  // The overwrite saves its own version; the snapshot keeps reading its copy.
+  _storage.Put(0, StringToBytesView("k"), StringToBytes("new"));
+  EXPECT_TRUE(snapshot.WrittenAfter(0, StringToBytesView("k")));
+  BytesConstView value;
+  ASSERT_OK(snapshot.Get(0, StringToBytesView("k"), value));
+  EXPECT_EQ(value.data(), first.data());
+  EXPECT_EQ(BytesViewToString(first), "old");
+}
+
+TEST_F(VersionedStorageTest, ScanCopiesAreFreedByTheirCaller) {
+  _storage.Put(0, StringToBytesView("a"), StringToBytes("1"));
+  _storage.Put(0, StringToBytesView("b"), StringToBytes("2"));
+  StorageSnapshot snapshot = _storage.GetSnapshot();
+  _storage.Put(0, StringToBytesView("a"), StringToBytes("3"));
+
+  const std::vector<BytesConstView> keys = {StringToBytesView("a"), StringToBytesView("b")};
+  std::vector<BytesConstView> values(keys.size());
+  std::vector<absl::Status> statuses(keys.size());
+  std::vector<Bytes> copies;
+  snapshot.MultiGet(0, keys, values, statuses, copies);
+  ASSERT_OK(statuses[0]);
+  ASSERT_OK(statuses[1]);
+  EXPECT_EQ(BytesViewToString(values[0]), "1");
+  EXPECT_EQ(BytesViewToString(values[1]), "2");
+  // Only "b" was read from the latest values; "a" from the history.
+  EXPECT_EQ(copies.size(), 1);
+  EXPECT_EQ(snapshot.ReadCopyCount(), 0);
+
+  BytesConstView value;
+  ASSERT_OK(snapshot.Get(0, StringToBytesView("b"), value));
+  EXPECT_EQ(snapshot.ReadCopyCount(), 1);
+  snapshot.ReleaseReadCopies();
+  EXPECT_EQ(snapshot.ReadCopyCount(), 0);
+  ASSERT_OK(snapshot.Get(0, StringToBytesView("b"), value));
+  EXPECT_EQ(BytesViewToString(value), "2");
+}
+
+TEST_F(VersionedStorageTest, WrittenAfterReportsLaterCommits) {
+  _storage.Put(0, StringToBytesView("a"), StringToBytes("a1"));
+  _storage.Put(0, StringToBytesView("b"), StringToBytes("b1"));
+  StorageSnapshot snapshot = _storage.GetSnapshot();
+  _storage.Put(0, StringToBytesView("a"), StringToBytes("a2"));
+  ASSERT_OK(_storage.Delete(0, StringToBytesView("b")));
+  _storage.Put(0, StringToBytesView("c"), StringToBytes("c2"));
+  StorageSnapshot later = _storage.GetSnapshot();
+
+  EXPECT_TRUE(snapshot.WrittenAfter(0, StringToBytesView("a")));
+  EXPECT_TRUE(snapshot.WrittenAfter(0, StringToBytesView("b")));
+  EXPECT_TRUE(snapshot.WrittenAfter(0, StringToBytesView("c")));
+  EXPECT_FALSE(snapshot.WrittenAfter(0, StringToBytesView("d")));
+  EXPECT_FALSE(snapshot.WrittenAfter(1, StringToBytesView("a")));
+  EXPECT_FALSE(later.WrittenAfter(0, StringToBytesView("a")));
+  _storage.Put(0, StringToBytesView("a"), StringToBytes("a3"));
+  EXPECT_TRUE(later.WrittenAfter(0, StringToBytesView("a")));
+}
+
+TEST_F(VersionedStorageTest, LayeredStorageReadsSnapshotBelowTempStorage) {
+  _storage.Put(0, StringToBytesView("a"), StringToBytes("a1"));
+  _storage.Put(0, StringToBytesView("b"), StringToBytes("b1"));
+  StorageSnapshot snapshot = _storage.GetSnapshot();
+  MemoryStorage temp_storage;
+  LayeredStorage layered(snapshot, &temp_storage);
+  _storage.Put(0, StringToBytesView("a"), StringToBytes("a2"));
+
+  Bytes* b = nullptr;
+  ASSERT_OK(layered.EnsureInTempStorage(0, StringToBytesView("b"), &b));
+  *b = StringToBytes("b2");
+  BytesConstView value;
+  ASSERT_OK(layered.Get(0, StringToBytesView("a"), value));
+  EXPECT_EQ(BytesViewToString(value), "a1");
+  ASSERT_OK(layered.Get(0, StringToBytesView("b"), value));
+  EXPECT_EQ(BytesViewToString(value), "b2");
+  ASSERT_OK(_storage.Get(0, StringToBytesView("b"), value));
+  EXPECT_EQ(BytesViewToString(value), "b1");
+}
+
+TEST_F(VersionedStorageTest, RangeDeletesAndTruncateKeepVersions) {
+  for (const std::string key : {"a", "b", "c", "d"}) {
+    _storage.Put(0, StringToBytesView(key), StringToBytes(key));
+  }
+  StorageSnapshot snapshot = _storage.GetSnapshot();
+  ASSERT_OK(_storage.DeleteRange(0, StringToBytesView("b"), StringToBytesView("d")));
+  StorageSnapshot after_range = _storage.GetSnapshot();
+  ASSERT_OK(_storage.Truncate(0));
+
+  EXPECT_EQ(ScanAll(snapshot), (std::vector<std::string>{"a=a", "b=b", "c=c", "d=d"}));
+  EXPECT_EQ(ScanAll(after_range), (std::vector<std::string>{"a=a", "d=d"}));
+  EXPECT_TRUE(ScanAll(_storage.GetSnapshot()).empty());
+}
+
+TEST_F(VersionedStorageTest, CursorCrossesReadAheadBatches) {
+  for (int i = 0; i < 100; ++i) {
+    _storage.Put(0, StringToBytesView(std::to_string(1000 + i)), StringToBytes("v1"));
+  }
+  StorageSnapshot snapshot = _storage.GetSnapshot();
+  auto cursor = snapshot.NewCursor(0);
+  cursor->Seek(StringToBytesView("1010"));
+  int expected = 1010;
+  for (; cursor->Valid(); cursor->Next(), ++expected) {
+    EXPECT_EQ(BytesViewToString(cursor->Key()), std::to_string(expected));
+    EXPECT_EQ(BytesViewToString(cursor->Value()), "v1");
+    // Writes between batches: deletes ahead of the cursor and new keys are not visible.
+    if (expected + 40 < 1100) {
+      ASSERT_OK(_storage.Delete(0, StringToBytesView(std::to_string(expected + 40))));
+    }
+    _storage.Put(0, StringToBytesView(std::to_string(expected) + "5"), StringToBytes("v2"));
+  }
+  EXPECT_EQ(expected, 1100);
+}
+
+TEST_F(VersionedStorageTest, VersionsAreReclaimedAfterSnapshotsClose) {
+  _storage.Put(0, StringToBytesView("k"), StringToBytes("v0"));
+  // No open snapshot: nothing is retained.
+  _storage.Put(0, StringToBytesView("k"), StringToBytes("v1"));
+  EXPECT_EQ(_storage.RetainedVersionCount(), 0);
+
+  {
+    StorageSnapshot snapshot = _storage.GetSnapshot();
+    _storage.Put(0, StringToBytesView("k"), StringToBytes("v2"));
+    _storage.Put(0, StringToBytesView("k"), StringToBytes("v3"));
+    EXPECT_EQ(_storage.RetainedVersionCount(), 2);
+    EXPECT_EQ(_storage.OldestSnapshot(), snapshot.sequence());
+  }
+  EXPECT_EQ(_storage.OldestSnapshot(), _storage.LastSequence());
+  _storage.Put(0, StringToBytesView("k"), StringToBytes("v4"));
+  EXPECT_EQ(_storage.RetainedVersionCount(), 0);
+}
+
+// Arena storage whose reads of the key "stall" wait until released, to hold a commit while it
+// copies the versions it supersedes.
+class StallingStorage : public ArenaStorage {
+ public:
+  absl::Status Get(const size_t collection_id, BytesConstView key,
+                   BytesConstView& value) const override {
+    if (BytesViewToString(key) == "stall") {
+      stalled = true;
+      while (!released) {
+        std::this_thread::yield();
+      }
+    }
+    return ArenaStorage::Get(collection_id, key, value);
+  }
+
+  mutable std::atomic<bool> stalled = false;
+  std::atomic<bool> released = false;
+};
+
+TEST(VersionedStorageCommitTest, SnapshotReadsDoNotWaitForVersionCopies) {
+  StallingStorage latest;
+  VersionedStorage storage(latest);
+  storage.Put(0, StringToBytesView("a"), StringToBytes("a1"));
+  storage.Put(0, StringToBytesView("stall"), StringToBytes("s1"));
+  StorageSnapshot snapshot = storage.GetSnapshot();
+
+  std::thread writer([&] {
+    const std::string a = "a";
+    const std::string stall = "stall";
+    WriteBatch batch;
+    batch.Put(0, StringToBytesView(a), StringToBytes("a2"));
+    batch.Put(0, StringToBytesView(stall), StringToBytes("s2"));
+    ASSERT_OK(storage.Write(std::move(batch)));
+  });
+  while (!latest.stalled) {
+    std::this_thread::yield();
+  }
+  // The commit is copying its versions: snapshots still open and read.
+  EXPECT_EQ(GetString(snapshot, "a"), "a1");
+  StorageSnapshot during = storage.GetSnapshot();
+  EXPECT_EQ(GetString(during, "a"), "a1");
+  EXPECT_FALSE(during.WrittenAfter(0, StringToBytesView("a")));
+  latest.released = true;
+  writer.join();
+
+  EXPECT_EQ(GetString(snapshot, "a"), "a1");
+  EXPECT_EQ(GetString(snapshot, "stall"), "s1");
+  EXPECT_EQ(GetString(storage.GetSnapshot(), "a"), "a2");
+}
+
+// Arena storage whose writes of the key "stall" wait until released, to hold a commit while it
+// applies its writes.
+class StallingWriteStorage : public ArenaStorage {
+ public:
+  void Put(const size_t collection_id, BytesConstView key, Bytes&& value) override {
+    if (BytesViewToString(key) == "stall") {
+      stalled = true;
+      while (!released) {
+        std::this_thread::yield();
+      }
+    }
+    ArenaStorage::Put(collection_id, key, std::move(value));
+  }
+
+  std::atomic<bool> stalled = false;
+  std::atomic<bool> released = false;
+};
+
+TEST(VersionedStorageCommitTest, SnapshotReadsOfOtherCollectionsDoNotWaitForWrites) {
+  StallingWriteStorage latest;
+  VersionedStorage storage(latest);
+  storage.Put(0, StringToBytesView("a"), StringToBytes("a1"));
+  storage.Put(1, StringToBytesView("b"), StringToBytes("b1"));
+  StorageSnapshot snapshot = storage.GetSnapshot();
+
+  std::thread writer([&] { storage.Put(0, StringToBytesView("stall"), StringToBytes("s2")); });
+  while (!latest.stalled) {
+    std::this_thread::yield();
+  }
+  // The commit is writing collection 0 only.
+  BytesConstView value;
+  ASSERT_OK(snapshot.Get(1, StringToBytesView("b"), value));
+  EXPECT_EQ(BytesViewToString(value), "b1");
+  EXPECT_FALSE(snapshot.WrittenAfter(1, StringToBytesView("b")));
+  latest.released = true;
+  writer.join();
+
+  EXPECT_EQ(GetString(snapshot, "stall"), "<NOT_FOUND: Key not found>");
+  EXPECT_EQ(GetString(storage.GetSnapshot(), "stall"), "s2");
+}
+
+TEST_F(VersionedStorageTest, FailedWriteTakesBackItsVersions) {
+  _storage.Put(0, StringToBytesView("a"), StringToBytes("a1"));
+  StorageSnapshot snapshot = _storage.GetSnapshot();
+  EXPECT_NOT_FOUND(_storage.Delete(0, StringToBytesView("x")));
+  EXPECT_EQ(_storage.LastSequence(), 1);
+  EXPECT_EQ(_storage.RetainedVersionCount(), 0);
+  EXPECT_FALSE(snapshot.WrittenAfter(0, StringToBytesView("x")));
+
+  _storage.Put(0, StringToBytesView("a"), StringToBytes("a2"));
+  EXPECT_EQ(_storage.LastSequence(), 2);
+  EXPECT_EQ(_storage.RetainedVersionCount(), 1);
+  EXPECT_EQ(GetString(snapshot, "a"), "a1");
+}
+
+TEST_F(VersionedStorageTest, ReadersSeeConsistentStateDuringWrites) {
+  // Every commit moves one unit between two keys; every snapshot must see the total unchanged.
+  constexpr int kTotal = 1000;
+  const std::string x_key = "x";
+  const std::string y_key = "y";
+  auto put_int = [](WriteBatch& batch, const std::string& key, int value) {
+    batch.Put(0, StringToBytesView(key), StringToBytes(std::to_string(value)));
+  };
+  {
+    WriteBatch batch;
+    put_int(batch, x_key, kTotal);
+    put_int(batch, y_key, 0);
+    ASSERT_OK(_storage.Write(std::move(batch)));
+  }
+
+  std::atomic<bool> done = false;
+  std::thread writer([&] {
+    for (int i = 1; i <= 2000; ++i) {
+      WriteBatch batch;
+      put_int(batch, x_key, kTotal - i % kTotal);
+      put_int(batch, y_key, i % kTotal);
+      ASSERT_OK(_storage.Write(std::move(batch)));
+    }
+    done = true;
+  });
+  std::vector<std::thread> readers;
+  for (int r = 0; r < 4; ++r) {
+    readers.emplace_back([&] {
+      while (!done) {
+        StorageSnapshot snapshot = _storage.GetSnapshot();
+        const int x = std::stoi(GetString(snapshot, "x"));
+        std::this_thread::yield();
+        const int y = std::stoi(GetString(snapshot, "y"));
+        EXPECT_EQ(x + y, kTotal);
+      }
+    });
+  }
+  writer.join();
+  for (std::thread& reader : readers) {
+    reader.join();
+  }
+}
+
+}  // namespace
+}  // namespace gendb
@@ -0,0 +1,456 @@
+#include "gendb/wal.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <filesystem>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "gendb/file.h"
+#include "gendb/status.h"
+
+namespace gendb {
+
+namespace {
+
+constexpr size_t kHeaderSize = 16;
+constexpr std::string_view kSegmentExtension = ".wal";
+
+constexpr std::array<uint32_t, 256> kCrc32cTable = [] {
+  std::array<uint32_t, 256> table{};
+  for (uint32_t i = 0; i < 256; ++i) {
+    uint32_t crc = i;
+    for (int bit = 0; bit < 8; ++bit) {
+      crc = (crc >> 1) ^ ((crc & 1) ? 0x82F63B78u : 0);
+    }
+    table[i] = crc;
+  }
+  return table;
+}();
+
+void PutVarint(Bytes& out, uint64_t value) {
+  while (value >= 0x80) {
+    out.push_back(static_cast<uint8_t>(value | 0x80));
+    value >>= 7;
+  }
+  out.push_back(static_cast<uint8_t>(value));
+}
+
+void PutLengthPrefixed(Bytes& out, BytesConstView bytes) {
+  PutVarint(out, bytes.size());
+  out.insert(out.end(), bytes.begin(), bytes.end());
+}
+
+template <typename T>
+void PutFixed(uint8_t* out, T value) {
+  for (size_t i = 0; i < sizeof(T); ++i) {
+    out[i] = static_cast<uint8_t>(value >> (8 * i));
+  }
+}
+
+template <typename T>
+T GetFixed(const uint8_t* in) {
+  T value = 0;
+  for (size_t i = 0; i < sizeof(T); ++i) {
+    value |= static_cast<T>(in[i]) << (8 * i);
+  }
+  return value;
+}
+
+// Reads the encoded ops of a WalBatch front to back. Every getter fails once the data runs out.
+class OpReader {
+ public:
+  explicit OpReader(BytesConstView data) : _data(data) {}
+
+  bool done() const { return _data.empty(); }
+
+  bool GetByte(uint8_t& value) {
+    if (_data.empty()) {
+      return false;
+    }
+    value = _data[0];
+    _data = _data.subspan(1);
+    return true;
+  }
+
+  bool GetVarint(uint64_t& value) {
+    value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+      uint8_t byte = 0;
+      if (!GetByte(byte)) {
+        return false;
+      }
+      value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+      if ((byte & 0x80) == 0) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  bool GetLengthPrefixed(BytesConstView& bytes) {
+    uint64_t size = 0;
+    if (!GetVarint(size) || size > _data.size()) {
+      return false;
+    }
+    bytes = _data.first(size);
+    _data = _data.subspan(size);
+    return true;
+  }
+
+  bool GetMask(absl::InlinedVector<uint32_t, 2>& mask) {
+    uint64_t count = 0;
+    if (!GetVarint(count) || count > _data.size()) {
+      return false;
+    }
+    mask.resize(count);
+    for (uint32_t& word : mask) {
+      uint64_t value = 0;
+      if (!GetVarint(value)) {
+        return false;
+      }
+      word = static_cast<uint32_t>(value);
+    }
+    return true;
+  }
+
+ private:
+  BytesConstView _data;
+};
+
+void PutMask(Bytes& out, const absl::InlinedVector<uint32_t, 2>& mask) {
+  PutVarint(out, mask.size());
+  for (uint32_t word : mask) {
+    PutVarint(out, word);
+  }
+}
+
+// Segment files of `dir` by the sequence number of their first record, in sequence order.
+std::vector<std::pair<uint64_t, std::filesystem::path>> ListSegments(const std::string& dir) {
+  std::vector<std::pair<uint64_t, std::filesystem::path>> segments;
+  for (const auto& entry : std::filesystem::directory_iterator(dir)) {
+    uint64_t first_sequence = 0;
+    const std::filesystem::path& path = entry.path();
+    if (path.extension() == kSegmentExtension &&
+        absl::SimpleAtoi(path.stem().string(), &first_sequence)) {
+      segments.emplace_back(first_sequence, path);
+    }
+  }
+  std::ranges::sort(segments);
+  return segments;
+}
+
+std::string SegmentName(uint64_t first_sequence) {
+  std::string digits = std::to_string(first_sequence);
+  return std::string(20 - digits.size(), '0') + digits + std::string(kSegmentExtension);
+}
+
+}  // namespace
+
+uint32_t Crc32c(BytesConstView data, uint32_t crc) {
+  crc = ~crc;
+  for (uint8_t byte : data) {
+    crc = kCrc32cTable[(crc ^ byte) & 0xFF] ^ (crc >> 8);
+  }
+  return ~crc;
+}
+
+void WalBatch::Put(size_t collection_id, BytesConstView key, BytesConstView value) {
+  _data.push_back(static_cast<uint8_t>(WalOp::Type::kPut));
+  PutVarint(_data, collection_id);
+  PutLengthPrefixed(_data, key);
+  PutLengthPrefixed(_data, value);
+}
+
+void WalBatch::Delete(size_t collection_id, BytesConstView key) {
+  _data.push_back(static_cast<uint8_t>(WalOp::Type::kDelete));
+  PutVarint(_data, collection_id);
+  PutLengthPrefixed(_data, key);
+}
+
+void WalBatch::Patch(size_t collection_id, BytesConstView key, const MessagePatch& patch) {
+  _data.push_back(static_cast<uint8_t>(WalOp::Type::kPatch));
+  PutVarint(_data, collection_id);
+  PutLengthPrefixed(_data, key);
+  PutMask(_data, patch.modified);
+  PutMask(_data, patch.removed);
+  PutLengthPrefixed(_data, patch.buffer);
+}
+
+absl::Status ForEachWalOp(BytesConstView data,
+                          const std::function<absl::Status(const WalOp&)>& fn) {
+  OpReader reader(data);
+  WalOp op;
+  while (!reader.done()) {
+    uint8_t type = 0;
+    uint64_t collection_id = 0;
+    bool ok = reader.GetByte(type) && reader.GetVarint(collection_id) &&
+              reader.GetLengthPrefixed(op.key);
+    op.type = static_cast<WalOp::Type>(type);
+    op.collection_id = collection_id;
+    switch (op.type) {
+      case WalOp::Type::kPut:
+        ok = ok && reader.GetLengthPrefixed(op.value);
+        break;
+      case WalOp::Type::kDelete:
+        break;
+      case WalOp::Type::kPatch: {
+        BytesConstView buffer;
+        ok = ok && reader.GetMask(op.patch.modified) && reader.GetMask(op.patch.removed) &&
+             reader.GetLengthPrefixed(buffer);
+        op.patch.buffer.assign(buffer.begin(), buffer.end());
+        break;
+      }
+      default:
+        ok = false;
+    }
+    if (!ok) {
+      return absl::DataLossError("Malformed WAL record");
+    }
+    RETURN_IF_ERROR(fn(op));
+  }
+  return absl::OkStatus();
+}
+
+Wal::Wal(WalOptions options, const ReplayFn& replay) : _options(std::move(options)) {
+  std::error_code error;
+  std::filesystem::create_directories(_options.dir, error);
+  if (error) {
+    throw std::runtime_error("Failed to create the WAL directory: " + error.message());
+  }
+
+  for (const auto& [first_sequence, path] : ListSegments(_options.dir)) {
+    // Mapped rather than read: replay consumes the records in place, front to back.
+    const MappedFile segment(path.string(), MADV_SEQUENTIAL);
+    const BytesConstView contents = segment.contents();
+    for (size_t offset = 0; offset + kHeaderSize <= contents.size();) {
+      const uint8_t* header = contents.data() + offset;
+      const uint32_t size = GetFixed<uint32_t>(header);
+      const uint32_t crc = GetFixed<uint32_t>(header + 4);
+      const uint64_t sequence = GetFixed<uint64_t>(header + 8);
+      if (sequence == 0 || size > contents.size() - offset - kHeaderSize ||
+          Crc32c(BytesConstView(header + 8, 8 + size)) != crc) {
+        break;
+      }
+      if (_sequence != 0 && sequence != _sequence + 1) {
+        throw std::runtime_error(absl::StrCat("WAL record ", _sequence + 1, " is missing"));
+      }
+      absl::Status status = replay(sequence, BytesConstView(header + kHeaderSize, size));
+      if (!status.ok()) {
+        throw std::runtime_error("Failed to replay the WAL: " + status.ToString());
+      }
+      _sequence = sequence;
+      offset += kHeaderSize + size;
+    }
+  }
+
+  if (_options.sync == WalSyncPolicy::kInterval) {
+    _sync_thread = std::thread([this] { RunSyncThread(); });
+  }
+}
+
+Wal::~Wal() {
+  if (_sync_thread.joinable()) {
+    {
+      std::lock_guard lock(_mutex);
+      _stopping = true;
+    }
+    _cv.notify_all();
+    _sync_thread.join();
+  }
+  if (_fd >= 0) {
+    if (_unsynced && _options.sync != WalSyncPolicy::kNone) {
+      ::fdatasync(_fd);
+    }
+    ::close(_fd);
+  }
+}
+
+absl::Status Wal::Append(std::span<const WalBatch* const> batches) {
+  std::lock_guard lock(_mutex);
+  RETURN_IF_ERROR(_error);
+  _buffer.clear();
+  uint64_t sequence = _sequence;
+  for (const WalBatch* batch : batches) {
+    const size_t offset = _buffer.size();
+    _buffer.resize(offset + kHeaderSize);
+    _buffer.insert(_buffer.end(), batch->data().begin(), batch->data().end());
+    uint8_t* header = _buffer.data() + offset;
+    PutFixed<uint32_t>(header, static_cast<uint32_t>(batch->data().size()));
+    PutFixed<uint64_t>(header + 8, ++sequence);
+    PutFixed<uint32_t>(header + 4,
+                       Crc32c(BytesConstView(header + 8, 8 + batch->data().size())));
+  }
+
+  if (_fd < 0 || _offset + _buffer.size() > _segment_size) {
+    RETURN_IF_ERROR(OpenSegment(_buffer.size()));
+  }
+  const size_t offset = _offset;
+  const uint64_t first_sequence = _sequence + 1;
+  absl::Status status = WriteAt(_fd, _buffer, offset);
+  if (status.ok() && _options.sync == WalSyncPolicy::kPerCommit && ::fdatasync(_fd) != 0) {
+    status = ErrnoStatus("Failed to sync the WAL");
+  }
+  if (!status.ok()) {
+    // The records may be on disk, in part or in full, although the commits fail.
+    (void)Erase(offset, _buffer.size(), first_sequence);
+    return status;
+  }
+  _offset += _buffer.size();
+  _sequence = sequence;
+  _last_append_sequence = first_sequence;
+  _last_append_offset = offset;
+  _last_append_size = _buffer.size();
+  if (_options.sync != WalSyncPolicy::kPerCommit) {
+    _unsynced = true;
+  }
+  return absl::OkStatus();
+}
+
+absl::Status Wal::Retract(uint64_t sequence) {
+  std::lock_guard lock(_mutex);
+  RETURN_IF_ERROR(_error);
+  if (_fd < 0 || sequence != _last_append_sequence) {
+    _error = absl::FailedPreconditionError(
+        absl::StrCat("WAL record ", sequence, " can no longer be erased: the log is read-only"));
+    return _error;
+  }
+  return Erase(_last_append_offset, _last_append_size, sequence);
+}
+
+absl::Status Wal::Erase(size_t offset, size_t size, uint64_t sequence) {
+  _last_append_sequence = 0;
+  // Reading the segment stops at the first zeroed header, so later appends replace the records.
+  absl::Status status = WriteAt(_fd, Bytes(size, 0), offset);
+  if (status.ok() && _options.sync != WalSyncPolicy::kNone && ::fdatasync(_fd) != 0) {
+    status = ErrnoStatus("Failed to sync the WAL");
+  }
+  if (!status.ok()) {
+    _error = absl::DataLossError(
+        absl::StrCat("Failed to erase WAL record ", sequence, ", the log is read-only: ",
+                     status.ToString()));
+    return _error;
+  }
+  _offset = offset;
+  _sequence = sequence - 1;
+  return absl::OkStatus();
+}
+
+absl::Status Wal::Sync() {
+  std::lock_guard lock(_mutex);
+  if (_fd < 0 || !_unsynced) {
+    return absl::OkStatus();
+  }
+  if (::fdatasync(_fd) != 0) {
+    return ErrnoStatus("Failed to sync the WAL");
+  }
+  _unsynced = false;
+  return absl::OkStatus();
+}
+
+uint64_t Wal::LastSequence() const {
+  std::lock_guard lock(_mutex);
+  return _sequence;
+}
+
+absl::Status Wal::RemoveThrough(uint64_t sequence) {
+  std::lock_guard lock(_mutex);
+  const auto segments = ListSegments(_options.dir);
+  for (size_t i = 0; i < segments.size(); ++i) {
+    const uint64_t last_sequence =
+        i + 1 < segments.size() ? segments[i + 1].first - 1 : _sequence;
+    if (last_sequence > sequence) {
+      break;
+    }
+    if (i + 1 == segments.size() && _fd >= 0) {
+      // The segment appended to: the next record opens a new one.
+      ::close(_fd);
+      _fd = -1;
+      _unsynced = false;
+      _last_append_sequence = 0;
+    }
+    std::error_code error;
+    std::filesystem::remove(segments[i].second, error);
+    if (error) {
+      return absl::InternalError("Failed to remove WAL segment " + segments[i].second.string() +
+                                 ": " + error.message());
+    }
+  }
+  // Every segment was removed if so, the one appended to included.
+  _sequence = std::max(_sequence, sequence);
+  if (_options.sync != WalSyncPolicy::kNone) {
+    return SyncDirectory(_options.dir);
+  }
+  return absl::OkStatus();
+}
+
+absl::Status Wal::OpenSegment(size_t min_size) {
+  if (_fd >= 0) {
+    if (_unsynced && _options.sync != WalSyncPolicy::kNone && ::fdatasync(_fd) != 0) {
+      return ErrnoStatus("Failed to sync the WAL");
+    }
+    ::close(_fd);
+    _fd = -1;
+    _unsynced = false;
+    _last_append_sequence = 0;
+  }
+
+  const std::string path =
+      (std::filesystem::path(_options.dir) / SegmentName(_sequence + 1)).string();
+  const int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    return ErrnoStatus(absl::StrCat("Failed to create ", path));
+  }
+  const size_t size = std::max(_options.segment_size, min_size);
+  // Allocated up front: appends then only change the data, which keeps fdatasync cheap, and
+  // the zeros after the last record mark the end of the segment.
+  if (const int error = ::posix_fallocate(fd, 0, static_cast<off_t>(size)); error != 0) {
+    ::close(fd);
+    return absl::ErrnoToStatus(error, absl::StrCat("Failed to preallocate ", path));
+  }
+  if (_options.sync != WalSyncPolicy::kNone) {
+    // Makes the new file itself durable.
+    absl::Status status = SyncDirectory(_options.dir);
+    if (!status.ok()) {
+      ::close(fd);
+      return status;
+    }
+  }
+  _fd = fd;
+  _offset = 0;
+  _segment_size = size;
+  return absl::OkStatus();
+}
+
+void Wal::RunSyncThread() {
+  std::unique_lock lock(_mutex);
+  while (!_stopping) {
+    _cv.wait_for(lock, _options.sync_interval, [&] { return _stopping; });
+    if (_fd < 0 || !_unsynced) {
+      continue;
+    }
+    // Appends go on while the duplicate is synced; a segment switch syncs the old file itself.
+    const int fd = ::dup(_fd);
+    if (fd < 0) {
+      continue;
+    }
+    _unsynced = false;
+    lock.unlock();
+    const bool synced = ::fdatasync(fd) == 0;
+    ::close(fd);
+    lock.lock();
+    if (!synced) {
+      _unsynced = true;
+    }
+  }
+}
+
+}  // namespace gendb
@@ -0,0 +1,163 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <span>
+#include <string>
+#include <thread>
+
+#include "absl/status/status.h"
+#include "gendb/bytes.h"
+#include "gendb/message_patch.h"
+
+namespace gendb {
+
+// When the records Wal::Append writes become durable.
+enum class WalSyncPolicy : uint8_t {
+  // Before Append returns.
+  kPerCommit,
+  // On a background thread, every WalOptions::sync_interval: a machine crash loses at most the
+  // commits of the last interval.
+  kInterval,
+  // When the OS writes the pages back. A crash of the process loses nothing, one of the machine
+  // may lose any suffix of the log.
+  kNone,
+};
+
+struct WalOptions {
+  // Directory of the segment files, created if missing.
+  std::string dir;
+  WalSyncPolicy sync = WalSyncPolicy::kPerCommit;
+  std::chrono::milliseconds sync_interval{10};
+  // Segments are preallocated to this size, so that appends do not grow the file. A record that
+  // does not fit gets a segment of its own.
+  size_t segment_size = 64 << 20;
+  // Threads that apply the log when a Db opens it (see ParallelWalReplay), 0 for one per hardware
+  // thread.
+  size_t replay_threads = 0;
+};
+
+// One change of a logged commit, as decoded by ForEachWalOp. Views point into the record.
+struct WalOp {
+  enum class Type : uint8_t { kPut = 1, kDelete = 2, kPatch = 3 };
+
+  Type type;
+  size_t collection_id;
+  BytesConstView key;
+  // kPut only.
+  BytesConstView value;
+  // kPatch only.
+  MessagePatch patch;
+};
+
+// Changes of one commit, encoded as they are added. Each op is its type byte, the varint
+// collection id and the length-prefixed key, followed by the length-prefixed value of a put, or
+// by the modified and removed field masks and the buffer of a patch.
+class WalBatch {
+ public:
+  void Put(size_t collection_id, BytesConstView key, BytesConstView value);
+  void Delete(size_t collection_id, BytesConstView key);
+  void Patch(size_t collection_id, BytesConstView key, const MessagePatch& patch);
+
+  // Adds the ops of `other` after those of this batch.
+  void Append(const WalBatch& other) {
+    _data.insert(_data.end(), other._data.begin(), other._data.end());
+  }
+
+  void Clear() { _data.clear(); }
+  bool empty() const { return _data.empty(); }
+  BytesConstView data() const { return _data; }
+
+ private:
+  Bytes _data;
+};
+
+// Calls `fn` with each op of the encoded WalBatch `data`, in order. Fails with a DataLossError if
+// `data` is malformed, or with the first error `fn` returns.
+absl::Status ForEachWalOp(BytesConstView data, const std::function<absl::Status(const WalOp&)>& fn);
+
+// CRC32C (Castagnoli) of `data`, continuing from `crc`.
+uint32_t Crc32c(BytesConstView data, uint32_t crc = 0);
+
+// Append-only log of commits in preallocated segment files, each named after the sequence number
+// of its first record. A record is a 16-byte header (payload size, CRC32C of the sequence number
+// and payload, sequence number) followed by the data of a WalBatch. Reading a segment stops at
+// the first record that is empty, where the preallocated zeros start, or fails its checksum: a
+// write torn by a crash only loses the records after it in that segment.
+class Wal {
+ public:
+  using ReplayFn = std::function<absl::Status(uint64_t sequence, BytesConstView record)>;
+
+  // Opens the log in `options.dir`, first passing every record already in it to `replay`, in
+  // sequence order. New records go to a new segment. Throws std::runtime_error if the log cannot
+  // be read or its directory written, if a record is missing, or if `replay` fails.
+  Wal(WalOptions options, const ReplayFn& replay);
+  // Makes the appended records durable, unless the policy is kNone.
+  ~Wal();
+
+  Wal(const Wal&) = delete;
+  Wal& operator=(const Wal&) = delete;
+
+  // Logs each batch as one record, with consecutive sequence numbers, in a single write and at
+  // most one sync. If the write or the sync fails, the records are erased again, so that they are
+  // not replayed either; if that fails too, the log refuses every later Append and Retract with
+  // the error. Thread-safe.
+  absl::Status Append(std::span<const WalBatch* const> batches);
+  absl::Status Append(const WalBatch& batch) {
+    const WalBatch* batches[] = {&batch};
+    return Append(batches);
+  }
+
+  // Erases the records of the last Append, the first of which is `sequence`, and reuses their
+  // sequence numbers: for a commit that was logged but failed to apply, which must not be
+  // replayed. Fails, and the log refuses later appends like a failed Append's, if other records
+  // were appended since or the segment holding them was removed. Thread-safe.
+  absl::Status Retract(uint64_t sequence);
+
+  // Makes every appended record durable, whatever the policy.
+  absl::Status Sync();
+
+  // Sequence number of the last record, 0 if the log is empty.
+  uint64_t LastSequence() const;
+
+  // Removes the segments whose records all have a sequence number of at most `sequence`, such as
+  // those a checkpoint holds the commits of. Records appended afterwards are numbered from
+  // `sequence + 1` on if the log did not reach it. Thread-safe.
+  absl::Status RemoveThrough(uint64_t sequence);
+
+ private:
+  // Syncs and closes the current segment and creates the next one, of at least `min_size` bytes.
+  absl::Status OpenSegment(size_t min_size);
+  // Zeroes the `size` bytes of records written at `offset` of the current segment, the first of
+  // which is `sequence`, and appends over them from then on. Sets `_error` on failure.
+  absl::Status Erase(size_t offset, size_t size, uint64_t sequence);
+  void RunSyncThread();
+
+  const WalOptions _options;
+  mutable std::mutex _mutex;
+  int _fd = -1;
+  size_t _offset = 0;
+  size_t _segment_size = 0;
+  uint64_t _sequence = 0;
+  // Records were written since the last sync.
+  bool _unsynced = false;
+  // Where the last Append wrote in the current segment, for Retract; 0 for the sequence if it
+  // cannot be retracted.
+  uint64_t _last_append_sequence = 0;
+  size_t _last_append_offset = 0;
+  size_t _last_append_size = 0;
+  // Set once records that must not be replayed could not be erased.
+  absl::Status _error;
+  // Encoded records of an Append, reused across calls.
+  Bytes _buffer;
+
+  // kInterval only.
+  std::condition_variable _cv;
+  bool _stopping = false;
+  std::thread _sync_thread;
+};
+
+}  // namespace gendb
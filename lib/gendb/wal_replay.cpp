@@ -0,0 +1,218 @@
+#include "gendb/wal_replay.h"
+
+#include <utility>
+
+#include "absl/hash/hash.h"
+#include "absl/types/span.h"
+#include "gendb/message_patch.h"
+#include "gendb/status.h"
+
+namespace gendb {
+
+ParallelWalReplay::ParallelWalReplay(const Storage& base, size_t threads) : _base(base) {
+  if (threads == 0) {
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  _workers.reserve(threads);
+  for (size_t i = 0; i < threads; ++i) {
+    _workers.push_back(std::make_unique<Worker>());
+  }
+  for (auto& worker : _workers) {
+    worker->thread = std::thread([this, &w = *worker] { Run(w); });
+  }
+}
+
+ParallelWalReplay::~ParallelWalReplay() {
+  for (auto& worker : _workers) {
+    {
+      std::lock_guard lock(worker->mutex);
+      worker->stopping = true;
+    }
+    worker->cv.notify_all();
+  }
+  for (auto& worker : _workers) {
+    if (worker->thread.joinable()) {
+      worker->thread.join();
+    }
+  }
+}
+
+absl::Status ParallelWalReplay::Add(BytesConstView record) {
+  ++_records;
+  return ForEachWalOp(record, [&](const WalOp& op) {
+    Dispatch(op);
+    return absl::OkStatus();
+  });
+}
+
+absl::Status ParallelWalReplay::AddDelta(const Checkpoint& delta) {
+  if (!delta.is_delta()) {
+    return absl::InvalidArgumentError("Not a checkpoint delta");
+  }
+  // Replayed whole, so its checksums are worth checking before any of it is applied.
+  RETURN_IF_ERROR(delta.Verify());
+  ++_records;
+  for (size_t collection_id = 0; collection_id < delta.collection_count(); ++collection_id) {
+    for (size_t i = 0; i < delta.size(collection_id); ++i) {
+      Checkpoint::Record record;
+      RETURN_IF_ERROR(delta.Read(collection_id, i, record));
+      WalOp op;
+      op.collection_id = collection_id;
+      op.key = record.key;
+      if (record.deleted) {
+        op.type = WalOp::Type::kDelete;
+      } else {
+        op.type = WalOp::Type::kPut;
+        op.value = record.value;
+      }
+      Dispatch(op);
+    }
+  }
+  return absl::OkStatus();
+}
+
+void ParallelWalReplay::Dispatch(const WalOp& op) {
+  const size_t hash =
+      absl::HashOf(op.collection_id, absl::Span<const uint8_t>(op.key.data(), op.key.size()));
+  Worker& worker = *_workers[hash % _workers.size()];
+  switch (op.type) {
+    case WalOp::Type::kPut:
+      worker.pending.Put(op.collection_id, op.key, op.value);
+      break;
+    case WalOp::Type::kDelete:
+      worker.pending.Delete(op.collection_id, op.key);
+      break;
+    case WalOp::Type::kPatch:
+      worker.pending.Patch(op.collection_id, op.key, op.patch);
+      break;
+  }
+  ++_ops;
+  if (worker.pending.data().size() >= kBatchBytes) {
+    Flush(worker);
+  }
+}
+
+void ParallelWalReplay::Flush(Worker& worker) {
+  if (worker.pending.empty()) {
+    return;
+  }
+  {
+    std::unique_lock lock(worker.mutex);
+    worker.cv.wait(lock, [&] { return worker.queue.size() < kMaxQueuedBatches; });
+    worker.queue.push_back(std::move(worker.pending));
+  }
+  worker.cv.notify_all();
+  worker.pending = WalBatch();
+}
+
+absl::Status ParallelWalReplay::Finish() {
+  for (auto& worker : _workers) {
+    Flush(*worker);
+    {
+      std::lock_guard lock(worker->mutex);
+      worker->stopping = true;
+    }
+    worker->cv.notify_all();
+  }
+  absl::Status status = absl::OkStatus();
+  for (auto& worker : _workers) {
+    worker->thread.join();
+    status.Update(worker->status);
+  }
+  return status;
+}
+
+void ParallelWalReplay::ForEachPartition(const std::function<void(const Partition&)>& fn) const {
+  std::vector<std::thread> threads;
+  threads.reserve(_workers.size());
+  for (const auto& worker : _workers) {
+    threads.emplace_back([&fn, &partition = worker->partition] { fn(partition); });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+}
+
+absl::Status ParallelWalReplay::WriteTo(Storage& storage, ChangedKeys* changed_keys) {
+  WriteBatch batch;
+  size_t size = 0;
+  for (const auto& worker : _workers) {
+    for (const auto& collection : worker->partition) {
+      size += collection.size();
+    }
+  }
+  batch.Reserve(size);
+  for (const auto& worker : _workers) {
+    for (size_t collection_id = 0; collection_id < worker->partition.size(); ++collection_id) {
+      for (auto& slot : worker->partition[collection_id]) {
+        if (changed_keys != nullptr) {
+          changed_keys->Add(collection_id, slot.key);
+        }
+        if (slot.value.has_value()) {
+          batch.Put(collection_id, slot.key, std::move(*slot.value));
+        } else {
+          batch.Delete(collection_id, slot.key);
+        }
+      }
+    }
+  }
+  return storage.Write(std::move(batch));
+}
+
+void ParallelWalReplay::Run(Worker& worker) {
+  std::unique_lock lock(worker.mutex);
+  while (true) {
+    worker.cv.wait(lock, [&] { return !worker.queue.empty() || worker.stopping; });
+    if (worker.queue.empty()) {
+      return;
+    }
+    WalBatch batch = std::move(worker.queue.front());
+    worker.queue.pop_front();
+    lock.unlock();
+    worker.cv.notify_all();
+
+    if (worker.status.ok()) {
+      worker.status = ForEachWalOp(
+          batch.data(), [&](const WalOp& op) { return Apply(worker.partition, op); });
+    }
+
+    lock.lock();
+  }
+}
+
+absl::Status ParallelWalReplay::Apply(Partition& partition, const WalOp& op) const {
+  if (op.collection_id >= partition.size()) {
+    partition.resize(op.collection_id + 1);
+  }
+  auto& collection = partition[op.collection_id];
+  switch (op.type) {
+    case WalOp::Type::kPut:
+      collection.insert_or_assign(op.key, Bytes(op.value.begin(), op.value.end()));
+      break;
+    case WalOp::Type::kDelete:
+      collection.insert_or_assign(op.key, std::nullopt);
+      break;
+    case WalOp::Type::kPatch: {
+      auto [it, inserted] = collection.try_emplace(op.key);
+      if (inserted) {
+        BytesConstView value;
+        absl::Status status = _base.Get(op.collection_id, op.key, value);
+        if (!status.ok()) {
+          collection.erase(it);
+          return status;
+        }
+        it->value.emplace(value.begin(), value.end());
+      }
+      if (!it->value.has_value()) {
+        return absl::NotFoundError("Patch of a deleted key");
+      }
+      Bytes patched;
+      ApplyPatch(op.patch, *it->value, patched);
+      *it->value = std::move(patched);
+      break;
+    }
+  }
+  return absl::OkStatus();
+}
+
+}  // namespace gendb
@@ -0,0 +1,156 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <thread>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "gendb/bytes.h"
+#include "gendb/changed_keys.h"
+#include "gendb/checkpoint.h"
+#include "gendb/flat_hash_map.h"
+#include "gendb/storage.h"
+#include "gendb/wal.h"
+
+namespace gendb {
+
+// Rebuilds the state that the records of a Wal leave, with the records applied in parallel. The
+// records are decoded on the thread that adds them, and each op is handed to the worker that
+// owns its collection id and key hash: a key only ever changes on one worker, in log order, and
+// workers never share a key. Patches are applied to the value in the worker's partition, or to
+// the one in the base storage for the first op on a key. Secondary indices are left to the
+// caller, who rebuilds them once from the final values (see RebuildIndex) instead of following
+// every record.
+class ParallelWalReplay {
+ public:
+  // Latest value of every key a worker replayed, by collection id. Keys whose last op deleted them
+  // map to no value.
+  using Partition = std::vector<FlatHashMap<std::optional<Bytes>>>;
+
+  // `base` is only read, until Finish returns. 0 `threads` is one per hardware thread.
+  ParallelWalReplay(const Storage& base, size_t threads);
+  ~ParallelWalReplay();
+
+  ParallelWalReplay(const ParallelWalReplay&) = delete;
+  ParallelWalReplay& operator=(const ParallelWalReplay&) = delete;
+
+  // Queues the ops of the encoded WalBatch `record` for the workers; `record` may be released
+  // when Add returns. Fails with a DataLossError if the record is malformed.
+  absl::Status Add(BytesConstView record);
+
+  // Queues a put or delete for every record of the checkpoint delta `delta`, which must outlive
+  // the replay. Deltas replay like one record of the WAL each, in generation order. DataLoss,
+  // with nothing queued, if the delta fails Checkpoint::Verify.
+  absl::Status AddDelta(const Checkpoint& delta);
+
+  // Waits for the workers to apply every op added, and stops them. Fails with the first error a
+  // worker stopped on: a malformed op, or a patch of a key that does not exist.
+  absl::Status Finish();
+
+  // Calls `fn(partition)` for every partition, each on a thread of its own. After Finish only.
+  void ForEachPartition(const std::function<void(const Partition&)>& fn) const;
+
+  // Writes every replayed change to `storage` in one Storage::Write, moving the values out of the
+  // partitions, and adds the changed keys to `changed_keys` if given. After Finish only.
+  absl::Status WriteTo(Storage& storage, ChangedKeys* changed_keys = nullptr);
+
+  // The storage the records were replayed over.
+  const Storage& base() const { return _base; }
+  size_t records() const { return _records; }
+  size_t ops() const { return _ops; }
+
+ private:
+  // Ops queued for a worker once this many bytes are pending for it.
+  static constexpr size_t kBatchBytes = 256 << 10;
+  // Add waits while a worker has this many batches queued, which bounds the memory of a replay
+  // that decodes faster than it applies.
+  static constexpr size_t kMaxQueuedBatches = 16;
+
+  struct Worker {
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<WalBatch> queue;
+    bool stopping = false;
+    // The first error, after which the worker drops its queue.
+    absl::Status status;
+    // Ops decoded for the worker but not queued yet. Add's thread only.
+    WalBatch pending;
+    Partition partition;
+    std::thread thread;
+  };
+
+  // Queues `op` for the worker that owns its key.
+  void Dispatch(const WalOp& op);
+  // Hands `worker.pending` to the worker.
+  void Flush(Worker& worker);
+  void Run(Worker& worker);
+  absl::Status Apply(Partition& partition, const WalOp& op) const;
+
+  const Storage& _base;
+  std::vector<std::unique_ptr<Worker>> _workers;
+  size_t _records = 0;
+  size_t _ops = 0;
+};
+
+// Adds to `index` a record for every value the replay left in `collection_id` that
+// `sec_key_fn(value)` returns a secondary key for, an optional, and erases the records of the
+// values it replaced in the base storage, which `index` is assumed to hold. The records are
+// extracted and sorted per partition in parallel, then inserted in order. After
+// ParallelWalReplay::Finish, and before WriteTo moves the values out.
+template <typename IndexT, typename SecKeyFn>
+void RebuildIndex(const ParallelWalReplay& replay, size_t collection_id, const SecKeyFn& sec_key_fn,
+                  IndexT& index) {
+  using Record = typename IndexT::Container::value_type;
+  using PrimKey = decltype(Record::prim_key);
+  const bool has_base = replay.base().GetCollectionSize(collection_id) > 0;
+  std::mutex mutex;
+  std::vector<std::vector<Record>> sorted;
+  std::vector<Record> replaced;
+  replay.ForEachPartition([&](const ParallelWalReplay::Partition& partition) {
+    std::vector<Record> records;
+    std::vector<Record> base_records;
+    if (collection_id < partition.size()) {
+      for (const auto& slot : partition[collection_id]) {
+        PrimKey prim_key;
+        if (slot.key.size() != prim_key.size()) {
+          continue;
+        }
+        std::ranges::copy(slot.key.view(), prim_key.begin());
+        BytesConstView base_value;
+        if (has_base && replay.base().Get(collection_id, slot.key.view(), base_value).ok()) {
+          if (auto sec_key = sec_key_fn(base_value)) {
+            base_records.push_back({*sec_key, prim_key, /*is_deleted=*/false});
+          }
+        }
+        if (!slot.value.has_value()) {
+          continue;
+        }
+        if (auto sec_key = sec_key_fn(BytesConstView(*slot.value))) {
+          records.push_back({*sec_key, prim_key, /*is_deleted=*/false});
+        }
+      }
+    }
+    std::ranges::sort(records);
+    std::lock_guard lock(mutex);
+    sorted.push_back(std::move(records));
+    replaced.insert(replaced.end(), base_records.begin(), base_records.end());
+  });
+  for (const Record& record : replaced) {
+    index.Erase(record.sec_key, record.prim_key);
+  }
+  for (const std::vector<Record>& records : sorted) {
+    for (const Record& record : records) {
+      index.Insert(record.sec_key, record.prim_key);
+    }
+  }
+}
+
+}  // namespace gendb
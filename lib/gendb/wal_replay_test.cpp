@@ -0,0 +1,219 @@
+#include "gendb/wal_replay.h"
+
+#include <gtest/gtest.h>
+
+#include <array>
+#include <filesystem>
+#include <optional>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "gendb/arena_storage.h"
+#include "gendb/checkpoint.h"
+#include "gendb/generated/metadata.fbs.h"
+#include "gendb/index.h"
+#include "status_matchers.h"
+
+namespace gendb {
+namespace {
+
+std::array<uint8_t, 4> Key(uint32_t i) {
+  return {static_cast<uint8_t>(i >> 24), static_cast<uint8_t>(i >> 16),
+          static_cast<uint8_t>(i >> 8), static_cast<uint8_t>(i)};
+}
+
+Bytes Value(int32_t i) { return MetadataValueBuilder().set_int_value(i).Build(); }
+
+MessagePatch Patch(int32_t i) { return MetadataValuePatchBuilder().set_int_value(i).Build(); }
+
+std::optional<int32_t> IntValue(const Storage& storage, size_t collection_id, uint32_t i) {
+  BytesConstView value;
+  if (!storage.Get(collection_id, BytesConstView(Key(i)), value).ok()) {
+    return std::nullopt;
+  }
+  return MetadataValue{value}.int_value();
+}
+
+TEST(ParallelWalReplayTest, AppliesEveryKeyInLogOrder) {
+  constexpr uint32_t kKeys = 1000;
+  MemoryStorage storage;
+  storage.Put(1, BytesConstView(Key(kKeys)), Value(-1));
+
+  {
+    ParallelWalReplay replay(storage, /*threads=*/4);
+    // Each record changes every key once, so the ops of a key are spread over the whole log.
+    for (int32_t round = 0; round < 5; ++round) {
+      WalBatch record;
+      for (uint32_t i = 0; i < kKeys; ++i) {
+        const size_t collection_id = i % 2;
+        if (round == 0) {
+          record.Put(collection_id, Key(i), Value(0));
+        } else if (round == 3 && i % 5 == 0) {
+          record.Delete(collection_id, Key(i));
+        } else if (round == 4 && i % 10 == 0) {
+          record.Put(collection_id, Key(i), Value(100));
+        } else if (round != 4) {
+          record.Patch(collection_id, Key(i), Patch(round));
+        }
+      }
+      record.Patch(1, Key(kKeys), Patch(round));
+      ASSERT_OK(replay.Add(record.data()));
+    }
+    ASSERT_OK(replay.Finish());
+    EXPECT_EQ(replay.records(), 5);
+    ASSERT_OK(replay.WriteTo(storage));
+  }
+
+  for (uint32_t i = 0; i < kKeys; ++i) {
+    std::optional<int32_t> expected = 3;
+    if (i % 10 == 0) {
+      expected = 100;
+    } else if (i % 5 == 0) {
+      expected = std::nullopt;
+    }
+    EXPECT_EQ(IntValue(storage, i % 2, i), expected) << i;
+  }
+  // The first op on the key patched the value the storage already had.
+  EXPECT_EQ(IntValue(storage, 1, kKeys), 4);
+}
+
+TEST(ParallelWalReplayTest, PatchOfMissingKeyFails) {
+  MemoryStorage storage;
+  ParallelWalReplay replay(storage, /*threads=*/2);
+  WalBatch record;
+  record.Put(0, Key(1), Value(1));
+  record.Delete(0, Key(1));
+  ASSERT_OK(replay.Add(record.data()));
+  WalBatch patch;
+  patch.Patch(0, Key(1), Patch(2));
+  ASSERT_OK(replay.Add(patch.data()));
+  EXPECT_STATUS_EQ(absl::StatusCode::kNotFound, replay.Finish());
+}
+
+TEST(ParallelWalReplayTest, MalformedRecordIsDataLoss) {
+  MemoryStorage storage;
+  ParallelWalReplay replay(storage, /*threads=*/2);
+  WalBatch record;
+  record.Put(0, Key(1), Value(1));
+  EXPECT_STATUS_EQ(absl::StatusCode::kDataLoss,
+                   replay.Add(record.data().first(record.data().size() - 1)));
+  ASSERT_OK(replay.Finish());
+}
+
+TEST(ParallelWalReplayTest, RebuildIndexSkipsDeletedKeys) {
+  MemoryStorage storage;
+  ParallelWalReplay replay(storage, /*threads=*/3);
+  WalBatch record;
+  for (uint32_t i = 0; i < 100; ++i) {
+    record.Put(0, Key(i), Value(static_cast<int32_t>(i % 7)));
+    // Not indexed: another collection.
+    record.Put(1, Key(i), Value(0));
+  }
+  for (uint32_t i = 0; i < 100; i += 3) {
+    record.Delete(0, Key(i));
+  }
+  ASSERT_OK(replay.Add(record.data()));
+  ASSERT_OK(replay.Finish());
+
+  Index<int32_t, std::array<uint8_t, 4>> index;
+  RebuildIndex(
+      replay, 0,
+      [](BytesConstView value) -> std::optional<int32_t> {
+        // Sixes are left out, as messages without the indexed field are.
+        const int32_t int_value = MetadataValue{value}.int_value();
+        return int_value == 6 ? std::nullopt : std::optional(int_value);
+      },
+      index);
+
+  std::vector<std::pair<int32_t, std::array<uint8_t, 4>>> expected;
+  for (int32_t sec_key = 0; sec_key < 6; ++sec_key) {
+    for (uint32_t i = 0; i < 100; ++i) {
+      if (i % 3 != 0 && static_cast<int32_t>(i % 7) == sec_key) {
+        expected.emplace_back(sec_key, Key(i));
+      }
+    }
+  }
+  std::vector<std::pair<int32_t, std::array<uint8_t, 4>>> records;
+  for (const auto& record : index._index) {
+    EXPECT_FALSE(record.is_deleted);
+    records.emplace_back(record.sec_key, record.prim_key);
+  }
+  EXPECT_EQ(records, expected);
+}
+
+TEST(ParallelWalReplayTest, RebuildIndexErasesRecordsOfReplacedBaseValues) {
+  // The base and its index, as a checkpoint leaves them.
+  MemoryStorage storage;
+  Index<int32_t, std::array<uint8_t, 4>> index;
+  for (uint32_t i = 0; i < 4; ++i) {
+    storage.Put(0, Key(i), Value(10));
+    index.Insert(10, Key(i));
+  }
+  ParallelWalReplay replay(storage, /*threads=*/2);
+  WalBatch record;
+  record.Put(0, Key(0), Value(20));
+  record.Delete(0, Key(1));
+  record.Patch(0, Key(2), Patch(30));
+  record.Put(0, Key(5), Value(10));
+  ASSERT_OK(replay.Add(record.data()));
+  ASSERT_OK(replay.Finish());
+
+  RebuildIndex(
+      replay, 0,
+      [](BytesConstView value) { return std::optional(MetadataValue{value}.int_value()); },
+      index);
+  std::vector<std::pair<int32_t, std::array<uint8_t, 4>>> records;
+  for (const auto& record : index._index) {
+    records.emplace_back(record.sec_key, record.prim_key);
+  }
+  const std::vector<std::pair<int32_t, std::array<uint8_t, 4>>> expected = {
+      {10, Key(3)}, {10, Key(5)}, {20, Key(0)}, {30, Key(2)}};
+  EXPECT_EQ(records, expected);
+}
+
+TEST(ParallelWalReplayTest, ReplaysDeltasAndRecordsChangedKeys) {
+  const std::string path = (std::filesystem::temp_directory_path() /
+                            ("wal_replay_test_" + std::to_string(std::random_device{}())))
+                               .string();
+  // Key 1 is rewritten and key 2 deleted after the base was taken.
+  MemoryStorage storage;
+  ArenaStorage changed;
+  ChangedKeys changed_keys;
+  for (uint32_t i = 0; i < 3; ++i) {
+    storage.Put(0, Key(i), Value(0));
+  }
+  changed.Put(0, Key(1), Value(1));
+  changed_keys.Add(0, Key(1));
+  changed_keys.Add(0, Key(2));
+  {
+    CheckpointWriter writer(path, /*generation=*/1, /*delta=*/true);
+    ASSERT_OK(writer.AddChangedKeys(changed, 0, changed_keys.collection(0)));
+    ASSERT_OK(writer.Finish(0));
+  }
+  const Checkpoint delta(path);
+  std::filesystem::remove(path);
+
+  ParallelWalReplay replay(storage, /*threads=*/2);
+  ASSERT_OK(replay.AddDelta(delta));
+  // The WAL logged after the delta replays over it.
+  WalBatch record;
+  record.Patch(0, Key(1), Patch(5));
+  record.Put(1, Key(7), Value(7));
+  ASSERT_OK(replay.Add(record.data()));
+  ASSERT_OK(replay.Finish());
+  EXPECT_EQ(replay.records(), 2);
+  ChangedKeys replayed;
+  ASSERT_OK(replay.WriteTo(storage, &replayed));
+
+  EXPECT_EQ(IntValue(storage, 0, 0), 0);
+  EXPECT_EQ(IntValue(storage, 0, 1), 5);
+  EXPECT_EQ(IntValue(storage, 0, 2), std::nullopt);
+  EXPECT_EQ(IntValue(storage, 1, 7), 7);
+  EXPECT_EQ(replayed.size(), 3);
+  EXPECT_EQ(replayed.collection(0).size(), 2);
+  EXPECT_TRUE(replayed.collection(1).contains(BytesConstView(Key(7))));
+}
+
+}  // namespace
+}  // namespace gendb
@@ -0,0 +1,306 @@
+#include "gendb/wal.h"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "status_matchers.h"
+
+namespace gendb {
+namespace {
+
+Bytes ToBytes(const std::string& str) { return {str.begin(), str.end()}; }
+
+std::string ToString(BytesConstView bytes) {
+  return {reinterpret_cast<const char*>(bytes.data()), bytes.size()};
+}
+
+class WalTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    _options.dir = (std::filesystem::temp_directory_path() /
+                    ("wal_test_" + std::to_string(std::random_device{}())))
+                       .string();
+    std::filesystem::remove_all(_options.dir);
+  }
+
+  void TearDown() override { std::filesystem::remove_all(_options.dir); }
+
+  // Opens the log and returns the records it replays, as (sequence, data).
+  std::vector<std::pair<uint64_t, std::string>> Replay() {
+    std::vector<std::pair<uint64_t, std::string>> records;
+    Wal wal(_options, [&](uint64_t sequence, BytesConstView record) {
+      records.emplace_back(sequence, ToString(record));
+      return absl::OkStatus();
+    });
+    return records;
+  }
+
+  std::vector<std::filesystem::path> Segments() const {
+    std::vector<std::filesystem::path> segments;
+    for (const auto& entry : std::filesystem::directory_iterator(_options.dir)) {
+      segments.push_back(entry.path());
+    }
+    std::ranges::sort(segments);
+    return segments;
+  }
+
+  static absl::Status NoReplay(uint64_t, BytesConstView) { return absl::OkStatus(); }
+
+  WalOptions _options;
+};
+
+TEST(WalBatchTest, OpsRoundTrip) {
+  MessagePatch patch;
+  patch.modified = {0b101};
+  patch.removed = {0, 0b10};
+  patch.buffer = ToBytes("patch");
+  WalBatch batch;
+  batch.Put(3, ToBytes("key1"), ToBytes("value"));
+  batch.Delete(0, ToBytes("key2"));
+  batch.Patch(300, ToBytes("key3"), patch);
+
+  std::vector<std::string> decoded;
+  ASSERT_OK(ForEachWalOp(batch.data(), [&](const WalOp& op) {
+    std::string line = std::to_string(static_cast<int>(op.type)) + " " +
+                       std::to_string(op.collection_id) + " " + ToString(op.key);
+    if (op.type == WalOp::Type::kPut) {
+      line += " " + ToString(op.value);
+    } else if (op.type == WalOp::Type::kPatch) {
+      EXPECT_EQ(op.patch.modified, patch.modified);
+      EXPECT_EQ(op.patch.removed, patch.removed);
+      line += " " + ToString(op.patch.buffer);
+    }
+    decoded.push_back(line);
+    return absl::OkStatus();
+  }));
+  EXPECT_EQ(decoded, (std::vector<std::string>{"1 3 key1 value", "2 0 key2", "3 300 key3 patch"}));
+}
+
+TEST(WalBatchTest, TruncatedBatchIsDataLoss) {
+  WalBatch batch;
+  batch.Put(1, ToBytes("key"), ToBytes("value"));
+  int ops = 0;
+  EXPECT_STATUS_EQ(absl::StatusCode::kDataLoss,
+                   ForEachWalOp(batch.data().first(batch.data().size() - 1), [&](const WalOp&) {
+                     ++ops;
+                     return absl::OkStatus();
+                   }));
+  EXPECT_EQ(ops, 0);
+}
+
+TEST_F(WalTest, ReplaysRecordsInSequenceOrder) {
+  {
+    Wal wal(_options, NoReplay);
+    EXPECT_EQ(wal.LastSequence(), 0);
+    WalBatch first;
+    first.Put(0, ToBytes("a"), ToBytes("1"));
+    ASSERT_OK(wal.Append(first));
+    WalBatch second;
+    second.Put(0, ToBytes("b"), ToBytes("2"));
+    WalBatch empty;
+    const WalBatch* batches[] = {&second, &empty};
+    ASSERT_OK(wal.Append(batches));
+    EXPECT_EQ(wal.LastSequence(), 3);
+  }
+  auto records = Replay();
+  ASSERT_EQ(records.size(), 3);
+  EXPECT_EQ(records[0].first, 1);
+  EXPECT_EQ(records[1].first, 2);
+  EXPECT_EQ(records[2].first, 3);
+  EXPECT_EQ(records[2].second, "");
+
+  // Appends after a reopen continue the sequence, in a new segment.
+  {
+    Wal wal(_options, NoReplay);
+    EXPECT_EQ(wal.LastSequence(), 3);
+    WalBatch batch;
+    batch.Delete(0, ToBytes("a"));
+    ASSERT_OK(wal.Append(batch));
+  }
+  EXPECT_EQ(Segments().size(), 2);
+  records = Replay();
+  ASSERT_EQ(records.size(), 4);
+  EXPECT_EQ(records[3].first, 4);
+}
+
+TEST_F(WalTest, TornRecordEndsItsSegment) {
+  {
+    Wal wal(_options, NoReplay);
+    for (const char* value : {"one", "two", "six"}) {
+      WalBatch batch;
+      batch.Put(0, ToBytes("key"), ToBytes(value));
+      ASSERT_OK(wal.Append(batch));
+    }
+  }
+  // Flip the last byte of the second record, as a write torn by a crash would leave it.
+  const std::filesystem::path segment = Segments().front();
+  WalBatch batch;
+  batch.Put(0, ToBytes("key"), ToBytes("one"));
+  const size_t record_size = 16 + batch.data().size();
+  {
+    std::fstream file(segment, std::ios::in | std::ios::out | std::ios::binary);
+    file.seekp(static_cast<std::streamoff>(2 * record_size - 1));
+    file.put('X');
+  }
+
+  auto records = Replay();
+  ASSERT_EQ(records.size(), 1);
+  {
+    Wal wal(_options, NoReplay);
+    EXPECT_EQ(wal.LastSequence(), 1);
+    ASSERT_OK(wal.Append(batch));
+  }
+  records = Replay();
+  ASSERT_EQ(records.size(), 2);
+  EXPECT_EQ(records[1].first, 2);
+}
+
+TEST_F(WalTest, FullSegmentsRollOver) {
+  _options.segment_size = 128;
+  std::vector<std::string> values;
+  {
+    Wal wal(_options, NoReplay);
+    for (int i = 0; i < 20; ++i) {
+      values.push_back("value" + std::to_string(i));
+      WalBatch batch;
+      batch.Put(1, ToBytes("key"), ToBytes(values.back()));
+      ASSERT_OK(wal.Append(batch));
+    }
+    // Larger than a segment: it gets one of its own.
+    values.push_back(std::string(1000, 'x'));
+    WalBatch batch;
+    batch.Put(1, ToBytes("key"), ToBytes(values.back()));
+    ASSERT_OK(wal.Append(batch));
+  }
+  EXPECT_GT(Segments().size(), 5);
+  EXPECT_EQ(std::filesystem::file_size(Segments().front()), 128);
+
+  std::vector<std::string> replayed;
+  Wal wal(_options, [&](uint64_t, BytesConstView record) {
+    return ForEachWalOp(record, [&](const WalOp& op) {
+      replayed.push_back(ToString(op.value));
+      return absl::OkStatus();
+    });
+  });
+  EXPECT_EQ(replayed, values);
+}
+
+TEST_F(WalTest, IntervalPolicySyncsInTheBackground) {
+  _options.sync = WalSyncPolicy::kInterval;
+  _options.sync_interval = std::chrono::milliseconds(1);
+  {
+    Wal wal(_options, NoReplay);
+    for (int i = 0; i < 10; ++i) {
+      WalBatch batch;
+      batch.Put(0, ToBytes("key"), ToBytes(std::to_string(i)));
+      ASSERT_OK(wal.Append(batch));
+      std::this_thread::sleep_for(std::chrono::microseconds(300));
+    }
+    ASSERT_OK(wal.Sync());
+  }
+  EXPECT_EQ(Replay().size(), 10);
+}
+
+TEST_F(WalTest, RemoveThroughDropsCoveredSegments) {
+  _options.segment_size = 128;
+  {
+    Wal wal(_options, NoReplay);
+    for (int i = 0; i < 20; ++i) {
+      WalBatch batch;
+      batch.Put(0, ToBytes("key"), ToBytes("value" + std::to_string(i)));
+      ASSERT_OK(wal.Append(batch));
+    }
+    const size_t segment_count = Segments().size();
+    ASSERT_GT(segment_count, 3);
+    // Only the segments holding nothing after record 10 go.
+    ASSERT_OK(wal.RemoveThrough(10));
+    EXPECT_LT(Segments().size(), segment_count);
+    EXPECT_GT(Segments().size(), 1);
+  }
+  auto records = Replay();
+  ASSERT_FALSE(records.empty());
+  EXPECT_LE(records.front().first, 11);
+  EXPECT_EQ(records.back().first, 20);
+
+  // Past the end of the log: every segment goes, and the sequence skips ahead.
+  {
+    Wal wal(_options, NoReplay);
+    ASSERT_OK(wal.RemoveThrough(30));
+    EXPECT_TRUE(Segments().empty());
+    EXPECT_EQ(wal.LastSequence(), 30);
+    ASSERT_OK(wal.Append(WalBatch()));
+  }
+  records = Replay();
+  ASSERT_EQ(records.size(), 1);
+  EXPECT_EQ(records[0].first, 31);
+}
+
+TEST_F(WalTest, RetractedRecordsAreNotReplayed) {
+  {
+    Wal wal(_options, NoReplay);
+    WalBatch first;
+    first.Put(0, ToBytes("a"), ToBytes("1"));
+    ASSERT_OK(wal.Append(first));
+    // A commit logged and then aborted, longer than the record that replaces it.
+    WalBatch aborted;
+    aborted.Put(0, ToBytes("b"), ToBytes(std::string(100, 'x')));
+    ASSERT_OK(wal.Append(aborted));
+    ASSERT_OK(wal.Retract(2));
+    EXPECT_EQ(wal.LastSequence(), 1);
+  }
+  auto records = Replay();
+  ASSERT_EQ(records.size(), 1);
+  EXPECT_EQ(records[0].first, 1);
+
+  {
+    Wal wal(_options, NoReplay);
+    WalBatch aborted;
+    aborted.Put(0, ToBytes("c"), ToBytes(std::string(100, 'y')));
+    ASSERT_OK(wal.Append(aborted));
+    ASSERT_OK(wal.Retract(2));
+    WalBatch second;
+    second.Delete(0, ToBytes("a"));
+    ASSERT_OK(wal.Append(second));
+    EXPECT_EQ(wal.LastSequence(), 2);
+  }
+  records = Replay();
+  ASSERT_EQ(records.size(), 2);
+  EXPECT_EQ(records[1].first, 2);
+  WalBatch second;
+  second.Delete(0, ToBytes("a"));
+  EXPECT_EQ(records[1].second, ToString(second.data()));
+}
+
+TEST_F(WalTest, RetractOfAnEarlierAppendMakesTheLogReadOnly) {
+  {
+    Wal wal(_options, NoReplay);
+    ASSERT_OK(wal.Append(WalBatch()));
+    ASSERT_OK(wal.Append(WalBatch()));
+    EXPECT_EQ(wal.Retract(1).code(), absl::StatusCode::kFailedPrecondition);
+    EXPECT_EQ(wal.Append(WalBatch()).code(), absl::StatusCode::kFailedPrecondition);
+    EXPECT_EQ(wal.LastSequence(), 2);
+  }
+  EXPECT_EQ(Replay().size(), 2);
+}
+
+TEST_F(WalTest, FailedReplayThrows) {
+  {
+    Wal wal(_options, NoReplay);
+    ASSERT_OK(wal.Append(WalBatch()));
+  }
+  EXPECT_THROW(Wal(_options,
+                   [](uint64_t, BytesConstView) { return absl::DataLossError("Bad record"); }),
+               std::runtime_error);
+}
+
+}  // namespace
+}  // namespace gendb
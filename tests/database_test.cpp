@@ -3,13 +3,24 @@
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
 
+#include <chrono>
+#include <filesystem>
+#include <future>
+#include <random>
+#include <set>
+#include <thread>
+#include <vector>
+
 #include "account.fbs.h"
+#include "allocation_counter.h"
+#include "config.fbs.h"
 #include "metadata.fbs.h"
 #include "position.fbs.h"
 
 using namespace gendb::tests;
 
 using gendb::MetadataType;
+using gendb::MetadataValue;
 
 TEST(DbTest, AddAndGetAccount) {
   Db db;
@@ -478,3 +489,837 @@ TEST(DbTest, NextAccountIdSequence_NotCommitted) {
   EXPECT_TRUE(writer2.NextAccountIdSequence(next_id2).ok());
   EXPECT_EQ(next_id2, 1);
 }
+
+TEST(DbTest, PointReadsDoNotAllocate) {
+  Db db;
+  {
+    auto writer = db.CreateWriter();
+    EXPECT_TRUE(
+        writer.PutAccount(1, AccountBuilder().set_account_id(1).set_name("Alice").Build()).ok());
+    EXPECT_TRUE(
+        writer.PutPosition(10, PositionBuilder().set_position_id(10).set_account_id(1).Build())
+            .ok());
+    EXPECT_TRUE(writer
+                    .PutConfig("limits", ConfigBuilder()
+                                             .set_config_name("limits")
+                                             .set_max_trade_volume(100.0)
+                                             .Build())
+                    .ok());
+    writer.Commit();
+  }
+
+  auto guard = db.SharedLock();
+  Account account;
+  Position position;
+  Config config;
+  size_t allocations = 0;
+  bool all_found = true;
+  {
+    gendb::tests::ScopedAllocationCounter counter;
+    all_found &= guard.GetAccount(1, account).ok();
+    all_found &= guard.GetPosition(10, position).ok();
+    all_found &= guard.GetConfig("limits", config).ok();
+    allocations = counter.count();
+  }
+  EXPECT_TRUE(all_found);
+  EXPECT_EQ(allocations, 0);
+  EXPECT_EQ(account.name(), "Alice");
+  EXPECT_EQ(config.max_trade_volume(), 100.0);
+}
+
+TEST(DbTest, GetAccountsBatch) {
+  Db db;
+  {
+    auto writer = db.CreateWriter();
+    for (uint64_t id = 1; id <= 200; id += 2) {
+      EXPECT_TRUE(writer
+                      .PutAccount(id, AccountBuilder()
+                                          .set_account_id(id)
+                                          .set_name("name" + std::to_string(id))
+                                          .Build())
+                      .ok());
+    }
+    writer.Commit();
+  }
+
+  // More ids than one MultiGet chunk, half of them missing.
+  std::vector<uint64_t> ids;
+  for (uint64_t id = 1; id <= 200; ++id) {
+    ids.push_back(id);
+  }
+  std::vector<Account> accounts(ids.size());
+  std::vector<absl::Status> statuses(ids.size());
+  auto guard = db.SharedLock();
+  guard.GetAccounts(ids, accounts, statuses);
+
+  for (size_t i = 0; i < ids.size(); ++i) {
+    if (ids[i] % 2 == 1) {
+      ASSERT_TRUE(statuses[i].ok()) << statuses[i];
+      EXPECT_EQ(accounts[i].account_id(), ids[i]);
+      EXPECT_EQ(accounts[i].name(), "name" + std::to_string(ids[i]));
+    } else {
+      EXPECT_TRUE(absl::IsNotFound(statuses[i])) << statuses[i];
+    }
+  }
+}
+
+TEST(DbTest, GetConfigsBatch) {
+  Db db;
+  {
+    auto writer = db.CreateWriter();
+    EXPECT_TRUE(
+        writer.PutConfig("a", ConfigBuilder().set_config_name("a").set_max_trade_volume(1).Build())
+            .ok());
+    writer.Commit();
+  }
+  const std::vector<std::string_view> names = {"a", "b"};
+  std::vector<Config> configs(names.size());
+  std::vector<absl::Status> statuses(names.size());
+  db.SharedLock().GetConfigs(names, configs, statuses);
+  ASSERT_TRUE(statuses[0].ok());
+  EXPECT_EQ(configs[0].max_trade_volume(), 1);
+  EXPECT_TRUE(absl::IsNotFound(statuses[1]));
+}
+
+TEST(DbTest, CollectionTuningFromSchema) {
+  using Compression = gendb::CollectionTuning::Compression;
+  // The metadata key starts with the 4-byte MetadataType.
+  EXPECT_EQ(Db::kCollectionTuning[MetadataValueCollId].prefix_length, 4);
+  EXPECT_EQ(Db::kCollectionTuning[AccountCollId].bloom_bits_per_key, 10);
+  EXPECT_TRUE(Db::kCollectionTuning[AccountCollId].optimize_point_lookup);
+  EXPECT_EQ(Db::kCollectionTuning[PositionCollId].block_size, 65536);
+  EXPECT_EQ(Db::kCollectionTuning[PositionCollId].compression, Compression::kZstd);
+  EXPECT_EQ(Db::kCollectionTuning[ConfigCollId].compression, Compression::kDefault);
+
+  const auto path = std::filesystem::temp_directory_path() /
+                    ("db_tuning_test_" + std::to_string(std::random_device{}()));
+  {
+    gendb::RocksDBStorage storage(path.string(), Db::kCollectionTuning);
+    storage.Put(AccountCollId, ToAccountKey(1),
+                AccountBuilder().set_account_id(1).set_name("Alice").Build());
+  }
+  {
+    gendb::RocksDBStorage storage(path.string(), Db::kCollectionTuning);
+    gendb::BytesConstView value;
+    EXPECT_TRUE(storage.Get(AccountCollId, ToAccountKey(1), value).ok());
+    EXPECT_EQ(storage.GetCollectionSize(AccountCollId), 1);
+  }
+  std::filesystem::remove_all(path);
+}
+
+TEST(DbTest, ScanAccountsInPrimaryKeyOrder) {
+  Db db;
+  {
+    auto writer = db.CreateWriter();
+    for (uint64_t id : {40, 7, 300, 12, 1000}) {
+      EXPECT_TRUE(writer.PutAccount(id, AccountBuilder().set_account_id(id).Build()).ok());
+    }
+    writer.Commit();
+  }
+  auto guard = db.SharedLock();
+  std::vector<uint64_t> ids;
+  for (auto it = guard.ScanAccounts(10, 1000); it.Valid(); it.Next()) {
+    ids.push_back(it.Value().account_id());
+  }
+  EXPECT_THAT(ids, ::testing::ElementsAre(12, 40, 300));
+
+  EXPECT_TRUE(guard.ScanAccounts(1001, 2000).IsEnd());
+}
+
+TEST(DbTest, ScanPositionsWithNegativeIds) {
+  Db db;
+  {
+    auto writer = db.CreateWriter();
+    for (int32_t id : {5, -3, 0, -100, 2}) {
+      EXPECT_TRUE(writer.PutPosition(id, PositionBuilder().set_position_id(id).Build()).ok());
+    }
+    writer.Commit();
+  }
+  auto guard = db.SharedLock();
+  std::vector<int32_t> ids;
+  for (auto it = guard.ScanPositions(-50, 5); it.Valid(); it.Next()) {
+    ids.push_back(it.Value().position_id());
+  }
+  // key_codec's sign-biased encoding orders negative ids first.
+  EXPECT_THAT(ids, ::testing::ElementsAre(-3, 0, 2));
+}
+
+TEST(DbTest, SnapshotReadsStateAsOfItsCreation) {
+  Db db;
+  {
+    auto writer = db.CreateWriter();
+    for (uint64_t id : {1, 2}) {
+      EXPECT_TRUE(
+          writer.PutAccount(id, AccountBuilder().set_account_id(id).set_name("v1").Build()).ok());
+    }
+    writer.Commit();
+  }
+  auto snapshot = db.Snapshot();
+  {
+    // A Guard held here would deadlock the commit; a snapshot does not block it.
+    auto writer = db.CreateWriter();
+    EXPECT_TRUE(writer.UpdateAccount(1, AccountPatchBuilder().set_name("v2").Build()).ok());
+    EXPECT_TRUE(
+        writer.PutAccount(3, AccountBuilder().set_account_id(3).set_name("v2").Build()).ok());
+    writer.Commit();
+  }
+
+  Account account;
+  EXPECT_TRUE(snapshot.GetAccount(1, account).ok());
+  EXPECT_EQ(account.name(), "v1");
+  EXPECT_EQ(snapshot.GetAccount(3, account).code(), absl::StatusCode::kNotFound);
+
+  std::vector<uint64_t> ids = {1, 2, 3};
+  std::vector<Account> accounts(ids.size());
+  std::vector<absl::Status> statuses(ids.size());
+  snapshot.GetAccounts(ids, accounts, statuses);
+  EXPECT_TRUE(statuses[0].ok() && statuses[1].ok());
+  EXPECT_EQ(accounts[0].name(), "v1");
+  EXPECT_EQ(statuses[2].code(), absl::StatusCode::kNotFound);
+
+  std::vector<uint64_t> scanned;
+  for (auto it = snapshot.ScanAccounts(0, 100); it.Valid(); it.Next()) {
+    scanned.push_back(it.Value().account_id());
+  }
+  EXPECT_THAT(scanned, ::testing::ElementsAre(1, 2));
+
+  EXPECT_TRUE(db.SharedLock().GetAccount(1, account).ok());
+  EXPECT_EQ(account.name(), "v2");
+  EXPECT_GT(db.Snapshot().sequence(), snapshot.sequence());
+}
+
+TEST(DbTest, SnapshotIndexScansIgnoreLaterCommits) {
+  Db db;
+  auto put_account = [&](uint64_t id, int32_t age) {
+    auto writer = db.CreateWriter();
+    EXPECT_TRUE(
+        writer.PutAccount(id, AccountBuilder().set_account_id(id).set_age(age).Build()).ok());
+    writer.Commit();
+  };
+  auto set_age = [&](uint64_t id, int32_t age) {
+    auto writer = db.CreateWriter();
+    EXPECT_TRUE(writer.UpdateAccount(id, AccountPatchBuilder().set_age(age).Build()).ok());
+    writer.Commit();
+  };
+  auto ids = [](gendb::Iterator<Account> it) {
+    std::vector<uint64_t> ids;
+    for (; it.Valid(); it.Next()) {
+      ids.push_back(it.Value().account_id());
+    }
+    return ids;
+  };
+  put_account(1, 20);
+  put_account(2, 30);
+
+  {
+    auto snapshot = db.Snapshot();
+    set_age(1, 50);      // Moves out of the range.
+    put_account(3, 25);  // Added after the snapshot.
+    set_age(2, 20);      // Moves within the range.
+
+    EXPECT_THAT(ids(snapshot.GetAccountByAgeRange(20, 31)), ::testing::ElementsAre(1, 2));
+    EXPECT_THAT(ids(snapshot.GetAccountByAgeEqual(20)), ::testing::ElementsAre(1));
+    EXPECT_THAT(ids(snapshot.GetAccountByAgeEqual(50)), ::testing::IsEmpty());
+    EXPECT_THAT(ids(db.SharedLock().GetAccountByAgeRange(20, 31)),
+                ::testing::UnorderedElementsAre(2, 3));
+  }
+  // The next commit drops the index records that only the snapshot still needed.
+  put_account(4, 99);
+  EXPECT_THAT(ids(db.SharedLock().GetAccountByAgeEqual(20)), ::testing::ElementsAre(2));
+  EXPECT_THAT(ids(db.Snapshot().GetAccountByAgeRange(0, 100)),
+              ::testing::ElementsAre(2, 3, 1, 4));
+}
+
+TEST(DbTest, CommitAsyncIsVisibleOnceItsFutureIsReady) {
+  Db db;
+  std::vector<std::future<void>> applied;
+  for (uint64_t id = 1; id <= 20; ++id) {
+    auto writer = db.CreateWriter();
+    EXPECT_TRUE(writer
+                    .PutAccount(id, AccountBuilder()
+                                        .set_account_id(id)
+                                        .set_age(static_cast<int32_t>(id % 2))
+                                        .Build())
+                    .ok());
+    applied.push_back(writer.CommitAsync());
+  }
+  applied.back().get();
+
+  auto guard = db.SharedLock();
+  Account account;
+  for (uint64_t id = 1; id <= 20; ++id) {
+    EXPECT_TRUE(guard.GetAccount(id, account).ok());
+  }
+  size_t odd = 0;
+  for (auto it = guard.GetAccountByAgeEqual(1); it.Valid(); it.Next()) {
+    ++odd;
+  }
+  EXPECT_EQ(odd, 10);
+}
+
+TEST(DbTest, NextWriterReadsAsyncCommits) {
+  Db db;
+  std::future<void> applied;
+  {
+    auto writer = db.CreateWriter();
+    uint64_t id = 0;
+    ASSERT_TRUE(writer.NextAccountIdSequence(id).ok());
+    EXPECT_TRUE(
+        writer.PutAccount(id, AccountBuilder().set_account_id(id).set_balance(1).Build()).ok());
+    applied = writer.CommitAsync();
+  }
+  // Orders after the handed off commit, so it sees its changes even if the apply is pending.
+  auto writer = db.CreateWriter();
+  uint64_t id = 0;
+  ASSERT_TRUE(writer.NextAccountIdSequence(id).ok());
+  EXPECT_EQ(id, 2);
+  Account account;
+  ASSERT_TRUE(writer.GetAccount(1, account).ok());
+  EXPECT_EQ(account.balance(), 1);
+}
+
+TEST(DbTest, CreateWriterDoesNotWaitForAsyncCommits) {
+  Db db;
+  std::future<void> applied;
+  {
+    // Keeps the apply thread from applying anything.
+    auto guard = db.SharedLock();
+    {
+      auto writer = db.CreateWriter();
+      EXPECT_TRUE(writer.PutAccount(1, AccountBuilder().set_account_id(1).set_balance(1).Build())
+                      .ok());
+      applied = writer.CommitAsync();
+    }
+    {
+      auto writer = db.CreateWriter();
+      EXPECT_TRUE(
+          writer.UpdateAccount(1, AccountPatchBuilder().set_balance(2).Build()).ok());
+      EXPECT_TRUE(writer.PutAccount(2, AccountBuilder().set_account_id(2).Build()).ok());
+      writer.CommitAsync();
+    }
+    auto writer = db.CreateWriter();
+    Account account;
+    ASSERT_TRUE(writer.GetAccount(1, account).ok());
+    EXPECT_EQ(account.balance(), 2);
+    EXPECT_TRUE(writer.GetAccount(2, account).ok());
+    EXPECT_TRUE(absl::IsNotFound(guard.GetAccount(1, account)));
+    EXPECT_EQ(applied.wait_for(std::chrono::seconds(0)), std::future_status::timeout);
+  }
+  applied.get();
+  auto writer = db.CreateWriter();
+  writer.Commit();
+  Account account;
+  ASSERT_TRUE(db.SharedLock().GetAccount(1, account).ok());
+  EXPECT_EQ(account.balance(), 2);
+}
+
+TEST(DbTest, AsyncReadsCompleteWithoutSuspendingInMemory) {
+  Db db;
+  {
+    auto writer = db.CreateWriter();
+    for (uint64_t id = 1; id <= 100; ++id) {
+      EXPECT_TRUE(writer
+                      .PutAccount(id, AccountBuilder()
+                                          .set_account_id(id)
+                                          .set_age(static_cast<int32_t>(id % 3))
+                                          .Build())
+                      .ok());
+    }
+    writer.Commit();
+  }
+
+  auto guard = db.SharedLock();
+  gendb::AsyncReadQueue queue;
+  Account account;
+  auto read = guard.GetAccountAsync(7, account, &queue);
+  size_t allocations = 0;
+  absl::Status status;
+  {
+    gendb::tests::ScopedAllocationCounter counter;
+    EXPECT_TRUE(read.await_ready());
+    status = read.await_resume();
+    allocations = counter.count();
+  }
+  EXPECT_TRUE(status.ok());
+  EXPECT_EQ(allocations, 0);
+  EXPECT_EQ(account.account_id(), 7);
+
+  size_t count = 0;
+  auto it = guard.GetAccountByAgeRangeAsync(1, 3, &queue);
+  while (true) {
+    auto next = it.Next();
+    ASSERT_TRUE(next.await_ready());
+    if (!next.await_resume()) {
+      break;
+    }
+    EXPECT_NE(it.Value().age(), 0);
+    ++count;
+  }
+  EXPECT_EQ(count, 67);
+  EXPECT_TRUE(absl::IsOutOfRange(it.Status()));
+  EXPECT_EQ(queue.pending(), 0);
+}
+
+TEST(DbTest, WalRecoversCommitsOnOpen) {
+  gendb::WalOptions options;
+  options.dir = (std::filesystem::temp_directory_path() /
+                 ("db_wal_test_" + std::to_string(std::random_device{}())))
+                    .string();
+  std::filesystem::remove_all(options.dir);
+  {
+    Db db(options);
+    for (int i = 0; i < 3; ++i) {
+      auto writer = db.CreateWriter();
+      uint64_t id = 0;
+      ASSERT_TRUE(writer.NextAccountIdSequence(id).ok());
+      EXPECT_TRUE(writer
+                      .PutAccount(id, AccountBuilder()
+                                          .set_account_id(id)
+                                          .set_name("Bob")
+                                          .set_age(static_cast<int32_t>(id))
+                                          .Build())
+                      .ok());
+      writer.Commit();
+    }
+    auto writer = db.CreateWriter();
+    EXPECT_TRUE(
+        writer.UpdateAccount(2, AccountPatchBuilder().set_name("Robert").set_age(7).Build()).ok());
+    writer.CommitAsync().get();
+  }
+
+  Db db(options);
+  {
+    auto guard = db.SharedLock();
+    Account account;
+    ASSERT_TRUE(guard.GetAccount(2, account).ok());
+    EXPECT_EQ(account.name(), "Robert");
+    std::vector<uint64_t> ids;
+    for (auto it = guard.GetAccountByAgeRange(0, 10); it.Valid(); it.Next()) {
+      ids.push_back(it.Value().account_id());
+    }
+    EXPECT_THAT(ids, testing::ElementsAre(1, 3, 2));
+  }
+  auto writer = db.CreateWriter();
+  uint64_t id = 0;
+  ASSERT_TRUE(writer.NextAccountIdSequence(id).ok());
+  EXPECT_EQ(id, 4);
+  std::filesystem::remove_all(options.dir);
+}
+
+TEST(DbTest, TryCommitReturnsWalErrorsAndDropsTheChanges) {
+  gendb::WalOptions options;
+  options.dir = (std::filesystem::temp_directory_path() /
+                 ("db_try_commit_test_" + std::to_string(std::random_device{}())))
+                    .string();
+  std::filesystem::remove_all(options.dir);
+  // Every commit opens a segment of its own, which fails while the directory is gone.
+  options.segment_size = 1;
+  Db db(options);
+  std::filesystem::remove_all(options.dir);
+  {
+    auto writer = db.CreateWriter();
+    ASSERT_TRUE(writer.PutAccount(1, AccountBuilder().set_account_id(1).Build()).ok());
+    EXPECT_FALSE(writer.TryCommit().ok());
+
+    std::filesystem::create_directories(options.dir);
+    ASSERT_TRUE(writer.PutAccount(2, AccountBuilder().set_account_id(2).Build()).ok());
+    EXPECT_TRUE(writer.TryCommit().ok());
+  }
+  auto guard = db.SharedLock();
+  Account account;
+  EXPECT_FALSE(guard.GetAccount(1, account).ok());
+  EXPECT_TRUE(guard.GetAccount(2, account).ok());
+  std::filesystem::remove_all(options.dir);
+}
+
+TEST(DbTest, CheckpointHoldsCommitsTheWalNoLongerHas) {
+  gendb::WalOptions options;
+  options.dir = (std::filesystem::temp_directory_path() /
+                 ("db_checkpoint_test_" + std::to_string(std::random_device{}())))
+                    .string();
+  const std::string checkpoint_path = options.dir + ".checkpoint";
+  std::filesystem::remove_all(options.dir);
+  auto put_accounts = [](Db& db, int count) {
+    for (int i = 0; i < count; ++i) {
+      auto writer = db.CreateWriter();
+      uint64_t id = 0;
+      ASSERT_TRUE(writer.NextAccountIdSequence(id).ok());
+      EXPECT_TRUE(writer
+                      .PutAccount(id, AccountBuilder()
+                                          .set_account_id(id)
+                                          .set_name("Bob")
+                                          .set_age(static_cast<int32_t>(id))
+                                          .Build())
+                      .ok());
+      writer.Commit();
+    }
+  };
+  auto ids_by_age = [](const Guard& guard) {
+    std::vector<uint64_t> ids;
+    for (auto it = guard.GetAccountByAgeRange(0, 10); it.Valid(); it.Next()) {
+      ids.push_back(it.Value().account_id());
+    }
+    return ids;
+  };
+  {
+    Db db(options);
+    put_accounts(db, 3);
+    ASSERT_TRUE(db.WriteCheckpoint(checkpoint_path).ok());
+    // Logged after the checkpoint: a patch of one of its values, which moves its index record.
+    put_accounts(db, 1);
+    auto writer = db.CreateWriter();
+    EXPECT_TRUE(
+        writer.UpdateAccount(2, AccountPatchBuilder().set_name("Robert").set_age(7).Build()).ok());
+    writer.Commit();
+  }
+
+  {
+    // The checkpoint alone.
+    Db db(checkpoint_path);
+    auto guard = db.SharedLock();
+    Account account;
+    ASSERT_TRUE(guard.GetAccount(2, account).ok());
+    EXPECT_EQ(account.name(), "Bob");
+    EXPECT_FALSE(guard.GetAccount(4, account).ok());
+    EXPECT_THAT(ids_by_age(guard), testing::ElementsAre(1, 2, 3));
+  }
+  {
+    Db db(checkpoint_path, options);
+    {
+      auto guard = db.SharedLock();
+      Account account;
+      ASSERT_TRUE(guard.GetAccount(2, account).ok());
+      EXPECT_EQ(account.name(), "Robert");
+      EXPECT_TRUE(guard.GetAccount(4, account).ok());
+      EXPECT_THAT(ids_by_age(guard), testing::ElementsAre(1, 3, 4, 2));
+    }
+    put_accounts(db, 1);
+    // Holds the whole log, so every segment goes.
+    ASSERT_TRUE(db.WriteCheckpoint(checkpoint_path).ok());
+    put_accounts(db, 1);
+  }
+  // Without the checkpoint, the log misses the commits it holds.
+  EXPECT_THROW(Db{options}, std::runtime_error);
+
+  Db db(checkpoint_path, options);
+  {
+    auto guard = db.SharedLock();
+    EXPECT_THAT(ids_by_age(guard), testing::ElementsAre(1, 3, 4, 5, 6, 2));
+  }
+  auto writer = db.CreateWriter();
+  uint64_t id = 0;
+  ASSERT_TRUE(writer.NextAccountIdSequence(id).ok());
+  EXPECT_EQ(id, 7);
+  std::filesystem::remove_all(options.dir);
+  std::filesystem::remove(checkpoint_path);
+}
+
+TEST(DbTest, CheckpointChainWritesDeltasOfTheChangedKeys) {
+  gendb::WalOptions options;
+  options.dir = (std::filesystem::temp_directory_path() /
+                 ("db_checkpoint_chain_test_" + std::to_string(std::random_device{}())))
+                    .string();
+  std::filesystem::remove_all(options.dir);
+  gendb::CheckpointChain chain({.dir = options.dir + ".chain", .max_deltas = 2},
+                               Db::MergeCheckpoints);
+  auto put_accounts = [](Db& db, int count) {
+    for (int i = 0; i < count; ++i) {
+      auto writer = db.CreateWriter();
+      uint64_t id = 0;
+      ASSERT_TRUE(writer.NextAccountIdSequence(id).ok());
+      EXPECT_TRUE(writer
+                      .PutAccount(id, AccountBuilder()
+                                          .set_account_id(id)
+                                          .set_name("Bob")
+                                          .set_age(static_cast<int32_t>(id))
+                                          .Build())
+                      .ok());
+      writer.Commit();
+    }
+  };
+  auto ids_by_age = [](const Guard& guard) {
+    std::vector<uint64_t> ids;
+    for (auto it = guard.GetAccountByAgeRange(0, 1000); it.Valid(); it.Next()) {
+      ids.push_back(it.Value().account_id());
+    }
+    return ids;
+  };
+  {
+    Db db(options);
+    put_accounts(db, 100);
+    ASSERT_TRUE(db.WriteCheckpoint(chain).ok());
+    EXPECT_EQ(chain.Paths(), std::vector<std::string>{chain.Path(1, /*delta=*/false)});
+    // Moves an index record, then takes an id from the sequence.
+    {
+      auto writer = db.CreateWriter();
+      EXPECT_TRUE(writer.UpdateAccount(2, AccountPatchBuilder().set_age(70).Build()).ok());
+      writer.Commit();
+    }
+    put_accounts(db, 1);
+    ASSERT_TRUE(db.WriteCheckpoint(chain).ok());
+  }
+  {
+    // Only the changed accounts and the sequence are written again.
+    const gendb::Checkpoint delta(chain.Path(2, /*delta=*/true));
+    EXPECT_TRUE(delta.is_delta());
+    EXPECT_EQ(delta.size(AccountCollId), 2);
+    EXPECT_EQ(delta.size(MetadataValueCollId), 1);
+  }
+  {
+    Db db(chain.Paths(), options);
+    {
+      auto guard = db.SharedLock();
+      Account account;
+      ASSERT_TRUE(guard.GetAccount(2, account).ok());
+      EXPECT_EQ(account.age(), 70);
+      EXPECT_TRUE(guard.GetAccount(101, account).ok());
+      const std::vector<uint64_t> ids = ids_by_age(guard);
+      ASSERT_EQ(ids.size(), 101);
+      EXPECT_EQ(ids[68], 2);
+      EXPECT_EQ(ids[69], 70);
+    }
+    // Opened from the chain's last checkpoint: the next ones are deltas again, until there are
+    // too many and they are merged into a base.
+    put_accounts(db, 1);
+    ASSERT_TRUE(db.WriteCheckpoint(chain).ok());
+    put_accounts(db, 1);
+    ASSERT_TRUE(db.WriteCheckpoint(chain).ok());
+    ASSERT_TRUE(chain.Merge().ok());
+    ASSERT_TRUE(chain.merge_status().ok());
+    EXPECT_EQ(chain.Paths(), std::vector<std::string>{chain.Path(4, /*delta=*/false)});
+    put_accounts(db, 1);
+  }
+  Db db(chain.Paths(), options);
+  {
+    auto guard = db.SharedLock();
+    EXPECT_EQ(ids_by_age(guard).size(), 104);
+  }
+  auto writer = db.CreateWriter();
+  uint64_t id = 0;
+  ASSERT_TRUE(writer.NextAccountIdSequence(id).ok());
+  EXPECT_EQ(id, 105);
+  std::filesystem::remove_all(options.dir);
+  std::filesystem::remove_all(options.dir + ".chain");
+}
+
+TEST(DbTest, ChangeStreamPublishesCommitsInOrder) {
+  gendb::WalOptions options;
+  options.dir = (std::filesystem::temp_directory_path() /
+                 ("db_change_stream_test_" + std::to_string(std::random_device{}())))
+                    .string();
+  std::filesystem::remove_all(options.dir);
+  Db db(options);
+  auto put_account = [&](uint64_t id, const std::string& name) {
+    auto writer = db.CreateWriter();
+    EXPECT_TRUE(
+        writer.PutAccount(id, AccountBuilder().set_account_id(id).set_name(name).Build()).ok());
+    writer.Commit();
+  };
+  // Before anything subscribed: logged, not published.
+  put_account(1, "Alice");
+  gendb::ChangeStream::Subscriber subscriber = db.Changes().Subscribe();
+  put_account(2, "Bob");
+  {
+    auto writer = db.CreateWriter();
+    EXPECT_TRUE(writer.UpdateAccount(1, AccountPatchBuilder().set_name("Alicia").Build()).ok());
+    writer.Commit();
+  }
+
+  gendb::ChangeBatch batch;
+  ASSERT_TRUE(subscriber.Next(batch).ok());
+  // Numbered like the WAL records.
+  EXPECT_EQ(batch.sequence, 2);
+  std::vector<std::string> names;
+  ASSERT_TRUE(gendb::ForEachWalOp(batch.changes.data(), [&](const gendb::WalOp& op) {
+                EXPECT_EQ(op.type, gendb::WalOp::Type::kPut);
+                EXPECT_EQ(op.collection_id, AccountCollId);
+                names.emplace_back(Account{op.value}.name());
+                return absl::OkStatus();
+              }).ok());
+  EXPECT_THAT(names, testing::ElementsAre("Bob"));
+
+  ASSERT_TRUE(subscriber.Next(batch).ok());
+  EXPECT_EQ(batch.sequence, 3);
+  std::vector<uint8_t> account = AccountBuilder().set_account_id(1).set_name("Alice").Build();
+  ASSERT_TRUE(gendb::ForEachWalOp(batch.changes.data(), [&](const gendb::WalOp& op) {
+                EXPECT_EQ(op.type, gendb::WalOp::Type::kPatch);
+                gendb::ApplyPatch<Account>(op.patch, account);
+                return absl::OkStatus();
+              }).ok());
+  EXPECT_EQ(Account{account}.name(), "Alicia");
+  EXPECT_TRUE(absl::IsOutOfRange(subscriber.Next(batch)));
+
+  gendb::ChangeStream::Subscriber resumed = db.Changes().Resume(2);
+  ASSERT_TRUE(resumed.Next(batch).ok());
+  EXPECT_EQ(batch.sequence, 3);
+  std::filesystem::remove_all(options.dir);
+}
+
+TEST(DbTest, ChangeStreamPublishesAppliedCommits) {
+  constexpr uint64_t kCommits = 200;
+  Db db;
+  gendb::ChangeStream::Subscriber subscriber = db.Changes().Subscribe();
+  std::thread producer([&] {
+    for (uint64_t id = 1; id <= kCommits; ++id) {
+      auto writer = db.CreateWriter();
+      EXPECT_TRUE(writer.PutAccount(id, AccountBuilder().set_account_id(id).Build()).ok());
+      writer.CommitAsync();
+    }
+  });
+  // Whatever a subscriber reads, readers of the Db already see.
+  gendb::ChangeBatch batch;
+  for (uint64_t read = 0; read < kCommits;) {
+    absl::Status status = subscriber.Next(batch);
+    if (absl::IsOutOfRange(status)) {
+      std::this_thread::yield();
+      continue;
+    }
+    ASSERT_TRUE(status.ok());
+    ++read;
+    ASSERT_TRUE(gendb::ForEachWalOp(batch.changes.data(), [&](const gendb::WalOp& op) {
+                  Account account;
+                  EXPECT_TRUE(db.SharedLock().GetAccount(Account{op.value}.account_id(), account)
+                                  .ok());
+                  return absl::OkStatus();
+                }).ok());
+  }
+  producer.join();
+}
+
+TEST(DbTest, DbNextSequenceIdsComeFromReservedBlocks) {
+  gendb::WalOptions options;
+  options.dir = (std::filesystem::temp_directory_path() /
+                 ("db_sequence_block_test_" + std::to_string(std::random_device{}())))
+                    .string();
+  std::filesystem::remove_all(options.dir);
+  const MetadataValueKey key{
+      .type = MetadataType::kSequence,
+      .id = static_cast<uint32_t>(SequenceMetadataId::AccountIdSequence)};
+  {
+    Db db(options);
+    uint64_t id = 0;
+    ASSERT_TRUE(db.NextAccountIdSequence(id).ok());
+    EXPECT_EQ(id, 1);
+    ASSERT_TRUE(db.NextAccountIdSequence(id).ok());
+    EXPECT_EQ(id, 2);
+    {
+      // The whole block was reserved with one commit.
+      auto guard = db.SharedLock();
+      MetadataValue value;
+      ASSERT_TRUE(guard.GetMetadataValue(key, value).ok());
+      EXPECT_EQ(value.int_value(), Db::kSequenceBlockSize);
+    }
+    {
+      // Writers take their ids after the block.
+      auto writer = db.CreateWriter();
+      ASSERT_TRUE(writer.NextAccountIdSequence(id).ok());
+      EXPECT_EQ(id, Db::kSequenceBlockSize + 1);
+      writer.Commit();
+    }
+
+    // Threads share the rest of the block and the ones after it without taking an id twice.
+    constexpr int kThreads = 4;
+    constexpr int kIdsPerThread = Db::kSequenceBlockSize;
+    std::vector<std::vector<uint64_t>> thread_ids(kThreads);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < kThreads; ++t) {
+      threads.emplace_back([&db, &ids = thread_ids[t]] {
+        for (int i = 0; i < kIdsPerThread; ++i) {
+          uint64_t next_id = 0;
+          ASSERT_TRUE(db.NextAccountIdSequence(next_id).ok());
+          ids.push_back(next_id);
+        }
+      });
+    }
+    for (std::thread& thread : threads) {
+      thread.join();
+    }
+    std::set<uint64_t> ids = {1, 2};
+    for (const std::vector<uint64_t>& taken : thread_ids) {
+      ids.insert(taken.begin(), taken.end());
+    }
+    EXPECT_EQ(ids.size(), 2 + kThreads * kIdsPerThread);
+    EXPECT_FALSE(ids.contains(Db::kSequenceBlockSize + 1));
+  }
+
+  // The reservations were logged: the rest of the last block is skipped on reopen.
+  Db db(options);
+  int32_t reserved = 0;
+  {
+    auto guard = db.SharedLock();
+    MetadataValue value;
+    ASSERT_TRUE(guard.GetMetadataValue(key, value).ok());
+    reserved = value.int_value();
+  }
+  uint64_t id = 0;
+  ASSERT_TRUE(db.NextAccountIdSequence(id).ok());
+  EXPECT_EQ(id, reserved + 1);
+  std::filesystem::remove_all(options.dir);
+}
+
+TEST(DbTest, DbNextSequenceIdsFailOnAWritersThread) {
+  Db db;
+  uint64_t id = 0;
+  ASSERT_TRUE(db.NextAccountIdSequence(id).ok());
+  {
+    // Fails even with ids left in the block, rather than waiting for the writer once it runs out.
+    auto writer = db.CreateWriter();
+    EXPECT_EQ(db.NextAccountIdSequence(id).code(), absl::StatusCode::kFailedPrecondition);
+    writer.Commit();
+    EXPECT_EQ(db.NextAccountIdSequence(id).code(), absl::StatusCode::kFailedPrecondition);
+  }
+  ASSERT_TRUE(db.NextAccountIdSequence(id).ok());
+  EXPECT_EQ(id, 2);
+}
+
+TEST(DbTest, DbNextSequenceIdsReturnWalErrors) {
+  gendb::WalOptions options;
+  options.dir = (std::filesystem::temp_directory_path() /
+                 ("db_sequence_wal_test_" + std::to_string(std::random_device{}())))
+                    .string();
+  std::filesystem::remove_all(options.dir);
+  // Every commit opens a segment of its own, which fails while the directory is gone.
+  options.segment_size = 1;
+  Db db(options);
+  std::filesystem::remove_all(options.dir);
+  uint64_t id = 0;
+  EXPECT_FALSE(db.NextAccountIdSequence(id).ok());
+
+  // The failed reservation took no id.
+  std::filesystem::create_directories(options.dir);
+  ASSERT_TRUE(db.NextAccountIdSequence(id).ok());
+  EXPECT_EQ(id, 1);
+  std::filesystem::remove_all(options.dir);
+}
+
+TEST(DbTest, SequencesStopAtInt32Max) {
+  gendb::WalOptions options;
+  options.dir = (std::filesystem::temp_directory_path() /
+                 ("db_sequence_max_test_" + std::to_string(std::random_device{}())))
+                    .string();
+  std::filesystem::remove_all(options.dir);
+  {
+    // Room for one more block.
+    gendb::Wal wal(options, [](uint64_t, gendb::BytesConstView) { return absl::OkStatus(); });
+    gendb::WalBatch batch;
+    const MetadataValueKey key{
+        .type = MetadataType::kSequence,
+        .id = static_cast<uint32_t>(SequenceMetadataId::AccountIdSequence)};
+    const int32_t last_id = INT32_MAX - Db::kSequenceBlockSize;
+    batch.Put(MetadataValueCollId, ToMetadataValueKey(key),
+              gendb::MetadataValueBuilder().set_int_value(last_id).Build());
+    ASSERT_TRUE(wal.Append(batch).ok());
+  }
+
+  Db db(options);
+  uint64_t id = 0;
+  for (int i = 0; i < Db::kSequenceBlockSize; ++i) {
+    ASSERT_TRUE(db.NextAccountIdSequence(id).ok());
+  }
+  EXPECT_EQ(id, INT32_MAX);
+  EXPECT_EQ(db.NextAccountIdSequence(id).code(), absl::StatusCode::kOutOfRange);
+  auto writer = db.CreateWriter();
+  EXPECT_EQ(writer.NextAccountIdSequence(id).code(), absl::StatusCode::kOutOfRange);
+  writer.Commit();
+  std::filesystem::remove_all(options.dir);
+}
@@ -2,8 +2,14 @@
 //
 #include "database.h"
 
+#include <algorithm>
 #include <cstdint>
+#include <exception>
+#include <future>
 #include <optional>
+#include <stdexcept>
+#include <string>
+#include <vector>
 
 #include "absl/status/status.h"
 #include "account.fbs.h"
@@ -13,17 +19,327 @@
 #include "gendb/iterator.h"
 #include "gendb/message_patch.h"
 #include "gendb/status.h"
+#include "gendb/wal_replay.h"
 #include "metadata.fbs.h"
 #include "position.fbs.h"
 
 namespace gendb::tests {
 
+namespace {
+
+// Indexed values as the indices store them.
+std::optional<int32_t> AccountByAgeValue(const Account& account) {
+  if (!account.has_age()) {
+    return std::nullopt;
+  }
+  return account.age();
+}
+
+std::optional<int32_t> PositionByAccountIdValue(const Position& position) {
+  if (!position.has_account_id()) {
+    return std::nullopt;
+  }
+  return position.account_id();
+}
+
+}  // namespace
+
+Db::Db(const gendb::WalOptions& wal_options) { OpenWal(wal_options, /*checkpoint_sequence=*/0); }
+
+Db::Db(const std::string& checkpoint_path) : Db(std::span(&checkpoint_path, 1)) {}
+
+Db::Db(const std::string& checkpoint_path, const gendb::WalOptions& wal_options)
+    : Db(std::span(&checkpoint_path, 1), wal_options) {}
+
+Db::Db(std::span<const std::string> checkpoint_paths) { OpenCheckpoints(checkpoint_paths); }
+
+Db::Db(std::span<const std::string> checkpoint_paths, const gendb::WalOptions& wal_options) {
+  OpenWal(wal_options, OpenCheckpoints(checkpoint_paths));
+}
+
+void Db::OpenWal(const gendb::WalOptions& wal_options, uint64_t checkpoint_sequence) {
+  // The log is replayed before `_wal` is set, so the replayed commits are not logged again.
+  gendb::ParallelWalReplay replay(_storage, wal_options.replay_threads);
+  auto wal = std::make_unique<gendb::Wal>(
+      wal_options, [&](uint64_t sequence, gendb::BytesConstView record) {
+        if (sequence <= checkpoint_sequence) {
+          return absl::OkStatus();
+        }
+        // Segments are only removed once a checkpoint holds their records.
+        if (replay.records() == 0 && sequence != checkpoint_sequence + 1) {
+          return absl::DataLossError("WAL record " + std::to_string(checkpoint_sequence + 1) +
+                                     " is missing");
+        }
+        return replay.Add(record);
+      });
+  if (absl::Status status = replay.Finish(); !status.ok()) {
+    throw std::runtime_error("Failed to replay the WAL: " + status.ToString());
+  }
+  // Before WriteTo moves the replayed values out.
+  gendb::RebuildIndex(
+      replay, AccountCollId,
+      [](gendb::BytesConstView value) { return AccountByAgeValue(Account{value}); },
+      _indices.account_by_age);
+  gendb::RebuildIndex(
+      replay, PositionCollId,
+      [](gendb::BytesConstView value) { return PositionByAccountIdValue(Position{value}); },
+      _indices.position_by_account_id);
+  if (absl::Status status = replay.WriteTo(_versioned_storage, _changed_keys.get()); !status.ok()) {
+    throw std::runtime_error("Failed to write the replayed WAL: " + status.ToString());
+  }
+  // The log may not reach the checkpoint: the sequence continues from the checkpoint's.
+  if (checkpoint_sequence > 0) {
+    if (absl::Status status = wal->RemoveThrough(checkpoint_sequence); !status.ok()) {
+      throw std::runtime_error("Failed to remove the checkpointed WAL: " + status.ToString());
+    }
+  }
+  _wal = std::move(wal);
+}
+
+uint64_t Db::OpenCheckpoints(std::span<const std::string> paths) {
+  std::vector<std::unique_ptr<const gendb::Checkpoint>> checkpoints =
+      gendb::OpenCheckpointChain(paths);
+  if (checkpoints.empty()) {
+    throw std::runtime_error("No checkpoint to open");
+  }
+  for (size_t i = 0; i < checkpoints.size(); ++i) {
+    // Deltas have no indices: they are rebuilt from the values.
+    if (checkpoints[i]->collection_count() != 4 ||
+        checkpoints[i]->index_count() != (i == 0 ? 2 : 0)) {
+      throw std::runtime_error("Checkpoint " + paths[i] + " was written for another schema");
+    }
+  }
+  if (absl::Status status = checkpoints.front()->LoadIndex(0, _indices.account_by_age);
+      !status.ok()) {
+    throw std::runtime_error("Failed to load index account_by_age: " + status.ToString());
+  }
+  if (absl::Status status = checkpoints.front()->LoadIndex(1, _indices.position_by_account_id);
+      !status.ok()) {
+    throw std::runtime_error("Failed to load index position_by_account_id: " + status.ToString());
+  }
+  _checkpoint_generation = checkpoints.back()->generation();
+  _checkpoint_wal_sequence = checkpoints.back()->wal_sequence();
+  if (_checkpoint_generation > 0) {
+    _changed_keys = std::make_unique<gendb::ChangedKeys>();
+  }
+  _storage.SetCheckpoint(std::move(checkpoints.front()));
+  if (checkpoints.size() == 1) {
+    return _checkpoint_wal_sequence;
+  }
+  // The deltas replay over the base like a WAL, with the indices rebuilt once. Their changes are
+  // already in the chain, so they are not tracked for the next delta.
+  gendb::ParallelWalReplay replay(_storage, /*threads=*/0);
+  for (size_t i = 1; i < checkpoints.size(); ++i) {
+    if (absl::Status status = replay.AddDelta(*checkpoints[i]); !status.ok()) {
+      throw std::runtime_error(
+          "Failed to replay checkpoint " + paths[i] + ": " + status.ToString());
+    }
+  }
+  if (absl::Status status = replay.Finish(); !status.ok()) {
+    throw std::runtime_error("Failed to replay the checkpoint deltas: " + status.ToString());
+  }
+  // Before WriteTo moves the replayed values out.
+  gendb::RebuildIndex(
+      replay, AccountCollId,
+      [](gendb::BytesConstView value) { return AccountByAgeValue(Account{value}); },
+      _indices.account_by_age);
+  gendb::RebuildIndex(
+      replay, PositionCollId,
+      [](gendb::BytesConstView value) { return PositionByAccountIdValue(Position{value}); },
+      _indices.position_by_account_id);
+  if (absl::Status status = replay.WriteTo(_versioned_storage); !status.ok()) {
+    throw std::runtime_error(
+        "Failed to write the replayed checkpoint deltas: " + status.ToString());
+  }
+  return _checkpoint_wal_sequence;
+}
+
+absl::Status Db::WriteCheckpoint(const std::string& path) {
+  std::lock_guard lock(_checkpoint_mutex);
+  // Outside of any chain, so no delta follows it.
+  return WriteCheckpointFile(path, /*generation=*/0, /*delta=*/false);
+}
+
+absl::Status Db::WriteCheckpoint(gendb::CheckpointChain& chain) {
+  std::lock_guard lock(_checkpoint_mutex);
+  const uint64_t last_generation = chain.LastGeneration();
+  // `_changed_keys` holds the changes since the Db's last checkpoint, which must be the chain's.
+  const bool delta = _changed_keys != nullptr && last_generation > 0 &&
+                     last_generation == _checkpoint_generation;
+  const uint64_t generation = last_generation + 1;
+  RETURN_IF_ERROR(WriteCheckpointFile(chain.Path(generation, delta), generation, delta));
+  return chain.Add(generation, delta);
+}
+
+absl::Status Db::MergeCheckpoints(std::span<const std::string> paths, const std::string& path) {
+  try {
+    // A merge reads the whole chain anyway, so it checks the base's checksums rather than carry
+    // a corrupt record into a new base under a fresh checksum. The deltas are checked as they
+    // replay.
+    if (!paths.empty()) {
+      RETURN_IF_ERROR(gendb::Checkpoint(paths.front()).Verify());
+    }
+    Db db(paths);
+    return db.WriteCheckpointFile(path, db._checkpoint_generation, /*delta=*/false);
+  } catch (const std::runtime_error& error) {
+    return absl::DataLossError(error.what());
+  }
+}
+
+absl::Status Db::WithCommitsHeld(const std::function<absl::Status()>& fn) {
+  std::lock_guard lock(_writer_mutex);
+  _apply_queue.WaitIdle();
+  return fn();
+}
+
+absl::Status Db::WriteCheckpointFile(const std::string& path, uint64_t generation, bool delta) {
+  // Commits are only held back while the state to write is captured: a snapshot, the last WAL
+  // record it holds and the keys changed since the last checkpoint, which commits from then on
+  // leave for a new set.
+  std::optional<gendb::StorageSnapshot> snapshot;
+  uint64_t wal_sequence = 0;
+  std::unique_ptr<gendb::ChangedKeys> changed_keys;
+  RETURN_IF_ERROR(WithCommitsHeld([&] {
+    snapshot.emplace(_versioned_storage.GetSnapshot());
+    wal_sequence = _wal != nullptr ? _wal->LastSequence() : _checkpoint_wal_sequence;
+    if (_changed_keys != nullptr || generation > 0) {
+      changed_keys = std::exchange(_changed_keys, std::make_unique<gendb::ChangedKeys>());
+    }
+    return absl::OkStatus();
+  }));
+
+  absl::Status status = [&] {
+    gendb::CheckpointWriter writer(path, generation, delta);
+    for (size_t collection_id = 0; collection_id < 4; ++collection_id) {
+      if (delta) {
+        RETURN_IF_ERROR(writer.AddChangedKeys(*snapshot, collection_id,
+                                              changed_keys->collection(collection_id)));
+      } else {
+        RETURN_IF_ERROR(writer.AddCollection(*snapshot->NewCursor(collection_id)));
+      }
+    }
+    if (!delta) {
+      // From the snapshot: the Db's indices may have moved on since.
+      {
+        Indices::AccountByAgeIndexType index;
+        auto cursor = snapshot->NewCursor(AccountCollId);
+        for (cursor->Seek({}); cursor->Valid(); cursor->Next()) {
+          if (auto value = AccountByAgeValue(Account{cursor->Value()})) {
+            std::array<uint8_t, sizeof(uint64_t)> prim_key;
+            std::copy_n(cursor->Key().begin(), prim_key.size(), prim_key.begin());
+            index.Insert(*value, prim_key);
+          }
+        }
+        RETURN_IF_ERROR(writer.AddIndex(index));
+      }
+      {
+        Indices::PositionByAccountIdIndexType index;
+        auto cursor = snapshot->NewCursor(PositionCollId);
+        for (cursor->Seek({}); cursor->Valid(); cursor->Next()) {
+          if (auto value = PositionByAccountIdValue(Position{cursor->Value()})) {
+            std::array<uint8_t, sizeof(int32_t)> prim_key;
+            std::copy_n(cursor->Key().begin(), prim_key.size(), prim_key.begin());
+            index.Insert(*value, prim_key);
+          }
+        }
+        RETURN_IF_ERROR(writer.AddIndex(index));
+      }
+    }
+    return writer.Finish(wal_sequence);
+  }();
+  if (!status.ok()) {
+    // The keys the checkpoint did not get to hold are still for the next delta.
+    RETURN_IF_ERROR(WithCommitsHeld([&] {
+      if (changed_keys != nullptr) {
+        changed_keys->Add(*_changed_keys);
+      }
+      _changed_keys = std::move(changed_keys);
+      return absl::OkStatus();
+    }));
+    return status;
+  }
+  _checkpoint_generation = generation;
+  _checkpoint_wal_sequence = wal_sequence;
+  // Only a checkpoint of a chain is followed by deltas.
+  if (generation == 0 && changed_keys != nullptr) {
+    RETURN_IF_ERROR(WithCommitsHeld([&] {
+      _changed_keys.reset();
+      return absl::OkStatus();
+    }));
+  }
+  return _wal != nullptr ? _wal->RemoveThrough(wal_sequence) : absl::OkStatus();
+}
+
 Guard Db::SharedLock() const {
-  return {*this, std::shared_lock<std::shared_mutex>(_reader_mutex)};
+  return {*this, _reader_mutex.LockShared()};
+}
+
+Snapshot Db::Snapshot() const {
+  return {*this, _versioned_storage.GetSnapshot()};
 }
 
 ScopedWrite Db::CreateWriter() {
-  return {*this, std::unique_lock<std::mutex>(_writer_mutex)};
+  return {*this, std::unique_lock(_writer_mutex)};
+}
+
+void Db::ApplyCommit(PendingCommit& commit) {
+  bool dropped = false;
+  {
+    std::lock_guard pending_lock(_pending_mutex);
+    if (_dropping_pending) {
+      _pending_storages.pop_front();
+      ++_dropped_commits;
+      _dropping_pending = !_pending_storages.empty();
+      dropped = true;
+    }
+  }
+  if (dropped) {
+    DiscardChanges(commit.changes);
+    throw std::runtime_error("Dropped a commit made over one that failed to apply");
+  }
+  std::unique_lock lock(_reader_mutex);
+  try {
+    // Writers created meanwhile read the storage from the pending commits, so it is left as is.
+    gendb::LayeredStorage(_versioned_storage, nullptr)
+        .MergeChanges(*commit.storage, _changed_keys.get());
+  } catch (...) {
+    lock.unlock();
+    // Only erased if no later commit was logged: the WAL then fails the next ones.
+    DiscardChanges(commit.changes);
+    std::lock_guard pending_lock(_pending_mutex);
+    _pending_storages.pop_front();
+    ++_dropped_commits;
+    // The commits still pending were made over this one.
+    _dropping_pending = !_pending_storages.empty();
+    throw;
+  }
+  _indices.MergeTempIndices(std::move(commit.indices), _versioned_storage.LastSequence(),
+                            _versioned_storage.OldestSnapshot());
+  lock.unlock();
+  {
+    // Writers created from now on read the Db itself.
+    std::lock_guard pending_lock(_pending_mutex);
+    _pending_storages.pop_front();
+  }
+  PublishChanges(std::move(commit.changes));
+}
+
+std::vector<std::shared_ptr<const gendb::MemoryStorage>> Db::PendingStorages(
+    uint64_t& dropped_commits) {
+  std::lock_guard lock(_pending_mutex);
+  dropped_commits = _dropped_commits;
+  return {_pending_storages.begin(), _pending_storages.end()};
+}
+
+bool Db::DroppedCommitsSince(uint64_t dropped_commits) {
+  std::lock_guard lock(_pending_mutex);
+  return _dropped_commits != dropped_commits;
+}
+
+void ScopedWrite::WaitForPending() const {
+  if (!_pending.empty()) {
+    _db._apply_queue.WaitIdle();
+  }
 }
 
 absl::Status Guard::GetMetadataValue(const MetadataValueKey& key,
@@ -34,6 +350,55 @@ absl::Status Guard::GetMetadataValue(const MetadataValueKey& key,
   return absl::OkStatus();
 }
 
+void Guard::GetMetadataValues(std::span<const MetadataValueKey> keys,
+                              std::span<MetadataValue> metadata_values,
+                              std::span<absl::Status> statuses) const {
+  gendb::MultiGetMessages<MetadataValue>(
+      _layered_storage, MetadataValueCollId, keys,
+      [](const MetadataValueKey& key) { return ToMetadataValueKey(key); }, metadata_values,
+      statuses);
+}
+
+gendb::Iterator<MetadataValue> Guard::ScanMetadataValues(const MetadataValueKey& from,
+                                                         const MetadataValueKey& to) const {
+  _layered_storage.ReleasePins();
+  const auto begin_key = ToMetadataValueKey(from);
+  const auto end_key = ToMetadataValueKey(to);
+  return gendb::MakePrimaryKeyIterator<MetadataValue>(_db._storage, MetadataValueCollId, begin_key,
+                                                      end_key);
+}
+
+gendb::GetMessageAwaitable<MetadataValue, std::array<uint8_t, 8>> Guard::GetMetadataValueAsync(
+    const MetadataValueKey& key, MetadataValue& metadata_value,
+    gendb::AsyncReadQueue* queue) const {
+  return {_layered_storage, MetadataValueCollId, ToMetadataValueKey(key), metadata_value, queue};
+}
+
+absl::Status Snapshot::GetMetadataValue(const MetadataValueKey& key,
+                                        MetadataValue& metadata_value) const {
+  BytesConstView value;
+  RETURN_IF_ERROR(_snapshot.Get(MetadataValueCollId, ToMetadataValueKey(key), value));
+  metadata_value = MetadataValue{value};
+  return absl::OkStatus();
+}
+
+void Snapshot::GetMetadataValues(std::span<const MetadataValueKey> keys,
+                                 std::span<MetadataValue> metadata_values,
+                                 std::span<absl::Status> statuses) const {
+  gendb::MultiGetMessages<MetadataValue>(
+      _snapshot, MetadataValueCollId, keys,
+      [](const MetadataValueKey& key) { return ToMetadataValueKey(key); }, metadata_values,
+      statuses);
+}
+
+gendb::Iterator<MetadataValue> Snapshot::ScanMetadataValues(const MetadataValueKey& from,
+                                                            const MetadataValueKey& to) const {
+  const auto begin_key = ToMetadataValueKey(from);
+  const auto end_key = ToMetadataValueKey(to);
+  return gendb::MakePrimaryKeyIterator<MetadataValue>(_snapshot, MetadataValueCollId, begin_key,
+                                                      end_key);
+}
+
 absl::Status ScopedWrite::GetMetadataValue(const MetadataValueKey& key,
                                            MetadataValue& metadata_value) const {
   BytesConstView value;
@@ -44,6 +409,9 @@ absl::Status ScopedWrite::GetMetadataValue(const MetadataValueKey& key,
 
 absl::Status ScopedWrite::PutMetadataValue(const MetadataValueKey& key, Bytes metadata_value) {
   auto key_ = ToMetadataValueKey(key);
+  if (_record_changes) {
+    _wal_batch.Put(MetadataValueCollId, key_, metadata_value);
+  }
   _temp_storage.Put(MetadataValueCollId, key_, std::move(metadata_value));
   return absl::OkStatus();
 }
@@ -53,6 +421,9 @@ absl::Status ScopedWrite::UpdateMetadataValue(const MetadataValueKey& key,
   Bytes* ptr = nullptr;
   auto key_ = ToMetadataValueKey(key);
   RETURN_IF_ERROR(_layered_storage.EnsureInTempStorage(MetadataValueCollId, key_, &ptr));
+  if (_record_changes) {
+    _wal_batch.Patch(MetadataValueCollId, key_, update);
+  }
   gendb::ApplyPatch<MetadataValue>(update, *ptr);
   return absl::OkStatus();
 }
@@ -63,6 +434,47 @@ absl::Status Guard::GetAccount(uint64_t account_id, Account& account) const {
   return absl::OkStatus();
 }
 
+void Guard::GetAccounts(std::span<const uint64_t> account_ids, std::span<Account> accounts,
+                        std::span<absl::Status> statuses) const {
+  gendb::MultiGetMessages<Account>(
+      _layered_storage, AccountCollId, account_ids,
+      [](uint64_t account_id) { return ToAccountKey(account_id); }, accounts, statuses);
+}
+
+gendb::Iterator<Account> Guard::ScanAccounts(uint64_t from_account_id,
+                                             uint64_t to_account_id) const {
+  _layered_storage.ReleasePins();
+  const auto begin_key = ToAccountKey(from_account_id);
+  const auto end_key = ToAccountKey(to_account_id);
+  return gendb::MakePrimaryKeyIterator<Account>(_db._storage, AccountCollId, begin_key, end_key);
+}
+
+gendb::GetMessageAwaitable<Account, std::array<uint8_t, 8>> Guard::GetAccountAsync(
+    uint64_t account_id, Account& account, gendb::AsyncReadQueue* queue) const {
+  return {_layered_storage, AccountCollId, ToAccountKey(account_id), account, queue};
+}
+
+absl::Status Snapshot::GetAccount(uint64_t account_id, Account& account) const {
+  BytesConstView value;
+  RETURN_IF_ERROR(_snapshot.Get(AccountCollId, ToAccountKey(account_id), value));
+  account = Account{value};
+  return absl::OkStatus();
+}
+
+void Snapshot::GetAccounts(std::span<const uint64_t> account_ids, std::span<Account> accounts,
+                           std::span<absl::Status> statuses) const {
+  gendb::MultiGetMessages<Account>(
+      _snapshot, AccountCollId, account_ids,
+      [](uint64_t account_id) { return ToAccountKey(account_id); }, accounts, statuses);
+}
+
+gendb::Iterator<Account> Snapshot::ScanAccounts(uint64_t from_account_id,
+                                                uint64_t to_account_id) const {
+  const auto begin_key = ToAccountKey(from_account_id);
+  const auto end_key = ToAccountKey(to_account_id);
+  return gendb::MakePrimaryKeyIterator<Account>(_snapshot, AccountCollId, begin_key, end_key);
+}
+
 absl::Status ScopedWrite::GetAccount(uint64_t account_id, Account& account) const {
   BytesConstView value;
   RETURN_IF_ERROR(_layered_storage.Get(AccountCollId, ToAccountKey(account_id), value));
@@ -73,6 +485,9 @@ absl::Status ScopedWrite::GetAccount(uint64_t account_id, Account& account) cons
 absl::Status ScopedWrite::PutAccount(uint64_t account_id, Bytes account) {
   auto key_ = ToAccountKey(account_id);
   MaybeUpdateAccountByAgeIndex(key_, account, /*update=*/nullptr);
+  if (_record_changes) {
+    _wal_batch.Put(AccountCollId, key_, account);
+  }
   _temp_storage.Put(AccountCollId, key_, std::move(account));
   return absl::OkStatus();
 }
@@ -82,6 +497,9 @@ absl::Status ScopedWrite::UpdateAccount(uint64_t account_id, const MessagePatch&
   auto key_ = ToAccountKey(account_id);
   RETURN_IF_ERROR(_layered_storage.EnsureInTempStorage(AccountCollId, key_, &ptr));
   MaybeUpdateAccountByAgeIndex(key_, *ptr, &update);
+  if (_record_changes) {
+    _wal_batch.Patch(AccountCollId, key_, update);
+  }
   gendb::ApplyPatch<Account>(update, *ptr);
   return absl::OkStatus();
 }
@@ -92,6 +510,47 @@ absl::Status Guard::GetPosition(int32_t position_id, Position& position) const {
   return absl::OkStatus();
 }
 
+void Guard::GetPositions(std::span<const int32_t> position_ids, std::span<Position> positions,
+                         std::span<absl::Status> statuses) const {
+  gendb::MultiGetMessages<Position>(
+      _layered_storage, PositionCollId, position_ids,
+      [](int32_t position_id) { return ToPositionKey(position_id); }, positions, statuses);
+}
+
+gendb::Iterator<Position> Guard::ScanPositions(int32_t from_position_id,
+                                               int32_t to_position_id) const {
+  _layered_storage.ReleasePins();
+  const auto begin_key = ToPositionKey(from_position_id);
+  const auto end_key = ToPositionKey(to_position_id);
+  return gendb::MakePrimaryKeyIterator<Position>(_db._storage, PositionCollId, begin_key, end_key);
+}
+
+gendb::GetMessageAwaitable<Position, std::array<uint8_t, 4>> Guard::GetPositionAsync(
+    int32_t position_id, Position& position, gendb::AsyncReadQueue* queue) const {
+  return {_layered_storage, PositionCollId, ToPositionKey(position_id), position, queue};
+}
+
+absl::Status Snapshot::GetPosition(int32_t position_id, Position& position) const {
+  BytesConstView value;
+  RETURN_IF_ERROR(_snapshot.Get(PositionCollId, ToPositionKey(position_id), value));
+  position = Position{value};
+  return absl::OkStatus();
+}
+
+void Snapshot::GetPositions(std::span<const int32_t> position_ids, std::span<Position> positions,
+                            std::span<absl::Status> statuses) const {
+  gendb::MultiGetMessages<Position>(
+      _snapshot, PositionCollId, position_ids,
+      [](int32_t position_id) { return ToPositionKey(position_id); }, positions, statuses);
+}
+
+gendb::Iterator<Position> Snapshot::ScanPositions(int32_t from_position_id,
+                                                  int32_t to_position_id) const {
+  const auto begin_key = ToPositionKey(from_position_id);
+  const auto end_key = ToPositionKey(to_position_id);
+  return gendb::MakePrimaryKeyIterator<Position>(_snapshot, PositionCollId, begin_key, end_key);
+}
+
 absl::Status ScopedWrite::GetPosition(int32_t position_id, Position& position) const {
   BytesConstView value;
   RETURN_IF_ERROR(_layered_storage.Get(PositionCollId, ToPositionKey(position_id), value));
@@ -102,6 +561,9 @@ absl::Status ScopedWrite::GetPosition(int32_t position_id, Position& position) c
 absl::Status ScopedWrite::PutPosition(int32_t position_id, Bytes position) {
   auto key_ = ToPositionKey(position_id);
   MaybeUpdatePositionByAccountIdIndex(key_, position, /*update=*/nullptr);
+  if (_record_changes) {
+    _wal_batch.Put(PositionCollId, key_, position);
+  }
   _temp_storage.Put(PositionCollId, key_, std::move(position));
   return absl::OkStatus();
 }
@@ -111,6 +573,9 @@ absl::Status ScopedWrite::UpdatePosition(int32_t position_id, const MessagePatch
   auto key_ = ToPositionKey(position_id);
   RETURN_IF_ERROR(_layered_storage.EnsureInTempStorage(PositionCollId, key_, &ptr));
   MaybeUpdatePositionByAccountIdIndex(key_, *ptr, &update);
+  if (_record_changes) {
+    _wal_batch.Patch(PositionCollId, key_, update);
+  }
   gendb::ApplyPatch<Position>(update, *ptr);
   return absl::OkStatus();
 }
@@ -121,6 +586,47 @@ absl::Status Guard::GetConfig(std::string_view config_name, Config& config) cons
   return absl::OkStatus();
 }
 
+void Guard::GetConfigs(std::span<const std::string_view> config_names, std::span<Config> configs,
+                       std::span<absl::Status> statuses) const {
+  gendb::MultiGetMessages<Config>(
+      _layered_storage, ConfigCollId, config_names,
+      [](std::string_view config_name) { return ToConfigKey(config_name); }, configs, statuses);
+}
+
+gendb::Iterator<Config> Guard::ScanConfigs(std::string_view from_config_name,
+                                           std::string_view to_config_name) const {
+  _layered_storage.ReleasePins();
+  const auto begin_key = ToConfigKey(from_config_name);
+  const auto end_key = ToConfigKey(to_config_name);
+  return gendb::MakePrimaryKeyIterator<Config>(_db._storage, ConfigCollId, begin_key, end_key);
+}
+
+gendb::GetMessageAwaitable<Config, SmallKey> Guard::GetConfigAsync(
+    std::string_view config_name, Config& config, gendb::AsyncReadQueue* queue) const {
+  return {_layered_storage, ConfigCollId, ToConfigKey(config_name), config, queue};
+}
+
+absl::Status Snapshot::GetConfig(std::string_view config_name, Config& config) const {
+  BytesConstView value;
+  RETURN_IF_ERROR(_snapshot.Get(ConfigCollId, ToConfigKey(config_name), value));
+  config = Config{value};
+  return absl::OkStatus();
+}
+
+void Snapshot::GetConfigs(std::span<const std::string_view> config_names, std::span<Config> configs,
+                          std::span<absl::Status> statuses) const {
+  gendb::MultiGetMessages<Config>(
+      _snapshot, ConfigCollId, config_names,
+      [](std::string_view config_name) { return ToConfigKey(config_name); }, configs, statuses);
+}
+
+gendb::Iterator<Config> Snapshot::ScanConfigs(std::string_view from_config_name,
+                                              std::string_view to_config_name) const {
+  const auto begin_key = ToConfigKey(from_config_name);
+  const auto end_key = ToConfigKey(to_config_name);
+  return gendb::MakePrimaryKeyIterator<Config>(_snapshot, ConfigCollId, begin_key, end_key);
+}
+
 absl::Status ScopedWrite::GetConfig(std::string_view config_name, Config& config) const {
   BytesConstView value;
   RETURN_IF_ERROR(_layered_storage.Get(ConfigCollId, ToConfigKey(config_name), value));
@@ -130,6 +636,9 @@ absl::Status ScopedWrite::GetConfig(std::string_view config_name, Config& config
 
 absl::Status ScopedWrite::PutConfig(std::string_view config_name, Bytes config) {
   auto key_ = ToConfigKey(config_name);
+  if (_record_changes) {
+    _wal_batch.Put(ConfigCollId, key_, config);
+  }
   _temp_storage.Put(ConfigCollId, key_, std::move(config));
   return absl::OkStatus();
 }
@@ -138,23 +647,93 @@ absl::Status ScopedWrite::UpdateConfig(std::string_view config_name, const Messa
   Bytes* ptr = nullptr;
   auto key_ = ToConfigKey(config_name);
   RETURN_IF_ERROR(_layered_storage.EnsureInTempStorage(ConfigCollId, key_, &ptr));
+  if (_record_changes) {
+    _wal_batch.Patch(ConfigCollId, key_, update);
+  }
   gendb::ApplyPatch<Config>(update, *ptr);
   return absl::OkStatus();
 }
 
+absl::Status ScopedWrite::LogCommit(Db::LoggedChanges& logged) {
+  if (_wal_batch.empty()) {
+    return absl::OkStatus();
+  }
+  if (_db._wal != nullptr) {
+    absl::Status status = _db._wal->Append(_wal_batch);
+    if (!status.ok()) {
+      _wal_batch.Clear();
+      return status;
+    }
+    logged.wal_sequence = _db._wal->LastSequence();
+  }
+  if (_db._change_stream.active()) {
+    logged.batch = std::move(_wal_batch);
+  }
+  _wal_batch.Clear();
+  return absl::OkStatus();
+}
+
+void ScopedWrite::Commit() {
+  absl::Status status = TryCommit();
+  if (!status.ok()) {
+    throw std::runtime_error("Failed to commit: " + status.ToString());
+  }
+}
+
+void Db::PublishChanges(LoggedChanges&& changes) {
+  if (changes.batch.empty() || !_change_stream.active()) {
+    return;
+  }
+  const uint64_t sequence =
+      _wal != nullptr ? changes.wal_sequence : _change_stream.LastSequence() + 1;
+  _change_stream.Publish(sequence, std::move(changes.batch));
+}
+
+void Db::DiscardChanges(const LoggedChanges& changes) {
+  if (_wal != nullptr && changes.wal_sequence != 0) {
+    // A failure leaves the WAL failing the next commits, which report it.
+    (void)_wal->Retract(changes.wal_sequence);
+  }
+}
+
 gendb::Iterator<Account> Guard::GetAccountByAgeRange(int32_t min_age, int32_t max_age) const {
+  _layered_storage.ReleasePins();
   return gendb::MakeSecondaryIndexIterator<Account, Indices::AccountByAgeIndexType>(
       _layered_storage, AccountCollId, _db._indices.account_by_age.lower_bound(min_age),
       _db._indices.account_by_age.lower_bound(max_age));
 }
 
 gendb::Iterator<Account> Guard::GetAccountByAgeEqual(int32_t age) const {
+  _layered_storage.ReleasePins();
   return gendb::MakeSecondaryIndexIterator<Account, Indices::AccountByAgeIndexType>(
       _layered_storage, AccountCollId, _db._indices.account_by_age.lower_bound(age),
       _db._indices.account_by_age.upper_bound(age));
 }
 
+gendb::AsyncIndexIterator<Account, Indices::AccountByAgeIndexType> Guard::GetAccountByAgeRangeAsync(
+    int32_t min_age, int32_t max_age, gendb::AsyncReadQueue* queue) const {
+  _layered_storage.ReleasePins();
+  return {_layered_storage, AccountCollId,
+          gendb::SingleSetIterator<Indices::AccountByAgeIndexType>(
+              _db._indices.account_by_age.lower_bound(min_age),
+              _db._indices.account_by_age.lower_bound(max_age)),
+          queue};
+}
+
+gendb::Iterator<Account> Snapshot::GetAccountByAgeRange(int32_t min_age, int32_t max_age) const {
+  return gendb::MakeSnapshotIndexIterator<Account, Indices::AccountByAgeIndexType>(
+      _db._reader_mutex, _db._indices.account_by_age, min_age, max_age, /*include_max=*/false,
+      _snapshot, AccountCollId, AccountByAgeValue);
+}
+
+gendb::Iterator<Account> Snapshot::GetAccountByAgeEqual(int32_t age) const {
+  return gendb::MakeSnapshotIndexIterator<Account, Indices::AccountByAgeIndexType>(
+      _db._reader_mutex, _db._indices.account_by_age, age, age, /*include_max=*/true, _snapshot,
+      AccountCollId, AccountByAgeValue);
+}
+
 gendb::Iterator<Account> ScopedWrite::GetAccountByAgeRange(int32_t min_age, int32_t max_age) const {
+  WaitForPending();
   return gendb::MakeSecondaryIndexIterator<Account, Indices::AccountByAgeIndexType>(
       _layered_storage, AccountCollId, _db._indices.account_by_age.lower_bound(min_age),
       _db._indices.account_by_age.lower_bound(max_age),
@@ -163,6 +742,7 @@ gendb::Iterator<Account> ScopedWrite::GetAccountByAgeRange(int32_t min_age, int3
 }
 
 gendb::Iterator<Account> ScopedWrite::GetAccountByAgeEqual(int32_t age) const {
+  WaitForPending();
   return gendb::MakeSecondaryIndexIterator<Account, Indices::AccountByAgeIndexType>(
       _layered_storage, AccountCollId, _db._indices.account_by_age.lower_bound(age),
       _db._indices.account_by_age.upper_bound(age), _temp_indices.account_by_age.lower_bound(age),
@@ -198,6 +778,7 @@ void ScopedWrite::MaybeUpdateAccountByAgeIndex(std::array<uint8_t, sizeof(uint64
 }
 gendb::Iterator<Position> Guard::GetPositionByAccountIdRange(int32_t min_account_id,
                                                              int32_t max_account_id) const {
+  _layered_storage.ReleasePins();
   return gendb::MakeSecondaryIndexIterator<Position, Indices::PositionByAccountIdIndexType>(
       _layered_storage, PositionCollId,
       _db._indices.position_by_account_id.lower_bound(min_account_id),
@@ -205,13 +786,39 @@ gendb::Iterator<Position> Guard::GetPositionByAccountIdRange(int32_t min_account
 }
 
 gendb::Iterator<Position> Guard::GetPositionByAccountIdEqual(int32_t account_id) const {
+  _layered_storage.ReleasePins();
   return gendb::MakeSecondaryIndexIterator<Position, Indices::PositionByAccountIdIndexType>(
       _layered_storage, PositionCollId, _db._indices.position_by_account_id.lower_bound(account_id),
       _db._indices.position_by_account_id.upper_bound(account_id));
 }
 
+gendb::AsyncIndexIterator<Position, Indices::PositionByAccountIdIndexType>
+Guard::GetPositionByAccountIdRangeAsync(int32_t min_account_id, int32_t max_account_id,
+                                        gendb::AsyncReadQueue* queue) const {
+  _layered_storage.ReleasePins();
+  return {_layered_storage, PositionCollId,
+          gendb::SingleSetIterator<Indices::PositionByAccountIdIndexType>(
+              _db._indices.position_by_account_id.lower_bound(min_account_id),
+              _db._indices.position_by_account_id.lower_bound(max_account_id)),
+          queue};
+}
+
+gendb::Iterator<Position> Snapshot::GetPositionByAccountIdRange(int32_t min_account_id,
+                                                                int32_t max_account_id) const {
+  return gendb::MakeSnapshotIndexIterator<Position, Indices::PositionByAccountIdIndexType>(
+      _db._reader_mutex, _db._indices.position_by_account_id, min_account_id, max_account_id,
+      /*include_max=*/false, _snapshot, PositionCollId, PositionByAccountIdValue);
+}
+
+gendb::Iterator<Position> Snapshot::GetPositionByAccountIdEqual(int32_t account_id) const {
+  return gendb::MakeSnapshotIndexIterator<Position, Indices::PositionByAccountIdIndexType>(
+      _db._reader_mutex, _db._indices.position_by_account_id, account_id, account_id,
+      /*include_max=*/true, _snapshot, PositionCollId, PositionByAccountIdValue);
+}
+
 gendb::Iterator<Position> ScopedWrite::GetPositionByAccountIdRange(int32_t min_account_id,
                                                                    int32_t max_account_id) const {
+  WaitForPending();
   return gendb::MakeSecondaryIndexIterator<Position, Indices::PositionByAccountIdIndexType>(
       _layered_storage, PositionCollId,
       _db._indices.position_by_account_id.lower_bound(min_account_id),
@@ -221,6 +828,7 @@ gendb::Iterator<Position> ScopedWrite::GetPositionByAccountIdRange(int32_t min_a
 }
 
 gendb::Iterator<Position> ScopedWrite::GetPositionByAccountIdEqual(int32_t account_id) const {
+  WaitForPending();
   return gendb::MakeSecondaryIndexIterator<Position, Indices::PositionByAccountIdIndexType>(
       _layered_storage, PositionCollId, _db._indices.position_by_account_id.lower_bound(account_id),
       _db._indices.position_by_account_id.upper_bound(account_id),
@@ -256,47 +864,164 @@ void ScopedWrite::MaybeUpdatePositionByAccountIdIndex(std::array<uint8_t, sizeof
   }
 }
 
-absl::Status ScopedWrite::NextAccountIdSequence(uint64_t& next_id) {
+absl::Status ScopedWrite::TakeSequenceIds(SequenceMetadataId sequence, int32_t count,
+                                          int32_t& last_id) {
   MetadataValue value;
-  MetadataValueKey key{.type = MetadataType::kSequence,
-                       .id = static_cast<uint32_t>(SequenceMetadataId::AccountIdSequence)};
+  MetadataValueKey key{.type = MetadataType::kSequence, .id = static_cast<uint32_t>(sequence)};
   auto status = GetMetadataValue(key, value);
   if (status.code() == absl::StatusCode::kNotFound) {
-    RETURN_IF_ERROR(PutMetadataValue(key, MetadataValueBuilder().set_int_value(1).Build()));
-    next_id = 1;
+    RETURN_IF_ERROR(PutMetadataValue(key, MetadataValueBuilder().set_int_value(count).Build()));
+    last_id = count;
   } else if (!status.ok()) {
     return status;
   } else {
-    int new_next_id = value.int_value() + 1;
+    if (value.int_value() > INT32_MAX - count) {
+      return absl::OutOfRangeError("Sequence " + std::to_string(key.id) + " is out of ids");
+    }
+    int new_last_id = value.int_value() + count;
     RETURN_IF_ERROR(
-        UpdateMetadataValue(key, MetadataValuePatchBuilder().set_int_value(new_next_id).Build()));
-    next_id = new_next_id;
+        UpdateMetadataValue(key, MetadataValuePatchBuilder().set_int_value(new_last_id).Build()));
+    last_id = new_last_id;
+  }
+  return absl::OkStatus();
+}
+
+absl::Status Db::NextBlockSequenceId(SequenceMetadataId sequence, int32_t& next_id) {
+  // Checked on every call, not only when a block runs out, so that the misuse does not depend on
+  // how many ids are left.
+  if (_writer_mutex.HeldByThisThread()) {
+    return absl::FailedPreconditionError(
+        "Db::Next... called on a thread holding a writer, which reserving ids would wait for");
   }
+  SequenceBlock& block = _sequence_blocks[static_cast<uint32_t>(sequence)];
+  while (true) {
+    // A new block is stored before its end, so an id read below `end` belongs to this block.
+    const int64_t end = block.end.load(std::memory_order_acquire);
+    int64_t id = block.next.load(std::memory_order_relaxed);
+    while (id < end) {
+      if (block.next.compare_exchange_weak(id, id + 1, std::memory_order_relaxed)) {
+        next_id = static_cast<int32_t>(id);
+        return absl::OkStatus();
+      }
+    }
+    std::lock_guard lock(block.mutex);
+    if (block.next.load(std::memory_order_relaxed) < block.end.load(std::memory_order_relaxed)) {
+      // Another thread reserved a block meanwhile.
+      continue;
+    }
+    int32_t first_id = 0;
+    RETURN_IF_ERROR(ReserveSequenceIds(sequence, first_id));
+    block.next.store(first_id, std::memory_order_relaxed);
+    block.end.store(int64_t{first_id} + kSequenceBlockSize, std::memory_order_release);
+  }
+}
+
+absl::Status Db::ReserveSequenceIds(SequenceMetadataId sequence, int32_t& first_id) {
+  int32_t last_id = 0;
+  auto writer = CreateWriter();
+  RETURN_IF_ERROR(writer.TakeSequenceIds(sequence, kSequenceBlockSize, last_id));
+  RETURN_IF_ERROR(writer.TryCommit());
+  first_id = last_id - kSequenceBlockSize + 1;
+  return absl::OkStatus();
+}
+
+absl::Status ScopedWrite::NextAccountIdSequence(uint64_t& next_id) {
+  int32_t last_id = 0;
+  RETURN_IF_ERROR(TakeSequenceIds(SequenceMetadataId::AccountIdSequence, 1, last_id));
+  next_id = last_id;
+  return absl::OkStatus();
+}
+
+absl::Status Db::NextAccountIdSequence(uint64_t& next_id) {
+  int32_t id = 0;
+  RETURN_IF_ERROR(NextBlockSequenceId(SequenceMetadataId::AccountIdSequence, id));
+  next_id = id;
   return absl::OkStatus();
 }
+
 absl::Status ScopedWrite::NextPositionIdSequence(int32_t& next_id) {
-  MetadataValue value;
-  MetadataValueKey key{.type = MetadataType::kSequence,
-                       .id = static_cast<uint32_t>(SequenceMetadataId::PositionIdSequence)};
-  auto status = GetMetadataValue(key, value);
-  if (status.code() == absl::StatusCode::kNotFound) {
-    RETURN_IF_ERROR(PutMetadataValue(key, MetadataValueBuilder().set_int_value(1).Build()));
-    next_id = 1;
-  } else if (!status.ok()) {
+  int32_t last_id = 0;
+  RETURN_IF_ERROR(TakeSequenceIds(SequenceMetadataId::PositionIdSequence, 1, last_id));
+  next_id = last_id;
+  return absl::OkStatus();
+}
+
+absl::Status Db::NextPositionIdSequence(int32_t& next_id) {
+  int32_t id = 0;
+  RETURN_IF_ERROR(NextBlockSequenceId(SequenceMetadataId::PositionIdSequence, id));
+  next_id = id;
+  return absl::OkStatus();
+}
+
+absl::Status ScopedWrite::TryCommit() {
+  absl::Status status;
+  if (!_pending.empty()) {
+    // Applied after the commits handed off before it, which the writer then reads from the Db.
+    _db._apply_queue.WaitIdle();
+    if (_db.DroppedCommitsSince(_dropped_commits)) {
+      status = absl::AbortedError("A commit this writer read failed to apply");
+      _wal_batch.Clear();
+    }
+    _layered_storage = gendb::LayeredStorage(_db._versioned_storage, &_temp_storage);
+    _snapshot.reset();
+    _pending.clear();
+  }
+  Db::LoggedChanges logged;
+  if (status.ok()) {
+    status = LogCommit(logged);
+  }
+  if (!status.ok()) {
+    // Nothing was logged: the writer goes on without the changes.
+    _temp_storage.Clear();
+    _temp_indices = {};
     return status;
-  } else {
-    int new_next_id = value.int_value() + 1;
-    RETURN_IF_ERROR(
-        UpdateMetadataValue(key, MetadataValuePatchBuilder().set_int_value(new_next_id).Build()));
-    next_id = new_next_id;
   }
+  std::unique_lock lock(_db._reader_mutex);
+  try {
+    _layered_storage.MergeTempStorage(_db._changed_keys.get());
+    _db._indices.MergeTempIndices(std::move(_temp_indices), _db._versioned_storage.LastSequence(),
+                                  _db._versioned_storage.OldestSnapshot());
+  } catch (...) {
+    lock.unlock();
+    _db.DiscardChanges(logged);
+    throw;
+  }
+  lock.unlock();
+  _db.PublishChanges(std::move(logged));
   return absl::OkStatus();
 }
 
-void ScopedWrite::Commit() {
-  std::unique_lock lock(_db._reader_mutex);
-  _layered_storage.MergeTempStorage();
-  _db._indices.MergeTempIndices(std::move(_temp_indices));
+std::future<void> ScopedWrite::CommitAsync() {
+  // Logged in commit order, before the writer lock is released, and published by the apply
+  // thread once applied.
+  Db::LoggedChanges logged;
+  absl::Status status = LogCommit(logged);
+  if (!status.ok()) {
+    throw std::runtime_error("Failed to log the commit: " + status.ToString());
+  }
+  auto storage = std::make_shared<const gendb::MemoryStorage>(std::move(_temp_storage));
+  bool dropped = false;
+  {
+    // Checked as the commit joins the pending ones, so that it is dropped if one it read fails to
+    // apply later on.
+    std::lock_guard lock(_db._pending_mutex);
+    dropped = !_pending.empty() && _db._dropped_commits != _dropped_commits;
+    if (!dropped) {
+      _db._pending_storages.push_back(storage);
+    }
+  }
+  if (dropped) {
+    _db.DiscardChanges(logged);
+    _lock.unlock();
+    std::promise<void> failed;
+    failed.set_exception(std::make_exception_ptr(
+        std::runtime_error("Dropped a commit made over one that failed to apply")));
+    return failed.get_future();
+  }
+  std::future<void> applied = _db._apply_queue.Submit(
+      {std::move(storage), std::move(_temp_indices), std::move(logged)});
+  _lock.unlock();
+  return applied;
 }
 
 }  // namespace gendb::tests
\ No newline at end of file
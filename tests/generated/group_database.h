@@ -0,0 +1,367 @@
+// AUTO GENERATED. DO NOT EDIT.
+//
+#pragma once
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string>
+
+#include "absl/status/status.h"
+#include "account.fbs.h"
+#include "gendb/arena_storage.h"
+#include "gendb/async_read.h"
+#include "gendb/bytes.h"
+#include "gendb/change_stream.h"
+#include "gendb/changed_keys.h"
+#include "gendb/checkpoint_chain.h"
+#include "gendb/checkpoint_storage.h"
+#include "gendb/group_commit.h"
+#include "gendb/index.h"
+#include "gendb/iterator.h"
+#include "gendb/key_codec.h"
+#include "gendb/layered_storage.h"
+#include "gendb/message_patch.h"
+#include "gendb/reader_biased_mutex.h"
+#include "gendb/versioned_storage.h"
+#include "gendb/wal.h"
+#include "metadata.fbs.h"
+
+namespace gendb::tests::group {
+
+// Forward declarations.
+class Guard;
+class Snapshot;
+class ScopedWrite;
+
+enum class SequenceMetadataId : uint32_t {
+  AccountIdSequence = 0,
+};
+
+enum CollectionId {
+  MetadataValueCollId = 0,
+  AccountCollId = 1,
+};
+
+// Collection keys getters.
+struct MetadataValueKey {
+  gendb::MetadataType type;
+  uint32_t id;
+};
+
+inline std::array<uint8_t, 8> ToMetadataValueKey(const MetadataValueKey& key) {
+  std::array<uint8_t, 8> key_raw;
+  internal::key_codec::EncodeTupleToView<std::tuple<gendb::MetadataType, uint32_t>>(
+      {key.type, key.id}, key_raw);
+  return key_raw;
+}
+
+inline std::array<uint8_t, 8> ToMetadataValueKey(MetadataValue metadata_value) {
+  std::array<uint8_t, 8> key_raw;
+  internal::key_codec::EncodeTupleToView<std::tuple<gendb::MetadataType, uint32_t>>(
+      {metadata_value.type(), metadata_value.id()}, key_raw);
+  return key_raw;
+}
+inline std::array<uint8_t, 8> ToAccountKey(uint64_t account_id) {
+  std::array<uint8_t, 8> key_raw;
+  internal::key_codec::EncodeTupleToView<std::tuple<uint64_t>>({account_id}, key_raw);
+  return key_raw;
+}
+
+inline std::array<uint8_t, 8> ToAccountKey(Account account) {
+  return ToAccountKey(account.account_id());
+}
+
+struct Indices {
+  using AccountByAgeIndexType =
+      gendb::Index</*age*/ int32_t, std::array<uint8_t, sizeof(uint64_t)>>;
+  AccountByAgeIndexType account_by_age;
+
+  void MergeTempIndices(Indices&& temp_indices, uint64_t sequence, uint64_t oldest_snapshot) {
+    account_by_age.MergeTempIndex(std::move(temp_indices.account_by_age), sequence,
+                                  oldest_snapshot);
+  }
+};
+
+class Db {
+ public:
+  // RocksDB column family tuning per CollectionId, from the `storage:` blocks of the schema. Pass
+  // it to gendb::RocksDBStorage when persisting the collections.
+  static constexpr std::array<gendb::CollectionTuning, 2> kCollectionTuning = {
+      gendb::CollectionTuning{.prefix_length = 4},
+      gendb::CollectionTuning{},
+  };
+
+  Db() = default;
+  // Recovers the commits logged in `wal_options.dir`, then logs each commit there before applying
+  // it. Throws std::runtime_error if the log cannot be replayed.
+  explicit Db(const gendb::WalOptions& wal_options);
+  // Serves the collections of the checkpoint at `checkpoint_path` (see WriteCheckpoint) from a
+  // read-only mapping, so values are paged in as they are first read; the indices are loaded from
+  // it. Throws std::runtime_error if the file is invalid or was written for another schema.
+  explicit Db(const std::string& checkpoint_path);
+  // Opens the checkpoint, then recovers the commits logged after it.
+  Db(const std::string& checkpoint_path, const gendb::WalOptions& wal_options);
+  // Opens a chain of checkpoints (see gendb::CheckpointChain::Paths): the base as above, then the
+  // changes of the deltas after it, replayed in parallel.
+  explicit Db(std::span<const std::string> checkpoint_paths);
+  Db(std::span<const std::string> checkpoint_paths, const gendb::WalOptions& wal_options);
+
+  Guard SharedLock() const;
+  // Consistent view as of the last commit, without holding the reader lock (see Snapshot).
+  class Snapshot Snapshot() const;
+  // Writers do not wait for each other. Each one reads a snapshot of the last commit before its
+  // creation, or its last Commit(), plus its own changes, so it holds back no commit. Commits are
+  // applied atomically in the order Commit() is called, so when concurrent writers change the
+  // same message the last commit wins.
+  ScopedWrite CreateWriter();
+
+  // Change data capture: each commit, as a batch numbered like its WAL record if the Db has a WAL,
+  // and in commit order otherwise. Commits are published once something subscribed, except those
+  // of writers created before that.
+  gendb::ChangeStream& Changes() { return _change_stream; }
+
+  // Ids the Db reserves at a time for the Next... methods below.
+  static constexpr int32_t kSequenceBlockSize = 1000;
+  // Take the next id of a sequence without a writer, from an in-memory block of
+  // kSequenceBlockSize ids reserved with a single commit. Unlike ScopedWrite's, an id taken is
+  // never handed out again, even if nothing commits it, and the rest of the block is skipped once
+  // the Db is closed. Thread-safe; OutOfRangeError once a block would pass INT32_MAX.
+  absl::Status NextAccountIdSequence(uint64_t& next_id);
+
+  // Writes every collection, sequence and index to a checkpoint at `path`, which replaces the
+  // file atomically, then removes the WAL segments it holds. It is written from a snapshot, so
+  // commits only wait while it is taken.
+  absl::Status WriteCheckpoint(const std::string& path);
+  // Adds the next checkpoint to `chain`: a delta of the keys changed since the previous one if the
+  // Db was opened from or last wrote the chain's last generation, a base otherwise. A delta costs
+  // as much as the keys changed, whatever the size of the database.
+  absl::Status WriteCheckpoint(gendb::CheckpointChain& chain);
+
+  // Writes the database of the checkpoint chain at `paths` to a base at `path`, without a WAL:
+  // the gendb::CheckpointChain::MergeFn of Dbs of this schema.
+  static absl::Status MergeCheckpoints(std::span<const std::string> paths, const std::string& path);
+
+ private:
+  friend class Guard;
+  friend class Snapshot;
+  friend class ScopedWrite;
+
+  // Replays the WAL over the state the Db holds, skipping the records up to `checkpoint_sequence`
+  // that its checkpoint already holds.
+  void OpenWal(const gendb::WalOptions& wal_options, uint64_t checkpoint_sequence);
+  // Whether writers record their changes, for the WAL or the change stream.
+  bool RecordsChanges() const { return _wal != nullptr || _change_stream.active(); }
+
+  // A commit's changes, logged and held back from the change stream until they are applied.
+  struct LoggedChanges {
+    // The WAL record holding them, or 0 without a WAL.
+    uint64_t wal_sequence = 0;
+    gendb::WalBatch batch;
+  };
+  // Publishes logged changes to the change stream, once readers of the Db see them.
+  void PublishChanges(LoggedChanges&& changes);
+  // Erases the WAL record of logged changes that failed to apply, so that opening the Db does not
+  // replay them. If it cannot, the WAL fails every later commit.
+  void DiscardChanges(const LoggedChanges& changes);
+  absl::Status NextBlockSequenceId(SequenceMetadataId sequence, int32_t& next_id);
+  // Commits the reservation of the next kSequenceBlockSize ids, the first of which is `first_id`.
+  absl::Status ReserveSequenceIds(SequenceMetadataId sequence, int32_t& first_id);
+  // Returns the sequence number of the last WAL record the checkpoints hold.
+  uint64_t OpenCheckpoints(std::span<const std::string> paths);
+  // Runs `fn` with commits held back.
+  absl::Status WithCommitsHeld(const std::function<absl::Status()>& fn);
+  // Writes a snapshot of the Db, with commits only held back while it is taken. A delta holds the
+  // keys in `_changed_keys` as of the snapshot. Under `_checkpoint_mutex`, but for a private Db.
+  absl::Status WriteCheckpointFile(const std::string& path, uint64_t generation, bool delta);
+
+  // Applies a batch of queued commits; runs on the thread leading the batch.
+  void ApplyCommits(std::span<ScopedWrite* const> writers);
+
+  gendb::GroupCommit<ScopedWrite> _group_commit;
+  // Writers take ids concurrently, so the Db hands them out: `_last_ids[id]` is the last id taken
+  // from the sequence with that SequenceMetadataId, or 0 until the sequence is first used.
+  std::mutex _sequence_mutex;
+  std::array<int32_t, 1> _last_ids{};
+
+  // Many readers and rare writers: reads stay on per-thread cache lines (see ReaderBiasedMutex).
+  mutable gendb::ReaderBiasedMutex _reader_mutex;
+  // Commits are applied to an arena over the checkpoint the Db was opened from, if any. They hold
+  // `_reader_mutex` exclusively, so the memory they unlink is freed at once: no Guard reads it.
+  gendb::CheckpointStorage _storage;
+  // Commits write through it; it keeps the versions that open snapshots still read.
+  gendb::VersionedStorage _versioned_storage{_storage};
+  Indices _indices;
+  // Serializes the checkpoint writes, and guards the two members below.
+  std::mutex _checkpoint_mutex;
+  // Generation of the checkpoint the Db was last opened from or wrote, 0 outside of a chain, and
+  // the last WAL record it holds, which a Db without a WAL carries over to its next checkpoint.
+  uint64_t _checkpoint_generation = 0;
+  uint64_t _checkpoint_wal_sequence = 0;
+  // Keys changed since that checkpoint, for the next delta. Commits only track them once there is
+  // a checkpoint to follow.
+  std::unique_ptr<gendb::ChangedKeys> _changed_keys;
+  // Set when the Db was opened with a WAL.
+  std::unique_ptr<gendb::Wal> _wal;
+  gendb::ChangeStream _change_stream;
+  // The ids of a sequence's block are handed out by moving `next` up to `end`. A new block is
+  // reserved under `mutex` once it runs out.
+  struct SequenceBlock {
+    std::atomic<int64_t> next = 0;
+    std::atomic<int64_t> end = 0;
+    std::mutex mutex;
+  };
+  std::array<SequenceBlock, 1> _sequence_blocks;
+};
+
+class Guard {
+ public:
+  absl::Status GetMetadataValue(const MetadataValueKey& key, MetadataValue& metadata_value) const;
+  absl::Status GetAccount(uint64_t account_id, Account& account) const;
+  // Batched point reads: `statuses[i]` and, when OK, the i-th message receive the result for the
+  // i-th key.
+  void GetMetadataValues(std::span<const MetadataValueKey> keys,
+                         std::span<MetadataValue> metadata_values,
+                         std::span<absl::Status> statuses) const;
+  void GetAccounts(std::span<const uint64_t> account_ids, std::span<Account> accounts,
+                   std::span<absl::Status> statuses) const;
+  // Primary key range scans over [from, to), in key order.
+  gendb::Iterator<MetadataValue> ScanMetadataValues(const MetadataValueKey& from,
+                                                    const MetadataValueKey& to) const;
+  gendb::Iterator<Account> ScanAccounts(uint64_t from_account_id, uint64_t to_account_id) const;
+  gendb::Iterator<Account> GetAccountByAgeRange(int32_t min_age, int32_t max_age) const;
+  gendb::Iterator<Account> GetAccountByAgeEqual(int32_t age) const;
+  // Reads to `co_await` from a coroutine (see gendb/async_read.h). In memory they complete without
+  // suspending; reads of a storage that blocks wait for `queue` to be flushed, if one is given.
+  // The guard must outlive the returned awaitables and iterators.
+  gendb::GetMessageAwaitable<MetadataValue, std::array<uint8_t, 8>> GetMetadataValueAsync(
+      const MetadataValueKey& key, MetadataValue& metadata_value,
+      gendb::AsyncReadQueue* queue = nullptr) const;
+  gendb::GetMessageAwaitable<Account, std::array<uint8_t, 8>> GetAccountAsync(
+      uint64_t account_id, Account& account, gendb::AsyncReadQueue* queue = nullptr) const;
+  gendb::AsyncIndexIterator<Account, Indices::AccountByAgeIndexType> GetAccountByAgeRangeAsync(
+      int32_t min_age, int32_t max_age, gendb::AsyncReadQueue* queue = nullptr) const;
+  // Messages read from a storage that pins its read buffers stay valid until the guard is
+  // destroyed or until this releases the buffers, for guards kept across many reads. Scans, whose
+  // iterators pin the buffers they read themselves, release them too: a guard only holds those of
+  // the reads since its last scan.
+  void ReleasePins() const { _layered_storage.ReleasePins(); }
+  ~Guard() = default;
+
+ private:
+  friend class Db;
+  Guard(const Db& db, gendb::ReaderBiasedMutex::ReadLock lock)
+      : _db(db),
+        _lock(std::move(lock)),
+        _layered_storage(const_cast<gendb::CheckpointStorage&>(_db._storage),
+                         /*temp_storage_ptr=*/nullptr) {}
+
+ private:
+  const Db& _db;
+  gendb::ReaderBiasedMutex::ReadLock _lock;
+  const gendb::LayeredStorage _layered_storage;
+};
+
+// Consistent read-only view of the Db as of the last commit before it was taken. Unlike Guard it
+// holds no lock: commits proceed while it is alive, and the versions they overwrite are kept until
+// it is destroyed. Each read only excludes the commits writing its collection while it runs: one
+// lookup, or one batch of a scan, at a time. Returned messages stay valid for the lifetime of the
+// snapshot, or until ReleaseReadCopies().
+class Snapshot {
+ public:
+  absl::Status GetMetadataValue(const MetadataValueKey& key, MetadataValue& metadata_value) const;
+  absl::Status GetAccount(uint64_t account_id, Account& account) const;
+  // Batched point reads: `statuses[i]` and, when OK, the i-th message receive the result for the
+  // i-th key.
+  void GetMetadataValues(std::span<const MetadataValueKey> keys,
+                         std::span<MetadataValue> metadata_values,
+                         std::span<absl::Status> statuses) const;
+  void GetAccounts(std::span<const uint64_t> account_ids, std::span<Account> accounts,
+                   std::span<absl::Status> statuses) const;
+  // Primary key range scans over [from, to), in key order.
+  gendb::Iterator<MetadataValue> ScanMetadataValues(const MetadataValueKey& from,
+                                                    const MetadataValueKey& to) const;
+  gendb::Iterator<Account> ScanAccounts(uint64_t from_account_id, uint64_t to_account_id) const;
+  gendb::Iterator<Account> GetAccountByAgeRange(int32_t min_age, int32_t max_age) const;
+  gendb::Iterator<Account> GetAccountByAgeEqual(int32_t age) const;
+
+  // Sequence number of the last commit visible to this snapshot.
+  uint64_t sequence() const { return _snapshot.sequence(); }
+
+  // Frees the copies of the latest messages the lookups so far made, which a snapshot kept across
+  // many of them would otherwise accumulate. Messages they returned are invalid afterwards.
+  void ReleaseReadCopies() const { _snapshot.ReleaseReadCopies(); }
+
+ private:
+  friend class Db;
+  Snapshot(const Db& db, gendb::StorageSnapshot snapshot)
+      : _db(db), _snapshot(std::move(snapshot)) {}
+
+ private:
+  const Db& _db;
+  gendb::StorageSnapshot _snapshot;
+};
+
+class ScopedWrite {
+ private:
+  absl::Status GetMetadataValue(const MetadataValueKey& key, MetadataValue& metadata_value) const;
+  absl::Status PutMetadataValue(const MetadataValueKey& key, std::vector<uint8_t> metadata_value);
+  absl::Status UpdateMetadataValue(const MetadataValueKey& key, const MessagePatch& update);
+
+ public:
+  absl::Status GetAccount(uint64_t account_id, Account& account) const;
+  absl::Status PutAccount(uint64_t account_id, std::vector<uint8_t> account);
+  absl::Status UpdateAccount(uint64_t account_id, const MessagePatch& update);
+
+ public:
+  gendb::Iterator<Account> GetAccountByAgeRange(int32_t min_age, int32_t max_age) const;
+  gendb::Iterator<Account> GetAccountByAgeEqual(int32_t age) const;
+
+  absl::Status NextAccountIdSequence(uint64_t& next_id);
+  // Throws std::runtime_error if the changes cannot be logged: see TryCommit().
+  void Commit();
+  // Same as Commit(), but returns the error of the WAL if the batch holding the changes cannot be
+  // logged. None of the batch is applied then.
+  absl::Status TryCommit();
+  ~ScopedWrite() = default;
+
+ private:
+  friend class Db;
+  ScopedWrite(Db& db)
+      : _db(db),
+        _snapshot(_db._versioned_storage.GetSnapshot()),
+        _layered_storage(*_snapshot, &_temp_storage) {}
+
+  // Drops the pending changes, which the Db applied, and moves to a snapshot of the last commit.
+  void Reset();
+
+  // Takes `count` consecutive ids of the sequence, the last of which is `last_id`.
+  absl::Status TakeSequenceIds(SequenceMetadataId sequence, int32_t count, int32_t& last_id);
+
+  // Logs the changes made since the last call, if the Db has a WAL, and returns them in `logged`
+  // for Db::PublishChanges() once they are applied. Logs nothing on error.
+  absl::Status LogCommit(Db::LoggedChanges& logged);
+
+  // Index update helpers
+  void MaybeUpdateAccountByAgeIndex(std::array<uint8_t, sizeof(uint64_t)> key,
+                                    gendb::BytesConstView account_buffer,
+                                    const MessagePatch* update);
+
+ private:
+  Db& _db;
+  // What this writer reads, under its own changes, until its next Commit().
+  std::optional<gendb::StorageSnapshot> _snapshot;
+  // Set by the leader of the batch holding the changes if it could not log it.
+  absl::Status _commit_status;
+  gendb::MemoryStorage _temp_storage;
+  Indices _temp_indices;
+  gendb::LayeredStorage _layered_storage;
+  // The changes for LogCommit(), always recorded: the leader of the batch replays them over the
+  // values committed since this writer read its own.
+  bool _record_changes = true;
+  gendb::WalBatch _wal_batch;
+};
+
+}  // namespace gendb::tests::group
@@ -0,0 +1,662 @@
+// AUTO GENERATED. DO NOT EDIT.
+//
+#include "optimistic_database.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "account.fbs.h"
+#include "gendb/bytes.h"
+#include "gendb/index.h"
+#include "gendb/iterator.h"
+#include "gendb/message_patch.h"
+#include "gendb/status.h"
+#include "gendb/wal_replay.h"
+#include "metadata.fbs.h"
+
+namespace gendb::tests::optimistic {
+
+namespace {
+
+// Indexed values as the indices store them.
+std::optional<int32_t> AccountByAgeValue(const Account& account) {
+  if (!account.has_age()) {
+    return std::nullopt;
+  }
+  return account.age();
+}
+
+}  // namespace
+
+Db::Db(const gendb::WalOptions& wal_options) { OpenWal(wal_options, /*checkpoint_sequence=*/0); }
+
+Db::Db(const std::string& checkpoint_path) : Db(std::span(&checkpoint_path, 1)) {}
+
+Db::Db(const std::string& checkpoint_path, const gendb::WalOptions& wal_options)
+    : Db(std::span(&checkpoint_path, 1), wal_options) {}
+
+Db::Db(std::span<const std::string> checkpoint_paths) { OpenCheckpoints(checkpoint_paths); }
+
+Db::Db(std::span<const std::string> checkpoint_paths, const gendb::WalOptions& wal_options) {
+  OpenWal(wal_options, OpenCheckpoints(checkpoint_paths));
+}
+
+void Db::OpenWal(const gendb::WalOptions& wal_options, uint64_t checkpoint_sequence) {
+  // The log is replayed before `_wal` is set, so the replayed commits are not logged again.
+  gendb::ParallelWalReplay replay(_storage, wal_options.replay_threads);
+  auto wal = std::make_unique<gendb::Wal>(
+      wal_options, [&](uint64_t sequence, gendb::BytesConstView record) {
+        if (sequence <= checkpoint_sequence) {
+          return absl::OkStatus();
+        }
+        // Segments are only removed once a checkpoint holds their records.
+        if (replay.records() == 0 && sequence != checkpoint_sequence + 1) {
+          return absl::DataLossError("WAL record " + std::to_string(checkpoint_sequence + 1) +
+                                     " is missing");
+        }
+        return replay.Add(record);
+      });
+  if (absl::Status status = replay.Finish(); !status.ok()) {
+    throw std::runtime_error("Failed to replay the WAL: " + status.ToString());
+  }
+  // Before WriteTo moves the replayed values out.
+  gendb::RebuildIndex(
+      replay, AccountCollId,
+      [](gendb::BytesConstView value) { return AccountByAgeValue(Account{value}); },
+      _indices.account_by_age);
+  if (absl::Status status = replay.WriteTo(_versioned_storage, _changed_keys.get()); !status.ok()) {
+    throw std::runtime_error("Failed to write the replayed WAL: " + status.ToString());
+  }
+  // The log may not reach the checkpoint: the sequence continues from the checkpoint's.
+  if (checkpoint_sequence > 0) {
+    if (absl::Status status = wal->RemoveThrough(checkpoint_sequence); !status.ok()) {
+      throw std::runtime_error("Failed to remove the checkpointed WAL: " + status.ToString());
+    }
+  }
+  _wal = std::move(wal);
+}
+
+uint64_t Db::OpenCheckpoints(std::span<const std::string> paths) {
+  std::vector<std::unique_ptr<const gendb::Checkpoint>> checkpoints =
+      gendb::OpenCheckpointChain(paths);
+  if (checkpoints.empty()) {
+    throw std::runtime_error("No checkpoint to open");
+  }
+  for (size_t i = 0; i < checkpoints.size(); ++i) {
+    // Deltas have no indices: they are rebuilt from the values.
+    if (checkpoints[i]->collection_count() != 2 ||
+        checkpoints[i]->index_count() != (i == 0 ? 1 : 0)) {
+      throw std::runtime_error("Checkpoint " + paths[i] + " was written for another schema");
+    }
+  }
+  if (absl::Status status = checkpoints.front()->LoadIndex(0, _indices.account_by_age);
+      !status.ok()) {
+    throw std::runtime_error("Failed to load index account_by_age: " + status.ToString());
+  }
+  _checkpoint_generation = checkpoints.back()->generation();
+  _checkpoint_wal_sequence = checkpoints.back()->wal_sequence();
+  if (_checkpoint_generation > 0) {
+    _changed_keys = std::make_unique<gendb::ChangedKeys>();
+  }
+  _storage.SetCheckpoint(std::move(checkpoints.front()));
+  if (checkpoints.size() == 1) {
+    return _checkpoint_wal_sequence;
+  }
+  // The deltas replay over the base like a WAL, with the indices rebuilt once. Their changes are
+  // already in the chain, so they are not tracked for the next delta.
+  gendb::ParallelWalReplay replay(_storage, /*threads=*/0);
+  for (size_t i = 1; i < checkpoints.size(); ++i) {
+    if (absl::Status status = replay.AddDelta(*checkpoints[i]); !status.ok()) {
+      throw std::runtime_error(
+          "Failed to replay checkpoint " + paths[i] + ": " + status.ToString());
+    }
+  }
+  if (absl::Status status = replay.Finish(); !status.ok()) {
+    throw std::runtime_error("Failed to replay the checkpoint deltas: " + status.ToString());
+  }
+  // Before WriteTo moves the replayed values out.
+  gendb::RebuildIndex(
+      replay, AccountCollId,
+      [](gendb::BytesConstView value) { return AccountByAgeValue(Account{value}); },
+      _indices.account_by_age);
+  if (absl::Status status = replay.WriteTo(_versioned_storage); !status.ok()) {
+    throw std::runtime_error(
+        "Failed to write the replayed checkpoint deltas: " + status.ToString());
+  }
+  return _checkpoint_wal_sequence;
+}
+
+absl::Status Db::WriteCheckpoint(const std::string& path) {
+  std::lock_guard lock(_checkpoint_mutex);
+  // Outside of any chain, so no delta follows it.
+  return WriteCheckpointFile(path, /*generation=*/0, /*delta=*/false);
+}
+
+absl::Status Db::WriteCheckpoint(gendb::CheckpointChain& chain) {
+  std::lock_guard lock(_checkpoint_mutex);
+  const uint64_t last_generation = chain.LastGeneration();
+  // `_changed_keys` holds the changes since the Db's last checkpoint, which must be the chain's.
+  const bool delta = _changed_keys != nullptr && last_generation > 0 &&
+                     last_generation == _checkpoint_generation;
+  const uint64_t generation = last_generation + 1;
+  RETURN_IF_ERROR(WriteCheckpointFile(chain.Path(generation, delta), generation, delta));
+  return chain.Add(generation, delta);
+}
+
+absl::Status Db::MergeCheckpoints(std::span<const std::string> paths, const std::string& path) {
+  try {
+    // A merge reads the whole chain anyway, so it checks the base's checksums rather than carry
+    // a corrupt record into a new base under a fresh checksum. The deltas are checked as they
+    // replay.
+    if (!paths.empty()) {
+      RETURN_IF_ERROR(gendb::Checkpoint(paths.front()).Verify());
+    }
+    Db db(paths);
+    return db.WriteCheckpointFile(path, db._checkpoint_generation, /*delta=*/false);
+  } catch (const std::runtime_error& error) {
+    return absl::DataLossError(error.what());
+  }
+}
+
+absl::Status Db::WithCommitsHeld(const std::function<absl::Status()>& fn) {
+  std::lock_guard lock(_commit_mutex);
+  return fn();
+}
+
+absl::Status Db::WriteCheckpointFile(const std::string& path, uint64_t generation, bool delta) {
+  // Commits are only held back while the state to write is captured: a snapshot, the last WAL
+  // record it holds and the keys changed since the last checkpoint, which commits from then on
+  // leave for a new set.
+  std::optional<gendb::StorageSnapshot> snapshot;
+  uint64_t wal_sequence = 0;
+  std::unique_ptr<gendb::ChangedKeys> changed_keys;
+  RETURN_IF_ERROR(WithCommitsHeld([&] {
+    snapshot.emplace(_versioned_storage.GetSnapshot());
+    wal_sequence = _wal != nullptr ? _wal->LastSequence() : _checkpoint_wal_sequence;
+    if (_changed_keys != nullptr || generation > 0) {
+      changed_keys = std::exchange(_changed_keys, std::make_unique<gendb::ChangedKeys>());
+    }
+    return absl::OkStatus();
+  }));
+
+  absl::Status status = [&] {
+    gendb::CheckpointWriter writer(path, generation, delta);
+    for (size_t collection_id = 0; collection_id < 2; ++collection_id) {
+      if (delta) {
+        RETURN_IF_ERROR(writer.AddChangedKeys(*snapshot, collection_id,
+                                              changed_keys->collection(collection_id)));
+      } else {
+        RETURN_IF_ERROR(writer.AddCollection(*snapshot->NewCursor(collection_id)));
+      }
+    }
+    if (!delta) {
+      // From the snapshot: the Db's indices may have moved on since.
+      {
+        Indices::AccountByAgeIndexType index;
+        auto cursor = snapshot->NewCursor(AccountCollId);
+        for (cursor->Seek({}); cursor->Valid(); cursor->Next()) {
+          if (auto value = AccountByAgeValue(Account{cursor->Value()})) {
+            std::array<uint8_t, sizeof(uint64_t)> prim_key;
+            std::copy_n(cursor->Key().begin(), prim_key.size(), prim_key.begin());
+            index.Insert(*value, prim_key);
+          }
+        }
+        RETURN_IF_ERROR(writer.AddIndex(index));
+      }
+    }
+    return writer.Finish(wal_sequence);
+  }();
+  if (!status.ok()) {
+    // The keys the checkpoint did not get to hold are still for the next delta.
+    RETURN_IF_ERROR(WithCommitsHeld([&] {
+      if (changed_keys != nullptr) {
+        changed_keys->Add(*_changed_keys);
+      }
+      _changed_keys = std::move(changed_keys);
+      return absl::OkStatus();
+    }));
+    return status;
+  }
+  _checkpoint_generation = generation;
+  _checkpoint_wal_sequence = wal_sequence;
+  // Only a checkpoint of a chain is followed by deltas.
+  if (generation == 0 && changed_keys != nullptr) {
+    RETURN_IF_ERROR(WithCommitsHeld([&] {
+      _changed_keys.reset();
+      return absl::OkStatus();
+    }));
+  }
+  return _wal != nullptr ? _wal->RemoveThrough(wal_sequence) : absl::OkStatus();
+}
+
+Guard Db::SharedLock() const {
+  return {*this, _reader_mutex.LockShared()};
+}
+
+Snapshot Db::Snapshot() const {
+  return {*this, _versioned_storage.GetSnapshot()};
+}
+
+ScopedWrite Db::CreateWriter() {
+  return {*this};
+}
+
+absl::Status Guard::GetMetadataValue(const MetadataValueKey& key,
+                                     MetadataValue& metadata_value) const {
+  BytesConstView value;
+  RETURN_IF_ERROR(_layered_storage.Get(MetadataValueCollId, ToMetadataValueKey(key), value));
+  metadata_value = MetadataValue{value};
+  return absl::OkStatus();
+}
+
+void Guard::GetMetadataValues(std::span<const MetadataValueKey> keys,
+                              std::span<MetadataValue> metadata_values,
+                              std::span<absl::Status> statuses) const {
+  gendb::MultiGetMessages<MetadataValue>(
+      _layered_storage, MetadataValueCollId, keys,
+      [](const MetadataValueKey& key) { return ToMetadataValueKey(key); }, metadata_values,
+      statuses);
+}
+
+gendb::Iterator<MetadataValue> Guard::ScanMetadataValues(const MetadataValueKey& from,
+                                                         const MetadataValueKey& to) const {
+  _layered_storage.ReleasePins();
+  const auto begin_key = ToMetadataValueKey(from);
+  const auto end_key = ToMetadataValueKey(to);
+  return gendb::MakePrimaryKeyIterator<MetadataValue>(_db._storage, MetadataValueCollId, begin_key,
+                                                      end_key);
+}
+
+gendb::GetMessageAwaitable<MetadataValue, std::array<uint8_t, 8>> Guard::GetMetadataValueAsync(
+    const MetadataValueKey& key, MetadataValue& metadata_value,
+    gendb::AsyncReadQueue* queue) const {
+  return {_layered_storage, MetadataValueCollId, ToMetadataValueKey(key), metadata_value, queue};
+}
+
+absl::Status Snapshot::GetMetadataValue(const MetadataValueKey& key,
+                                        MetadataValue& metadata_value) const {
+  BytesConstView value;
+  RETURN_IF_ERROR(_snapshot.Get(MetadataValueCollId, ToMetadataValueKey(key), value));
+  metadata_value = MetadataValue{value};
+  return absl::OkStatus();
+}
+
+void Snapshot::GetMetadataValues(std::span<const MetadataValueKey> keys,
+                                 std::span<MetadataValue> metadata_values,
+                                 std::span<absl::Status> statuses) const {
+  gendb::MultiGetMessages<MetadataValue>(
+      _snapshot, MetadataValueCollId, keys,
+      [](const MetadataValueKey& key) { return ToMetadataValueKey(key); }, metadata_values,
+      statuses);
+}
+
+gendb::Iterator<MetadataValue> Snapshot::ScanMetadataValues(const MetadataValueKey& from,
+                                                            const MetadataValueKey& to) const {
+  const auto begin_key = ToMetadataValueKey(from);
+  const auto end_key = ToMetadataValueKey(to);
+  return gendb::MakePrimaryKeyIterator<MetadataValue>(_snapshot, MetadataValueCollId, begin_key,
+                                                      end_key);
+}
+
+absl::Status ScopedWrite::GetMetadataValue(const MetadataValueKey& key,
+                                           MetadataValue& metadata_value) const {
+  BytesConstView value;
+  auto key_ = ToMetadataValueKey(key);
+  _read_set.Add(MetadataValueCollId, key_);
+  RETURN_IF_ERROR(_layered_storage.Get(MetadataValueCollId, key_, value));
+  metadata_value = MetadataValue{value};
+  return absl::OkStatus();
+}
+
+absl::Status ScopedWrite::PutMetadataValue(const MetadataValueKey& key, Bytes metadata_value) {
+  auto key_ = ToMetadataValueKey(key);
+  if (_record_changes) {
+    _wal_batch.Put(MetadataValueCollId, key_, metadata_value);
+  }
+  _temp_storage.Put(MetadataValueCollId, key_, std::move(metadata_value));
+  return absl::OkStatus();
+}
+
+absl::Status ScopedWrite::UpdateMetadataValue(const MetadataValueKey& key,
+                                              const MessagePatch& update) {
+  Bytes* ptr = nullptr;
+  auto key_ = ToMetadataValueKey(key);
+  _read_set.Add(MetadataValueCollId, key_);
+  RETURN_IF_ERROR(_layered_storage.EnsureInTempStorage(MetadataValueCollId, key_, &ptr));
+  if (_record_changes) {
+    _wal_batch.Patch(MetadataValueCollId, key_, update);
+  }
+  gendb::ApplyPatch<MetadataValue>(update, *ptr);
+  return absl::OkStatus();
+}
+absl::Status Guard::GetAccount(uint64_t account_id, Account& account) const {
+  BytesConstView value;
+  RETURN_IF_ERROR(_layered_storage.Get(AccountCollId, ToAccountKey(account_id), value));
+  account = Account{value};
+  return absl::OkStatus();
+}
+
+void Guard::GetAccounts(std::span<const uint64_t> account_ids, std::span<Account> accounts,
+                        std::span<absl::Status> statuses) const {
+  gendb::MultiGetMessages<Account>(
+      _layered_storage, AccountCollId, account_ids,
+      [](uint64_t account_id) { return ToAccountKey(account_id); }, accounts, statuses);
+}
+
+gendb::Iterator<Account> Guard::ScanAccounts(uint64_t from_account_id,
+                                             uint64_t to_account_id) const {
+  _layered_storage.ReleasePins();
+  const auto begin_key = ToAccountKey(from_account_id);
+  const auto end_key = ToAccountKey(to_account_id);
+  return gendb::MakePrimaryKeyIterator<Account>(_db._storage, AccountCollId, begin_key, end_key);
+}
+
+gendb::GetMessageAwaitable<Account, std::array<uint8_t, 8>> Guard::GetAccountAsync(
+    uint64_t account_id, Account& account, gendb::AsyncReadQueue* queue) const {
+  return {_layered_storage, AccountCollId, ToAccountKey(account_id), account, queue};
+}
+
+absl::Status Snapshot::GetAccount(uint64_t account_id, Account& account) const {
+  BytesConstView value;
+  RETURN_IF_ERROR(_snapshot.Get(AccountCollId, ToAccountKey(account_id), value));
+  account = Account{value};
+  return absl::OkStatus();
+}
+
+void Snapshot::GetAccounts(std::span<const uint64_t> account_ids, std::span<Account> accounts,
+                           std::span<absl::Status> statuses) const {
+  gendb::MultiGetMessages<Account>(
+      _snapshot, AccountCollId, account_ids,
+      [](uint64_t account_id) { return ToAccountKey(account_id); }, accounts, statuses);
+}
+
+gendb::Iterator<Account> Snapshot::ScanAccounts(uint64_t from_account_id,
+                                                uint64_t to_account_id) const {
+  const auto begin_key = ToAccountKey(from_account_id);
+  const auto end_key = ToAccountKey(to_account_id);
+  return gendb::MakePrimaryKeyIterator<Account>(_snapshot, AccountCollId, begin_key, end_key);
+}
+
+absl::Status ScopedWrite::GetAccount(uint64_t account_id, Account& account) const {
+  BytesConstView value;
+  auto key_ = ToAccountKey(account_id);
+  _read_set.Add(AccountCollId, key_);
+  RETURN_IF_ERROR(_layered_storage.Get(AccountCollId, key_, value));
+  account = Account{value};
+  return absl::OkStatus();
+}
+
+absl::Status ScopedWrite::PutAccount(uint64_t account_id, Bytes account) {
+  auto key_ = ToAccountKey(account_id);
+  MaybeUpdateAccountByAgeIndex(key_, account, /*update=*/nullptr);
+  if (_record_changes) {
+    _wal_batch.Put(AccountCollId, key_, account);
+  }
+  _temp_storage.Put(AccountCollId, key_, std::move(account));
+  return absl::OkStatus();
+}
+
+absl::Status ScopedWrite::UpdateAccount(uint64_t account_id, const MessagePatch& update) {
+  Bytes* ptr = nullptr;
+  auto key_ = ToAccountKey(account_id);
+  _read_set.Add(AccountCollId, key_);
+  RETURN_IF_ERROR(_layered_storage.EnsureInTempStorage(AccountCollId, key_, &ptr));
+  MaybeUpdateAccountByAgeIndex(key_, *ptr, &update);
+  if (_record_changes) {
+    _wal_batch.Patch(AccountCollId, key_, update);
+  }
+  gendb::ApplyPatch<Account>(update, *ptr);
+  return absl::OkStatus();
+}
+
+absl::Status ScopedWrite::LogCommit(Db::LoggedChanges& logged) {
+  if (_wal_batch.empty()) {
+    return absl::OkStatus();
+  }
+  if (_db._wal != nullptr) {
+    absl::Status status = _db._wal->Append(_wal_batch);
+    if (!status.ok()) {
+      _wal_batch.Clear();
+      return status;
+    }
+    logged.wal_sequence = _db._wal->LastSequence();
+  }
+  if (_db._change_stream.active()) {
+    logged.batch = std::move(_wal_batch);
+  }
+  _wal_batch.Clear();
+  return absl::OkStatus();
+}
+
+void Db::PublishChanges(LoggedChanges&& changes) {
+  if (changes.batch.empty() || !_change_stream.active()) {
+    return;
+  }
+  const uint64_t sequence =
+      _wal != nullptr ? changes.wal_sequence : _change_stream.LastSequence() + 1;
+  _change_stream.Publish(sequence, std::move(changes.batch));
+}
+
+void Db::DiscardChanges(const LoggedChanges& changes) {
+  if (_wal != nullptr && changes.wal_sequence != 0) {
+    // A failure leaves the WAL failing the next commits, which report it.
+    (void)_wal->Retract(changes.wal_sequence);
+  }
+}
+
+gendb::Iterator<Account> Guard::GetAccountByAgeRange(int32_t min_age, int32_t max_age) const {
+  _layered_storage.ReleasePins();
+  return gendb::MakeSecondaryIndexIterator<Account, Indices::AccountByAgeIndexType>(
+      _layered_storage, AccountCollId, _db._indices.account_by_age.lower_bound(min_age),
+      _db._indices.account_by_age.lower_bound(max_age));
+}
+
+gendb::Iterator<Account> Guard::GetAccountByAgeEqual(int32_t age) const {
+  _layered_storage.ReleasePins();
+  return gendb::MakeSecondaryIndexIterator<Account, Indices::AccountByAgeIndexType>(
+      _layered_storage, AccountCollId, _db._indices.account_by_age.lower_bound(age),
+      _db._indices.account_by_age.upper_bound(age));
+}
+
+gendb::AsyncIndexIterator<Account, Indices::AccountByAgeIndexType> Guard::GetAccountByAgeRangeAsync(
+    int32_t min_age, int32_t max_age, gendb::AsyncReadQueue* queue) const {
+  _layered_storage.ReleasePins();
+  return {_layered_storage, AccountCollId,
+          gendb::SingleSetIterator<Indices::AccountByAgeIndexType>(
+              _db._indices.account_by_age.lower_bound(min_age),
+              _db._indices.account_by_age.lower_bound(max_age)),
+          queue};
+}
+
+gendb::Iterator<Account> Snapshot::GetAccountByAgeRange(int32_t min_age, int32_t max_age) const {
+  return gendb::MakeSnapshotIndexIterator<Account, Indices::AccountByAgeIndexType>(
+      _db._reader_mutex, _db._indices.account_by_age, min_age, max_age, /*include_max=*/false,
+      _snapshot, AccountCollId, AccountByAgeValue);
+}
+
+gendb::Iterator<Account> Snapshot::GetAccountByAgeEqual(int32_t age) const {
+  return gendb::MakeSnapshotIndexIterator<Account, Indices::AccountByAgeIndexType>(
+      _db._reader_mutex, _db._indices.account_by_age, age, age, /*include_max=*/true, _snapshot,
+      AccountCollId, AccountByAgeValue);
+}
+
+gendb::Iterator<Account> ScopedWrite::GetAccountByAgeRange(int32_t min_age, int32_t max_age) const {
+  _account_by_age_reads.push_back({min_age, max_age, /*include_max=*/false});
+  return gendb::MakeSnapshotWriterIndexIterator<Account, Indices::AccountByAgeIndexType>(
+      _db._reader_mutex, _db._indices.account_by_age, min_age, max_age, /*include_max=*/false,
+      *_snapshot, AccountByAgeValue, _layered_storage, AccountCollId,
+      _temp_indices.account_by_age.lower_bound(min_age),
+      _temp_indices.account_by_age.lower_bound(max_age));
+}
+
+gendb::Iterator<Account> ScopedWrite::GetAccountByAgeEqual(int32_t age) const {
+  _account_by_age_reads.push_back({age, age, /*include_max=*/true});
+  return gendb::MakeSnapshotWriterIndexIterator<Account, Indices::AccountByAgeIndexType>(
+      _db._reader_mutex, _db._indices.account_by_age, age, age, /*include_max=*/true, *_snapshot,
+      AccountByAgeValue, _layered_storage, AccountCollId,
+      _temp_indices.account_by_age.lower_bound(age),
+      _temp_indices.account_by_age.upper_bound(age));
+}
+
+void ScopedWrite::MaybeUpdateAccountByAgeIndex(std::array<uint8_t, sizeof(uint64_t)> key,
+                                               gendb::BytesConstView account_buffer,
+                                               const MessagePatch* update) {
+  std::optional<int32_t> age_before = std::nullopt;
+  std::optional<int32_t> age_after = std::nullopt;
+  if (update != nullptr && !DoModifyField(*update, Account::Age)) {
+    // This is update op which doesn't touch the indexed field.
+    return;
+  }
+  Account account{account_buffer};
+  if (account.has_age()) {
+    age_before = account.age();
+  }
+  if (update != nullptr) {
+    Account account_update{update->buffer};
+    if (account_update.has_age()) {
+      age_after = account_update.age();
+    }
+  }
+  if (age_before.has_value()) {
+    _temp_indices.account_by_age.Insert(age_before.value(), key,
+                                        /*is_deleted=*/update != nullptr);
+  }
+  if (age_after.has_value()) {
+    _temp_indices.account_by_age.Insert(age_after.value(), key);
+  }
+}
+
+absl::Status ScopedWrite::TakeSequenceIds(SequenceMetadataId sequence, int32_t count,
+                                          int32_t& last_id) {
+  MetadataValue value;
+  MetadataValueKey key{.type = MetadataType::kSequence, .id = static_cast<uint32_t>(sequence)};
+  auto status = GetMetadataValue(key, value);
+  if (status.code() == absl::StatusCode::kNotFound) {
+    RETURN_IF_ERROR(PutMetadataValue(key, MetadataValueBuilder().set_int_value(count).Build()));
+    last_id = count;
+  } else if (!status.ok()) {
+    return status;
+  } else {
+    if (value.int_value() > INT32_MAX - count) {
+      return absl::OutOfRangeError("Sequence " + std::to_string(key.id) + " is out of ids");
+    }
+    int new_last_id = value.int_value() + count;
+    RETURN_IF_ERROR(
+        UpdateMetadataValue(key, MetadataValuePatchBuilder().set_int_value(new_last_id).Build()));
+    last_id = new_last_id;
+  }
+  return absl::OkStatus();
+}
+
+absl::Status Db::NextBlockSequenceId(SequenceMetadataId sequence, int32_t& next_id) {
+  SequenceBlock& block = _sequence_blocks[static_cast<uint32_t>(sequence)];
+  while (true) {
+    // A new block is stored before its end, so an id read below `end` belongs to this block.
+    const int64_t end = block.end.load(std::memory_order_acquire);
+    int64_t id = block.next.load(std::memory_order_relaxed);
+    while (id < end) {
+      if (block.next.compare_exchange_weak(id, id + 1, std::memory_order_relaxed)) {
+        next_id = static_cast<int32_t>(id);
+        return absl::OkStatus();
+      }
+    }
+    std::lock_guard lock(block.mutex);
+    if (block.next.load(std::memory_order_relaxed) < block.end.load(std::memory_order_relaxed)) {
+      // Another thread reserved a block meanwhile.
+      continue;
+    }
+    int32_t first_id = 0;
+    RETURN_IF_ERROR(ReserveSequenceIds(sequence, first_id));
+    block.next.store(first_id, std::memory_order_relaxed);
+    block.end.store(int64_t{first_id} + kSequenceBlockSize, std::memory_order_release);
+  }
+}
+
+absl::Status Db::ReserveSequenceIds(SequenceMetadataId sequence, int32_t& first_id) {
+  int32_t last_id = 0;
+  while (true) {
+    auto writer = CreateWriter();
+    RETURN_IF_ERROR(writer.TakeSequenceIds(sequence, kSequenceBlockSize, last_id));
+    absl::Status status = writer.Commit();
+    if (status.ok()) {
+      break;
+    }
+    // Retried if a concurrent writer took ids of the sequence first.
+    if (!absl::IsAborted(status)) {
+      return status;
+    }
+  }
+  first_id = last_id - kSequenceBlockSize + 1;
+  return absl::OkStatus();
+}
+
+absl::Status ScopedWrite::NextAccountIdSequence(uint64_t& next_id) {
+  int32_t last_id = 0;
+  RETURN_IF_ERROR(TakeSequenceIds(SequenceMetadataId::AccountIdSequence, 1, last_id));
+  next_id = last_id;
+  return absl::OkStatus();
+}
+
+absl::Status Db::NextAccountIdSequence(uint64_t& next_id) {
+  int32_t id = 0;
+  RETURN_IF_ERROR(NextBlockSequenceId(SequenceMetadataId::AccountIdSequence, id));
+  next_id = id;
+  return absl::OkStatus();
+}
+
+absl::Status ScopedWrite::Commit() {
+  absl::Status status = absl::OkStatus();
+  {
+    // Only commits change the indices, so while it holds the commit mutex this writer reads them
+    // without the reader lock.
+    std::lock_guard commit_lock(_db._commit_mutex);
+    bool conflict = _read_set.WrittenAfter(*_snapshot);
+    for (const auto& range : _account_by_age_reads) {
+      conflict = conflict || gendb::IndexRangeWrittenAfter(_db._indices.account_by_age, range,
+                                                           *_snapshot, AccountCollId);
+    }
+    if (conflict) {
+      status = absl::AbortedError("A commit since the writer's snapshot changed what it read");
+    } else {
+      Db::LoggedChanges logged;
+      status = LogCommit(logged);
+      if (status.ok()) {
+        std::unique_lock lock(_db._reader_mutex);
+        try {
+          gendb::LayeredStorage(_db._versioned_storage, &_temp_storage)
+              .MergeTempStorage(_db._changed_keys.get());
+          _db._indices.MergeTempIndices(std::move(_temp_indices),
+                                        _db._versioned_storage.LastSequence(),
+                                        _db._versioned_storage.OldestSnapshot());
+        } catch (...) {
+          lock.unlock();
+          _db.DiscardChanges(logged);
+          throw;
+        }
+        lock.unlock();
+        _db.PublishChanges(std::move(logged));
+      }
+    }
+  }
+  Reset();
+  return status;
+}
+
+void ScopedWrite::Reset() {
+  _temp_storage.Clear();
+  _wal_batch.Clear();
+  _temp_indices = {};
+  _record_changes = _db.RecordsChanges();
+  _read_set.Clear();
+  _account_by_age_reads.clear();
+  // The old snapshot goes first: it holds back the reclamation of the versions it reads.
+  _snapshot.reset();
+  _snapshot.emplace(_db._versioned_storage.GetSnapshot());
+}
+
+}  // namespace gendb::tests::optimistic
@@ -3,23 +3,264 @@
 #include "primitive_database.h"
 
 #include <cstdint>
+#include <exception>
+#include <future>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <vector>
 
 #include "absl/status/status.h"
 #include "gendb/bytes.h"
 #include "gendb/iterator.h"
 #include "gendb/message_patch.h"
 #include "gendb/status.h"
+#include "gendb/wal_replay.h"
 #include "messageA.fbs.h"
 #include "metadata.fbs.h"
 
 namespace gendb::tests::primitive {
+Db::Db(const gendb::WalOptions& wal_options) { OpenWal(wal_options, /*checkpoint_sequence=*/0); }
+
+Db::Db(const std::string& checkpoint_path) : Db(std::span(&checkpoint_path, 1)) {}
+
+Db::Db(const std::string& checkpoint_path, const gendb::WalOptions& wal_options)
+    : Db(std::span(&checkpoint_path, 1), wal_options) {}
+
+Db::Db(std::span<const std::string> checkpoint_paths) { OpenCheckpoints(checkpoint_paths); }
+
+Db::Db(std::span<const std::string> checkpoint_paths, const gendb::WalOptions& wal_options) {
+  OpenWal(wal_options, OpenCheckpoints(checkpoint_paths));
+}
+
+void Db::OpenWal(const gendb::WalOptions& wal_options, uint64_t checkpoint_sequence) {
+  // The log is replayed before `_wal` is set, so the replayed commits are not logged again.
+  gendb::ParallelWalReplay replay(_storage, wal_options.replay_threads);
+  auto wal = std::make_unique<gendb::Wal>(
+      wal_options, [&](uint64_t sequence, gendb::BytesConstView record) {
+        if (sequence <= checkpoint_sequence) {
+          return absl::OkStatus();
+        }
+        // Segments are only removed once a checkpoint holds their records.
+        if (replay.records() == 0 && sequence != checkpoint_sequence + 1) {
+          return absl::DataLossError("WAL record " + std::to_string(checkpoint_sequence + 1) +
+                                     " is missing");
+        }
+        return replay.Add(record);
+      });
+  if (absl::Status status = replay.Finish(); !status.ok()) {
+    throw std::runtime_error("Failed to replay the WAL: " + status.ToString());
+  }
+  if (absl::Status status = replay.WriteTo(_versioned_storage, _changed_keys.get()); !status.ok()) {
+    throw std::runtime_error("Failed to write the replayed WAL: " + status.ToString());
+  }
+  // The log may not reach the checkpoint: the sequence continues from the checkpoint's.
+  if (checkpoint_sequence > 0) {
+    if (absl::Status status = wal->RemoveThrough(checkpoint_sequence); !status.ok()) {
+      throw std::runtime_error("Failed to remove the checkpointed WAL: " + status.ToString());
+    }
+  }
+  _wal = std::move(wal);
+}
+
+uint64_t Db::OpenCheckpoints(std::span<const std::string> paths) {
+  std::vector<std::unique_ptr<const gendb::Checkpoint>> checkpoints =
+      gendb::OpenCheckpointChain(paths);
+  if (checkpoints.empty()) {
+    throw std::runtime_error("No checkpoint to open");
+  }
+  for (size_t i = 0; i < checkpoints.size(); ++i) {
+    // Deltas have no indices: they are rebuilt from the values.
+    if (checkpoints[i]->collection_count() != 2 ||
+        checkpoints[i]->index_count() != (i == 0 ? 0 : 0)) {
+      throw std::runtime_error("Checkpoint " + paths[i] + " was written for another schema");
+    }
+  }
+  _checkpoint_generation = checkpoints.back()->generation();
+  _checkpoint_wal_sequence = checkpoints.back()->wal_sequence();
+  if (_checkpoint_generation > 0) {
+    _changed_keys = std::make_unique<gendb::ChangedKeys>();
+  }
+  _storage.SetCheckpoint(std::move(checkpoints.front()));
+  if (checkpoints.size() == 1) {
+    return _checkpoint_wal_sequence;
+  }
+  // The deltas replay over the base like a WAL, with the indices rebuilt once. Their changes are
+  // already in the chain, so they are not tracked for the next delta.
+  gendb::ParallelWalReplay replay(_storage, /*threads=*/0);
+  for (size_t i = 1; i < checkpoints.size(); ++i) {
+    if (absl::Status status = replay.AddDelta(*checkpoints[i]); !status.ok()) {
+      throw std::runtime_error(
+          "Failed to replay checkpoint " + paths[i] + ": " + status.ToString());
+    }
+  }
+  if (absl::Status status = replay.Finish(); !status.ok()) {
+    throw std::runtime_error("Failed to replay the checkpoint deltas: " + status.ToString());
+  }
+  if (absl::Status status = replay.WriteTo(_versioned_storage); !status.ok()) {
+    throw std::runtime_error(
+        "Failed to write the replayed checkpoint deltas: " + status.ToString());
+  }
+  return _checkpoint_wal_sequence;
+}
+
+absl::Status Db::WriteCheckpoint(const std::string& path) {
+  std::lock_guard lock(_checkpoint_mutex);
+  // Outside of any chain, so no delta follows it.
+  return WriteCheckpointFile(path, /*generation=*/0, /*delta=*/false);
+}
+
+absl::Status Db::WriteCheckpoint(gendb::CheckpointChain& chain) {
+  std::lock_guard lock(_checkpoint_mutex);
+  const uint64_t last_generation = chain.LastGeneration();
+  // `_changed_keys` holds the changes since the Db's last checkpoint, which must be the chain's.
+  const bool delta = _changed_keys != nullptr && last_generation > 0 &&
+                     last_generation == _checkpoint_generation;
+  const uint64_t generation = last_generation + 1;
+  RETURN_IF_ERROR(WriteCheckpointFile(chain.Path(generation, delta), generation, delta));
+  return chain.Add(generation, delta);
+}
+
+absl::Status Db::MergeCheckpoints(std::span<const std::string> paths, const std::string& path) {
+  try {
+    // A merge reads the whole chain anyway, so it checks the base's checksums rather than carry
+    // a corrupt record into a new base under a fresh checksum. The deltas are checked as they
+    // replay.
+    if (!paths.empty()) {
+      RETURN_IF_ERROR(gendb::Checkpoint(paths.front()).Verify());
+    }
+    Db db(paths);
+    return db.WriteCheckpointFile(path, db._checkpoint_generation, /*delta=*/false);
+  } catch (const std::runtime_error& error) {
+    return absl::DataLossError(error.what());
+  }
+}
+
+absl::Status Db::WithCommitsHeld(const std::function<absl::Status()>& fn) {
+  std::lock_guard lock(_writer_mutex);
+  _apply_queue.WaitIdle();
+  return fn();
+}
+
+absl::Status Db::WriteCheckpointFile(const std::string& path, uint64_t generation, bool delta) {
+  // Commits are only held back while the state to write is captured: a snapshot, the last WAL
+  // record it holds and the keys changed since the last checkpoint, which commits from then on
+  // leave for a new set.
+  std::optional<gendb::StorageSnapshot> snapshot;
+  uint64_t wal_sequence = 0;
+  std::unique_ptr<gendb::ChangedKeys> changed_keys;
+  RETURN_IF_ERROR(WithCommitsHeld([&] {
+    snapshot.emplace(_versioned_storage.GetSnapshot());
+    wal_sequence = _wal != nullptr ? _wal->LastSequence() : _checkpoint_wal_sequence;
+    if (_changed_keys != nullptr || generation > 0) {
+      changed_keys = std::exchange(_changed_keys, std::make_unique<gendb::ChangedKeys>());
+    }
+    return absl::OkStatus();
+  }));
+
+  absl::Status status = [&] {
+    gendb::CheckpointWriter writer(path, generation, delta);
+    for (size_t collection_id = 0; collection_id < 2; ++collection_id) {
+      if (delta) {
+        RETURN_IF_ERROR(writer.AddChangedKeys(*snapshot, collection_id,
+                                              changed_keys->collection(collection_id)));
+      } else {
+        RETURN_IF_ERROR(writer.AddCollection(*snapshot->NewCursor(collection_id)));
+      }
+    }
+    return writer.Finish(wal_sequence);
+  }();
+  if (!status.ok()) {
+    // The keys the checkpoint did not get to hold are still for the next delta.
+    RETURN_IF_ERROR(WithCommitsHeld([&] {
+      if (changed_keys != nullptr) {
+        changed_keys->Add(*_changed_keys);
+      }
+      _changed_keys = std::move(changed_keys);
+      return absl::OkStatus();
+    }));
+    return status;
+  }
+  _checkpoint_generation = generation;
+  _checkpoint_wal_sequence = wal_sequence;
+  // Only a checkpoint of a chain is followed by deltas.
+  if (generation == 0 && changed_keys != nullptr) {
+    RETURN_IF_ERROR(WithCommitsHeld([&] {
+      _changed_keys.reset();
+      return absl::OkStatus();
+    }));
+  }
+  return _wal != nullptr ? _wal->RemoveThrough(wal_sequence) : absl::OkStatus();
+}
 
 Guard Db::SharedLock() const {
-  return {*this, std::shared_lock<std::shared_mutex>(_reader_mutex)};
+  return {*this, _reader_mutex.LockShared()};
+}
+
+Snapshot Db::Snapshot() const {
+  return {*this, _versioned_storage.GetSnapshot()};
 }
 
 ScopedWrite Db::CreateWriter() {
-  return {*this, std::unique_lock<std::mutex>(_writer_mutex)};
+  return {*this, std::unique_lock(_writer_mutex)};
+}
+
+void Db::ApplyCommit(PendingCommit& commit) {
+  bool dropped = false;
+  {
+    std::lock_guard pending_lock(_pending_mutex);
+    if (_dropping_pending) {
+      _pending_storages.pop_front();
+      ++_dropped_commits;
+      _dropping_pending = !_pending_storages.empty();
+      dropped = true;
+    }
+  }
+  if (dropped) {
+    DiscardChanges(commit.changes);
+    throw std::runtime_error("Dropped a commit made over one that failed to apply");
+  }
+  std::unique_lock lock(_reader_mutex);
+  try {
+    // Writers created meanwhile read the storage from the pending commits, so it is left as is.
+    gendb::LayeredStorage(_versioned_storage, nullptr)
+        .MergeChanges(*commit.storage, _changed_keys.get());
+  } catch (...) {
+    lock.unlock();
+    // Only erased if no later commit was logged: the WAL then fails the next ones.
+    DiscardChanges(commit.changes);
+    std::lock_guard pending_lock(_pending_mutex);
+    _pending_storages.pop_front();
+    ++_dropped_commits;
+    // The commits still pending were made over this one.
+    _dropping_pending = !_pending_storages.empty();
+    throw;
+  }
+  lock.unlock();
+  {
+    // Writers created from now on read the Db itself.
+    std::lock_guard pending_lock(_pending_mutex);
+    _pending_storages.pop_front();
+  }
+  PublishChanges(std::move(commit.changes));
+}
+
+std::vector<std::shared_ptr<const gendb::MemoryStorage>> Db::PendingStorages(
+    uint64_t& dropped_commits) {
+  std::lock_guard lock(_pending_mutex);
+  dropped_commits = _dropped_commits;
+  return {_pending_storages.begin(), _pending_storages.end()};
+}
+
+bool Db::DroppedCommitsSince(uint64_t dropped_commits) {
+  std::lock_guard lock(_pending_mutex);
+  return _dropped_commits != dropped_commits;
+}
+
+void ScopedWrite::WaitForPending() const {
+  if (!_pending.empty()) {
+    _db._apply_queue.WaitIdle();
+  }
 }
 
 absl::Status Guard::GetMetadataValue(const MetadataValueKey& key,
@@ -30,6 +271,55 @@ absl::Status Guard::GetMetadataValue(const MetadataValueKey& key,
   return absl::OkStatus();
 }
 
+void Guard::GetMetadataValues(std::span<const MetadataValueKey> keys,
+                              std::span<MetadataValue> metadata_values,
+                              std::span<absl::Status> statuses) const {
+  gendb::MultiGetMessages<MetadataValue>(
+      _layered_storage, MetadataValueCollId, keys,
+      [](const MetadataValueKey& key) { return ToMetadataValueKey(key); }, metadata_values,
+      statuses);
+}
+
+gendb::Iterator<MetadataValue> Guard::ScanMetadataValues(const MetadataValueKey& from,
+                                                         const MetadataValueKey& to) const {
+  _layered_storage.ReleasePins();
+  const auto begin_key = ToMetadataValueKey(from);
+  const auto end_key = ToMetadataValueKey(to);
+  return gendb::MakePrimaryKeyIterator<MetadataValue>(_db._storage, MetadataValueCollId, begin_key,
+                                                      end_key);
+}
+
+gendb::GetMessageAwaitable<MetadataValue, std::array<uint8_t, 8>> Guard::GetMetadataValueAsync(
+    const MetadataValueKey& key, MetadataValue& metadata_value,
+    gendb::AsyncReadQueue* queue) const {
+  return {_layered_storage, MetadataValueCollId, ToMetadataValueKey(key), metadata_value, queue};
+}
+
+absl::Status Snapshot::GetMetadataValue(const MetadataValueKey& key,
+                                        MetadataValue& metadata_value) const {
+  BytesConstView value;
+  RETURN_IF_ERROR(_snapshot.Get(MetadataValueCollId, ToMetadataValueKey(key), value));
+  metadata_value = MetadataValue{value};
+  return absl::OkStatus();
+}
+
+void Snapshot::GetMetadataValues(std::span<const MetadataValueKey> keys,
+                                 std::span<MetadataValue> metadata_values,
+                                 std::span<absl::Status> statuses) const {
+  gendb::MultiGetMessages<MetadataValue>(
+      _snapshot, MetadataValueCollId, keys,
+      [](const MetadataValueKey& key) { return ToMetadataValueKey(key); }, metadata_values,
+      statuses);
+}
+
+gendb::Iterator<MetadataValue> Snapshot::ScanMetadataValues(const MetadataValueKey& from,
+                                                            const MetadataValueKey& to) const {
+  const auto begin_key = ToMetadataValueKey(from);
+  const auto end_key = ToMetadataValueKey(to);
+  return gendb::MakePrimaryKeyIterator<MetadataValue>(_snapshot, MetadataValueCollId, begin_key,
+                                                      end_key);
+}
+
 absl::Status ScopedWrite::GetMetadataValue(const MetadataValueKey& key,
                                            MetadataValue& metadata_value) const {
   BytesConstView value;
@@ -40,6 +330,9 @@ absl::Status ScopedWrite::GetMetadataValue(const MetadataValueKey& key,
 
 absl::Status ScopedWrite::PutMetadataValue(const MetadataValueKey& key, Bytes metadata_value) {
   auto key_ = ToMetadataValueKey(key);
+  if (_record_changes) {
+    _wal_batch.Put(MetadataValueCollId, key_, metadata_value);
+  }
   _temp_storage.Put(MetadataValueCollId, key_, std::move(metadata_value));
   return absl::OkStatus();
 }
@@ -49,6 +342,9 @@ absl::Status ScopedWrite::UpdateMetadataValue(const MetadataValueKey& key,
   Bytes* ptr = nullptr;
   auto key_ = ToMetadataValueKey(key);
   RETURN_IF_ERROR(_layered_storage.EnsureInTempStorage(MetadataValueCollId, key_, &ptr));
+  if (_record_changes) {
+    _wal_batch.Patch(MetadataValueCollId, key_, update);
+  }
   gendb::ApplyPatch<MetadataValue>(update, *ptr);
   return absl::OkStatus();
 }
@@ -59,6 +355,51 @@ absl::Status Guard::GetMessageA(gendb::tests::primitive::KeyEnum key, MessageA&
   return absl::OkStatus();
 }
 
+void Guard::GetMessageAs(std::span<const gendb::tests::primitive::KeyEnum> keys,
+                         std::span<MessageA> message_as, std::span<absl::Status> statuses) const {
+  gendb::MultiGetMessages<MessageA>(
+      _layered_storage, MessageACollId, keys,
+      [](gendb::tests::primitive::KeyEnum key) { return ToMessageAKey(key); }, message_as,
+      statuses);
+}
+
+gendb::Iterator<MessageA> Guard::ScanMessageAs(gendb::tests::primitive::KeyEnum from_key,
+                                               gendb::tests::primitive::KeyEnum to_key) const {
+  _layered_storage.ReleasePins();
+  const auto begin_key = ToMessageAKey(from_key);
+  const auto end_key = ToMessageAKey(to_key);
+  return gendb::MakePrimaryKeyIterator<MessageA>(_db._storage, MessageACollId, begin_key, end_key);
+}
+
+gendb::GetMessageAwaitable<MessageA, std::array<uint8_t, 4>> Guard::GetMessageAAsync(
+    gendb::tests::primitive::KeyEnum key, MessageA& message_a, gendb::AsyncReadQueue* queue) const {
+  return {_layered_storage, MessageACollId, ToMessageAKey(key), message_a, queue};
+}
+
+absl::Status Snapshot::GetMessageA(gendb::tests::primitive::KeyEnum key,
+                                   MessageA& message_a) const {
+  BytesConstView value;
+  RETURN_IF_ERROR(_snapshot.Get(MessageACollId, ToMessageAKey(key), value));
+  message_a = MessageA{value};
+  return absl::OkStatus();
+}
+
+void Snapshot::GetMessageAs(std::span<const gendb::tests::primitive::KeyEnum> keys,
+                            std::span<MessageA> message_as,
+                            std::span<absl::Status> statuses) const {
+  gendb::MultiGetMessages<MessageA>(
+      _snapshot, MessageACollId, keys,
+      [](gendb::tests::primitive::KeyEnum key) { return ToMessageAKey(key); }, message_as,
+      statuses);
+}
+
+gendb::Iterator<MessageA> Snapshot::ScanMessageAs(gendb::tests::primitive::KeyEnum from_key,
+                                                  gendb::tests::primitive::KeyEnum to_key) const {
+  const auto begin_key = ToMessageAKey(from_key);
+  const auto end_key = ToMessageAKey(to_key);
+  return gendb::MakePrimaryKeyIterator<MessageA>(_snapshot, MessageACollId, begin_key, end_key);
+}
+
 absl::Status ScopedWrite::GetMessageA(gendb::tests::primitive::KeyEnum key,
                                       MessageA& message_a) const {
   BytesConstView value;
@@ -69,6 +410,9 @@ absl::Status ScopedWrite::GetMessageA(gendb::tests::primitive::KeyEnum key,
 
 absl::Status ScopedWrite::PutMessageA(gendb::tests::primitive::KeyEnum key, Bytes message_a) {
   auto key_ = ToMessageAKey(key);
+  if (_record_changes) {
+    _wal_batch.Put(MessageACollId, key_, message_a);
+  }
   _temp_storage.Put(MessageACollId, key_, std::move(message_a));
   return absl::OkStatus();
 }
@@ -78,13 +422,120 @@ absl::Status ScopedWrite::UpdateMessageA(gendb::tests::primitive::KeyEnum key,
   Bytes* ptr = nullptr;
   auto key_ = ToMessageAKey(key);
   RETURN_IF_ERROR(_layered_storage.EnsureInTempStorage(MessageACollId, key_, &ptr));
+  if (_record_changes) {
+    _wal_batch.Patch(MessageACollId, key_, update);
+  }
   gendb::ApplyPatch<MessageA>(update, *ptr);
   return absl::OkStatus();
 }
 
+absl::Status ScopedWrite::LogCommit(Db::LoggedChanges& logged) {
+  if (_wal_batch.empty()) {
+    return absl::OkStatus();
+  }
+  if (_db._wal != nullptr) {
+    absl::Status status = _db._wal->Append(_wal_batch);
+    if (!status.ok()) {
+      _wal_batch.Clear();
+      return status;
+    }
+    logged.wal_sequence = _db._wal->LastSequence();
+  }
+  if (_db._change_stream.active()) {
+    logged.batch = std::move(_wal_batch);
+  }
+  _wal_batch.Clear();
+  return absl::OkStatus();
+}
+
 void ScopedWrite::Commit() {
+  absl::Status status = TryCommit();
+  if (!status.ok()) {
+    throw std::runtime_error("Failed to commit: " + status.ToString());
+  }
+}
+
+void Db::PublishChanges(LoggedChanges&& changes) {
+  if (changes.batch.empty() || !_change_stream.active()) {
+    return;
+  }
+  const uint64_t sequence =
+      _wal != nullptr ? changes.wal_sequence : _change_stream.LastSequence() + 1;
+  _change_stream.Publish(sequence, std::move(changes.batch));
+}
+
+void Db::DiscardChanges(const LoggedChanges& changes) {
+  if (_wal != nullptr && changes.wal_sequence != 0) {
+    // A failure leaves the WAL failing the next commits, which report it.
+    (void)_wal->Retract(changes.wal_sequence);
+  }
+}
+
+absl::Status ScopedWrite::TryCommit() {
+  absl::Status status;
+  if (!_pending.empty()) {
+    // Applied after the commits handed off before it, which the writer then reads from the Db.
+    _db._apply_queue.WaitIdle();
+    if (_db.DroppedCommitsSince(_dropped_commits)) {
+      status = absl::AbortedError("A commit this writer read failed to apply");
+      _wal_batch.Clear();
+    }
+    _layered_storage = gendb::LayeredStorage(_db._versioned_storage, &_temp_storage);
+    _snapshot.reset();
+    _pending.clear();
+  }
+  Db::LoggedChanges logged;
+  if (status.ok()) {
+    status = LogCommit(logged);
+  }
+  if (!status.ok()) {
+    // Nothing was logged: the writer goes on without the changes.
+    _temp_storage.Clear();
+    return status;
+  }
   std::unique_lock lock(_db._reader_mutex);
-  _layered_storage.MergeTempStorage();
+  try {
+    _layered_storage.MergeTempStorage(_db._changed_keys.get());
+  } catch (...) {
+    lock.unlock();
+    _db.DiscardChanges(logged);
+    throw;
+  }
+  lock.unlock();
+  _db.PublishChanges(std::move(logged));
+  return absl::OkStatus();
+}
+
+std::future<void> ScopedWrite::CommitAsync() {
+  // Logged in commit order, before the writer lock is released, and published by the apply
+  // thread once applied.
+  Db::LoggedChanges logged;
+  absl::Status status = LogCommit(logged);
+  if (!status.ok()) {
+    throw std::runtime_error("Failed to log the commit: " + status.ToString());
+  }
+  auto storage = std::make_shared<const gendb::MemoryStorage>(std::move(_temp_storage));
+  bool dropped = false;
+  {
+    // Checked as the commit joins the pending ones, so that it is dropped if one it read fails to
+    // apply later on.
+    std::lock_guard lock(_db._pending_mutex);
+    dropped = !_pending.empty() && _db._dropped_commits != _dropped_commits;
+    if (!dropped) {
+      _db._pending_storages.push_back(storage);
+    }
+  }
+  if (dropped) {
+    _db.DiscardChanges(logged);
+    _lock.unlock();
+    std::promise<void> failed;
+    failed.set_exception(std::make_exception_ptr(
+        std::runtime_error("Dropped a commit made over one that failed to apply")));
+    return failed.get_future();
+  }
+  std::future<void> applied = _db._apply_queue.Submit({std::move(storage), std::move(logged)});
+  _lock.unlock();
+  return applied;
 }
 
 }  // namespace gendb::tests::primitive
\ No newline at end of file
@@ -1,15 +1,34 @@
 // AUTO GENERATED. DO NOT EDIT.
 //
 #pragma once
+#include <array>
 #include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
 #include <mutex>
-#include <shared_mutex>
+#include <optional>
+#include <span>
+#include <string>
 
 #include "absl/status/status.h"
+#include "gendb/apply_queue.h"
+#include "gendb/arena_storage.h"
+#include "gendb/async_read.h"
 #include "gendb/bytes.h"
+#include "gendb/change_stream.h"
+#include "gendb/changed_keys.h"
+#include "gendb/checkpoint_chain.h"
+#include "gendb/checkpoint_storage.h"
+#include "gendb/iterator.h"
 #include "gendb/key_codec.h"
 #include "gendb/layered_storage.h"
 #include "gendb/message_patch.h"
+#include "gendb/owned_mutex.h"
+#include "gendb/reader_biased_mutex.h"
+#include "gendb/versioned_storage.h"
+#include "gendb/wal.h"
 #include "messageA.fbs.h"
 #include "metadata.fbs.h"
 
@@ -17,6 +36,7 @@ namespace gendb::tests::primitive {
 
 // Forward declarations.
 class Guard;
+class Snapshot;
 class ScopedWrite;
 
 enum CollectionId {
@@ -56,37 +76,220 @@ inline std::array<uint8_t, 4> ToMessageAKey(MessageA message_a) {
 
 class Db {
  public:
+  // RocksDB column family tuning per CollectionId, from the `storage:` blocks of the schema. Pass
+  // it to gendb::RocksDBStorage when persisting the collections.
+  static constexpr std::array<gendb::CollectionTuning, 2> kCollectionTuning = {
+      gendb::CollectionTuning{.prefix_length = 4},
+      gendb::CollectionTuning{},
+  };
+
+  Db() = default;
+  // Recovers the commits logged in `wal_options.dir`, then logs each commit there before applying
+  // it. Throws std::runtime_error if the log cannot be replayed.
+  explicit Db(const gendb::WalOptions& wal_options);
+  // Serves the collections of the checkpoint at `checkpoint_path` (see WriteCheckpoint) from a
+  // read-only mapping, so values are paged in as they are first read; the indices are loaded from
+  // it. Throws std::runtime_error if the file is invalid or was written for another schema.
+  explicit Db(const std::string& checkpoint_path);
+  // Opens the checkpoint, then recovers the commits logged after it.
+  Db(const std::string& checkpoint_path, const gendb::WalOptions& wal_options);
+  // Opens a chain of checkpoints (see gendb::CheckpointChain::Paths): the base as above, then the
+  // changes of the deltas after it, replayed in parallel.
+  explicit Db(std::span<const std::string> checkpoint_paths);
+  Db(std::span<const std::string> checkpoint_paths, const gendb::WalOptions& wal_options);
+
   Guard SharedLock() const;
+  // Consistent view as of the last commit, without holding the reader lock (see Snapshot).
+  class Snapshot Snapshot() const;
+  // Waits for the previous writer to be destroyed or to hand its changes off with CommitAsync().
+  // Changes handed off and not applied yet are read from the apply queue, over a snapshot of the
+  // Db: the writer does not wait for them, except to read an index or to Commit().
   ScopedWrite CreateWriter();
 
+  // Change data capture: each commit, as a batch numbered like its WAL record if the Db has a WAL,
+  // and in commit order otherwise. Commits are published once something subscribed, except those
+  // of writers created before that.
+  gendb::ChangeStream& Changes() { return _change_stream; }
+
+  // Writes every collection, sequence and index to a checkpoint at `path`, which replaces the
+  // file atomically, then removes the WAL segments it holds. It is written from a snapshot, so
+  // commits only wait while it is taken. Waits for the current writer, which the calling thread
+  // must not hold.
+  absl::Status WriteCheckpoint(const std::string& path);
+  // Adds the next checkpoint to `chain`: a delta of the keys changed since the previous one if the
+  // Db was opened from or last wrote the chain's last generation, a base otherwise. A delta costs
+  // as much as the keys changed, whatever the size of the database.
+  absl::Status WriteCheckpoint(gendb::CheckpointChain& chain);
+
+  // Writes the database of the checkpoint chain at `paths` to a base at `path`, without a WAL:
+  // the gendb::CheckpointChain::MergeFn of Dbs of this schema.
+  static absl::Status MergeCheckpoints(std::span<const std::string> paths, const std::string& path);
+
  private:
   friend class Guard;
+  friend class Snapshot;
   friend class ScopedWrite;
 
-  std::mutex _writer_mutex;
-  mutable std::shared_mutex _reader_mutex;
-  MemoryStorage _storage;
+  // Replays the WAL over the state the Db holds, skipping the records up to `checkpoint_sequence`
+  // that its checkpoint already holds.
+  void OpenWal(const gendb::WalOptions& wal_options, uint64_t checkpoint_sequence);
+  // Whether writers record their changes, for the WAL or the change stream.
+  bool RecordsChanges() const { return _wal != nullptr || _change_stream.active(); }
+
+  // A commit's changes, logged and held back from the change stream until they are applied.
+  struct LoggedChanges {
+    // The WAL record holding them, or 0 without a WAL.
+    uint64_t wal_sequence = 0;
+    gendb::WalBatch batch;
+  };
+  // Publishes logged changes to the change stream, once readers of the Db see them.
+  void PublishChanges(LoggedChanges&& changes);
+  // Erases the WAL record of logged changes that failed to apply, so that opening the Db does not
+  // replay them. If it cannot, the WAL fails every later commit.
+  void DiscardChanges(const LoggedChanges& changes);
+  // Returns the sequence number of the last WAL record the checkpoints hold.
+  uint64_t OpenCheckpoints(std::span<const std::string> paths);
+  // Runs `fn` with commits held back.
+  absl::Status WithCommitsHeld(const std::function<absl::Status()>& fn);
+  // Writes a snapshot of the Db, with commits only held back while it is taken. A delta holds the
+  // keys in `_changed_keys` as of the snapshot. Under `_checkpoint_mutex`, but for a private Db.
+  absl::Status WriteCheckpointFile(const std::string& path, uint64_t generation, bool delta);
+
+  // Changes handed off by ScopedWrite::CommitAsync().
+  struct PendingCommit {
+    // Also in `_pending_storages` until applied.
+    std::shared_ptr<const gendb::MemoryStorage> storage;
+    LoggedChanges changes;
+  };
+
+  // Runs on the apply thread.
+  void ApplyCommit(PendingCommit& commit);
+  // The storages of the commits handed off and not applied yet, in commit order, and the count of
+  // commits dropped so far: see `_dropped_commits`.
+  std::vector<std::shared_ptr<const gendb::MemoryStorage>> PendingStorages(uint64_t& dropped_commits);
+  // Whether a commit was dropped since PendingStorages() returned `dropped_commits`.
+  bool DroppedCommitsSince(uint64_t dropped_commits);
+
+  std::mutex _pending_mutex;
+  std::deque<std::shared_ptr<const gendb::MemoryStorage>> _pending_storages;
+  // The pending commits that failed to apply, or were dropped because they read over one that did.
+  // A writer reading pending commits cannot commit once the count changes.
+  uint64_t _dropped_commits = 0;
+  // Set when a commit fails to apply, until no commit is pending: those still pending were made
+  // over it, so they are dropped rather than applied.
+  bool _dropping_pending = false;
+
+  // Knows its holder, so that the Next... methods fail on a writer's thread instead of waiting.
+  gendb::OwnedMutex _writer_mutex;
+  // Many readers and rare writers: reads stay on per-thread cache lines (see ReaderBiasedMutex).
+  mutable gendb::ReaderBiasedMutex _reader_mutex;
+  // Commits are applied to an arena over the checkpoint the Db was opened from, if any. They hold
+  // `_reader_mutex` exclusively, so the memory they unlink is freed at once: no Guard reads it.
+  gendb::CheckpointStorage _storage;
+  // Commits write through it; it keeps the versions that open snapshots still read.
+  gendb::VersionedStorage _versioned_storage{_storage};
+  // Serializes the checkpoint writes, and guards the two members below.
+  std::mutex _checkpoint_mutex;
+  // Generation of the checkpoint the Db was last opened from or wrote, 0 outside of a chain, and
+  // the last WAL record it holds, which a Db without a WAL carries over to its next checkpoint.
+  uint64_t _checkpoint_generation = 0;
+  uint64_t _checkpoint_wal_sequence = 0;
+  // Keys changed since that checkpoint, for the next delta. Commits only track them once there is
+  // a checkpoint to follow.
+  std::unique_ptr<gendb::ChangedKeys> _changed_keys;
+  // Set when the Db was opened with a WAL.
+  std::unique_ptr<gendb::Wal> _wal;
+  gendb::ChangeStream _change_stream;
+  // Last, so that it is destroyed first: its thread applies the commits still queued before the
+  // storage goes away.
+  gendb::ApplyQueue<PendingCommit> _apply_queue{
+      [this](PendingCommit& commit) { ApplyCommit(commit); }};
 };
 
 class Guard {
  public:
   absl::Status GetMetadataValue(const MetadataValueKey& key, MetadataValue& metadata_value) const;
   absl::Status GetMessageA(gendb::tests::primitive::KeyEnum key, MessageA& message_a) const;
+  // Batched point reads: `statuses[i]` and, when OK, the i-th message receive the result for the
+  // i-th key.
+  void GetMetadataValues(std::span<const MetadataValueKey> keys,
+                         std::span<MetadataValue> metadata_values,
+                         std::span<absl::Status> statuses) const;
+  void GetMessageAs(std::span<const gendb::tests::primitive::KeyEnum> keys,
+                    std::span<MessageA> message_as, std::span<absl::Status> statuses) const;
+  // Primary key range scans over [from, to), in key order.
+  gendb::Iterator<MetadataValue> ScanMetadataValues(const MetadataValueKey& from,
+                                                    const MetadataValueKey& to) const;
+  gendb::Iterator<MessageA> ScanMessageAs(gendb::tests::primitive::KeyEnum from_key,
+                                          gendb::tests::primitive::KeyEnum to_key) const;
+  // Reads to `co_await` from a coroutine (see gendb/async_read.h). In memory they complete without
+  // suspending; reads of a storage that blocks wait for `queue` to be flushed, if one is given.
+  // The guard must outlive the returned awaitables and iterators.
+  gendb::GetMessageAwaitable<MetadataValue, std::array<uint8_t, 8>> GetMetadataValueAsync(
+      const MetadataValueKey& key, MetadataValue& metadata_value,
+      gendb::AsyncReadQueue* queue = nullptr) const;
+  gendb::GetMessageAwaitable<MessageA, std::array<uint8_t, 4>> GetMessageAAsync(
+      gendb::tests::primitive::KeyEnum key, MessageA& message_a,
+      gendb::AsyncReadQueue* queue = nullptr) const;
+  // Messages read from a storage that pins its read buffers stay valid until the guard is
+  // destroyed or until this releases the buffers, for guards kept across many reads. Scans, whose
+  // iterators pin the buffers they read themselves, release them too: a guard only holds those of
+  // the reads since its last scan.
+  void ReleasePins() const { _layered_storage.ReleasePins(); }
   ~Guard() = default;
 
  private:
   friend class Db;
-  Guard(const Db& db, std::shared_lock<std::shared_mutex> lock)
+  Guard(const Db& db, gendb::ReaderBiasedMutex::ReadLock lock)
       : _db(db),
         _lock(std::move(lock)),
-        _layered_storage(const_cast<MemoryStorage&>(_db._storage), /*temp_storage_ptr=*/nullptr) {}
+        _layered_storage(const_cast<gendb::CheckpointStorage&>(_db._storage),
+                         /*temp_storage_ptr=*/nullptr) {}
 
  private:
   const Db& _db;
-  std::shared_lock<std::shared_mutex> _lock;
+  gendb::ReaderBiasedMutex::ReadLock _lock;
   const gendb::LayeredStorage _layered_storage;
 };
 
+// Consistent read-only view of the Db as of the last commit before it was taken. Unlike Guard it
+// holds no lock: commits proceed while it is alive, and the versions they overwrite are kept until
+// it is destroyed. Each read only excludes the commits writing its collection while it runs: one
+// lookup, or one batch of a scan, at a time. Returned messages stay valid for the lifetime of the
+// snapshot, or until ReleaseReadCopies().
+class Snapshot {
+ public:
+  absl::Status GetMetadataValue(const MetadataValueKey& key, MetadataValue& metadata_value) const;
+  absl::Status GetMessageA(gendb::tests::primitive::KeyEnum key, MessageA& message_a) const;
+  // Batched point reads: `statuses[i]` and, when OK, the i-th message receive the result for the
+  // i-th key.
+  void GetMetadataValues(std::span<const MetadataValueKey> keys,
+                         std::span<MetadataValue> metadata_values,
+                         std::span<absl::Status> statuses) const;
+  void GetMessageAs(std::span<const gendb::tests::primitive::KeyEnum> keys,
+                    std::span<MessageA> message_as, std::span<absl::Status> statuses) const;
+  // Primary key range scans over [from, to), in key order.
+  gendb::Iterator<MetadataValue> ScanMetadataValues(const MetadataValueKey& from,
+                                                    const MetadataValueKey& to) const;
+  gendb::Iterator<MessageA> ScanMessageAs(gendb::tests::primitive::KeyEnum from_key,
+                                          gendb::tests::primitive::KeyEnum to_key) const;
+  // Sequence number of the last commit visible to this snapshot.
+  uint64_t sequence() const { return _snapshot.sequence(); }
+
+  // Frees the copies of the latest messages the lookups so far made, which a snapshot kept across
+  // many of them would otherwise accumulate. Messages they returned are invalid afterwards.
+  void ReleaseReadCopies() const { _snapshot.ReleaseReadCopies(); }
+
+ private:
+  friend class Db;
+  Snapshot(const Db& db, gendb::StorageSnapshot snapshot)
+      : _db(db), _snapshot(std::move(snapshot)) {}
+
+ private:
+  const Db& _db;
+  gendb::StorageSnapshot _snapshot;
+};
+
 class ScopedWrite {
  private:
   absl::Status GetMetadataValue(const MetadataValueKey& key, MetadataValue& metadata_value) const;
@@ -99,23 +302,57 @@ class ScopedWrite {
   absl::Status UpdateMessageA(gendb::tests::primitive::KeyEnum key, const MessagePatch& update);
 
  public:
+  // Throws std::runtime_error if the changes cannot be committed: see TryCommit().
   void Commit();
+  // Same as Commit(), but returns the error of the WAL if the changes cannot be logged, or an
+  // AbortedError if a commit handed off with CommitAsync() that this writer read failed to apply.
+  // The changes are dropped then, applying nothing, and the writer goes on without them.
+  absl::Status TryCommit();
+  // Hands the changes to the Db's apply thread, which applies them after those of earlier
+  // CommitAsync() calls, and releases the writer lock without waiting. The future becomes ready
+  // once readers see the changes, or holds an error if they were dropped: when they or a commit
+  // they read over fail to apply. The writer must not be used afterwards, only destroyed.
+  std::future<void> CommitAsync();
   ~ScopedWrite() = default;
 
  private:
   friend class Db;
-  ScopedWrite(Db& db, std::unique_lock<std::mutex> lock)
+  ScopedWrite(Db& db, std::unique_lock<gendb::OwnedMutex> lock)
       : _db(const_cast<Db&>(db)),
         _lock(std::move(lock)),
-        _layered_storage(_db._storage, &_temp_storage) {}
+        _pending(_db.PendingStorages(_dropped_commits)),
+        _layered_storage(_db._versioned_storage, &_temp_storage) {
+    if (!_pending.empty()) {
+      // The apply thread is changing the Db: read a snapshot of it, taken after the pending
+      // commits were listed so that none is missed.
+      _snapshot.emplace(_db._versioned_storage.GetSnapshot());
+      _layered_storage = gendb::LayeredStorage(*_snapshot, _pending, &_temp_storage);
+    }
+  }
+
+  // Waits for the pending commits to be applied, before reading the Db's indices.
+  void WaitForPending() const;
+
+  // Logs the changes made since the last call, if the Db has a WAL, and returns them in `logged`
+  // for Db::PublishChanges() once they are applied. Logs nothing on error.
+  absl::Status LogCommit(Db::LoggedChanges& logged);
 
   // Index update helpers
 
  private:
   Db& _db;
-  std::unique_lock<std::mutex> _lock;
+  std::unique_lock<gendb::OwnedMutex> _lock;
+  // Db::_dropped_commits as of `_pending`, set first.
+  uint64_t _dropped_commits = 0;
+  // Commits handed off and not applied when the writer was created, read over `_snapshot`.
+  std::vector<std::shared_ptr<const gendb::MemoryStorage>> _pending;
+  std::optional<gendb::StorageSnapshot> _snapshot;
   gendb::MemoryStorage _temp_storage;
   gendb::LayeredStorage _layered_storage;
+  // The changes for LogCommit(), recorded only when the Db has a WAL or a change stream subscriber
+  // as of the writer's creation.
+  bool _record_changes = _db.RecordsChanges();
+  gendb::WalBatch _wal_batch;
 };
 
 }  // namespace gendb::tests::primitive
@@ -0,0 +1,473 @@
+// AUTO GENERATED. DO NOT EDIT.
+//
+#include "rcu_database.h"
+
+#include <cstdint>
+#include <optional>
+#include <stdexcept>
+#include <string>
+
+#include "absl/status/status.h"
+#include "account.fbs.h"
+#include "gendb/bytes.h"
+#include "gendb/index.h"
+#include "gendb/iterator.h"
+#include "gendb/message_patch.h"
+#include "gendb/status.h"
+#include "gendb/wal_replay.h"
+#include "metadata.fbs.h"
+
+namespace gendb::tests::rcu {
+namespace {
+
+// Indexed values as the indices store them.
+std::optional<int32_t> AccountByAgeValue(const Account& account) {
+  if (!account.has_age()) {
+    return std::nullopt;
+  }
+  return account.age();
+}
+
+}  // namespace
+
+Db::Db(const gendb::WalOptions& wal_options) { OpenWal(wal_options, /*checkpoint_sequence=*/0); }
+
+void Db::OpenWal(const gendb::WalOptions& wal_options, uint64_t checkpoint_sequence) {
+  // Not published until it holds the whole log.
+  auto state = std::make_unique<DbState>();
+  // The log is replayed before `_wal` is set, so the replayed commits are not logged again.
+  gendb::ParallelWalReplay replay(state->storage, wal_options.replay_threads);
+  auto wal = std::make_unique<gendb::Wal>(
+      wal_options, [&](uint64_t sequence, gendb::BytesConstView record) {
+        if (sequence <= checkpoint_sequence) {
+          return absl::OkStatus();
+        }
+        // Segments are only removed once a checkpoint holds their records.
+        if (replay.records() == 0 && sequence != checkpoint_sequence + 1) {
+          return absl::DataLossError("WAL record " + std::to_string(checkpoint_sequence + 1) +
+                                     " is missing");
+        }
+        return replay.Add(record);
+      });
+  if (absl::Status status = replay.Finish(); !status.ok()) {
+    throw std::runtime_error("Failed to replay the WAL: " + status.ToString());
+  }
+  // Before WriteTo moves the replayed values out.
+  gendb::RebuildIndex(
+      replay, AccountCollId,
+      [](gendb::BytesConstView value) { return AccountByAgeValue(Account{value}); },
+      state->indices.account_by_age);
+  if (absl::Status status = replay.WriteTo(state->storage); !status.ok()) {
+    throw std::runtime_error("Failed to write the replayed WAL: " + status.ToString());
+  }
+  // The log may not reach the checkpoint: the sequence continues from the checkpoint's.
+  if (checkpoint_sequence > 0) {
+    if (absl::Status status = wal->RemoveThrough(checkpoint_sequence); !status.ok()) {
+      throw std::runtime_error("Failed to remove the checkpointed WAL: " + status.ToString());
+    }
+  }
+  delete _state.exchange(state.release(), std::memory_order_release);
+  _wal = std::move(wal);
+}
+
+Guard Db::SharedLock() const {
+  // The section is entered before the state is loaded, so a commit cannot free it in between.
+  return {_epochs.Enter(), _state.load(std::memory_order_acquire)};
+}
+
+Snapshot Db::Snapshot() const {
+  Guard guard = SharedLock();
+  return {std::make_shared<const DbState>(*guard._state)};
+}
+
+ScopedWrite Db::CreateWriter() {
+  return {*this, std::unique_lock<gendb::OwnedMutex>(_writer_mutex)};
+}
+
+absl::Status Guard::GetMetadataValue(const MetadataValueKey& key,
+                                     MetadataValue& metadata_value) const {
+  BytesConstView value;
+  RETURN_IF_ERROR(_layered_storage.Get(MetadataValueCollId, ToMetadataValueKey(key), value));
+  metadata_value = MetadataValue{value};
+  return absl::OkStatus();
+}
+
+void Guard::GetMetadataValues(std::span<const MetadataValueKey> keys,
+                              std::span<MetadataValue> metadata_values,
+                              std::span<absl::Status> statuses) const {
+  gendb::MultiGetMessages<MetadataValue>(
+      _layered_storage, MetadataValueCollId, keys,
+      [](const MetadataValueKey& key) { return ToMetadataValueKey(key); }, metadata_values,
+      statuses);
+}
+
+gendb::Iterator<MetadataValue> Guard::ScanMetadataValues(const MetadataValueKey& from,
+                                                         const MetadataValueKey& to) const {
+  _layered_storage.ReleasePins();
+  const auto begin_key = ToMetadataValueKey(from);
+  const auto end_key = ToMetadataValueKey(to);
+  return gendb::MakePrimaryKeyIterator<MetadataValue>(_state->storage, MetadataValueCollId,
+                                                      begin_key, end_key);
+}
+
+gendb::GetMessageAwaitable<MetadataValue, std::array<uint8_t, 8>> Guard::GetMetadataValueAsync(
+    const MetadataValueKey& key, MetadataValue& metadata_value,
+    gendb::AsyncReadQueue* queue) const {
+  return {_layered_storage, MetadataValueCollId, ToMetadataValueKey(key), metadata_value, queue};
+}
+
+absl::Status Snapshot::GetMetadataValue(const MetadataValueKey& key,
+                                        MetadataValue& metadata_value) const {
+  BytesConstView value;
+  RETURN_IF_ERROR(_layered_storage.Get(MetadataValueCollId, ToMetadataValueKey(key), value));
+  metadata_value = MetadataValue{value};
+  return absl::OkStatus();
+}
+
+void Snapshot::GetMetadataValues(std::span<const MetadataValueKey> keys,
+                                 std::span<MetadataValue> metadata_values,
+                                 std::span<absl::Status> statuses) const {
+  gendb::MultiGetMessages<MetadataValue>(
+      _layered_storage, MetadataValueCollId, keys,
+      [](const MetadataValueKey& key) { return ToMetadataValueKey(key); }, metadata_values,
+      statuses);
+}
+
+gendb::Iterator<MetadataValue> Snapshot::ScanMetadataValues(const MetadataValueKey& from,
+                                                            const MetadataValueKey& to) const {
+  const auto begin_key = ToMetadataValueKey(from);
+  const auto end_key = ToMetadataValueKey(to);
+  return gendb::MakePrimaryKeyIterator<MetadataValue>(_state->storage, MetadataValueCollId,
+                                                      begin_key, end_key);
+}
+
+absl::Status ScopedWrite::GetMetadataValue(const MetadataValueKey& key,
+                                           MetadataValue& metadata_value) const {
+  BytesConstView value;
+  RETURN_IF_ERROR(_layered_storage.Get(MetadataValueCollId, ToMetadataValueKey(key), value));
+  metadata_value = MetadataValue{value};
+  return absl::OkStatus();
+}
+
+absl::Status ScopedWrite::PutMetadataValue(const MetadataValueKey& key, Bytes metadata_value) {
+  auto key_ = ToMetadataValueKey(key);
+  if (_record_changes) {
+    _wal_batch.Put(MetadataValueCollId, key_, metadata_value);
+  }
+  _temp_storage.Put(MetadataValueCollId, key_, std::move(metadata_value));
+  return absl::OkStatus();
+}
+
+absl::Status ScopedWrite::UpdateMetadataValue(const MetadataValueKey& key,
+                                              const MessagePatch& update) {
+  Bytes* ptr = nullptr;
+  auto key_ = ToMetadataValueKey(key);
+  RETURN_IF_ERROR(_layered_storage.EnsureInTempStorage(MetadataValueCollId, key_, &ptr));
+  if (_record_changes) {
+    _wal_batch.Patch(MetadataValueCollId, key_, update);
+  }
+  gendb::ApplyPatch<MetadataValue>(update, *ptr);
+  return absl::OkStatus();
+}
+absl::Status Guard::GetAccount(uint64_t account_id, Account& account) const {
+  BytesConstView value;
+  RETURN_IF_ERROR(_layered_storage.Get(AccountCollId, ToAccountKey(account_id), value));
+  account = Account{value};
+  return absl::OkStatus();
+}
+
+void Guard::GetAccounts(std::span<const uint64_t> account_ids, std::span<Account> accounts,
+                        std::span<absl::Status> statuses) const {
+  gendb::MultiGetMessages<Account>(
+      _layered_storage, AccountCollId, account_ids,
+      [](uint64_t account_id) { return ToAccountKey(account_id); }, accounts, statuses);
+}
+
+gendb::Iterator<Account> Guard::ScanAccounts(uint64_t from_account_id,
+                                             uint64_t to_account_id) const {
+  _layered_storage.ReleasePins();
+  const auto begin_key = ToAccountKey(from_account_id);
+  const auto end_key = ToAccountKey(to_account_id);
+  return gendb::MakePrimaryKeyIterator<Account>(_state->storage, AccountCollId, begin_key,
+                                                end_key);
+}
+
+gendb::GetMessageAwaitable<Account, std::array<uint8_t, 8>> Guard::GetAccountAsync(
+    uint64_t account_id, Account& account, gendb::AsyncReadQueue* queue) const {
+  return {_layered_storage, AccountCollId, ToAccountKey(account_id), account, queue};
+}
+
+absl::Status Snapshot::GetAccount(uint64_t account_id, Account& account) const {
+  BytesConstView value;
+  RETURN_IF_ERROR(_layered_storage.Get(AccountCollId, ToAccountKey(account_id), value));
+  account = Account{value};
+  return absl::OkStatus();
+}
+
+void Snapshot::GetAccounts(std::span<const uint64_t> account_ids, std::span<Account> accounts,
+                           std::span<absl::Status> statuses) const {
+  gendb::MultiGetMessages<Account>(
+      _layered_storage, AccountCollId, account_ids,
+      [](uint64_t account_id) { return ToAccountKey(account_id); }, accounts, statuses);
+}
+
+gendb::Iterator<Account> Snapshot::ScanAccounts(uint64_t from_account_id,
+                                                uint64_t to_account_id) const {
+  const auto begin_key = ToAccountKey(from_account_id);
+  const auto end_key = ToAccountKey(to_account_id);
+  return gendb::MakePrimaryKeyIterator<Account>(_state->storage, AccountCollId, begin_key,
+                                                end_key);
+}
+
+absl::Status ScopedWrite::GetAccount(uint64_t account_id, Account& account) const {
+  BytesConstView value;
+  RETURN_IF_ERROR(_layered_storage.Get(AccountCollId, ToAccountKey(account_id), value));
+  account = Account{value};
+  return absl::OkStatus();
+}
+
+absl::Status ScopedWrite::PutAccount(uint64_t account_id, Bytes account) {
+  auto key_ = ToAccountKey(account_id);
+  MaybeUpdateAccountByAgeIndex(key_, account, /*update=*/nullptr);
+  if (_record_changes) {
+    _wal_batch.Put(AccountCollId, key_, account);
+  }
+  _temp_storage.Put(AccountCollId, key_, std::move(account));
+  return absl::OkStatus();
+}
+
+absl::Status ScopedWrite::UpdateAccount(uint64_t account_id, const MessagePatch& update) {
+  Bytes* ptr = nullptr;
+  auto key_ = ToAccountKey(account_id);
+  RETURN_IF_ERROR(_layered_storage.EnsureInTempStorage(AccountCollId, key_, &ptr));
+  MaybeUpdateAccountByAgeIndex(key_, *ptr, &update);
+  if (_record_changes) {
+    _wal_batch.Patch(AccountCollId, key_, update);
+  }
+  gendb::ApplyPatch<Account>(update, *ptr);
+  return absl::OkStatus();
+}
+
+absl::Status ScopedWrite::LogCommit(Db::LoggedChanges& logged) {
+  if (_wal_batch.empty()) {
+    return absl::OkStatus();
+  }
+  if (_db._wal != nullptr) {
+    absl::Status status = _db._wal->Append(_wal_batch);
+    if (!status.ok()) {
+      _wal_batch.Clear();
+      return status;
+    }
+    logged.wal_sequence = _db._wal->LastSequence();
+  }
+  if (_db._change_stream.active()) {
+    logged.batch = std::move(_wal_batch);
+  }
+  _wal_batch.Clear();
+  return absl::OkStatus();
+}
+
+void ScopedWrite::Commit() {
+  absl::Status status = TryCommit();
+  if (!status.ok()) {
+    throw std::runtime_error("Failed to commit: " + status.ToString());
+  }
+}
+
+void Db::PublishChanges(LoggedChanges&& changes) {
+  if (changes.batch.empty() || !_change_stream.active()) {
+    return;
+  }
+  const uint64_t sequence =
+      _wal != nullptr ? changes.wal_sequence : _change_stream.LastSequence() + 1;
+  _change_stream.Publish(sequence, std::move(changes.batch));
+}
+
+void Db::DiscardChanges(const LoggedChanges& changes) {
+  if (_wal != nullptr && changes.wal_sequence != 0) {
+    // A failure leaves the WAL failing the next commits, which report it.
+    (void)_wal->Retract(changes.wal_sequence);
+  }
+}
+
+gendb::Iterator<Account> Guard::GetAccountByAgeRange(int32_t min_age, int32_t max_age) const {
+  _layered_storage.ReleasePins();
+  return gendb::MakeSecondaryIndexIterator<Account, Indices::AccountByAgeIndexType>(
+      _layered_storage, AccountCollId, _state->indices.account_by_age.lower_bound(min_age),
+      _state->indices.account_by_age.lower_bound(max_age));
+}
+
+gendb::Iterator<Account> Guard::GetAccountByAgeEqual(int32_t age) const {
+  _layered_storage.ReleasePins();
+  return gendb::MakeSecondaryIndexIterator<Account, Indices::AccountByAgeIndexType>(
+      _layered_storage, AccountCollId, _state->indices.account_by_age.lower_bound(age),
+      _state->indices.account_by_age.upper_bound(age));
+}
+
+gendb::AsyncIndexIterator<Account, Indices::AccountByAgeIndexType> Guard::GetAccountByAgeRangeAsync(
+    int32_t min_age, int32_t max_age, gendb::AsyncReadQueue* queue) const {
+  _layered_storage.ReleasePins();
+  return {_layered_storage, AccountCollId,
+          gendb::SingleSetIterator<Indices::AccountByAgeIndexType>(
+              _state->indices.account_by_age.lower_bound(min_age),
+              _state->indices.account_by_age.lower_bound(max_age)),
+          queue};
+}
+
+gendb::Iterator<Account> Snapshot::GetAccountByAgeRange(int32_t min_age, int32_t max_age) const {
+  return gendb::MakeSecondaryIndexIterator<Account, Indices::AccountByAgeIndexType>(
+      _layered_storage, AccountCollId, _state->indices.account_by_age.lower_bound(min_age),
+      _state->indices.account_by_age.lower_bound(max_age));
+}
+
+gendb::Iterator<Account> Snapshot::GetAccountByAgeEqual(int32_t age) const {
+  return gendb::MakeSecondaryIndexIterator<Account, Indices::AccountByAgeIndexType>(
+      _layered_storage, AccountCollId, _state->indices.account_by_age.lower_bound(age),
+      _state->indices.account_by_age.upper_bound(age));
+}
+
+gendb::Iterator<Account> ScopedWrite::GetAccountByAgeRange(int32_t min_age, int32_t max_age) const {
+  return gendb::MakeSecondaryIndexIterator<Account, Indices::AccountByAgeIndexType>(
+      _layered_storage, AccountCollId, _draft->indices.account_by_age.lower_bound(min_age),
+      _draft->indices.account_by_age.lower_bound(max_age),
+      _temp_indices.account_by_age.lower_bound(min_age),
+      _temp_indices.account_by_age.lower_bound(max_age));
+}
+
+gendb::Iterator<Account> ScopedWrite::GetAccountByAgeEqual(int32_t age) const {
+  return gendb::MakeSecondaryIndexIterator<Account, Indices::AccountByAgeIndexType>(
+      _layered_storage, AccountCollId, _draft->indices.account_by_age.lower_bound(age),
+      _draft->indices.account_by_age.upper_bound(age),
+      _temp_indices.account_by_age.lower_bound(age), _temp_indices.account_by_age.upper_bound(age));
+}
+
+void ScopedWrite::MaybeUpdateAccountByAgeIndex(std::array<uint8_t, sizeof(uint64_t)> key,
+                                               gendb::BytesConstView account_buffer,
+                                               const MessagePatch* update) {
+  std::optional<int32_t> age_before = std::nullopt;
+  std::optional<int32_t> age_after = std::nullopt;
+  if (update != nullptr && !DoModifyField(*update, Account::Age)) {
+    // This is update op which doesn't touch the indexed field.
+    return;
+  }
+  Account account{account_buffer};
+  if (account.has_age()) {
+    age_before = account.age();
+  }
+  if (update != nullptr) {
+    Account account_update{update->buffer};
+    if (account_update.has_age()) {
+      age_after = account_update.age();
+    }
+  }
+  if (age_before.has_value()) {
+    _temp_indices.account_by_age.Insert(age_before.value(), key,
+                                        /*is_deleted=*/update != nullptr);
+  }
+  if (age_after.has_value()) {
+    _temp_indices.account_by_age.Insert(age_after.value(), key);
+  }
+}
+
+absl::Status ScopedWrite::TakeSequenceIds(SequenceMetadataId sequence, int32_t count,
+                                          int32_t& last_id) {
+  MetadataValue value;
+  MetadataValueKey key{.type = MetadataType::kSequence, .id = static_cast<uint32_t>(sequence)};
+  auto status = GetMetadataValue(key, value);
+  if (status.code() == absl::StatusCode::kNotFound) {
+    RETURN_IF_ERROR(PutMetadataValue(key, MetadataValueBuilder().set_int_value(count).Build()));
+    last_id = count;
+  } else if (!status.ok()) {
+    return status;
+  } else {
+    if (value.int_value() > INT32_MAX - count) {
+      return absl::OutOfRangeError("Sequence " + std::to_string(key.id) + " is out of ids");
+    }
+    int new_last_id = value.int_value() + count;
+    RETURN_IF_ERROR(
+        UpdateMetadataValue(key, MetadataValuePatchBuilder().set_int_value(new_last_id).Build()));
+    last_id = new_last_id;
+  }
+  return absl::OkStatus();
+}
+
+absl::Status Db::NextBlockSequenceId(SequenceMetadataId sequence, int32_t& next_id) {
+  // Checked on every call, not only when a block runs out, so that the misuse does not depend on
+  // how many ids are left.
+  if (_writer_mutex.HeldByThisThread()) {
+    return absl::FailedPreconditionError(
+        "Db::Next... called on a thread holding a writer, which reserving ids would wait for");
+  }
+  SequenceBlock& block = _sequence_blocks[static_cast<uint32_t>(sequence)];
+  while (true) {
+    // A new block is stored before its end, so an id read below `end` belongs to this block.
+    const int64_t end = block.end.load(std::memory_order_acquire);
+    int64_t id = block.next.load(std::memory_order_relaxed);
+    while (id < end) {
+      if (block.next.compare_exchange_weak(id, id + 1, std::memory_order_relaxed)) {
+        next_id = static_cast<int32_t>(id);
+        return absl::OkStatus();
+      }
+    }
+    std::lock_guard lock(block.mutex);
+    if (block.next.load(std::memory_order_relaxed) < block.end.load(std::memory_order_relaxed)) {
+      // Another thread reserved a block meanwhile.
+      continue;
+    }
+    int32_t first_id = 0;
+    RETURN_IF_ERROR(ReserveSequenceIds(sequence, first_id));
+    block.next.store(first_id, std::memory_order_relaxed);
+    block.end.store(int64_t{first_id} + kSequenceBlockSize, std::memory_order_release);
+  }
+}
+
+absl::Status Db::ReserveSequenceIds(SequenceMetadataId sequence, int32_t& first_id) {
+  int32_t last_id = 0;
+  auto writer = CreateWriter();
+  RETURN_IF_ERROR(writer.TakeSequenceIds(sequence, kSequenceBlockSize, last_id));
+  RETURN_IF_ERROR(writer.TryCommit());
+  first_id = last_id - kSequenceBlockSize + 1;
+  return absl::OkStatus();
+}
+
+absl::Status ScopedWrite::NextAccountIdSequence(uint64_t& next_id) {
+  int32_t last_id = 0;
+  RETURN_IF_ERROR(TakeSequenceIds(SequenceMetadataId::AccountIdSequence, 1, last_id));
+  next_id = last_id;
+  return absl::OkStatus();
+}
+
+absl::Status Db::NextAccountIdSequence(uint64_t& next_id) {
+  int32_t id = 0;
+  RETURN_IF_ERROR(NextBlockSequenceId(SequenceMetadataId::AccountIdSequence, id));
+  next_id = id;
+  return absl::OkStatus();
+}
+
+absl::Status ScopedWrite::TryCommit() {
+  Db::LoggedChanges logged;
+  absl::Status status = LogCommit(logged);
+  if (!status.ok()) {
+    // Nothing was logged: the writer goes on without the changes.
+    _temp_storage.Clear();
+    _temp_indices = {};
+    return status;
+  }
+  try {
+    // Readers never see the draft: it is only published as a whole, below.
+    _layered_storage.MergeTempStorage();
+    _draft->indices.MergeTempIndices(std::move(_temp_indices));
+  } catch (...) {
+    _db.DiscardChanges(logged);
+    throw;
+  }
+  ++_draft->sequence;
+  // The published copy shares every node with the draft, which stays with this writer so it can
+  // keep writing. The replaced state is freed once the Guards that loaded it are gone.
+  const DbState* replaced = _db._state.exchange(new DbState(*_draft), std::memory_order_acq_rel);
+  _db._epochs.Retire(std::unique_ptr<const DbState>(replaced));
+  _db.PublishChanges(std::move(logged));
+  return absl::OkStatus();
+}
+
+}  // namespace gendb::tests::rcu
@@ -0,0 +1,314 @@
+// AUTO GENERATED. DO NOT EDIT.
+//
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <span>
+
+#include "absl/status/status.h"
+#include "gendb/async_read.h"
+#include "account.fbs.h"
+#include "gendb/bytes.h"
+#include "gendb/change_stream.h"
+#include "gendb/epoch.h"
+#include "gendb/index.h"
+#include "gendb/iterator.h"
+#include "gendb/key_codec.h"
+#include "gendb/layered_storage.h"
+#include "gendb/message_patch.h"
+#include "gendb/owned_mutex.h"
+#include "gendb/persistent_storage.h"
+#include "gendb/wal.h"
+#include "metadata.fbs.h"
+
+namespace gendb::tests::rcu {
+
+// Forward declarations.
+class Guard;
+class Snapshot;
+class ScopedWrite;
+
+enum class SequenceMetadataId : uint32_t {
+  AccountIdSequence = 0,
+};
+
+enum CollectionId {
+  MetadataValueCollId = 0,
+  AccountCollId = 1,
+};
+
+// Collection keys getters.
+struct MetadataValueKey {
+  gendb::MetadataType type;
+  uint32_t id;
+};
+
+inline std::array<uint8_t, 8> ToMetadataValueKey(const MetadataValueKey& key) {
+  std::array<uint8_t, 8> key_raw;
+  internal::key_codec::EncodeTupleToView<std::tuple<gendb::MetadataType, uint32_t>>(
+      {key.type, key.id}, key_raw);
+  return key_raw;
+}
+
+inline std::array<uint8_t, 8> ToMetadataValueKey(MetadataValue metadata_value) {
+  std::array<uint8_t, 8> key_raw;
+  internal::key_codec::EncodeTupleToView<std::tuple<gendb::MetadataType, uint32_t>>(
+      {metadata_value.type(), metadata_value.id()}, key_raw);
+  return key_raw;
+}
+inline std::array<uint8_t, 8> ToAccountKey(uint64_t account_id) {
+  std::array<uint8_t, 8> key_raw;
+  internal::key_codec::EncodeTupleToView<std::tuple<uint64_t>>({account_id}, key_raw);
+  return key_raw;
+}
+
+inline std::array<uint8_t, 8> ToAccountKey(Account account) {
+  return ToAccountKey(account.account_id());
+}
+
+struct Indices {
+  using AccountByAgeIndexType =
+      gendb::PersistentIndex</*age*/ int32_t, std::array<uint8_t, sizeof(uint64_t)>>;
+  AccountByAgeIndexType account_by_age;
+
+  void MergeTempIndices(Indices&& temp_indices) {
+    account_by_age.MergeTempIndex(std::move(temp_indices.account_by_age));
+  }
+};
+
+// Everything readers see. A published state is never modified: commits copy it, which only shares
+// its trees, apply their changes to the copy and publish that.
+struct DbState {
+  // Number of commits applied.
+  uint64_t sequence = 0;
+  gendb::PersistentStorage storage;
+  Indices indices;
+};
+
+class Db {
+ public:
+  // RocksDB column family tuning per CollectionId, from the `storage:` blocks of the schema. Pass
+  // it to gendb::RocksDBStorage when persisting the collections.
+  static constexpr std::array<gendb::CollectionTuning, 2> kCollectionTuning = {
+      gendb::CollectionTuning{.prefix_length = 4},
+      gendb::CollectionTuning{},
+  };
+
+  Db() = default;
+  // Recovers the commits logged in `wal_options.dir`, then logs each commit there before applying
+  // it. Throws std::runtime_error if the log cannot be replayed.
+  explicit Db(const gendb::WalOptions& wal_options);
+
+  ~Db() { delete _state.load(std::memory_order_relaxed); }
+
+  // Reads the state published by the last commit. Takes no lock, so commits never wait for it,
+  // but it keeps that state alive: hold it briefly and prefer Snapshot for long reads.
+  Guard SharedLock() const;
+  // Consistent view as of the last commit that may be kept for any time (see Snapshot).
+  class Snapshot Snapshot() const;
+  ScopedWrite CreateWriter();
+
+  // Change data capture: each commit, as a batch numbered like its WAL record if the Db has a WAL,
+  // and in commit order otherwise. Commits are published once something subscribed, except those
+  // of writers created before that.
+  gendb::ChangeStream& Changes() { return _change_stream; }
+
+  // Ids the Db reserves at a time for the Next... methods below.
+  static constexpr int32_t kSequenceBlockSize = 1000;
+  // Take the next id of a sequence without a writer, from an in-memory block of
+  // kSequenceBlockSize ids reserved with a single commit. Unlike ScopedWrite's, an id taken is
+  // never handed out again, even if nothing commits it, and the rest of the block is skipped once
+  // the Db is closed. Thread-safe; OutOfRangeError once a block would pass INT32_MAX.
+  // FailedPreconditionError on a thread that holds a writer, whose lock reserving a block takes.
+  absl::Status NextAccountIdSequence(uint64_t& next_id);
+
+ private:
+  friend class Guard;
+  friend class Snapshot;
+  friend class ScopedWrite;
+
+  // Replays the WAL over the state the Db holds, skipping the records up to `checkpoint_sequence`
+  // that its checkpoint already holds.
+  void OpenWal(const gendb::WalOptions& wal_options, uint64_t checkpoint_sequence);
+  // Whether writers record their changes, for the WAL or the change stream.
+  bool RecordsChanges() const { return _wal != nullptr || _change_stream.active(); }
+
+  // A commit's changes, logged and held back from the change stream until they are applied.
+  struct LoggedChanges {
+    // The WAL record holding them, or 0 without a WAL.
+    uint64_t wal_sequence = 0;
+    gendb::WalBatch batch;
+  };
+  // Publishes logged changes to the change stream, once readers of the Db see them.
+  void PublishChanges(LoggedChanges&& changes);
+  // Erases the WAL record of logged changes that failed to apply, so that opening the Db does not
+  // replay them. If it cannot, the WAL fails every later commit.
+  void DiscardChanges(const LoggedChanges& changes);
+  absl::Status NextBlockSequenceId(SequenceMetadataId sequence, int32_t& next_id);
+  // Commits the reservation of the next kSequenceBlockSize ids, the first of which is `first_id`.
+  absl::Status ReserveSequenceIds(SequenceMetadataId sequence, int32_t& first_id);
+
+  // Knows its holder, so that the Next... methods fail on a writer's thread instead of waiting.
+  gendb::OwnedMutex _writer_mutex;
+  // States replaced by commits are freed once the Guards that loaded them are gone.
+  mutable gendb::EpochManager _epochs;
+  std::atomic<const DbState*> _state = new DbState();
+  // Set when the Db was opened with a WAL.
+  std::unique_ptr<gendb::Wal> _wal;
+  gendb::ChangeStream _change_stream;
+  // The ids of a sequence's block are handed out by moving `next` up to `end`. A new block is
+  // reserved under `mutex` once it runs out.
+  struct SequenceBlock {
+    std::atomic<int64_t> next = 0;
+    std::atomic<int64_t> end = 0;
+    std::mutex mutex;
+  };
+  std::array<SequenceBlock, 1> _sequence_blocks;
+};
+
+class Guard {
+ public:
+  absl::Status GetMetadataValue(const MetadataValueKey& key, MetadataValue& metadata_value) const;
+  absl::Status GetAccount(uint64_t account_id, Account& account) const;
+  // Batched point reads: `statuses[i]` and, when OK, the i-th message receive the result for the
+  // i-th key.
+  void GetMetadataValues(std::span<const MetadataValueKey> keys,
+                         std::span<MetadataValue> metadata_values,
+                         std::span<absl::Status> statuses) const;
+  void GetAccounts(std::span<const uint64_t> account_ids, std::span<Account> accounts,
+                   std::span<absl::Status> statuses) const;
+  // Primary key range scans over [from, to), in key order.
+  gendb::Iterator<MetadataValue> ScanMetadataValues(const MetadataValueKey& from,
+                                                    const MetadataValueKey& to) const;
+  gendb::Iterator<Account> ScanAccounts(uint64_t from_account_id, uint64_t to_account_id) const;
+  gendb::Iterator<Account> GetAccountByAgeRange(int32_t min_age, int32_t max_age) const;
+  gendb::Iterator<Account> GetAccountByAgeEqual(int32_t age) const;
+  // Reads to `co_await` from a coroutine (see gendb/async_read.h). In memory they complete without
+  // suspending; reads of a storage that blocks wait for `queue` to be flushed, if one is given.
+  // The guard must outlive the returned awaitables and iterators.
+  gendb::GetMessageAwaitable<MetadataValue, std::array<uint8_t, 8>> GetMetadataValueAsync(
+      const MetadataValueKey& key, MetadataValue& metadata_value,
+      gendb::AsyncReadQueue* queue = nullptr) const;
+  gendb::GetMessageAwaitable<Account, std::array<uint8_t, 8>> GetAccountAsync(
+      uint64_t account_id, Account& account, gendb::AsyncReadQueue* queue = nullptr) const;
+  gendb::AsyncIndexIterator<Account, Indices::AccountByAgeIndexType> GetAccountByAgeRangeAsync(
+      int32_t min_age, int32_t max_age, gendb::AsyncReadQueue* queue = nullptr) const;
+  // Messages read from a storage that pins its read buffers stay valid until the guard is
+  // destroyed or until this releases the buffers, for guards kept across many reads. Scans, whose
+  // iterators pin the buffers they read themselves, release them too: a guard only holds those of
+  // the reads since its last scan.
+  void ReleasePins() const { _layered_storage.ReleasePins(); }
+  ~Guard() = default;
+
+ private:
+  friend class Db;
+  Guard(gendb::EpochManager::ReadSection epoch, const DbState* state)
+      : _epoch(std::move(epoch)),
+        _state(state),
+        _layered_storage(const_cast<gendb::PersistentStorage&>(_state->storage),
+                         /*temp_storage_ptr=*/nullptr) {}
+
+ private:
+  // Keeps `_state` from being freed by later commits.
+  gendb::EpochManager::ReadSection _epoch;
+  const DbState* _state;
+  const gendb::LayeredStorage _layered_storage;
+};
+
+// Consistent read-only view of the Db as of the last commit before it was taken. It owns a copy of
+// that state, which shares every node with it, so it neither blocks commits nor holds back the
+// reclamation of later states. Returned messages stay valid for the lifetime of the snapshot.
+class Snapshot {
+ public:
+  absl::Status GetMetadataValue(const MetadataValueKey& key, MetadataValue& metadata_value) const;
+  absl::Status GetAccount(uint64_t account_id, Account& account) const;
+  // Batched point reads: `statuses[i]` and, when OK, the i-th message receive the result for the
+  // i-th key.
+  void GetMetadataValues(std::span<const MetadataValueKey> keys,
+                         std::span<MetadataValue> metadata_values,
+                         std::span<absl::Status> statuses) const;
+  void GetAccounts(std::span<const uint64_t> account_ids, std::span<Account> accounts,
+                   std::span<absl::Status> statuses) const;
+  // Primary key range scans over [from, to), in key order.
+  gendb::Iterator<MetadataValue> ScanMetadataValues(const MetadataValueKey& from,
+                                                    const MetadataValueKey& to) const;
+  gendb::Iterator<Account> ScanAccounts(uint64_t from_account_id, uint64_t to_account_id) const;
+  gendb::Iterator<Account> GetAccountByAgeRange(int32_t min_age, int32_t max_age) const;
+  gendb::Iterator<Account> GetAccountByAgeEqual(int32_t age) const;
+
+  // Sequence number of the last commit visible to this snapshot.
+  uint64_t sequence() const { return _state->sequence; }
+
+ private:
+  friend class Db;
+  Snapshot(std::shared_ptr<const DbState> state)
+      : _state(std::move(state)),
+        _layered_storage(const_cast<gendb::PersistentStorage&>(_state->storage),
+                         /*temp_storage_ptr=*/nullptr) {}
+
+ private:
+  std::shared_ptr<const DbState> _state;
+  const gendb::LayeredStorage _layered_storage;
+};
+
+class ScopedWrite {
+ private:
+  absl::Status GetMetadataValue(const MetadataValueKey& key, MetadataValue& metadata_value) const;
+  absl::Status PutMetadataValue(const MetadataValueKey& key, std::vector<uint8_t> metadata_value);
+  absl::Status UpdateMetadataValue(const MetadataValueKey& key, const MessagePatch& update);
+
+ public:
+  absl::Status GetAccount(uint64_t account_id, Account& account) const;
+  absl::Status PutAccount(uint64_t account_id, std::vector<uint8_t> account);
+  absl::Status UpdateAccount(uint64_t account_id, const MessagePatch& update);
+
+ public:
+  gendb::Iterator<Account> GetAccountByAgeRange(int32_t min_age, int32_t max_age) const;
+  gendb::Iterator<Account> GetAccountByAgeEqual(int32_t age) const;
+
+  absl::Status NextAccountIdSequence(uint64_t& next_id);
+  // Throws std::runtime_error if the changes cannot be committed: see TryCommit().
+  void Commit();
+  // Same as Commit(), but returns the error of the WAL if the changes cannot be logged. The changes
+  // are dropped then, applying nothing, and the writer goes on without them.
+  absl::Status TryCommit();
+  ~ScopedWrite() = default;
+
+ private:
+  friend class Db;
+  ScopedWrite(Db& db, std::unique_lock<gendb::OwnedMutex> lock)
+      : _db(db),
+        _lock(std::move(lock)),
+        _draft(std::make_unique<DbState>(*_db._state.load(std::memory_order_relaxed))),
+        _layered_storage(_draft->storage, &_temp_storage) {}
+
+  // Takes `count` consecutive ids of the sequence, the last of which is `last_id`.
+  absl::Status TakeSequenceIds(SequenceMetadataId sequence, int32_t count, int32_t& last_id);
+
+  // Logs the changes made since the last call, if the Db has a WAL, and returns them in `logged`
+  // for Db::PublishChanges() once they are applied. Logs nothing on error.
+  absl::Status LogCommit(Db::LoggedChanges& logged);
+
+  // Index update helpers
+  void MaybeUpdateAccountByAgeIndex(std::array<uint8_t, sizeof(uint64_t)> key,
+                                    gendb::BytesConstView account_buffer,
+                                    const MessagePatch* update);
+
+ private:
+  Db& _db;
+  std::unique_lock<gendb::OwnedMutex> _lock;
+  // The next state: a copy of the published one that Commit() applies the changes to.
+  std::unique_ptr<DbState> _draft;
+  gendb::MemoryStorage _temp_storage;
+  Indices _temp_indices;
+  gendb::LayeredStorage _layered_storage;
+  // The changes for LogCommit(), recorded only when the Db has a WAL or a change stream subscriber
+  // as of the writer's creation.
+  bool _record_changes = _db.RecordsChanges();
+  gendb::WalBatch _wal_batch;
+};
+
+}  // namespace gendb::tests::rcu
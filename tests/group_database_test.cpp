@@ -0,0 +1,321 @@
+#include "generated/group_database.h"
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <filesystem>
+#include <random>
+#include <set>
+#include <thread>
+#include <vector>
+
+#include "account.fbs.h"
+
+using namespace gendb::tests::group;
+
+using gendb::MetadataType;
+using gendb::MetadataValue;
+using gendb::tests::Account;
+using gendb::tests::AccountBuilder;
+using gendb::tests::AccountPatchBuilder;
+
+namespace {
+
+std::vector<uint64_t> Ids(gendb::Iterator<Account> it) {
+  std::vector<uint64_t> ids;
+  for (; it.Valid(); it.Next()) {
+    ids.push_back(it.Value().account_id());
+  }
+  return ids;
+}
+
+void PutAccount(Db& db, uint64_t id, int32_t age) {
+  auto writer = db.CreateWriter();
+  EXPECT_TRUE(writer.PutAccount(id, AccountBuilder().set_account_id(id).set_age(age).Build()).ok());
+  writer.Commit();
+}
+
+TEST(GroupDbTest, ReadsCommittedWrites) {
+  Db db;
+  {
+    auto writer = db.CreateWriter();
+    for (uint64_t id : {3, 1, 2}) {
+      EXPECT_TRUE(writer
+                      .PutAccount(id, AccountBuilder()
+                                          .set_account_id(id)
+                                          .set_age(static_cast<int32_t>(id * 10))
+                                          .set_name("v1")
+                                          .Build())
+                      .ok());
+    }
+    EXPECT_THAT(Ids(writer.GetAccountByAgeRange(0, 100)), ::testing::ElementsAre(1, 2, 3));
+    writer.Commit();
+  }
+  {
+    auto writer = db.CreateWriter();
+    EXPECT_TRUE(writer.UpdateAccount(2, AccountPatchBuilder().set_age(5).Build()).ok());
+    writer.Commit();
+  }
+
+  auto guard = db.SharedLock();
+  Account account;
+  EXPECT_TRUE(guard.GetAccount(1, account).ok());
+  EXPECT_EQ(account.name(), "v1");
+  EXPECT_THAT(Ids(guard.ScanAccounts(0, 100)), ::testing::ElementsAre(1, 2, 3));
+  EXPECT_THAT(Ids(guard.GetAccountByAgeRange(0, 100)), ::testing::ElementsAre(2, 1, 3));
+  EXPECT_THAT(Ids(guard.GetAccountByAgeEqual(20)), ::testing::IsEmpty());
+}
+
+TEST(GroupDbTest, PutReplacesIndexRecord) {
+  Db db;
+  PutAccount(db, 1, 10);
+  PutAccount(db, 1, 20);
+  auto guard = db.SharedLock();
+  EXPECT_THAT(Ids(guard.GetAccountByAgeEqual(10)), ::testing::IsEmpty());
+  EXPECT_THAT(Ids(guard.GetAccountByAgeEqual(20)), ::testing::ElementsAre(1));
+}
+
+TEST(GroupDbTest, WriterReadsItsStateUntilCommit) {
+  Db db;
+  PutAccount(db, 1, 10);
+  {
+    auto writer = db.CreateWriter();
+    Account account;
+    EXPECT_TRUE(writer.GetAccount(1, account).ok());
+    EXPECT_EQ(account.age(), 10);
+
+    // Open writers do not hold back other commits.
+    std::thread other([&] { PutAccount(db, 1, 20); });
+    other.join();
+    EXPECT_TRUE(writer.GetAccount(1, account).ok());
+    EXPECT_EQ(account.age(), 10);
+    EXPECT_THAT(Ids(writer.GetAccountByAgeEqual(10)), ::testing::ElementsAre(1));
+    EXPECT_TRUE(writer.PutAccount(2, AccountBuilder().set_account_id(2).set_age(30).Build()).ok());
+    writer.Commit();
+    // Once committed, `writer` reads the latest state.
+    EXPECT_TRUE(writer.GetAccount(1, account).ok());
+    EXPECT_EQ(account.age(), 20);
+  }
+
+  auto guard = db.SharedLock();
+  Account account;
+  EXPECT_TRUE(guard.GetAccount(1, account).ok());
+  EXPECT_EQ(account.age(), 20);
+  EXPECT_THAT(Ids(guard.GetAccountByAgeRange(0, 100)), ::testing::ElementsAre(1, 2));
+}
+
+TEST(GroupDbTest, ConcurrentWritersCommitEverything) {
+  constexpr int kThreads = 8;
+  constexpr int kCommitsPerThread = 100;
+  Db db;
+  std::vector<std::vector<uint64_t>> ids(kThreads);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreads; ++t) {
+    threads.emplace_back([&, t] {
+      for (int i = 0; i < kCommitsPerThread; ++i) {
+        auto writer = db.CreateWriter();
+        uint64_t id = 0;
+        ASSERT_TRUE(writer.NextAccountIdSequence(id).ok());
+        ASSERT_TRUE(
+            writer.PutAccount(id, AccountBuilder().set_account_id(id).set_age(t).Build()).ok());
+        writer.Commit();
+        ids[t].push_back(id);
+      }
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+
+  std::set<uint64_t> unique_ids;
+  auto guard = db.SharedLock();
+  for (int t = 0; t < kThreads; ++t) {
+    unique_ids.insert(ids[t].begin(), ids[t].end());
+    EXPECT_THAT(Ids(guard.GetAccountByAgeEqual(t)), ::testing::UnorderedElementsAreArray(ids[t]));
+  }
+  EXPECT_EQ(unique_ids.size(), kThreads * kCommitsPerThread);
+  EXPECT_EQ(Ids(guard.ScanAccounts(0, UINT64_MAX)).size(), kThreads * kCommitsPerThread);
+  MetadataValue sequence;
+  ASSERT_TRUE(guard
+                  .GetMetadataValue({.type = MetadataType::kSequence,
+                                     .id = static_cast<uint32_t>(
+                                         SequenceMetadataId::AccountIdSequence)},
+                                    sequence)
+                  .ok());
+  EXPECT_EQ(sequence.int_value(), kThreads * kCommitsPerThread);
+}
+
+TEST(GroupDbTest, IndexFollowsLastCommitOfConflictingWriters) {
+  constexpr int kThreads = 4;
+  Db db;
+  PutAccount(db, 1, 0);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreads; ++t) {
+    threads.emplace_back([&, t] {
+      for (int i = 0; i < 200; ++i) {
+        auto writer = db.CreateWriter();
+        EXPECT_TRUE(writer.UpdateAccount(1, AccountPatchBuilder().set_age(t * 1000 + i).Build())
+                        .ok());
+        writer.Commit();
+      }
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+
+  auto guard = db.SharedLock();
+  Account account;
+  ASSERT_TRUE(guard.GetAccount(1, account).ok());
+  EXPECT_THAT(Ids(guard.GetAccountByAgeRange(0, kThreads * 1000)), ::testing::ElementsAre(1));
+  EXPECT_THAT(Ids(guard.GetAccountByAgeEqual(account.age())), ::testing::ElementsAre(1));
+}
+
+TEST(GroupDbTest, ConcurrentPatchesOfOneMessageKeepEveryField) {
+  constexpr int kCommits = 300;
+  Db db;
+  PutAccount(db, 1, 0);
+  std::thread balance_writer([&] {
+    for (int i = 1; i <= kCommits; ++i) {
+      auto writer = db.CreateWriter();
+      EXPECT_TRUE(writer.UpdateAccount(1, AccountPatchBuilder().set_balance(i).Build()).ok());
+      writer.Commit();
+    }
+  });
+  std::thread age_writer([&] {
+    for (int i = 1; i <= kCommits; ++i) {
+      auto writer = db.CreateWriter();
+      EXPECT_TRUE(writer.UpdateAccount(1, AccountPatchBuilder().set_age(i).Build()).ok());
+      writer.Commit();
+    }
+  });
+  balance_writer.join();
+  age_writer.join();
+
+  auto guard = db.SharedLock();
+  Account account;
+  ASSERT_TRUE(guard.GetAccount(1, account).ok());
+  EXPECT_EQ(account.balance(), kCommits);
+  EXPECT_EQ(account.age(), kCommits);
+  EXPECT_THAT(Ids(guard.GetAccountByAgeEqual(kCommits)), ::testing::ElementsAre(1));
+}
+
+TEST(GroupDbTest, WalRecoversBatchedCommits) {
+  constexpr int kThreads = 4;
+  constexpr int kCommitsPerThread = 50;
+  gendb::WalOptions options;
+  options.dir = (std::filesystem::temp_directory_path() /
+                 ("group_db_wal_test_" + std::to_string(std::random_device{}())))
+                    .string();
+  options.sync = gendb::WalSyncPolicy::kNone;
+  std::filesystem::remove_all(options.dir);
+  {
+    Db db(options);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < kThreads; ++t) {
+      threads.emplace_back([&, t] {
+        for (int i = 0; i < kCommitsPerThread; ++i) {
+          auto writer = db.CreateWriter();
+          uint64_t id = 0;
+          ASSERT_TRUE(writer.NextAccountIdSequence(id).ok());
+          ASSERT_TRUE(
+              writer.PutAccount(id, AccountBuilder().set_account_id(id).set_age(t).Build()).ok());
+          writer.Commit();
+        }
+      });
+    }
+    for (std::thread& thread : threads) {
+      thread.join();
+    }
+  }
+
+  Db db(options);
+  {
+    auto guard = db.SharedLock();
+    EXPECT_EQ(Ids(guard.ScanAccounts(0, UINT64_MAX)).size(), kThreads * kCommitsPerThread);
+    EXPECT_EQ(Ids(guard.GetAccountByAgeRange(0, kThreads)).size(), kThreads * kCommitsPerThread);
+  }
+  // Commits may be batched in another order than their ids were taken: the last id taken is
+  // recovered all the same.
+  auto writer = db.CreateWriter();
+  uint64_t id = 0;
+  ASSERT_TRUE(writer.NextAccountIdSequence(id).ok());
+  EXPECT_EQ(id, kThreads * kCommitsPerThread + 1);
+  std::filesystem::remove_all(options.dir);
+}
+
+TEST(GroupDbTest, TryCommitReturnsWalErrors) {
+  gendb::WalOptions options;
+  options.dir = (std::filesystem::temp_directory_path() /
+                 ("group_db_try_commit_test_" + std::to_string(std::random_device{}())))
+                    .string();
+  std::filesystem::remove_all(options.dir);
+  // Every batch opens a segment of its own, which fails while the directory is gone.
+  options.segment_size = 1;
+  Db db(options);
+  std::filesystem::remove_all(options.dir);
+  auto writer = db.CreateWriter();
+  ASSERT_TRUE(writer.PutAccount(1, AccountBuilder().set_account_id(1).Build()).ok());
+  EXPECT_FALSE(writer.TryCommit().ok());
+
+  std::filesystem::create_directories(options.dir);
+  ASSERT_TRUE(writer.PutAccount(2, AccountBuilder().set_account_id(2).Build()).ok());
+  EXPECT_TRUE(writer.TryCommit().ok());
+  {
+    auto guard = db.SharedLock();
+    EXPECT_THAT(Ids(guard.ScanAccounts(0, UINT64_MAX)), ::testing::ElementsAre(2));
+  }
+  std::filesystem::remove_all(options.dir);
+}
+
+TEST(GroupDbTest, CheckpointsDuringCommitsLoseNone) {
+  constexpr int kThreads = 4;
+  constexpr int kCommitsPerThread = 50;
+  gendb::WalOptions options;
+  options.dir = (std::filesystem::temp_directory_path() /
+                 ("group_db_checkpoint_test_" + std::to_string(std::random_device{}())))
+                    .string();
+  options.sync = gendb::WalSyncPolicy::kNone;
+  const std::string checkpoint_path = options.dir + ".checkpoint";
+  std::filesystem::remove_all(options.dir);
+  {
+    Db db(options);
+    std::atomic<int> running = kThreads;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < kThreads; ++t) {
+      threads.emplace_back([&, t] {
+        for (int i = 0; i < kCommitsPerThread; ++i) {
+          auto writer = db.CreateWriter();
+          uint64_t id = 0;
+          ASSERT_TRUE(writer.NextAccountIdSequence(id).ok());
+          ASSERT_TRUE(
+              writer.PutAccount(id, AccountBuilder().set_account_id(id).set_age(t).Build()).ok());
+          writer.Commit();
+        }
+        --running;
+      });
+    }
+    do {
+      ASSERT_TRUE(db.WriteCheckpoint(checkpoint_path).ok());
+    } while (running > 0);
+    for (std::thread& thread : threads) {
+      thread.join();
+    }
+  }
+
+  Db db(checkpoint_path, options);
+  {
+    auto guard = db.SharedLock();
+    EXPECT_EQ(Ids(guard.ScanAccounts(0, UINT64_MAX)).size(), kThreads * kCommitsPerThread);
+    EXPECT_EQ(Ids(guard.GetAccountByAgeRange(0, kThreads)).size(), kThreads * kCommitsPerThread);
+  }
+  auto writer = db.CreateWriter();
+  uint64_t id = 0;
+  ASSERT_TRUE(writer.NextAccountIdSequence(id).ok());
+  EXPECT_EQ(id, kThreads * kCommitsPerThread + 1);
+  std::filesystem::remove_all(options.dir);
+  std::filesystem::remove(checkpoint_path);
+}
+
+}  // namespace
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <cstddef>
+
+namespace gendb::tests {
+
+// Counts heap allocations made by the current thread while the counter is alive. Linking
+// allocation_counter.cpp replaces the global operator new to make this possible.
+class ScopedAllocationCounter {
+ public:
+  ScopedAllocationCounter();
+
+  size_t count() const;
+
+ private:
+  size_t _start;
+};
+
+}  // namespace gendb::tests
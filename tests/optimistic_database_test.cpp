@@ -0,0 +1,214 @@
+#include "generated/optimistic_database.h"
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <filesystem>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "account.fbs.h"
+
+using namespace gendb::tests::optimistic;
+
+using gendb::tests::Account;
+using gendb::tests::AccountBuilder;
+using gendb::tests::AccountPatchBuilder;
+
+namespace {
+
+std::vector<uint64_t> Ids(gendb::Iterator<Account> it) {
+  std::vector<uint64_t> ids;
+  for (; it.Valid(); it.Next()) {
+    ids.push_back(it.Value().account_id());
+  }
+  return ids;
+}
+
+void PutAccount(Db& db, uint64_t id, int32_t age) {
+  auto writer = db.CreateWriter();
+  EXPECT_TRUE(writer.PutAccount(id, AccountBuilder().set_account_id(id).set_age(age).Build()).ok());
+  EXPECT_TRUE(writer.Commit().ok());
+}
+
+void UpdateAccount(Db& db, uint64_t id, const gendb::MessagePatch& update) {
+  auto writer = db.CreateWriter();
+  EXPECT_TRUE(writer.UpdateAccount(id, update).ok());
+  EXPECT_TRUE(writer.Commit().ok());
+}
+
+TEST(OptimisticDbTest, ReadsCommittedWrites) {
+  Db db;
+  {
+    auto writer = db.CreateWriter();
+    for (uint64_t id : {3, 1, 2}) {
+      EXPECT_TRUE(writer
+                      .PutAccount(id, AccountBuilder()
+                                          .set_account_id(id)
+                                          .set_age(static_cast<int32_t>(id * 10))
+                                          .set_name("v1")
+                                          .Build())
+                      .ok());
+    }
+    EXPECT_THAT(Ids(writer.GetAccountByAgeRange(0, 100)), ::testing::ElementsAre(1, 2, 3));
+    EXPECT_TRUE(writer.Commit().ok());
+    EXPECT_TRUE(writer.UpdateAccount(2, AccountPatchBuilder().set_age(5).Build()).ok());
+    EXPECT_THAT(Ids(writer.GetAccountByAgeRange(0, 100)), ::testing::ElementsAre(2, 1, 3));
+    EXPECT_TRUE(writer.Commit().ok());
+  }
+
+  auto guard = db.SharedLock();
+  Account account;
+  EXPECT_TRUE(guard.GetAccount(1, account).ok());
+  EXPECT_EQ(account.name(), "v1");
+  EXPECT_THAT(Ids(guard.ScanAccounts(0, 100)), ::testing::ElementsAre(1, 2, 3));
+  EXPECT_THAT(Ids(guard.GetAccountByAgeRange(0, 100)), ::testing::ElementsAre(2, 1, 3));
+  EXPECT_THAT(Ids(guard.GetAccountByAgeEqual(20)), ::testing::IsEmpty());
+}
+
+TEST(OptimisticDbTest, WriterReadsItsSnapshot) {
+  Db db;
+  PutAccount(db, 1, 10);
+  PutAccount(db, 2, 20);
+  auto writer = db.CreateWriter();
+  EXPECT_TRUE(writer.UpdateAccount(2, AccountPatchBuilder().set_age(30).Build()).ok());
+
+  // Writers do not wait for each other.
+  UpdateAccount(db, 1, AccountPatchBuilder().set_age(25).Build());
+  PutAccount(db, 3, 15);
+
+  Account account;
+  EXPECT_TRUE(writer.GetAccount(1, account).ok());
+  EXPECT_EQ(account.age(), 10);
+  EXPECT_EQ(writer.GetAccount(3, account).code(), absl::StatusCode::kNotFound);
+  EXPECT_THAT(Ids(writer.GetAccountByAgeRange(0, 100)), ::testing::ElementsAre(1, 2));
+  EXPECT_THAT(Ids(writer.GetAccountByAgeEqual(30)), ::testing::ElementsAre(2));
+  EXPECT_THAT(Ids(writer.GetAccountByAgeEqual(25)), ::testing::IsEmpty());
+}
+
+TEST(OptimisticDbTest, CommitAbortsWhenAReadKeyChanged) {
+  Db db;
+  PutAccount(db, 1, 10);
+  auto writer = db.CreateWriter();
+  Account account;
+  ASSERT_TRUE(writer.GetAccount(1, account).ok());
+  EXPECT_TRUE(writer.PutAccount(2, AccountBuilder().set_account_id(2).set_age(20).Build()).ok());
+
+  UpdateAccount(db, 1, AccountPatchBuilder().set_balance(5).Build());
+  EXPECT_EQ(writer.Commit().code(), absl::StatusCode::kAborted);
+  EXPECT_EQ(db.SharedLock().GetAccount(2, account).code(), absl::StatusCode::kNotFound);
+  EXPECT_THAT(Ids(db.SharedLock().GetAccountByAgeEqual(20)), ::testing::IsEmpty());
+
+  // The writer starts over from the latest state, so the retry goes through.
+  ASSERT_TRUE(writer.GetAccount(1, account).ok());
+  EXPECT_EQ(account.balance(), 5);
+  EXPECT_EQ(writer.GetAccount(2, account).code(), absl::StatusCode::kNotFound);
+  EXPECT_TRUE(writer.PutAccount(2, AccountBuilder().set_account_id(2).set_age(20).Build()).ok());
+  EXPECT_TRUE(writer.Commit().ok());
+  EXPECT_TRUE(db.SharedLock().GetAccount(2, account).ok());
+}
+
+TEST(OptimisticDbTest, BlindWritesDoNotConflict) {
+  Db db;
+  PutAccount(db, 1, 10);
+  auto writer = db.CreateWriter();
+  EXPECT_TRUE(writer.PutAccount(1, AccountBuilder().set_account_id(1).set_age(10).Build()).ok());
+  EXPECT_TRUE(writer.PutAccount(2, AccountBuilder().set_account_id(2).set_age(20).Build()).ok());
+
+  UpdateAccount(db, 1, AccountPatchBuilder().set_balance(5).Build());
+  EXPECT_TRUE(writer.Commit().ok());
+  Account account;
+  ASSERT_TRUE(db.SharedLock().GetAccount(1, account).ok());
+  EXPECT_EQ(account.balance(), 0);
+}
+
+TEST(OptimisticDbTest, CommitAbortsWhenAReadIndexRangeChanged) {
+  Db db;
+  PutAccount(db, 1, 10);
+  PutAccount(db, 2, 30);
+
+  // A message entering the range.
+  auto writer = db.CreateWriter();
+  EXPECT_THAT(Ids(writer.GetAccountByAgeRange(10, 20)), ::testing::ElementsAre(1));
+  PutAccount(db, 3, 15);
+  EXPECT_EQ(writer.Commit().code(), absl::StatusCode::kAborted);
+
+  // A message leaving it.
+  EXPECT_THAT(Ids(writer.GetAccountByAgeRange(10, 20)), ::testing::ElementsAre(1, 3));
+  UpdateAccount(db, 3, AccountPatchBuilder().set_age(40).Build());
+  EXPECT_EQ(writer.Commit().code(), absl::StatusCode::kAborted);
+
+  // A message in the range changing.
+  EXPECT_THAT(Ids(writer.GetAccountByAgeEqual(10)), ::testing::ElementsAre(1));
+  UpdateAccount(db, 1, AccountPatchBuilder().set_balance(5).Build());
+  EXPECT_EQ(writer.Commit().code(), absl::StatusCode::kAborted);
+
+  // Changes outside the range.
+  EXPECT_THAT(Ids(writer.GetAccountByAgeRange(10, 20)), ::testing::ElementsAre(1));
+  PutAccount(db, 4, 20);
+  UpdateAccount(db, 2, AccountPatchBuilder().set_balance(5).Build());
+  EXPECT_TRUE(writer.Commit().ok());
+}
+
+TEST(OptimisticDbTest, ConcurrentIncrementsAreSerialized) {
+  constexpr int kThreads = 8;
+  constexpr int kIncrementsPerThread = 100;
+  Db db;
+  PutAccount(db, 1, 10);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreads; ++t) {
+    threads.emplace_back([&] {
+      auto writer = db.CreateWriter();
+      for (int i = 0; i < kIncrementsPerThread;) {
+        Account account;
+        ASSERT_TRUE(writer.GetAccount(1, account).ok());
+        ASSERT_TRUE(writer
+                        .UpdateAccount(
+                            1, AccountPatchBuilder().set_balance(account.balance() + 1).Build())
+                        .ok());
+        absl::Status status = writer.Commit();
+        if (status.ok()) {
+          ++i;
+        } else {
+          ASSERT_EQ(status.code(), absl::StatusCode::kAborted);
+        }
+      }
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+
+  Account account;
+  ASSERT_TRUE(db.SharedLock().GetAccount(1, account).ok());
+  EXPECT_EQ(account.balance(), kThreads * kIncrementsPerThread);
+}
+
+TEST(OptimisticDbTest, WalDoesNotLogAbortedCommits) {
+  gendb::WalOptions options;
+  options.dir = (std::filesystem::temp_directory_path() /
+                 ("optimistic_db_wal_test_" + std::to_string(std::random_device{}())))
+                    .string();
+  std::filesystem::remove_all(options.dir);
+  {
+    Db db(options);
+    PutAccount(db, 1, 10);
+    auto writer = db.CreateWriter();
+    Account account;
+    ASSERT_TRUE(writer.GetAccount(1, account).ok());
+    EXPECT_TRUE(writer.PutAccount(2, AccountBuilder().set_account_id(2).set_age(20).Build()).ok());
+    UpdateAccount(db, 1, AccountPatchBuilder().set_balance(5).Build());
+    EXPECT_EQ(writer.Commit().code(), absl::StatusCode::kAborted);
+  }
+
+  Db db(options);
+  Account account;
+  ASSERT_TRUE(db.SharedLock().GetAccount(1, account).ok());
+  EXPECT_EQ(account.balance(), 5);
+  EXPECT_EQ(db.SharedLock().GetAccount(2, account).code(), absl::StatusCode::kNotFound);
+  EXPECT_THAT(Ids(db.SharedLock().GetAccountByAgeEqual(10)), ::testing::ElementsAre(1));
+  std::filesystem::remove_all(options.dir);
+}
+
+}  // namespace
@@ -0,0 +1,208 @@
+#include "generated/rcu_database.h"
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <filesystem>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "account.fbs.h"
+
+using namespace gendb::tests::rcu;
+
+using gendb::tests::Account;
+using gendb::tests::AccountBuilder;
+using gendb::tests::AccountPatchBuilder;
+
+namespace {
+
+std::vector<uint64_t> Ids(gendb::Iterator<Account> it) {
+  std::vector<uint64_t> ids;
+  for (; it.Valid(); it.Next()) {
+    ids.push_back(it.Value().account_id());
+  }
+  return ids;
+}
+
+TEST(RcuDbTest, ReadsCommittedWrites) {
+  Db db;
+  {
+    auto writer = db.CreateWriter();
+    for (uint64_t id : {3, 1, 2}) {
+      EXPECT_TRUE(writer
+                      .PutAccount(id, AccountBuilder()
+                                          .set_account_id(id)
+                                          .set_age(static_cast<int32_t>(id * 10))
+                                          .set_name("v1")
+                                          .Build())
+                      .ok());
+    }
+    // Not visible to readers before the commit.
+    Account account;
+    EXPECT_EQ(db.SharedLock().GetAccount(1, account).code(), absl::StatusCode::kNotFound);
+    EXPECT_THAT(Ids(writer.GetAccountByAgeRange(0, 100)), ::testing::ElementsAre(1, 2, 3));
+    writer.Commit();
+  }
+  {
+    auto writer = db.CreateWriter();
+    EXPECT_TRUE(writer.UpdateAccount(2, AccountPatchBuilder().set_age(5).Build()).ok());
+    writer.Commit();
+  }
+
+  auto guard = db.SharedLock();
+  Account account;
+  EXPECT_TRUE(guard.GetAccount(1, account).ok());
+  EXPECT_EQ(account.name(), "v1");
+  EXPECT_THAT(Ids(guard.ScanAccounts(0, 100)), ::testing::ElementsAre(1, 2, 3));
+  EXPECT_THAT(Ids(guard.GetAccountByAgeRange(0, 100)), ::testing::ElementsAre(2, 1, 3));
+  EXPECT_THAT(Ids(guard.GetAccountByAgeEqual(20)), ::testing::IsEmpty());
+}
+
+TEST(RcuDbTest, CommitsDoNotWaitForGuards) {
+  Db db;
+  {
+    auto writer = db.CreateWriter();
+    EXPECT_TRUE(
+        writer.PutAccount(1, AccountBuilder().set_account_id(1).set_name("v1").Build()).ok());
+    writer.Commit();
+  }
+  // With the locked commit mode this commit would deadlock on the open Guard.
+  auto guard = db.SharedLock();
+  Account before;
+  EXPECT_TRUE(guard.GetAccount(1, before).ok());
+  {
+    auto writer = db.CreateWriter();
+    EXPECT_TRUE(writer.UpdateAccount(1, AccountPatchBuilder().set_name("v2").Build()).ok());
+    EXPECT_TRUE(
+        writer.PutAccount(2, AccountBuilder().set_account_id(2).set_name("v2").Build()).ok());
+    writer.Commit();
+  }
+
+  // The Guard keeps reading the state it started with; messages read from it stay valid.
+  Account account;
+  EXPECT_EQ(before.name(), "v1");
+  EXPECT_TRUE(guard.GetAccount(1, account).ok());
+  EXPECT_EQ(account.name(), "v1");
+  EXPECT_EQ(guard.GetAccount(2, account).code(), absl::StatusCode::kNotFound);
+  EXPECT_TRUE(db.SharedLock().GetAccount(1, account).ok());
+  EXPECT_EQ(account.name(), "v2");
+}
+
+TEST(RcuDbTest, SnapshotOutlivesLaterCommits) {
+  Db db;
+  auto put_account = [&](uint64_t id, int32_t age) {
+    auto writer = db.CreateWriter();
+    EXPECT_TRUE(
+        writer.PutAccount(id, AccountBuilder().set_account_id(id).set_age(age).Build()).ok());
+    writer.Commit();
+  };
+  put_account(1, 20);
+  auto snapshot = db.Snapshot();
+  EXPECT_EQ(snapshot.sequence(), 1);
+  for (uint64_t id = 2; id < 100; ++id) {
+    put_account(id, 20);
+  }
+  EXPECT_THAT(Ids(snapshot.GetAccountByAgeEqual(20)), ::testing::ElementsAre(1));
+  EXPECT_EQ(db.Snapshot().sequence(), 99);
+  EXPECT_EQ(Ids(db.SharedLock().GetAccountByAgeEqual(20)).size(), 99);
+}
+
+TEST(RcuDbTest, WriterStaysUsableAfterCommit) {
+  Db db;
+  auto writer = db.CreateWriter();
+  uint64_t first_id = 0;
+  EXPECT_TRUE(writer.NextAccountIdSequence(first_id).ok());
+  EXPECT_TRUE(writer.PutAccount(first_id, AccountBuilder().set_account_id(first_id).Build()).ok());
+  writer.Commit();
+  uint64_t second_id = 0;
+  EXPECT_TRUE(writer.NextAccountIdSequence(second_id).ok());
+  EXPECT_EQ(second_id, first_id + 1);
+  EXPECT_TRUE(
+      writer.PutAccount(second_id, AccountBuilder().set_account_id(second_id).Build()).ok());
+  writer.Commit();
+  EXPECT_THAT(Ids(db.SharedLock().ScanAccounts(0, 100)),
+              ::testing::ElementsAre(first_id, second_id));
+}
+
+TEST(RcuDbTest, ReadersSeeConsistentStateDuringCommits) {
+  // Every commit moves one unit of balance between two accounts; readers must always see the
+  // total unchanged, in point reads and index scans alike.
+  constexpr float kTotal = 1000;
+  Db db;
+  {
+    auto writer = db.CreateWriter();
+    EXPECT_TRUE(writer
+                    .PutAccount(1, AccountBuilder()
+                                       .set_account_id(1)
+                                       .set_age(1)
+                                       .set_balance(kTotal)
+                                       .Build())
+                    .ok());
+    EXPECT_TRUE(
+        writer.PutAccount(2, AccountBuilder().set_account_id(2).set_age(1).set_balance(0).Build())
+            .ok());
+    writer.Commit();
+  }
+
+  std::atomic<bool> done = false;
+  std::thread writer_thread([&] {
+    for (int i = 1; i <= 2000; ++i) {
+      auto writer = db.CreateWriter();
+      const float moved = static_cast<float>(i % 100);
+      EXPECT_TRUE(writer.UpdateAccount(1, AccountPatchBuilder().set_balance(kTotal - moved).Build())
+                      .ok());
+      EXPECT_TRUE(writer.UpdateAccount(2, AccountPatchBuilder().set_balance(moved).Build()).ok());
+      writer.Commit();
+    }
+    done = true;
+  });
+  std::vector<std::thread> readers;
+  for (int r = 0; r < 4; ++r) {
+    readers.emplace_back([&] {
+      while (!done) {
+        auto guard = db.SharedLock();
+        Account a;
+        Account b;
+        ASSERT_TRUE(guard.GetAccount(1, a).ok());
+        std::this_thread::yield();
+        ASSERT_TRUE(guard.GetAccount(2, b).ok());
+        EXPECT_EQ(a.balance() + b.balance(), kTotal);
+
+        float scanned = 0;
+        for (auto it = guard.GetAccountByAgeEqual(1); it.Valid(); it.Next()) {
+          scanned += it.Value().balance();
+        }
+        EXPECT_EQ(scanned, kTotal);
+      }
+    });
+  }
+  writer_thread.join();
+  for (std::thread& reader : readers) {
+    reader.join();
+  }
+}
+
+TEST(RcuDbTest, WalRecoversCommitsOnOpen) {
+  gendb::WalOptions options;
+  options.dir = (std::filesystem::temp_directory_path() /
+                 ("rcu_db_wal_test_" + std::to_string(std::random_device{}())))
+                    .string();
+  std::filesystem::remove_all(options.dir);
+  {
+    Db db(options);
+    auto writer = db.CreateWriter();
+    for (uint64_t id : {1, 2}) {
+      EXPECT_TRUE(writer.PutAccount(id, AccountBuilder().set_account_id(id).Build()).ok());
+      writer.Commit();
+    }
+  }
+
+  Db db(options);
+  EXPECT_THAT(Ids(db.SharedLock().ScanAccounts(0, 100)), ::testing::ElementsAre(1, 2));
+  std::filesystem::remove_all(options.dir);
+}
+
+}  // namespace
@@ -0,0 +1,159 @@
+#include "generated/storage_index_database.h"
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <filesystem>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "account.fbs.h"
+#include "position.fbs.h"
+
+using namespace gendb::tests::storage_index;
+
+using gendb::tests::Account;
+using gendb::tests::AccountBuilder;
+using gendb::tests::AccountPatchBuilder;
+using gendb::tests::PositionBuilder;
+
+namespace {
+
+std::vector<uint64_t> Ids(gendb::Iterator<Account> it) {
+  std::vector<uint64_t> ids;
+  for (; it.Valid(); it.Next()) {
+    ids.push_back(it.Value().account_id());
+  }
+  return ids;
+}
+
+void PutAccount(Db& db, uint64_t id, int32_t age) {
+  auto writer = db.CreateWriter();
+  EXPECT_TRUE(writer.PutAccount(id, AccountBuilder().set_account_id(id).set_age(age).Build()).ok());
+  writer.Commit();
+}
+
+void SetAge(Db& db, uint64_t id, int32_t age) {
+  auto writer = db.CreateWriter();
+  EXPECT_TRUE(writer.UpdateAccount(id, AccountPatchBuilder().set_age(age).Build()).ok());
+  writer.Commit();
+}
+
+std::string TempPath(const std::string& name) {
+  return (std::filesystem::temp_directory_path() /
+          (name + "_" + std::to_string(std::random_device{}())))
+      .string();
+}
+
+TEST(StorageIndexDbTest, IndicesAreCollectionsAfterTheSchemas) {
+  EXPECT_EQ(AccountByAgeIndexCollId, ConfigCollId + 1);
+  EXPECT_EQ(PositionByAccountIdIndexCollId, ConfigCollId + 2);
+  EXPECT_EQ(Db::kCollectionTuning.size(), PositionByAccountIdIndexCollId + 1);
+}
+
+TEST(StorageIndexDbTest, ScansReadRecordsInSecondaryKeyOrder) {
+  Db db;
+  PutAccount(db, 3, 30);
+  PutAccount(db, 1, 20);
+  PutAccount(db, 2, 20);
+  PutAccount(db, 4, 40);
+
+  auto guard = db.SharedLock();
+  // Ties in the secondary key are in primary key order.
+  EXPECT_THAT(Ids(guard.GetAccountByAgeRange(20, 40)), testing::ElementsAre(1, 2, 3));
+  EXPECT_THAT(Ids(guard.GetAccountByAgeEqual(20)), testing::ElementsAre(1, 2));
+  EXPECT_THAT(Ids(guard.GetAccountByAgeEqual(25)), testing::IsEmpty());
+}
+
+TEST(StorageIndexDbTest, PutsAndUpdatesMoveTheRecords) {
+  Db db;
+  PutAccount(db, 1, 20);
+  PutAccount(db, 2, 30);
+  SetAge(db, 1, 50);
+  // Replaces the message: the record of its previous age goes.
+  PutAccount(db, 2, 10);
+  {
+    auto writer = db.CreateWriter();
+    // Leaves the age alone.
+    EXPECT_TRUE(writer.UpdateAccount(1, AccountPatchBuilder().set_name("Anna").Build()).ok());
+    writer.Commit();
+  }
+
+  auto guard = db.SharedLock();
+  EXPECT_THAT(Ids(guard.GetAccountByAgeRange(0, 100)), testing::ElementsAre(2, 1));
+  EXPECT_THAT(Ids(guard.GetAccountByAgeEqual(20)), testing::IsEmpty());
+  EXPECT_THAT(Ids(guard.GetAccountByAgeEqual(30)), testing::IsEmpty());
+}
+
+TEST(StorageIndexDbTest, WriterReadsItsStagedRecordsOverTheCommittedOnes) {
+  Db db;
+  PutAccount(db, 1, 20);
+  PutAccount(db, 2, 30);
+
+  auto writer = db.CreateWriter();
+  EXPECT_TRUE(writer.PutAccount(3, AccountBuilder().set_account_id(3).set_age(25).Build()).ok());
+  EXPECT_TRUE(writer.UpdateAccount(1, AccountPatchBuilder().set_age(40).Build()).ok());
+  EXPECT_THAT(Ids(writer.GetAccountByAgeRange(0, 100)), testing::ElementsAre(3, 2, 1));
+  EXPECT_THAT(Ids(writer.GetAccountByAgeEqual(20)), testing::IsEmpty());
+  EXPECT_THAT(Ids(db.SharedLock().GetAccountByAgeRange(0, 100)), testing::ElementsAre(1, 2));
+
+  writer.Commit();
+  EXPECT_THAT(Ids(db.SharedLock().GetAccountByAgeRange(0, 100)), testing::ElementsAre(3, 2, 1));
+}
+
+TEST(StorageIndexDbTest, WriterReadsRecordsOfAsyncCommits) {
+  Db db;
+  {
+    auto writer = db.CreateWriter();
+    EXPECT_TRUE(
+        writer.PutPosition(7, PositionBuilder().set_position_id(7).set_account_id(1).Build()).ok());
+    writer.CommitAsync();
+  }
+  auto writer = db.CreateWriter();
+  auto it = writer.GetPositionByAccountIdEqual(1);
+  ASSERT_TRUE(it.Valid());
+  EXPECT_EQ(it.Value().position_id(), 7);
+}
+
+TEST(StorageIndexDbTest, SnapshotScansIgnoreLaterCommits) {
+  Db db;
+  PutAccount(db, 1, 20);
+  PutAccount(db, 2, 30);
+
+  auto snapshot = db.Snapshot();
+  SetAge(db, 1, 50);
+  PutAccount(db, 3, 25);
+
+  EXPECT_THAT(Ids(snapshot.GetAccountByAgeRange(20, 31)), testing::ElementsAre(1, 2));
+  EXPECT_THAT(Ids(db.SharedLock().GetAccountByAgeRange(20, 31)), testing::ElementsAre(3, 2));
+}
+
+TEST(StorageIndexDbTest, RecordsAreRecoveredFromTheWalAndCheckpoints) {
+  gendb::WalOptions options;
+  options.dir = TempPath("storage_index_db_test");
+  const std::string checkpoint_path = options.dir + ".checkpoint";
+  std::filesystem::remove_all(options.dir);
+  {
+    Db db(options);
+    PutAccount(db, 1, 20);
+    PutAccount(db, 2, 30);
+    ASSERT_TRUE(db.WriteCheckpoint(checkpoint_path).ok());
+    // Logged after the checkpoint.
+    SetAge(db, 1, 40);
+    PutAccount(db, 3, 10);
+  }
+  {
+    // The checkpoint alone.
+    Db db(checkpoint_path);
+    EXPECT_THAT(Ids(db.SharedLock().GetAccountByAgeRange(0, 100)), testing::ElementsAre(1, 2));
+  }
+
+  Db db(checkpoint_path, options);
+  EXPECT_THAT(Ids(db.SharedLock().GetAccountByAgeRange(0, 100)), testing::ElementsAre(3, 2, 1));
+  EXPECT_THAT(Ids(db.SharedLock().GetAccountByAgeEqual(20)), testing::IsEmpty());
+  std::filesystem::remove_all(options.dir);
+  std::filesystem::remove(checkpoint_path);
+}
+
+}  // namespace